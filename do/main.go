@@ -173,6 +173,7 @@ func main() {
 	// ad-hoc flags to be set manually (to show less options)
 	var (
 		flgGenTranslationsInfoCpp = false
+		flgGenTranslationsBin     = false
 		flgCppCheck               = false
 		flgCppCheckAll            = false
 		flgClangTidy              = false
@@ -223,6 +224,7 @@ func main() {
 		flag.BoolVar(&flgWc, "wc", false, "show loc stats (like wc -l)")
 		flag.BoolVar(&flgTransDownload, "trans-dl", false, "download latest translations to src/docs/translations.txt")
 		//flag.BoolVar(&flgGenTranslationsInfoCpp, "trans-gen-info", false, "generate src/TranslationLangs.cpp")
+		flag.BoolVar(&flgGenTranslationsBin, "trans-gen-bin", false, "generate src/docs/translations.bin from src/docs/translations.txt")
 		flag.BoolVar(&flgClean, "clean", false, "clean the build (remove out/ files except for settings)")
 		flag.BoolVar(&flgCheckAccessKeys, "check-access-keys", false, "check access keys for menu items")
 		//flag.BoolVar(&flgBuildNo, "build-no", false, "print build number")
@@ -363,6 +365,11 @@ func main() {
 		return
 	}
 
+	if flgGenTranslationsBin {
+		genTranslationsBin()
+		return
+	}
+
 	if flgBuildLzsa {
 		buildLzsa()
 		return
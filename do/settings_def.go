@@ -92,6 +92,8 @@ var (
 			"horizontal and vertical distance between two pages in facing and book view modes").setStructName("Size"),
 		mkField("CbxMangaMode", Bool, false,
 			"if true, default to displaying Comic Book files in manga mode (from right to left if showing 2 pages at a time)"),
+		mkField("ImageScaling", String, "lanczos",
+			"how images are scaled for display (lanczos, bicubic, gdiplus). lanczos is the sharpest, gdiplus uses Windows' own scaling").setExpert().setVersion("3.5"),
 	}
 
 	chmUI = []*Field{
@@ -157,6 +159,9 @@ var (
 			"Hex encoded MD5 fingerprint of file content (32 chars) followed by "+
 				"crypt key (64 chars) - only applies for PDF documents").setDoc("data required to open a password protected document without having to " +
 			"ask for the password again"),
+		mkField("Fingerprint", String, nil,
+			"Hex encoded fingerprint of file content (32 chars) as used for the keys "+
+				"of cached tiles, text and layouts, updated whenever the document is opened").setVersion("3.5"),
 		mkField("UseDefaultState", Bool, false,
 			"if true, we use global defaults when opening this file (instead of "+
 				"the values below)"),
@@ -348,6 +353,42 @@ var (
 		mkField("CustomScreenDPI", Int, 0,
 			"actual resolution of the main screen in DPI (if this value "+
 				"isn't positive, the system's UI setting is used)").setExpert().setVersion("2.5"),
+		mkField("RenderThreads", Int, 0,
+			"number of threads used for rendering pages (if this value "+
+				"isn't positive, the number of processor cores minus one is used)").setExpert().setVersion("3.5"),
+		mkField("JpxDecodeThreads", Int, 0,
+			"number of threads used for decoding a JPEG 2000 image (if this value "+
+				"isn't positive, the cores not used by the other rendering threads are used)").setExpert().setVersion("3.5"),
+		mkField("RenderInWorkerProcesses", Bool, false,
+			"if true, PDF, XPS and other MuPDF documents are rendered in separate helper processes, one per "+
+				"rendering thread, so that a crash in a damaged document doesn't close the viewer").setExpert().setVersion("3.5"),
+		mkField("RenderCacheSize", Int, 0,
+			"maximum amount of memory (in MB) used for caching rendered pages (if this value "+
+				"isn't positive, it's based on the amount of physical memory)").setExpert().setVersion("3.5"),
+		mkField("TileCacheSize", Int, 0,
+			"maximum amount of disk space (in MB) used for saving rendered pages, so that documents "+
+				"show up faster when they're opened again (if this value isn't positive, rendered pages "+
+				"aren't saved)").setExpert().setVersion("3.5"),
+		mkField("HibernateTabsAfter", Int, 0,
+			"number of minutes after which documents in background tabs are unloaded to free memory "+
+				"(they're reloaded when the tab is selected again; if this value isn't positive, "+
+				"documents are never unloaded)").setExpert().setVersion("3.5"),
+		mkField("IdleTasksCpuUsage", Int, 50,
+			"percentage of the time (of one processor core) used for preparing the text and the content boxes "+
+				"of open documents while the computer isn't used and isn't running on battery (if this value "+
+				"isn't positive, they're only prepared when needed)").setExpert().setVersion("3.5"),
+		mkField("IdleTasksMemoryLimit", Int, 0,
+			"amount of memory (in MB) above which preparing open documents pauses (if this value "+
+				"isn't positive, it's based on the amount of physical memory)").setExpert().setVersion("3.5"),
+		mkField("EbookTextRendering", String, "gdiplus",
+			"how text of EPUB, FB2, MOBI and other ebooks is laid out and drawn (gdiplus, directwrite). "+
+				"directwrite uses DirectWrite and Direct2D, which can draw with the GPU").setExpert().setVersion("3.5"),
+		mkField("GpuPagePainting", Bool, false,
+			"if true, rendered pages are painted with Direct2D, which can use the GPU for scaling "+
+				"them (not used in remote desktop sessions)").setExpert().setVersion("3.5"),
+		mkField("VectorPrinting", Bool, false,
+			"if true, PDF, XPS and similar documents are printed as vector graphics instead of bitmaps "+
+				"where possible, which makes print jobs of text documents much smaller").setExpert().setVersion("3.5"),
 		mkEmptyLine(),
 
 		// file history and favorites
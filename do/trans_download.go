@@ -87,5 +87,6 @@ func downloadTranslations() bool {
 	writeFileMust(translationsTxtPath, d)
 	fmt.Printf("Wrote response of size %d to %s\n", len(d), translationsTxtPath)
 	printSusTranslations(d)
+	genTranslationsBin()
 	return false
 }
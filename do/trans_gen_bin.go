@@ -0,0 +1,215 @@
+package main
+
+import (
+	"bytes"
+	"encoding/binary"
+	"path/filepath"
+	"sort"
+	"strings"
+)
+
+// translations.bin is translations.txt compiled into a form that SumatraPDF
+// uses directly from the resource section (see Translations.cpp).
+// All numbers are little-endian u32 (or i32):
+//
+//	magic, nStrings, nLangs
+//	disp[nStrings]    displacements of a minimal perfect hash of the english strings
+//	strs[nStrings]    offset of the english string in each hash slot
+//	nLangs times:
+//	  langCode        offset of the language code
+//	  trans[nStrings] offset of the translation in each hash slot (0 if untranslated)
+//	pool              zero-terminated utf-8 strings, offsets are relative to its start
+var translationsBinPath = filepath.Join("src", "docs", "translations.bin")
+
+const transBinMagic = 0x534e5254 // "TRNS"
+
+// must match TransHash() in Translations.cpp
+func transHash(d uint32, s string) uint32 {
+	if d == 0 {
+		d = 0x01000193
+	}
+	for i := 0; i < len(s); i++ {
+		d = (d * 0x01000193) ^ uint32(s[i])
+	}
+	return d
+}
+
+// translations.txt escapes tabs and newlines
+func transUnescape(s string) string {
+	var sb strings.Builder
+	for i := 0; i < len(s); i++ {
+		c := s[i]
+		if c != '\\' || i+1 >= len(s) {
+			sb.WriteByte(c)
+			continue
+		}
+		i++
+		switch s[i] {
+		case 't':
+			sb.WriteByte('\t')
+		case 'n':
+			sb.WriteByte('\n')
+		case 'r':
+			sb.WriteByte('\r')
+		default:
+			sb.WriteByte(s[i])
+		}
+	}
+	return sb.String()
+}
+
+// returns displacements and the index of the key in each slot
+// http://stevehanov.ca/blog/index.php?id=119
+func buildMinimalPerfectHash(keys []string) ([]int32, []int) {
+	n := len(keys)
+	buckets := make([][]int, n)
+	for i, k := range keys {
+		b := transHash(0, k) % uint32(n)
+		buckets[b] = append(buckets[b], i)
+	}
+	order := make([]int, n)
+	for i := range order {
+		order[i] = i
+	}
+	sort.SliceStable(order, func(i, j int) bool {
+		return len(buckets[order[i]]) > len(buckets[order[j]])
+	})
+
+	disp := make([]int32, n)
+	slots := make([]int, n)
+	for i := range slots {
+		slots[i] = -1
+	}
+	idx := 0
+	for ; idx < n; idx++ {
+		b := order[idx]
+		if len(buckets[b]) <= 1 {
+			break
+		}
+		for d := uint32(1); ; d++ {
+			var used []uint32
+			ok := true
+			for _, ki := range buckets[b] {
+				slot := transHash(d, keys[ki]) % uint32(n)
+				if slots[slot] != -1 {
+					ok = false
+					break
+				}
+				for _, u := range used {
+					if u == slot {
+						ok = false
+					}
+				}
+				if !ok {
+					break
+				}
+				used = append(used, slot)
+			}
+			if !ok {
+				continue
+			}
+			for i, ki := range buckets[b] {
+				slots[used[i]] = ki
+			}
+			disp[b] = int32(d)
+			break
+		}
+	}
+	// buckets with a single key go directly into a free slot
+	free := 0
+	for ; idx < n; idx++ {
+		b := order[idx]
+		if len(buckets[b]) == 0 {
+			break
+		}
+		for slots[free] != -1 {
+			free++
+		}
+		slots[free] = buckets[b][0]
+		disp[b] = -int32(free) - 1
+	}
+	return disp, slots
+}
+
+func genTranslationsBin() {
+	d := readFileMust(translationsTxtPath)
+	lines := strings.Split(string(d), "\n")[2:]
+	lines = trimEmptyLinesFromEnd(lines)
+
+	var keys []string
+	var langCodes []string
+	// translations[langCode][key index]
+	translations := map[string]map[int]string{}
+	seen := map[string]bool{}
+	for _, l := range lines {
+		if len(l) == 0 {
+			continue
+		}
+		if l[0] == ':' {
+			key := transUnescape(l[1:])
+			panicIf(seen[key], "duplicate string '%s'", key)
+			seen[key] = true
+			keys = append(keys, key)
+			continue
+		}
+		panicIf(len(keys) == 0)
+		parts := strings.SplitN(l, ":", 2)
+		panicIf(len(parts) != 2, "Invalid line: '%s'", l)
+		lang, trans := parts[0], parts[1]
+		m := translations[lang]
+		if m == nil {
+			m = map[int]string{}
+			translations[lang] = m
+			langCodes = append(langCodes, lang)
+		}
+		ki := len(keys) - 1
+		// the first translation wins
+		if _, ok := m[ki]; !ok {
+			m[ki] = transUnescape(trans)
+		}
+	}
+	sort.Strings(langCodes)
+
+	var pool bytes.Buffer
+	offsets := map[string]uint32{}
+	poolOffset := func(s string) uint32 {
+		if off, ok := offsets[s]; ok {
+			return off
+		}
+		off := uint32(pool.Len())
+		pool.WriteString(s)
+		pool.WriteByte(0)
+		offsets[s] = off
+		return off
+	}
+	// offset 0 is the empty string, for "untranslated"
+	poolOffset("")
+
+	disp, slots := buildMinimalPerfectHash(keys)
+	n := len(keys)
+	var res []uint32
+	res = append(res, transBinMagic, uint32(n), uint32(len(langCodes)))
+	for _, v := range disp {
+		res = append(res, uint32(v))
+	}
+	for _, ki := range slots {
+		res = append(res, poolOffset(keys[ki]))
+	}
+	for _, lang := range langCodes {
+		res = append(res, poolOffset(lang))
+		m := translations[lang]
+		for _, ki := range slots {
+			var off uint32
+			if trans, ok := m[ki]; ok && trans != "" {
+				off = poolOffset(trans)
+			}
+			res = append(res, off)
+		}
+	}
+
+	var buf bytes.Buffer
+	must(binary.Write(&buf, binary.LittleEndian, res))
+	buf.Write(pool.Bytes())
+	writeFileMust(translationsBinPath, buf.Bytes())
+	logf(ctx(), "Wrote %s: %d strings, %d languages, %d bytes\n", translationsBinPath, n, len(langCodes), buf.Len())
+}
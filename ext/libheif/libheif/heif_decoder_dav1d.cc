@@ -44,6 +44,14 @@ struct dav1d_decoder
 
 static const char kEmptyString[] = "";
 
+// SumatraPDF: set with heif_dav1d_set_max_threads(), 0 is dav1d's default (all logical cores)
+static int dav1d_max_threads = 0;
+
+void heif_dav1d_set_max_threads(int max_threads)
+{
+  dav1d_max_threads = max_threads;
+}
+
 static const int DAV1D_PLUGIN_PRIORITY = 150;
 
 #define MAX_PLUGIN_NAME_LENGTH 80
@@ -94,6 +102,10 @@ struct heif_error dav1d_new_decoder(void** dec)
 
   decoder->settings.frame_size_limit = MAX_IMAGE_WIDTH * MAX_IMAGE_HEIGHT;
   decoder->settings.all_layers = 0;
+  // SumatraPDF: images are single frames, so only tile and row threads help
+  // and waiting for more frames to be queued would only add latency
+  decoder->settings.n_threads = dav1d_max_threads;
+  decoder->settings.max_frame_delay = 1;
 
   if (dav1d_open(&decoder->context, &decoder->settings) != 0) {
     struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kSuccess};
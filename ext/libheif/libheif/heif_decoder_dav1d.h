@@ -23,4 +23,7 @@
 
 const struct heif_decoder_plugin* get_decoder_plugin_dav1d();
 
+// SumatraPDF: number of threads for decoding an image, 0 for all logical cores
+void heif_dav1d_set_max_threads(int max_threads);
+
 #endif
@@ -105,6 +105,20 @@ static pdf_fontlistMS fontlistMS = {
 static int did_init = 0;
 static CRITICAL_SECTION cs_fonts;
 
+// if set, the list of system fonts is saved there so that the fonts
+// directory doesn't have to be scanned again at the next start
+static WCHAR font_list_cache_path[MAX_PATH] = {0};
+
+#define FONT_LIST_CACHE_MAGIC "SPDFFNT1"
+
+typedef struct {
+    char magic[8];
+    DWORD entry_size;
+    DWORD len;
+    // the list is only valid as long as the fonts directory doesn't change
+    FILETIME font_dir_time;
+} font_list_cache_header;
+
 static inline USHORT BEtoHs(USHORT x) {
     BYTE* data = (BYTE*)&x;
     return (data[0] << 8) | data[1];
@@ -456,6 +470,92 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
     FindClose(hList);
 }
 
+static int get_dir_time(const WCHAR* dir, FILETIME* time) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(dir, GetFileExInfoStandard, &data))
+        return 0;
+    *time = data.ftLastWriteTime;
+    return 1;
+}
+
+static int load_font_list_cache(const FILETIME* font_dir_time) {
+    font_list_cache_header hdr;
+    sys_font_info* fontmap = NULL;
+    LARGE_INTEGER size;
+    DWORD n, len;
+    int ok = 0;
+
+    if (!font_list_cache_path[0])
+        return 0;
+    HANDLE h = CreateFileW(font_list_cache_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return 0;
+    if (!GetFileSizeEx(h, &size) || !ReadFile(h, &hdr, sizeof(hdr), &n, NULL) || n != sizeof(hdr))
+        goto Exit;
+    if (memcmp(hdr.magic, FONT_LIST_CACHE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.entry_size != sizeof(sys_font_info))
+        goto Exit;
+    if (CompareFileTime(&hdr.font_dir_time, font_dir_time) != 0)
+        goto Exit;
+    len = hdr.len;
+    // also catches files that have been cut short
+    if (len == 0 || size.QuadPart != (LONGLONG)sizeof(hdr) + (LONGLONG)len * sizeof(sys_font_info))
+        goto Exit;
+    fontmap = (sys_font_info*)malloc(len * sizeof(sys_font_info));
+    if (!fontmap)
+        goto Exit;
+    if (!ReadFile(h, fontmap, len * sizeof(sys_font_info), &n, NULL) || n != len * sizeof(sys_font_info))
+        goto Exit;
+    for (DWORD i = 0; i < len; i++) {
+        fontmap[i].fontface[MAX_FACENAME - 1] = '\0';
+        fontmap[i].fontpath[MAX_PATH - 1] = '\0';
+    }
+    free(fontlistMS.fontmap);
+    fontlistMS.fontmap = fontmap;
+    fontlistMS.len = (int)len;
+    fontlistMS.cap = (int)len;
+    fontmap = NULL;
+    ok = 1;
+Exit:
+    free(fontmap);
+    CloseHandle(h);
+    return ok;
+}
+
+static void save_font_list_cache(const FILETIME* font_dir_time) {
+    font_list_cache_header hdr;
+    DWORD n, size;
+    BOOL ok;
+
+    if (!font_list_cache_path[0] || fontlistMS.len == 0)
+        return;
+    HANDLE h = CreateFileW(font_list_cache_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND) {
+        WCHAR dir[MAX_PATH];
+        WCHAR* sep;
+        wcscpy_s(dir, MAX_PATH, font_list_cache_path);
+        sep = wcsrchr(dir, '\\');
+        if (sep) {
+            *sep = '\0';
+            CreateDirectoryW(dir, NULL);
+            h = CreateFileW(font_list_cache_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        }
+    }
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FONT_LIST_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.entry_size = sizeof(sys_font_info);
+    hdr.len = (DWORD)fontlistMS.len;
+    hdr.font_dir_time = *font_dir_time;
+    size = (DWORD)fontlistMS.len * sizeof(sys_font_info);
+    ok = WriteFile(h, &hdr, sizeof(hdr), &n, NULL) && n == sizeof(hdr);
+    ok = ok && WriteFile(h, fontlistMS.fontmap, size, &n, NULL) && n == size;
+    CloseHandle(h);
+    if (!ok)
+        DeleteFileW(font_list_cache_path);
+}
+
 // cf. https://blogs.msdn.com/b/oldnewthing/archive/2004/10/25/247180.aspx
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define CURRENT_HMODULE ((HMODULE)&__ImageBase)
@@ -466,8 +566,16 @@ static void create_system_font_list(fz_context* ctx) {
 
     cch = GetWindowsDirectory(szFontDir, nelem(szFontDir) - 12);
     if (0 < cch && cch < nelem(szFontDir) - 12) {
-        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts\\*.?t?");
-        extend_system_font_list(ctx, szFontDir);
+        FILETIME font_dir_time;
+        int has_time;
+        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts");
+        has_time = get_dir_time(szFontDir, &font_dir_time);
+        if (!has_time || !load_font_list_cache(&font_dir_time)) {
+            wcscat_s(szFontDir, MAX_PATH, L"\\*.?t?");
+            extend_system_font_list(ctx, szFontDir);
+            if (has_time)
+                save_font_list_cache(&font_dir_time);
+        }
     }
 
     if (fontlistMS.len == 0)
@@ -516,66 +624,128 @@ static void* fz_resize_array(fz_context* ctx, void* p, unsigned int count, unsig
     return np;
 }
 
-typedef struct cached_font {
-    struct cached_font* next;
+// the data of loaded font files is shared by all fz_contexts (one per document)
+// and kept after the last font using it is gone, up to MAX_UNUSED_FONT_DATA
+#define MAX_UNUSED_FONT_DATA (32 * 1024 * 1024)
+
+typedef struct shared_font_data {
+    struct shared_font_data* next;
     sys_font_info* fi;
-    fz_context* ctx;
-    fz_buffer* buffer;
-} cached_font;
+    unsigned char* data;
+    size_t len;
+    // number of fz_buffers using it
+    int refs;
+} shared_font_data;
+
+// most recently loaded first. guarded by cs_fonts
+static shared_font_data* shared_fonts = 0;
+
+static unsigned char* read_font_file(const char* path, size_t* len_out) {
+    WCHAR pathW[MAX_PATH];
+    LARGE_INTEGER size;
+    unsigned char* data = NULL;
+    DWORD n;
+
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, pathW, nelem(pathW)))
+        return NULL;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (GetFileSizeEx(h, &size) && size.QuadPart > 0 && size.QuadPart < 0x7fffffff) {
+        data = (unsigned char*)malloc((size_t)size.QuadPart);
+        if (data && (!ReadFile(h, data, (DWORD)size.QuadPart, &n, NULL) || n != (DWORD)size.QuadPart)) {
+            free(data);
+            data = NULL;
+        }
+    }
+    CloseHandle(h);
+    *len_out = data ? (size_t)size.QuadPart : 0;
+    return data;
+}
+
+// must be called with cs_fonts held
+static void free_unused_font_data(void) {
+    size_t unused = 0;
+    shared_font_data** currp = &shared_fonts;
+    while (*currp) {
+        shared_font_data* curr = *currp;
+        if (curr->refs == 0) {
+            unused += curr->len;
+            if (unused > MAX_UNUSED_FONT_DATA) {
+                *currp = curr->next;
+                free(curr->data);
+                free(curr);
+                continue;
+            }
+        }
+        currp = &curr->next;
+    }
+}
 
-static cached_font* cached_fonts = 0;
+// returns font data with a reference that must be released with release_font_data()
+static shared_font_data* get_font_data(fz_context* ctx, sys_font_info* fi) {
+    shared_font_data* sf;
+    unsigned char* data;
+    size_t len;
 
-static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
     EnterCriticalSection(&cs_fonts);
-    cached_font* f = cached_fonts;
-    fz_buffer* buffer = NULL;
-    while (f) {
-        if (f->ctx == ctx && f->fi == fi) {
-            buffer = f->buffer;
-            break;
+    for (sf = shared_fonts; sf; sf = sf->next) {
+        if (sf->fi == fi) {
+            sf->refs++;
+            LeaveCriticalSection(&cs_fonts);
+            return sf;
         }
-        f = f->next;
     }
     LeaveCriticalSection(&cs_fonts);
-    return buffer;
-}
 
-void drop_cached_fonts_for_ctx(fz_context* ctx) {
-    EnterCriticalSection(&cs_fonts);
+    // don't block other threads while reading the file
+    data = read_font_file(fi->fontpath, &len);
+    if (!data)
+        return NULL;
+    fz_warn(ctx, "loading non-embedded font '%s' from '%s'", fi->fontface, fi->fontpath);
 
-    cached_font** currp = &cached_fonts;
-    cached_font** nextp;
-    cached_font* curr;
-    cached_font* next;
-    int refs;
-    while (1) {
-        curr = *currp;
-        if (!curr) {
+    EnterCriticalSection(&cs_fonts);
+    // another thread might've read the same file in the meantime
+    for (sf = shared_fonts; sf; sf = sf->next) {
+        if (sf->fi == fi)
             break;
-        }
-        nextp = &(curr->next);
-        if (curr->ctx == ctx) {
-            next = *nextp;
-            refs = curr->buffer->refs;
-            if (refs != 1) {
-                // TODO: crash?
-                fz_warn(ctx, "drop_cached_fonts_for_ctx: bad refcount %d", refs);
-            }
-            fz_drop_buffer(curr->ctx, curr->buffer);
-            free(curr);
-            *currp = next;
-        } else {
-            currp = nextp;
-        }
     }
+    if (sf) {
+        free(data);
+    } else {
+        sf = (shared_font_data*)malloc(sizeof(shared_font_data));
+        if (!sf) {
+            LeaveCriticalSection(&cs_fonts);
+            free(data);
+            return NULL;
+        }
+        sf->fi = fi;
+        sf->data = data;
+        sf->len = len;
+        sf->refs = 0;
+        sf->next = shared_fonts;
+        shared_fonts = sf;
+    }
+    sf->refs++;
+    LeaveCriticalSection(&cs_fonts);
+    return sf;
+}
+
+// called when a fz_buffer wrapping the data of a font is freed
+static void release_font_data(void* opaque) {
+    shared_font_data* sf = (shared_font_data*)opaque;
+    EnterCriticalSection(&cs_fonts);
+    sf->refs--;
+    free_unused_font_data();
     LeaveCriticalSection(&cs_fonts);
 }
 
 static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_name) {
     sys_font_info* found = NULL;
     char *comma, *fontname;
-    fz_font* font;
+    fz_font* font = NULL;
     fz_buffer* buffer;
+    shared_font_data* data;
 
     EnterCriticalSection(&cs_fonts);
     if (fontlistMS.len == 0) {
@@ -644,31 +814,28 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
     if (!found)
         fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't find system font '%s'", orig_name);
 
-    buffer = get_cached_font_buffer(ctx, found);
-    if (buffer) {
-        fz_warn(ctx, "found cached non-embedded buffer for font '%s' from '%s'", orig_name, found->fontpath);
-    } else {
-        buffer = fz_read_file(ctx, found->fontpath);
-        if (!buffer) {
-            return NULL;
-        }
-        cached_font* f = (cached_font*)malloc(sizeof(cached_font));
-        if (!f) {
-            return NULL;
-        }
-        f->fi = found;
-        f->ctx = ctx;
-        f->buffer = buffer;
-        EnterCriticalSection(&cs_fonts);
-        f->next = cached_fonts;
-        cached_fonts = f;
-        LeaveCriticalSection(&cs_fonts);
-
-        fz_warn(ctx, "loading non-embedded font '%s' from '%s'", orig_name, found->fontpath);
-    }
+    data = get_font_data(ctx, found);
+    if (!data)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't read system font '%s' from '%s'", orig_name, found->fontpath);
 
     int use_glyph_bbox = strcmp(found->fontface, "DroidSansFallback") != 0;
-    font = fz_new_font_from_buffer(ctx, orig_name, buffer, found->index, use_glyph_bbox);
+    // the buffer doesn't own the data but keeps a reference to it until it's dropped
+    fz_try(ctx) {
+        buffer = fz_new_buffer_from_shared_data_with_drop(ctx, data->data, data->len, release_font_data, data);
+    }
+    fz_catch(ctx) {
+        release_font_data(data);
+        fz_rethrow(ctx);
+    }
+    fz_try(ctx) {
+        font = fz_new_font_from_buffer(ctx, orig_name, buffer, found->index, use_glyph_bbox);
+    }
+    fz_always(ctx) {
+        fz_drop_buffer(ctx, buffer);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
     font->flags.ft_substitute = 1;
     return font;
 }
@@ -788,9 +955,24 @@ void init_system_font_list(void) {
     did_init = 1;
 }
 
+void set_system_font_list_cache_path(const char* path) {
+    init_system_font_list();
+    EnterCriticalSection(&cs_fonts);
+    font_list_cache_path[0] = '\0';
+    if (path && !MultiByteToWideChar(CP_UTF8, 0, path, -1, font_list_cache_path, nelem(font_list_cache_path)))
+        font_list_cache_path[0] = '\0';
+    LeaveCriticalSection(&cs_fonts);
+}
+
 void destroy_system_font_list(void) {
     free(fontlistMS.fontmap);
     memset(&fontlistMS, 0, sizeof(fontlistMS));
+    while (shared_fonts) {
+        shared_font_data* next = shared_fonts->next;
+        free(shared_fonts->data);
+        free(shared_fonts);
+        shared_fonts = next;
+    }
     DeleteCriticalSection(&cs_fonts);
 }
 
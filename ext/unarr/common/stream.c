@@ -217,4 +217,138 @@ ar_stream *ar_open_istream(IStream *stream)
     IUnknown_AddRef(stream);
     return ar_open_stream(stream, stream_close, stream_read, stream_seek, stream_tell);
 }
+
+/***** stream based on a read-only file mapping *****/
+
+/* 32-bit processes don't have enough address space to map big files at once,
+   so only a window of the file is mapped there */
+#ifdef _WIN64
+#define MAPPED_MAX_VIEW_SIZE ((uint64_t)1 << 46)
+#else
+#define MAPPED_MAX_VIEW_SIZE ((uint64_t)32 * 1024 * 1024)
+#endif
+
+struct MappedStream {
+    HANDLE hFile;
+    HANDLE hMap;
+    uint64_t length;
+    uint64_t offset;
+    /* maps [view_start, view_start + view_size) of the file */
+    const uint8_t *view;
+    uint64_t view_start;
+    size_t view_size;
+    uint32_t granularity;
+};
+
+static void mapped_close(void *data)
+{
+    struct MappedStream *stm = data;
+    if (stm->view)
+        UnmapViewOfFile(stm->view);
+    CloseHandle(stm->hMap);
+    CloseHandle(stm->hFile);
+    free(stm);
+}
+
+/* maps the window that contains the current offset */
+static bool mapped_map_view(struct MappedStream *stm)
+{
+    uint64_t start = stm->offset - stm->offset % stm->granularity;
+    uint64_t size = stm->length - start;
+    if (size > MAPPED_MAX_VIEW_SIZE)
+        size = MAPPED_MAX_VIEW_SIZE;
+    if (stm->view)
+        UnmapViewOfFile(stm->view);
+    stm->view = MapViewOfFile(stm->hMap, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)size);
+    if (!stm->view)
+        return false;
+    stm->view_start = start;
+    stm->view_size = (size_t)size;
+    return true;
+}
+
+static size_t mapped_read(void *data, void *buffer, size_t count)
+{
+    struct MappedStream *stm = data;
+    size_t read = 0;
+    while (count > 0 && stm->offset < stm->length) {
+        size_t n;
+        if (!stm->view || stm->offset < stm->view_start || stm->offset >= stm->view_start + stm->view_size) {
+            if (!mapped_map_view(stm))
+                break;
+        }
+        n = (size_t)(stm->view_start + stm->view_size - stm->offset);
+        if (n > count)
+            n = count;
+#ifdef _MSC_VER
+        /* reading a mapped file raises an exception on I/O errors (e.g. a network drive going away) */
+        __try {
+            memcpy((uint8_t *)buffer + read, stm->view + (stm->offset - stm->view_start), n);
+        } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+            break;
+        }
+#else
+        memcpy((uint8_t *)buffer + read, stm->view + (stm->offset - stm->view_start), n);
+#endif
+        stm->offset += n;
+        read += n;
+        count -= n;
+    }
+    return read;
+}
+
+static bool mapped_seek(void *data, off64_t offset, int origin)
+{
+    struct MappedStream *stm = data;
+    if (origin == SEEK_CUR)
+        offset += stm->offset;
+    else if (origin == SEEK_END)
+        offset += stm->length;
+    if (offset < 0 || (uint64_t)offset > stm->length)
+        return false;
+    stm->offset = (uint64_t)offset;
+    return true;
+}
+
+static off64_t mapped_tell(void *data)
+{
+    struct MappedStream *stm = data;
+    return (off64_t)stm->offset;
+}
+
+ar_stream *ar_open_file_mapped_w(const wchar_t *path)
+{
+    struct MappedStream *stm;
+    LARGE_INTEGER size;
+    SYSTEM_INFO si;
+    HANDLE hFile, hMap;
+
+    if (!path)
+        return NULL;
+    hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NULL;
+    /* CreateFileMapping fails for empty files */
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0) {
+        CloseHandle(hFile);
+        return NULL;
+    }
+    hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMap) {
+        CloseHandle(hFile);
+        return NULL;
+    }
+    stm = calloc(1, sizeof(struct MappedStream));
+    if (!stm) {
+        CloseHandle(hMap);
+        CloseHandle(hFile);
+        return NULL;
+    }
+    GetSystemInfo(&si);
+    stm->hFile = hFile;
+    stm->hMap = hMap;
+    stm->length = (uint64_t)size.QuadPart;
+    stm->granularity = si.dwAllocationGranularity;
+    return ar_open_stream(stm, mapped_close, mapped_read, mapped_seek, mapped_tell);
+}
 #endif
@@ -30,6 +30,9 @@ ar_stream *ar_open_memory(const void *data, size_t datalen);
 typedef struct IStream IStream;
 /* opens a read-only stream based on the given IStream */
 ar_stream *ar_open_istream(IStream *stream);
+/* opens a read-only stream for the given file path which reads from a file mapping
+   instead of copying through a FILE buffer; returns NULL on error (e.g. empty files) */
+ar_stream *ar_open_file_mapped_w(const wchar_t *path);
 #endif
 
 /* closes the stream and releases underlying resources */
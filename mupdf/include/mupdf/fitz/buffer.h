@@ -44,6 +44,9 @@ typedef struct
 	size_t cap, len;
 	int unused_bits;
 	int shared;
+	/* SumatraPDF: see fz_new_buffer_from_shared_data_with_drop */
+	void (*drop_shared)(void *opaque);
+	void *drop_shared_opaque;
 } fz_buffer;
 
 /**
@@ -99,6 +102,14 @@ fz_buffer *fz_new_buffer_from_data(fz_context *ctx, unsigned char *data, size_t
 */
 fz_buffer *fz_new_buffer_from_shared_data(fz_context *ctx, const unsigned char *data, size_t size);
 
+/**
+	SumatraPDF: like fz_new_buffer_from_shared_data, but calls
+	drop_shared(opaque) when the buffer is freed. Lets the owner of
+	data free it once no buffer uses it.
+*/
+fz_buffer *fz_new_buffer_from_shared_data_with_drop(fz_context *ctx, const unsigned char *data, size_t size,
+	void (*drop_shared)(void *opaque), void *opaque);
+
 /**
 	Create a new buffer containing a copy of the passed data.
 */
@@ -139,4 +139,10 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	Approximate number of bytes used by the display list itself
+	(not including the images, fonts etc. it keeps alive).
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list);
+
 #endif
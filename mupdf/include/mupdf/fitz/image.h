@@ -414,6 +414,18 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	SumatraPDF: like fz_load_jpx but decodes up to *l2factor resolution
+	levels less. *l2factor is updated to the subsampling still to be done.
+*/
+fz_pixmap *fz_load_jpx_subsampled(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, int *l2factor);
+
+/**
+	SumatraPDF: number of threads used for decoding a JPX image (0 or 1 for
+	decoding on the calling thread). Images are still decoded one at a time.
+*/
+void fz_set_jpx_decode_threads(int n);
+
 /**
 	Exposed for CBZ.
 */
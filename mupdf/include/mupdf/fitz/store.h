@@ -374,6 +374,36 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/**
+	SumatraPDF: change the maximum size of the store. If the store is
+	bigger than that, items are evicted the next time one is stored.
+*/
+void fz_set_store_max(fz_context *ctx, size_t max);
+
+/**
+	SumatraPDF: usage statistics of the store. hits and misses count
+	the lookups with fz_find_item, evictions the items that were
+	dropped to make space for new ones.
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int items;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+} fz_store_stats;
+
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
+/**
+	SumatraPDF: like fz_store_item, but when space has to be made, items
+	stored with a priority > 0 are only evicted after all the others (as
+	long as they take up at most half of the store).
+*/
+void *fz_store_item_with_priority(fz_context *ctx, void *key, void *val, size_t itemsize, const fz_store_type *type, int priority);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
@@ -494,6 +494,8 @@ struct pdf_document
 
 	struct {
 		fz_hash_table *fonts;
+		/* SumatraPDF: parsed JBIG2Globals streams by object number */
+		fz_hash_table *jbig2_globals;
 	} resources;
 
 	int orphans_max;
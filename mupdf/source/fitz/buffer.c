@@ -89,6 +89,17 @@ fz_new_buffer_from_shared_data(fz_context *ctx, const unsigned char *data, size_
 	return b;
 }
 
+/* SumatraPDF: */
+fz_buffer *
+fz_new_buffer_from_shared_data_with_drop(fz_context *ctx, const unsigned char *data, size_t size,
+	void (*drop_shared)(void *opaque), void *opaque)
+{
+	fz_buffer *b = fz_new_buffer_from_shared_data(ctx, data, size);
+	b->drop_shared = drop_shared;
+	b->drop_shared_opaque = opaque;
+	return b;
+}
+
 fz_buffer *
 fz_new_buffer_from_copied_data(fz_context *ctx, const unsigned char *data, size_t size)
 {
@@ -203,6 +214,9 @@ fz_drop_buffer(fz_context *ctx, fz_buffer *buf)
 	{
 		if (!buf->shared)
 			fz_free(ctx, buf->data);
+		/* SumatraPDF: */
+		else if (buf->drop_shared)
+			buf->drop_shared(buf->drop_shared_opaque);
 		fz_free(ctx, buf);
 	}
 }
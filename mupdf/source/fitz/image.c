@@ -889,6 +889,17 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	return NULL;
 }
 
+/* SumatraPDF: decoding JBIG2 and CCITT scans is slow compared to their
+ * compressed size, so their pixmaps are kept in the store for longer */
+static int
+is_slow_to_decode(fz_context *ctx, fz_image *image)
+{
+	fz_compressed_buffer *buffer = fz_compressed_image_buffer(ctx, image);
+	if (buffer == NULL)
+		return 0;
+	return buffer->params.type == FZ_IMAGE_JBIG2 || buffer->params.type == FZ_IMAGE_FAX;
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
@@ -1006,7 +1017,8 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		keyp->l2factor = l2factor;
 		keyp->rect = key.rect;
 
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		/* SumatraPDF: see is_slow_to_decode() */
+		existing_tile = fz_store_item_with_priority(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type, is_slow_to_decode(ctx, image));
 		if (existing_tile)
 		{
 			/* We already have a tile. This must have been produced by a
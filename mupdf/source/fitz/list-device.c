@@ -1554,6 +1554,13 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list)
+{
+	if (!list)
+		return 0;
+	return sizeof(fz_display_list) + list->max * sizeof(fz_display_node);
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
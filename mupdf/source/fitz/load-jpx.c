@@ -69,6 +69,7 @@ typedef struct
 	fz_colorspace *cs;
 	int xres;
 	int yres;
+	int l2factor;
 } fz_jpxd;
 
 typedef struct
@@ -101,6 +102,14 @@ typedef struct
 
 static fz_context *opj_secret = NULL;
 
+/* SumatraPDF: number of threads openjpeg uses for decoding an image */
+static int jpx_decode_threads = 0;
+
+void fz_set_jpx_decode_threads(int n)
+{
+	jpx_decode_threads = n;
+}
+
 static void set_opj_context(fz_context *ctx)
 {
 	opj_secret = ctx;
@@ -121,6 +130,8 @@ https://github.com/sumatrapdfreader/sumatrapdf/issues/1306
 #include <Windows.h>
 static int isInitialized = 0;
 static CRITICAL_SECTION opj_cs;
+/* SumatraPDF: the thread holding opj_lock, the one that owns opj_secret */
+static DWORD opj_owner_thread = 0;
 
 void opj_lock(fz_context *ctx)
 {
@@ -132,14 +143,26 @@ void opj_lock(fz_context *ctx)
 
 	EnterCriticalSection(&opj_cs);
 	set_opj_context(ctx);
+	opj_owner_thread = GetCurrentThreadId();
 }
 
 void opj_unlock(fz_context *ctx)
 {
+	opj_owner_thread = 0;
 	set_opj_context(NULL);
 	LeaveCriticalSection(&opj_cs);
 }
+
+static int opj_on_worker_thread(void)
+{
+	return GetCurrentThreadId() != opj_owner_thread;
+}
 #else
+static int opj_on_worker_thread(void)
+{
+	return 0;
+}
+
 void opj_lock(fz_context *ctx)
 {
 	fz_lock(ctx, FZ_LOCK_FREETYPE);
@@ -156,22 +179,61 @@ void opj_unlock(fz_context *ctx)
 #endif
 
 
+/* SumatraPDF: openjpeg's worker threads (see opj_codec_set_threads) allocate
+ * through the context of the thread holding opj_lock. Scavenging would evict
+ * from that context's store on the wrong thread, so they only call its
+ * allocator. fz_free doesn't scavenge and is safe on any thread */
+static void *opj_worker_malloc(fz_context *ctx, size_t size)
+{
+	void *p;
+	if (size == 0)
+		return NULL;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	p = ctx->alloc.malloc(ctx->alloc.user, size);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return p;
+}
+
+static void *opj_worker_realloc(fz_context *ctx, void *ptr, size_t size)
+{
+	void *p;
+	if (size == 0)
+	{
+		fz_free(ctx, ptr);
+		return NULL;
+	}
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	p = ctx->alloc.realloc(ctx->alloc.user, ptr, size);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return p;
+}
+
 void *opj_malloc(size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
 	assert(ctx != NULL);
 
+	if (opj_on_worker_thread())
+		return opj_worker_malloc(ctx, size);
 	return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
 }
 
 void *opj_calloc(size_t n, size_t size)
 {
 	fz_context *ctx = get_opj_context();
+	void *p;
 
 	assert(ctx != NULL);
 
-	return fz_calloc_no_throw(ctx, n, size);
+	if (!opj_on_worker_thread())
+		return fz_calloc_no_throw(ctx, n, size);
+	if (n == 0 || size == 0 || n > SIZE_MAX / size)
+		return NULL;
+	p = opj_worker_malloc(ctx, n * size);
+	if (p)
+		memset(p, 0, n * size);
+	return p;
 }
 
 void *opj_realloc(void *ptr, size_t size)
@@ -180,6 +242,8 @@ void *opj_realloc(void *ptr, size_t size)
 
 	assert(ctx != NULL);
 
+	if (opj_on_worker_thread())
+		return opj_worker_realloc(ctx, ptr, size);
 	return fz_realloc_no_throw(ctx, ptr, size);
 }
 
@@ -400,8 +464,14 @@ template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT3
 	}
 }
 
+static int
+jpx_ceildivpow2(int a, int b)
+{
+	return (a + (1 << b) - 1) >> b;
+}
+
 static void
-copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
+copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx, int l2factor)
 {
 	unsigned char *dst;
 	int stride, comps;
@@ -420,8 +490,9 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		/* SumatraPDF: component offsets are at full resolution, data is reduced */
+		int32_t oy = safe_mul32(ctx, jpx_ceildivpow2(comp->y0, l2factor), cdy) - jpx_ceildivpow2(jpx->y0, l2factor);
+		int32_t ox = safe_mul32(ctx, jpx_ceildivpow2(comp->x0, l2factor), cdx) - jpx_ceildivpow2(jpx->x0, l2factor);
 		unsigned char *dst0 = dst + oy * stride;
 		int prec = comp->prec;
 		int sgnd = comp->sgnd;
@@ -447,8 +518,33 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* SumatraPDF: decode with up to l2factor resolution levels less */
+static int
+jpx_set_reduce_factor(fz_context *ctx, opj_codec_t *codec, int l2factor)
+{
+	opj_codestream_info_v2_t *info;
+	OPJ_UINT32 i;
+	int maxfactor;
+
+	if (l2factor <= 0)
+		return 0;
+	info = opj_get_cstr_info(codec);
+	if (!info || !info->m_default_tile_info.tccp_info)
+	{
+		opj_destroy_cstr_info(&info);
+		return 0;
+	}
+	maxfactor = l2factor;
+	for (i = 0; i < info->nbcomps; i++)
+		maxfactor = fz_mini(maxfactor, (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1);
+	opj_destroy_cstr_info(&info);
+	if (maxfactor <= 0 || !opj_set_decoded_resolution_factor(codec, maxfactor))
+		return 0;
+	return maxfactor;
+}
+
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, int l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -485,6 +581,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		opj_destroy_codec(codec);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
 	}
+	/* SumatraPDF: the worker threads allocate through opj_malloc, which uses
+	 * the context of the thread holding opj_lock without scavenging its store */
+	if (jpx_decode_threads > 1 && opj_has_thread_support())
+		opj_codec_set_threads(codec, jpx_decode_threads);
 
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
@@ -505,11 +605,16 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	state->l2factor = onlymeta ? 0 : jpx_set_reduce_factor(ctx, codec, l2factor);
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* SumatraPDF: tiles might have fewer resolution levels than the main header */
+		if (state->l2factor > 0)
+			return jpx_read_image(ctx, state, data, size, defcs, onlymeta, 0);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
 
@@ -539,8 +644,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	w = state->width = jpx->x1 - jpx->x0;
-	h = state->height = jpx->y1 - jpx->y0;
+	w = state->width = jpx_ceildivpow2(jpx->x1, state->l2factor) - jpx_ceildivpow2(jpx->x0, state->l2factor);
+	h = state->height = jpx_ceildivpow2(jpx->y1, state->l2factor) - jpx_ceildivpow2(jpx->y0, state->l2factor);
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -611,7 +716,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		a = !!a; /* ignore any superfluous alpha channels */
 		img = fz_new_pixmap(ctx, state->cs, w, h, NULL, a);
 		fz_clear_pixmap_with_value(ctx, img, 0);
-		copy_jpx_to_pixmap(ctx, img, jpx);
+		copy_jpx_to_pixmap(ctx, img, jpx, state->l2factor);
 
 		if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 3 && a == 0)
 			jpx_ycc_to_rgb(ctx, img, 1, 1);
@@ -634,6 +739,13 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+{
+	int l2factor = 0;
+	return fz_load_jpx_subsampled(ctx, data, size, defcs, &l2factor);
+}
+
+fz_pixmap *
+fz_load_jpx_subsampled(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
 {
 	fz_jpxd state = { 0 };
 	fz_pixmap *pix = NULL;
@@ -641,13 +753,14 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, *l2factor);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 
+	*l2factor -= state.l2factor;
 	return pix;
 }
 
@@ -659,7 +772,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, 0);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -681,6 +794,16 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_subsampled(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
+void fz_set_jpx_decode_threads(int n)
+{
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
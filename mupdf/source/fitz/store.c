@@ -36,6 +36,8 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	/* SumatraPDF: see fz_store_item_with_priority() */
+	int priority;
 } fz_item;
 
 /* Every entry in fz_store is protected by the alloc lock */
@@ -59,6 +61,14 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* SumatraPDF: usage statistics, see fz_get_store_stats() */
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+	/* SumatraPDF: size of the items stored with a priority */
+	size_t priority_size;
 };
 
 void
@@ -82,6 +92,10 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	store->max = max;
 	store->defer_reap_count = 0;
 	store->needs_reaping = 0;
+	store->hits = 0;
+	store->misses = 0;
+	store->evictions = 0;
+	store->priority_size = 0;
 	ctx->store = store;
 }
 
@@ -133,6 +147,8 @@ do_reap(fz_context *ctx)
 
 		/* We have to drop it */
 		store->size -= item->size;
+		if (item->priority)
+			store->priority_size -= item->size;
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -279,6 +295,8 @@ evict(fz_context *ctx, fz_item *item)
 	int drop;
 
 	store->size -= item->size;
+	if (item->priority)
+		store->priority_size -= item->size;
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -312,6 +330,34 @@ evict(fz_context *ctx, fz_item *item)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 }
 
+/* SumatraPDF: returns the highest priority of the items that have to be
+ * evicted to free tofree, or -1 if that's not possible. Items with a
+ * priority are kept as long as they take up at most half of the store. */
+static int
+eviction_priority(fz_store *store, size_t tofree)
+{
+	fz_item *item;
+	size_t count;
+	int max_priority = store->priority_size <= store->max / 2 ? 0 : INT_MAX;
+
+	for (;;)
+	{
+		count = 0;
+		for (item = store->tail; item; item = item->prev)
+		{
+			if (item->val->refs == 1 && item->priority <= max_priority)
+			{
+				count += item->size;
+				if (count >= tofree)
+					return max_priority;
+			}
+		}
+		if (max_priority == INT_MAX)
+			return -1;
+		max_priority = INT_MAX;
+	}
+}
+
 static size_t
 ensure_space(fz_context *ctx, size_t tofree)
 {
@@ -319,24 +365,16 @@ ensure_space(fz_context *ctx, size_t tofree)
 	size_t count;
 	fz_store *store = ctx->store;
 	fz_item *to_be_freed = NULL;
+	int max_priority;
 
 	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
 
 	/* First check that we *can* free tofree; if not, we'd rather not
 	 * cache this. */
-	count = 0;
-	for (item = store->tail; item; item = item->prev)
-	{
-		if (item->val->refs == 1)
-		{
-			count += item->size;
-			if (count >= tofree)
-				break;
-		}
-	}
+	max_priority = eviction_priority(store, tofree);
 
 	/* If we ran out of items to search, then we can never free enough */
-	if (item == NULL)
+	if (max_priority < 0)
 	{
 		return 0;
 	}
@@ -346,10 +384,12 @@ ensure_space(fz_context *ctx, size_t tofree)
 	for (item = store->tail; item; item = prev)
 	{
 		prev = item->prev;
-		if (item->val->refs != 1)
+		if (item->val->refs != 1 || item->priority > max_priority)
 			continue;
 
 		store->size -= item->size;
+		if (item->priority)
+			store->priority_size -= item->size;
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -373,6 +413,7 @@ ensure_space(fz_context *ctx, size_t tofree)
 		/* Link into to_be_freed */
 		item->next = to_be_freed;
 		to_be_freed = item;
+		store->evictions++;
 
 		count += item->size;
 		if (count >= tofree)
@@ -435,6 +476,13 @@ touch(fz_store *store, fz_item *item)
 
 void *
 fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_store_type *type)
+{
+	return fz_store_item_with_priority(ctx, key, val_, itemsize, type, 0);
+}
+
+/* SumatraPDF */
+void *
+fz_store_item_with_priority(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_store_type *type, int priority)
 {
 	fz_item *item = NULL;
 	size_t size;
@@ -474,6 +522,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	item->priority = priority;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -565,6 +614,8 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 		}
 	}
 	store->size += itemsize;
+	if (priority)
+		store->priority_size += itemsize;
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
 	touch(store, item);
@@ -621,9 +672,11 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
+		store->hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -852,6 +905,7 @@ scavenge(fz_context *ctx, size_t tofree)
 			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
 		}
 		freed += largest->size;
+		store->evictions++;
 		evict(ctx, largest); /* Drops then retakes lock */
 	}
 	while (freed < tofree);
@@ -1028,6 +1082,8 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 
 		/* We have to drop it */
 		store->size -= item->size;
+		if (item->priority)
+			store->priority_size -= item->size;
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -1117,3 +1173,40 @@ void fz_log_dump_store(fz_context *ctx, const char *fmt, ...)
 }
 
 #endif
+
+/* SumatraPDF: the limit is applied to the current content the next time
+ * an item is stored, so this can be called from any thread */
+void
+fz_set_store_max(fz_context *ctx, size_t max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->max = max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/* SumatraPDF */
+void
+fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+	fz_item *item;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->max = store->max;
+	stats->size = store->size;
+	for (item = store->head; item; item = item->next)
+		stats->items++;
+	stats->hits = store->hits;
+	stats->misses = store->misses;
+	stats->evictions = store->evictions;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
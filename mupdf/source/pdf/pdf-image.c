@@ -246,6 +246,68 @@ pdf_is_jpx_image(fz_context *ctx, pdf_obj *dict)
 	return 0;
 }
 
+/* SumatraPDF: JPX images are only decoded when they're drawn and at the
+ * resolution that's needed (e.g. for thumbnails and zoomed out pages) instead
+ * of being fully decoded when loaded. Decoded pixmaps are cached by the store
+ * like those of other compressed images. */
+typedef struct
+{
+	fz_image super;
+	fz_buffer *buffer;
+	fz_colorspace *defcs;
+	int has_decode;
+	float decode[FZ_MAX_COLORS * 2];
+} pdf_jpx_image;
+
+static fz_pixmap *
+pdf_jpx_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+	unsigned char *data;
+	size_t len = fz_buffer_storage(ctx, image->buffer, &data);
+	int local_l2factor = 0;
+	fz_pixmap *pix;
+
+	if (!l2factor)
+		l2factor = &local_l2factor;
+	pix = fz_load_jpx_subsampled(ctx, data, len, image->defcs, l2factor);
+	if (image->has_decode)
+	{
+		fz_try(ctx)
+			fz_decode_tile(ctx, pix, image->decode);
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+			fz_rethrow(ctx);
+		}
+	}
+
+	/* the whole image is always decoded */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = 0;
+		subarea->x1 = image->super.w;
+		subarea->y1 = image->super.h;
+	}
+	return pix;
+}
+
+static size_t
+pdf_jpx_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+	return sizeof(pdf_jpx_image) + (image->buffer ? image->buffer->len : 0);
+}
+
+static void
+pdf_drop_jpx_image(fz_context *ctx, fz_image *image_)
+{
+	pdf_jpx_image *image = (pdf_jpx_image *)image_;
+	fz_drop_buffer(ctx, image->buffer);
+	fz_drop_colorspace(ctx, image->defcs);
+}
+
 static fz_image *
 pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 {
@@ -269,10 +331,39 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 		unsigned char *data;
 		size_t len;
 
+		int w = pdf_dict_get_int(ctx, dict, PDF_NAME(Width));
+		int h = pdf_dict_get_int(ctx, dict, PDF_NAME(Height));
+
 		obj = pdf_dict_get(ctx, dict, PDF_NAME(ColorSpace));
 		if (obj)
 			colorspace = pdf_load_colorspace(ctx, obj);
 
+		/* soft masks are converted right away and without a colorspace
+		 * the image has to be decoded to know its colorspace */
+		if (!forcemask && colorspace && w > 0 && h > 0)
+		{
+			pdf_jpx_image *jpx;
+
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
+			if (pdf_is_dict(ctx, obj))
+				mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
+
+			jpx = fz_new_derived_image(ctx, w, h, 8, colorspace, 96, 96, 0, 0, NULL, NULL, mask, pdf_jpx_image,
+				pdf_jpx_image_get_pixmap, pdf_jpx_image_get_size, pdf_drop_jpx_image);
+			jpx->buffer = fz_keep_buffer(ctx, buf);
+			jpx->defcs = fz_keep_colorspace(ctx, colorspace);
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+			if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
+			{
+				int i;
+				jpx->has_decode = 1;
+				for (i = 0; i < FZ_MAX_COLORS * 2; i++)
+					jpx->decode[i] = pdf_array_get_real(ctx, obj, i);
+			}
+			img = &jpx->super;
+			break;
+		}
+
 		len = fz_buffer_storage(ctx, buf, &data);
 		pix = fz_load_jpx(ctx, data, len, colorspace);
 
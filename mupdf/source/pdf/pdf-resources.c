@@ -91,5 +91,6 @@ pdf_drop_resource_tables(fz_context *ctx, pdf_document *doc)
 	if (doc)
 	{
 		fz_drop_hash_table(ctx, doc->resources.fonts);
+		fz_drop_hash_table(ctx, doc->resources.jbig2_globals);
 	}
 }
@@ -82,16 +82,62 @@ pdf_stream_has_crypt(fz_context *ctx, pdf_obj *stm)
 	return 0;
 }
 
+static void pdf_drop_jbig2_globals_as_void(fz_context *ctx, void *globals)
+{
+	fz_drop_jbig2_globals(ctx, globals);
+}
+
+/* SumatraPDF: the pages of scanned documents usually share one symbol
+ * dictionary. The store evicts it under memory pressure, so the parsed
+ * globals are also kept with the document, keyed by object number. */
+static fz_jbig2_globals *
+pdf_find_doc_jbig2_globals(fz_context *ctx, pdf_document *doc, int num)
+{
+	fz_jbig2_globals *globals;
+
+	if (!doc || num <= 0 || !doc->resources.jbig2_globals)
+		return NULL;
+	globals = fz_hash_find(ctx, doc->resources.jbig2_globals, &num);
+	return globals ? fz_keep_jbig2_globals(ctx, globals) : NULL;
+}
+
+static void
+pdf_insert_doc_jbig2_globals(fz_context *ctx, pdf_document *doc, int num, fz_jbig2_globals *globals)
+{
+	if (!doc || num <= 0)
+		return;
+	fz_try(ctx)
+	{
+		if (!doc->resources.jbig2_globals)
+			doc->resources.jbig2_globals = fz_new_hash_table(ctx, 16, sizeof(num), -1, pdf_drop_jbig2_globals_as_void);
+		if (!fz_hash_insert(ctx, doc->resources.jbig2_globals, &num, globals))
+			fz_keep_jbig2_globals(ctx, globals);
+	}
+	fz_catch(ctx)
+	{
+		/* not caching it with the document is not an error */
+		fz_warn(ctx, "cannot cache jbig2 globals");
+	}
+}
+
 static fz_jbig2_globals *
 pdf_load_jbig2_globals(fz_context *ctx, pdf_obj *dict)
 {
 	fz_jbig2_globals *globals;
 	fz_buffer *buf = NULL;
+	pdf_document *doc = pdf_is_indirect(ctx, dict) ? pdf_get_indirect_document(ctx, dict) : NULL;
+	int num = pdf_to_num(ctx, dict);
 
 	fz_var(buf);
 
+	if ((globals = pdf_find_doc_jbig2_globals(ctx, doc, num)) != NULL)
+		return globals;
+
 	if ((globals = pdf_find_item(ctx, fz_drop_jbig2_globals_imp, dict)) != NULL)
+	{
+		pdf_insert_doc_jbig2_globals(ctx, doc, num, globals);
 		return globals;
+	}
 
 	if (pdf_mark_obj(ctx, dict))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cyclic reference when loading JBIG2 globals");
@@ -101,6 +147,7 @@ pdf_load_jbig2_globals(fz_context *ctx, pdf_obj *dict)
 		buf = pdf_load_stream(ctx, dict);
 		globals = fz_load_jbig2_globals(ctx, buf);
 		pdf_store_item(ctx, dict, globals, fz_buffer_storage(ctx, buf, NULL));
+		pdf_insert_doc_jbig2_globals(ctx, doc, num, globals);
 	}
 	fz_always(ctx)
 	{
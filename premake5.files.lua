@@ -608,20 +608,26 @@ function sumatrapdf_files()
     "ExternalViewers.*",
     "Favorites.*",
     "FileHistory.*",
+    "FileTextCache.*",
     "FileThumbnails.*",
+    "FindAll.*",
     "Flags.*",
     "FzImgReader.*",
     "GlobalPrefs.*",
+    "IdleTasks.*",
     "Installer.*",
     "InstallerCommon.cpp",
     "MainWindow.*",
     "MemLeakDetect.*",
     "Menu.*",
     "Notifications.*",
+    "PageOverview.*",
     "PdfSync.*",
     "Print.*",
     "ProgressUpdateUI.*",
     "RenderCache.*",
+    "RenderWorker.*",
+    "ResourceStats.*",
     "RegistryInstaller.*",
     "RegistryPreview.*",
     "RegistrySearchFilter.*",
@@ -646,6 +652,8 @@ function sumatrapdf_files()
     "TextSearch.*",
     "TextSelection.*",
     "Theme.*",
+    "ThumbnailStore.*",
+    "TileCache.*",
     "Toolbar.*",
     "Translations.*",
     "TranslationLangs.cpp",
@@ -718,6 +726,7 @@ function utils_files()
     "HtmlPullParser.*",
     "HtmlPrettyPrint.*",
     "HttpUtil.*",
+    "ImageResample.*",
     "JsonParser.*",
     "Log.*",
     "LzmaSimpleArchive.*",
@@ -732,7 +741,9 @@ function utils_files()
     "StrFormat.*",
     "StrUtil.*",
     "TempAllocator.*",
+    "TextMatcher.*",
     "ThreadUtil.*",
+    "TimeTrace.*",
     "TgaReader.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
@@ -777,6 +788,7 @@ function engines_files()
     "EngineMulti.*",
     "EngineMupdf.*",
     "EngineMupdfImpl.*",
+    "FzGdiDevice.*",
     "EnginePs.*",
     "EngineAll.h",
     "ChmFile.*",
@@ -1130,6 +1142,7 @@ function test_util_files()
     "SquareTreeParser.*",
     "TrivialHtmlParser.*",
     "TempAllocator.*",
+    "TextMatcher.*",
     "UtAssert.*",
     "Vec.*",
     "WinUtil.*",
@@ -1178,6 +1191,7 @@ function pdf_preview_files()
     "EngineImages.*",
     "EngineMupdf.*",
     "EngineMupdfImpl.*",
+    "FzGdiDevice.*",
     "EngineAll.h",
     "FzImgReader.*",
     "HtmlFormatter.*",
@@ -1187,6 +1201,7 @@ function pdf_preview_files()
     "PalmDbReader.*",
     "PdfCreator.*",
     "SumatraConfig.*",
+    "ThumbnailStore.*",
   })
 end
 
@@ -1204,6 +1219,7 @@ function search_filter_files()
     "EngineAll.h",
     "EngineMupdf.*",
     "EngineMupdfImpl.*",
+    "FzGdiDevice.*",
     "PalmDbReader.*",
     "RegistrySearchFilter.*",
     "MobiDoc.*",
@@ -138,6 +138,8 @@ ACCEL gBuiltInAccelerators[] = {
     {FCONTROL | FVIRTKEY, VK_INSERT, CmdCopySelection},
     {FCONTROL | FVIRTKEY, 'D', CmdProperties},
     {FCONTROL | FVIRTKEY, 'F', CmdFindFirst},
+    {FSHIFT | FCONTROL | FVIRTKEY, 'F', CmdFindAll},
+    {FSHIFT | FCONTROL | FVIRTKEY, 'O', CmdShowPageOverview},
     {FCONTROL | FVIRTKEY, 'G', CmdGoToPage},
     {0, 'g', CmdGoToPage},
     {FCONTROL | FVIRTKEY, 'K', CmdCommandPalette},
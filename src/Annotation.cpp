@@ -157,8 +157,14 @@ RectF GetRect(Annotation* annot) {
     EngineMupdf* e = annot->engine;
     ScopedCritSec cs(e->ctxAccess);
 
-    // TOOD: needs try / catch
-    fz_rect rc = pdf_annot_rect(e->ctx, annot->pdfannot);
+    fz_rect rc{};
+    fz_var(rc);
+    fz_try(e->ctx) {
+        rc = pdf_annot_rect(e->ctx, annot->pdfannot);
+    }
+    fz_catch(e->ctx) {
+        rc = {};
+    }
     auto rect = ToRectF(rc);
     return rect;
 }
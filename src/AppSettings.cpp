@@ -8,6 +8,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
@@ -31,6 +32,7 @@
 #include "Toolbar.h"
 #include "Translations.h"
 #include "Accelerators.h"
+#include "FileTextCache.h"
 
 #include "utils/Log.h"
 
@@ -39,6 +41,34 @@ extern void RememberDefaultWindowPosition(MainWindow* win);
 
 static WatchedFile* gWatchedSettingsFile = nullptr;
 
+// settings are saved often (e.g. when closing a tab or changing the display mode)
+// so they're written on a background thread. Saves requested in quick succession
+// are combined into a single write of the most recent data
+constexpr int kSettingsWriteDelayMs = 500;
+
+// protects gSettingsToWrite, gSettingsWriterRunning and gLastSettingsWriteTime
+static CRITICAL_SECTION gSettingsWriteAccess;
+// held while writing the settings file
+static CRITICAL_SECTION gSettingsFileAccess;
+static bool gSettingsWriteAccessInitialized = false;
+static char* gSettingsPathToWrite = nullptr;
+static ByteSlice gSettingsToWrite;
+static bool gSettingsWriterRunning = false;
+static FILETIME gLastSettingsWriteTime{};
+
+// contents of the settings file as last loaded or saved (only used on the ui thread)
+static ByteSlice gPrevSettingsData;
+
+// the first call must come from the ui thread (before any thread is started)
+static void InitSettingsWriteAccess() {
+    if (gSettingsWriteAccessInitialized) {
+        return;
+    }
+    InitializeCriticalSection(&gSettingsWriteAccess);
+    InitializeCriticalSection(&gSettingsFileAccess);
+    gSettingsWriteAccessInitialized = true;
+}
+
 // number of weeks past since 2011-01-01
 static int GetWeekCount() {
     SYSTEMTIME date20110101{};
@@ -83,6 +113,8 @@ static void setMinMax(int& i, int minVal, int maxVal) {
 /* Caller needs to CleanUpSettings() */
 bool LoadSettings() {
     CrashIf(gGlobalPrefs);
+    TIME_TRACE("LoadSettings");
+    InitSettingsWriteAccess();
 
     auto timeStart = TimeGet();
 
@@ -103,7 +135,8 @@ bool LoadSettings() {
             gprefs->restoreSession = true;
         }
 #endif
-        prefsData.Free();
+        gPrevSettingsData.Free();
+        gPrevSettingsData = prefsData;
     }
 
     if (!gprefs->uiLanguage || !trans::ValidateLangCode(gprefs->uiLanguage)) {
@@ -169,6 +202,9 @@ bool LoadSettings() {
     gFileHistory.UpdateStatesSource(gprefs->fileStates);
     //    auto fontName = ToWstrTemp(gprefs->fixedPageUI.ebookFontName);
     //    SetDefaultEbookFont(fontName.Get(), gprefs->fixedPageUI.ebookFontSize);
+    SetImageScaling(gprefs->comicBookUI.imageScaling);
+    SetEbookTextRendering(gprefs->ebookTextRendering);
+    UpdateArchiveEntriesCacheDir();
 
     if (!file::Exists(settingsPath)) {
         SaveSettings();
@@ -198,15 +234,21 @@ static void RememberSessionState() {
                 continue;
             }
             char* fp = tab->filePath;
-            FileState* fs = NewDisplayState(fp);
-            if (tab->ctrl) {
-                tab->ctrl->GetDisplayState(fs);
+            // hibernated tabs remember the state of their unloaded document
+            FileState* fs = tab->hibernatedState;
+            if (!fs) {
+                fs = NewDisplayState(fp);
+                if (tab->ctrl) {
+                    tab->ctrl->GetDisplayState(fs);
+                }
             }
             fs->showToc = tab->showToc;
             *fs->tocState = tab->tocState;
             TabState* ts = NewTabState(fs);
             data->tabStates->Append(ts);
-            DeleteDisplayState(fs);
+            if (fs != tab->hibernatedState) {
+                DeleteDisplayState(fs);
+            }
         }
         if (data->tabStates->Size() == 0) {
             continue;
@@ -224,6 +266,79 @@ static void RememberSessionState() {
     }
 }
 
+// writes to a temporary file first so that the settings file
+// is never left half-written (e.g. if the disk is full)
+static bool WriteSettingsFile(const char* path, const ByteSlice& data) {
+    TIME_TRACE("WriteSettingsFile");
+    AutoFreeStr tmpPath = str::Join(path, ".tmp");
+    if (!file::WriteFile(tmpPath, data)) {
+        return false;
+    }
+    AutoFreeWstr tmpPathW = ToWstr(tmpPath);
+    AutoFreeWstr pathW = ToWstr(path);
+    BOOL ok = MoveFileExW(tmpPathW, pathW, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok) {
+        DeleteFileW(tmpPathW);
+    }
+    return ok;
+}
+
+// writes the settings that haven't been written yet (if any).
+// Returns false if writing them failed
+static bool WritePendingSettings() {
+    ScopedCritSec scopeFile(&gSettingsFileAccess);
+    char* path = nullptr;
+    ByteSlice data;
+    {
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        path = gSettingsPathToWrite;
+        gSettingsPathToWrite = nullptr;
+        data = gSettingsToWrite;
+        gSettingsToWrite = {};
+    }
+    if (!path) {
+        return true;
+    }
+
+    WatchedFileSetIgnore(gWatchedSettingsFile, true);
+    bool ok = WriteSettingsFile(path, data);
+    if (ok) {
+        FILETIME time = file::GetModificationTime(path);
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        gLastSettingsWriteTime = time;
+    }
+    WatchedFileSetIgnore(gWatchedSettingsFile, false);
+    if (!ok) {
+        logf("WritePendingSettings: failed to write '%s'\n", path);
+    }
+    str::Free(path);
+    data.Free();
+    return ok;
+}
+
+static DWORD WINAPI SettingsWriterThread(LPVOID) {
+    while (true) {
+        // wait a bit so that saves requested in the meantime are written together
+        Sleep(kSettingsWriteDelayMs);
+        WritePendingSettings();
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        if (gSettingsToWrite.empty()) {
+            gSettingsWriterRunning = false;
+            break;
+        }
+    }
+    return 0;
+}
+
+// writes settings saved with SaveSettings() right away (e.g. before exiting
+// or opening the settings file in a text editor)
+bool FlushSettings() {
+    if (!gSettingsWriteAccessInitialized) {
+        return true;
+    }
+    return WritePendingSettings();
+}
+
 // called whenever global preferences change or a file is
 // added or removed from gFileHistory (in order to keep
 // the list of recently opened documents in sync)
@@ -232,6 +347,7 @@ bool SaveSettings() {
     if (!HasPermission(Perm::SavePreferences)) {
         return false;
     }
+    TIME_TRACE("SaveSettings");
 
     // update display states for all tabs
     for (MainWindow* win : gWindows) {
@@ -252,30 +368,58 @@ bool SaveSettings() {
     if (!path) {
         return false;
     }
-    ByteSlice prevPrefs = file::ReadFile(path);
-    const char* prevPrefsData = (char*)prevPrefs.data();
+    // the previous data is the file as we've last loaded or saved it, unless someone
+    // else has changed it since (and ReloadSettings() hasn't picked that up yet).
+    // Then it's read again, so that settings we don't know about aren't lost
+    FILETIME time = file::GetModificationTime(path);
+    bool changedOnDisk = false;
+    {
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        changedOnDisk = !FileTimeEq(time, gLastSettingsWriteTime) && !FileTimeEq(time, gGlobalPrefs->lastPrefUpdate);
+    }
+    if (changedOnDisk) {
+        ByteSlice onDisk = file::ReadFile(path);
+        if (!onDisk.empty()) {
+            gPrevSettingsData.Free();
+            gPrevSettingsData = onDisk;
+        }
+    }
+    const char* prevPrefsData = (char*)gPrevSettingsData.data();
     ByteSlice prefs = SerializeGlobalPrefs(gGlobalPrefs, prevPrefsData);
-    defer {
-        str::Free(prevPrefs.data());
-        str::Free(prefs.data());
-    };
     CrashIf(prefs.empty());
     if (prefs.empty()) {
         return false;
     }
 
     // only save if anything's changed at all
-    if (prevPrefs.size() == prefs.size() && str::Eq(prefs, prevPrefs)) {
+    if (gPrevSettingsData.size() == prefs.size() && str::Eq(prefs, gPrevSettingsData)) {
+        str::Free(prefs.data());
         return true;
     }
+    gPrevSettingsData.Free();
+    gPrevSettingsData = prefs;
 
-    WatchedFileSetIgnore(gWatchedSettingsFile, true);
-    bool ok = file::WriteFile(path, prefs);
-    if (ok) {
-        gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path);
+    bool startWriter = false;
+    {
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        str::ReplaceWithCopy(&gSettingsPathToWrite, path);
+        gSettingsToWrite.Free();
+        gSettingsToWrite = prefs.Clone();
+        startWriter = !gSettingsWriterRunning;
+        gSettingsWriterRunning = true;
     }
-    WatchedFileSetIgnore(gWatchedSettingsFile, false);
-    return ok;
+    if (startWriter) {
+        HANDLE h = CreateThread(nullptr, 0, SettingsWriterThread, nullptr, 0, nullptr);
+        if (!h) {
+            {
+                ScopedCritSec scope(&gSettingsWriteAccess);
+                gSettingsWriterRunning = false;
+            }
+            return FlushSettings();
+        }
+        CloseHandle(h);
+    }
+    return true;
 }
 
 // refresh the preferences when a different SumatraPDF process saves them
@@ -305,6 +449,13 @@ bool ReloadSettings() {
     }
 
     FILETIME time = file::GetModificationTime(settingsPath);
+    {
+        // the file might've been modified by our own SettingsWriterThread
+        ScopedCritSec scope(&gSettingsWriteAccess);
+        if (FileTimeEq(time, gLastSettingsWriteTime)) {
+            gGlobalPrefs->lastPrefUpdate = time;
+        }
+    }
     if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate)) {
         return true;
     }
@@ -350,6 +501,7 @@ bool ReloadSettings() {
 void CleanUpSettings() {
     DeleteGlobalPrefs(gGlobalPrefs);
     gGlobalPrefs = nullptr;
+    gPrevSettingsData.Free();
 }
 
 void schedulePrefsReload() {
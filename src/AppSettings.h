@@ -14,6 +14,7 @@ char* GetSettingsFileNameTemp();
 
 bool LoadSettings();
 bool SaveSettings();
+bool FlushSettings();
 bool ReloadSettings();
 void CleanUpSettings();
 void RegisterSettingsForFileChanges();
@@ -551,17 +551,13 @@ static const WCHAR* Md5OfAppExe() {
     if (appPath.empty()) {
         return {};
     }
-    ByteSlice d = file::ReadFile(appPath.data);
-    if (d.empty()) {
+    u8 md5[16]{};
+    if (!CalcFileDigest(appPath.data, DigestKind::MD5, md5)) {
         return nullptr;
     }
 
-    u8 md5[16]{};
-    CalcMD5Digest(d.data, d.size(), md5);
-
     AutoFree md5HexA(_MemToHex(&md5));
     AutoFreeWstr md5Hex = strconv::Utf8ToWchar(md5HexA.AsView());
-    d.Free();
     return md5Hex.StealData();
 }
 
@@ -6,6 +6,7 @@
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
@@ -27,6 +28,8 @@
 #include "DisplayModel.h"
 #include "Theme.h"
 #include "GlobalPrefs.h"
+#include "FileHistory.h"
+#include "FileThumbnails.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
@@ -43,6 +46,7 @@
 #include "Caption.h"
 #include "Menu.h"
 #include "uia/Provider.h"
+#include "ResourceStats.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
 #include "SumatraAbout.h"
@@ -60,6 +64,10 @@
 // Therefore, a higher factor makes smooth scrolling faster.
 static const double gSmoothScrollingFactor = 0.2;
 
+// delay for repainting after scrolling or zooming, when tiles rendered in
+// draft quality get rendered again (longer than DisplayModel's kScrollIdleMs)
+constexpr int kSettledRepaintDelayMs = 250;
+
 // these can be global, as the mouse wheel can't affect more than one window at once
 static int gDeltaPerLine = 0;
 // set when WM_MOUSEWHEEL has been passed on (to prevent recursion)
@@ -247,7 +255,7 @@ static bool StopDraggingAnnotation(MainWindow* win, int x, int y, bool aborted)
         // logf("prev rect: x=%.2f, y=%.2f, dx=%.2f, dy=%.2f\n", ar.x, ar.y, ar.dx, ar.dy);
         // logf(" new rect: x=%.2f, y=%.2f, dx=%.2f, dy=%.2f\n", r.x, r.y, r.dx, r.dy);
         SetRect(annot, r);
-        MainWindowRerender(win);
+        RerenderAnnotation(win, annot, ar);
         ToolbarUpdateStateForWindow(win, true);
         StartEditAnnotations(win->CurrentTab(), annot);
     } else {
@@ -355,7 +363,11 @@ static void OnMouseMove(MainWindow* win, int x, int y, WPARAM) {
             if (GetCursor()) {
                 SetCursorCached(IDC_IBEAM);
             }
-            [[fallthrough]];
+            win->selectionRect.dx = x - win->selectionRect.x;
+            win->selectionRect.dy = y - win->selectionRect.y;
+            OnSelectionEdgeAutoscroll(win, x, y);
+            RepaintTextSelection(win);
+            break;
         case MouseAction::Selecting:
             win->selectionRect.dx = x - win->selectionRect.x;
             win->selectionRect.dy = y - win->selectionRect.y;
@@ -699,10 +711,44 @@ static void OnMouseRightButtonDblClick(MainWindow* win, int x, int y, WPARAM key
     }
 }
 
+// bitmaps must be selected out of it again after blitting them
+static HDC GetCanvasBitmapDC(MainWindow* win, HDC hdc) {
+    CanvasGdiObjects& gdi = win->canvasGdi;
+    if (!gdi.bmpDC) {
+        gdi.bmpDC = CreateCompatibleDC(hdc);
+    }
+    return gdi.bmpDC;
+}
+
+static HBRUSH GetCanvasBrush(MainWindow* win, COLORREF col) {
+    CanvasGdiObjects& gdi = win->canvasGdi;
+    int idx = gdi.brushColors.Find(col);
+    if (idx >= 0) {
+        return gdi.brushes[idx];
+    }
+    // the canvas uses only a few colors at a time (they change with the theme)
+    if (gdi.brushes.size() >= 8) {
+        gdi.DeleteBrushes();
+    }
+    HBRUSH brush = CreateSolidBrush(col);
+    gdi.brushColors.Append(col);
+    gdi.brushes.Append(brush);
+    return brush;
+}
+
+// for messages shown instead of pages
+static HFONT GetCanvasFont(MainWindow* win, HDC hdc) {
+    CanvasGdiObjects& gdi = win->canvasGdi;
+    if (!gdi.font) {
+        gdi.font = CreateSimpleFont(hdc, "MS Shell Dlg", 14);
+    }
+    return gdi.font;
+}
+
 #ifdef DRAW_PAGE_SHADOWS
 #define BORDER_SIZE 1
 #define SHADOW_OFFSET 4
-static void PaintPageFrameAndShadow(HDC hdc, Rect& bounds, Rect& pageRect, bool presentation) {
+static void PaintPageFrameAndShadow(MainWindow*, HDC hdc, Rect& bounds, Rect& pageRect, bool presentation) {
     // Frame info
     Rect frame = bounds;
     frame.Inflate(BORDER_SIZE, BORDER_SIZE);
@@ -737,12 +783,10 @@ static void PaintPageFrameAndShadow(HDC hdc, Rect& bounds, Rect& pageRect, bool
     Rectangle(hdc, frame.x, frame.y, frame.x + frame.dx, frame.y + frame.dy);
 }
 #else
-static void PaintPageFrameAndShadow(HDC hdc, Rect& bounds, Rect&, bool) {
-    AutoDeletePen pen(CreatePen(PS_NULL, 0, 0));
+static void PaintPageFrameAndShadow(MainWindow* win, HDC hdc, Rect& bounds, Rect&, bool) {
     auto col = GetAppColor(AppColor::MainWindowBg);
-    AutoDeleteBrush brush(CreateSolidBrush(col));
-    ScopedSelectPen restorePen(hdc, pen);
-    ScopedSelectObject restoreBrush(hdc, brush);
+    ScopedSelectPen restorePen(hdc, GetStockPen(NULL_PEN));
+    ScopedSelectObject restoreBrush(hdc, GetCanvasBrush(win, col));
     Rectangle(hdc, bounds.x, bounds.y, bounds.x + bounds.dx + 1, bounds.y + bounds.dy + 1);
 }
 #endif
@@ -757,7 +801,8 @@ static void DebugShowLinks(DisplayModel* dm, HDC hdc) {
     HPEN pen = CreatePen(PS_SOLID, 1, RGB(0x00, 0xff, 0xff));
     HGDIOBJ oldPen = SelectObject(hdc, pen);
 
-    for (int pageNo = dm->PageCount(); pageNo >= 1; --pageNo) {
+    int firstVisiblePageNo = std::max(dm->FirstVisiblePageNo(), 1);
+    for (int pageNo = dm->LastVisiblePageNo(); pageNo >= firstVisiblePageNo; --pageNo) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         if (!pageInfo || !pageInfo->shown || 0.0 == pageInfo->visibleRatio) {
             continue;
@@ -784,13 +829,17 @@ static void DebugShowLinks(DisplayModel* dm, HDC hdc) {
         pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0x00, 0xff));
         oldPen = SelectObject(hdc, pen);
 
-        for (int pageNo = dm->PageCount(); pageNo >= 1; --pageNo) {
+        for (int pageNo = dm->LastVisiblePageNo(); pageNo >= firstVisiblePageNo; --pageNo) {
             PageInfo* pageInfo = dm->GetPageInfo(pageNo);
             if (!pageInfo->shown || 0.0 == pageInfo->visibleRatio) {
                 continue;
             }
 
-            auto cbbox = dm->GetEngine()->PageContentBox(pageNo);
+            // only the content boxes that have been computed in the background
+            RectF cbbox = pageInfo->contentBox;
+            if (cbbox.IsEmpty()) {
+                continue;
+            }
             Rect rect = dm->CvtToScreen(pageNo, cbbox);
             DrawRect(hdc, rect);
         }
@@ -811,12 +860,71 @@ static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX* tv)
     tv->Blue = (COLOR16)((ab + perc * (bb - ab)) * 256);
 }
 
+/* debug code to see how well the fitz cache of the current document works */
+static void DebugShowStoreStats(DisplayModel* dm, HDC hdc) {
+    if (!gDebugShowStoreStats) {
+        return;
+    }
+    AutoFreeStr stats = EngineMupdfGetStoreStats(dm->GetEngine());
+    if (!stats) {
+        return;
+    }
+    ScopedSelectObject font(hdc, GetDefaultGuiFont());
+    SetTextColor(hdc, RGB(0x00, 0x00, 0x00));
+    SetBkColor(hdc, RGB(0xff, 0xff, 0xe0));
+    SetBkMode(hdc, OPAQUE);
+    Size size = dm->GetViewPort().Size();
+    RECT r = {4, 4, size.dx - 4, size.dy - 4};
+    HdcDrawText(hdc, stats, -1, &r, DT_SINGLELINE | DT_LEFT | DT_TOP | DT_NOPREFIX);
+}
+
+// shown below the store stats
+static void DebugShowResourceStats(DisplayModel* dm, HDC hdc) {
+    const char* stats = GetLastResourceStats();
+    if (!gDebugShowResourceStats || !stats) {
+        return;
+    }
+    ScopedSelectObject font(hdc, GetDefaultGuiFont());
+    SetTextColor(hdc, RGB(0x00, 0x00, 0x00));
+    SetBkColor(hdc, RGB(0xe0, 0xf0, 0xff));
+    SetBkMode(hdc, OPAQUE);
+    Size size = dm->GetViewPort().Size();
+    RECT r = {4, 4, size.dx - 4, size.dy - 4};
+    if (gDebugShowStoreStats) {
+        TEXTMETRIC tm{};
+        GetTextMetrics(hdc, &tm);
+        r.top += tm.tmHeight + 4;
+    }
+    HdcDrawText(hdc, stats, -1, &r, DT_LEFT | DT_TOP | DT_NOPREFIX);
+}
+
+// while a hibernated tab is being reloaded, pages that haven't been rendered
+// yet are painted the way they looked before the tab was hibernated
+static bool PaintTabSnapshot(WindowTab* tab, HDC hdc, Rect bounds) {
+    if (!tab->snapshot) {
+        return false;
+    }
+    HDC bmpDC = GetCanvasBitmapDC(tab->win, hdc);
+    if (!bmpDC) {
+        return false;
+    }
+    HGDIOBJ prev = SelectObject(bmpDC, tab->snapshot);
+    BitBlt(hdc, bounds.x, bounds.y, bounds.dx, bounds.dy, bmpDC, bounds.x, bounds.y, SRCCOPY);
+    SelectObject(bmpDC, prev);
+    return true;
+}
+
 static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
     CrashIf(!win->AsFixed());
     if (!win->AsFixed()) {
         return;
     }
     DisplayModel* dm = win->AsFixed();
+    WindowTab* tab = win->CurrentTab();
+    // the snapshot is only valid as long as the view hasn't changed
+    if (tab->snapshot && (dm->GetViewPort() != tab->snapshotViewPort || dm->GetZoomVirtual() != tab->snapshotZoom)) {
+        tab->DeleteSnapshot();
+    }
 
     bool isImage = dm->GetEngine()->IsImageCollection();
     // draw comic books and single images on a black background
@@ -826,13 +934,13 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
     auto gcols = gGlobalPrefs->fixedPageUI.gradientColors;
     auto nGCols = gcols->size();
     if (paintOnBlackWithoutShadow) {
-        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(WIN_COL_BLACK));
-        FillRect(hdc, rcArea, brush);
+        FillRect(hdc, rcArea, GetStockBrush(BLACK_BRUSH));
     } else if (0 == nGCols) {
         auto col = GetAppColor(AppColor::NoDocBg);
-        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(col));
-        FillRect(hdc, rcArea, brush);
+        FillRect(hdc, rcArea, GetCanvasBrush(win, col));
     } else {
+        // the gradient depends on the scroll position
+        win->bufferCanScroll = false;
         COLORREF colors[3];
         colors[0] = ParseColor(gcols->at(0), WIN_COL_WHITE);
         if (nGCols == 1) {
@@ -892,9 +1000,11 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
 
     bool rendering = false;
     Rect screen(Point(), dm->GetViewPort().Size());
+    Rect area = screen.Intersect(ToRect(*rcArea));
 
     bool isRtl = IsUIRightToLeft();
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
+    int lastVisiblePageNo = dm->LastVisiblePageNo();
+    for (int pageNo = dm->FirstVisiblePageNo(); pageNo > 0 && pageNo <= lastVisiblePageNo; ++pageNo) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
             continue;
@@ -905,23 +1015,29 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
         }
 
         Rect bounds = pageInfo->pageOnScreen.Intersect(screen);
+        Rect paintBounds = bounds.Intersect(area);
+        if (paintBounds.IsEmpty()) {
+            continue;
+        }
         // don't paint the frame background for images
         if (!dm->GetEngine()->IsImageCollection()) {
             Rect r = pageInfo->pageOnScreen;
             auto presMode = win->presentation;
-            PaintPageFrameAndShadow(hdc, bounds, r, presMode);
+            PaintPageFrameAndShadow(win, hdc, bounds, r, presMode);
         }
 
         bool renderOutOfDateCue = false;
-        int renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
+        int renderDelay = gRenderCache.Paint(hdc, paintBounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
 
         if (renderDelay != 0) {
-            AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, "MS Shell Dlg", 14));
-            HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
+            win->bufferCanScroll = false;
+            HGDIOBJ hPrevFont = SelectObject(hdc, GetCanvasFont(win, hdc));
             auto col = GetAppColor(AppColor::MainWindowText);
             SetTextColor(hdc, col);
             if (renderDelay != RENDER_DELAY_FAILED) {
-                if (renderDelay < REPAINT_MESSAGE_DELAY_IN_MS) {
+                if (PaintTabSnapshot(tab, hdc, bounds)) {
+                    // the page is repainted once it has been rendered
+                } else if (renderDelay < REPAINT_MESSAGE_DELAY_IN_MS) {
                     RepaintAsync(win, REPAINT_MESSAGE_DELAY_IN_MS / 4);
                 } else {
                     DrawCenteredText(hdc, bounds, _TR("Please wait - rendering..."), isRtl);
@@ -937,12 +1053,13 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
         if (!renderOutOfDateCue) {
             continue;
         }
+        win->bufferCanScroll = false;
 
-        HDC bmpDC = CreateCompatibleDC(hdc);
+        HDC bmpDC = GetCanvasBitmapDC(win, hdc);
         if (!bmpDC) {
             continue;
         }
-        SelectObject(bmpDC, gBitmapReloadingCue);
+        HGDIOBJ prevBmp = SelectObject(bmpDC, gBitmapReloadingCue);
         int size = DpiScale(win->hwndFrame, 16);
         int cx = std::min(bounds.dx, 2 * size);
         int cy = std::min(bounds.dy, 2 * size);
@@ -951,9 +1068,15 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
         int dxDest = std::min(cx, size);
         int dyDest = std::min(cy, size);
         StretchBlt(hdc, x, y, dxDest, dyDest, bmpDC, 0, 0, 16, 16, SRCCOPY);
-        DeleteDC(bmpDC);
+        SelectObject(bmpDC, prevBmp);
     }
 
+    if (dm->IsInMotion()) {
+        RepaintAsync(win, kSettledRepaintDelayMs);
+    }
+
+    PaintFindAllHits(win, hdc);
+
     if (win->showSelection) {
         PaintSelection(win, hdc);
     }
@@ -963,11 +1086,68 @@ static void DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
     }
 
     if (!rendering) {
+        tab->DeleteSnapshot();
         DebugShowLinks(dm, hdc);
     }
+    if (gDebugShowStoreStats || gDebugShowResourceStats) {
+        win->bufferCanScroll = false;
+    }
+    DebugShowStoreStats(dm, hdc);
+    DebugShowResourceStats(dm, hdc);
+}
+
+// only paints area if the rest of the buffer is still up to date (e.g. when
+// the canvas has been scrolled), otherwise all of it
+static void PaintDocumentBuffer(MainWindow* win, RECT area) {
+    DisplayModel* dm = win->AsFixed();
+    HDC hdc = win->buffer->GetDC();
+    Rect rc = win->buffer->rect;
+    bool isUpToDate = dm && win->bufferDm == dm && win->bufferViewPort == dm->GetViewPort() &&
+                      win->bufferZoom == dm->GetZoomVirtual() && win->bufferRotation == dm->GetRotation();
+    if (!isUpToDate || ToRect(area) == rc) {
+        area = ToRECT(rc);
+        win->bufferCanScroll = true;
+    }
+
+    int saved = SaveDC(hdc);
+    IntersectClipRect(hdc, area.left, area.top, area.right, area.bottom);
+    DrawDocument(win, hdc, &area);
+    RestoreDC(hdc, saved);
+
+    win->bufferDm = dm;
+    if (dm) {
+        win->bufferViewPort = dm->GetViewPort();
+        win->bufferZoom = dm->GetZoomVirtual();
+        win->bufferRotation = dm->GetRotation();
+    }
+}
+
+// shows how long painting takes and how often we actually paint and
+// logs it once a second, together with how many repaints were coalesced
+static void UpdateFrameStats(MainWindow* win, double paintMs) {
+    if (win->frameStatsStart.QuadPart == 0) {
+        win->frameStatsStart = TimeGet();
+    }
+    win->nPaints++;
+    win->paintMsTotal += paintMs;
+    double elapsedMs = TimeSinceInMs(win->frameStatsStart);
+    if (elapsedMs < 1000.0) {
+        win->frameRateWnd->ShowFrameRateDur(paintMs);
+        return;
+    }
+    int paintsPerSec = (int)(win->nPaints * 1000.0 / elapsedMs);
+    win->frameRateWnd->ShowFrameStats(paintMs, paintsPerSec);
+    int nCoalesced = std::max(win->nRepaintRequests - win->nPaints, 0);
+    logf("frame stats: %d paints/s, avg paint %.2f ms, %d repaint requests, %d coalesced\n", paintsPerSec,
+         win->paintMsTotal / win->nPaints, win->nRepaintRequests, nCoalesced);
+    win->frameStatsStart = TimeGet();
+    win->nPaints = 0;
+    win->nRepaintRequests = 0;
+    win->paintMsTotal = 0;
 }
 
 static void OnPaintDocument(MainWindow* win) {
+    TIME_TRACE("PaintDocument");
     auto t = TimeGet();
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
@@ -980,13 +1160,14 @@ static void OnPaintDocument(MainWindow* win) {
             FillRect(hdc, &ps.rcPaint, GetStockBrush(WHITE_BRUSH));
             break;
         default:
-            DrawDocument(win, win->buffer->GetDC(), &ps.rcPaint);
+            PaintDocumentBuffer(win, ps.rcPaint);
             win->buffer->Flush(hdc);
     }
 
     EndPaint(win->hwndCanvas, &ps);
+    win->lastPaintTime = TimeGet();
     if (gShowFrameRate) {
-        win->frameRateWnd->ShowFrameRateDur(TimeSinceInMs(t));
+        UpdateFrameStats(win, TimeSinceInMs(t));
     }
 }
 
@@ -1489,18 +1670,37 @@ static LRESULT WndProcCanvasChmUI(MainWindow* win, HWND hwnd, UINT msg, WPARAM w
 
 ///// methods needed for FixedPageUI canvases with loading error /////
 
+// until the document of a hibernated or restored tab has been loaded, show
+// how the tab looked when it was last visible or the thumbnail of its first page
+static void PaintPendingTab(MainWindow* win, HDC hdc) {
+    WindowTab* tab = win->CurrentTab();
+    Rect rc = ClientRect(win->hwndCanvas);
+    if (PaintTabSnapshot(tab, hdc, rc)) {
+        return;
+    }
+    FileState* fs = gFileHistory.FindByPath(tab->filePath);
+    if (!fs || !HasThumbnail(fs)) {
+        return;
+    }
+    Size size = fs->thumbnail->Size();
+    Rect target(rc.x + (rc.dx - size.dx) / 2, rc.y + (rc.dy - size.dy) / 2, size.dx, size.dy);
+    fs->thumbnail->StretchDIBits(hdc, target);
+}
+
 static void OnPaintError(MainWindow* win) {
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
 
-    AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, "MS Shell Dlg", 14));
-    HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
+    HGDIOBJ hPrevFont = SelectObject(hdc, GetCanvasFont(win, hdc));
     auto bgCol = GetAppColor(AppColor::NoDocBg);
-    ScopedGdiObj<HBRUSH> bgBrush(CreateSolidBrush(bgCol));
-    FillRect(hdc, &ps.rcPaint, bgBrush);
-    // TODO: should this be "Error opening %s"?
-    AutoFreeWstr msg(str::Format(_TR("Error loading %s"), win->CurrentTab()->filePath.Get()));
-    DrawCenteredText(hdc, ClientRect(win->hwndCanvas), msg, IsUIRightToLeft());
+    FillRect(hdc, &ps.rcPaint, GetCanvasBrush(win, bgCol));
+    if (win->CurrentTab()->hibernatedState) {
+        PaintPendingTab(win, hdc);
+    } else {
+        // TODO: should this be "Error opening %s"?
+        AutoFreeWstr msg(str::Format(_TR("Error loading %s"), win->CurrentTab()->filePath.Get()));
+        DrawCenteredText(hdc, ClientRect(win->hwndCanvas), msg, IsUIRightToLeft());
+    }
     SelectObject(hdc, hPrevFont);
 
     EndPaint(win->hwndCanvas, &ps);
@@ -1524,6 +1724,40 @@ static LRESULT WndProcCanvasLoadError(MainWindow* win, HWND hwnd, UINT msg, WPAR
 
 ///// methods needed for all types of canvas /////
 
+static double GetRefreshPeriodMs(HWND hwnd) {
+    DWM_TIMING_INFO info{};
+    info.cbSize = sizeof(info);
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    if (SUCCEEDED(dwm::GetCompositionTimingInfo(nullptr, &info)) && info.qpcRefreshPeriod > 0) {
+        return (double)info.qpcRefreshPeriod * 1000.0 / (double)freq.QuadPart;
+    }
+    HDC hdc = GetDC(hwnd);
+    int hz = GetDeviceCaps(hdc, VREFRESH);
+    ReleaseDC(hwnd, hdc);
+    // 0 and 1 mean "default refresh rate of the hardware"
+    if (hz <= 1) {
+        hz = 60;
+    }
+    return 1000.0 / (double)hz;
+}
+
+// paints right away unless the last paint happened less than a display refresh ago,
+// in which case a single paint is scheduled for the next refresh
+static void ScheduleRepaint(MainWindow* win) {
+    win->nRepaintRequests++;
+    if (win->pacedRepaintPending) {
+        return;
+    }
+    double waitMs = GetRefreshPeriodMs(win->hwndCanvas) - TimeSinceInMs(win->lastPaintTime);
+    if (waitMs < 1.0) {
+        WndProcCanvas(win->hwndCanvas, WM_TIMER, REPAINT_TIMER_ID, 0);
+        return;
+    }
+    win->pacedRepaintPending = true;
+    win->delayedRepaintTimer = SetTimer(win->hwndCanvas, REPAINT_TIMER_ID, (uint)ceil(waitMs), nullptr);
+}
+
 void RepaintAsync(MainWindow* win, int delayInMs) {
     // even though RepaintAsync is mostly called from the UI thread,
     // we depend on the repaint message to happen asynchronously
@@ -1532,19 +1766,94 @@ void RepaintAsync(MainWindow* win, int delayInMs) {
             return;
         }
         if (!delayInMs) {
-            WndProcCanvas(win->hwndCanvas, WM_TIMER, REPAINT_TIMER_ID, 0);
+            ScheduleRepaint(win);
         } else if (!win->delayedRepaintTimer) {
             win->delayedRepaintTimer = SetTimer(win->hwndCanvas, REPAINT_TIMER_ID, (uint)delayInMs, nullptr);
         }
     });
 }
 
+// moves what's already in the buffer and on the screen by how much the view port has
+// moved since the last paint (which is cheap, also over remote desktop connections)
+// so that only the newly exposed parts have to be painted
+static bool ScrollCanvas(MainWindow* win) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || !win->buffer || !win->bufferCanScroll || win->bufferDm != dm || win->presentation == PM_BLACK_SCREEN ||
+        win->presentation == PM_WHITE_SCREEN) {
+        return false;
+    }
+    Rect vp = dm->GetViewPort();
+    Rect prev = win->bufferViewPort;
+    if (vp.Size() != prev.Size() || win->bufferZoom != dm->GetZoomVirtual() ||
+        win->bufferRotation != dm->GetRotation()) {
+        return false;
+    }
+    int dx = prev.x - vp.x;
+    int dy = prev.y - vp.y;
+    if (dx == 0 && dy == 0) {
+        return true;
+    }
+    Rect rc = win->buffer->rect;
+    if (abs(dx) >= rc.dx || abs(dy) >= rc.dy) {
+        return false;
+    }
+
+    RECT rcBuffer = ToRECT(Rect(0, 0, rc.dx, rc.dy));
+    ScrollDC(win->buffer->GetDC(), dx, dy, &rcBuffer, &rcBuffer, nullptr, nullptr);
+    win->bufferViewPort = vp;
+    // invalidates the exposed parts
+    ScrollWindowEx(win->hwndCanvas, dx, dy, nullptr, nullptr, nullptr, nullptr, SW_INVALIDATE);
+    UpdateWindow(win->hwndCanvas);
+    return true;
+}
+
+void RepaintScrolledAsync(MainWindow* win) {
+    uitask::Post([win] {
+        if (!MainWindowStillValid(win)) {
+            return;
+        }
+        if (!ScrollCanvas(win)) {
+            win->RedrawAllIncludingNonClient(true);
+        }
+    });
+}
+
+// picks up pages of ebooks that are laid out in the background
+// and page sizes of big PDFs that are read in the background
+static void OnEbookLayoutTimer(MainWindow* win, HWND hwnd) {
+    WindowTab* tab = win->CurrentTab();
+    DisplayModel* dm = win->AsFixed();
+    if (tab && dm) {
+        if (dm->UpdatePageCount()) {
+            UpdateToolbarPageText(win, dm->PageCount(), true);
+        }
+        dm->UpdatePageSizes();
+        if (tab->showTocAfterLayout && !dm->GetEngine()->IsLayoutInProgress()) {
+            tab->showTocAfterLayout = false;
+            SetSidebarVisibility(win, true, gGlobalPrefs->showFavorites);
+        }
+    }
+
+    // documents in other tabs are updated once they're selected
+    for (WindowTab* t : win->Tabs()) {
+        DisplayModel* tdm = t->AsFixed();
+        if (tdm && (tdm->GetEngine()->IsLayoutInProgress() || tdm->GetEngine()->IsPageSizeUpdatePending())) {
+            return;
+        }
+        if (t->showTocAfterLayout) {
+            return;
+        }
+    }
+    KillTimer(hwnd, EBOOK_LAYOUT_TIMER_ID);
+}
+
 static void OnTimer(MainWindow* win, HWND hwnd, WPARAM timerId) {
     Point pt;
 
     switch (timerId) {
         case REPAINT_TIMER_ID:
             win->delayedRepaintTimer = 0;
+            win->pacedRepaintPending = false;
             KillTimer(hwnd, REPAINT_TIMER_ID);
             win->RedrawAllIncludingNonClient(true);
             break;
@@ -1586,6 +1895,14 @@ static void OnTimer(MainWindow* win, HWND hwnd, WPARAM timerId) {
             }
             break;
 
+        case EBOOK_LAYOUT_TIMER_ID:
+            OnEbookLayoutTimer(win, hwnd);
+            break;
+
+        case HIBERNATE_TABS_TIMER_ID:
+            HibernateBackgroundTabs(win);
+            break;
+
         case AUTO_RELOAD_TIMER_ID:
             KillTimer(hwnd, AUTO_RELOAD_TIMER_ID);
             if (win->CurrentTab() && win->CurrentTab()->reloadOnFocus) {
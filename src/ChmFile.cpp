@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include <chm_lib.h>
 #include "utils/ByteReader.h"
+#include "utils/Dict.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
@@ -14,42 +15,123 @@
 #include "EbookBase.h"
 #include "ChmFile.h"
 
+// objects bigger than that aren't cached
+constexpr size_t kMaxCachedChmObjectSize = 1024 * 1024;
+constexpr size_t kMaxChmCacheSize = 8 * 1024 * 1024;
+
+// LZX data can only be decompressed from the start of a reset interval
+// (usually 2 or 4 blocks of 32 kB), so reaching a topic deep in a big file
+// decompresses all the blocks before it in its reset interval. CHMLib
+// keeps decompressed blocks in a direct mapped cache which by default only
+// has 5 slots. With 512 slots (at most 16 MB, slots are allocated on first
+// use) the blocks of topics visited before stay decompressed
+constexpr int kChmBlocksCached = 512;
+
+ChmFile::ChmFile() {
+    InitializeCriticalSection(&cacheAccess);
+}
+
 ChmFile::~ChmFile() {
     chm_close(chmHandle);
+    delete objectIndex;
+    for (auto& co : cachedObjects) {
+        co.data.Free();
+    }
+    DeleteCriticalSection(&cacheAccess);
 }
 
-bool ChmFile::HasData(const char* fileName) const {
-    if (!fileName) {
+static int ChmIndexEntry(struct chmFile*, struct chmUnitInfo* info, void* data) {
+    if (str::IsEmpty(info->path)) {
+        return CHM_ENUMERATOR_CONTINUE;
+    }
+    ChmFile* chm = (ChmFile*)data;
+    ChmObjectInfo obj;
+    obj.start = info->start;
+    obj.length = info->length;
+    obj.space = info->space;
+    str::ToLowerInPlace(info->path);
+    if (chm->objectIndex->Insert(info->path, chm->objects.isize())) {
+        chm->objects.Append(obj);
+    }
+    return CHM_ENUMERATOR_CONTINUE;
+}
+
+void ChmFile::BuildObjectIndex() {
+    objectIndex = new dict::MapStrToInt(1024);
+    chm_enumerate(chmHandle, CHM_ENUMERATE_ALL, ChmIndexEntry, this);
+}
+
+// like chm_resolve_object() (which compares paths case-insensitively)
+// but a hash table lookup. Also tries with backslashes replaced
+static bool LookupChmObject(const dict::MapStrToInt* index, const char* fileName, int* idxOut) {
+    char key[CHM_MAX_PATHLEN + 1];
+    size_t len = str::Len(fileName);
+    if (len > CHM_MAX_PATHLEN) {
+        return false;
+    }
+    bool hasBackslash = false;
+    for (size_t i = 0; i <= len; i++) {
+        char c = fileName[i];
+        hasBackslash |= c == '\\';
+        key[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    if (index->Get(key, idxOut)) {
+        return true;
+    }
+    if (!hasBackslash) {
         return false;
     }
+    // Microsoft's HTML Help CHM viewer tolerates backslashes in URLs
+    str::TransCharsInPlace(key, "\\", "/");
+    return index->Get(key, idxOut);
+}
 
+// objectIdxOut is -1 for objects not in objects (shouldn't happen)
+bool ChmFile::FindObject(const char* fileName, struct chmUnitInfo* info, int* objectIdxOut) const {
+    *objectIdxOut = -1;
+    if (!fileName) {
+        return false;
+    }
     if (!str::StartsWith(fileName, "/")) {
         fileName = str::JoinTemp("/", fileName);
     } else if (str::StartsWith(fileName, "///")) {
         fileName += 2;
     }
 
-    struct chmUnitInfo info {};
-    return chm_resolve_object(chmHandle, fileName, &info) == CHM_RESOLVE_SUCCESS;
-}
-
-ByteSlice ChmFile::GetData(const char* fileName) const {
-    if (!str::StartsWith(fileName, "/")) {
-        fileName = str::JoinTemp("/", fileName);
-    } else if (str::StartsWith(fileName, "///")) {
-        fileName = fileName + 2;
+    int idx;
+    if (objectIndex && LookupChmObject(objectIndex, fileName, &idx)) {
+        const ChmObjectInfo& obj = objects.at(idx);
+        info->start = obj.start;
+        info->length = obj.length;
+        info->space = obj.space;
+        info->flags = 0;
+        info->path[0] = 0;
+        *objectIdxOut = idx;
+        return true;
     }
 
-    struct chmUnitInfo info;
-    int res = chm_resolve_object(chmHandle, fileName, &info);
+    // in case the enumeration missed something
+    int res = chm_resolve_object(chmHandle, fileName, info);
     if (CHM_RESOLVE_SUCCESS != res && str::FindChar(fileName, '\\')) {
         // Microsoft's HTML Help CHM viewer tolerates backslashes in URLs
         auto fileNameTemp = str::DupTemp(fileName);
         str::TransCharsInPlace(fileNameTemp, "\\", "/");
-        res = chm_resolve_object(chmHandle, fileNameTemp, &info);
+        res = chm_resolve_object(chmHandle, fileNameTemp, info);
     }
+    return CHM_RESOLVE_SUCCESS == res;
+}
 
-    if (CHM_RESOLVE_SUCCESS != res) {
+bool ChmFile::HasData(const char* fileName) const {
+    struct chmUnitInfo info {};
+    int idx;
+    return FindObject(fileName, &info, &idx);
+}
+
+// the caller owns the returned data
+ByteSlice ChmFile::GetData(const char* fileName) const {
+    struct chmUnitInfo info;
+    int objectIdx;
+    if (!FindObject(fileName, &info, &objectIdx)) {
         return {};
     }
     size_t len = (size_t)info.length;
@@ -58,15 +140,52 @@ ByteSlice ChmFile::GetData(const char* fileName) const {
         return {};
     }
 
+    if (objectIdx >= 0) {
+        ScopedCritSec scope(&cacheAccess);
+        for (size_t i = 0; i < cachedObjects.size(); i++) {
+            ChmCachedObject co = cachedObjects[i];
+            if (co.objectIdx != objectIdx) {
+                continue;
+            }
+            cachedObjects.RemoveAt(i);
+            cachedObjects.Append(co);
+            // +1 for 0 terminator for C string compatibility
+            u8* d = AllocArray<u8>(len + 1);
+            if (!d) {
+                return {};
+            }
+            memcpy(d, co.data.data(), len);
+            return {d, len};
+        }
+    }
+
     // +1 for 0 terminator for C string compatibility
     u8* d = AllocArray<u8>(len + 1);
     if (!d) {
         return {};
     }
     if (!chm_retrieve_object(chmHandle, &info, d, 0, len)) {
+        free(d);
         return {};
     }
 
+    if (objectIdx >= 0 && len <= kMaxCachedChmObjectSize) {
+        ChmCachedObject co;
+        co.objectIdx = objectIdx;
+        co.data = {(u8*)memdup(d, len), len};
+        if (co.data.data()) {
+            ScopedCritSec scope(&cacheAccess);
+            cachedObjects.Append(co);
+            cachedSize += len;
+            while (cachedSize > kMaxChmCacheSize) {
+                ChmCachedObject& oldest = cachedObjects[0];
+                cachedSize -= oldest.data.size();
+                oldest.data.Free();
+                cachedObjects.RemoveAt(0);
+            }
+        }
+    }
+
     return {d, len};
 }
 
@@ -278,6 +397,8 @@ bool ChmFile::Load(const char* path) {
     if (!chmHandle) {
         return false;
     }
+    chm_set_param(chmHandle, CHM_PARAM_MAX_BLOCKS_CACHED, kChmBlocksCached);
+    BuildObjectIndex();
 
     ParseWindowsData();
     if (!ParseSystemData()) {
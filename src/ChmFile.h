@@ -1,9 +1,37 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+namespace dict {
+class MapStrToInt;
+}
+
+// where an object is stored inside the CHM file
+struct ChmObjectInfo {
+    u64 start = 0;
+    u64 length = 0;
+    int space = 0;
+};
+
+// recently retrieved object data
+struct ChmCachedObject {
+    int objectIdx = 0;
+    ByteSlice data;
+};
+
 struct ChmFile {
     struct chmFile* chmHandle = nullptr;
 
+    // all objects of the file, indexed by lower-cased path
+    // (chm_resolve_object() walks the directory on every call)
+    Vec<ChmObjectInfo> objects;
+    dict::MapStrToInt* objectIndex = nullptr;
+
+    // decompressing LZX blocks is expensive and the same CSS and images
+    // get requested over and over again. Most recently used last
+    mutable Vec<ChmCachedObject> cachedObjects;
+    mutable size_t cachedSize = 0;
+    mutable CRITICAL_SECTION cacheAccess;
+
     // Data parsed from /#WINDOWS, /#STRINGS, /#SYSTEM files inside CHM file
     AutoFreeStr title;
     AutoFreeStr tocPath;
@@ -17,10 +45,12 @@ struct ChmFile {
     bool ParseSystemData();
     bool ParseTocOrIndex(EbookTocVisitor* visitor, const char* path, bool isIndex) const;
     void FixPathCodepage(AutoFreeStr& path, uint& fileCP);
+    void BuildObjectIndex();
+    bool FindObject(const char* fileName, struct chmUnitInfo* info, int* objectIdxOut) const;
 
     bool Load(const char* fileName);
 
-    ChmFile() = default;
+    ChmFile();
     ~ChmFile();
 
     bool HasData(const char* fileName) const;
@@ -3,7 +3,10 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
+#include "utils/HtmlParserLookup.h"
+#include "utils/HtmlPullParser.h"
 #include "utils/HtmlWindow.h"
+#include "utils/ThreadUtil.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
@@ -15,6 +18,7 @@
 #include "DocController.h"
 #include "EngineBase.h"
 #include "EbookBase.h"
+#include "EbookDoc.h"
 #include "ChmFile.h"
 #include "GlobalPrefs.h"
 #include "ChmModel.h"
@@ -84,11 +88,22 @@ ChmModel::ChmModel(DocControllerCallback* cb) : DocController(cb) {
 }
 
 ChmModel::~ChmModel() {
-    EnterCriticalSection(&docAccess);
+    if (prefetchThread) {
+        EnterCriticalSection(&docAccess);
+        stopPrefetch = true;
+        LeaveCriticalSection(&docAccess);
+        SetEvent(prefetchEvent);
+        WaitForSingleObject(prefetchThread, INFINITE);
+        CloseHandle(prefetchThread);
+        CloseHandle(prefetchEvent);
+    }
+    // not under docAccess because this waits for the thread
+    // that calls GetDataForUrl()
     // TODO: deleting htmlWindow seems to spin a modal loop which
     //       can lead to WM_PAINT being dispatched for the parent
     //       hwnd and then crashing in SumatraPDF.cpp's DrawDocument
     delete htmlWindow;
+    EnterCriticalSection(&docAccess);
     delete htmlWindowCb;
     delete doc;
     delete tocTrace;
@@ -446,7 +461,94 @@ bool ChmModel::OnBeforeNavigate(const char* url, bool newWindow) {
     return false;
 }
 
+// don't decompress more than that many resources ahead of the browser
+constexpr int kMaxPrefetchUrls = 64;
+
+static DWORD WINAPI ChmPrefetchThreadProc(void* data) {
+    SetThreadName("ChmPrefetchThread");
+    ChmModel* cm = (ChmModel*)data;
+    for (;;) {
+        WaitForSingleObject(cm->prefetchEvent, INFINITE);
+        for (;;) {
+            AutoFreeStr url;
+            {
+                ScopedCritSec scope(&cm->docAccess);
+                if (cm->stopPrefetch) {
+                    return 0;
+                }
+                if (cm->prefetchUrls.Size() == 0) {
+                    break;
+                }
+                url.SetCopy(cm->prefetchUrls.at(0));
+                cm->prefetchUrls.RemoveAt(0);
+            }
+            // the browser's request for this url waits at most
+            // for the one being decompressed
+            cm->GetDataForUrl(url);
+        }
+    }
+}
+
+// images and style sheets of a topic are loaded into the cache
+// while the browser is still busy with the topic's html
+void ChmModel::PrefetchLinkedData(const char* topicUrl, const ByteSlice& html) {
+    // whatever hasn't been prefetched for the previous topic is no longer needed
+    prefetchUrls.Reset();
+    HtmlPullParser parser(html);
+    HtmlToken* tok;
+    while ((tok = parser.Next()) != nullptr && !tok->IsError() && prefetchUrls.Size() < kMaxPrefetchUrls) {
+        if (!tok->IsStartTag() && !tok->IsEmptyElementEndTag()) {
+            continue;
+        }
+        AttrInfo* attr = nullptr;
+        if (Tag_Img == tok->tag) {
+            attr = tok->GetAttrByName("src");
+        } else if (Tag_Link == tok->tag) {
+            attr = tok->GetAttrByName("href");
+        }
+        if (!attr || attr->valLen == 0) {
+            continue;
+        }
+        char* link = str::DupTemp(attr->val, attr->valLen);
+        if (IsExternalUrl(link)) {
+            continue;
+        }
+        AutoFreeStr fullUrl = NormalizeURL(link, topicUrl);
+        AutoFreeStr plainUrl = url::GetFullPathTemp(fullUrl);
+        // the browser requests urls relative to the root
+        const char* s = plainUrl.Get();
+        if (*s == '/') {
+            s++;
+        }
+        if (!FindDataForUrl(s) && doc->HasData(s)) {
+            prefetchUrls.AppendIfNotExists(s);
+        }
+    }
+    if (prefetchUrls.Size() == 0) {
+        return;
+    }
+    if (!prefetchThread) {
+        prefetchEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        if (!prefetchEvent) {
+            return;
+        }
+        prefetchThread = CreateThread(nullptr, 0, ChmPrefetchThreadProc, this, 0, nullptr);
+        if (!prefetchThread) {
+            CloseHandle(prefetchEvent);
+            prefetchEvent = nullptr;
+            return;
+        }
+    }
+    SetEvent(prefetchEvent);
+}
+
+static bool IsHtmlUrl(const char* url) {
+    const char* ext = path::GetExtTemp(url);
+    return str::EqI(ext, ".htm") || str::EqI(ext, ".html");
+}
+
 // Load and cache data for a given url inside CHM file.
+// Called on HtmlWindow's and on the prefetch thread
 ByteSlice ChmModel::GetDataForUrl(const char* url) {
     ScopedCritSec scope(&docAccess);
     char* plainUrl = url::GetFullPathTemp(url);
@@ -460,6 +562,9 @@ ByteSlice ChmModel::GetDataForUrl(const char* url) {
             return {};
         }
         urlDataCache.Append(e);
+        if (IsHtmlUrl(plainUrl)) {
+            PrefetchLinkedData(plainUrl, e->data);
+        }
     }
     return e->data;
 }
@@ -629,8 +734,9 @@ class ChmThumbnailTask : public HtmlWindowCallback {
     }
 
     ~ChmThumbnailTask() override {
-        EnterCriticalSection(&docAccess);
+        // waits for the thread that calls GetDataForUrl()
         delete hw;
+        EnterCriticalSection(&docAccess);
         DestroyWindow(hwnd);
         delete doc;
         for (auto&& d : data) {
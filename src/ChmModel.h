@@ -82,6 +82,12 @@ struct ChmModel : DocController {
     float initZoom = kInvalidZoom;
 
     Vec<ChmCacheEntry*> urlDataCache;
+    // urls linked from the current topic that haven't been loaded yet,
+    // protected by docAccess
+    StrVec prefetchUrls;
+    HANDLE prefetchThread = nullptr;
+    HANDLE prefetchEvent = nullptr;
+    bool stopPrefetch = false;
     // use a pool allocator for strings that aren't freed until this ChmModel
     // is deleted (e.g. for titles and URLs for ChmTocItem and ChmCacheEntry)
     PoolAllocator poolAlloc;
@@ -90,6 +96,7 @@ struct ChmModel : DocController {
     void DisplayPage(const char* pageUrl);
 
     ChmCacheEntry* FindDataForUrl(const char* url) const;
+    void PrefetchLinkedData(const char* topicUrl, const ByteSlice& html);
 
     void ZoomTo(float zoomLevel) const;
 };
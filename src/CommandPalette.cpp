@@ -139,14 +139,34 @@ static bool IsCmdInMenuList(i32 cmdId, UINT_PTR* a) {
 
 #define IsCmdInList(name) __cmdInList(cmdId, name, dimof(name))
 
+// strings shown in the palette with lower-cased copies for matching and
+// the result of the last query, to filter incrementally when the query is extended
+struct PaletteStrings {
+    StrVec strs;
+    StrVec lower;
+    // indexes into strs, best match first
+    Vec<int> matches;
+
+    void Append(const char* s);
+};
+
+void PaletteStrings::Append(const char* s) {
+    strs.Append(s);
+    char* sLower = str::DupTemp(s);
+    str::ToLowerInPlace(sLower);
+    lower.Append(sLower);
+}
+
 struct CommandPaletteWnd : Wnd {
     ~CommandPaletteWnd() override = default;
     MainWindow* win = nullptr;
 
     Edit* editQuery = nullptr;
-    StrVec filesInTabs;
-    StrVec filesInHistory;
-    StrVec commands;
+    PaletteStrings filesInTabs;
+    PaletteStrings filesInHistory;
+    PaletteStrings commands;
+    // the query the matches in PaletteStrings are for
+    str::Str lastFilter;
     ListBox* listBox = nullptr;
     Static* staticHelp = nullptr;
 
@@ -281,6 +301,10 @@ static bool AllowCommand(const CommandPaletteBuildCtx& ctx, i32 cmdId) {
 
     switch (cmdId) {
         case CmdDebugShowLinks:
+        case CmdDebugShowStoreStats:
+        case CmdDebugShowResourceStats:
+        case CmdDebugToggleTimeTrace:
+        case CmdDebugSaveTimeTrace:
             return gIsDebugBuild || gIsPreReleaseBuild;
         case CmdDebugTestApp:
         case CmdDebugShowNotif:
@@ -347,7 +371,9 @@ void CommandPaletteWnd::CollectStrings(MainWindow* win) {
             }
             const char* name = tab2->filePath.Get();
             name = path::GetBaseNameTemp(name);
-            filesInTabs.AppendIfNotExists(name);
+            if (!filesInTabs.strs.Contains(name)) {
+                filesInTabs.Append(name);
+            }
         }
     }
 
@@ -425,48 +451,112 @@ bool CommandPaletteWnd::PreTranslateMessage(MSG& msg) {
     return false;
 }
 
-// filter is one or more words separated by whitespace
-// filter matches if all words match, ignoring the case
-static bool FilterMatches(const char* str, const char* filter) {
-    // empty filter matches all
-    if (str::EmptyOrWhiteSpaceOnly(filter)) {
-        return true;
-    }
-    StrVec words;
+// filter is one or more words separated by whitespace.
+// Splits it into unique, lower-cased words
+static void ParseFilter(const char* filter, StrVec& words) {
     char* s = str::DupTemp(filter);
+    str::ToLowerInPlace(s);
     char* wordStart = s;
-    bool wasWs = false;
     while (*s) {
         if (str::IsWs(*s)) {
             *s = 0;
-            if (!wasWs) {
+            if (*wordStart) {
                 words.AppendIfNotExists(wordStart);
-                wasWs = true;
             }
             wordStart = s + 1;
         }
         s++;
     }
-    if (str::Len(wordStart) > 0) {
+    if (*wordStart) {
         words.AppendIfNotExists(wordStart);
     }
-    // all words must be present
+}
+
+static bool IsWordStart(const char* s, const char* pos) {
+    return pos == s || !isalnum((u8)pos[-1]);
+}
+
+// s and word are lower-case. Returns -1 if word isn't in s, not even as a
+// subsequence of characters. A substring always scores higher than
+// a subsequence, starting at a word boundary and close to the start more so
+static int ScoreWord(const char* s, const char* word) {
+    const char* pos = str::Find(s, word);
+    if (pos) {
+        int score = 2000 - std::min((int)(pos - s), 999);
+        if (IsWordStart(s, pos)) {
+            score += 1000;
+        }
+        return score;
+    }
+    // consecutive characters and characters at word boundaries score higher
+    int score = 500;
+    const char* prev = nullptr;
+    for (const char* w = word; *w; w++) {
+        pos = str::FindChar(prev ? prev + 1 : s, *w);
+        if (!pos) {
+            return -1;
+        }
+        if (prev && pos == prev + 1) {
+            score += 5;
+        } else if (prev) {
+            score -= std::min((int)(pos - prev), 50);
+        }
+        if (IsWordStart(s, pos)) {
+            score += 10;
+        }
+        prev = pos;
+    }
+    return std::clamp(score, 1, 999);
+}
+
+// all words must match
+static int ScoreMatch(const char* s, const StrVec& words) {
+    int score = 0;
     int nWords = words.Size();
     for (int i = 0; i < nWords; i++) {
-        auto word = words.at(i);
-        if (!str::ContainsI(str, word)) {
-            return false;
+        int wordScore = ScoreWord(s, words.at(i));
+        if (wordScore < 0) {
+            return -1;
         }
+        score += wordScore;
     }
-    return true;
+    return score;
 }
 
-static void FilterStrings(StrVec& strs, const char* filter, StrVec& matchedOut) {
-    for (char* s : strs) {
-        if (!FilterMatches(s, filter)) {
-            continue;
+struct PaletteMatch {
+    int idx;
+    int score;
+};
+
+// if incremental, only strings that matched a shorter version of the query can match
+static void FilterStrings(PaletteStrings& ps, const StrVec& words, bool incremental, StrVec& matchedOut) {
+    int n = ps.strs.Size();
+    if (words.Size() == 0) {
+        ps.matches.Reset();
+        for (int i = 0; i < n; i++) {
+            ps.matches.Append(i);
+            matchedOut.Append(ps.strs.at(i));
         }
-        matchedOut.Append(s);
+        return;
+    }
+
+    Vec<PaletteMatch> matches;
+    int nCandidates = incremental ? ps.matches.isize() : n;
+    for (int i = 0; i < nCandidates; i++) {
+        int idx = incremental ? ps.matches.at(i) : i;
+        int score = ScoreMatch(ps.lower.at(idx), words);
+        if (score >= 0) {
+            matches.Append({idx, score});
+        }
+    }
+    // best first, keep the original order for the same score
+    std::sort(matches.begin(), matches.end(), [](const PaletteMatch& a, const PaletteMatch& b) {
+        return a.score != b.score ? a.score > b.score : a.idx < b.idx;
+    });
+    ps.matches.Reset();
+    for (PaletteMatch& m : matches) {
+        ps.matches.Append(m.idx);
+        matchedOut.Append(ps.strs.at(m.idx));
     }
 }
 
@@ -478,19 +568,27 @@ const char* SkipWS(const char* s) {
 }
 
 void CommandPaletteWnd::FilterStringsForQuery(const char* filter, StrVec& strings) {
+    // extending the query can only remove matches
+    bool incremental = lastFilter.size() > 0 && str::StartsWith(filter, lastFilter.Get());
+    lastFilter.Reset();
+    lastFilter.Append(filter);
+
     filter = SkipWS(filter);
     bool skipFiles = (filter[0] == '>');
     if (skipFiles) {
         ++filter;
         filter = SkipWS(filter);
     }
+    StrVec words;
+    ParseFilter(filter, words);
+
     // for efficiency, reusing existing model
     strings.Reset();
     if (!skipFiles) {
-        FilterStrings(filesInTabs, filter, strings);
-        FilterStrings(filesInHistory, filter, strings);
+        FilterStrings(filesInTabs, words, incremental, strings);
+        FilterStrings(filesInHistory, words, incremental, strings);
     }
-    FilterStrings(commands, filter, strings);
+    FilterStrings(commands, words, incremental, strings);
 }
 
 void CommandPaletteWnd::QueryChanged() {
@@ -558,7 +656,7 @@ void CommandPaletteWnd::ExecuteCurrentSelection() {
         return;
     }
 
-    bool isFromTab = filesInTabs.Contains(s);
+    bool isFromTab = filesInTabs.strs.Contains(s);
     if (isFromTab) {
         WindowTab* tab = FindOpenedFile(s);
         if (tab) {
@@ -70,6 +70,8 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdFindNextSel, "Find Next Selection")                              \
     V(CmdFindPrevSel, "Find Previous Selection")                          \
     V(CmdFindMatch, "Find: Match Case")                                   \
+    V(CmdFindAll, "Find All")                                             \
+    V(CmdShowPageOverview, "Page Overview")                               \
     V(CmdSaveAnnotations, "Save Annotations to existing PDF")             \
     V(CmdEditAnnotations, "Edit Annotations")                             \
     V(CmdSelectAnnotation, "Select Annotation in Editor")                 \
@@ -127,11 +129,15 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdFavoriteDel, "Delete Favorite")                                  \
     V(CmdFavoriteToggle, "Toggle Favorites")                              \
     V(CmdDebugShowLinks, "Debug: Show Links")                             \
+    V(CmdDebugShowStoreStats, "Debug: Show Store Stats")                  \
+    V(CmdDebugShowResourceStats, "Debug: Show Resource Stats")            \
     V(CmdDebugCrashMe, "Debug: Crash Me")                                 \
     V(CmdDebugDownloadSymbols, "Debug: Download Symbols")                 \
     V(CmdDebugTestApp, "Debug: Test App")                                 \
     V(CmdDebugShowNotif, "Debug: Show Notification")                      \
     V(CmdDebugStartStressTest, "Debug: Start Stress Test")                \
+    V(CmdDebugToggleTimeTrace, "Debug: Record Time Trace")                \
+    V(CmdDebugSaveTimeTrace, "Debug: Save Time Trace")                    \
     V(CmdCreateAnnotText, "Create Text Annotation")                       \
     V(CmdCreateAnnotLink, "Create Link Annotation")                       \
     V(CmdCreateAnnotFreeText, "Create Free Text Annotation")              \
@@ -9,6 +9,7 @@
 
 #include "utils/WinDynCalls.h"
 #include "utils/DbgHelpDyn.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/HttpUtil.h"
 #include "utils/LzmaSimpleArchive.h"
@@ -81,6 +82,8 @@ static HeapAllocator* gCrashHandlerAllocator = nullptr;
 static char* gSymbolsUrl = nullptr;
 static char* gCrashDumpPath = nullptr;
 static char* gSymbolPath = nullptr;
+// symbols of each build are cached in their own sub-directory of gSymbolsCacheDir
+static char* gSymbolsCacheDir = nullptr;
 static char* gSymbolsDir = nullptr;
 static char* gLibMupdfPdbPath = nullptr;
 static char* gSumatraPdfDllPdbPath = nullptr;
@@ -90,6 +93,9 @@ static char* gSettingsFile = nullptr;
 static char* gModulesInfo = nullptr;
 static HANDLE gDumpEvent = nullptr;
 static HANDLE gDumpThread = nullptr;
+// set once the minidump and the crash report (with the symbols available
+// locally) have been written, before symbols are downloaded
+static HANDLE gReportSavedEvent = nullptr;
 static bool isDllBuild = false;
 static bool gCrashed = false;
 char* gCrashFilePath = nullptr;
@@ -201,6 +207,80 @@ static void DeleteSymbolsIfExist() {
     logf("DeleteSymbolsIfExist: deleted '%s' (%d)\n", gSumatraPdfDllPdbPath, (int)ok);
 }
 
+// only keep symbols for this many builds
+constexpr int kMaxCachedSymbolBuilds = 3;
+
+static FILETIME GetDirModificationTime(const char* dir) {
+    WIN32_FILE_ATTRIBUTE_DATA fad{};
+    GetFileAttributesExW(ToWstrTemp(dir), GetFileExInfoStandard, &fad);
+    return fad.ftLastWriteTime;
+}
+
+// removes the symbols of the least recently written builds
+// and those stored directly in gSymbolsCacheDir by older versions
+static void PruneSymbolsCache() {
+    if (str::Eq(gSymbolsCacheDir, gSymbolsDir)) {
+        return;
+    }
+    const char* legacyNames[] = {"SumatraPDF.pdb", "SumatraPDF-dll.pdb", "libmupdf.pdb"};
+    for (const char* name : legacyNames) {
+        file::Delete(path::JoinTemp(gSymbolsCacheDir, name));
+    }
+
+    StrVec dirs;
+    CollectPathsFromDirectory(path::JoinTemp(gSymbolsCacheDir, "*"), dirs, true);
+    Vec<FILETIME> times;
+    for (char* dir : dirs) {
+        times.Append(GetDirModificationTime(dir));
+    }
+    int nKept = 1; // the current build's directory
+    while (dirs.Size() > 0) {
+        int newest = -1;
+        for (int i = 0; i < dirs.Size(); i++) {
+            if (!str::EqI(dirs.at(i), gSymbolsDir) &&
+                (newest < 0 || CompareFileTime(&times.at(i), &times.at(newest)) > 0)) {
+                newest = i;
+            }
+        }
+        if (newest < 0) {
+            break;
+        }
+        if (nKept < kMaxCachedSymbolBuilds) {
+            nKept++;
+        } else {
+            bool ok = dir::RemoveAll(dirs.at(newest));
+            logf("PruneSymbolsCache: deleted '%s' (%d)\n", dirs.at(newest), (int)ok);
+        }
+        dirs.RemoveAt(newest);
+        times.RemoveAt(newest);
+    }
+}
+
+// the archive has the symbols of both the static and the dll build
+static bool IsSymbolsFileNeeded(const char* name, bool dllBuild) {
+    if (str::EqI(name, "SumatraPDF.pdb")) {
+        return !dllBuild;
+    }
+    if (str::EqI(name, "SumatraPDF-dll.pdb") || str::EqI(name, "libmupdf.pdb")) {
+        return dllBuild;
+    }
+    return true;
+}
+
+struct ExtractSymbolsData {
+    lzma::SimpleArchive* archive = nullptr;
+    int idx = 0;
+    char* filePath = nullptr;
+    bool ok = false;
+};
+
+static DWORD WINAPI ExtractSymbolsThread(LPVOID data) {
+    auto d = (ExtractSymbolsData*)data;
+    d->ok = lzma::ExtractFileByIdxToPath(d->archive, d->idx, d->filePath, gCrashHandlerAllocator);
+    return 0;
+}
+
+// each needed .pdb file is decompressed straight to disk on its own thread
 static bool ExtractSymbols(const u8* archiveData, size_t dataSize, const char* dstDir, Allocator* allocator) {
     logf("ExtractSymbols: dir '%s', size: %d\n", dstDir, (int)dataSize);
     lzma::SimpleArchive archive;
@@ -210,27 +290,49 @@ static bool ExtractSymbols(const u8* archiveData, size_t dataSize, const char* d
         return false;
     }
 
+    bool dllBuild = IsDllBuild();
+    Vec<ExtractSymbolsData> files(archive.filesCount, allocator);
     for (int i = 0; i < archive.filesCount; i++) {
-        lzma::FileInfo* fi = &(archive.files[i]);
-        const char* name = fi->name;
+        const char* name = archive.files[i].name;
         logf("ExtractSymbols: file %d is '%s'\n", i, name);
-        u8* uncompressed = GetFileDataByIdx(&archive, i, allocator);
-        if (!uncompressed) {
-            return false;
+        if (!IsSymbolsFileNeeded(name, dllBuild)) {
+            continue;
+        }
+        ExtractSymbolsData d;
+        d.archive = &archive;
+        d.idx = i;
+        d.filePath = path::Join(allocator, dstDir, name);
+        if (!d.filePath) {
+            ok = false;
+            break;
         }
-        char* filePath = path::Join(allocator, dstDir, name);
-        if (!filePath) {
-            return false;
+        files.Append(d);
+    }
+
+    // the last file is extracted on this thread
+    Vec<HANDLE> threads(files.size(), allocator);
+    for (int i = 0; ok && i < files.isize() - 1; i++) {
+        HANDLE h = CreateThread(nullptr, 0, ExtractSymbolsThread, &files.at(i), 0, nullptr);
+        if (h) {
+            threads.Append(h);
+        } else {
+            ExtractSymbolsThread(&files.at(i));
         }
-        ByteSlice d = {uncompressed, fi->uncompressedSize};
-        ok = file::WriteFile(filePath, d);
-
-        Allocator::Free(allocator, filePath);
-        Allocator::Free(allocator, uncompressed);
-        if (!ok) {
-            logf("ExtractSymbols: failed to write '%s'\n", filePath);
-            return false;
+    }
+    if (ok && files.size() > 0) {
+        ExtractSymbolsThread(&files.Last());
+    }
+    for (HANDLE h : threads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+
+    for (ExtractSymbolsData& d : files) {
+        if (!d.ok) {
+            logf("ExtractSymbols: failed to write '%s'\n", d.filePath);
+            ok = false;
         }
+        Allocator::Free(allocator, d.filePath);
     }
     return ok;
 }
@@ -255,6 +357,7 @@ static bool DownloadAndUnzipSymbols(const char* symDir) {
     }
 
     DeleteSymbolsIfExist();
+    PruneSymbolsCache();
 
     HttpRsp rsp;
     if (!HttpGet(gSymbolsUrl, &rsp)) {
@@ -272,16 +375,24 @@ static bool DownloadAndUnzipSymbols(const char* symDir) {
     return ok;
 }
 
-bool CrashHandlerDownloadSymbols() {
-    log("CrashHandlerDownloadSymbols()\n");
-    if (!dir::Create(gSymbolsDir)) {
-        log("CrashHandlerDownloadSymbols: couldn't create symbols dir\n");
+// initializes dbghelp with the symbols already on disk
+static bool InitializeLocalSymbols() {
+    if (!dir::CreateAll(gSymbolsDir)) {
+        log("InitializeLocalSymbols: couldn't create symbols dir\n");
         return false;
     }
 
     WCHAR* ws = ToWstrTemp(gSymbolPath);
     if (!dbghelp::Initialize(ws, false)) {
-        log("CrashHandlerDownloadSymbols: dbghelp::Initialize() failed\n");
+        log("InitializeLocalSymbols: dbghelp::Initialize() failed\n");
+        return false;
+    }
+    return true;
+}
+
+bool CrashHandlerDownloadSymbols() {
+    log("CrashHandlerDownloadSymbols()\n");
+    if (!InitializeLocalSymbols()) {
         return false;
     }
 
@@ -295,6 +406,7 @@ bool CrashHandlerDownloadSymbols() {
         return false;
     }
 
+    WCHAR* ws = ToWstrTemp(gSymbolPath);
     if (!dbghelp::Initialize(ws, true)) {
         log("CrashHandlerDownloadSymbols: second dbghelp::Initialize() failed\n");
         return false;
@@ -360,10 +472,11 @@ void _uploadDebugReportIfFunc(bool cond, __unused const char* condStr) {
     }
 }
 
+// report is the crash report built with the symbols available locally.
 // If we can't resolve the symbols, we assume it's because we don't have symbols
-// so we'll try to download them and retry. If we can resolve symbols, we'll
-// get the callstacks etc. and submit to our server for analysis.
-void TryUploadCrashReport() {
+// so we'll try to download them and rebuild the report. Then we submit
+// the callstacks etc. to our server for analysis.
+static void TryUploadCrashReport(char* report) {
     log("TryUploadCrashReport()\n");
     if (!CrashHandlerCanUseNet()) {
         log("TryUploadCrashReport(): skipping because !CrashHandlerCanUseNet()\n");
@@ -372,19 +485,21 @@ void TryUploadCrashReport() {
 
     logf("TryUploadCrashReport: gSymbolPathW: '%s'\n", gSymbolPath);
 
-    bool ok = CrashHandlerDownloadSymbols();
-    if (!ok) {
-        log("TryUploadCrashReport(): CrashHandlerDownloadSymbols() failed\n");
+    if (!dbghelp::HasSymbols()) {
+        bool ok = CrashHandlerDownloadSymbols();
+        if (ok) {
+            report = BuildCrashInfoText(true);
+            SaveCrashInfo(ByteSlice(report));
+        } else {
+            log("TryUploadCrashReport(): CrashHandlerDownloadSymbols() failed\n");
+        }
     }
 
-    char* sv = BuildCrashInfoText(true);
-    if (str::IsEmpty(sv)) {
+    if (str::IsEmpty(report)) {
         log("TryUploadCrashReport(): skipping because !BuildCrashInfoText()\n");
         return;
     }
-    ByteSlice d = sv;
-    SaveCrashInfo(d);
-    UploadCrashReport(d);
+    UploadCrashReport(ByteSlice(report));
     // gCrashHandlerAllocator->Free((const void*)d.data());
     log("TryUploadCrashReport() finished\n");
 }
@@ -395,17 +510,31 @@ static DWORD WINAPI CrashDumpThread(LPVOID) {
         return 0;
     }
 
-    TryUploadCrashReport();
-
     // always write a MiniDump (for the latest crash only)
     // set the SUMATRAPDF_FULLDUMP environment variable for more complete dumps
     DWORD n = GetEnvironmentVariableA("SUMATRAPDF_FULLDUMP", nullptr, 0);
     bool fullDump = (0 != n);
     WCHAR* ws = ToWstrTemp(gCrashDumpPath);
     dbghelp::WriteMiniDump(ws, &gMei, fullDump);
+
+    // callstacks are resolved with cached symbols or left as module offsets
+    // so that the report is written without waiting for a download
+    char* report = nullptr;
+    if (InitializeLocalSymbols()) {
+        report = BuildCrashInfoText(true);
+        if (!str::IsEmpty(report)) {
+            SaveCrashInfo(ByteSlice(report));
+        }
+    }
+    SetEvent(gReportSavedEvent);
+
+    TryUploadCrashReport(report);
     return 0;
 }
 
+// how long to wait for the report upload once the crash message is closed
+constexpr DWORD kMaxCrashUploadWaitMs = 60 * 1000;
+
 static LONG WINAPI DumpExceptionHandler(EXCEPTION_POINTERS* exceptionInfo) {
     if (!exceptionInfo || (EXCEPTION_BREAKPOINT == exceptionInfo->ExceptionRecord->ExceptionCode)) {
         return EXCEPTION_CONTINUE_SEARCH;
@@ -429,9 +558,13 @@ static LONG WINAPI DumpExceptionHandler(EXCEPTION_POINTERS* exceptionInfo) {
     // write callstack for the calling thread correctly. We use msdn-recommended
     // work-around of spinning a thread to do the writing
     SetEvent(gDumpEvent);
-    WaitForSingleObject(gDumpThread, INFINITE);
+    // the user is told as soon as the report is saved. Downloading symbols
+    // and uploading the report continue while the message is shown
+    HANDLE handles[2] = {gReportSavedEvent, gDumpThread};
+    WaitForMultipleObjects(dimof(handles), handles, FALSE, INFINITE);
 
     ShowCrashHandlerMessage();
+    WaitForSingleObject(gDumpThread, kMaxCrashUploadWaitMs);
     TerminateProcess(GetCurrentProcess(), 1);
 
     return EXCEPTION_CONTINUE_SEARCH;
@@ -618,20 +751,72 @@ static void BuildSymbolPath() {
     str::ReplaceWithCopy(&gSymbolPath, path.Get());
 }
 
+// the CodeView record in the executable's debug directory
+struct CodeViewInfo {
+    DWORD signature; // "RSDS"
+    GUID guid;
+    DWORD age;
+};
+
+// returns the pdb GUID and age of the executable (the key under which
+// symbol servers store its symbols) or nullptr. Caller needs to free()
+static char* GetExeSymbolsId() {
+    u8* base = (u8*)GetModuleHandleW(nullptr);
+    auto dosHdr = (IMAGE_DOS_HEADER*)base;
+    if (!base || dosHdr->e_magic != IMAGE_DOS_SIGNATURE) {
+        return nullptr;
+    }
+    auto ntHdr = (IMAGE_NT_HEADERS*)(base + dosHdr->e_lfanew);
+    if (ntHdr->Signature != IMAGE_NT_SIGNATURE) {
+        return nullptr;
+    }
+    IMAGE_DATA_DIRECTORY& debugDir = ntHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+    if (debugDir.VirtualAddress == 0) {
+        return nullptr;
+    }
+    auto entries = (IMAGE_DEBUG_DIRECTORY*)(base + debugDir.VirtualAddress);
+    size_t nEntries = debugDir.Size / sizeof(IMAGE_DEBUG_DIRECTORY);
+    for (size_t i = 0; i < nEntries; i++) {
+        IMAGE_DEBUG_DIRECTORY& e = entries[i];
+        if (e.Type != IMAGE_DEBUG_TYPE_CODEVIEW || e.AddressOfRawData == 0 || e.SizeOfData < sizeof(CodeViewInfo)) {
+            continue;
+        }
+        auto cv = (CodeViewInfo*)(base + e.AddressOfRawData);
+        if (cv->signature != 0x53445352) {
+            continue;
+        }
+        const GUID& g = cv->guid;
+        return str::Format("%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X", (uint)g.Data1, (uint)g.Data2,
+                           (uint)g.Data3, (uint)g.Data4[0], (uint)g.Data4[1], (uint)g.Data4[2], (uint)g.Data4[3],
+                           (uint)g.Data4[4], (uint)g.Data4[5], (uint)g.Data4[6], (uint)g.Data4[7], (uint)cv->age);
+    }
+    return nullptr;
+}
+
 bool SetSymbolsDir(const char* symDir) {
     if (!symDir) {
         return false;
     }
 
+    free(gSymbolsCacheDir);
     free(gSymbolsDir);
     free(gLibMupdfPdbPath);
     free(gSumatraPdfDllPdbPath);
     free(gSumatraPdfPdbPath);
 
-    gSymbolsDir = str::Dup(symDir);
-    gSumatraPdfPdbPath = path::Join(symDir, "SumatraPDF.pdb");
-    gSumatraPdfDllPdbPath = path::Join(symDir, "SumatraPDF-dll.pdb");
-    gLibMupdfPdbPath = path::Join(symDir, "libmupdf.pdb");
+    // symbols are kept per build, so that they're downloaded
+    // only once even when switching between versions
+    gSymbolsCacheDir = str::Dup(symDir);
+    char* symbolsId = GetExeSymbolsId();
+    if (symbolsId) {
+        gSymbolsDir = path::Join(symDir, symbolsId);
+        free(symbolsId);
+    } else {
+        gSymbolsDir = str::Dup(symDir);
+    }
+    gSumatraPdfPdbPath = path::Join(gSymbolsDir, "SumatraPDF.pdb");
+    gSumatraPdfDllPdbPath = path::Join(gSymbolsDir, "SumatraPDF-dll.pdb");
+    gLibMupdfPdbPath = path::Join(gSymbolsDir, "libmupdf.pdb");
     BuildSymbolPath();
     return true;
 }
@@ -715,6 +900,11 @@ void InstallCrashHandler(const char* crashDumpPath, const char* crashFilePath, c
         log("InstallCrashHandler: skipping because !gDumpEvent\n");
         return;
     }
+    gReportSavedEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!gReportSavedEvent) {
+        log("InstallCrashHandler: skipping because !gReportSavedEvent\n");
+        return;
+    }
     gDumpThread = CreateThread(nullptr, 0, CrashDumpThread, nullptr, 0, nullptr);
     if (!gDumpThread) {
         log("InstallCrashHandler: skipping because !gDumpThread\n");
@@ -746,9 +936,11 @@ void UninstallCrashHandler() {
 
     CloseHandle(gDumpThread);
     CloseHandle(gDumpEvent);
+    CloseHandle(gReportSavedEvent);
 
     str::FreePtr(&gCrashDumpPath);
     str::FreePtr(&gSymbolsUrl);
+    str::FreePtr(&gSymbolsCacheDir);
     str::FreePtr(&gSymbolsDir);
     str::FreePtr(&gLibMupdfPdbPath);
     str::FreePtr(&gSumatraPdfPdbPath);
@@ -47,6 +47,9 @@
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Timer.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 
 #include "wingui/UIModels.h"
 
@@ -61,12 +64,371 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "FileTextCache.h"
+#include "IdleTasks.h"
+#include "TileCache.h"
 
 #include "utils/Log.h"
 
 // if true, we pre-render the pages right before and after the visible pages
 static bool gPredictiveRender = true;
 
+// content boxes are expensive to compute (e.g. a pdf page has to be run
+// through a bbox device), so they're computed on a thread for all
+// DisplayModels of an engine and saved in the cache directory
+struct ContentBoxes {
+    EngineBase* engine = nullptr;
+    // for finding it again from the ui thread
+    int id = 0;
+    CRITICAL_SECTION access;
+    // indexed by pageNo - 1
+    Vec<RectF> boxes;
+    Vec<bool> known;
+    bool modified = false;
+    // where the thread continues, moved to pages that are needed right now
+    int nextPageNo = 1;
+    // false if content boxes are computed when needed instead
+    bool inBackground = false;
+    HANDLE hThread = nullptr;
+    bool threadRunning = false;
+    // checked by the thread before each page
+    bool stop = false;
+    // the thread deletes ContentBoxes and engine when it's done with the current page
+    bool deleteOnExit = false;
+    bool notifyPending = false;
+    // are told about new content boxes on the ui thread
+    Vec<DisplayModel*> listeners;
+
+    explicit ContentBoxes(EngineBase* engine);
+    ~ContentBoxes();
+};
+
+// a document opened in several tabs or windows is loaded only once:
+// its DisplayModels share the engine and the text cache
+struct SharedEngine {
+    EngineBase* engine = nullptr;
+    DocumentTextCache* textCache = nullptr;
+    ContentBoxes* contentBoxes = nullptr;
+    char* path = nullptr;
+    FILETIME modified{};
+    // number of DisplayModels using engine
+    int refs = 0;
+};
+
+struct SharedEngines {
+    // DisplayModels are created on loading threads
+    CRITICAL_SECTION access;
+    Vec<SharedEngine*> engines;
+
+    SharedEngines() {
+        InitializeCriticalSection(&access);
+    }
+    ~SharedEngines() {
+        DeleteCriticalSection(&access);
+    }
+};
+
+static SharedEngines gSharedEngines;
+
+EngineBase* AcquireSharedEngine(const char* path, const char* decryptionKey) {
+    if (!path) {
+        return nullptr;
+    }
+    FILETIME modified = file::GetModificationTime(path);
+    ScopedCritSec scope(&gSharedEngines.access);
+    for (SharedEngine* se : gSharedEngines.engines) {
+        if (!str::EqI(se->path, path) || CompareFileTime(&se->modified, &modified) != 0) {
+            continue;
+        }
+        // page count and page sizes must not change anymore because each
+        // DisplayModel only gets told about that once
+        EngineBase* engine = se->engine;
+        if (engine->IsLayoutInProgress() || engine->IsPageSizeUpdatePending()) {
+            continue;
+        }
+        // loading the document again would ask for the password
+        if (engine->IsPasswordProtected()) {
+            AutoFreeStr engineKey = engine->GetDecryptionKey();
+            if (!engineKey || !str::Eq(engineKey, decryptionKey)) {
+                continue;
+            }
+        }
+        // the new DisplayModel would show annotations that aren't in the file
+        if (engine->kind == kindEngineMupdf && EngineMupdfHasUnsavedAnnotations(engine)) {
+            continue;
+        }
+        se->refs++;
+        return engine;
+    }
+    return nullptr;
+}
+
+static LONG gContentBoxesId = 0;
+
+ContentBoxes::ContentBoxes(EngineBase* engine) : engine(engine) {
+    InitializeCriticalSection(&access);
+    id = (int)InterlockedIncrement(&gContentBoxesId);
+    inBackground = ComputesContentBoxesInBackground(engine);
+    if (!inBackground) {
+        return;
+    }
+    if (LoadContentBoxesCache(engine, boxes, known)) {
+        return;
+    }
+    int nPages = engine->PageCount();
+    for (int i = 0; i < nPages; i++) {
+        boxes.Append(RectF());
+        known.Append(false);
+    }
+}
+
+ContentBoxes::~ContentBoxes() {
+    if (hThread) {
+        CloseHandle(hThread);
+    }
+    if (modified && !engine->IsLayoutInProgress() && boxes.isize() == engine->PageCount()) {
+        SaveContentBoxesCache(engine, boxes, known);
+    }
+    DeleteCriticalSection(&access);
+}
+
+// the ui thread is only told about new content boxes once per batch
+static void NotifyContentBoxes(int id) {
+    Vec<DisplayModel*> dms;
+    {
+        ScopedCritSec scope(&gSharedEngines.access);
+        for (SharedEngine* se : gSharedEngines.engines) {
+            ContentBoxes* cbs = se->contentBoxes;
+            if (cbs && cbs->id == id) {
+                ScopedCritSec scope2(&cbs->access);
+                cbs->notifyPending = false;
+                for (DisplayModel* dm : cbs->listeners) {
+                    dms.Append(dm);
+                }
+            }
+        }
+    }
+    // DisplayModels are only deleted on the ui thread
+    for (DisplayModel* dm : dms) {
+        dm->ContentBoxesChanged();
+    }
+}
+
+// must be called with cbs->access held. Returns 0 if all are known
+static int NextUnknownContentBox(ContentBoxes* cbs) {
+    int nPages = cbs->known.isize();
+    for (int i = 0; i < nPages; i++) {
+        int pageNo = (cbs->nextPageNo - 1 + i) % nPages + 1;
+        if (!cbs->known[pageNo - 1]) {
+            return pageNo;
+        }
+    }
+    return 0;
+}
+
+// returns false if all content boxes are known
+static bool ComputeNextContentBox(ContentBoxes* cbs) {
+    int pageNo;
+    {
+        ScopedCritSec scope(&cbs->access);
+        pageNo = cbs->stop ? 0 : NextUnknownContentBox(cbs);
+    }
+    if (pageNo == 0) {
+        return false;
+    }
+    RectF box = cbs->engine->PageContentBox(pageNo);
+    bool notify = false;
+    {
+        ScopedCritSec scope(&cbs->access);
+        cbs->boxes[pageNo - 1] = box;
+        cbs->known[pageNo - 1] = true;
+        cbs->modified = true;
+        cbs->nextPageNo = pageNo + 1;
+        notify = !cbs->notifyPending;
+        cbs->notifyPending = true;
+    }
+    if (notify) {
+        int id = cbs->id;
+        uitask::Post([id] { NotifyContentBoxes(id); });
+    }
+    return true;
+}
+
+static void DeleteContentBoxesAndEngine(ContentBoxes* cbs) {
+    EngineBase* engine = cbs->engine;
+    delete cbs;
+    delete engine;
+}
+
+static DWORD WINAPI ContentBoxesThread(void* data) {
+    SetThreadName("ContentBoxesThread");
+    ContentBoxes* cbs = (ContentBoxes*)data;
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    while (ComputeNextContentBox(cbs)) {
+        // compute all of them
+    }
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    bool deleteOnExit;
+    {
+        ScopedCritSec scope(&cbs->access);
+        cbs->threadRunning = false;
+        deleteOnExit = cbs->deleteOnExit;
+    }
+    if (deleteOnExit) {
+        DeleteContentBoxesAndEngine(cbs);
+    }
+    return 0;
+}
+
+// called on the ui thread when the engine is no longer used. Doesn't wait
+// for the content box the thread is computing, the thread deletes cbs and
+// the engine afterwards
+static void ReleaseContentBoxes(ContentBoxes* cbs) {
+    {
+        ScopedCritSec scope(&cbs->access);
+        cbs->stop = true;
+        if (cbs->threadRunning) {
+            cbs->deleteOnExit = true;
+            return;
+        }
+    }
+    DeleteContentBoxesAndEngine(cbs);
+}
+
+// returns false if the text of all pages has been extracted
+static bool ExtractNextPageText(DocumentTextCache* textCache, int* pageNo) {
+    int nPages;
+    {
+        ScopedCritSec scope(&textCache->access);
+        nPages = textCache->nPages;
+    }
+    for (; *pageNo <= nPages; (*pageNo)++) {
+        if (!textCache->HasTextForPage(*pageNo)) {
+            textCache->GetTextForPage(*pageNo);
+            return true;
+        }
+    }
+    return false;
+}
+
+// prepares what's otherwise only done when needed, e.g. when searching or
+// fitting content, in idle time (one page per step)
+static void ScheduleIdleWarmUp(EngineBase* engine, DocumentTextCache* textCache, ContentBoxes* cbs) {
+    if (cbs->inBackground) {
+        ScheduleIdleTask(engine, [cbs] { return ComputeNextContentBox(cbs); });
+    }
+    // new tasks run first, so the text is extracted before the content boxes are computed
+    ScheduleIdleTask(engine, [textCache, pageNo = 1]() mutable { return ExtractNextPageText(textCache, &pageNo); });
+}
+
+// returns false if the content box of the page isn't known yet, in which
+// case it'll be computed in the background soon
+static bool GetKnownContentBox(ContentBoxes* cbs, int pageNo, RectF* box) {
+    if (!cbs->inBackground) {
+        *box = cbs->engine->PageContentBox(pageNo);
+        return true;
+    }
+    ScopedCritSec scope(&cbs->access);
+    if (pageNo <= cbs->known.isize() && cbs->known[pageNo - 1]) {
+        *box = cbs->boxes[pageNo - 1];
+        return true;
+    }
+    // ebooks can get more pages while they're being laid out
+    while (cbs->known.isize() < pageNo) {
+        cbs->boxes.Append(RectF());
+        cbs->known.Append(false);
+    }
+    cbs->nextPageNo = pageNo;
+    if (!cbs->threadRunning && !cbs->stop) {
+        if (cbs->hThread) {
+            CloseHandle(cbs->hThread);
+        }
+        cbs->threadRunning = true;
+        cbs->hThread = CreateThread(nullptr, 0, ContentBoxesThread, cbs, 0, nullptr);
+        cbs->threadRunning = cbs->hThread != nullptr;
+    }
+    return false;
+}
+
+// returns the text cache for engine, creating it if engine
+// hasn't been returned by AcquireSharedEngine()
+static DocumentTextCache* AddSharedEngine(EngineBase* engine, DisplayModel* dm, ContentBoxes** contentBoxesOut) {
+    {
+        ScopedCritSec scope(&gSharedEngines.access);
+        for (SharedEngine* se : gSharedEngines.engines) {
+            if (se->engine == engine) {
+                // the reference was taken in AcquireSharedEngine()
+                ScopedCritSec scope2(&se->contentBoxes->access);
+                se->contentBoxes->listeners.Append(dm);
+                *contentBoxesOut = se->contentBoxes;
+                return se->textCache;
+            }
+        }
+    }
+
+    LoadPageSizesCache(engine);
+    auto textCache = new DocumentTextCache(engine);
+    textCache->LoadFromDisk();
+    auto contentBoxes = new ContentBoxes(engine);
+    contentBoxes->listeners.Append(dm);
+    *contentBoxesOut = contentBoxes;
+    ScheduleIdleWarmUp(engine, textCache, contentBoxes);
+
+    auto se = new SharedEngine();
+    se->engine = engine;
+    se->textCache = textCache;
+    se->contentBoxes = contentBoxes;
+    se->path = str::Dup(engine->FilePath());
+    if (se->path) {
+        se->modified = file::GetModificationTime(se->path);
+    }
+    se->refs = 1;
+    ScopedCritSec scope(&gSharedEngines.access);
+    gSharedEngines.engines.Append(se);
+    return textCache;
+}
+
+// returns true if engine and its text cache are no longer used
+static bool ReleaseSharedEngine(EngineBase* engine) {
+    ScopedCritSec scope(&gSharedEngines.access);
+    for (int i = 0; i < gSharedEngines.engines.isize(); i++) {
+        SharedEngine* se = gSharedEngines.engines[i];
+        if (se->engine != engine) {
+            continue;
+        }
+        se->refs--;
+        if (se->refs > 0) {
+            return false;
+        }
+        gSharedEngines.engines.RemoveAt(i);
+        str::Free(se->path);
+        delete se;
+        return true;
+    }
+    CrashIf(true);
+    return true;
+}
+
+bool IsEngineShared(EngineBase* engine) {
+    ScopedCritSec scope(&gSharedEngines.access);
+    for (SharedEngine* se : gSharedEngines.engines) {
+        if (se->engine == engine) {
+            return se->refs > 1;
+        }
+    }
+    return false;
+}
+
+// scrolling steps further apart than this (in ms) aren't a continuous scroll
+constexpr double kScrollIdleMs = 200;
+// roughly how long it takes to render a page, in ms
+constexpr float kExpectedPageRenderMs = 150;
+// how many pages to render ahead at most, so that they fit into the render queue
+constexpr int kMaxPrefetchPages = 4;
+// how many slides around the current one are kept rendered in presentation mode
+constexpr int kPresentationSlidesAhead = 2;
+constexpr int kPresentationSlidesBehind = 1;
+
 static int ColumnsFromDisplayMode(DisplayMode displayMode) {
     if (!IsSingle(displayMode)) {
         return 2;
@@ -242,14 +604,20 @@ SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
     CrashIf(!pageInfo);
 
     if (fitToContent && pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
+        LoadContentBox(pageNo, pageInfo);
         if (pageInfo->contentBox.IsEmpty()) {
             return PageSizeAfterRotation(pageNo);
         }
     }
 
-    RectF box = fitToContent ? pageInfo->contentBox : pageInfo->page;
-    return engine->Transform(box, pageNo, 1.0, rotation).Size();
+    if (fitToContent) {
+        return engine->Transform(pageInfo->contentBox, pageNo, 1.0, rotation).Size();
+    }
+    if (pageInfo->pageRotatedFor != rotation + 1) {
+        pageInfo->pageRotated = engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+        pageInfo->pageRotatedFor = rotation + 1;
+    }
+    return pageInfo->pageRotated;
 }
 
 /* given 'columns' and an absolute 'pageNo', return the number of the first
@@ -302,7 +670,8 @@ DisplayModel::DisplayModel(EngineBase* engine, DocControllerCallback* cb) : DocC
     pageSpacing.dy += 4;
 #endif
 
-    textCache = new DocumentTextCache(engine);
+    textCache = AddSharedEngine(engine, this, &contentBoxes);
+    GetTileCacheDigest(engine, tileCacheDigest);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
 }
@@ -314,9 +683,20 @@ DisplayModel::~DisplayModel() {
     delete pdfSync;
     delete textSearch;
     delete textSelection;
-    delete textCache;
-    delete engine;
+    EnterCriticalSection(&contentBoxes->access);
+    contentBoxes->listeners.Remove(this);
+    LeaveCriticalSection(&contentBoxes->access);
+    if (ReleaseSharedEngine(engine)) {
+        CancelIdleTasks(engine);
+        delete textCache;
+        SavePageSizesCache(engine);
+        // also deletes the engine, possibly on the content boxes thread
+        ReleaseContentBoxes(contentBoxes);
+    }
     free(pagesInfo);
+    for (PageInfo* pi : oldPagesInfo) {
+        free(pi);
+    }
 }
 
 PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
@@ -324,7 +704,26 @@ PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
         return nullptr;
     }
     CrashIf(!pagesInfo);
-    return &(pagesInfo[pageNo - 1]);
+    PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+    if (pageInfo->pageOnScreenGen != visiblePartsGen && pageInfo->shown) {
+        pageInfo->pageOnScreen = pageInfo->pos;
+        pageInfo->pageOnScreen.Offset(-visiblePartsOffset.x, -visiblePartsOffset.y);
+        pageInfo->pageOnScreenGen = visiblePartsGen;
+    }
+    return pageInfo;
+}
+
+// keeps the cached bitmaps: until the pages have been rendered at the new zoom,
+// RenderCache::PaintTile() stretches the ones for the previous zoom
+void DisplayModel::SetScreenDpi(int screenDPI) {
+    float newDpiFactor = 1.0f * screenDPI / engine->GetFileDPI();
+    if (newDpiFactor == dpiFactor) {
+        return;
+    }
+    ScrollState ss = GetScrollState();
+    dpiFactor = newDpiFactor;
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
 }
 
 // Call this before the first Relayout
@@ -368,6 +767,7 @@ void DisplayModel::BuildPagesInfo() {
     CrashIf(pagesInfo);
     int pageCount = PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
+    pagesInfoCap = pageCount;
 
     log("DisplayModel::BuildPagesInfo started\n");
     auto timeStart = TimeGet();
@@ -390,6 +790,8 @@ void DisplayModel::BuildPagesInfo() {
         newStartPage--;
     }
 
+    firstVisiblePageNo = lastVisiblePageNo = 0;
+    pageRows.Reset();
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
@@ -397,6 +799,7 @@ void DisplayModel::BuildPagesInfo() {
         if (pageInfo->page.IsEmpty()) {
             pageInfo->page = defaultRect;
         }
+        pageInfo->pageRotatedFor = 0;
         pageInfo->visibleRatio = 0.0;
         pageInfo->shown = false;
         if (IsContinuous(displayMode)) {
@@ -407,6 +810,71 @@ void DisplayModel::BuildPagesInfo() {
     }
 }
 
+// picks up pages that the engine has laid out in the background
+// since the last call. Returns true if there were new pages
+bool DisplayModel::UpdatePageCount() {
+    CrashIf(!pagesInfo);
+    int pageCount = PageCount();
+    int newPageCount = engine->LaidOutPageCount();
+    if (newPageCount <= pageCount) {
+        return false;
+    }
+
+    if (newPageCount > pagesInfoCap) {
+        // grow exponentially, since this is called repeatedly while laying out
+        int cap = std::max(newPageCount, 2 * pagesInfoCap);
+        PageInfo* newPagesInfo = AllocArray<PageInfo>(cap);
+        memcpy(newPagesInfo, pagesInfo, pageCount * sizeof(PageInfo));
+        oldPagesInfo.Append(pagesInfo);
+        pagesInfo = newPagesInfo;
+        pagesInfoCap = cap;
+    }
+    for (int pageNo = pageCount + 1; pageNo <= newPageCount; pageNo++) {
+        PageInfo* pageInfo = &pagesInfo[pageNo - 1];
+        pageInfo->page = engine->PageMediabox(pageNo);
+        pageInfo->visibleRatio = 0.0;
+        pageInfo->pageRotatedFor = 0;
+        pageInfo->shown = IsContinuous(displayMode);
+    }
+
+    // make room for the new pages before they become visible through engine->PageCount()
+    textCache->SetPageCount(newPageCount);
+    engine->CommitPages(newPageCount);
+
+    Relayout(zoomVirtual, rotation);
+    cb->UpdateScrollbars(canvasSize);
+    RepaintDisplay();
+
+    if (pendingScrollState.page > 0 && ValidPageNo(pendingScrollState.page)) {
+        ScrollState ss = pendingScrollState;
+        pendingScrollState = ScrollState();
+        SetScrollState(ss);
+    }
+    return true;
+}
+
+// picks up the real page sizes of documents whose page sizes were
+// estimated while loading. Returns true if any have changed
+bool DisplayModel::UpdatePageSizes() {
+    CrashIf(!pagesInfo);
+    if (!engine->UpdatePageSizes()) {
+        return false;
+    }
+    ScrollState ss = GetScrollState();
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        RectF mediabox = engine->PageMediabox(pageNo);
+        if (!mediabox.IsEmpty()) {
+            pagesInfo[pageNo - 1].page = mediabox;
+            pagesInfo[pageNo - 1].pageRotatedFor = 0;
+        }
+    }
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+    cb->UpdateScrollbars(canvasSize);
+    RepaintDisplay();
+    return true;
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
 bool DisplayModel::PageShown(int pageNo) const {
@@ -427,6 +895,13 @@ bool DisplayModel::PageVisible(int pageNo) const {
 
 /* Return true if a page is visible or a page in a row below or above is visible */
 bool DisplayModel::PageVisibleNearby(int pageNo) const {
+    if (IsPresentationSlide(pageNo)) {
+        return true;
+    }
+    if (prefetchFirstPageNo > 0) {
+        // while scrolling, pages that have been scrolled past aren't needed
+        return prefetchFirstPageNo <= pageNo && pageNo <= prefetchLastPageNo;
+    }
     DisplayMode mode = GetDisplayMode();
     int columns = ColumnsFromDisplayMode(mode);
 
@@ -439,6 +914,27 @@ bool DisplayModel::PageVisibleNearby(int pageNo) const {
     return false;
 }
 
+// called from the render threads, so this doesn't use GetPageInfo()
+float DisplayModel::GetRenderCost(int pageNo) const {
+    if (!ValidPageNo(pageNo)) {
+        return 0;
+    }
+    return pagesInfo[pageNo - 1].renderCost;
+}
+
+void DisplayModel::UpdateRenderCost(int pageNo, float msPerMPixel) {
+    if (!ValidPageNo(pageNo)) {
+        return;
+    }
+    PageInfo* pageInfo = &pagesInfo[pageNo - 1];
+    // the first rendering of a page also includes loading it,
+    // so don't rely on a single measurement
+    if (pageInfo->renderCost > 0) {
+        msPerMPixel = (pageInfo->renderCost + msPerMPixel) / 2;
+    }
+    pageInfo->renderCost = msPerMPixel;
+}
+
 /* Return true if the first page is fully visible and alone on a line in
    show cover mode (i.e. it's not possible to flip to a previous page) */
 bool DisplayModel::FirstBookPageVisible() const {
@@ -490,9 +986,7 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) co
         RectF box;
         for (int i = first; i <= last; i++) {
             PageInfo* pageInfo = GetPageInfo(i);
-            if (pageInfo->contentBox.IsEmpty()) {
-                pageInfo->contentBox = engine->PageContentBox(i);
-            }
+            LoadContentBox(i, pageInfo);
 
             RectF pageBox = engine->Transform(pageInfo->page, i, 1.0, rotation);
             RectF contentBox = engine->Transform(pageInfo->contentBox, i, 1.0, rotation);
@@ -536,7 +1030,8 @@ int DisplayModel::FirstVisiblePageNo() const {
         return kInvalidPageNo;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    int last = std::min(lastVisiblePageNo, PageCount());
+    for (int pageNo = std::max(firstVisiblePageNo, 1); pageNo <= last; ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > 0.0) {
             return pageNo;
@@ -547,6 +1042,22 @@ int DisplayModel::FirstVisiblePageNo() const {
     return kInvalidPageNo;
 }
 
+int DisplayModel::LastVisiblePageNo() const {
+    CrashIf(!pagesInfo);
+    if (!pagesInfo) {
+        return kInvalidPageNo;
+    }
+
+    int first = std::max(firstVisiblePageNo, 1);
+    for (int pageNo = std::min(lastVisiblePageNo, PageCount()); pageNo >= first; --pageNo) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (pageInfo->visibleRatio > 0.0) {
+            return pageNo;
+        }
+    }
+    return kInvalidPageNo;
+}
+
 // we consider the most visible page the current one
 // (in continuous layout, there's no better criteria)
 int DisplayModel::CurrentPageNo() const {
@@ -562,7 +1073,8 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = kInvalidPageNo;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    int last = std::min(lastVisiblePageNo, PageCount());
+    for (int pageNo = std::max(firstVisiblePageNo, 1); pageNo <= last; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -592,9 +1104,17 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
            across the pages so that the largest page fits. In most documents
            all pages are the same size anyway */
         float minZoom = (float)HUGE_VAL;
+        // the zoom only depends on the page size, so only re-calculate
+        // it when the size differs from the previous page
+        SizeF prevSize;
+        float zoom = 0;
         for (int pageNo = 1; pageNo <= nPages; pageNo++) {
             if (PageShown(pageNo)) {
-                float zoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
+                SizeF size = PageSizeAfterRotation(pageNo);
+                if (zoom == 0 || size.dx != prevSize.dx || size.dy != prevSize.dy) {
+                    zoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
+                    prevSize = size;
+                }
                 PageInfo* pageInfo = GetPageInfo(pageNo);
                 ReportIf(zoom < 0.01f);
                 pageInfo->zoomReal = zoom;
@@ -848,6 +1368,27 @@ RestartLayout:
     }
 
     canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
+
+    pageRows.Reset();
+    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown) {
+            continue;
+        }
+        Rect& pos = pageInfo->pos;
+        if (pageRows.size() > 0 && pageRows.Last().y == pos.y) {
+            PageRow& row = pageRows.Last();
+            row.bottom = std::max(row.bottom, pos.y + pos.dy);
+            row.lastPageNo = pageNo;
+            continue;
+        }
+        PageRow row;
+        row.y = pos.y;
+        row.bottom = pos.y + pos.dy;
+        row.firstPageNo = pageNo;
+        row.lastPageNo = pageNo;
+        pageRows.Append(row);
+    }
 }
 
 void DisplayModel::ChangeStartPage(int newStartPage) {
@@ -859,6 +1400,7 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
     if (IsBookView(GetDisplayMode()) && newStartPage == 1 && columns > 1) {
         newStartPage--;
     }
+    firstVisiblePageNo = lastVisiblePageNo = 0;
     for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (IsContinuous(GetDisplayMode())) {
@@ -884,25 +1426,57 @@ void DisplayModel::RecalcVisibleParts() const {
         return;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            CrashIf(0.0 != pageInfo->visibleRatio);
-            continue;
-        }
+    ClearVisibleParts();
+    // pageOnScreen of all pages is now outdated
+    visiblePartsOffset = viewPort.TL();
+    visiblePartsGen++;
 
-        Rect pageRect = pageInfo->pos;
-        Rect visiblePart = pageRect.Intersect(viewPort);
+    int nPages = PageCount();
+    for (int i = PageRowAtY(viewPort.y); i < pageRows.isize() && pageRows[i].y < viewPort.y + viewPort.dy; i++) {
+        int last = std::min(pageRows[i].lastPageNo, nPages);
+        for (int pageNo = pageRows[i].firstPageNo; pageNo <= last; pageNo++) {
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            if (!pageInfo->shown) {
+                continue;
+            }
 
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
+            Rect pageRect = pageInfo->pos;
+            Rect visiblePart = pageRect.Intersect(viewPort);
+            if (visiblePart.IsEmpty()) {
+                continue;
+            }
             CrashIf(pageRect.dx <= 0 || pageRect.dy <= 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            if (0 == firstVisiblePageNo) {
+                firstVisiblePageNo = pageNo;
+            }
+            lastVisiblePageNo = pageNo;
+        }
+    }
+}
+
+// index of the first row of pages that ends below y
+int DisplayModel::PageRowAtY(int y) const {
+    int lo = 0;
+    int hi = pageRows.isize();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (pageRows[mid].bottom <= y) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
+    return lo;
+}
+
+void DisplayModel::ClearVisibleParts() const {
+    int last = std::min(lastVisiblePageNo, PageCount());
+    for (int pageNo = std::max(firstVisiblePageNo, 1); pageNo <= last; pageNo++) {
+        GetPageInfo(pageNo)->visibleRatio = 0.0;
+    }
+    firstVisiblePageNo = lastVisiblePageNo = 0;
 }
 
 int DisplayModel::GetPageNoByPoint(Point pt) const {
@@ -911,15 +1485,16 @@ int DisplayModel::GetPageNoByPoint(Point pt) const {
         return -1;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        CrashIf(!(0.0 == pageInfo->visibleRatio || pageInfo->shown));
-        if (!pageInfo->shown) {
-            continue;
-        }
-
-        if (pageInfo->pageOnScreen.Contains(pt)) {
-            return pageNo;
+    int y = pt.y + visiblePartsOffset.y;
+    int nPages = PageCount();
+    // Contains() includes the bottom edge of a page
+    for (int i = PageRowAtY(y - 1); i < pageRows.isize() && pageRows[i].y <= y; i++) {
+        int last = std::min(pageRows[i].lastPageNo, nPages);
+        for (int pageNo = pageRows[i].firstPageNo; pageNo <= last; pageNo++) {
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            if (pageInfo->shown && pageInfo->pageOnScreen.Contains(pt)) {
+                return pageNo;
+            }
         }
     }
 
@@ -1088,23 +1663,27 @@ bool DisplayModel::IsOverText(Point pt) {
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
-void DisplayModel::RenderVisibleParts() {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            CrashIf(!pageInfo->shown);
-            if (0 == firstVisiblePage) {
-                firstVisiblePage = pageNo;
-            }
-            lastVisiblePage = pageNo;
-        }
+/* Return true if a page is one of the slides that are rendered ahead of time
+   in presentation mode, so that going to the next slide doesn't have to wait */
+bool DisplayModel::IsPresentationSlide(int pageNo) const {
+    if (!presentationMode || IsContinuous(GetDisplayMode())) {
+        return false;
     }
+    int firstVisiblePage = FirstVisiblePageNo();
+    if (kInvalidPageNo == firstVisiblePage) {
+        return false;
+    }
+    int lastVisiblePage = LastVisiblePageNo();
+    return firstVisiblePage - kPresentationSlidesBehind <= pageNo &&
+           pageNo <= lastVisiblePage + kPresentationSlidesAhead;
+}
+
+void DisplayModel::RenderVisibleParts() {
+    int firstVisiblePage = FirstVisiblePageNo();
+    int lastVisiblePage = LastVisiblePageNo();
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
-    if (0 == firstVisiblePage) {
+    if (kInvalidPageNo == firstVisiblePage) {
         return;
     }
 
@@ -1115,7 +1694,60 @@ void DisplayModel::RenderVisibleParts() {
         cb->RequestRendering(pageNo);
     }
 
-    if (gPredictiveRender) {
+    prefetchFirstPageNo = prefetchLastPageNo = 0;
+    float velocity = ScrollVelocity();
+    if (gPredictiveRender && presentationMode && !IsContinuous(GetDisplayMode())) {
+        // the next slides are requested last (the closest one last), so that
+        // they're rendered before the previous one (see IsPresentationSlide)
+        int prevPage = std::max(firstVisiblePage - kPresentationSlidesBehind, 1);
+        for (int pageNo = prevPage; pageNo < firstVisiblePage; pageNo++) {
+            cb->RequestRendering(pageNo);
+        }
+        int nextPage = std::min(lastVisiblePage + kPresentationSlidesAhead, PageCount());
+        for (int pageNo = nextPage; pageNo > lastVisiblePage; pageNo--) {
+            cb->RequestRendering(pageNo);
+        }
+    } else if (gPredictiveRender && velocity != 0 && IsContinuous(GetDisplayMode())) {
+        // the faster the user scrolls, the more pages ahead are needed soon
+        // while pages behind can be skipped. Farther pages are requested
+        // first, so that closer ones are rendered first
+        int columns = ColumnsFromDisplayMode(GetDisplayMode());
+        PageInfo* pageInfo = GetPageInfo(firstVisiblePage);
+        int rowDy = std::max(pageInfo->pos.dy + pageSpacing.dy, 1);
+        float rowsPerRender = fabsf(velocity) * kExpectedPageRenderMs / (float)rowDy;
+        // pages would be scrolled past before they're rendered,
+        // so only render quick low resolution placeholders
+        bool isFling = rowsPerRender >= 0.5f;
+        int ahead = std::min(columns * (1 + (int)ceilf(rowsPerRender)), kMaxPrefetchPages);
+        int behind = isFling ? 0 : columns;
+        if (velocity > 0) {
+            prefetchFirstPageNo = std::max(firstVisiblePage - behind, 1);
+            prefetchLastPageNo = std::min(lastVisiblePage + ahead, PageCount());
+            for (int pageNo = prefetchFirstPageNo; pageNo < firstVisiblePage; pageNo++) {
+                cb->RequestRendering(pageNo);
+            }
+            for (int pageNo = prefetchLastPageNo; pageNo > lastVisiblePage; pageNo--) {
+                if (isFling) {
+                    cb->RequestPlaceholderRendering(pageNo);
+                } else {
+                    cb->RequestRendering(pageNo);
+                }
+            }
+        } else {
+            prefetchFirstPageNo = std::max(firstVisiblePage - ahead, 1);
+            prefetchLastPageNo = std::min(lastVisiblePage + behind, PageCount());
+            for (int pageNo = prefetchLastPageNo; pageNo > lastVisiblePage; pageNo--) {
+                cb->RequestRendering(pageNo);
+            }
+            for (int pageNo = prefetchFirstPageNo; pageNo < firstVisiblePage; pageNo++) {
+                if (isFling) {
+                    cb->RequestPlaceholderRendering(pageNo);
+                } else {
+                    cb->RequestRendering(pageNo);
+                }
+            }
+        }
+    } else if (gPredictiveRender) {
         // prerender two more pages in facing and book view modes
         // if the rendering queue still has place for them
         if (!IsSingle(GetDisplayMode())) {
@@ -1141,6 +1773,38 @@ void DisplayModel::RenderVisibleParts() {
     }
 }
 
+void DisplayModel::UpdateScrollVelocity(int dy) {
+    double dt = TimeSinceInMs(lastScrollTime);
+    lastScrollTime = TimeGet();
+    if (dy == 0) {
+        return;
+    }
+    scrollSteps = dt > kScrollIdleMs ? 1 : scrollSteps + 1;
+    if (dt > kScrollIdleMs || (dy > 0) != (scrollVelocity > 0)) {
+        // first step of a scroll (or a change of direction): assume it
+        // took all the time before scrolling would be considered idle
+        scrollVelocity = (float)(dy / kScrollIdleMs);
+        return;
+    }
+    float v = (float)(dy / std::max(dt, 1.0));
+    scrollVelocity = 0.7f * scrollVelocity + 0.3f * v;
+}
+
+float DisplayModel::ScrollVelocity() const {
+    if (TimeSinceInMs(lastScrollTime) > kScrollIdleMs) {
+        return 0;
+    }
+    return scrollVelocity;
+}
+
+// a single step (e.g. Page Down) isn't continuous movement
+bool DisplayModel::IsInMotion() const {
+    if (scrollSteps > 1 && TimeSinceInMs(lastScrollTime) <= kScrollIdleMs) {
+        return true;
+    }
+    return zoomSteps > 1 && TimeSinceInMs(lastZoomTime) <= kScrollIdleMs;
+}
+
 void DisplayModel::SetViewPortSize(Size newViewPortSize) {
     ScrollState ss;
 
@@ -1166,14 +1830,54 @@ void DisplayModel::SetViewPortSize(Size newViewPortSize) {
     }
 }
 
+// content boxes are computed in the background, so this might
+// leave the content box empty until ContentBoxesChanged()
+void DisplayModel::LoadContentBox(int pageNo, PageInfo* pageInfo) const {
+    if (!pageInfo->contentBox.IsEmpty()) {
+        return;
+    }
+    RectF box;
+    if (GetKnownContentBox(contentBoxes, pageNo, &box)) {
+        pageInfo->contentBox = box;
+    }
+}
+
+// called on the ui thread when content boxes computed in the background
+// become available. They only change the layout when fitting content
+void DisplayModel::ContentBoxesChanged() {
+    if (!pagesInfo || kZoomFitContent != zoomVirtual) {
+        return;
+    }
+    bool changed = false;
+    int nPages = PageCount();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->contentBox.IsEmpty()) {
+            continue;
+        }
+        ScopedCritSec scope(&contentBoxes->access);
+        if (pageNo <= contentBoxes->known.isize() && contentBoxes->known[pageNo - 1]) {
+            pageInfo->contentBox = contentBoxes->boxes[pageNo - 1];
+            changed |= !pageInfo->contentBox.IsEmpty();
+        }
+    }
+    if (!changed) {
+        return;
+    }
+    ScrollState ss = GetScrollState();
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+}
+
 RectF DisplayModel::GetContentBox(int pageNo) const {
     RectF cbox{};
     // we cache the contentBox
     PageInfo* pageInfo = GetPageInfo(pageNo);
-    if (pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
-    }
+    LoadContentBox(pageNo, pageInfo);
     cbox = pageInfo->contentBox;
+    if (cbox.IsEmpty()) {
+        return cbox;
+    }
     float zoom = pageInfo->zoomReal;
     // TODO: must be a better way
     if (zoom == 0) {
@@ -1194,6 +1898,10 @@ Point DisplayModel::GetContentStart(int pageNo) const {
 
 // TODO: what's GoToPage supposed to do for Facing at 400% zoom?
 void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX) {
+    if (!ValidPageNo(pageNo)) {
+        // the destination might be on a page that was laid out in the background
+        UpdatePageCount();
+    }
     if (!ValidPageNo(pageNo)) {
         logf("DisplayModel::GoToPage: invalid pageNo: %d, nPages: %d\n", pageNo, engine->PageCount());
         ReportIf(true);
@@ -1220,9 +1928,9 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (kZoomFitContent == zoomVirtual) {
         // make sure that CalcZoomReal uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i = PageCount(); i > 0; i--) {
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
-        }
+        ClearVisibleParts();
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        firstVisiblePageNo = lastVisiblePageNo = pageNo;
         Relayout(zoomVirtual, rotation);
     }
     // lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1440,7 +2148,7 @@ void DisplayModel::ScrollXTo(int xOff) {
     if (CurrentPageNo() != currPageNo) {
         cb->PageNoChanged(this, CurrentPageNo());
     }
-    RepaintDisplay();
+    cb->RepaintScrolled();
 }
 
 void DisplayModel::ScrollXBy(int dx) {
@@ -1452,6 +2160,7 @@ void DisplayModel::ScrollXBy(int dx) {
 
 void DisplayModel::ScrollYTo(int yOff) {
     int currPageNo = CurrentPageNo();
+    UpdateScrollVelocity(yOff - viewPort.y);
     viewPort.y = yOff;
     RecalcVisibleParts();
     RenderVisibleParts();
@@ -1460,7 +2169,7 @@ void DisplayModel::ScrollYTo(int yOff) {
     if (newPageNo != currPageNo) {
         cb->PageNoChanged(this, newPageNo);
     }
-    RepaintDisplay();
+    cb->RepaintScrolled();
 }
 
 /* Scroll the doc in y-axis by 'dy'. If 'changePage' is TRUE, automatically
@@ -1557,6 +2266,9 @@ void DisplayModel::SetZoomVirtual(float zoomLevel, Point* fixPt) {
         ss.x = ss.y = -1;
     }
 
+    zoomSteps = TimeSinceInMs(lastZoomTime) > kScrollIdleMs ? 1 : zoomSteps + 1;
+    lastZoomTime = TimeGet();
+
     // lf("DisplayModel::SetZoomVirtual() zoomLevel=%.6f", _zoomLevel);
     Relayout(zoomLevel, rotation);
     SetScrollState(ss);
@@ -1677,7 +2389,7 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 char* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
-    Rect* coords;
+    PageCoords coords;
     const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
     if (str::IsEmpty(pageText)) {
         return nullptr;
@@ -1785,6 +2497,11 @@ ScrollState DisplayModel::GetScrollState() {
 }
 
 void DisplayModel::SetScrollState(const ScrollState& state) {
+    if (!ValidPageNo(state.page) && engine->IsLayoutInProgress()) {
+        // restored by UpdatePageCount() once the page has been laid out
+        pendingScrollState = state;
+        return;
+    }
     GoToPage(state.page, 0);
     // Bail out, if the page wasn't scrolled
     if (state.x < 0 && state.y < 0) {
@@ -23,15 +23,26 @@ struct PageInfo {
        Calculated in DisplayModel::Relayout() */
     Rect pos{};
 
+    /* page size after rotation at zoom 1.0, cached for Relayout() which needs
+       it for every page. Valid if pageRotatedFor is rotation + 1 */
+    SizeF pageRotated{};
+    int pageRotatedFor;
+
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
+    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y)
+       Updated by DisplayModel::GetPageInfo() when it's out of date */
     Rect pageOnScreen{};
+    int pageOnScreenGen;
 
     // when zoomVirtual in DisplayMode is kZoomFitPage, kZoomFitWidth
     // or kZoomFitContent, this is per-page zoom level
     float zoomReal;
 
+    // how long it took to render a million pixels of this page (in ms),
+    // 0 if it hasn't been rendered yet. Updated by the render threads
+    float renderCost;
+
     /* data that needs to be set before DisplayModel::Relayout().
        Determines whether a given page should be shown on the screen. */
     bool shown = false;
@@ -51,6 +62,7 @@ struct ScrollState {
 };
 
 struct DocumentTextCache;
+struct ContentBoxes;
 struct TextSelection;
 class TextSearch;
 struct TextSel;
@@ -128,11 +140,16 @@ struct DisplayModel : DocController {
     Synchronizer* pdfSync = nullptr;
 
     DocumentTextCache* textCache = nullptr;
+    // shared with other DisplayModels of the same engine
+    ContentBoxes* contentBoxes = nullptr;
+    // identifies the document in the tile cache, all 0 if its tiles aren't saved
+    u8 tileCacheDigest[16]{};
     TextSelection* textSelection = nullptr;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
 
     PageInfo* GetPageInfo(int pageNo) const;
+    void ContentBoxesChanged();
 
     /* current rotation selected by user */
     int GetRotation() const;
@@ -153,7 +170,11 @@ struct DisplayModel : DocController {
     bool PageShown(int pageNo) const;
     bool PageVisible(int pageNo) const;
     bool PageVisibleNearby(int pageNo) const;
+    bool IsPresentationSlide(int pageNo) const;
+    float GetRenderCost(int pageNo) const;
+    void UpdateRenderCost(int pageNo, float msPerMPixel);
     int FirstVisiblePageNo() const;
+    int LastVisiblePageNo() const;
     bool FirstBookPageVisible() const;
     bool LastBookPageVisible() const;
 
@@ -188,6 +209,8 @@ struct DisplayModel : DocController {
     void CopyNavHistory(DisplayModel& orig);
 
     void SetInitialViewSettings(DisplayMode displayMode, int newStartPage, Size viewPort, int screenDPI);
+    // e.g. after the window has been moved to a monitor with a different scale
+    void SetScreenDpi(int screenDPI);
     void SetDisplayR2L(bool r2l);
     bool GetDisplayR2L() const;
 
@@ -198,6 +221,8 @@ struct DisplayModel : DocController {
     bool GetPresentationMode() const;
 
     void BuildPagesInfo();
+    bool UpdatePageCount();
+    bool UpdatePageSizes();
     float ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeF PageSizeAfterRotation(int pageNo, bool fitToContent = false) const;
     void ChangeStartPage(int startPage);
@@ -206,6 +231,7 @@ struct DisplayModel : DocController {
     void RenderVisibleParts();
     void AddNavPoint();
     RectF GetContentBox(int pageNo) const;
+    void LoadContentBox(int pageNo, PageInfo* pageInfo) const;
     void CalcZoomReal(float zoomVirtual);
     void GoToPage(int pageNo, int scrollY, bool addNavPt = false, int scrollX = -1);
     bool GoToPrevPage(int scrollY);
@@ -215,6 +241,54 @@ struct DisplayModel : DocController {
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo = nullptr;
+    // pagesInfo can have room for more pages when the engine is still laying out
+    int pagesInfoCap = 0;
+    // arrays replaced by UpdatePageCount(), render threads might still be reading them
+    Vec<PageInfo*> oldPagesInfo;
+    // scroll state to restore once its page has been laid out
+    ScrollState pendingScrollState;
+
+    // pages with the same pos.y, laid out next to each other
+    struct PageRow {
+        int y = 0;
+        // the bottom of the tallest page
+        int bottom = 0;
+        int firstPageNo = 0;
+        int lastPageNo = 0;
+    };
+    // shown pages by rows top to bottom, built by Relayout(). Both y and bottom are
+    // sorted, so the visible pages can be found without looking at all pages
+    Vec<PageRow> pageRows;
+    // pages outside of this range aren't visible (0 if no pages are)
+    mutable int firstVisiblePageNo = 0;
+    mutable int lastVisiblePageNo = 0;
+    // viewPort.TL() when RecalcVisibleParts() was last called. pageOnScreen
+    // of pages is only calculated when needed, if their pageOnScreenGen is outdated
+    mutable Point visiblePartsOffset;
+    mutable int visiblePartsGen = 1;
+
+    int PageRowAtY(int y) const;
+    void ClearVisibleParts() const;
+
+    // smoothed vertical scrolling speed in pixels per ms (negative when scrolling up),
+    // updated by ScrollYTo() and used for predicting which pages to render next
+    float scrollVelocity = 0;
+    LARGE_INTEGER lastScrollTime{};
+    // while scrolling, the pages needed soon: the visible ones and more of them in
+    // the direction of travel. 0 when not scrolling
+    int prefetchFirstPageNo = 0;
+    int prefetchLastPageNo = 0;
+
+    // number of scroll steps (or zoom changes) in a row, each less than kScrollIdleMs apart
+    int scrollSteps = 0;
+    LARGE_INTEGER lastZoomTime{};
+    int zoomSteps = 0;
+
+    void UpdateScrollVelocity(int dy);
+    float ScrollVelocity() const;
+    // true while the user scrolls or zooms continuously, pages are then
+    // rendered in draft quality (see RenderPageArgs::draft)
+    bool IsInMotion() const;
 
     DisplayMode displayMode{DisplayMode::Automatic};
     /* In non-continuous mode is the first page from a file that we're
@@ -261,3 +335,12 @@ struct DisplayModel : DocController {
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool dontRenderFlag = false;
 };
+
+// returns the engine of a DisplayModel showing path (if the file hasn't changed
+// since it was loaded) so that it can be shared with a new DisplayModel.
+// Password protected documents are only shared if their decryption key is
+// decryptionKey (i.e. the remembered one), documents with unsaved annotations aren't.
+// The reference that is taken is owned by the DisplayModel created with it
+EngineBase* AcquireSharedEngine(const char* path, const char* decryptionKey);
+// true if the engine is used by more than one DisplayModel
+bool IsEngineShared(EngineBase* engine);
@@ -51,8 +51,12 @@ struct DocControllerCallback {
     virtual void GotoLink(IPageDestination*) = 0;
     // DisplayModel //
     virtual void Repaint() = 0;
+    // like Repaint(), when only the view port has moved
+    virtual void RepaintScrolled() = 0;
     virtual void UpdateScrollbars(Size canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // a quick low resolution rendering to show until the page is rendered
+    virtual void RequestPlaceholderRendering(int pageNo) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) = 0;
     // ChmModel //
@@ -21,6 +21,13 @@
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 // tries to extract an encoding from <?xml encoding="..."?>
 // returns CP_ACP on failure
 static uint GetCodepageFromPI(const char* xmlPI) {
@@ -39,7 +46,7 @@ static uint GetCodepageFromPI(const char* xmlPI) {
         return CP_ACP;
     }
 
-    AutoFreeStr encoding = str::Dup(enc->val, enc->valLen);
+    StrSpan encoding = enc->Val();
     struct {
         const char* namePart;
         uint codePage;
@@ -149,26 +156,71 @@ char* NormalizeURL(const char* url, const char* base) {
     return norm.Release();
 }
 
-inline char decode64(char c) {
-    if ('A' <= c && c <= 'Z') {
-        return c - 'A';
-    }
-    if ('a' <= c && c <= 'z') {
-        return c - 'a' + 26;
-    }
-    if ('0' <= c && c <= '9') {
-        return c - '0' + 52;
-    }
-    if ('+' == c) {
-        return 62;
+// 0xFF for characters that aren't part of the base64 alphabet
+struct Base64Values {
+    u8 values[256];
+
+    Base64Values() {
+        memset(values, 0xFF, sizeof(values));
+        for (int i = 0; i < 26; i++) {
+            values['A' + i] = (u8)i;
+            values['a' + i] = (u8)(i + 26);
+        }
+        for (int i = 0; i < 10; i++) {
+            values['0' + i] = (u8)(i + 52);
+        }
+        values['+'] = 62;
+        values['/'] = 63;
+    }
+};
+
+#if USE_SSE2
+// signed comparisons, so that characters >= 0x80 are in no range
+static inline __m128i InRange(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+// decodes 16 base64 characters into 12 bytes. Returns false (without writing
+// anything) if any of them is whitespace, padding or otherwise invalid
+static bool Base64Decode16(const u8* s, u8* dst) {
+    __m128i c = _mm_loadu_si128((const __m128i*)s);
+    __m128i upper = InRange(c, 'A', 'Z');
+    __m128i lower = InRange(c, 'a', 'z');
+    __m128i digit = InRange(c, '0', '9');
+    __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+        return false;
     }
-    if ('/' == c) {
-        return 63;
+
+    // the ranges are disjoint, so the offsets can be or-ed together
+    __m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+    offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+    offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+    __m128i v = _mm_add_epi8(c, offset);
+
+    // each 32-bit lane holds 4 6-bit values a, b, c, d (a in the lowest byte)
+    // which are merged into the 24-bit value a << 18 | b << 12 | c << 6 | d
+    __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 6), _mm_srli_epi16(v, 8));
+    __m128i quads = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pairs, _mm_set1_epi32(0xFFFF)), 12),
+                                 _mm_srli_epi32(pairs, 16));
+    alignas(16) u32 res[4];
+    _mm_store_si128((__m128i*)res, quads);
+    for (u32 n : res) {
+        *dst++ = (u8)(n >> 16);
+        *dst++ = (u8)(n >> 8);
+        *dst++ = (u8)n;
     }
-    return -1;
+    return true;
 }
+#endif
 
+// whitespace is skipped, decoding stops at the first '='
 static ByteSlice Base64Decode(const ByteSlice& data) {
+    static const Base64Values b64;
     size_t sLen = data.size();
     u8* s = data.data();
     u8* end = data.data() + sLen;
@@ -176,10 +228,18 @@ static ByteSlice Base64Decode(const ByteSlice& data) {
     u8* curr = result;
     u8 c = 0;
     int step = 0;
-    for (; s < end && *s != '='; s++) {
-        char n = decode64(*s);
-        if (-1 == n) {
-            if (str::IsWs((char)*s)) {
+    while (s < end && *s != '=') {
+#if USE_SSE2
+        // whole runs of 16 characters between line breaks are decoded at once
+        if (step % 4 == 0 && end - s >= 16 && Base64Decode16(s, curr)) {
+            s += 16;
+            curr += 12;
+            continue;
+        }
+#endif
+        u8 n = b64.values[*s++];
+        if (0xFF == n) {
+            if (str::IsWs((char)s[-1])) {
                 continue;
             }
             free(result);
@@ -288,6 +348,9 @@ EpubDoc::~EpubDoc() {
         str::Free(img.base);
         str::Free(img.fileName);
     }
+    for (ByteSlice& html : chapters) {
+        html.Free();
+    }
 
     LeaveCriticalSection(&zipAccess);
     DeleteCriticalSection(&zipAccess);
@@ -319,31 +382,43 @@ static bool isImageMediaType(const char* mediatype) {
     return str::Eq(mediatype, "image/png") || str::Eq(mediatype, "image/jpeg") || str::Eq(mediatype, "image/gif");
 }
 
-bool EpubDoc::Load() {
-    if (!zip) {
-        return false;
-    }
+// returns the path of the package document (.opf) within the archive
+static char* GetEpubContentPath(MultiFormatArchive* zip) {
     ByteSlice container = zip->GetFileDataByName("META-INF/container.xml");
     if (!container) {
-        return false;
+        return nullptr;
     }
     AutoFree contFree = container.Get();
     HtmlParser parser;
     HtmlElement* node = parser.ParseInPlace(container);
     if (!node) {
-        return false;
+        return nullptr;
     }
 
     // only consider the first <rootfile> element (default rendition)
     node = parser.FindElementByNameNS("rootfile", EPUB_CONTAINER_NS);
     if (!node) {
-        return false;
+        return nullptr;
     }
     char* contentPath = node->GetAttributeTemp("full-path");
     if (!contentPath) {
-        return false;
+        return nullptr;
     }
     url::DecodeInPlace(contentPath);
+    return str::Dup(contentPath);
+}
+
+bool EpubDoc::Load() {
+    if (!zip) {
+        return false;
+    }
+    AutoFreeStr contentPathFree(GetEpubContentPath(zip));
+    char* contentPath = contentPathFree.Get();
+    if (!contentPath) {
+        return false;
+    }
+    HtmlParser parser;
+    HtmlElement* node = nullptr;
 
     // encrypted files will be ignored (TODO: support decryption)
     StrVec encList;
@@ -455,26 +530,66 @@ bool EpubDoc::Load() {
         }
 
         const char* fname = pathList.at(idList.Find(idref));
-        char* fullPath = str::JoinTemp(contentPath, fname);
-        ByteSlice html = zip->GetFileDataByName(fullPath);
-        if (!html) {
-            continue;
-        }
-        char* decoded = DecodeTextToUtf8(html, true);
-        html.Free();
-        if (!decoded) {
-            continue;
+        spinePaths.Append(str::JoinTemp(contentPath, fname));
+    }
+    // the spine items are only read as they're laid out
+    chapters.AppendBlanks(spinePaths.size());
+    chapterLoaded.AppendBlanks(spinePaths.size());
+
+    return spinePaths.size() > 0;
+}
+
+int EpubDoc::GetChapterCount() const {
+    return spinePaths.Size();
+}
+
+// can be called from several layout threads at once
+ByteSlice EpubDoc::GetChapterHtml(int chapterNo) {
+    const char* fullPath = spinePaths.at(chapterNo);
+    ByteSlice html;
+    {
+        ScopedCritSec scope(&zipAccess);
+        if (chapterLoaded[chapterNo]) {
+            return chapters[chapterNo];
         }
+        html = zip->GetFileDataByName(fullPath);
+    }
+    char* decoded = html ? DecodeTextToUtf8(html, true) : nullptr;
+    html.Free();
+
+    str::Str res;
+    if (decoded) {
         // insert explicit page-breaks between sections including
         // an anchor with the file name at the top (for internal links)
         ReportIf(str::FindChar(fullPath, '"'));
-        str::TransCharsInPlace(fullPath, "\"", "'");
-        htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", fullPath);
-        htmlData.Append(decoded);
+        AutoFreeStr pagePath(str::Dup(fullPath));
+        str::TransCharsInPlace(pagePath, "\"", "'");
+        res.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", pagePath.Get());
+        res.Append(decoded);
         str::Free(decoded);
     }
 
-    return htmlData.size() > 0;
+    ScopedCritSec scope(&zipAccess);
+    if (!chapterLoaded[chapterNo]) {
+        chapterLoaded[chapterNo] = true;
+        if (res.size() > 0) {
+            chapters[chapterNo] = res.StealAsByteSlice();
+        }
+    }
+    return chapters[chapterNo];
+}
+
+bool EpubDoc::GetChapterFileInfo(int chapterNo, i64* sizeOut, i64* fileTimeOut) {
+    const char* fullPath = spinePaths.at(chapterNo);
+    ScopedCritSec scope(&zipAccess);
+    size_t fileId = zip->GetFileId(fullPath);
+    if (fileId == (size_t)-1) {
+        return false;
+    }
+    MultiFormatArchive::FileInfo* fi = zip->GetFileInfos().at(fileId);
+    *sizeOut = (i64)fi->fileSizeUncompressed;
+    *fileTimeOut = fi->fileTime;
+    return true;
 }
 
 void EpubDoc::ParseMetadata(const char* content) {
@@ -518,10 +633,6 @@ void EpubDoc::ParseMetadata(const char* content) {
     }
 }
 
-ByteSlice EpubDoc::GetHtmlData() const {
-    return htmlData.AsByteSlice();
-}
-
 ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     ScopedCritSec scope(&zipAccess);
 
@@ -552,6 +663,12 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     if (str::FindChar(url, '\\')) {
         str::TransCharsInPlace(url, "\\", "/");
     }
+    return GetImageDataByUrl(url);
+}
+
+ByteSlice* EpubDoc::GetImageDataByUrl(const char* url) {
+    ScopedCritSec scope(&zipAccess);
+
     for (ImageData& img : images) {
         if (str::Eq(img.fileName, url)) {
             if (img.base.empty()) {
@@ -578,6 +695,17 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     return nullptr;
 }
 
+const char* EpubDoc::GetImageUrl(const ByteSlice& img) {
+    ScopedCritSec scope(&zipAccess);
+
+    for (ImageData& data : images) {
+        if (!data.base.empty() && data.base.data() == img.data()) {
+            return data.fileName;
+        }
+    }
+    return nullptr;
+}
+
 ByteSlice EpubDoc::GetFileData(const char* relPath, const char* pagePath) {
     if (!pagePath) {
         CrashIf(true);
@@ -753,6 +881,69 @@ EpubDoc* EpubDoc::CreateFromFile(const char* path) {
     return doc;
 }
 
+// only parses the package document to find the cover image, which is a lot
+// cheaper than Load() (e.g. for thumbnails). The caller must free the data
+ByteSlice EpubDoc::LoadCoverImage(IStream* stream) {
+    MultiFormatArchive* zip = OpenZipArchive(stream, true);
+    if (!zip) {
+        return {};
+    }
+    defer {
+        delete zip;
+    };
+    AutoFreeStr contentPath(GetEpubContentPath(zip));
+    if (!contentPath) {
+        return {};
+    }
+    ByteSlice content = zip->GetFileDataByName(contentPath);
+    AutoFree contentFree = content.Get();
+    if (!content) {
+        return {};
+    }
+    HtmlParser parser;
+    if (!parser.ParseInPlace(content)) {
+        return {};
+    }
+    HtmlElement* manifest = parser.FindElementByNameNS("manifest", EPUB_OPF_NS);
+    if (!manifest) {
+        return {};
+    }
+
+    // EPUB 2 references the cover's manifest item with <meta name="cover" content="id" />
+    char* coverId = nullptr;
+    HtmlElement* node = parser.FindElementByNameNS("meta", EPUB_OPF_NS);
+    for (; node && !coverId; node = parser.FindElementByNameNS("meta", EPUB_OPF_NS, node)) {
+        if (str::Eq(node->GetAttributeTemp("name"), "cover")) {
+            coverId = node->GetAttributeTemp("content");
+        }
+    }
+    // EPUB 3 marks the cover's manifest item with properties="cover-image"
+    char* coverPath = nullptr;
+    for (node = manifest->down; node && !coverPath; node = node->next) {
+        if (!isImageMediaType(node->GetAttributeTemp("media-type"))) {
+            continue;
+        }
+        char* properties = node->GetAttributeTemp("properties");
+        bool isCover = properties && str::Find(properties, "cover-image");
+        if (isCover || (coverId && str::Eq(node->GetAttributeTemp("id"), coverId))) {
+            coverPath = node->GetAttributeTemp("href");
+        }
+    }
+    if (!coverPath) {
+        return {};
+    }
+    url::DecodeInPlace(coverPath);
+
+    // hrefs are relative to the package document
+    char* slashPos = str::FindCharLast(contentPath, '/');
+    if (slashPos) {
+        *(slashPos + 1) = '\0';
+    } else {
+        *contentPath.Get() = '\0';
+    }
+    return zip->GetFileDataByName(str::JoinTemp(contentPath, coverPath));
+}
+
 EpubDoc* EpubDoc::CreateFromStream(IStream* stream) {
     EpubDoc* doc = new EpubDoc(stream);
     if (!doc || !doc->Load()) {
@@ -768,10 +959,12 @@ const char* FB2_MAIN_NS = "http://www.gribuser.ru/xml/fictionbook/2.0";
 const char* FB2_XLINK_NS = "http://www.w3.org/1999/xlink";
 
 Fb2Doc::Fb2Doc(const char* fileName) : fileName(str::Dup(fileName)) {
+    InitializeCriticalSection(&imagesAccess);
 }
 
 Fb2Doc::Fb2Doc(IStream* stream) : stream(stream) {
     stream->AddRef();
+    InitializeCriticalSection(&imagesAccess);
 }
 
 Fb2Doc::~Fb2Doc() {
@@ -782,6 +975,7 @@ Fb2Doc::~Fb2Doc() {
     if (stream) {
         stream->Release();
     }
+    DeleteCriticalSection(&imagesAccess);
 }
 
 static ByteSlice loadFromFile(Fb2Doc* doc) {
@@ -850,13 +1044,13 @@ bool Fb2Doc::Load() {
     if (data.empty()) {
         return false;
     }
-    AutoFreeStr tmp = DecodeTextToUtf8(data, true);
+    source.Set(DecodeTextToUtf8(data, true));
     data.Free();
-    if (!tmp) {
+    if (!source) {
         return false;
     }
 
-    ByteSlice data2(tmp.Get());
+    ByteSlice data2(source.Get());
 
     HtmlPullParser parser(data2);
     HtmlToken* tok;
@@ -949,6 +1143,10 @@ bool Fb2Doc::Load() {
         }
     }
 
+    nEncodedImages = images.isize();
+    if (nEncodedImages == 0) {
+        source.Set(nullptr);
+    }
     return xmlData.size() > 0;
 }
 
@@ -965,30 +1163,40 @@ void Fb2Doc::ExtractImage(HtmlPullParser* parser, HtmlToken* tok) {
         return;
     }
 
+    // decoded in GetImageData()
     ImageData data;
-    data.base = Base64Decode({(u8*)tok->s, tok->sLen});
-    if (data.base.empty()) {
-        return;
-    }
     data.fileName = str::Join("#", id);
     data.fileId = images.size();
     images.Append(data);
+    encodedImages.Append({(u8*)tok->s, tok->sLen});
 }
 
 ByteSlice Fb2Doc::GetXmlData() const {
     return {(u8*)xmlData.Get(), xmlData.size()};
 }
 
-ByteSlice* Fb2Doc::GetImageData(const char* fileName) const {
+ByteSlice* Fb2Doc::GetImageData(const char* fileName) {
+    ScopedCritSec scope(&imagesAccess);
     for (size_t i = 0; i < images.size(); i++) {
-        if (str::Eq(images.at(i).fileName, fileName)) {
-            return &images.at(i).base;
+        ImageData& img = images.at(i);
+        if (!str::Eq(img.fileName, fileName)) {
+            continue;
+        }
+        ByteSlice& encoded = encodedImages.at(i);
+        if (!encoded.empty()) {
+            img.base = Base64Decode(encoded);
+            encoded = {};
+            // the source is no longer needed once all images are decoded
+            if (--nEncodedImages == 0) {
+                source.Set(nullptr);
+            }
         }
+        return img.base.empty() ? nullptr : &img.base;
     }
     return nullptr;
 }
 
-ByteSlice* Fb2Doc::GetCoverImage() const {
+ByteSlice* Fb2Doc::GetCoverImage() {
     if (!coverImage) {
         return nullptr;
     }
@@ -28,11 +28,14 @@ struct PropertyMap {
 
 class EpubDoc {
     MultiFormatArchive* zip = nullptr;
-    // zip and images are the only mutable members of EpubDoc after initialization;
-    // access to them must be serialized for multi-threaded users
+    // zip, images and chapters are the only mutable members of EpubDoc after
+    // initialization; access to them must be serialized for multi-threaded users
     CRITICAL_SECTION zipAccess;
 
-    str::Str htmlData;
+    // full paths of the spine items, their html is loaded on demand
+    StrVec spinePaths;
+    Vec<ByteSlice> chapters;
+    Vec<bool> chapterLoaded;
     Vec<ImageData> images;
     AutoFreeStr tocPath;
     AutoFreeStr fileName;
@@ -50,9 +53,19 @@ class EpubDoc {
     explicit EpubDoc(IStream* stream);
     ~EpubDoc();
 
-    ByteSlice GetHtmlData() const;
+    int GetChapterCount() const;
+    // decoded html of a spine item, loaded on first use and kept until
+    // the document is deleted. Empty if the item can't be loaded
+    ByteSlice GetChapterHtml(int chapterNo);
+    // uncompressed size and time of the spine item from the zip directory
+    // (i.e. without loading it). Returns false if it's not in the zip
+    bool GetChapterFileInfo(int chapterNo, i64* sizeOut, i64* fileTimeOut);
 
     ByteSlice* GetImageData(const char* fileName, const char* pagePath);
+    // url is the normalized path of the image within the archive
+    ByteSlice* GetImageDataByUrl(const char* url);
+    // returns the url of previously loaded image data (nullptr if unknown)
+    const char* GetImageUrl(const ByteSlice& img);
     ByteSlice GetFileData(const char* relPath, const char* pagePath);
 
     char* GetProperty(DocumentProperty prop) const;
@@ -66,6 +79,7 @@ class EpubDoc {
 
     static EpubDoc* CreateFromFile(const char* path);
     static EpubDoc* CreateFromStream(IStream* stream);
+    static ByteSlice LoadCoverImage(IStream* stream);
 };
 
 /* ********** FictionBook (FB2) ********** */
@@ -78,7 +92,13 @@ class Fb2Doc {
     IStream* stream = nullptr;
 
     str::Str xmlData;
+    // the decoded document which the base64 data of not yet decoded images points into
+    AutoFree source;
+    // images are only decoded on first use
     Vec<ImageData> images;
+    Vec<ByteSlice> encodedImages;
+    int nEncodedImages = 0;
+    CRITICAL_SECTION imagesAccess;
     AutoFree coverImage;
     PropertyMap props;
     bool isZipped = false;
@@ -93,8 +113,9 @@ class Fb2Doc {
 
     ByteSlice GetXmlData() const;
 
-    ByteSlice* GetImageData(const char* fileName) const;
-    ByteSlice* GetCoverImage() const;
+    // can be called from several threads at once
+    ByteSlice* GetImageData(const char* fileName);
+    ByteSlice* GetCoverImage();
 
     char* GetProperty(DocumentProperty prop) const;
     const char* GetFileName() const;
@@ -42,17 +42,32 @@ MobiFormatter::MobiFormatter(HtmlFormatterArgs* args, MobiDoc* doc) : HtmlFormat
     }
 }
 
+// MobiDoc decodes text records on demand, so make sure that
+// there's always enough decoded html ahead of the parser
+HtmlToken* MobiFormatter::NextHtmlToken() {
+    if (doc && (size_t)currReparseIdx + kMobiDecodeAhead / 2 > htmlParser->Len()) {
+        ByteSlice html = doc->DecodeHtmlData((size_t)currReparseIdx + kMobiDecodeAhead);
+        CrashIf((const char*)html.data() != htmlParser->Start());
+        htmlParser->SetLen(html.size());
+    }
+    return HtmlFormatter::NextHtmlToken();
+}
+
 // parses size in the form "1em" or "3pt". To interpret ems we need emInPoints
 // to be passed by the caller
-static float ParseSizeAsPixels(const char* s, size_t len, float emInPoints) {
+static float ParseSizeAsPixels(const StrSpan& s, float emInPoints) {
     float sizeInPoints = 0;
-    if (str::Parse(s, len, "%fem", &sizeInPoints)) {
+    StrSpan unit;
+    if (!str::ParseFloat(s, &sizeInPoints, &unit)) {
+        return 0;
+    }
+    if (str::StartsWith(unit, "em")) {
         sizeInPoints *= emInPoints;
-    } else if (str::Parse(s, len, "%fin", &sizeInPoints)) {
+    } else if (str::StartsWith(unit, "in")) {
         sizeInPoints *= 72;
-    } else if (str::Parse(s, len, "%fpt", &sizeInPoints)) {
+    } else if (str::StartsWith(unit, "pt")) {
         // no conversion needed
-    } else if (str::Parse(s, len, "%fpx", &sizeInPoints)) {
+    } else if (str::StartsWith(unit, "px")) {
         return sizeInPoints;
     } else {
         return 0;
@@ -72,7 +87,7 @@ void MobiFormatter::HandleSpacing_Mobi(HtmlToken* t) {
     // 3pt top padding (the same seems to apply for <blockquote>)
     AttrInfo* attr = t->GetAttrByName("width");
     if (attr) {
-        float lineIndent = ParseSizeAsPixels(attr->val, attr->valLen, CurrFont()->GetSize());
+        float lineIndent = ParseSizeAsPixels(attr->Val(), CurrFont()->GetSize());
         // there are files with negative width which produces partially invisible
         // text, so don't allow that
         if (lineIndent > 0) {
@@ -83,7 +98,7 @@ void MobiFormatter::HandleSpacing_Mobi(HtmlToken* t) {
     attr = t->GetAttrByName("height");
     if (attr) {
         // for use it in FlushCurrLine()
-        currLineTopPadding = ParseSizeAsPixels(attr->val, attr->valLen, CurrFont()->GetSize());
+        currLineTopPadding = ParseSizeAsPixels(attr->Val(), CurrFont()->GetSize());
     }
 }
 
@@ -101,7 +116,7 @@ void MobiFormatter::HandleTagImg(HtmlToken* t) {
     AttrInfo* attr = t->GetAttrByName("recindex");
     if (attr) {
         int n;
-        if (str::Parse(attr->val, attr->valLen, "%d", &n)) {
+        if (str::ParseInt(attr->Val(), &n)) {
             ByteSlice* img = doc->GetImage(n);
             needAlt = !img || !EmitImage(img);
         }
@@ -165,7 +180,7 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
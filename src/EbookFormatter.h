@@ -13,6 +13,7 @@ class MobiFormatter : public HtmlFormatter {
     void HandleSpacing_Mobi(HtmlToken* t);
     void HandleTagImg(HtmlToken* t) override;
     void HandleHtmlTag(HtmlToken* t) override;
+    HtmlToken* NextHtmlToken() override;
 
   public:
     MobiFormatter(HtmlFormatterArgs* args, MobiDoc* doc);
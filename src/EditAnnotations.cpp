@@ -506,11 +506,12 @@ static void DoTextAlignment(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void TextAlignmentSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownTextAlignment->GetCurrentSelection();
     int newQuadding = idx;
     SetQuadding(ew->annot, newQuadding);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoTextFont(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -530,11 +531,12 @@ static void DoTextFont(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void TextFontSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownTextFont->GetCurrentSelection();
     const char* font = seqstrings::IdxToStr(gFontNames, idx);
     SetDefaultAppearanceTextFont(ew->annot, font);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoTextSize(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -551,12 +553,13 @@ static void DoTextSize(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void TextFontSizeChanging(EditAnnotationsWindow* ew, TrackbarPosChangingEvent* ev) {
+    RectF prevRect = GetRect(ew->annot);
     int fontSize = ev->pos;
     SetDefaultAppearanceTextSize(ew->annot, fontSize);
     AutoFreeStr s = str::Format(_TRA("Text Size: %d"), fontSize);
     ew->staticTextSize->SetText(s.Get());
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoTextColor(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -570,12 +573,13 @@ static void DoTextColor(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void TextColorSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownTextColor->GetCurrentSelection();
     char* item = ew->dropDownTextColor->items.at(idx);
     auto col = GetDropDownColor(item);
     SetDefaultAppearanceTextColor(ew->annot, col);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoBorder(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -594,12 +598,13 @@ static void DoBorder(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void BorderWidthChanging(EditAnnotationsWindow* ew, TrackbarPosChangingEvent* ev) {
+    RectF prevRect = GetRect(ew->annot);
     int borderWidth = ev->pos;
     SetBorderWidth(ew->annot, borderWidth);
     AutoFreeStr s = str::Format(_TRA("Border: %d"), borderWidth);
     ew->staticBorder->SetText(s.Get());
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoLineStartEnd(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -620,6 +625,7 @@ static void DoLineStartEnd(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void LineStartSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     int start = 0;
     int end = 0;
     GetLineEndingStyles(ew->annot, &start, &end);
@@ -627,10 +633,11 @@ static void LineStartSelectionChanged(EditAnnotationsWindow* ew) {
     int newVal = idx;
     start = newVal;
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void LineEndSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     int start = 0;
     int end = 0;
     GetLineEndingStyles(ew->annot, &start, &end);
@@ -638,7 +645,7 @@ static void LineEndSelectionChanged(EditAnnotationsWindow* ew) {
     int newVal = idx;
     end = newVal;
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoIcon(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -669,11 +676,12 @@ static void DoIcon(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void IconSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownIcon->GetCurrentSelection();
     auto item = ew->dropDownIcon->items.at(idx);
     SetIconName(ew->annot, item);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoColor(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -696,12 +704,13 @@ static void DoColor(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void ColorSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownColor->GetCurrentSelection();
     auto item = ew->dropDownColor->items.at(idx);
     auto col = GetDropDownColor(item);
     SetColor(ew->annot, col);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoInteriorColor(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -717,12 +726,13 @@ static void DoInteriorColor(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void InteriorColorSelectionChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto idx = ew->dropDownInteriorColor->GetCurrentSelection();
     auto item = ew->dropDownInteriorColor->items.at(idx);
     auto col = GetDropDownColor(item);
     SetInteriorColor(ew->annot, col);
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void DoOpacity(EditAnnotationsWindow* ew, Annotation* annot) {
@@ -746,12 +756,13 @@ static void DoSaveEmbed(EditAnnotationsWindow* ew, Annotation* annot) {
 }
 
 static void OpacityChanging(EditAnnotationsWindow* ew, TrackbarPosChangingEvent* ev) {
+    RectF prevRect = GetRect(ew->annot);
     int opacity = ev->pos;
     SetOpacity(ew->annot, opacity);
     AutoFreeStr s = str::Format(_TRA("Opacity: %d"), opacity);
     ew->staticOpacity->SetText(s.Get());
     EnableSaveIfAnnotationsChanged(ew);
-    MainWindowRerender(ew->tab->win);
+    RerenderAnnotation(ew->tab->win, ew->annot, prevRect);
 }
 
 static void UpdateUIForSelectedAnnotation(EditAnnotationsWindow* ew, int itemNo) {
@@ -839,8 +850,22 @@ static void ButtonEmbedAttachment(EditAnnotationsWindow* ew) {
     MessageBoxNYI(ew->hwnd);
 }
 
+// the appearance of some annotations (e.g. line endings, thick borders)
+// is drawn slightly outside of their rectangle
+constexpr float kAnnotationRerenderMargin = 4.f;
+
+// re-renders the part of the page covered by annot before and after the change
+void RerenderAnnotation(MainWindow* win, Annotation* annot, RectF prevRect) {
+    RectF r = prevRect.Union(GetRect(annot));
+    r.Inflate(kAnnotationRerenderMargin, kAnnotationRerenderMargin);
+    MainWindowRerenderRect(win, PageNo(annot), r);
+}
+
 void DeleteAnnotationAndUpdateUI(WindowTab* tab, EditAnnotationsWindow* ew, Annotation* annot) {
     annot = FindMatchingAnnotation(ew, annot);
+    int pageNo = PageNo(annot);
+    RectF rect = GetRect(annot);
+    rect.Inflate(kAnnotationRerenderMargin, kAnnotationRerenderMargin);
     DeleteAnnotation(annot);
     if (ew != nullptr) {
         // can be null if called from Menu.cpp and annotations window is not visible
@@ -848,7 +873,7 @@ void DeleteAnnotationAndUpdateUI(WindowTab* tab, EditAnnotationsWindow* ew, Anno
         UpdateUIForSelectedAnnotation(ew, 0);
         ew->listBox->SetCurrentSelection(0);
     }
-    MainWindowRerender(tab->win);
+    MainWindowRerenderRect(tab->win, pageNo, rect);
     ToolbarUpdateStateForWindow(tab->win, false);
 }
 
@@ -864,25 +889,37 @@ void EditAnnotationsWindow::ListBoxSelectionChanged() {
 
 static UINT_PTR gMainWindowRerenderTimer = 0;
 static MainWindow* gMainWindowForRender = nullptr;
+static int gPageNoForRender = 0;
+static RectF gRectForRender;
 
 // TODO: there seems to be a leak
 static void ContentsChanged(EditAnnotationsWindow* ew) {
+    RectF prevRect = GetRect(ew->annot);
     auto txt = ew->editContents->GetTextTemp();
     SetContents(ew->annot, txt);
     EnableSaveIfAnnotationsChanged(ew);
 
     MainWindow* win = ew->tab->win;
+    RectF rect = prevRect.Union(GetRect(ew->annot));
+    rect.Inflate(kAnnotationRerenderMargin, kAnnotationRerenderMargin);
     if (gMainWindowRerenderTimer != 0) {
         // logf("ContentsChanged: killing existing timer for re-render of MainWindow\n");
         KillTimer(win->hwndCanvas, gMainWindowRerenderTimer);
         gMainWindowRerenderTimer = 0;
+        if (gMainWindowForRender == win && gPageNoForRender == PageNo(ew->annot)) {
+            rect = rect.Union(gRectForRender);
+        } else if (MainWindowStillValid(gMainWindowForRender)) {
+            MainWindowRerenderRect(gMainWindowForRender, gPageNoForRender, gRectForRender);
+        }
     }
     UINT timeoutInMs = 1000;
     gMainWindowForRender = win;
+    gPageNoForRender = PageNo(ew->annot);
+    gRectForRender = rect;
     gMainWindowRerenderTimer = SetTimer(win->hwndCanvas, 1, timeoutInMs, [](HWND, UINT, UINT_PTR, DWORD) {
         if (MainWindowStillValid(gMainWindowForRender)) {
             // logf("ContentsChanged: re-rendering MainWindow\n");
-            MainWindowRerender(gMainWindowForRender);
+            MainWindowRerenderRect(gMainWindowForRender, gPageNoForRender, gRectForRender);
         } else {
             // logf("ContentsChanged: NOT re-rendering MainWindow because is not valid anymore\n");
         }
@@ -9,3 +9,4 @@ void CloseAndDeleteEditAnnotationsWindow(EditAnnotationsWindow*);
 void AddAnnotationToEditWindow(EditAnnotationsWindow*, Annotation*);
 void SelectAnnotationInEditWindow(EditAnnotationsWindow*, Annotation*);
 void DeleteAnnotationAndUpdateUI(WindowTab*, EditAnnotationsWindow*, Annotation*);
+void RerenderAnnotation(MainWindow*, Annotation*, RectF prevRect);
@@ -13,18 +13,24 @@ EngineBase* CreateEngineDjVuFromFile(const char* path);
 EngineBase* CreateEngineDjVuFromStream(IStream* stream);
 
 /* EngineEbook.cpp */
-EngineBase* CreateEngineEpubFromFile(const char* fileName);
+EngineBase* CreateEngineEpubFromFile(const char* fileName, bool lazyLayout = false);
 EngineBase* CreateEngineEpubFromStream(IStream* stream);
-EngineBase* CreateEngineFb2FromFile(const char* fileName);
+EngineBase* CreateEngineFb2FromFile(const char* fileName, bool lazyLayout = false);
 EngineBase* CreateEngineFb2FromStream(IStream* stream);
-EngineBase* CreateEngineMobiFromFile(const char* fileName);
+EngineBase* CreateEngineMobiFromFile(const char* fileName, bool lazyLayout = false);
 EngineBase* CreateEngineMobiFromStream(IStream* stream);
-EngineBase* CreateEnginePdbFromFile(const char* fileName);
+EngineBase* CreateEnginePdbFromFile(const char* fileName, bool lazyLayout = false);
 EngineBase* CreateEngineChmFromFile(const char* fileName);
 EngineBase* CreateEngineHtmlFromFile(const char* fileName);
 EngineBase* CreateEngineTxtFromFile(const char* fileName);
 
 void SetDefaultEbookFont(const char* name, float size);
+// if set, laid out pages of EPUB, FB2 and MOBI documents are saved in this directory
+// so that re-opening a document with the same settings doesn't lay it out again
+void SetEngineEbookLayoutCacheDir(const char* dir);
+constexpr const char* kEbookLayoutCacheExt = ".layoutcache";
+// "gdiplus" or "directwrite"
+void SetEbookTextRendering(const char* name);
 void EngineEbookCleanup();
 
 /* EngineImages.cpp */
@@ -39,26 +45,61 @@ EngineBase* CreateEngineImageDirFromFile(const char* fileName);
 bool IsEngineCbxSupportedFileType(Kind kind);
 EngineBase* CreateEngineCbxFromFile(const char* path);
 EngineBase* CreateEngineCbxFromStream(IStream* stream);
+// the caller must free the image data of the first page
+ByteSlice EngineCbxLoadCoverImage(IStream* stream);
+// a page size is empty if it's not known yet. Returns false if not a comic book
+bool EngineCbxGetPageSizes(EngineBase*, Vec<Size>& sizes);
+// e.g. sizes saved from a previous EngineCbxGetPageSizes() for the same file
+void EngineCbxSetPageSizes(EngineBase*, const Vec<Size>& sizes);
+// the undecoded image of a page of a comic book or an image directory (empty for
+// other documents), which the caller must free
+ByteSlice EngineImagesGetPageData(EngineBase*, int pageNo);
+// "lanczos", "bicubic" or "gdiplus"
+void SetImageScaling(const char* name);
 
 /* EngineMulti.cpp */
 
 bool IsEngineMultiSupportedFileType(Kind);
 EngineBase* CreateEngineMultiFromDirectory(const char* dir);
+ByteSlice EngineMultiLoadAttachment(EngineBase* engine, TocItem* ti, int attachmentNo);
 TocItem* CreateWrapperItem(EngineBase* engine);
 
 /* EngineMupdf.cpp */
 
 bool IsEngineMupdfSupportedFileType(Kind);
 EngineBase* CreateEngineMupdfFromFile(const char* path, Kind kind, int displayDPI, PasswordUI* pwdUI = nullptr);
-EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr);
+// maxStoreSize of 0 uses the default size of the fitz cache for fonts, images etc.
+EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr,
+                                        size_t maxStoreSize = 0);
 EngineBase* CreateEngineMupdfFromData(const ByteSlice& data, const char* nameHint, PasswordUI* pwdUI);
+// renders the first page of a PDF document to fit into size, only loading what that page needs
+RenderedBitmap* EngineMupdfRenderThumbnail(IStream* stream, Size size);
 ByteSlice LoadEmbeddedPDFFile(const char* path);
 const char* ParseEmbeddedStreamNumber(const char* path, int* streamNoOut);
 Annotation* EngineMupdfCreateAnnotation(EngineBase*, AnnotationType type, int pageNo, PointF pos);
 int EngineMupdfGetAnnotations(EngineBase*, Vec<Annotation*>*);
 bool EngineMupdfHasUnsavedAnnotations(EngineBase*);
+bool EngineMupdfFileChangedSinceLoad(EngineBase*);
+bool EngineMupdfGetPageDigests(EngineBase*, Vec<u64>& digests);
+void EngineMupdfReleasePage(EngineBase*, int pageNo);
 bool EngineMupdfSupportsAnnotations(EngineBase*);
-bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, std::function<void(const char*)> showErrorFunc);
+bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, std::function<void(const char*)> showErrorFunc,
+                            bool optimize = false);
+// if set, the index of installed system fonts (used for non-embedded fonts) is saved
+// in this directory so that the fonts don't have to be scanned at every start
+void SetEngineMupdfFontListCacheDir(const char* dir);
+constexpr const char* kFontListCacheFileName = "systemfonts.cache";
+// number of threads used for decoding a JPEG 2000 image (only one
+// image is decoded at a time, images are decoded on the calling thread if n <= 1)
+void SetEngineMupdfJpxDecodeThreads(int n);
+// extracting the font list (DocumentProperty::FontList) of a large document takes a while,
+// so this starts doing it in the background. Returns true once the font list is ready
+bool EngineMupdfFontListReady(EngineBase*);
+// the engine of the document being viewed gets a bigger part of the memory
+// budget shared by the fitz caches of all documents (nullptr if none)
+void SetEngineMupdfForeground(EngineBase*);
+// usage statistics of the fitz cache, for debugging. the caller must free()
+char* EngineMupdfGetStoreStats(EngineBase*);
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, AnnotationType* allowedAnnots);
 ByteSlice EngineMupdfLoadAttachment(EngineBase*, int attachmentNo);
 
@@ -67,12 +108,17 @@ ByteSlice EngineMupdfLoadAttachment(EngineBase*, int attachmentNo);
 bool IsEnginePsAvailable();
 bool IsEnginePsSupportedFileType(Kind);
 EngineBase* CreateEnginePsFromFile(const char* fileName);
+// if set, PDF files converted by Ghostscript are saved in this directory
+// so that re-opening the same PostScript file doesn't convert it again
+void SetEnginePsCacheDir(const char* dir);
+constexpr const char* kPsCacheExt = ".pscache";
 
 /* EngineCreate.cpp */
 
 bool IsSupportedFileType(Kind kind, bool enableEngineEbooks);
 
-EngineBase* CreateEngineFromFile(const char* filePath, PasswordUI* pwdUI, bool enableChmEngine);
+EngineBase* CreateEngineFromFile(const char* filePath, PasswordUI* pwdUI, bool enableChmEngine,
+                                 bool lazyLayout = false);
 
 bool EngineSupportsAnnotations(EngineBase*);
 bool EngineGetAnnotations(EngineBase*, Vec<Annotation*>*);
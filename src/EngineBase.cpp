@@ -323,10 +323,37 @@ int EngineBase::PageCount() const {
     return pageCount;
 }
 
+int EngineBase::LaidOutPageCount() {
+    return PageCount();
+}
+
+void EngineBase::CommitPages(int nPages) {
+    CrashIf(nPages != pageCount);
+}
+
+bool EngineBase::IsLayoutInProgress() {
+    return false;
+}
+
+bool EngineBase::IsPageSizeUpdatePending() {
+    return false;
+}
+
+bool EngineBase::UpdatePageSizes() {
+    return false;
+}
+
+void EngineBase::GetMemStats(EngineMemStats&) {
+}
+
 RectF EngineBase::PageContentBox(int pageNo, RenderTarget) {
     return PageMediabox(pageNo);
 }
 
+bool EngineBase::DrawPageOnDC(HDC, RenderPageArgs&, Point) {
+    return false;
+}
+
 bool EngineBase::SaveFileAsPDF(const char*) {
     return false;
 }
@@ -370,11 +370,27 @@ struct RenderPageArgs {
     RectF* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out = nullptr;
+    // faster but lower quality rendering (e.g. less anti-aliasing) for
+    // placeholders and while scrolling or zooming
+    bool draft = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
 };
 
+// memory held by an engine, see ResourceStats.h
+struct EngineMemStats {
+    // decoded resources: the fz_store for MuPDF documents,
+    // cached decoded bitmaps for images
+    i64 cacheSize = 0;
+    int cacheItems = 0;
+    // pages whose content is loaded
+    int loadedPages = 0;
+    // recorded page content (fz_display_list)
+    i64 displayListsSize = 0;
+    int displayLists = 0;
+};
+
 class EngineBase {
   public:
     Kind kind = nullptr;
@@ -400,6 +416,18 @@ class EngineBase {
 
     // number of pages the loaded document contains
     int PageCount() const;
+    // engines that lay out the document in the background (ebooks) only add
+    // new pages to PageCount() when CommitPages() is called, so that callers
+    // can first make room for them. LaidOutPageCount() is how many are ready
+    virtual int LaidOutPageCount();
+    virtual void CommitPages(int nPages);
+    // true while LaidOutPageCount() can still grow or exceeds PageCount()
+    virtual bool IsLayoutInProgress();
+    // engines that make up page sizes while loading big documents read the
+    // real ones in the background. UpdatePageSizes() makes them visible through
+    // PageMediabox() once they're known and returns true if any have changed
+    virtual bool IsPageSizeUpdatePending();
+    virtual bool UpdatePageSizes();
 
     // the box containing the visible page content (usually RectF(0, 0, pageWidth, pageHeight))
     virtual RectF PageMediabox(int pageNo) = 0;
@@ -410,6 +438,11 @@ class EngineBase {
     // renders a page into a cacheable RenderedBitmap
     // (*cookie_out must be deleted after the call returns)
     virtual RenderedBitmap* RenderPage(RenderPageArgs& args) = 0;
+    // draws a page directly on hdc (e.g. a printer DC) with vector graphics,
+    // with the top-left corner of what RenderPage() would render at offset.
+    // Returns false without drawing if that isn't possible for the page.
+    // With a nullptr hdc, only checks whether it would be possible
+    virtual bool DrawPageOnDC(HDC hdc, RenderPageArgs& args, Point offset);
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
@@ -493,6 +526,10 @@ class EngineBase {
     // without also measuring rendering times
     virtual bool BenchLoadPage(int pageNo) = 0;
 
+    // adds the memory used by this engine's caches to stats.
+    // Called periodically while resource stats are shown, so it must be cheap
+    virtual void GetMemStats(EngineMemStats& stats);
+
     // the name of the file this engine handles
     const char* FilePath() const;
 
@@ -6,6 +6,7 @@
 #include "utils/WinUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/Dpi.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
@@ -57,7 +58,8 @@ bool IsSupportedFileType(Kind kind, bool enableEngineEbooks) {
     return false;
 }
 
-static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI* pwdUI, bool enableChmEngine) {
+static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI* pwdUI, bool enableChmEngine,
+                                       bool lazyLayout) {
     if (!kind) {
         return nullptr;
     }
@@ -116,42 +118,43 @@ static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI*
 #endif
 
     if (kind == kindFileEpub) {
-        engine = CreateEngineEpubFromFile(path);
+        engine = CreateEngineEpubFromFile(path, lazyLayout);
         return engine;
     }
     if (kind == kindFileFb2 || kind == kindFileFb2z) {
-        engine = CreateEngineFb2FromFile(path);
+        engine = CreateEngineFb2FromFile(path, lazyLayout);
         return engine;
     }
     if (kind == kindFileMobi) {
-        engine = CreateEngineMobiFromFile(path);
+        engine = CreateEngineMobiFromFile(path, lazyLayout);
         return engine;
     }
     if (kind == kindFilePalmDoc) {
-        engine = CreateEnginePdbFromFile(path);
+        engine = CreateEnginePdbFromFile(path, lazyLayout);
         return engine;
     }
     if (kind == kindFileHTML) {
-        engine = CreateEnginePdbFromFile(path);
+        engine = CreateEnginePdbFromFile(path, lazyLayout);
         return engine;
     }
     return nullptr;
 }
 
-EngineBase* CreateEngineFromFile(const char* path, PasswordUI* pwdUI, bool enableChmEngine) {
+EngineBase* CreateEngineFromFile(const char* path, PasswordUI* pwdUI, bool enableChmEngine, bool lazyLayout) {
     CrashIf(!path);
+    TIME_TRACE_ARG("CreateEngineFromFile", path);
 
     // try to open with the engine guess from file name
     // if that fails, try to guess the file type based on content
     Kind kind = GuessFileTypeFromName(path);
-    EngineBase* engine = CreateEngineForKind(kind, path, pwdUI, enableChmEngine);
+    EngineBase* engine = CreateEngineForKind(kind, path, pwdUI, enableChmEngine, lazyLayout);
     if (engine) {
         return engine;
     }
 
     Kind newKind = GuessFileTypeFromContent(path);
     if (kind != newKind) {
-        engine = CreateEngineForKind(newKind, path, pwdUI, enableChmEngine);
+        engine = CreateEngineForKind(newKind, path, pwdUI, enableChmEngine, lazyLayout);
     }
     return engine;
 }
@@ -123,35 +123,25 @@ static TocItem* NewDjVuTocItem(TocItem* parent, const char* title, const char* l
     return res;
 }
 
+// each document has its own context (and thus its own message queue and lock)
+// so that different documents (and clones of a document used by other threads)
+// can be decoded concurrently
 struct DjVuContext {
     ddjvu_context_t* ctx = nullptr;
-    int refCount = 1;
     CRITICAL_SECTION lock;
 
     DjVuContext() {
         InitializeCriticalSection(&lock);
+        // ddjvu_context_create() calls setlocale() which would change the locale
+        // of the whole process while other threads might be using it
+        int prevLocale = _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
         ctx = ddjvu_context_create("DjVuEngine");
         // reset the locale to "C" as most other code expects
         setlocale(LC_ALL, "C");
+        _configthreadlocale(prevLocale);
         CrashIf(!ctx);
     }
 
-    int AddRef() {
-        EnterCriticalSection(&lock);
-        ++refCount;
-        int res = refCount;
-        LeaveCriticalSection(&lock);
-        return res;
-    }
-
-    int Release() {
-        EnterCriticalSection(&lock);
-        CrashIf(refCount <= 0);
-        --refCount;
-        LeaveCriticalSection(&lock);
-        return refCount;
-    }
-
     ~DjVuContext() {
         EnterCriticalSection(&lock);
         if (ctx) {
@@ -161,6 +151,8 @@ struct DjVuContext {
         DeleteCriticalSection(&lock);
     }
 
+    // ddjvu_message_wait() blocks until the context posts a message, so with
+    // a context per document we only wake up for messages of our document
     void SpinMessageLoop(bool wait = true) const {
         const ddjvu_message_t* msg = nullptr;
         if (wait) {
@@ -186,10 +178,8 @@ struct DjVuContext {
         return ddjvu_document_create_by_filename_utf8(ctx, fileName, /* cache */ FALSE);
     }
 
-    ddjvu_document_t* OpenStream(IStream* stream) {
+    ddjvu_document_t* OpenData(const ByteSlice& d) {
         ScopedCritSec scope(&lock);
-        ByteSlice d = GetDataFromStream(stream, nullptr);
-        AutoFree dFree(d.Get());
         if (d.empty() || d.size() > ULONG_MAX) {
             return nullptr;
         }
@@ -198,33 +188,7 @@ struct DjVuContext {
     }
 };
 
-// TODO: make it non-static because it accesses other static state
-// in djvu which got deleted first
-static DjVuContext* gDjVuContext;
-
-static DjVuContext* GetDjVuContext() {
-    if (!gDjVuContext) {
-        gDjVuContext = new DjVuContext();
-    } else {
-        gDjVuContext->AddRef();
-    }
-    return gDjVuContext;
-}
-
-static void ReleaseDjVuContext() {
-    CrashIf(!gDjVuContext);
-    int refCount = gDjVuContext->Release();
-    if (refCount != 0) {
-        return;
-    }
-}
-
 void CleanupEngineDjVu() {
-    if (gDjVuContext) {
-        CrashIf(gDjVuContext->refCount != 0);
-        delete gDjVuContext;
-        gDjVuContext = nullptr;
-    }
     minilisp_finish();
 }
 
@@ -233,6 +197,22 @@ struct DjVuPageInfo {
     Vec<IPageElement*> allElements;
     miniexp_t annos{miniexp_dummy};
     bool gotAllElements = false;
+    // ratio of GetFileDPI() and the page's dpi, 0 until known
+    float dpiFactor = 0;
+};
+
+// decoded pages are kept around so that rendering a page at another zoom
+// level (or another tile of it) doesn't have to decode it again
+constexpr size_t kMaxDjVuPageCacheSize = 64 * 1024 * 1024;
+constexpr int kMaxDjVuCachedPages = 8;
+// how many pages after the one being rendered are decoded in the background
+constexpr int kDjVuPrefetchPages = 2;
+
+struct DjVuCachedPage {
+    ddjvu_page_t* page = nullptr;
+    int pageNo = 0;
+    // estimated memory used by the decoded page, 0 until decoded
+    size_t size = 0;
 };
 
 class EngineDjVu : public EngineBase {
@@ -274,6 +254,7 @@ class EngineDjVu : public EngineBase {
 
   protected:
     IStream* stream = nullptr;
+    DjVuContext* djvu = nullptr;
 
     Vec<DjVuPageInfo*> pages;
 
@@ -283,14 +264,21 @@ class EngineDjVu : public EngineBase {
 
     Vec<ddjvu_fileinfo_t> fileInfos;
 
-    RenderedBitmap* CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const;
+    // least recently used first, only accessed under djvu->lock
+    Vec<DjVuCachedPage> cachedPages;
+
+    ddjvu_page_t* GetDecodedPage(int pageNo);
+    void PrefetchPages(int pageNo);
+    void TrimPageCache(ddjvu_page_t* keep);
+    float GetDpiFactor(int pageNo);
+    RenderedBitmap* CreateRenderedBitmap(Size size, bool grayscale, char** dataOut) const;
     bool ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>& coords);
     char* ResolveNamedDest(const char* name);
     TocItem* BuildTocTree(TocItem* parent, miniexp_t entry, int& idCounter);
     bool Load(const char* fileName);
     bool Load(IStream* stream);
-    bool FinishLoading();
-    bool LoadMediaboxes();
+    bool FinishLoading(const ByteSlice& streamData);
+    bool LoadMediaboxes(const ByteSlice& fileData);
 };
 
 EngineDjVu::EngineDjVu() {
@@ -298,14 +286,18 @@ EngineDjVu::EngineDjVu() {
     str::ReplaceWithCopy(&defaultExt, ".djvu");
     // DPI isn't constant for all pages and thus premultiplied
     fileDPI = 300.0f;
-    GetDjVuContext();
+    djvu = new DjVuContext();
 }
 
 EngineDjVu::~EngineDjVu() {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    EnterCriticalSection(&djvu->lock);
 
     delete tocTree;
 
+    for (auto& cp : cachedPages) {
+        ddjvu_page_release(cp.page);
+    }
+
     for (auto pi : pages) {
         if (pi->annos && pi->annos != miniexp_dummy) {
             ddjvu_miniexp_release(doc, pi->annos);
@@ -323,7 +315,8 @@ EngineDjVu::~EngineDjVu() {
     if (stream) {
         stream->Release();
     }
-    ReleaseDjVuContext();
+    LeaveCriticalSection(&djvu->lock);
+    delete djvu;
 }
 
 EngineBase* EngineDjVu::Clone() {
@@ -361,15 +354,6 @@ bool EngineDjVu::BenchLoadPage(int) {
 // so try to either only use them when actually needed or replace them
 // with a function that extracts all the data at once:
 
-static bool ReadBytes(HANDLE h, DWORD offset, void* buffer, DWORD count) {
-    DWORD res = SetFilePointer(h, offset, nullptr, FILE_BEGIN);
-    if (res != offset) {
-        return false;
-    }
-    bool ok = ReadFile(h, buffer, count, &res, nullptr);
-    return ok && res == count;
-}
-
 #define DJVU_MARK_MAGIC 0x41542654L /* AT&T */
 #define DJVU_MARK_FORM 0x464F524DL  /* FORM */
 #define DJVU_MARK_DJVM 0x444A564DL  /* DJVM */
@@ -389,48 +373,42 @@ struct DjVuInfoChunk {
 
 static_assert(sizeof(DjVuInfoChunk) == 10, "wrong size of DjVuInfoChunk structure");
 
-bool EngineDjVu::LoadMediaboxes() {
-    const char* path = FilePath();
-    if (!path) {
-        return false;
-    }
-    AutoCloseHandle h(file::OpenReadOnly(path));
-    if (!h.IsValid()) {
-        return false;
-    }
-    char buffer[16];
-    ByteReader r(buffer, sizeof(buffer));
-    if (!ReadBytes(h, 0, buffer, 16) || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
+// walks the chain of IFF chunk headers in memory and extracts the page sizes
+// from the pages' INFO chunks
+static bool ParseMediaboxes(const ByteSlice& data, Vec<DjVuPageInfo*>& pages, float fileDPI) {
+    ByteReader r(data);
+    size_t size = data.size();
+    if (size < 16 || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
         return false;
     }
 
-    DWORD offset = r.DWordBE(12) == DJVU_MARK_DJVM ? 16 : 4;
+    size_t offset = r.DWordBE(12) == DJVU_MARK_DJVM ? 16 : 4;
+    int pageCount = pages.isize();
     for (int pageNo = 0; pageNo < pageCount; /* no op, must inc inside isMark */) {
-        if (!ReadBytes(h, offset, buffer, 16)) {
+        if (offset + 16 > size) {
             return false;
         }
-        int partLen = r.DWordBE(4);
-        if (partLen < 0) {
+        int partLen = r.DWordBE(offset + 4);
+        if (partLen < 0 || (size_t)partLen > size - offset) {
             return false;
         }
-        bool isMark =
-            r.DWordBE(0) == DJVU_MARK_FORM && r.DWordBE(8) == DJVU_MARK_DJVU && r.DWordBE(12) == DJVU_MARK_INFO;
+        bool isMark = r.DWordBE(offset) == DJVU_MARK_FORM && r.DWordBE(offset + 8) == DJVU_MARK_DJVU &&
+                      r.DWordBE(offset + 12) == DJVU_MARK_INFO;
         if (isMark) {
-            if (!ReadBytes(h, offset + 16, buffer, 14)) {
+            DjVuInfoChunk info;
+            // the INFO chunk's data follows its 4 byte name and 4 byte length
+            bool ok = r.UnpackBE(&info, sizeof(info), "2w6b", offset + 20);
+            if (!ok) {
                 return false;
             }
-            DjVuInfoChunk info;
-            bool ok = r.UnpackBE(&info, sizeof(info), "2w6b", 4);
-            CrashIf(!ok);
             int dpi = MAKEWORD(info.dpiLo, info.dpiHi); // dpi is little-endian
             // DjVuLibre ignores DPI values outside 25 to 6000 in DjVuInfo::decode
             if (dpi < 25 || 6000 < dpi) {
                 dpi = 300;
             }
             DjVuPageInfo* pi = pages[pageNo];
-            // auto&& mediabox = pi->mediabox;
-            float dx = GetFileDPI() * info.width / dpi;
-            float dy = GetFileDPI() * info.height / dpi;
+            float dx = fileDPI * info.width / dpi;
+            float dy = fileDPI * info.height / dpi;
             if (info.flags & 4) {
                 pi->mediabox.dx = dy;
                 pi->mediabox.dy = dx;
@@ -446,26 +424,73 @@ bool EngineDjVu::LoadMediaboxes() {
     return true;
 }
 
+// reading a mapped file raises an exception when e.g. a network share goes away
+static bool ParseMappedMediaboxes(const ByteSlice& data, Vec<DjVuPageInfo*>& pages, float fileDPI) {
+    __try {
+        return ParseMediaboxes(data, pages, fileDPI);
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER
+                                                                : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+}
+
+// fileData is the content of the document if it was loaded from a stream,
+// otherwise the file is mapped into memory
+bool EngineDjVu::LoadMediaboxes(const ByteSlice& fileData) {
+    if (!fileData.empty()) {
+        return ParseMediaboxes(fileData, pages, GetFileDPI());
+    }
+
+    const char* path = FilePath();
+    if (!path) {
+        return false;
+    }
+    AutoCloseHandle h(file::OpenReadOnly(path));
+    if (!h.IsValid()) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(h, &fileSize) || fileSize.QuadPart < 16 || (u64)fileSize.QuadPart > (u64)SIZE_MAX) {
+        return false;
+    }
+    AutoCloseHandle hMap(CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!hMap.IsValid()) {
+        return false;
+    }
+    // on 32-bit builds mapping very large files might fail for lack of address space,
+    // in which case FinishLoading() falls back to asking ddjvu
+    void* data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        return false;
+    }
+    ByteSlice mapped((u8*)data, (size_t)fileSize.QuadPart);
+    bool ok = ParseMappedMediaboxes(mapped, pages, GetFileDPI());
+    UnmapViewOfFile(data);
+    return ok;
+}
+
 bool EngineDjVu::Load(const char* fileName) {
     SetFilePath(fileName);
-    doc = gDjVuContext->OpenFile(fileName);
-    return FinishLoading();
+    doc = djvu->OpenFile(fileName);
+    return FinishLoading({});
 }
 
 bool EngineDjVu::Load(IStream* stream) {
-    doc = gDjVuContext->OpenStream(stream);
-    return FinishLoading();
+    ByteSlice d = GetDataFromStream(stream, nullptr);
+    AutoFree dFree(d.Get());
+    doc = djvu->OpenData(d);
+    return FinishLoading(d);
 }
 
-bool EngineDjVu::FinishLoading() {
+bool EngineDjVu::FinishLoading(const ByteSlice& streamData) {
     if (!doc) {
         return false;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     while (!ddjvu_document_decoding_done(doc)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
 
     if (ddjvu_document_decoding_error(doc)) {
@@ -480,14 +505,14 @@ bool EngineDjVu::FinishLoading() {
     for (int i = 0; i < pageCount; i++) {
         pages.Append(new DjVuPageInfo());
     }
-    bool ok = LoadMediaboxes();
+    bool ok = LoadMediaboxes(streamData);
     if (!ok) {
         // fall back to the slower but safer way to extract page mediaboxes
         for (int i = 0; i < pageCount; i++) {
             ddjvu_status_t status;
             ddjvu_pageinfo_t info;
             while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
             if (DDJVU_JOB_OK == status) {
                 DjVuPageInfo* pi = pages[i];
@@ -500,7 +525,7 @@ bool EngineDjVu::FinishLoading() {
     }
 
     while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
         ddjvu_miniexp_release(doc, outline);
@@ -512,7 +537,7 @@ bool EngineDjVu::FinishLoading() {
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-            gDjVuContext->SpinMessageLoop();
+            djvu->SpinMessageLoop();
         }
         if (DDJVU_JOB_OK == status && info.type == 'P' && info.pageno >= 0) {
             fileInfos.Append(info);
@@ -523,7 +548,118 @@ bool EngineDjVu::FinishLoading() {
     return true;
 }
 
-RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const {
+static size_t EstimateDecodedPageSize(ddjvu_page_t* page) {
+    size_t dx = (size_t)ddjvu_page_get_width(page);
+    size_t dy = (size_t)ddjvu_page_get_height(page);
+    // JB2 masks are (mostly) 1 bit per pixel, IW44 layers need several bytes
+    if (DDJVU_PAGETYPE_BITONAL == ddjvu_page_get_type(page)) {
+        return dx * dy / 8 + 1;
+    }
+    return dx * dy * 3 + 1;
+}
+
+// returns a fully decoded page owned by the page cache (don't release it)
+// must be called with djvu->lock held
+ddjvu_page_t* EngineDjVu::GetDecodedPage(int pageNo) {
+    DjVuCachedPage cp;
+    for (size_t i = 0; i < cachedPages.size(); i++) {
+        if (cachedPages[i].pageNo == pageNo) {
+            cp = cachedPages[i];
+            cachedPages.RemoveAt(i);
+            break;
+        }
+    }
+    if (!cp.page) {
+        cp.page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+        cp.pageNo = pageNo;
+        if (!cp.page) {
+            return nullptr;
+        }
+    }
+
+    while (!ddjvu_page_decoding_done(cp.page)) {
+        djvu->SpinMessageLoop();
+    }
+    if (ddjvu_page_decoding_error(cp.page)) {
+        ddjvu_page_release(cp.page);
+        return nullptr;
+    }
+    if (cp.size == 0) {
+        cp.size = EstimateDecodedPageSize(cp.page);
+    }
+    cachedPages.Append(cp);
+
+    PrefetchPages(pageNo);
+    TrimPageCache(cp.page);
+    return cp.page;
+}
+
+// ddjvu decodes pages on its own threads so creating them is enough to get
+// the following pages ready by the time the user scrolls to them
+void EngineDjVu::PrefetchPages(int pageNo) {
+    int last = std::min(pageNo + kDjVuPrefetchPages, pageCount);
+    for (int n = pageNo + 1; n <= last; n++) {
+        bool isCached = false;
+        for (auto& cp : cachedPages) {
+            if (cp.pageNo == n) {
+                isCached = true;
+                break;
+            }
+        }
+        if (isCached) {
+            continue;
+        }
+        DjVuCachedPage cp;
+        cp.page = ddjvu_page_create_by_pageno(doc, n - 1);
+        cp.pageNo = n;
+        if (cp.page) {
+            // prefetched pages are less important than the one just requested
+            cachedPages.InsertAt(cachedPages.size() > 0 ? cachedPages.size() - 1 : 0, cp);
+        }
+    }
+}
+
+void EngineDjVu::TrimPageCache(ddjvu_page_t* keep) {
+    size_t totalSize = 0;
+    for (auto& cp : cachedPages) {
+        totalSize += cp.size;
+    }
+    size_t i = 0;
+    while (i < cachedPages.size() &&
+           (totalSize > kMaxDjVuPageCacheSize || cachedPages.size() > (size_t)kMaxDjVuCachedPages)) {
+        DjVuCachedPage cp = cachedPages[i];
+        if (cp.page == keep) {
+            i++;
+            continue;
+        }
+        totalSize -= cp.size;
+        ddjvu_page_release(cp.page);
+        cachedPages.RemoveAt(i);
+    }
+}
+
+// must be called with djvu->lock held
+float EngineDjVu::GetDpiFactor(int pageNo) {
+    DjVuPageInfo* pi = pages[pageNo - 1];
+    if (pi->dpiFactor != 0) {
+        return pi->dpiFactor;
+    }
+    ddjvu_status_t status;
+    ddjvu_pageinfo_t info;
+    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
+        djvu->SpinMessageLoop();
+    }
+    pi->dpiFactor = 1.0;
+    if (DDJVU_JOB_OK == status) {
+        pi->dpiFactor = GetFileDPI() / info.dpi;
+    }
+    return pi->dpiFactor;
+}
+
+// creates a top-down DIB section (24 bit or 8 bit grayscale) for ddjvu_page_render()
+// to render into (so that there's no intermediate buffer to copy from)
+RenderedBitmap* EngineDjVu::CreateRenderedBitmap(Size size, bool grayscale, char** dataOut) const {
+    *dataOut = nullptr;
     int stride = ((size.dx * (grayscale ? 1 : 3) + 3) / 4) * 4;
 
     BITMAPINFO* bmi = (BITMAPINFO*)calloc(1, sizeof(BITMAPINFOHEADER) + (grayscale ? 256 * sizeof(RGBQUAD) : 0));
@@ -546,21 +682,28 @@ RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size,
     bmi->bmiHeader.biSizeImage = size.dy * stride;
     bmi->bmiHeader.biClrUsed = grayscale ? 256 : 0;
 
+    // a few rows of slack, same as the buffer ddjvu_page_render() used to render into
+    DWORD mapSize = (DWORD)(stride * (size.dy + 5));
     void* data = nullptr;
-    HANDLE hMap =
-        CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmi->bmiHeader.biSizeImage, nullptr);
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
-    if (hbmp) {
-        memcpy(data, bmpData, bmi->bmiHeader.biSizeImage);
+    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, mapSize, nullptr);
+    HBITMAP hbmp = nullptr;
+    if (hMap) {
+        hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
     }
-
     free(bmi);
 
+    if (!hbmp) {
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+    *dataOut = (char*)data;
     return new RenderedBitmap(hbmp, size, hMap);
 }
 
 RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto pageNo = args.pageNo;
@@ -570,16 +713,10 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     Rect full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return nullptr;
     }
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return nullptr;
-    }
 
     ddjvu_page_rotation_t rot = DDJVU_ROTATE_0;
     switch (rotation) {
@@ -609,7 +746,6 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     int topToBottom = TRUE;
@@ -617,44 +753,34 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     ddjvu_rect_t prect = {full.x, full.y, (uint)full.dx, (uint)full.dy};
     ddjvu_rect_t rrect = {screen.x, 2 * full.y - screen.y + full.dy - screen.dy, (uint)screen.dx, (uint)screen.dy};
 
-    RenderedBitmap* bmp = nullptr;
     size_t bytesPerPixel = isBitonal ? 1 : 3;
     size_t dx = (size_t)screen.dx;
     size_t dy = (size_t)screen.dy;
     size_t stride = ((dx * bytesPerPixel + 3) / 4) * 4;
-    size_t nBytes = stride * (dy + 5);
-    AutoFree bmpData = AllocArray<char>(nBytes);
-    if (!bmpData) {
+    char* bmpData = nullptr;
+    RenderedBitmap* bmp = CreateRenderedBitmap(screen.Size(), isBitonal, &bmpData);
+    if (!bmp) {
         return nullptr;
     }
 
     ddjvu_render_mode_t mode = isBitonal ? DDJVU_RENDER_MASKONLY : DDJVU_RENDER_COLOR;
-    int ok = ddjvu_page_render(page, mode, &prect, &rrect, fmt, (unsigned long)stride, bmpData.Get());
+    int ok = ddjvu_page_render(page, mode, &prect, &rrect, fmt, (unsigned long)stride, bmpData);
     if (!ok) {
         // nothing was rendered, leave the page blank (same as WinDjView)
         memset(bmpData, 0xFF, stride * dy);
-        isBitonal = true;
     }
-    bmp = CreateRenderedBitmap(bmpData, screen.Size(), isBitonal);
 
     return bmp;
 }
 
 RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     RectF pageRc = PageMediabox(pageNo);
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return pageRc;
     }
-
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return pageRc;
-    }
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
     // render the page in 8-bit grayscale up to 250x250 px in size
@@ -662,7 +788,6 @@ RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     ddjvu_format_set_row_order(fmt, /* top_to_bottom */ TRUE);
@@ -852,11 +977,11 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
 
 PageText EngineDjVu::ExtractPageText(int pageNo) {
     const WCHAR* lineSep = L"\n";
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     miniexp_t pagetext;
     while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     if (miniexp_nil == pagetext) {
         return {};
@@ -876,15 +1001,7 @@ PageText EngineDjVu::ExtractPageText(int pageNo) {
     PageText res;
 
     CrashIf(str::Len(extracted.Get()) != coords.size());
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    float dpiFactor = 1.0;
-    if (DDJVU_JOB_OK == status) {
-        dpiFactor = GetFileDPI() / info.dpi;
-    }
+    float dpiFactor = GetDpiFactor(pageNo);
 
     // TODO: the coordinates aren't completely correct yet
     Rect page = PageMediabox(pageNo).Round();
@@ -918,11 +1035,11 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
     auto& els = pi->allElements;
 
     if (pi->annos == miniexp_dummy) {
-        ScopedCritSec scope(&gDjVuContext->lock);
+        ScopedCritSec scope(&djvu->lock);
         while (pi->annos == miniexp_dummy) {
             pi->annos = ddjvu_document_get_pageanno(doc, pageNo - 1);
             if (pi->annos == miniexp_dummy) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
         }
     }
@@ -931,19 +1048,10 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
         return els;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     Rect page = PageMediabox(pageNo).Round();
-
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    float dpiFactor = 1.0;
-    if (DDJVU_JOB_OK == status) {
-        dpiFactor = GetFileDPI() / info.dpi;
-    }
+    float dpiFactor = GetDpiFactor(pageNo);
 
     miniexp_t* links = ddjvu_anno_get_hyperlinks(pi->annos);
     for (int i = 0; links[i]; i++) {
@@ -1162,7 +1270,7 @@ TocTree* EngineDjVu::GetToc() {
     if (tocTree) {
         return tocTree;
     }
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
     int idCounter = 0;
     TocItem* root = BuildTocTree(nullptr, outline, idCounter);
     if (!root) {
@@ -8,6 +8,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "mui/Mui.h"
 #include "utils/TgaReader.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -439,7 +440,46 @@ static bool CheckRenderPath(const char* path) {
     return true;
 }
 
-static bool RenderDocument(EngineBase* engine, const char* renderPath, float zoom = 1.f, bool silent = false) {
+struct RenderPageRange {
+    int start = 1;
+    // end == INT_MAX means to the last page
+    int end = INT_MAX;
+};
+
+// parses e.g. "1-3,7,10-" (same syntax as -print-settings and -bench)
+static bool ParseRenderPageRanges(const char* ranges, Vec<RenderPageRange>& result) {
+    StrVec rangeList;
+    Split(rangeList, ranges, ",", true);
+    for (char* rangeStr : rangeList) {
+        int start, end;
+        if (str::Parse(rangeStr, "%d-%d%$", &start, &end) && 0 < start && start <= end) {
+            result.Append(RenderPageRange{start, end});
+        } else if (str::Parse(rangeStr, "%d-%$", &start) && 0 < start) {
+            result.Append(RenderPageRange{start, INT_MAX});
+        } else if (str::Parse(rangeStr, "%d%$", &start) && 0 < start) {
+            result.Append(RenderPageRange{start, start});
+        } else {
+            return false;
+        }
+    }
+    return result.size() > 0;
+}
+
+static bool IsPageInRanges(const Vec<RenderPageRange>* ranges, int pageNo) {
+    if (!ranges) {
+        return true;
+    }
+    for (auto& range : *ranges) {
+        if (range.start <= pageNo && pageNo <= range.end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// if pages is given, only those pages are rendered to images
+static bool RenderDocument(EngineBase* engine, const char* renderPath, float zoom = 1.f, bool silent = false,
+                           const Vec<RenderPageRange>* pages = nullptr) {
     if (!CheckRenderPath(renderPath)) {
         return false;
     }
@@ -476,6 +516,9 @@ static bool RenderDocument(EngineBase* engine, const char* renderPath, float zoo
 
     bool success = true;
     for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        if (!IsPageInRanges(pages, pageNo)) {
+            continue;
+        }
         RenderPageArgs args(pageNo, zoom, 0);
         RenderedBitmap* bmp = engine->RenderPage(args);
         success &= bmp != nullptr;
@@ -523,6 +566,138 @@ class PasswordHolder : public PasswordUI {
     }
 };
 
+// -batch <jobs.txt> renders many documents on several threads (one document
+// per thread at a time). Each line of the job list (or of stdin for "-batch -",
+// read as jobs come in) describes a job as tab separated fields:
+// <file>\t<render path>[\t<zoom>%[\t<pages>]], e.g. "a.pdf\tthumbs\\a-%d.png\t25%\t1"
+// For every job, a line with its result and duration is printed, followed by
+// a summary with the throughput at the end
+struct BatchRenderer {
+    CRITICAL_SECTION access;
+    FILE* jobs = nullptr;
+    const char* password = nullptr;
+    bool silent = false;
+
+    // guarded by access
+    int nJobs = 0;
+    int nFailed = 0;
+    int nPages = 0;
+};
+
+// returns false when there are no more jobs
+static bool ReadBatchJob(BatchRenderer* b, str::Str& line, int& jobNo) {
+    ScopedCritSec scope(&b->access);
+    char buf[4096];
+    for (;;) {
+        if (!fgets(buf, dimof(buf), b->jobs)) {
+            return false;
+        }
+        str::TrimWSInPlace(buf, str::TrimOpt::Right);
+        // skip empty lines and comments
+        if (buf[0] && buf[0] != '#') {
+            line.Set(buf);
+            jobNo = ++b->nJobs;
+            return true;
+        }
+    }
+}
+
+static bool RunBatchJob(BatchRenderer* b, const char* job, int& nPages) {
+    StrVec fields;
+    Split(fields, job, "\t");
+    float zoom = 1.f;
+    Vec<RenderPageRange> pages;
+    if (fields.Size() < 2 || !CheckRenderPath(fields.at(1))) {
+        ErrOut("Error: Invalid job '%s'!", job);
+        return false;
+    }
+    if (fields.Size() > 2 && !str::IsEmpty(fields.at(2))) {
+        if (!str::Parse(fields.at(2), "%f%%%$", &zoom) || zoom <= 0.f) {
+            ErrOut("Error: Invalid zoom in job '%s'!", job);
+            return false;
+        }
+        zoom /= 100.f;
+    }
+    if (fields.Size() > 3 && !ParseRenderPageRanges(fields.at(3), pages)) {
+        ErrOut("Error: Invalid pages in job '%s'!", job);
+        return false;
+    }
+
+    PasswordHolder pwdUI(b->password);
+    EngineBase* engine = CreateEngineFromFile(fields.at(0), &pwdUI, false);
+    if (!engine) {
+        ErrOut("Error: Couldn't create an engine for %s!", fields.at(0));
+        return false;
+    }
+    Vec<RenderPageRange>* pagesToRender = pages.size() > 0 ? &pages : nullptr;
+    bool ok = RenderDocument(engine, fields.at(1), zoom, b->silent, pagesToRender);
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        nPages += IsPageInRanges(pagesToRender, pageNo) ? 1 : 0;
+    }
+    delete engine;
+    return ok;
+}
+
+static DWORD WINAPI BatchRenderThread(LPVOID data) {
+    BatchRenderer* b = (BatchRenderer*)data;
+    str::Str job;
+    int jobNo;
+    while (ReadBatchJob(b, job, jobNo)) {
+        auto timeStart = TimeGet();
+        int nPages = 0;
+        bool ok = RunBatchJob(b, job.Get(), nPages);
+        double dur = TimeSinceInMs(timeStart);
+
+        ScopedCritSec scope(&b->access);
+        b->nPages += nPages;
+        b->nFailed += ok ? 0 : 1;
+        Out("%d\t%s\t%.0f ms\t%d pages\t%s\n", jobNo, ok ? "ok" : "failed", dur, nPages, job.Get());
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int RunBatch(const char* jobsPath, int nThreads, const char* password, bool silent) {
+    BatchRenderer b;
+    b.password = password;
+    b.silent = silent;
+    b.jobs = str::Eq(jobsPath, "-") ? stdin : _wfopen(ToWstrTemp(jobsPath), L"r");
+    if (!b.jobs) {
+        ErrOut("Error: Couldn't open %s!", jobsPath);
+        return 1;
+    }
+    if (nThreads <= 0) {
+        nThreads = std::max(GetPhysicalProcessorCount(), 1);
+    }
+    InitializeCriticalSection(&b.access);
+
+    auto timeStart = TimeGet();
+    Vec<HANDLE> threads;
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, BatchRenderThread, &b, 0, nullptr);
+        if (h) {
+            threads.Append(h);
+        }
+    }
+    if (threads.size() == 0) {
+        BatchRenderThread(&b);
+    }
+    // WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles
+    for (HANDLE h : threads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    double secs = TimeSinceInMs(timeStart) / 1000.0;
+
+    Out("%d jobs (%d failed), %d pages in %.2f s with %d threads: %.1f jobs/s, %.1f pages/s\n", b.nJobs, b.nFailed,
+        b.nPages, secs, (int)threads.size(), secs > 0 ? b.nJobs / secs : 0, secs > 0 ? b.nPages / secs : 0);
+    if (b.jobs != stdin) {
+        fclose(b.jobs);
+    }
+    DeleteCriticalSection(&b.access);
+    return b.nFailed > 0 ? 1 : 0;
+}
+
 int main(__unused int argc, __unused char** argv) {
     setlocale(LC_ALL, "C");
     DisableDataExecution();
@@ -534,6 +709,7 @@ int main(__unused int argc, __unused char** argv) {
     Usage:
         ErrOut("%s [-pwd <password>][-quick][-render <path-%%d.tga>] <filename>",
                path::GetBaseNameTemp(argList.args[0]));
+        ErrOut("%s [-pwd <password>][-threads <n>] -batch <jobs.txt | ->", path::GetBaseNameTemp(argList.args[0]));
         return 2;
     }
 
@@ -543,6 +719,8 @@ int main(__unused int argc, __unused char** argv) {
     char* renderPath = nullptr;
     float renderZoom = 1.f;
     bool loadOnly = false, silent = false;
+    char* batchPath = nullptr;
+    int nThreads = 0;
 
     for (int i = 1; i < nArgs; i++) {
         if (str::Eq(argList.at(i), "-pwd") && i + 1 < nArgs && !password) {
@@ -562,6 +740,10 @@ int main(__unused int argc, __unused char** argv) {
             loadOnly = true;
         } else if (str::Eq(argList.at(i), "-silent")) {
             silent = true;
+        } else if (str::Eq(argList.at(i), "-batch") && i + 1 < nArgs && !batchPath) {
+            batchPath = argList.at(++i);
+        } else if (str::Eq(argList.at(i), "-threads") && i + 1 < nArgs) {
+            nThreads = atoi(argList.at(++i));
         } else if (str::Eq(argList.at(i), "-full")) {
             // -full is for backward compatibility
             fullDump = true;
@@ -571,7 +753,7 @@ int main(__unused int argc, __unused char** argv) {
             goto Usage;
         }
     }
-    if (!filePath) {
+    if (!filePath && !batchPath) {
         goto Usage;
     }
 
@@ -584,6 +766,10 @@ int main(__unused int argc, __unused char** argv) {
     ScopedGdiPlus gdiPlus;
     ScopedMui miniMui;
 
+    if (batchPath) {
+        return RunBatch(batchPath, nThreads, password, silent);
+    }
+
     WIN32_FIND_DATA fdata;
     WCHAR* pathW = ToWstrTemp(filePath);
     HANDLE hfind = FindFirstFileW(pathW, &fdata);
@@ -7,6 +7,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
@@ -39,6 +40,14 @@ Kind kindEngineTxt = "engineTxt";
 
 static AutoFreeStr gDefaultFontName;
 static float gDefaultFontSize = 10.f;
+static AutoFreeStr gLayoutCacheDir;
+
+// in lazy mode, that many pages are laid out before a document is shown,
+// the rest is laid out on a background thread
+constexpr int kLazyLayoutFirstPages = 32;
+
+// upper limit for threads laying out chapters in parallel
+constexpr int kMaxLayoutThreads = 8;
 
 static const WCHAR* GetDefaultFontName() {
     char* s = gDefaultFontName.Get();
@@ -70,6 +79,16 @@ void SetDefaultEbookFont(const char* name, float size) {
     gDefaultFontSize = size * 0.8f;
 }
 
+void SetEngineEbookLayoutCacheDir(const char* dir) {
+    gLayoutCacheDir.SetCopy(dir);
+}
+
+static bool gUseDirectWrite = false;
+
+void SetEbookTextRendering(const char* name) {
+    gUseDirectWrite = str::EqI(name, "directwrite");
+}
+
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
 struct PageAnchor {
@@ -90,6 +109,97 @@ class EbookAbortCookie : public AbortCookie {
     }
 };
 
+// the html that laid out pages point into. EPUB chapters are loaded
+// one by one, so it can consist of several separately allocated parts
+struct LayoutCacheHtml {
+    // empty for parts that haven't been loaded yet (see AppendUnloaded)
+    Vec<ByteSlice> parts;
+    // number of each part in the document (e.g. the EPUB chapter) and its size
+    Vec<int> partNos;
+    Vec<size_t> sizes;
+    // offset of each part if all parts were concatenated
+    Vec<size_t> offsets;
+    size_t size = 0;
+    // the part found by the last OffsetOf() call
+    int lastPart = 0;
+
+    void Append(ByteSlice part, int partNo = 0);
+    void AppendUnloaded(size_t partSize, int partNo);
+    int PartAt(size_t offset, size_t len) const;
+    const char* At(size_t offset, size_t len) const;
+    bool OffsetOf(const char* s, size_t len, u32* offsetOut);
+};
+
+void LayoutCacheHtml::Append(ByteSlice part, int partNo) {
+    if (part.empty() || part.size() == 0) {
+        return;
+    }
+    parts.Append(part);
+    partNos.Append(partNo);
+    sizes.Append(part.size());
+    offsets.Append(size);
+    size += part.size();
+}
+
+// for a part whose size is known from the layout cache
+void LayoutCacheHtml::AppendUnloaded(size_t partSize, int partNo) {
+    if (partSize == 0) {
+        return;
+    }
+    parts.Append(ByteSlice());
+    partNos.Append(partNo);
+    sizes.Append(partSize);
+    offsets.Append(size);
+    size += partSize;
+}
+
+// returns the index of the part offset and len lie within, -1 if there's no such part
+int LayoutCacheHtml::PartAt(size_t offset, size_t len) const {
+    size_t* begin = offsets.LendData();
+    size_t* end = begin + offsets.size();
+    auto it = std::upper_bound(begin, end, offset);
+    if (it == begin) {
+        return -1;
+    }
+    size_t idx = (it - begin) - 1;
+    size_t partSize = sizes.at(idx);
+    size_t partOffset = offset - offsets.at(idx);
+    if (partOffset > partSize || len > partSize - partOffset) {
+        return -1;
+    }
+    return (int)idx;
+}
+
+// returns nullptr if offset and len don't lie within a single part or if it's not loaded
+const char* LayoutCacheHtml::At(size_t offset, size_t len) const {
+    int idx = PartAt(offset, len);
+    if (idx < 0 || parts.at(idx).empty()) {
+        return nullptr;
+    }
+    return (const char*)parts.at(idx).data() + (offset - offsets.at(idx));
+}
+
+// consecutive calls are usually for the same part, so that's tried first
+bool LayoutCacheHtml::OffsetOf(const char* s, size_t len, u32* offsetOut) {
+    int nParts = parts.isize();
+    for (int n = 0; n < nParts; n++) {
+        int idx = (lastPart + n) % nParts;
+        if (parts.at(idx).empty()) {
+            continue;
+        }
+        const char* start = (const char*)parts.at(idx).data();
+        size_t partLen = parts.at(idx).size();
+        if (s >= start && s <= start + partLen && len <= (size_t)(start + partLen - s)) {
+            lastPart = idx;
+            *offsetOut = (u32)(offsets.at(idx) + (s - start));
+            return true;
+        }
+    }
+    return false;
+}
+
+struct LayoutCachePart;
+
 class EngineEbook : public EngineBase {
   public:
     EngineEbook();
@@ -125,7 +235,16 @@ class EngineEbook : public EngineBase {
 
     bool BenchLoadPage(int pageNo) override;
 
+    int LaidOutPageCount() override;
+    void CommitPages(int nPages) override;
+    bool IsLayoutInProgress() override;
+
+    void LayoutRemainingPages();
+    void LayoutChapters();
+    void SaveLayoutCache();
+
   protected:
+    // all pages laid out so far (pageCount only includes the committed ones)
     Vec<HtmlPage*>* pages = nullptr;
     Vec<PageAnchor> anchors;
     // contains for each page the last anchor indicating
@@ -138,11 +257,78 @@ class EngineEbook : public EngineBase {
     // page dimensions can vary between filetypes
     RectF pageRect;
     float pageBorder;
+    // decoded images, used under pagesAccess
+    HtmlImageCache imageCache;
+    // text is measured and drawn with DirectWrite instead of GDI+
+    bool useDirectWrite = false;
+    mui::TextRenderMethod LayoutTextRenderMethod(mui::TextRenderMethod method) const {
+        return useDirectWrite ? mui::TextRenderMethod::DWrite : method;
+    }
+
+    // in lazy mode, formatter is owned by layoutThread after loading
+    bool lazyLayout = false;
+    bool skipEmptyPages = false;
+    HtmlFormatter* formatter = nullptr;
+    HANDLE layoutThread = nullptr;
+    // guarded by pagesAccess
+    bool layoutFinished = false;
+    bool abortLayout = false;
+    // signaled when pages have been laid out
+    CONDITION_VARIABLE pagesLaidOut;
+
+    // documents made of independent chapters (EPUB spine items) are laid out
+    // with one formatter per chapter, on several threads at once
+    int nChapters = 0;
+    // guarded by pagesAccess
+    int nextChapter = 0;
+    int nextChapterToAppend = 0;
+    // laid out chapters that can't be appended to pages before their predecessors
+    Vec<Vec<HtmlPage*>*> chapterPages;
+    // each formatter needs its own, since allocators aren't thread safe
+    Vec<PoolAllocator*> chapterAllocators;
+
+    // pages restored from the layout cache can have strings that point into parts
+    // of the html that haven't been loaded yet. Those are set by ResolveCachedPage()
+    // when the page is first used. Guarded by pagesAccess
+    LayoutCacheHtml* cachedHtml = nullptr;
+    // data of the cache file the instructions are read from
+    ByteSlice layoutCache;
+    // for each page the position of its LayoutCacheInstrs in layoutCache, 0 once resolved
+    Vec<size_t> unresolvedPages;
 
     void GetTransform(Matrix& m, float zoom, int rotation);
-    bool ExtractPageAnchors();
+    void FormatPages(HtmlFormatter* f, bool skipEmpty);
+    void FormatChapters(int nChaptersTotal);
+    // the html of a chapter is only loaded once a thread starts laying it out
+    virtual ByteSlice GetChapterHtml(int chapterNo);
+    bool LayoutNextChapter();
+    void LayoutRemainingChapters();
+    void AppendLaidOutChapters();
+    virtual HtmlFormatter* CreateChapterFormatter(ByteSlice html, Allocator* textAllocator);
+    void FinishLayout();
+    void WaitForLayout(const std::function<bool()>& done);
+    IPageDestination* FindNamedDest(const char* name, bool allowBase);
+    void StopLayout();
+    void ExtractPageAnchors();
     char* ExtractFontList();
 
+    // laid out pages of EPUB, FB2 and MOBI documents are cached on disk
+    // (see SetEngineEbookLayoutCacheDir)
+    bool LoadLayoutCache();
+    char* GetLayoutCachePath();
+    // the html all laid out pages point into, empty if the layout isn't cached
+    virtual void GetLayoutCacheHtml(LayoutCacheHtml& html);
+    // documents whose html is loaded in parts (EPUB chapters) return the number of
+    // parts instead, so that pages can be restored without loading all of them
+    virtual int GetLayoutCachePartCount();
+    // sets srcSize and srcTime of part without loading it, false if it can't be cached
+    virtual bool GetLayoutCachePartSource(int partNo, LayoutCachePart& part);
+    virtual ByteSlice GetLayoutCachePart(int partNo);
+    void ResolveCachedPage(int pageNo);
+    // the caller must free() the result, nullptr if img can't be referenced
+    virtual char* GetLayoutCacheImageRef(const ByteSlice& img);
+    virtual ByteSlice* GetLayoutCacheImage(const char* ref);
+
     virtual IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
 
     Vec<DrawInstr>* GetHtmlPage(int pageNo);
@@ -196,9 +382,15 @@ EngineEbook::EngineEbook() {
     pageBorder = 0.4f * GetFileDPI();
     preferredLayout = preferredLayout = PageLayout(PageLayout::Type::Single);
     InitializeCriticalSection(&pagesAccess);
+    InitializeConditionVariable(&pagesLaidOut);
+    // the setting might change before pages are drawn
+    useDirectWrite = gUseDirectWrite;
 }
 
 EngineEbook::~EngineEbook() {
+    StopLayout();
+    delete formatter;
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
@@ -208,6 +400,15 @@ EngineEbook::~EngineEbook() {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    for (Vec<HtmlPage*>* chapter : chapterPages) {
+        if (chapter) {
+            DeleteVecMembers(*chapter);
+            delete chapter;
+        }
+    }
+    DeleteVecMembers(chapterAllocators);
+    delete cachedHtml;
+    layoutCache.Free();
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
@@ -254,11 +455,11 @@ void EngineEbook::GetTransform(Matrix& m, float zoom, int rotation) {
 }
 
 Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
-    CrashIf(pageNo < 1 || PageCount() < pageNo);
-    if (pageNo < 1 || PageCount() < pageNo) {
+    HtmlPage* page = GetHtmlPage2(pageNo);
+    if (!page) {
         return nullptr;
     }
-    return &pages->at(pageNo - 1)->instructions;
+    return &page->instructions;
 }
 
 HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
@@ -266,18 +467,266 @@ HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
     if (pageNo < 1 || PageCount() < pageNo) {
         return nullptr;
     }
+    // pages might be growing on layoutThread
+    ScopedCritSec scope(&pagesAccess);
+    ResolveCachedPage(pageNo);
     return pages->at(pageNo - 1);
 }
 
-bool EngineEbook::ExtractPageAnchors() {
-    ScopedCritSec scope(&pagesAccess);
+static DWORD WINAPI EbookLayoutThread(LPVOID data) {
+    EngineEbook* engine = (EngineEbook*)data;
+    engine->LayoutRemainingPages();
+    engine->SaveLayoutCache();
+    return 0;
+}
 
-    DrawInstr* baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
+// lays out the whole document or, in lazy mode, the first few pages
+// (the rest is then laid out on a background thread)
+// takes ownership of f
+void EngineEbook::FormatPages(HtmlFormatter* f, bool skipEmpty) {
+    pages = new Vec<HtmlPage*>();
+    skipEmptyPages = skipEmpty;
+    formatter = f;
+    for (;;) {
+        if (lazyLayout && (int)pages->size() >= kLazyLayoutFirstPages) {
+            break;
+        }
+        HtmlPage* page = formatter->Next(skipEmptyPages);
+        if (!page) {
+            layoutFinished = true;
+            break;
+        }
+        pages->Append(page);
+    }
+
+    ExtractPageAnchors();
+    pageCount = (int)pages->size();
+    if (layoutFinished) {
+        delete formatter;
+        formatter = nullptr;
+        return;
+    }
+
+    layoutThread = CreateThread(nullptr, 0, EbookLayoutThread, this, 0, nullptr);
+    if (!layoutThread) {
+        LayoutRemainingPages();
+        pageCount = (int)pages->size();
+        return;
+    }
+    SetThreadPriority(layoutThread, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+void EngineEbook::LayoutRemainingPages() {
+    if (nChapters > 0) {
+        LayoutRemainingChapters();
+        return;
+    }
+    for (;;) {
+        // formatting happens outside of pagesAccess so that
+        // already laid out pages can be rendered meanwhile
+        HtmlPage* page = formatter->Next(skipEmptyPages);
+
+        ScopedCritSec scope(&pagesAccess);
+        WakeAllConditionVariable(&pagesLaidOut);
+        if (!page) {
+            layoutFinished = true;
+            return;
+        }
+        pages->Append(page);
+        ExtractPageAnchors();
+        if (abortLayout) {
+            return;
+        }
+    }
+}
+
+HtmlFormatter* EngineEbook::CreateChapterFormatter(__unused ByteSlice html, __unused Allocator* textAllocator) {
+    CrashIf(true);
+    return nullptr;
+}
+
+ByteSlice EngineEbook::GetChapterHtml(__unused int chapterNo) {
+    CrashIf(true);
+    return {};
+}
+
+static DWORD WINAPI EbookChapterThread(LPVOID data) {
+    EngineEbook* engine = (EngineEbook*)data;
+    engine->LayoutChapters();
+    return 0;
+}
+
+// like FormatPages() but lays out chapters in parallel. EpubDoc starts each
+// spine item with a page marker, which forces a new page and resets CSS,
+// so each chapter can be laid out on its own
+void EngineEbook::FormatChapters(int nChaptersTotal) {
+    if (nChaptersTotal < 2) {
+        FormatPages(CreateChapterFormatter(GetChapterHtml(0), &allocator), false);
+        return;
+    }
+
+    nChapters = nChaptersTotal;
+    pages = new Vec<HtmlPage*>();
+    skipEmptyPages = false;
+    chapterPages.AppendBlanks(nChapters);
+    if (!lazyLayout) {
+        LayoutRemainingChapters();
+        pageCount = (int)pages->size();
+        return;
+    }
+
+    while ((int)pages->size() < kLazyLayoutFirstPages && LayoutNextChapter()) {
+        // no-op
+    }
+    pageCount = (int)pages->size();
+    if (layoutFinished) {
+        return;
+    }
+    layoutThread = CreateThread(nullptr, 0, EbookLayoutThread, this, 0, nullptr);
+    if (!layoutThread) {
+        LayoutRemainingChapters();
+        pageCount = (int)pages->size();
+        return;
+    }
+    SetThreadPriority(layoutThread, THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+// lays out the next chapter not yet taken by another thread
+// returns false if there are none left
+bool EngineEbook::LayoutNextChapter() {
+    int chapterNo;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (abortLayout || nextChapter >= nChapters) {
             return false;
         }
+        chapterNo = nextChapter++;
+    }
+
+    PoolAllocator* textAllocator = new PoolAllocator();
+    ByteSlice html = GetChapterHtml(chapterNo);
+    Vec<HtmlPage*>* res;
+    if (html.empty()) {
+        // spine items that can't be loaded are skipped
+        res = new Vec<HtmlPage*>();
+    } else {
+        HtmlFormatter* f = CreateChapterFormatter(html, textAllocator);
+        res = f->FormatAllPages(skipEmptyPages);
+        delete f;
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    chapterAllocators.Append(textAllocator);
+    chapterPages[chapterNo] = res;
+    AppendLaidOutChapters();
+    return true;
+}
+
+void EngineEbook::LayoutChapters() {
+    while (LayoutNextChapter()) {
+        // no-op
+    }
+}
+
+// lays out chapters on this and up to kMaxLayoutThreads - 1 other threads
+void EngineEbook::LayoutRemainingChapters() {
+    int nThreads = std::min(GetPhysicalProcessorCount(), kMaxLayoutThreads);
+    {
+        ScopedCritSec scope(&pagesAccess);
+        nThreads = std::min(nThreads, nChapters - nextChapter);
+    }
+    HANDLE threads[kMaxLayoutThreads];
+    int nStarted = 0;
+    for (int i = 1; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, EbookChapterThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        SetThreadPriority(h, GetThreadPriority(GetCurrentThread()));
+        threads[nStarted++] = h;
+    }
+    LayoutChapters();
+    if (nStarted > 0) {
+        WaitForMultipleObjects(nStarted, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
+// moves laid out chapters to pages, in document order
+// must be called with pagesAccess held
+void EngineEbook::AppendLaidOutChapters() {
+    while (nextChapterToAppend < nChapters && chapterPages[nextChapterToAppend]) {
+        Vec<HtmlPage*>* chapter = chapterPages[nextChapterToAppend];
+        pages->Append(chapter->LendData(), chapter->size());
+        delete chapter;
+        chapterPages[nextChapterToAppend] = nullptr;
+        nextChapterToAppend++;
+    }
+    ExtractPageAnchors();
+    if (nextChapterToAppend == nChapters) {
+        layoutFinished = true;
+    }
+    WakeAllConditionVariable(&pagesLaidOut);
+}
+
+// waits until the whole document has been laid out
+void EngineEbook::FinishLayout() {
+    ScopedCritSec scope(&pagesAccess);
+    WaitForLayout([] { return false; });
+}
+
+// waits until done() returns true for the pages laid out so far
+// or the whole document has been laid out
+// must be called with pagesAccess held
+void EngineEbook::WaitForLayout(const std::function<bool()>& done) {
+    while (!layoutFinished && !abortLayout && !done()) {
+        SleepConditionVariableCS(&pagesLaidOut, &pagesAccess, INFINITE);
+    }
+}
+
+// must be called before deleting the data that formatter is using
+void EngineEbook::StopLayout() {
+    imageCache.StopPrefetching();
+    if (!layoutThread) {
+        return;
+    }
+    EnterCriticalSection(&pagesAccess);
+    abortLayout = true;
+    WakeAllConditionVariable(&pagesLaidOut);
+    LeaveCriticalSection(&pagesAccess);
+    WaitForSingleObject(layoutThread, INFINITE);
+    CloseHandle(layoutThread);
+    layoutThread = nullptr;
+}
+
+int EngineEbook::LaidOutPageCount() {
+    ScopedCritSec scope(&pagesAccess);
+    return (int)pages->size();
+}
+
+void EngineEbook::CommitPages(int nPages) {
+    ScopedCritSec scope(&pagesAccess);
+    CrashIf(nPages < pageCount || nPages > (int)pages->size());
+    pageCount = nPages;
+}
+
+bool EngineEbook::IsLayoutInProgress() {
+    ScopedCritSec scope(&pagesAccess);
+    return !layoutFinished || pageCount < (int)pages->size();
+}
+
+// the name of an anchor at the start of an EPUB chapter is followed by this
+// (see EpubDoc::GetChapterHtml)
+static const char* kPageMarkerSuffix = "\" page_marker />";
+
+// extracts anchors from pages laid out since the last call
+// must be called with pagesAccess held (or before layoutThread is started)
+void EngineEbook::ExtractPageAnchors() {
+    DrawInstr* baseAnchor = baseAnchors.size() > 0 ? baseAnchors.Last() : nullptr;
+    for (int pageNo = (int)baseAnchors.size() + 1; pageNo <= (int)pages->size(); pageNo++) {
+        Vec<DrawInstr>* pageInstrs = &pages->at(pageNo - 1)->instructions;
 
         for (size_t k = 0; k < pageInstrs->size(); k++) {
             DrawInstr* i = &pageInstrs->at(k);
@@ -285,7 +734,7 @@ bool EngineEbook::ExtractPageAnchors() {
                 continue;
             }
             anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
+            if (k < 2 && str::StartsWith(i->str.s + i->str.len, kPageMarkerSuffix)) {
                 baseAnchor = i;
             }
         }
@@ -293,9 +742,501 @@ bool EngineEbook::ExtractPageAnchors() {
     }
 
     CrashIf(baseAnchors.size() != pages->size());
+}
+
+/* on-disk cache of laid out pages */
+
+// bump when the file layout or the way documents are laid out changes
+constexpr u32 kLayoutCacheVersion = 3;
+constexpr u32 kLayoutCacheMagic = 0x43594c53; // 'SLYC'
+
+// don't cache the layout of documents that would need bigger cache files
+constexpr size_t kMaxLayoutCacheFileSize = 64 * 1024 * 1024;
+
+/*
+File layout (all values little-endian):
+
+LayoutCacheHeader
+LayoutCachePart[nParts]
+for each font:
+  LayoutCacheFont
+  WCHAR name[nameLen + 1] - zero terminated
+  (padding to 4 bytes)
+for each image:
+  u32 len
+  char ref[len + 1] - zero terminated
+  (padding to 4 bytes)
+char strings[stringsLen] - text that isn't part of the html, each string is
+  zero terminated and can continue past the len of the instruction (e.g.
+  with the page marker after the name of an anchor)
+(padding to 4 bytes)
+for each page:
+  LayoutCachePage
+  LayoutCacheInstr[nInstrs]
+*/
+
+struct LayoutCacheHeader {
+    u32 magic;
+    u32 version;
+    // pages can only be re-used if they'd be laid out the same
+    float pageDx;
+    float pageDy;
+    float fontSize;
+    u32 fontNameHash;
+    u32 dpi;
+    u32 useDirectWrite;
+    u32 htmlLen;
+    u32 nParts;
+    u32 nFonts;
+    u32 nImages;
+    u32 stringsLen;
+    u32 nPages;
+};
+
+// a part of the html that is loaded separately (i.e. an EPUB chapter).
+// The size and time of its file in the archive are compared on load, so
+// that the chapters don't have to be decompressed to validate the cache
+struct LayoutCachePart {
+    i64 srcSize;
+    i64 srcTime;
+    // size of the decoded html
+    u32 htmlLen;
+    u32 padding;
+};
+
+struct LayoutCacheFont {
+    float sizePt;
+    u32 style;
+    u32 nameLen;
+};
+
+struct LayoutCachePage {
+    i32 reparseIdx;
+    u32 nInstrs;
+};
+
+enum class LayoutCacheData : u32 {
+    None = 0,
+    // offset and len are within the html
+    Html,
+    // offset and len are within strings
+    Strings,
+    // offset is the index of the font or image
+    Index,
+};
+
+struct LayoutCacheInstr {
+    u32 type;
+    LayoutCacheData data;
+    u32 offset;
+    u32 len;
+    RectF bbox;
+};
+
+static size_t AlignTo4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+static void AppendPadded(str::Str& d, const void* data, size_t len) {
+    d.Append((const char*)data, len);
+    while (d.size() % 4 != 0) {
+        d.AppendChar(0);
+    }
+}
+
+// bounds checked reading of a cache file
+struct LayoutCacheReader {
+    ByteSlice d;
+    size_t pos = 0;
+    bool ok = true;
+
+    explicit LayoutCacheReader(const ByteSlice& d) : d(d) {
+    }
+
+    const u8* Read(size_t len, bool padded = false) {
+        size_t n = padded ? AlignTo4(len) : len;
+        if (!ok || n < len || n > d.size() - pos) {
+            ok = false;
+            return nullptr;
+        }
+        const u8* res = d.data() + pos;
+        pos += n;
+        return res;
+    }
+};
+
+static bool InstrHasStr(DrawInstrType t) {
+    return t == DrawInstrType::String || t == DrawInstrType::RtlString || t == DrawInstrType::LinkStart ||
+           t == DrawInstrType::Anchor;
+}
+
+static void InitLayoutCacheHeader(LayoutCacheHeader& hdr, const RectF& pageRect, float pageBorder,
+                                  bool useDirectWrite) {
+    const WCHAR* fontName = GetDefaultFontName();
+    hdr.magic = kLayoutCacheMagic;
+    hdr.version = kLayoutCacheVersion;
+    hdr.pageDx = pageRect.dx - 2 * pageBorder;
+    hdr.pageDy = pageRect.dy - 2 * pageBorder;
+    hdr.fontSize = GetDefaultFontSize();
+    hdr.fontNameHash = MurmurHash2(fontName, str::Len(fontName) * sizeof(WCHAR));
+    hdr.dpi = (u32)DpiGetForHwnd(HWND_DESKTOP);
+    hdr.useDirectWrite = useDirectWrite ? 1 : 0;
+}
+
+// there's a cache file for each combination of settings a document has been laid out with
+// returns nullptr if the layout of this document shouldn't be cached on disk
+// the caller must free() the result
+char* EngineEbook::GetLayoutCachePath() {
+    const char* filePath = FilePath();
+    if (!gLayoutCacheDir || !filePath || !file::Exists(filePath)) {
+        return nullptr;
+    }
+    u8 digest[16]{};
+    if (!CalcFileFingerprint(filePath, digest)) {
+        return nullptr;
+    }
+    LayoutCacheHeader hdr{};
+    InitLayoutCacheHeader(hdr, pageRect, pageBorder, useDirectWrite);
+    u32 settingsHash = MurmurHash2(&hdr, sizeof(hdr));
+    AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
+    AutoFreeStr settings = str::MemToHex((const u8*)&settingsHash, sizeof(settingsHash));
+    char* name = str::JoinTemp(fingerPrint, "-", settings);
+    return path::Join(gLayoutCacheDir, str::JoinTemp(name, kEbookLayoutCacheExt));
+}
+
+void EngineEbook::GetLayoutCacheHtml(__unused LayoutCacheHtml& html) {
+}
+
+int EngineEbook::GetLayoutCachePartCount() {
+    return 0;
+}
+
+bool EngineEbook::GetLayoutCachePartSource(__unused int partNo, __unused LayoutCachePart& part) {
+    return false;
+}
+
+ByteSlice EngineEbook::GetLayoutCachePart(__unused int partNo) {
+    return {};
+}
+
+char* EngineEbook::GetLayoutCacheImageRef(__unused const ByteSlice& img) {
+    return nullptr;
+}
+
+ByteSlice* EngineEbook::GetLayoutCacheImage(__unused const char* ref) {
+    return nullptr;
+}
+
+static bool ReadLayoutCachePages(LayoutCacheReader& r, const LayoutCacheHeader* hdr, const LayoutCacheHtml& html,
+                                 Vec<mui::CachedFont*>& fonts, Vec<ByteSlice*>& images, const char* strings,
+                                 Allocator* textAllocator, Vec<HtmlPage*>* pagesOut, Vec<size_t>* unresolvedOut) {
+    for (u32 pageNo = 0; pageNo < hdr->nPages; pageNo++) {
+        const LayoutCachePage* p = (const LayoutCachePage*)r.Read(sizeof(LayoutCachePage));
+        if (!p || p->nInstrs > (r.d.size() - r.pos) / sizeof(LayoutCacheInstr)) {
+            return false;
+        }
+        size_t instrsPos = r.pos;
+        const LayoutCacheInstr* instrs = (const LayoutCacheInstr*)r.Read(p->nInstrs * sizeof(LayoutCacheInstr));
+        HtmlPage* page = new HtmlPage(p->reparseIdx);
+        pagesOut->Append(page);
+        unresolvedOut->Append(0);
+        DrawInstr* dst = page->instructions.AppendBlanks(p->nInstrs);
+        for (u32 k = 0; k < p->nInstrs; k++) {
+            const LayoutCacheInstr& ci = instrs[k];
+            DrawInstr& i = dst[k];
+            if (ci.type > (u32)DrawInstrType::RtlString) {
+                return false;
+            }
+            i.type = (DrawInstrType)ci.type;
+            i.bbox = ci.bbox;
+            if (i.type == DrawInstrType::SetFont) {
+                if (ci.data != LayoutCacheData::Index || ci.offset >= fonts.size()) {
+                    return false;
+                }
+                i.font = fonts.at(ci.offset);
+            } else if (i.type == DrawInstrType::Image) {
+                if (ci.data != LayoutCacheData::Index || ci.offset >= images.size()) {
+                    return false;
+                }
+                ByteSlice* img = images.at(ci.offset);
+                i.str.s = (const char*)img->data();
+                i.str.len = (u32)img->size();
+            } else if (ci.data == LayoutCacheData::Html) {
+                // anchors are needed right away by ExtractPageAnchors()
+                if (html.PartAt(ci.offset, ci.len) < 0 || i.type == DrawInstrType::Anchor) {
+                    return false;
+                }
+                // nullptr if the part isn't loaded yet, set by ResolveCachedPage()
+                i.str.s = html.At(ci.offset, ci.len);
+                i.str.len = ci.len;
+                if (!i.str.s) {
+                    unresolvedOut->Last() = instrsPos;
+                }
+            } else if (ci.data == LayoutCacheData::Strings) {
+                if (ci.offset > hdr->stringsLen || ci.len > hdr->stringsLen - ci.offset) {
+                    return false;
+                }
+                const char* s = strings + ci.offset;
+                size_t n = std::max(strnlen(s, hdr->stringsLen - ci.offset), (size_t)ci.len);
+                // zero-terminated like the text returned by ResolveHtmlEntities
+                i.str.s = (const char*)Allocator::MemDup(textAllocator, s, n, 1);
+                i.str.len = ci.len;
+            }
+        }
+    }
+    return r.pos == r.d.size();
+}
+
+// returns true if all pages were restored from the cache, in which case
+// the document doesn't have to be laid out
+bool EngineEbook::LoadLayoutCache() {
+    AutoFreeStr cachePath = GetLayoutCachePath();
+    if (!cachePath) {
+        return false;
+    }
+    ByteSlice d = file::ReadFile(cachePath);
+    if (d.empty()) {
+        return false;
+    }
+    // kept if pages have strings that still have to be resolved
+    defer {
+        d.Free();
+    };
+
+    LayoutCacheReader r(d);
+    const LayoutCacheHeader* hdr = (const LayoutCacheHeader*)r.Read(sizeof(LayoutCacheHeader));
+    int nParts = GetLayoutCachePartCount();
+    bool ok = hdr && hdr->nParts == (u32)nParts;
+
+    // parts are only loaded once a page that points into them is used
+    LayoutCacheHtml* html = new LayoutCacheHtml();
+    for (int i = 0; ok && i < nParts; i++) {
+        const LayoutCachePart* p = (const LayoutCachePart*)r.Read(sizeof(LayoutCachePart));
+        LayoutCachePart src{};
+        ok = p && GetLayoutCachePartSource(i, src) && src.srcSize == p->srcSize && src.srcTime == p->srcTime;
+        if (ok) {
+            html->AppendUnloaded(p->htmlLen, i);
+        }
+    }
+    if (ok && nParts == 0) {
+        GetLayoutCacheHtml(*html);
+    }
+
+    LayoutCacheHeader expected{};
+    InitLayoutCacheHeader(expected, pageRect, pageBorder, useDirectWrite);
+    expected.htmlLen = (u32)html->size;
+    expected.nParts = (u32)nParts;
+    // the settings and the size of the html have to match
+    ok = ok && html->size > 0 && memcmp(hdr, &expected, offsetof(LayoutCacheHeader, nFonts)) == 0;
+
+    Vec<mui::CachedFont*> fonts;
+    for (u32 i = 0; ok && i < hdr->nFonts; i++) {
+        const LayoutCacheFont* f = (const LayoutCacheFont*)r.Read(sizeof(LayoutCacheFont));
+        const WCHAR* name = f ? (const WCHAR*)r.Read(((size_t)f->nameLen + 1) * sizeof(WCHAR), true) : nullptr;
+        ok = name && name[f->nameLen] == 0;
+        if (ok) {
+            fonts.Append(mui::GetCachedFont(name, f->sizePt, (Gdiplus::FontStyle)f->style));
+        }
+    }
+    Vec<ByteSlice*> images;
+    for (u32 i = 0; ok && i < hdr->nImages; i++) {
+        const u32* len = (const u32*)r.Read(sizeof(u32));
+        const char* ref = len ? (const char*)r.Read((size_t)*len + 1, true) : nullptr;
+        // the image might no longer be loadable
+        ByteSlice* img = ref && ref[*len] == 0 ? GetLayoutCacheImage(ref) : nullptr;
+        ok = img != nullptr;
+        images.Append(img);
+    }
+    const char* strings = ok ? (const char*)r.Read(hdr->stringsLen, true) : nullptr;
+
+    Vec<HtmlPage*>* res = new Vec<HtmlPage*>();
+    Vec<size_t> unresolved;
+    ok = ok && r.ok && hdr->nPages > 0;
+    ok = ok && ReadLayoutCachePages(r, hdr, *html, fonts, images, strings, &allocator, res, &unresolved);
+    if (!ok) {
+        DeleteVecMembers(*res);
+        delete res;
+        delete html;
+        file::Delete(cachePath);
+        return false;
+    }
+
+    bool hasUnresolved = false;
+    for (size_t pos : unresolved) {
+        hasUnresolved = hasUnresolved || pos != 0;
+    }
+    if (hasUnresolved) {
+        cachedHtml = html;
+        unresolvedPages = std::move(unresolved);
+        layoutCache = d;
+        d = ByteSlice();
+    } else {
+        delete html;
+    }
+
+    pages = res;
+    pageCount = (int)pages->size();
+    layoutFinished = true;
+    ExtractPageAnchors();
+    // mark as recently used for CleanUpTextCache()
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(cachePath, now);
     return true;
 }
 
+// sets the strings of a page restored by LoadLayoutCache() that point into parts
+// of the html which weren't loaded yet. Must be called with pagesAccess held
+void EngineEbook::ResolveCachedPage(int pageNo) {
+    if (!cachedHtml || pageNo > unresolvedPages.isize() || unresolvedPages.at(pageNo - 1) == 0) {
+        return;
+    }
+    const LayoutCacheInstr* instrs = (const LayoutCacheInstr*)(layoutCache.data() + unresolvedPages.at(pageNo - 1));
+    unresolvedPages.at(pageNo - 1) = 0;
+    Vec<DrawInstr>& pageInstrs = pages->at(pageNo - 1)->instructions;
+    for (size_t k = 0; k < pageInstrs.size(); k++) {
+        DrawInstr& i = pageInstrs.at(k);
+        const LayoutCacheInstr& ci = instrs[k];
+        if (ci.data != LayoutCacheData::Html || i.str.s) {
+            continue;
+        }
+        // checked by ReadLayoutCachePages()
+        int idx = cachedHtml->PartAt(ci.offset, ci.len);
+        if (cachedHtml->parts.at(idx).empty()) {
+            ByteSlice part = GetLayoutCachePart(cachedHtml->partNos.at(idx));
+            // only differs if the file has changed since it was opened
+            if (part.size() == cachedHtml->sizes.at(idx)) {
+                cachedHtml->parts.at(idx) = part;
+            } else {
+                logf("EngineEbook::ResolveCachedPage: part %d has changed\n", cachedHtml->partNos.at(idx));
+            }
+        }
+        i.str.s = cachedHtml->At(ci.offset, ci.len);
+        if (!i.str.s) {
+            i.str.s = "";
+            i.str.len = 0;
+        }
+    }
+}
+
+// saves the pages once the whole document has been laid out (if they're not saved yet)
+// called on the thread that loaded the document or on layoutThread
+void EngineEbook::SaveLayoutCache() {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!layoutFinished || abortLayout) {
+            return;
+        }
+    }
+    // all parts have been loaded for laying them out
+    LayoutCacheHtml html;
+    str::Str partsData;
+    int nParts = GetLayoutCachePartCount();
+    for (int i = 0; i < nParts; i++) {
+        LayoutCachePart part{};
+        if (!GetLayoutCachePartSource(i, part)) {
+            return;
+        }
+        ByteSlice partHtml = GetLayoutCachePart(i);
+        part.htmlLen = (u32)partHtml.size();
+        partsData.Append((const char*)&part, sizeof(part));
+        html.Append(partHtml, i);
+    }
+    if (nParts == 0) {
+        GetLayoutCacheHtml(html);
+    }
+    if (html.size == 0 || html.size > kMaxLayoutCacheFileSize) {
+        return;
+    }
+    AutoFreeStr cachePath = GetLayoutCachePath();
+    if (!cachePath || file::Exists(cachePath)) {
+        return;
+    }
+
+    Vec<mui::CachedFont*> fonts;
+    Vec<const char*> images;
+    str::Str fontsData;
+    str::Str imagesData;
+    str::Str strings;
+    str::Str pagesData;
+    // once laid out, pages don't change anymore
+    for (HtmlPage* page : *pages) {
+        LayoutCachePage cp{(i32)page->reparseIdx, (u32)page->instructions.size()};
+        pagesData.Append((const char*)&cp, sizeof(cp));
+        for (DrawInstr& i : page->instructions) {
+            LayoutCacheInstr ci{(u32)i.type, LayoutCacheData::None, 0, 0, i.bbox};
+            if (i.type == DrawInstrType::SetFont) {
+                int idx = fonts.Find(i.font);
+                if (idx < 0) {
+                    const WCHAR* name = i.font->GetName();
+                    LayoutCacheFont cf{i.font->GetSize(), (u32)i.font->GetStyle(), (u32)str::Len(name)};
+                    fontsData.Append((const char*)&cf, sizeof(cf));
+                    AppendPadded(fontsData, name, ((size_t)cf.nameLen + 1) * sizeof(WCHAR));
+                    idx = fonts.isize();
+                    fonts.Append(i.font);
+                }
+                ci.data = LayoutCacheData::Index;
+                ci.offset = (u32)idx;
+            } else if (i.type == DrawInstrType::Image) {
+                int idx = images.Find(i.str.s);
+                if (idx < 0) {
+                    AutoFreeStr ref = GetLayoutCacheImageRef(i.GetImage());
+                    if (!ref) {
+                        return;
+                    }
+                    u32 len = (u32)str::Len(ref);
+                    imagesData.Append((const char*)&len, sizeof(len));
+                    AppendPadded(imagesData, ref.Get(), (size_t)len + 1);
+                    idx = images.isize();
+                    images.Append(i.str.s);
+                }
+                ci.data = LayoutCacheData::Index;
+                ci.offset = (u32)idx;
+            } else if (InstrHasStr(i.type) && i.str.s) {
+                // anchors of all pages are extracted right after loading, so unlike
+                // other strings they can't wait for their part of the html to be loaded
+                bool isAnchor = i.type == DrawInstrType::Anchor;
+                if (!isAnchor && html.OffsetOf(i.str.s, i.str.len, &ci.offset)) {
+                    ci.data = LayoutCacheData::Html;
+                } else {
+                    ci.data = LayoutCacheData::Strings;
+                    ci.offset = (u32)strings.size();
+                    strings.Append(i.str.s, i.str.len);
+                    if (isAnchor && str::StartsWith(i.str.s + i.str.len, kPageMarkerSuffix)) {
+                        strings.Append(kPageMarkerSuffix);
+                    }
+                    strings.AppendChar(0);
+                }
+                ci.len = (u32)i.str.len;
+            }
+            pagesData.Append((const char*)&ci, sizeof(ci));
+        }
+        if (pagesData.size() + strings.size() > kMaxLayoutCacheFileSize) {
+            return;
+        }
+    }
+
+    LayoutCacheHeader hdr{};
+    InitLayoutCacheHeader(hdr, pageRect, pageBorder, useDirectWrite);
+    hdr.htmlLen = (u32)html.size;
+    hdr.nParts = (u32)nParts;
+    hdr.nFonts = (u32)fonts.size();
+    hdr.nImages = (u32)images.size();
+    hdr.stringsLen = (u32)strings.size();
+    hdr.nPages = (u32)pages->size();
+
+    str::Str d;
+    d.Append((const char*)&hdr, sizeof(hdr));
+    d.Append(partsData.Get(), partsData.size());
+    d.Append(fontsData.Get(), fontsData.size());
+    d.Append(imagesData.Get(), imagesData.size());
+    AppendPadded(d, strings.Get(), strings.size());
+    d.Append(pagesData.Get(), pagesData.size());
+    if (dir::CreateForFile(cachePath)) {
+        file::WriteFile(cachePath, d.AsByteSlice());
+    }
+}
+
 RectF EngineEbook::Transform(const RectF& rect, __unused int pageNo, float zoom, int rotation, bool inverse) {
     RectF rcF = rect; // TODO: un-needed conversion
     auto p1 = Gdiplus::PointF(rcF.x, rcF.y);
@@ -347,10 +1288,16 @@ RenderedBitmap* EngineEbook::RenderPage(RenderPageArgs& args) {
 
     ScopedCritSec scope(&pagesAccess);
 
-    mui::ITextRender* textDraw = mui::TextRenderGdiplus::Create(&g);
+    // the glyph cache re-uses glyphs rasterized for previous pages
+    auto method = useDirectWrite ? mui::TextRenderMethod::DWrite : mui::TextRenderMethod::GlyphCache;
+    mui::ITextRender* textDraw = mui::CreateTextRender(method, &g, screen.dx, screen.dy);
     DrawHtmlPage(&g, textDraw, GetHtmlPage(pageNo), pageBorder, pageBorder, false, Color((ARGB)Color::Black),
-                 cookie ? &cookie->abort : nullptr);
+                 cookie ? &cookie->abort : nullptr, &imageCache);
     delete textDraw;
+    // the next pages are likely to be shown soon
+    for (int n = pageNo + 1; n <= pageNo + 2 && n <= PageCount(); n++) {
+        imageCache.PrefetchPage(GetHtmlPage(n));
+    }
     DeleteDC(hDC);
 
     if (cookie && cookie->abort) {
@@ -458,7 +1405,11 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
         return NewEbookLink(link, rect, nullptr, pageNo);
     }
 
-    DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
+    DrawInstr* baseAnchor = nullptr;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        baseAnchor = baseAnchors.at(pageNo - 1);
+    }
     if (baseAnchor) {
         char* basePath = str::DupTemp(baseAnchor->str.s, baseAnchor->str.len);
         AutoFreeStr relPath = ResolveHtmlEntities(link->str.s, link->str.len);
@@ -535,7 +1486,22 @@ IPageElement* EngineEbook::GetElementAtPos(int pageNo, PointF pt) {
     return nullptr;
 }
 
+// the anchor might be on a page that hasn't been laid out yet, so
+// this only waits until it is (or the whole document has been laid out)
 IPageDestination* EngineEbook::GetNamedDest(const char* name) {
+    ScopedCritSec scope(&pagesAccess);
+    IPageDestination* dest = nullptr;
+    WaitForLayout([&] {
+        dest = FindNamedDest(name, false);
+        return dest != nullptr;
+    });
+    return dest ? dest : FindNamedDest(name, true);
+}
+
+// if the name has both path and ID and only the path is found, the destination is
+// the page with the path if allowBase is true (i.e. once the document is laid out)
+// must be called with pagesAccess held
+IPageDestination* EngineEbook::FindNamedDest(const char* name, bool allowBase) {
     const char* id = name;
     if (str::FindChar(id, '#')) {
         id = str::FindChar(id, '#') + 1;
@@ -577,7 +1543,7 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
     }
 
     // don't fail if an ID doesn't exist in a merged document
-    if (basePageNo != 0) {
+    if (allowBase && basePageNo != 0) {
         RectF rect(0, pageBorder, pageRect.dx, 10);
         rect.Inflate(-pageBorder, 0);
         return NewSimpleDest(basePageNo, rect);
@@ -587,16 +1553,14 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
 }
 
 char* EngineEbook::ExtractFontList() {
+    FinishLayout();
     ScopedCritSec scope(&pagesAccess);
 
     Vec<mui::CachedFont*> seenFonts;
     StrVec fonts;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
-            continue;
-        }
+    for (HtmlPage* page : *pages) {
+        Vec<DrawInstr>* pageInstrs = &page->instructions;
 
         for (DrawInstr& i : *pageInstrs) {
             if (DrawInstrType::SetFont != i.type || seenFonts.Contains(i.font)) {
@@ -716,7 +1680,7 @@ class EngineEpub : public EngineEbook {
 
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool lazyLayout = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -727,6 +1691,14 @@ class EngineEpub : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateChapterFormatter(ByteSlice html, Allocator* textAllocator) override;
+    ByteSlice GetChapterHtml(int chapterNo) override;
+    int GetLayoutCachePartCount() override;
+    bool GetLayoutCachePartSource(int partNo, LayoutCachePart& part) override;
+    ByteSlice GetLayoutCachePart(int partNo) override;
+    char* GetLayoutCacheImageRef(const ByteSlice& img) override;
+    ByteSlice* GetLayoutCacheImage(const char* ref) override;
 };
 
 EngineEpub::EngineEpub() : EngineEbook() {
@@ -735,6 +1707,7 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopLayout();
     delete doc;
     delete tocTree;
     if (stream) {
@@ -774,28 +1747,30 @@ bool EngineEpub::Load(IStream* stream) {
     return FinishLoading();
 }
 
-bool EngineEpub::FinishLoading() {
-    if (!doc) {
-        return false;
-    }
-
+HtmlFormatter* EngineEpub::CreateChapterFormatter(ByteSlice html, Allocator* textAllocator) {
     HtmlFormatterArgs args{};
-    args.htmlStr = doc->GetHtmlData();
+    args.htmlStr = html;
     args.pageDx = (float)pageRect.dx - 2 * pageBorder;
     args.pageDy = (float)pageRect.dy - 2 * pageBorder;
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
+    args.textAllocator = textAllocator;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::GdiplusQuick);
+    return new EpubFormatter(&args, doc);
+}
 
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+bool EngineEpub::FinishLoading() {
+    if (!doc) {
         return false;
     }
 
+    if (!LoadLayoutCache()) {
+        FormatChapters(doc->GetChapterCount());
+        if (!layoutThread) {
+            SaveLayoutCache();
+        }
+    }
+
     preferredLayout = PageLayout(PageLayout::Type::Book);
     if (doc->IsRTL()) {
         preferredLayout.r2l = true;
@@ -804,6 +1779,32 @@ bool EngineEpub::FinishLoading() {
     return pageCount > 0;
 }
 
+ByteSlice EngineEpub::GetChapterHtml(int chapterNo) {
+    return doc->GetChapterHtml(chapterNo);
+}
+
+// the parts of the layout cache are the chapters, they're validated
+// against the zip directory and only loaded when a page needs them
+int EngineEpub::GetLayoutCachePartCount() {
+    return doc->GetChapterCount();
+}
+
+bool EngineEpub::GetLayoutCachePartSource(int partNo, LayoutCachePart& part) {
+    return doc->GetChapterFileInfo(partNo, &part.srcSize, &part.srcTime);
+}
+
+ByteSlice EngineEpub::GetLayoutCachePart(int partNo) {
+    return doc->GetChapterHtml(partNo);
+}
+
+char* EngineEpub::GetLayoutCacheImageRef(const ByteSlice& img) {
+    return str::Dup(doc->GetImageUrl(img));
+}
+
+ByteSlice* EngineEpub::GetLayoutCacheImage(const char* ref) {
+    return doc->GetImageDataByUrl(ref);
+}
+
 ByteSlice EngineEpub::GetFileData() {
     const char* path = FilePath();
     return GetStreamOrFileData(stream, path);
@@ -829,6 +1830,10 @@ TocTree* EngineEpub::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    if (IsLayoutInProgress()) {
+        // resolving the destinations needs the whole document
+        return nullptr;
+    }
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -841,8 +1846,9 @@ TocTree* EngineEpub::GetToc() {
     return tocTree;
 }
 
-EngineBase* EngineEpub::CreateFromFile(const char* fileName) {
+EngineBase* EngineEpub::CreateFromFile(const char* fileName, bool lazyLayout) {
     EngineEpub* engine = new EngineEpub();
+    engine->lazyLayout = lazyLayout;
     if (!engine->Load(fileName)) {
         delete engine;
         return nullptr;
@@ -859,8 +1865,8 @@ EngineBase* EngineEpub::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineEpubFromFile(const char* fileName) {
-    return EngineEpub::CreateFromFile(fileName);
+EngineBase* CreateEngineEpubFromFile(const char* fileName, bool lazyLayout) {
+    return EngineEpub::CreateFromFile(fileName, lazyLayout);
 }
 
 EngineBase* CreateEngineEpubFromStream(IStream* stream) {
@@ -876,6 +1882,7 @@ class EngineFb2 : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".fb2");
     }
     ~EngineFb2() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -893,7 +1900,7 @@ class EngineFb2 : public EngineEbook {
 
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool lazyLayout = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -903,6 +1910,14 @@ class EngineFb2 : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    void GetLayoutCacheHtml(LayoutCacheHtml& html) override {
+        html.Append(doc->GetXmlData());
+    }
+    char* GetLayoutCacheImageRef(const ByteSlice& img) override;
+    ByteSlice* GetLayoutCacheImage(const char* ref) override {
+        return doc->GetImageData(ref);
+    }
 };
 
 bool EngineFb2::Load(const char* fileName) {
@@ -928,25 +1943,38 @@ bool EngineFb2::FinishLoading() {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::GdiplusQuick);
 
     if (doc->IsZipped()) {
         str::ReplaceWithCopy(&defaultExt, ".fb2z");
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
+    if (!LoadLayoutCache()) {
+        FormatPages(new Fb2Formatter(&args, doc), false);
+        if (!layoutThread) {
+            SaveLayoutCache();
+        }
     }
     return pageCount > 0;
 }
 
+char* EngineFb2::GetLayoutCacheImageRef(const ByteSlice& img) {
+    for (ImageData& data : doc->images) {
+        if (data.base.data() == img.data()) {
+            return str::Dup(data.fileName);
+        }
+    }
+    return nullptr;
+}
+
 TocTree* EngineFb2::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    if (IsLayoutInProgress()) {
+        // resolving the destinations needs the whole document
+        return nullptr;
+    }
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -959,8 +1987,9 @@ TocTree* EngineFb2::GetToc() {
     return tocTree;
 }
 
-EngineBase* EngineFb2::CreateFromFile(const char* fileName) {
+EngineBase* EngineFb2::CreateFromFile(const char* fileName, bool lazyLayout) {
     EngineFb2* engine = new EngineFb2();
+    engine->lazyLayout = lazyLayout;
     if (!engine->Load(fileName)) {
         delete engine;
         return nullptr;
@@ -977,8 +2006,8 @@ EngineBase* EngineFb2::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineFb2FromFile(const char* fileName) {
-    return EngineFb2::CreateFromFile(fileName);
+EngineBase* CreateEngineFb2FromFile(const char* fileName, bool lazyLayout) {
+    return EngineFb2::CreateFromFile(fileName, lazyLayout);
 }
 
 EngineBase* CreateEngineFb2FromStream(IStream* stream) {
@@ -996,6 +2025,7 @@ class EngineMobi : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".mobi");
     }
     ~EngineMobi() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1014,7 +2044,7 @@ class EngineMobi : public EngineEbook {
     IPageDestination* GetNamedDest(const char* name) override;
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool lazyLayout = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -1024,6 +2054,15 @@ class EngineMobi : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    // decodes the whole document, which is still much faster than laying it out
+    void GetLayoutCacheHtml(LayoutCacheHtml& html) override {
+        html.Append(doc->GetHtmlData());
+    }
+    char* GetLayoutCacheImageRef(const ByteSlice& img) override;
+    ByteSlice* GetLayoutCacheImage(const char* ref) override {
+        return doc->GetImage((size_t)atoi(ref));
+    }
 };
 
 bool EngineMobi::Load(const char* fileName) {
@@ -1043,35 +2082,52 @@ bool EngineMobi::FinishLoading() {
     }
 
     HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
+    // MobiFormatter decodes the rest of the document as it lays it out
+    args.htmlStr = doc->DecodeHtmlData(kMobiDecodeAhead);
     args.pageDx = (float)pageRect.dx - 2 * pageBorder;
     args.pageDy = (float)pageRect.dy - 2 * pageBorder;
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::GdiplusQuick);
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
+    if (!LoadLayoutCache()) {
+        FormatPages(new MobiFormatter(&args, doc), true);
+        if (!layoutThread) {
+            SaveLayoutCache();
+        }
     }
     return pageCount > 0;
 }
 
+// images are referenced by their recindex
+char* EngineMobi::GetLayoutCacheImageRef(const ByteSlice& img) {
+    for (size_t i = 1; i <= doc->imagesCount; i++) {
+        ByteSlice* data = doc->GetImage(i);
+        if (data && data->data() == img.data()) {
+            return str::Format("%d", (int)i);
+        }
+    }
+    return nullptr;
+}
+
 IPageDestination* EngineMobi::GetNamedDest(const char* name) {
     int filePos = atoi(name);
     if (filePos < 0 || 0 == filePos && *name != '0') {
         return nullptr;
     }
+    // filePos might be on a page that hasn't been laid out yet,
+    // so this waits until there's a page after it
+    ScopedCritSec scope(&pagesAccess);
+    WaitForLayout([&] { return pages->size() > 0 && pages->Last()->reparseIdx > filePos; });
+    int nPages = (int)pages->size();
     int pageNo;
-    for (pageNo = 1; pageNo < PageCount(); pageNo++) {
+    for (pageNo = 1; pageNo < nPages; pageNo++) {
         if (pages->at(pageNo)->reparseIdx > filePos) {
             break;
         }
     }
-    CrashIf(pageNo < 1 || pageNo > PageCount());
+    CrashIf(pageNo < 1 || pageNo > nPages);
 
     ByteSlice htmlData = doc->GetHtmlData();
     size_t htmlLen = htmlData.size();
@@ -1080,8 +2136,7 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
         return nullptr;
     }
 
-    ScopedCritSec scope(&pagesAccess);
-    Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
+    Vec<DrawInstr>* pageInstrs = &pages->at(pageNo - 1)->instructions;
     // link to the bottom of the page, if filePos points
     // beyond the last visible DrawInstr of a page
     float currY = (float)pageRect.dy;
@@ -1101,6 +2156,10 @@ TocTree* EngineMobi::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    if (IsLayoutInProgress()) {
+        // resolving the destinations needs the whole document
+        return nullptr;
+    }
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -1113,8 +2172,9 @@ TocTree* EngineMobi::GetToc() {
     return tocTree;
 }
 
-EngineBase* EngineMobi::CreateFromFile(const char* fileName) {
+EngineBase* EngineMobi::CreateFromFile(const char* fileName, bool lazyLayout) {
     EngineMobi* engine = new EngineMobi();
+    engine->lazyLayout = lazyLayout;
     if (!engine->Load(fileName)) {
         delete engine;
         return nullptr;
@@ -1131,8 +2191,8 @@ EngineBase* EngineMobi::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineMobiFromFile(const char* fileName) {
-    return EngineMobi::CreateFromFile(fileName);
+EngineBase* CreateEngineMobiFromFile(const char* fileName, bool lazyLayout) {
+    return EngineMobi::CreateFromFile(fileName, lazyLayout);
 }
 
 EngineBase* CreateEngineMobiFromStream(IStream* stream) {
@@ -1148,6 +2208,7 @@ class EnginePdb : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".pdb");
     }
     ~EnginePdb() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1165,7 +2226,7 @@ class EnginePdb : public EngineEbook {
 
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool lazyLayout = false);
 
   protected:
     PalmDoc* doc = nullptr;
@@ -1189,14 +2250,9 @@ bool EnginePdb::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::GdiplusQuick);
 
-    pages = HtmlFormatter(&args).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
+    FormatPages(new HtmlFormatter(&args), true);
 
     return pageCount > 0;
 }
@@ -1205,6 +2261,10 @@ TocTree* EnginePdb::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    if (IsLayoutInProgress()) {
+        // resolving the destinations needs the whole document
+        return nullptr;
+    }
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     auto* root = builder.GetRoot();
@@ -1217,8 +2277,9 @@ TocTree* EnginePdb::GetToc() {
     return tocTree;
 }
 
-EngineBase* EnginePdb::CreateFromFile(const char* fileName) {
+EngineBase* EnginePdb::CreateFromFile(const char* fileName, bool lazyLayout) {
     EnginePdb* engine = new EnginePdb();
+    engine->lazyLayout = lazyLayout;
     if (!engine->Load(fileName)) {
         delete engine;
         return nullptr;
@@ -1226,8 +2287,8 @@ EngineBase* EnginePdb::CreateFromFile(const char* fileName) {
     return engine;
 }
 
-EngineBase* CreateEnginePdbFromFile(const char* fileName) {
-    return EnginePdb::CreateFromFile(fileName);
+EngineBase* CreateEnginePdbFromFile(const char* fileName, bool lazyLayout) {
+    return EnginePdb::CreateFromFile(fileName, lazyLayout);
 }
 
 /* formatting extensions for CHM */
@@ -1516,14 +2577,9 @@ bool EngineChm::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::GdiplusQuick);
 
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
+    FormatPages(new ChmFormatter(&args, dataCache), false);
 
     return pageCount > 0;
 }
@@ -1656,14 +2712,9 @@ bool EngineHtml::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::Gdiplus);
 
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
+    FormatPages(new HtmlFileFormatter(&args, doc), false);
 
     return pageCount > 0;
 }
@@ -1771,14 +2822,9 @@ bool EngineTxt::Load(const char* fileName) {
     args.SetFontName(GetDefaultFontName());
     args.fontSize = GetDefaultFontSize();
     args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
+    args.textRenderMethod = LayoutTextRenderMethod(mui::TextRenderMethod::Gdiplus);
 
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
+    FormatPages(new TxtFormatter(&args), false);
 
     return pageCount > 0;
 }
@@ -1812,4 +2858,5 @@ EngineBase* CreateEngineTxtFromFile(const char* fileName) {
 
 void EngineEbookCleanup() {
     gDefaultFontName.Reset();
+    gLayoutCacheDir.Reset();
 }
@@ -7,6 +7,8 @@
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/AvifReader.h"
+#include "utils/ImageResample.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/JsonParser.h"
@@ -48,8 +50,35 @@ Kind kindEngineImage = "engineImage";
 Kind kindEngineImageDir = "engineImageDir";
 Kind kindEngineComicBooks = "engineComicBooks";
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE 10
+// how much memory decoded bitmaps cached for quicker rendering can use
+// (a comic book page scanned at 300 dpi is 20-60 MB decoded)
+constexpr size_t kMaxImagePageCacheSize32 = 256 * 1024 * 1024;
+constexpr size_t kMaxImagePageCacheSize64 = 1024 * 1024 * 1024;
+// how much of solid comic book archives is kept in memory after uncompressing
+// them in the background, the rest goes to a temporary file
+constexpr size_t kMaxExtractedArchiveSize32 = 128 * 1024 * 1024;
+constexpr size_t kMaxExtractedArchiveSize64 = 512 * 1024 * 1024;
+// pages kept even if they're above the budget
+constexpr int kMinImagePagesCached = 2;
+// number of pages decoded in the background ahead of the page being read
+constexpr int kReadAheadPages = 3;
+
+// pages can be decoded at down to 1/2^kMaxImageScaleShift of their size
+// when they're shown zoomed out
+constexpr int kMaxImageScaleShift = 3;
+
+// how much of a comic book image to uncompress to find its size in the header
+// (jpeg headers can be big if they contain a thumbnail or a color profile)
+constexpr size_t kImageHeaderProbeSize = 64 * 1024;
+
+// how pages are scaled when they're rendered, see SetImageScaling()
+static bool gUseGdiplusScaling = false;
+static ResampleFilter gResampleFilter = ResampleFilter::Lanczos3;
+
+void SetImageScaling(const char* name) {
+    gUseGdiplusScaling = str::EqI(name, "gdiplus");
+    gResampleFilter = str::EqI(name, "bicubic") ? ResampleFilter::Bicubic : ResampleFilter::Lanczos3;
+}
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -58,16 +87,30 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // approximate size of the decoded bitmap
+    size_t memSize = 0;
+    // set while LoadBitmapForPage() runs without holding cacheAccess
+    bool isLoading = false;
+    // bmp was decoded at 1/2^scaleShift of the page size
+    int scaleShift = 0;
+    // GDI+ bitmaps can't be used by several threads at once
+    CRITICAL_SECTION bmpAccess;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
         this->bmp = bmp;
+        InitializeCriticalSection(&bmpAccess);
+    }
+    ~ImagePage() {
+        DeleteCriticalSection(&bmpAccess);
     }
 };
 
 struct ImagePageInfo {
     Vec<IPageElement*> allElements;
     RectF mediabox;
+    // decoded bitmaps (at each scale) that are in EngineImages::pageCache
+    ImagePage* cached[kMaxImageScaleShift + 1] = {};
 };
 
 class EngineImages : public EngineBase {
@@ -103,19 +146,61 @@ class EngineImages : public EngineBase {
         return page != nullptr;
     }
 
+    void GetMemStats(EngineMemStats& stats) override {
+        ScopedCritSec scope(&cacheAccess);
+        stats.cacheSize += (i64)pageCacheSize;
+        stats.cacheItems += pageCache.isize();
+        stats.loadedPages += pageCache.isize();
+    }
+
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    // signaled when a page is done loading
+    CONDITION_VARIABLE pageLoaded;
+    // most recently used first
     Vec<ImagePage*> pageCache;
+    // sum of memSize of pages in pageCache
+    size_t pageCacheSize = 0;
+    size_t maxPageCacheSize = 0;
     Vec<ImagePageInfo*> pages;
 
+    // decode pages following the page last rendered (in the direction
+    // the user is moving in) so that the next page shows up instantly
+    HANDLE readAheadThreads[kReadAheadPages] = {};
+    int nReadAheadThreads = 0;
+    // signaled when there are new pages to read ahead
+    CONDITION_VARIABLE readAheadWork;
+    bool abortReadAhead = false;
+    int readAheadPageNo = 0;
+    int readAheadDir = 1;
+    int readAheadScaleShift = 0;
+    // number of pages after readAheadPageNo handed out to read-ahead threads
+    int nReadAheadTaken = 0;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
+    bool DrawPageGdiplus(ImagePage* page, int pageNo, float zoom, int rotation, Rect screen, Point screenTL,
+                         HBITMAP hbmp);
+
+    // set if LoadBitmapForPage() can decode at a lower resolution
+    bool canDecodeScaled = false;
 
-    virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
+    // scaleShift is only != 0 if canDecodeScaled
+    virtual Bitmap* LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) = 0;
     virtual RectF LoadMediabox(int pageNo) = 0;
 
-    ImagePage* GetPage(int pageNo, bool tryOnly = false);
+    Size ScaledPageSize(int pageNo, int scaleShift);
+    // the page might be at a higher resolution than asked for if that's already cached
+    ImagePage* GetPage(int pageNo, bool tryOnly = false, int scaleShift = 0);
     void DropPage(ImagePage* page, bool forceRemove);
+    bool IsPageCacheFull();
+
+    void StartReadAhead(int pageNo, int scaleShift);
+    int NextReadAheadPage();
+    void ReadAhead();
+    // must be called by destructors of derived classes, since
+    // the read-ahead thread calls LoadBitmapForPage()
+    void StopReadAhead();
 
     RectF PageContentBox(int pageNo, RenderTarget) override;
 };
@@ -127,10 +212,14 @@ EngineImages::EngineImages() {
     preferredLayout.nonContinuous = true;
     isImageCollection = true;
 
+    maxPageCacheSize = IsProcess64() ? kMaxImagePageCacheSize64 : kMaxImagePageCacheSize32;
     InitializeCriticalSection(&cacheAccess);
+    InitializeConditionVariable(&pageLoaded);
+    InitializeConditionVariable(&readAheadWork);
 }
 
 EngineImages::~EngineImages() {
+    StopReadAhead();
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -153,30 +242,64 @@ RectF EngineImages::PageMediabox(int pageNo) {
     return mbox;
 }
 
-RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
-    auto pageNo = args.pageNo;
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
+// the smallest resolution (as 1/2^scaleShift) that isn't
+// smaller than the resolution the page is shown at
+static int ScaleShiftForZoom(float zoom) {
+    int scaleShift = 0;
+    while (scaleShift < kMaxImageScaleShift && zoom * (float)(2 << scaleShift) <= 1.f) {
+        scaleShift++;
+    }
+    return scaleShift;
+}
 
-    ImagePage* page = GetPage(pageNo);
-    if (!page) {
-        return nullptr;
+static ImagePixels DibPixels(HBITMAP hbmp) {
+    DIBSECTION ds;
+    if (GetObject(hbmp, sizeof(ds), &ds) != sizeof(ds) || !ds.dsBm.bmBits) {
+        return {};
     }
+    // CreateMemoryBitmap() creates top-down DIBs
+    return {(u8*)ds.dsBm.bmBits, ds.dsBm.bmWidth, ds.dsBm.bmHeight, ds.dsBm.bmWidthBytes};
+}
 
-    auto timeStart = TimeGet();
-    defer {
-        auto dur = TimeSinceInMs(timeStart);
-        logf("EngineImages::RenderPage() in %.2f ms\n", dur);
-    };
+// scales the bitmap of an unrotated page with ResampleBitmap(), which is much faster than GDI+
+static bool DrawPageResampled(ImagePage* page, RectF mbox, float zoom, Point screenTL, HBITMAP hbmp) {
+    ImagePixels dst = DibPixels(hbmp);
+    if (!dst.data || mbox.IsEmpty()) {
+        return false;
+    }
+    memset(dst.data, 0xFF, (size_t)dst.stride * dst.dy);
+    // the part of the rendered bitmap covered by the page
+    RectF pageOnScreen(mbox.x * zoom - screenTL.x, mbox.y * zoom - screenTL.y, mbox.dx * zoom, mbox.dy * zoom);
+    Rect dstR = pageOnScreen.Round().Intersect(Rect(0, 0, dst.dx, dst.dy));
+    if (dstR.IsEmpty()) {
+        return true;
+    }
 
-    RectF pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
-    Rect screen = Transform(pageRc, pageNo, zoom, rotation).Round();
-    Point screenTL = screen.TL();
-    screen.Offset(-screen.x, -screen.y);
+    Bitmap* bmp = page->bmp;
+    Gdiplus::Rect bmpR(0, 0, bmp->GetWidth(), bmp->GetHeight());
+    BitmapData bmpData;
+    if (bmp->LockBits(&bmpR, ImageLockModeRead, PixelFormat32bppARGB, &bmpData) != Ok) {
+        return false;
+    }
+    bool ok = false;
+    if (bmpData.Stride > 0) {
+        ImagePixels src{(u8*)bmpData.Scan0, (int)bmpData.Width, (int)bmpData.Height, bmpData.Stride};
+        // the bitmap might've been decoded at a lower resolution than the page size
+        float scaleX = (float)src.dx / mbox.dx;
+        float scaleY = (float)src.dy / mbox.dy;
+        RectF srcR(((float)(dstR.x + screenTL.x) / zoom - mbox.x) * scaleX,
+                   ((float)(dstR.y + screenTL.y) / zoom - mbox.y) * scaleY, (float)dstR.dx / zoom * scaleX,
+                   (float)dstR.dy / zoom * scaleY);
+        ImagePixels dstPart{dst.data + (size_t)dstR.y * dst.stride + (size_t)dstR.x * 4, dstR.dx, dstR.dy,
+                             dst.stride};
+        ok = ResampleBitmap(src, srcR, dstPart, gResampleFilter);
+    }
+    bmp->UnlockBits(&bmpData);
+    return ok;
+}
 
-    HANDLE hMap = nullptr;
-    HBITMAP hbmp = CreateMemoryBitmap(screen.Size(), &hMap);
+bool EngineImages::DrawPageGdiplus(ImagePage* page, int pageNo, float zoom, int rotation, Rect screen,
+                                   Point screenTL, HBITMAP hbmp) {
     HDC hDC = CreateCompatibleDC(nullptr);
     DeleteObject(SelectObject(hDC, hbmp));
 
@@ -198,15 +321,61 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     g.SetTransform(&m);
 
     Rect pageRcI = PageMediabox(pageNo).Round();
+    // the bitmap might've been decoded at a lower resolution than the page size
+    Gdiplus::RectF srcR((float)pageRcI.x, (float)pageRcI.y, (float)pageRcI.dx, (float)pageRcI.dy);
+    if (page->scaleShift > 0 && pageRcI.dx > 0 && pageRcI.dy > 0) {
+        float scaleX = (float)page->bmp->GetWidth() / (float)pageRcI.dx;
+        float scaleY = (float)page->bmp->GetHeight() / (float)pageRcI.dy;
+        srcR = Gdiplus::RectF(srcR.X * scaleX, srcR.Y * scaleY, srcR.Width * scaleX, srcR.Height * scaleY);
+    }
+    Gdiplus::RectF dstR((float)pageRcI.x, (float)pageRcI.y, (float)pageRcI.dx, (float)pageRcI.dy);
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok =
-        g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    Status ok = g.DrawImage(page->bmp, dstR, srcR.X, srcR.Y, srcR.Width, srcR.Height, UnitPixel, &imgAttrs);
 
-    DropPage(page, false);
     DeleteDC(hDC);
+    return ok == Ok;
+}
 
-    if (ok != Ok) {
+RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
+    auto pageNo = args.pageNo;
+    auto pageRect = args.pageRect;
+    auto zoom = args.zoom;
+    auto rotation = args.rotation;
+
+    int scaleShift = canDecodeScaled ? ScaleShiftForZoom(zoom) : 0;
+    ImagePage* page = GetPage(pageNo, false, scaleShift);
+    if (!page) {
+        return nullptr;
+    }
+    StartReadAhead(pageNo, scaleShift);
+
+    auto timeStart = TimeGet();
+    defer {
+        auto dur = TimeSinceInMs(timeStart);
+        logf("EngineImages::RenderPage() in %.2f ms\n", dur);
+    };
+
+    RectF pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
+    Rect screen = Transform(pageRc, pageNo, zoom, rotation).Round();
+    Point screenTL = screen.TL();
+    screen.Offset(-screen.x, -screen.y);
+
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(screen.Size(), &hMap);
+    bool ok = false;
+    {
+        ScopedCritSec scope(&page->bmpAccess);
+        if (!gUseGdiplusScaling && NormalizeRotation(rotation) == 0) {
+            ok = DrawPageResampled(page, PageMediabox(pageNo), zoom, screenTL, hbmp);
+        }
+        if (!ok) {
+            ok = DrawPageGdiplus(page, pageNo, zoom, rotation, screen, screenTL, hbmp);
+        }
+    }
+    DropPage(page, false);
+
+    if (!ok) {
         DeleteObject(hbmp);
         CloseHandle(hMap);
         return nullptr;
@@ -283,11 +452,24 @@ RenderedBitmap* EngineImages::GetImageForPageElement(IPageElement* pel) {
         return nullptr;
     }
 
-    HBITMAP hbmp;
+    ScopedCritSec scope(&page->bmpAccess);
     auto bmp = page->bmp;
     int dx = bmp->GetWidth();
     int dy = bmp->GetHeight();
     Size s{dx, dy};
+    if (!gUseGdiplusScaling) {
+        // copying with ResampleBitmap() is faster than GetHBITMAP()
+        HANDLE hMap = nullptr;
+        HBITMAP hbmp = CreateMemoryBitmap(s, &hMap);
+        RectF mbox(0, 0, (float)dx, (float)dy);
+        if (hbmp && DrawPageResampled(page, mbox, 1.f, Point(), hbmp)) {
+            DropPage(page, false);
+            return new RenderedBitmap(hbmp, s, hMap);
+        }
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+    }
+    HBITMAP hbmp;
     auto status = bmp->GetHBITMAP((ARGB)Color::White, &hbmp);
     DropPage(page, false);
     if (status != Ok) {
@@ -315,44 +497,92 @@ bool EngineImages::SaveFileAs(const char* dstPath) {
     return file::WriteFile(dstPath, d);
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
-    ScopedCritSec scope(&cacheAccess);
+static size_t BitmapMemSize(Bitmap* bmp) {
+    if (!bmp) {
+        return 0;
+    }
+    size_t bpp = (size_t)GetPixelFormatSize(bmp->GetPixelFormat());
+    return (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * std::max(bpp, (size_t)8) / 8;
+}
 
-    ImagePage* result = nullptr;
+// returns an empty size for the full size
+Size EngineImages::ScaledPageSize(int pageNo, int scaleShift) {
+    if (scaleShift == 0) {
+        return Size();
+    }
+    Rect mbox = PageMediabox(pageNo).Round();
+    int div = 1 << scaleShift;
+    return Size(std::max((mbox.dx + div - 1) / div, 1), std::max((mbox.dy + div - 1) / div, 1));
+}
 
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
+// the closest to scaleShift that isn't at a lower resolution
+static ImagePage* FindCachedPage(ImagePageInfo* pi, int scaleShift) {
+    for (int i = scaleShift; i >= 0; i--) {
+        if (pi->cached[i]) {
+            return pi->cached[i];
         }
     }
+    return nullptr;
+}
+
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly, int scaleShift) {
+    CrashIf(scaleShift < 0 || scaleShift > kMaxImageScaleShift || (scaleShift > 0 && !canDecodeScaled));
+    ScopedCritSec scope(&cacheAccess);
+
+    ImagePageInfo* pi = pages[pageNo - 1];
+    ImagePage* result = FindCachedPage(pi, scaleShift);
     if (!result && tryOnly) {
         return nullptr;
     }
 
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            CrashIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
+        // the page is cached while it's being loaded so that
+        // other threads wait for it instead of loading it again
         result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
+        result->isLoading = true;
+        result->scaleShift = scaleShift;
+        result->refs++;
         pageCache.InsertAt(0, result);
+        pi->cached[scaleShift] = result;
+
+        // decode without holding cacheAccess, so that other pages can be
+        // decoded and rendered at the same time. LoadBitmapForPage() must
+        // protect the state it shares with other pages
+        LeaveCriticalSection(&cacheAccess);
+        bool ownBmp = true;
+        Bitmap* bmp = LoadBitmapForPage(pageNo, scaleShift, ownBmp);
+        EnterCriticalSection(&cacheAccess);
+
+        result->bmp = bmp;
+        result->ownBmp = ownBmp;
+        result->isLoading = false;
+        WakeAllConditionVariable(&pageLoaded);
+        // might've been evicted while loading
+        if (pi->cached[scaleShift] == result) {
+            result->memSize = BitmapMemSize(bmp);
+            pageCacheSize += result->memSize;
+        }
+        // least recently used pages go first
+        while (pageCacheSize > maxPageCacheSize && pageCache.isize() > kMinImagePagesCached) {
+            DropPage(pageCache.Last(), true);
+        }
+    } else {
+        result->refs++;
+        while (result->isLoading) {
+            SleepConditionVariableCS(&pageLoaded, &cacheAccess, INFINITE);
+        }
+        if (pi->cached[result->scaleShift] == result && result != pageCache.at(0)) {
+            // keep the list Most Recently Used first
+            pageCache.Remove(result);
+            pageCache.InsertAt(0, result);
+        }
     }
+
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
-        return nullptr;
-    }
-    if (!result) {
+    if (!result->bmp) {
+        DropPage(result, false);
         return nullptr;
     }
-
-    result->refs++;
     return result;
 }
 
@@ -361,8 +591,11 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     page->refs--;
     CrashIf(page->refs < 0);
 
-    if (0 == page->refs || forceRemove) {
+    ImagePageInfo* pi = pages[page->pageNo - 1];
+    if ((0 == page->refs || forceRemove) && pi->cached[page->scaleShift] == page) {
         pageCache.Remove(page);
+        pageCacheSize -= page->memSize;
+        pi->cached[page->scaleShift] = nullptr;
     }
 
     if (0 == page->refs) {
@@ -373,6 +606,112 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     }
 }
 
+bool EngineImages::IsPageCacheFull() {
+    ScopedCritSec scope(&cacheAccess);
+    return pageCacheSize >= maxPageCacheSize;
+}
+
+static DWORD WINAPI ReadAheadThread(LPVOID data) {
+    EngineImages* engine = (EngineImages*)data;
+    engine->ReadAhead();
+    return 0;
+}
+
+// called after rendering pageNo. The direction of reading is
+// guessed from which page was rendered before
+void EngineImages::StartReadAhead(int pageNo, int scaleShift) {
+    ScopedCritSec scope(&cacheAccess);
+    if (pageNo == readAheadPageNo && scaleShift == readAheadScaleShift) {
+        return;
+    }
+    readAheadScaleShift = scaleShift;
+    if (readAheadPageNo != 0 && pageNo != readAheadPageNo) {
+        readAheadDir = pageNo < readAheadPageNo ? -1 : 1;
+    }
+    readAheadPageNo = pageNo;
+    nReadAheadTaken = 0;
+    if (pageCount < 2) {
+        return;
+    }
+    if (nReadAheadThreads == 0) {
+        // leave a core for the UI and rendering
+        int nThreads = std::clamp(GetPhysicalProcessorCount() - 1, 1, kReadAheadPages);
+        for (int i = 0; i < nThreads; i++) {
+            HANDLE h = CreateThread(nullptr, 0, ReadAheadThread, this, 0, nullptr);
+            if (!h) {
+                break;
+            }
+            SetThreadPriority(h, THREAD_PRIORITY_BELOW_NORMAL);
+            readAheadThreads[nReadAheadThreads++] = h;
+        }
+        // AVIF images are decoded by dav1d on its own threads; split the cores
+        // between the pages decoded at the same time instead of oversubscribing
+        int nCores = GetPhysicalProcessorCount();
+        SetAvifDecodeThreads(std::max(nCores / (nReadAheadThreads + 1), 1));
+    }
+    WakeAllConditionVariable(&readAheadWork);
+}
+
+// returns 0 if there's no page to read ahead. Must be called with cacheAccess held
+int EngineImages::NextReadAheadPage() {
+    while (nReadAheadTaken < kReadAheadPages) {
+        int pageNo = readAheadPageNo + ++nReadAheadTaken * readAheadDir;
+        if (pageNo < 1 || pageNo > pageCount) {
+            break;
+        }
+        if (FindCachedPage(pages[pageNo - 1], readAheadScaleShift)) {
+            continue;
+        }
+        // don't evict the pages being read to make room for more pages ahead
+        ImagePage* lru = pageCache.size() > 0 ? pageCache.Last() : nullptr;
+        size_t avgSize = lru ? pageCacheSize / pageCache.size() : 0;
+        if (lru && pageCacheSize + avgSize > maxPageCacheSize &&
+            abs(lru->pageNo - readAheadPageNo) <= kReadAheadPages) {
+            break;
+        }
+        return pageNo;
+    }
+    nReadAheadTaken = kReadAheadPages;
+    return 0;
+}
+
+void EngineImages::ReadAhead() {
+    ScopedCritSec scope(&cacheAccess);
+    while (!abortReadAhead) {
+        int pageNo = NextReadAheadPage();
+        if (pageNo == 0) {
+            SleepConditionVariableCS(&readAheadWork, &cacheAccess, INFINITE);
+            continue;
+        }
+        int scaleShift = readAheadScaleShift;
+        // GetPage() only decodes without holding cacheAccess if it's not held recursively
+        LeaveCriticalSection(&cacheAccess);
+        ImagePage* page = GetPage(pageNo, false, scaleShift);
+        if (page) {
+            DropPage(page, false);
+        }
+        EnterCriticalSection(&cacheAccess);
+    }
+}
+
+// waits for the pages currently being read ahead to be decoded
+void EngineImages::StopReadAhead() {
+    if (nReadAheadThreads == 0) {
+        return;
+    }
+    {
+        ScopedCritSec scope(&cacheAccess);
+        abortReadAhead = true;
+        WakeAllConditionVariable(&readAheadWork);
+    }
+    WaitForMultipleObjects(nReadAheadThreads, readAheadThreads, TRUE, INFINITE);
+    for (int i = 0; i < nReadAheadThreads; i++) {
+        CloseHandle(readAheadThreads[i]);
+        readAheadThreads[i] = nullptr;
+    }
+    nReadAheadThreads = 0;
+}
+
 // Get content box for image by cropping out margins of similar color
 RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
     // try to load bitmap for the image
@@ -383,6 +722,7 @@ RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
         DropPage(page, false);
     };
 
+    ScopedCritSec scope(&page->bmpAccess);
     auto bmp = page->bmp;
     if (!bmp)
         return RectF{};
@@ -506,7 +846,7 @@ class EngineImage : public EngineImages {
     bool LoadFromStream(IStream* stream);
     bool FinishLoading();
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 };
 
@@ -515,6 +855,7 @@ EngineImage::EngineImage() {
 }
 
 EngineImage::~EngineImage() {
+    StopReadAhead();
     delete image;
 }
 
@@ -683,7 +1024,7 @@ char* EngineImage::GetProperty(DocumentProperty prop) {
     }
 }
 
-Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineImage::LoadBitmapForPage(int pageNo, __unused int scaleShift, bool& deleteAfterUse) {
     if (1 == pageNo) {
         deleteAfterUse = false;
         return image;
@@ -691,6 +1032,8 @@ Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
 
     // extract other frames from multi-page TIFFs and animated GIFs
     ReportIfNotMultiImage(this);
+    // all frames are cloned from the same image
+    ScopedCritSec scope(&cacheAccess);
     const GUID* dim = imageFormat == kindFileTiff ? &FrameDimensionPage : &FrameDimensionTime;
     uint frameCount = image->GetFrameCount(dim);
     CrashIf((unsigned int)pageNo > frameCount);
@@ -713,9 +1056,11 @@ RectF EngineImage::LoadMediabox(int pageNo) {
     }
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
+        EnterCriticalSection(&page->bmpAccess);
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
+        LeaveCriticalSection(&page->bmpAccess);
         DropPage(page, false);
         return mbox;
     }
@@ -749,7 +1094,12 @@ bool EngineImage::SaveFileAsPDF(const char* pdfFileName) {
     }
     for (int i = 2; i <= PageCount() && ok; i++) {
         ImagePage* page = GetPage(i);
-        ok = page && c->AddPageFromGdiplusBitmap(page->bmp, dpi);
+        if (page) {
+            ScopedCritSec scope(&page->bmpAccess);
+            ok = c->AddPageFromGdiplusBitmap(page->bmp, dpi);
+        } else {
+            ok = false;
+        }
         DropPage(page, false);
     }
     if (ok) {
@@ -812,6 +1162,7 @@ class EngineImageDir : public EngineImages {
     EngineImageDir() {
         fileDPI = 96.0f;
         kind = kindEngineImageDir;
+        canDecodeScaled = true;
         str::ReplaceWithCopy(&defaultExt, "");
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
@@ -819,6 +1170,7 @@ class EngineImageDir : public EngineImages {
     }
 
     ~EngineImageDir() override {
+        StopReadAhead();
         delete tocTree;
     }
 
@@ -850,7 +1202,7 @@ class EngineImageDir : public EngineImages {
 
     // protected:
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 
     StrVec pageFileNames;
@@ -962,14 +1314,15 @@ bool EngineImageDir::SaveFileAs(const char* dstPath) {
     return ok;
 }
 
-Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) {
+    Size scaledSize = ScaledPageSize(pageNo, scaleShift);
     char* path = pageFileNames.at(pageNo - 1);
     ByteSlice bmpData = file::ReadFile(path);
     if (!bmpData) {
         return nullptr;
     }
     deleteAfterUse = true;
-    Bitmap* res = BitmapFromData(bmpData);
+    Bitmap* res = BitmapFromData(bmpData, scaledSize);
     bmpData.Free();
     return res;
 }
@@ -985,20 +1338,9 @@ RectF EngineImageDir::LoadMediabox(int pageNo) {
     return RectF();
 }
 
+// streamed to the file, so that directories with many images don't have to fit into memory
 bool EngineImageDir::SaveFileAsPDF(const char* pdfFileName) {
-    bool ok = true;
-    PdfCreator* c = new PdfCreator();
-    for (int i = 1; i <= PageCount() && ok; i++) {
-        char* path = pageFileNames.at(i - 1);
-        ByteSlice data = file::ReadFile(path);
-        ok = c->AddPageFromImageData(data, GetFileDPI());
-        str::Free(data);
-    }
-    if (ok) {
-        ok = c->SaveToFile(pdfFileName);
-    }
-    delete c;
-    return ok;
+    return PdfCreator::RenderToFile(pdfFileName, this);
 }
 
 EngineBase* EngineImageDir::CreateFromFile(const char* fileName) {
@@ -1022,7 +1364,31 @@ EngineBase* CreateEngineImageDirFromFile(const char* fileName) {
 
 ///// CbxEngine handles comic book files (either .cbz, .cbr, .cb7 or .cbt) /////
 
-class EngineCbx : public EngineImages, public json::ValueVisitor {
+// paths of ComicBookInfo metadata in the archive comment
+enum class ComicBookInfoPath {
+    Title,
+    PublicationYear,
+    PublicationMonth,
+    AppID,
+    LastModified,
+    Summary,
+    CreditPerson,
+    CreditPrimary,
+};
+
+static const char* gComicBookInfoPaths[] = {
+    "/ComicBookInfo/1.0/title",
+    "/ComicBookInfo/1.0/publicationYear",
+    "/ComicBookInfo/1.0/publicationMonth",
+    "/appID",
+    "/lastModified",
+    "/X-summary",
+    "/ComicBookInfo/1.0/credits[*]/person",
+    "/ComicBookInfo/1.0/credits[*]/primary",
+};
+static const json::PathSet kComicBookInfoPaths(gComicBookInfoPaths, dimof(gComicBookInfoPaths));
+
+class EngineCbx : public EngineImages, public json::PathVisitor {
   public:
     explicit EngineCbx(MultiFormatArchive* arch);
     ~EngineCbx() override;
@@ -1035,8 +1401,8 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
 
     TocTree* GetToc() override;
 
-    // json::ValueVisitor
-    bool Visit(const char* path, const char* value, json::Type type) override;
+    // json::PathVisitor
+    bool Visit(int pathIdx, int arrayIdx, StrSpan value, json::Type type) override;
 
     static EngineBase* CreateFromFile(const char* path);
     static EngineBase* CreateFromStream(IStream* stream);
@@ -1045,7 +1411,7 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
     Vec<ByteSlice> images;
 
   protected:
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 
     bool LoadFromFile(const char* fileName);
@@ -1055,6 +1421,12 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
     ByteSlice GetImageData(int pageNo);
     void ParseComicInfoXml(const ByteSlice& xmlData);
 
+  public:
+    // unlike GetImageData(), doesn't keep the image in memory. The caller must free it
+    ByteSlice GetImageDataCopy(int pageNo);
+
+  protected:
+
     // access to cbxFile must be protected after initialization (with cacheAccess)
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
@@ -1075,9 +1447,11 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    canDecodeScaled = true;
 }
 
 EngineCbx::~EngineCbx() {
+    StopReadAhead();
     delete tocTree;
 
     delete cbxFile;
@@ -1143,6 +1517,12 @@ static const char* GetExtFromArchiveType(MultiFormatArchive* cbxFile) {
     return nullptr;
 }
 
+static bool IsCbxPageFile(const char* fileName) {
+    Kind kind = GuessFileTypeFromName(fileName);
+    // OS X occasionally leaves metadata with image extensions
+    return IsEngineImageSupportedFileType(kind) && !str::StartsWith(path::GetBaseNameTemp(fileName), ".");
+}
+
 bool EngineCbx::FinishLoading() {
     CrashIf(!cbxFile);
     if (!cbxFile) {
@@ -1179,10 +1559,7 @@ bool EngineCbx::FinishLoading() {
             return false;
         }
 
-        Kind kind = GuessFileTypeFromName(fileName);
-        if (IsEngineImageSupportedFileType(kind) &&
-            // OS X occasionally leaves metadata with image extensions
-            !str::StartsWith(path::GetBaseNameTemp(fileName), ".")) {
+        if (IsCbxPageFile(fileName)) {
             pageFiles.Append(fileInfo);
         }
     }
@@ -1194,7 +1571,7 @@ bool EngineCbx::FinishLoading() {
     }
     const char* comment = cbxFile->GetComment();
     if (comment) {
-        json::Parse(comment, this);
+        json::Parse(comment, kComicBookInfoPaths, this);
     }
 
     int nFiles = pageFiles.isize();
@@ -1213,6 +1590,12 @@ bool EngineCbx::FinishLoading() {
     files = std::move(pageFiles);
     pageCount = nFiles;
 
+    // random access to files in solid archives has to uncompress everything
+    // stored before them, so uncompress all of them once instead
+    if (cbxFile->isSolid) {
+        cbxFile->StartExtractingAll(IsProcess64() ? kMaxExtractedArchiveSize64 : kMaxExtractedArchiveSize32);
+    }
+
     TocItem* root = nullptr;
     TocItem* curr = nullptr;
     for (int i = 0; i < pageCount; i++) {
@@ -1254,6 +1637,16 @@ ByteSlice EngineCbx::GetImageData(int pageNo) {
     return images[pageNo - 1] = cbxFile->GetFileDataById(fileId);
 }
 
+ByteSlice EngineCbx::GetImageDataCopy(int pageNo) {
+    CrashIf((pageNo < 1) || (pageNo > PageCount()));
+    ScopedCritSec scope(&cacheAccess);
+    if (!images[pageNo - 1].empty()) {
+        return images[pageNo - 1].Clone();
+    }
+    size_t fileId = files[pageNo - 1]->fileId;
+    return cbxFile->GetFileDataById(fileId);
+}
+
 static char* GetTextContent(HtmlPullParser& parser) {
     HtmlToken* tok = parser.Next();
     if (!tok || !tok->IsText()) {
@@ -1310,50 +1703,61 @@ void EngineCbx::ParseComicInfoXml(const ByteSlice& xmlData) {
 
 // extract ComicBookInfo metadata
 // http://code.google.com/p/comicbookinfo/
-bool EngineCbx::Visit(const char* path, const char* value, json::Type type) {
-    if (json::Type::String == type && str::Eq(path, "/ComicBookInfo/1.0/title")) {
-        propTitle.Set(str::Dup(value));
-    } else if (json::Type::Number == type && str::Eq(path, "/ComicBookInfo/1.0/publicationYear")) {
-        propDate.Set(str::Format("%s/%d", propDate ? propDate.Get() : "", atoi(value)));
-    } else if (json::Type::Number == type && str::Eq(path, "/ComicBookInfo/1.0/publicationMonth")) {
-        propDate.Set(str::Format("%d%s", atoi(value), propDate ? propDate.Get() : ""));
-    } else if (json::Type::String == type && str::Eq(path, "/appID")) {
-        propCreator.Set(str::Dup(value));
-    } else if (json::Type::String == type && str::Eq(path, "/lastModified")) {
-        propModDate.Set(str::Dup(value));
-    } else if (json::Type::String == type && str::Eq(path, "/X-summary")) {
-        propSummary.Set(str::Dup(value));
-    } else if (str::StartsWith(path, "/ComicBookInfo/1.0/credits[")) {
-        int idx = -1;
-        const char* prop = str::Parse(path, "/ComicBookInfo/1.0/credits[%d]/", &idx);
-        if (prop) {
-            if (json::Type::String == type && str::Eq(prop, "person")) {
-                propAuthorTmp.Set(str::Dup(value));
-            } else if (json::Type::Bool == type && str::Eq(prop, "primary") && propAuthorTmp &&
-                       !propAuthors.Contains(propAuthorTmp)) {
+bool EngineCbx::Visit(int pathIdx, int /*arrayIdx*/, StrSpan value, json::Type type) {
+    bool isString = json::Type::String == type;
+    bool isNumber = json::Type::Number == type;
+    switch ((ComicBookInfoPath)pathIdx) {
+        case ComicBookInfoPath::Title:
+            if (isString) {
+                propTitle.Set(str::Dup(value.data(), value.size()));
+            }
+            break;
+        case ComicBookInfoPath::PublicationYear:
+            if (isNumber) {
+                int year = atoi(str::DupTemp(value.data(), value.size()));
+                propDate.Set(str::Format("%s/%d", propDate ? propDate.Get() : "", year));
+            }
+            break;
+        case ComicBookInfoPath::PublicationMonth:
+            if (isNumber) {
+                int month = atoi(str::DupTemp(value.data(), value.size()));
+                propDate.Set(str::Format("%d%s", month, propDate ? propDate.Get() : ""));
+            }
+            break;
+        case ComicBookInfoPath::AppID:
+            if (isString) {
+                propCreator.Set(str::Dup(value.data(), value.size()));
+            }
+            break;
+        case ComicBookInfoPath::LastModified:
+            if (isString) {
+                propModDate.Set(str::Dup(value.data(), value.size()));
+            }
+            break;
+        case ComicBookInfoPath::Summary:
+            if (isString) {
+                propSummary.Set(str::Dup(value.data(), value.size()));
+            }
+            break;
+        case ComicBookInfoPath::CreditPerson:
+            if (isString) {
+                propAuthorTmp.Set(str::Dup(value.data(), value.size()));
+            }
+            return true;
+        case ComicBookInfoPath::CreditPrimary:
+            if (json::Type::Bool == type && propAuthorTmp && !propAuthors.Contains(propAuthorTmp)) {
                 propAuthors.Append(propAuthorTmp.Get());
             }
-        }
-        return true;
+            return true;
     }
     // stop parsing once we have all desired information
     return !propTitle || propAuthors.size() == 0 || !propCreator || !propDate ||
            str::FindChar(propDate, '/') <= propDate;
 }
 
+// streamed to the file, so that comic books with thousands of pages don't have to fit into memory
 bool EngineCbx::SaveFileAsPDF(const char* pdfFileName) {
-    bool ok = true;
-    PdfCreator* c = new PdfCreator();
-    for (int i = 1; i <= PageCount() && ok; i++) {
-        ByteSlice img = GetImageData(i);
-        ok = c->AddPageFromImageData(img, GetFileDPI());
-    }
-    if (ok) {
-        c->CopyProperties(this);
-        ok = c->SaveToFile(pdfFileName);
-    }
-    delete c;
-    return ok;
+    return PdfCreator::RenderToFile(pdfFileName, this);
 }
 
 char* EngineCbx::GetProperty(DocumentProperty prop) {
@@ -1376,30 +1780,55 @@ char* EngineCbx::GetProperty(DocumentProperty prop) {
     }
 }
 
-Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, int scaleShift, bool& deleteAfterUse) {
     auto timeStart = TimeGet();
     defer {
         auto dur = TimeSinceInMs(timeStart);
         logf("EngineCbx::LoadBitmapForPage(page: %d) took %.2f ms\n", pageNo, dur);
     };
-    ByteSlice img = GetImageData(pageNo);
+    Size scaledSize = ScaledPageSize(pageNo, scaleShift);
+    ByteSlice img;
+    {
+        // access to cbxFile must be serialized but decoding can happen in parallel
+        ScopedCritSec scope(&cacheAccess);
+        img = GetImageData(pageNo);
+    }
     if (!img.empty()) {
         deleteAfterUse = true;
-        return BitmapFromData(img);
+        return BitmapFromData(img, scaledSize);
     }
     return nullptr;
 }
 
 RectF EngineCbx::LoadMediabox(int pageNo) {
-    ByteSlice img = GetImageData(pageNo);
-    if (!img.empty()) {
-        Size size = BitmapSizeFromData(img);
-        return RectF(0, 0, (float)size.dx, (float)size.dy);
+    {
+        // access to cbxFile and images must be serialized with LoadBitmapForPage()
+        ScopedCritSec scope(&cacheAccess);
+
+        // the size is usually in the image header, which saves
+        // uncompressing (and keeping in memory) all of the image
+        if (images[pageNo - 1].empty()) {
+            size_t fileId = files[pageNo - 1]->fileId;
+            ByteSlice header = cbxFile->GetFileDataPartById(fileId, kImageHeaderProbeSize);
+            Size size = BitmapSizeFromHeader(header);
+            header.Free();
+            if (!size.IsEmpty()) {
+                return RectF(0, 0, (float)size.dx, (float)size.dy);
+            }
+        }
+
+        ByteSlice img = GetImageData(pageNo);
+        if (!img.empty()) {
+            Size size = BitmapSizeFromData(img);
+            return RectF(0, 0, (float)size.dx, (float)size.dy);
+        }
     }
 
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
+        EnterCriticalSection(&page->bmpAccess);
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
+        LeaveCriticalSection(&page->bmpAccess);
         DropPage(page, false);
         return mbox;
     }
@@ -1497,3 +1926,80 @@ EngineBase* CreateEngineCbxFromFile(const char* path) {
 EngineBase* CreateEngineCbxFromStream(IStream* stream) {
     return EngineCbx::CreateFromStream(stream);
 }
+
+// only extracts the image of the first page, without parsing metadata or
+// sorting the whole archive as EngineCbx does (e.g. for thumbnails)
+ByteSlice EngineCbxLoadCoverImage(IStream* stream) {
+    MultiFormatArchive* archive = OpenZipArchive(stream, false);
+    if (!archive) {
+        archive = OpenRarArchive(stream);
+    }
+    if (!archive) {
+        archive = Open7zArchive(stream);
+    }
+    if (!archive) {
+        archive = OpenTarArchive(stream);
+    }
+    if (!archive) {
+        return {};
+    }
+    defer {
+        delete archive;
+    };
+
+    MultiFormatArchive::FileInfo* first = nullptr;
+    for (auto* fileInfo : archive->GetFileInfos()) {
+        const char* fileName = fileInfo->name;
+        if (str::Len(fileName) == 0 || !IsCbxPageFile(fileName)) {
+            continue;
+        }
+        if (!first || cmpArchFileInfoByName(fileInfo, first)) {
+            first = fileInfo;
+        }
+    }
+    if (!first) {
+        return {};
+    }
+    return archive->GetFileDataById(first->fileId);
+}
+
+bool EngineCbxGetPageSizes(EngineBase* engine, Vec<Size>& sizes) {
+    if (!engine || engine->kind != kindEngineComicBooks) {
+        return false;
+    }
+    EngineCbx* e = (EngineCbx*)engine;
+    for (ImagePageInfo* pi : e->pages) {
+        RectF& mbox = pi->mediabox;
+        sizes.Append(Size((int)mbox.dx, (int)mbox.dy));
+    }
+    return true;
+}
+
+ByteSlice EngineImagesGetPageData(EngineBase* engine, int pageNo) {
+    if (!engine) {
+        return {};
+    }
+    if (engine->kind == kindEngineComicBooks) {
+        return ((EngineCbx*)engine)->GetImageDataCopy(pageNo);
+    }
+    if (engine->kind == kindEngineImageDir) {
+        EngineImageDir* e = (EngineImageDir*)engine;
+        return file::ReadFile(e->pageFileNames.at(pageNo - 1));
+    }
+    return {};
+}
+
+void EngineCbxSetPageSizes(EngineBase* engine, const Vec<Size>& sizes) {
+    if (!engine || engine->kind != kindEngineComicBooks) {
+        return;
+    }
+    EngineCbx* e = (EngineCbx*)engine;
+    int n = std::min(e->pages.isize(), sizes.isize());
+    for (int i = 0; i < n; i++) {
+        Size size = sizes[i];
+        RectF& mbox = e->pages[i]->mediabox;
+        if (mbox.IsEmpty() && !size.IsEmpty()) {
+            mbox = RectF(0, 0, (float)size.dx, (float)size.dy);
+        }
+    }
+}
@@ -7,6 +7,7 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/DirIter.h"
@@ -23,14 +24,61 @@ extern "C" {
 
 #include "utils/Log.h"
 
+// a folder can have hundreds of files so we only keep the most recently used open
+constexpr int kMaxOpenEngines = 8;
+
+// copies of the elements of a page which don't depend on the engine of the file
+struct PageElementCopies {
+    Vec<IPageElement*> els;
+    // copies replaced when the file's elements changed. They're not freed
+    // because callers might still use them (e.g. MainWindow::linkOnLastButtonDown)
+    Vec<IPageElement*> replaced;
+    // EngineInfo::startPageNo when the copies were made
+    int startPageNo = 0;
+
+    ~PageElementCopies() {
+        DeleteVecMembers(els);
+        DeleteVecMembers(replaced);
+    }
+};
+
 struct EngineInfo {
+    char* path = nullptr;
     TocItem* tocRoot = nullptr;
+    // nullptr if not currently open
     EngineBase* engine = nullptr;
+
+    // remembered so that we don't have to open the file to lay out its pages
+    int nPages = 0;
+    Vec<RectF> mediaboxes;
+    // empty if the file doesn't have page labels
+    StrVec pageLabels;
+    // first page in EngineMulti, 0 if unchecked
+    int startPageNo = 0;
+
+    // engine can't be closed while it's being used
+    int nUsers = 0;
+    int lastUsed = 0;
+    // the file is being opened by AcquireEngine() on some thread
+    bool isLoading = false;
+
+    // copies of the page elements returned by GetElements() (nullptr for pages
+    // not asked for yet). The callers keep pointers to them after the engine is closed
+    Vec<PageElementCopies*> pageElements;
+
+    ~EngineInfo() {
+        str::Free(path);
+        delete engine;
+        for (PageElementCopies* copies : pageElements) {
+            delete copies;
+        }
+    }
 };
 
-struct EnginePage {
-    int pageNoInEngine = 0;
-    EngineBase* engine = nullptr;
+// pages of ei are startPageNo..startPageNo + ei->nPages - 1
+struct EnginePages {
+    int startPageNo = 0;
+    EngineInfo* ei = nullptr;
 };
 
 Kind kindEngineMulti = "enginePdfMulti";
@@ -45,6 +93,7 @@ class EngineMulti : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool DrawPageOnDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -70,31 +119,135 @@ class EngineMulti : public EngineBase {
     int GetPageByLabel(const char* label) const override;
 
     bool LoadFromFiles(const char* dir, StrVec& files);
-    void UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo);
+    void UpdatePagesForEngines(Vec<EngineInfo*>& enginesInfo);
 
-    EngineBase* PageToEngine(int& pageNo) const;
-    Vec<EnginePage> pageToEngine;
-    Vec<EngineInfo> enginesInfo;
+    EngineInfo* PageToEngine(int& pageNo) const;
+    EngineBase* AcquireEngine(EngineInfo* ei);
+    void ReleaseEngine(EngineInfo* ei);
+    void CloseUnusedEngines(EngineInfo* keep);
+    Vec<IPageElement*> GetElementCopies(EngineInfo* ei, EngineBase* engine, int pageNo);
+
+    // sorted by startPageNo, only for engines that are not unchecked
+    Vec<EnginePages> pageToEngine;
+    Vec<EngineInfo*> enginesInfo;
     TocTree* tocTree = nullptr;
+
+    // protects EngineInfo::engine, nUsers, lastUsed, isLoading and pageElements
+    CRITICAL_SECTION enginesAccess;
+    // signaled when a file opened by AcquireEngine() has been loaded
+    CONDITION_VARIABLE engineLoaded;
+    int useCounter = 0;
 };
 
-EngineBase* EngineMulti::PageToEngine(int& pageNo) const {
-    const EnginePage& ep = pageToEngine[pageNo - 1];
-    pageNo = ep.pageNoInEngine;
-    return ep.engine;
+// opens the file with pageNo (if it's not open) and keeps it open while in scope.
+// pageNo is changed to the page number within that file
+struct ScopedPageEngine {
+    EngineMulti* multi = nullptr;
+    EngineInfo* ei = nullptr;
+    EngineBase* engine = nullptr;
+
+    ScopedPageEngine(EngineMulti* multi, int& pageNo) {
+        this->multi = multi;
+        ei = multi->PageToEngine(pageNo);
+        engine = multi->AcquireEngine(ei);
+    }
+    ~ScopedPageEngine() {
+        if (engine) {
+            multi->ReleaseEngine(ei);
+        }
+    }
+    EngineBase* operator->() const {
+        return engine;
+    }
+};
+
+EngineInfo* EngineMulti::PageToEngine(int& pageNo) const {
+    auto cmp = [](int n, const EnginePages& ep) { return n < ep.startPageNo; };
+    const EnginePages* ep = std::upper_bound(pageToEngine.begin(), pageToEngine.end(), pageNo, cmp);
+    CrashIf(ep == pageToEngine.begin());
+    ep--;
+    pageNo = pageNo - ep->startPageNo + 1;
+    return ep->ei;
+}
+
+// the file is opened without holding enginesAccess so that threads using
+// other files of the folder don't have to wait for it
+EngineBase* EngineMulti::AcquireEngine(EngineInfo* ei) {
+    ScopedCritSec cs(&enginesAccess);
+    while (ei->isLoading) {
+        SleepConditionVariableCS(&engineLoaded, &enginesAccess, INFINITE);
+    }
+    if (!ei->engine) {
+        ei->isLoading = true;
+        LeaveCriticalSection(&enginesAccess);
+        EngineBase* engine = CreateEngineFromFile(ei->path, nullptr, true);
+        if (engine && engine->PageCount() != ei->nPages) {
+            // the file has changed since we've opened the folder
+            logf("EngineMulti::AcquireEngine: '%s' now has %d pages instead of %d\n", ei->path, engine->PageCount(),
+                 ei->nPages);
+            delete engine;
+            engine = nullptr;
+        }
+        EnterCriticalSection(&enginesAccess);
+        ei->isLoading = false;
+        WakeAllConditionVariable(&engineLoaded);
+        if (!engine) {
+            return nullptr;
+        }
+        ei->engine = engine;
+        CloseUnusedEngines(ei);
+    }
+    ei->nUsers++;
+    ei->lastUsed = ++useCounter;
+    return ei->engine;
+}
+
+void EngineMulti::ReleaseEngine(EngineInfo* ei) {
+    ScopedCritSec cs(&enginesAccess);
+    CrashIf(ei->nUsers <= 0);
+    ei->nUsers--;
+}
+
+// closes least recently used engines until at most kMaxOpenEngines are open.
+// must be called with enginesAccess held
+void EngineMulti::CloseUnusedEngines(EngineInfo* keep) {
+    while (true) {
+        int nOpen = 0;
+        EngineInfo* lru = nullptr;
+        for (EngineInfo* ei : enginesInfo) {
+            if (!ei->engine) {
+                continue;
+            }
+            nOpen++;
+            if (ei == keep || ei->nUsers > 0) {
+                continue;
+            }
+            if (!lru || ei->lastUsed < lru->lastUsed) {
+                lru = ei;
+            }
+        }
+        if (nOpen <= kMaxOpenEngines || !lru) {
+            return;
+        }
+        delete lru->engine;
+        lru->engine = nullptr;
+    }
 }
 
 EngineMulti::EngineMulti() {
     kind = kindEngineMulti;
     defaultExt = str::Dup(""); // TODO: no extension, is it important?
     fileDPI = 72.0f;
+    InitializeCriticalSection(&enginesAccess);
+    InitializeConditionVariable(&engineLoaded);
 }
 
 EngineMulti::~EngineMulti() {
-    for (auto&& ei : enginesInfo) {
-        delete ei.engine;
+    for (EngineInfo* ei : enginesInfo) {
+        delete ei;
     }
     delete tocTree;
+    DeleteCriticalSection(&enginesAccess);
 }
 
 EngineBase* EngineMulti::Clone() {
@@ -104,22 +257,39 @@ EngineBase* EngineMulti::Clone() {
 }
 
 RectF EngineMulti::PageMediabox(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->PageMediabox(pageNo);
+    EngineInfo* ei = PageToEngine(pageNo);
+    return ei->mediaboxes[pageNo - 1];
 }
 
 RectF EngineMulti::PageContentBox(int pageNo, RenderTarget target) {
-    EngineBase* e = PageToEngine(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return e.ei->mediaboxes[pageNo - 1];
+    }
     return e->PageContentBox(pageNo, target);
 }
 
 RenderedBitmap* EngineMulti::RenderPage(RenderPageArgs& args) {
-    EngineBase* e = PageToEngine(args.pageNo);
+    ScopedPageEngine e(this, args.pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
     return e->RenderPage(args);
 }
 
+bool EngineMulti::DrawPageOnDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    ScopedPageEngine e(this, args.pageNo);
+    if (!e.engine) {
+        return false;
+    }
+    return e->DrawPageOnDC(hdc, args, offset);
+}
+
 RectF EngineMulti::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
-    EngineBase* e = PageToEngine(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return {};
+    }
     return e->Transform(rect, pageNo, zoom, rotation, inverse);
 }
 
@@ -136,12 +306,18 @@ bool EngineMulti::SaveFileAsPDF(const char*) {
 }
 
 PageText EngineMulti::ExtractPageText(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return {};
+    }
     return e->ExtractPageText(pageNo);
 }
 
 bool EngineMulti::HasClipOptimizations(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return false;
+    }
     return e->HasClipOptimizations(pageNo);
 }
 
@@ -150,51 +326,185 @@ char* EngineMulti::GetProperty(DocumentProperty prop) {
 }
 
 bool EngineMulti::BenchLoadPage(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return false;
+    }
     return e->BenchLoadPage(pageNo);
 }
 
+static bool IsPageNavigationDestination(IPageDestination* dest) {
+    if (!dest) {
+        return false;
+    }
+    if (dest->GetKind() == kindDestinationScrollTo) {
+        return true;
+    }
+    // TODO: possibly more kinds
+    return false;
+}
+
+// the engine that created dest might get closed, so we make a copy that
+// doesn't depend on it. pageNo is used if dest doesn't have a page number
+static IPageDestination* CloneDest(IPageDestination* dest, int pageNo) {
+    if (!dest) {
+        return nullptr;
+    }
+    Kind kind = dest->GetKind();
+    char* value = dest->GetValue();
+    if (kind == kindDestinationLaunchEmbedded || kind == kindDestinationAttachment) {
+        // value is the path of the file (with the stream number) and pageNo the number
+        // of the attachment. Attachments are loaded with EngineMultiLoadAttachment()
+        auto res = new PageDestination();
+        res->kind = kind;
+        res->pageNo = dest->GetPageNo();
+        res->rect = dest->GetRect();
+        res->value = str::Dup(value);
+        res->name = str::Dup(dest->GetName());
+        return res;
+    }
+    if (kind == kindDestinationLaunchFile) {
+        return value ? new PageDestinationFile(value) : nullptr;
+    }
+    if (value) {
+        return new PageDestinationURL(value);
+    }
+    if (dest->GetPageNo() > 0) {
+        pageNo = dest->GetPageNo();
+    }
+    if (pageNo <= 0) {
+        return nullptr;
+    }
+    auto res = (PageDestination*)NewSimpleDest(pageNo, dest->GetRect(), dest->GetZoom());
+    res->name = str::Dup(dest->GetName());
+    return res;
+}
+
+static IPageDestination* CloneTocDest(TocItem* ti) {
+    return CloneDest(ti->dest, ti->pageNo);
+}
+
+// pageNoAdd converts page numbers of the file to page numbers of EngineMulti
+static IPageElement* ClonePageElement(IPageElement* el, int pageNoAdd) {
+    IPageElement* res = nullptr;
+    Kind kind = el->GetKind();
+    if (kind == kindPageElementDest) {
+        // links without a page number (e.g. to a missing named destination) don't go anywhere
+        IPageDestination* dest = CloneDest(el->AsLink(), 0);
+        if (dest && IsPageNavigationDestination(dest)) {
+            dest->pageNo += pageNoAdd;
+        }
+        res = new PageElementDestination(dest);
+    } else if (kind == kindPageElementImage) {
+        auto img = new PageElementImage();
+        img->imageID = ((PageElementImage*)el)->imageID;
+        res = img;
+    } else if (kind == kindPageElementComment) {
+        res = new PageElementComment(((PageElementComment*)el)->comment);
+    } else {
+        res = new IPageElement();
+        res->kind = kind;
+    }
+    res->rect = el->rect;
+    res->pageNo = el->pageNo + pageNoAdd;
+    return res;
+}
+
+// the elements of an engine are freed when it's closed, so we return copies owned
+// by ei. They're the same as engine's elements, in the same order. pageNo is the
+// page number within the file, engine must be acquired
+Vec<IPageElement*> EngineMulti::GetElementCopies(EngineInfo* ei, EngineBase* engine, int pageNo) {
+    // e.g. EngineMupdf adds links detected in the text once it has been extracted
+    Vec<IPageElement*> els = engine->GetElements(pageNo);
+
+    ScopedCritSec cs(&enginesAccess);
+    if (ei->pageElements.isize() < ei->nPages) {
+        ei->pageElements.AppendBlanks(ei->nPages - ei->pageElements.isize());
+    }
+    PageElementCopies*& copies = ei->pageElements[pageNo - 1];
+    if (!copies) {
+        copies = new PageElementCopies();
+    } else if (copies->els.size() == els.size() && copies->startPageNo == ei->startPageNo) {
+        return copies->els;
+    }
+    for (IPageElement* el : copies->els) {
+        copies->replaced.Append(el);
+    }
+    copies->els.Reset();
+    copies->startPageNo = ei->startPageNo;
+    int pageNoAdd = ei->startPageNo - 1;
+    for (IPageElement* el : els) {
+        copies->els.Append(ClonePageElement(el, pageNoAdd));
+    }
+    return copies->els;
+}
+
 Vec<IPageElement*> EngineMulti::GetElements(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElements(pageNo);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return {};
+    }
+    return GetElementCopies(e.ei, e.engine, pageNo);
 }
 
 // don't delete the result
 IPageElement* EngineMulti::GetElementAtPos(int pageNo, PointF pt) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElementAtPos(pageNo, pt);
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    IPageElement* el = e->GetElementAtPos(pageNo, pt);
+    if (!el) {
+        return nullptr;
+    }
+    // return the copy of el
+    Vec<IPageElement*> els = e->GetElements(pageNo);
+    int idx = els.Find(el);
+    Vec<IPageElement*> copies = GetElementCopies(e.ei, e.engine, pageNo);
+    if (idx < 0 || idx >= copies.isize()) {
+        return nullptr;
+    }
+    return copies[idx];
 }
 
 RenderedBitmap* EngineMulti::GetImageForPageElement(IPageElement* ipel) {
     CrashIf(kindPageElementImage != ipel->GetKind());
     PageElementImage* pel = (PageElementImage*)ipel;
-    EngineBase* e = PageToEngine(pel->pageNo);
-    return e->GetImageForPageElement(pel);
+    int pageNo = pel->pageNo;
+    ScopedPageEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    // the engine expects an element with its own page number
+    PageElementImage el;
+    el.rect = pel->rect;
+    el.pageNo = pageNo;
+    el.imageID = pel->imageID;
+    return e->GetImageForPageElement(&el);
 }
 
 IPageDestination* EngineMulti::GetNamedDest(const char* name) {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        auto dest = e->GetNamedDest(name);
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->startPageNo == 0) {
+            continue;
+        }
+        EngineBase* e = AcquireEngine(ei);
+        if (!e) {
+            continue;
+        }
+        // the caller owns the result so it's fine if the engine gets closed
+        IPageDestination* dest = e->GetNamedDest(name);
+        ReleaseEngine(ei);
         if (dest) {
-            // TODO: fix up page number in returned destination
+            if (IsPageNavigationDestination(dest)) {
+                dest->pageNo += ei->startPageNo - 1;
+            }
             return dest;
         }
     }
     return nullptr;
 }
 
-static bool IsPageNavigationDestination(IPageDestination* dest) {
-    if (!dest) {
-        return false;
-    }
-    if (dest->GetKind() == kindDestinationScrollTo) {
-        return true;
-    }
-    // TODO: possibly more kinds
-    return false;
-}
-
 static void updateTocItemsPageNo(TocItem* ti, int nPageNoAdd, bool root) {
     if (nPageNoAdd == 0) {
         return;
@@ -224,21 +534,25 @@ TocTree* EngineMulti::GetToc() {
 }
 
 char* EngineMulti::GetPageLabel(int pageNo) const {
-    if (pageNo < 1 || pageNo >= pageCount) {
+    if (pageNo < 1 || pageNo > pageCount) {
         return nullptr;
     }
 
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetPageLabel(pageNo);
+    EngineInfo* ei = PageToEngine(pageNo);
+    if (ei->pageLabels.Size() == 0) {
+        return str::Format("%d", pageNo);
+    }
+    return str::Dup(ei->pageLabels.at(pageNo - 1));
 }
 
 int EngineMulti::GetPageByLabel(const char* label) const {
     for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        int pageNo = e->GetPageByLabel(label);
-        if (pageNo != -1) {
-            // TODO: fixup page number
-            return pageNo;
+        EngineInfo* ei = pe.ei;
+        int n = ei->pageLabels.Size();
+        for (int i = 0; i < n; i++) {
+            if (str::Eq(ei->pageLabels.at(i), label)) {
+                return pe.startPageNo + i;
+            }
         }
     }
     return -1;
@@ -278,7 +592,7 @@ static void CalcEndPageNo(TocItem* root, int nPages) {
 }
 #endif
 
-static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
+static TocItem* CloneTocItemRecur(TocItem* ti, TocItem* parent, bool removeUnchecked) {
     if (ti == nullptr) {
         return nullptr;
     }
@@ -287,10 +601,10 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
         while (next && next->isUnchecked) {
             next = next->next;
         }
-        return CloneTocItemRecur(next, removeUnchecked);
+        return CloneTocItemRecur(next, parent, removeUnchecked);
     }
     TocItem* res = new TocItem();
-    res->parent = ti->parent;
+    res->parent = parent;
     res->title = str::Dup(ti->title);
     res->isOpenDefault = ti->isOpenDefault;
     res->isOpenToggled = ti->isOpenToggled;
@@ -299,9 +613,8 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
     res->id = ti->id;
     res->fontFlags = ti->fontFlags;
     res->color = ti->color;
-    res->dest = ti->dest;
-    res->destNotOwned = true;
-    res->child = CloneTocItemRecur(ti->child, removeUnchecked);
+    res->dest = CloneTocDest(ti);
+    res->child = CloneTocItemRecur(ti->child, res, removeUnchecked);
 
     res->nPages = ti->nPages;
     res->engineFilePath = str::Dup(ti->engineFilePath);
@@ -312,54 +625,125 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
             next = next->next;
         }
     }
-    res->next = CloneTocItemRecur(next, removeUnchecked);
+    res->next = CloneTocItemRecur(next, parent, removeUnchecked);
     return res;
 }
 
+// all items of the file's ToC are (grand-)children of the wrapper, which
+// has the path of the file (see EngineMultiLoadAttachment)
 TocItem* CreateWrapperItem(EngineBase* engine) {
-    TocItem* tocFileRoot = nullptr;
+    int nPages = engine->PageCount();
+    const char* title = path::GetBaseNameTemp(engine->FilePath());
+    TocItem* tocWrapper = new TocItem(nullptr, title, 0);
+    tocWrapper->isOpenDefault = true;
     TocTree* tocTree = engine->GetToc();
     // it's ok if engine doesn't have toc
     if (tocTree) {
-        tocFileRoot = CloneTocItemRecur(tocTree->root, false);
+        tocWrapper->child = CloneTocItemRecur(tocTree->root, tocWrapper, false);
     }
-    int nPages = engine->PageCount();
-    const char* title = path::GetBaseNameTemp(engine->FilePath());
-    TocItem* tocWrapper = new TocItem(tocFileRoot, title, 0);
-    tocWrapper->isOpenDefault = true;
-    tocWrapper->child = tocFileRoot;
     char* filePath = (char*)engine->FilePath();
     tocWrapper->engineFilePath = str::Dup(filePath);
     tocWrapper->nPages = nPages;
     tocWrapper->pageNo = 1;
-    if (tocFileRoot) {
-        tocFileRoot->parent = tocWrapper;
-    }
     return tocWrapper;
 }
 
+// gets everything needed to show the pages of the file without having it open
+static EngineInfo* LoadEngineInfo(const char* path, bool keepOpen) {
+    EngineBase* engine = CreateEngineFromFile(path, nullptr, true);
+    if (!engine) {
+        return nullptr;
+    }
+    auto ei = new EngineInfo();
+    ei->path = str::Dup(path);
+    ei->nPages = engine->PageCount();
+    bool hasLabels = engine->HasPageLabels();
+    for (int i = 1; i <= ei->nPages; i++) {
+        ei->mediaboxes.Append(engine->PageMediabox(i));
+        if (hasLabels) {
+            AutoFreeStr label = engine->GetPageLabel(i);
+            ei->pageLabels.Append(label ? label.Get() : "");
+        }
+    }
+    ei->tocRoot = CreateWrapperItem(engine);
+    if (keepOpen) {
+        ei->engine = engine;
+    } else {
+        delete engine;
+    }
+    return ei;
+}
+
+struct OpenEnginesData {
+    StrVec* files = nullptr;
+    EngineInfo** infos = nullptr;
+    LONG nextIdx = -1;
+};
+
+static void OpenEngines(OpenEnginesData* d) {
+    int n = d->files->Size();
+    while (true) {
+        int i = (int)InterlockedIncrement(&d->nextIdx);
+        if (i >= n) {
+            break;
+        }
+        char* path = d->files->at(i);
+        d->infos[i] = LoadEngineInfo(path, i < kMaxOpenEngines);
+    }
+}
+
+static DWORD WINAPI OpenEnginesThread(void* data) {
+    OpenEngines((OpenEnginesData*)data);
+    DestroyTempAllocator();
+    return 0;
+}
+
+// opening is mostly parsing so we open files on several threads and
+// each thread takes the next file to open until all are opened
+static void OpenEnginesParallel(StrVec& files, EngineInfo** infos) {
+    int n = files.Size();
+    int nThreads = std::min(n, std::min(GetPhysicalProcessorCount(), MAXIMUM_WAIT_OBJECTS));
+    OpenEnginesData data;
+    data.files = &files;
+    data.infos = infos;
+    Vec<HANDLE> threads;
+    // the current thread also opens files
+    for (int i = 1; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, OpenEnginesThread, &data, 0, nullptr);
+        if (h) {
+            threads.Append(h);
+        }
+    }
+    OpenEngines(&data);
+    if (threads.size() > 0) {
+        WaitForMultipleObjects((DWORD)threads.size(), threads.LendData(), TRUE, INFINITE);
+    }
+    for (HANDLE h : threads) {
+        CloseHandle(h);
+    }
+}
+
 bool EngineMulti::LoadFromFiles(const char* dir, StrVec& files) {
     int n = files.Size();
+    EngineInfo** infos = AllocArray<EngineInfo*>(n);
+    OpenEnginesParallel(files, infos);
+
     TocItem* tocFiles = nullptr;
     for (int i = 0; i < n; i++) {
-        char* path = files.at(i);
-        EngineBase* engine = CreateEngineFromFile(path, nullptr, true);
-        if (!engine) {
+        EngineInfo* ei = infos[i];
+        if (!ei) {
             continue;
         }
 
-        TocItem* wrapper = CreateWrapperItem(engine);
+        TocItem* wrapper = ei->tocRoot;
         if (tocFiles == nullptr) {
             tocFiles = wrapper;
         } else {
             tocFiles->AddSiblingAtEnd(wrapper);
         }
-
-        EngineInfo ei;
-        ei.engine = engine;
-        ei.tocRoot = wrapper;
         enginesInfo.Append(ei);
     }
+    free(infos);
     if (tocFiles == nullptr) {
         return false;
     }
@@ -376,23 +760,24 @@ bool EngineMulti::LoadFromFiles(const char* dir, StrVec& files) {
     return true;
 }
 
-void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
+void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo*>& enginesInfo) {
     int nTotalPages = 0;
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
+    for (EngineInfo* ei : enginesInfo) {
+        ei->startPageNo = 0;
+        TocItem* root = ei->tocRoot;
         if (root->isUnchecked) {
             continue;
         }
-        int nPages = ei.engine->PageCount();
-        for (int i = 1; i <= nPages; i++) {
-            EnginePage ep{i, ei.engine};
+        int nPages = ei->nPages;
+        if (nPages > 0) {
+            ei->startPageNo = nTotalPages + 1;
+            EnginePages ep{ei->startPageNo, ei};
             pageToEngine.Append(ep);
         }
-        updateTocItemsPageNo(ei.tocRoot, nTotalPages, true);
+        updateTocItemsPageNo(ei->tocRoot, nTotalPages, true);
         nTotalPages += nPages;
     }
     pageCount = nTotalPages;
-    CrashIf((size_t)pageCount != pageToEngine.size());
 
     auto verifyPages = [&nTotalPages](TocItem* ti) -> bool {
         if (!IsPageNavigationDestination(ti->dest)) {
@@ -403,8 +788,8 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
         return true;
     };
 
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
+    for (EngineInfo* ei : enginesInfo) {
+        TocItem* root = ei->tocRoot;
         if (root->isUnchecked) {
             continue;
         }
@@ -412,6 +797,33 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
     }
 }
 
+// ti is the ToC item of the attachment, the file it's in is opened if necessary
+ByteSlice EngineMultiLoadAttachment(EngineBase* engine, TocItem* ti, int attachmentNo) {
+    EngineMulti* multi = (EngineMulti*)engine;
+    while (ti && !ti->engineFilePath) {
+        ti = ti->parent;
+    }
+    if (!ti) {
+        return {};
+    }
+    for (EngineInfo* ei : multi->enginesInfo) {
+        if (!str::Eq(ei->path, ti->engineFilePath)) {
+            continue;
+        }
+        EngineBase* e = multi->AcquireEngine(ei);
+        if (!e) {
+            return {};
+        }
+        ByteSlice res;
+        if (e->kind == kindEngineMupdf) {
+            res = EngineMupdfLoadAttachment(e, attachmentNo);
+        }
+        multi->ReleaseEngine(ei);
+        return res;
+    }
+    return {};
+}
+
 bool IsEngineMultiSupportedFileType(Kind kind) {
     return kind == kindDirectory;
 }
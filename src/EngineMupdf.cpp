@@ -9,6 +9,7 @@ extern "C" {
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/Dict.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
@@ -28,11 +29,19 @@ extern "C" {
 #include "EngineBase.h"
 #include "EngineMupdfImpl.h"
 #include "EngineAll.h"
+#include "FzGdiDevice.h"
 #include "EbookBase.h"
 #include "EbookDoc.h"
 
 #include "utils/Log.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 // A5
 static float layoutA5DxPt = 420.f;
 static float layoutA5DyPt = 595.f;
@@ -43,14 +52,46 @@ static float layoutA4DyPt = 842.f;
 
 static float layoutFontEm = 11.f;
 
+// anti-aliasing used for draft renders (see RenderPageArgs::draft), in bits (8 is best quality)
+constexpr int kDraftAaLevel = 2;
+
 // maximum size of a file that's entirely loaded into memory before parsed
 // and displayed; larger files will be kept open while they're displayed
 // so that their content can be loaded on demand in order to preserve memory
 constexpr i64 kMaxMemoryFileSize = 32 * 1024 * 1024;
+// files on network shares and removable drives are never loaded entirely
+// before being displayed, they're read on demand in chunks of that size
+// (fewer round trips than the 4 kB reads of fz_open_file_w)
+constexpr DWORD kSlowFileReadSize = 64 * 1024;
+
+// how much memory we allow cached page display lists to take
+// (per document). least recently used are evicted first
+constexpr size_t kMaxDisplayListsSize = 64 * 1024 * 1024;
+// rasterized page contents (without annotations) kept for re-compositing
+// tiles after annotation edits
+constexpr size_t kMaxContentTilesSize = 64 * 1024 * 1024;
+
+// how many pages are kept loaded (per document). Least recently used
+// pages above that are dropped and re-loaded when needed again
+constexpr int kMaxLoadedPages = 256;
+
+// reading mediaboxes of all pages touches most of the file, so for documents
+// with more pages they're read on a background thread after loading
+// (until then all pages are assumed to be as big as the first one)
+constexpr int kMinPagesForLazyMediaboxes = 4096;
+// how many mediaboxes the background thread reads before letting others use ctx
+constexpr int kMediaboxesPerLock = 256;
+// how many named destinations are resolved for the index before letting others use ctx
+constexpr int kNamedDestsPerLock = 64;
+
+// fonts and colorspaces used by that many pages at the start of the document
+// are parsed in the background after loading, so that rendering and scrolling
+// through them doesn't have to
+constexpr int kWarmUpPages = 16;
 
 // in mupdf_load_system_font.c
-extern "C" void drop_cached_fonts_for_ctx(fz_context*);
 extern "C" void pdf_install_load_system_font_funcs(fz_context* ctx);
+extern "C" void set_system_font_list_cache_path(const char* path);
 
 static AnnotationType AnnotationTypeFromPdfAnnot(enum pdf_annot_type tp) {
     return (AnnotationType)tp;
@@ -173,6 +214,20 @@ static int FzGetPageNo(fz_context* ctx, fz_document* doc, fz_link* link, fz_outl
     return pageNo;
 }
 
+// fz_load_outline() already resolves the destinations of outline items
+// so there's no need to re-resolve them (which can be slow for named destinations)
+static int FzGetOutlinePageNo(fz_context* ctx, fz_document* doc, fz_outline* outline) {
+    int pageNo = -1;
+    fz_var(pageNo);
+    fz_try(ctx) {
+        pageNo = fz_page_number_from_location(ctx, doc, outline->page);
+    }
+    fz_catch(ctx) {
+        pageNo = -1;
+    }
+    return pageNo + 1;
+}
+
 static IPageDestination* NewPageDestinationMupdf(fz_context* ctx, fz_document* doc, fz_link* link,
                                                  fz_outline* outline) {
     CrashIf(link && outline);
@@ -196,7 +251,11 @@ static IPageDestination* NewPageDestinationMupdf(fz_context* ctx, fz_document* d
 
     auto dest = new PageDestinationMupdf(link, outline);
     dest->rect = FzGetRectF(link, outline);
-    dest->pageNo = FzGetPageNo(ctx, doc, link, outline);
+    if (outline) {
+        dest->pageNo = FzGetOutlinePageNo(ctx, doc, outline);
+    } else {
+        dest->pageNo = FzGetPageNo(ctx, doc, link, nullptr);
+    }
     return dest;
 }
 
@@ -306,39 +365,146 @@ static WCHAR* PdfCleanStringInPlace(WCHAR* s) {
     return s;
 }
 
+// IStreams (from the shell, often backed by network or cloud storage) are
+// read in aligned blocks of that size, of which the most recently used are kept
+// so that PDF parsing seeking back and forth doesn't need a Read for every seek
+constexpr int kIStreamBlockSize = 64 * 1024;
+constexpr int kIStreamBlockCount = 8;
+// when blocks are read sequentially, up to that many are read at once
+constexpr int kIStreamMaxReadAhead = 4;
+
+struct istream_block {
+    i64 offset; // -1 if not in use
+    int len;
+    u32 lastUse;
+    u8 data[kIStreamBlockSize];
+};
+
 struct istream_filter {
     IStream* stream;
-    u8 buf[4096];
+    i64 size;
+    // current seek position of stream, -1 if unknown
+    i64 streamPos;
+    // offset of the block after the last one read from stream
+    i64 nextReadOffset;
+    int readAhead;
+    u32 useCount;
+    istream_block blocks[kIStreamBlockCount];
+    u8 readBuf[kIStreamBlockSize * kIStreamMaxReadAhead];
 };
 
+static istream_block* FindIStreamBlock(istream_filter* state, i64 offset) {
+    for (istream_block& block : state->blocks) {
+        if (block.offset == offset) {
+            block.lastUse = ++state->useCount;
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+static istream_block* GetLeastRecentlyUsedIStreamBlock(istream_filter* state) {
+    istream_block* res = &state->blocks[0];
+    for (istream_block& block : state->blocks) {
+        if (block.offset < 0) {
+            return &block;
+        }
+        if (block.lastUse < res->lastUse) {
+            res = &block;
+        }
+    }
+    return res;
+}
+
+// reads the block at offset (and, when reading sequentially, the blocks after it)
+static istream_block* ReadIStreamBlocks(fz_context* ctx, istream_filter* state, i64 offset) {
+    bool sequential = offset == state->nextReadOffset;
+    state->readAhead = sequential ? std::min(state->readAhead * 2, kIStreamMaxReadAhead) : 1;
+    i64 toRead = std::min((i64)state->readAhead * kIStreamBlockSize, state->size - offset);
+
+    if (state->streamPos != offset) {
+        LARGE_INTEGER off;
+        off.QuadPart = offset;
+        state->streamPos = -1;
+        HRESULT res = state->stream->Seek(off, STREAM_SEEK_SET, nullptr);
+        if (FAILED(res)) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
+        }
+        state->streamPos = offset;
+    }
+    // a stream might return less than asked for before its end
+    ULONG total = 0;
+    while (total < (ULONG)toRead) {
+        ULONG cbRead = 0;
+        HRESULT res = state->stream->Read(state->readBuf + total, (ULONG)toRead - total, &cbRead);
+        if (FAILED(res)) {
+            state->streamPos = -1;
+            fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error: %x", res);
+        }
+        if (cbRead == 0) {
+            break;
+        }
+        total += cbRead;
+    }
+    state->streamPos = offset + total;
+
+    istream_block* first = nullptr;
+    for (ULONG blockStart = 0; blockStart < total || !first; blockStart += kIStreamBlockSize) {
+        istream_block* block = FindIStreamBlock(state, offset + blockStart);
+        if (!block) {
+            block = GetLeastRecentlyUsedIStreamBlock(state);
+        }
+        block->offset = offset + blockStart;
+        block->len = (int)std::min(total - std::min(blockStart, total), (ULONG)kIStreamBlockSize);
+        memcpy(block->data, state->readBuf + blockStart, block->len);
+        block->lastUse = ++state->useCount;
+        if (!first) {
+            first = block;
+        }
+    }
+    // the first block must stay the most recently used
+    first->lastUse = ++state->useCount;
+    state->nextReadOffset = offset + ((total + kIStreamBlockSize - 1) / kIStreamBlockSize) * kIStreamBlockSize;
+    return first;
+}
+
 extern "C" int next_istream(fz_context* ctx, fz_stream* stm, __unused size_t max) {
     istream_filter* state = (istream_filter*)stm->state;
-    ULONG cbRead = sizeof(state->buf);
-    HRESULT res = state->stream->Read(state->buf, sizeof(state->buf), &cbRead);
-    if (FAILED(res)) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error: %x", res);
+    // after a seek or at the end of a block, stm->pos is where reading continues
+    i64 pos = stm->pos;
+    if (pos >= state->size) {
+        return EOF;
     }
-    stm->rp = state->buf;
-    stm->wp = stm->rp + cbRead;
-    stm->pos += cbRead;
+    i64 blockOffset = pos - (pos % kIStreamBlockSize);
+    istream_block* block = FindIStreamBlock(state, blockOffset);
+    if (!block) {
+        block = ReadIStreamBlocks(ctx, state, blockOffset);
+    }
+    if (pos >= block->offset + block->len) {
+        return EOF;
+    }
+    stm->rp = block->data + (pos - block->offset);
+    stm->wp = block->data + block->len;
+    stm->pos = block->offset + block->len;
 
-    return cbRead > 0 ? *stm->rp++ : EOF;
+    return *stm->rp++;
 }
 
 extern "C" void seek_istream(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
     istream_filter* state = (istream_filter*)stm->state;
-    LARGE_INTEGER off;
-    ULARGE_INTEGER n;
-    off.QuadPart = offset;
-    HRESULT res = state->stream->Seek(off, whence, &n);
-    if (FAILED(res)) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
+    if (whence == SEEK_CUR) {
+        offset += stm->pos - (stm->wp - stm->rp);
+    } else if (whence == SEEK_END) {
+        offset += state->size;
+    }
+    if (offset < 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: negative offset");
     }
-    if (n.HighPart != 0 || n.LowPart > INT_MAX) {
+    if (offset > INT_MAX) {
         fz_throw(ctx, FZ_ERROR_GENERIC, "documents beyond 2GB aren't supported");
     }
-    stm->pos = n.LowPart;
-    stm->rp = stm->wp = state->buf;
+    stm->pos = std::min(offset, state->size);
+    stm->rp = stm->wp = state->readBuf;
 }
 
 extern "C" void drop_istream(fz_context* ctx, void* state_) {
@@ -353,13 +519,24 @@ static fz_stream* FzOpenIStream(fz_context* ctx, IStream* stream) {
     }
 
     LARGE_INTEGER zero{};
-    HRESULT res = stream->Seek(zero, STREAM_SEEK_SET, nullptr);
+    ULARGE_INTEGER size;
+    HRESULT res = stream->Seek(zero, STREAM_SEEK_END, &size);
+    if (SUCCEEDED(res)) {
+        res = stream->Seek(zero, STREAM_SEEK_SET, nullptr);
+    }
     if (FAILED(res)) {
         fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
     }
 
     istream_filter* state = fz_malloc_struct(ctx, istream_filter);
     state->stream = stream;
+    state->size = (i64)size.QuadPart;
+    state->streamPos = 0;
+    state->nextReadOffset = 0;
+    state->readAhead = 1;
+    for (istream_block& block : state->blocks) {
+        block.offset = -1;
+    }
     stream->AddRef();
 
     fz_stream* stm = fz_new_stream(ctx, state, next_istream, drop_istream);
@@ -367,53 +544,122 @@ static fz_stream* FzOpenIStream(fz_context* ctx, IStream* stream) {
     return stm;
 }
 
-static void* FzMemdup(fz_context* ctx, void* p, size_t size) {
-    void* res = fz_malloc_no_throw(ctx, size);
-    if (!res) {
+struct winfile_filter {
+    HANDLE h;
+    u8 buf[kSlowFileReadSize];
+};
+
+extern "C" int next_winfile(fz_context* ctx, fz_stream* stm, __unused size_t max) {
+    winfile_filter* state = (winfile_filter*)stm->state;
+    DWORD cbRead = 0;
+    if (!ReadFile(state->h, state->buf, sizeof(state->buf), &cbRead, nullptr)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "file read error: %x", (uint)GetLastError());
+    }
+    stm->rp = state->buf;
+    stm->wp = stm->rp + cbRead;
+    stm->pos += cbRead;
+
+    return cbRead > 0 ? *stm->rp++ : EOF;
+}
+
+extern "C" void seek_winfile(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    winfile_filter* state = (winfile_filter*)stm->state;
+    LARGE_INTEGER off;
+    LARGE_INTEGER n;
+    off.QuadPart = offset;
+    // whence is SEEK_SET, SEEK_CUR or SEEK_END which match FILE_BEGIN etc.
+    if (!SetFilePointerEx(state->h, off, &n, (DWORD)whence)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "file seek error: %x", (uint)GetLastError());
+    }
+    stm->pos = n.QuadPart;
+    stm->rp = stm->wp = state->buf;
+}
+
+extern "C" void drop_winfile(fz_context* ctx, void* state_) {
+    winfile_filter* state = (winfile_filter*)state_;
+    CloseHandle(state->h);
+    fz_free(ctx, state);
+}
+
+// for files on slow drives: reads in bigger chunks and lets other programs
+// replace the file while it's open, like they can for files loaded into memory
+static fz_stream* FzOpenSlowFile(fz_context* ctx, const char* path) {
+    WCHAR* pathW = ToWstrTemp(path);
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open file %s", path);
+    }
+
+    winfile_filter* state = nullptr;
+    fz_try(ctx) {
+        state = fz_malloc_struct(ctx, winfile_filter);
+    }
+    fz_catch(ctx) {
+        CloseHandle(h);
+        fz_rethrow(ctx);
+    }
+    state->h = h;
+    fz_stream* stm = fz_new_stream(ctx, state, next_winfile, drop_winfile);
+    stm->seek = seek_winfile;
+    return stm;
+}
+
+// reads the file directly into a buffer allocated by libmupdf (so that
+// it can be freed across dll boundaries)
+static fz_stream* FzOpenMemoryFile(fz_context* ctx, const char* path, i64 fileSize) {
+    WCHAR* pathW = ToWstrTemp(path);
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
         return nullptr;
     }
-    memcpy(res, p, size);
-    return res;
+    DWORD size = (DWORD)fileSize;
+    u8* data = (u8*)fz_malloc_no_throw(ctx, size);
+    DWORD cbRead = 0;
+    bool ok = data && ReadFile(h, data, size, &cbRead, nullptr) && cbRead == size;
+    CloseHandle(h);
+    if (!ok) {
+        fz_free(ctx, data);
+        return nullptr;
+    }
+
+    fz_stream* stm = nullptr;
+    fz_buffer* buf = nullptr;
+    fz_var(buf);
+    fz_var(stm);
+    fz_try(ctx) {
+        buf = fz_new_buffer_from_data(ctx, data, size);
+        stm = fz_open_buffer(ctx, buf);
+    }
+    fz_always(ctx) {
+        fz_drop_buffer(ctx, buf);
+    }
+    fz_catch(ctx) {
+        // fz_new_buffer_from_data frees data if it fails
+        stm = nullptr;
+    }
+    return stm;
 }
 
 static fz_stream* FzOpenFile2(fz_context* ctx, const char* path) {
     fz_stream* stm = nullptr;
+    // on network shares reading the whole file first would delay
+    // showing the first page until all of it has been transferred
+    if (!path::IsOnFixedDrive(path)) {
+        return FzOpenSlowFile(ctx, path);
+    }
+
     i64 fileSize = file::GetSize(path);
     // load small files entirely into memory so that they can be
     // overwritten even by programs that don't open files with FILE_SHARE_READ
     if (fileSize > 0 && fileSize < kMaxMemoryFileSize) {
-        ByteSlice dataTmp = file::ReadFile(path);
-        if (dataTmp.empty()) {
-            // failed to read
-            return nullptr;
-        }
-
-        // TODO: we copy so that the memory ends up in chunk allocated
-        // by libmupdf so that it works across dll boundaries.
-        // We can either use  fz_new_buffer_from_shared_data
-        // and free the data on the side or create Allocator that
-        // uses fz_malloc_no_throw and pass it to ReadFileWithAllocator
-        size_t size = dataTmp.size();
-        void* data = FzMemdup(ctx, (void*)dataTmp.data(), size);
-        if (!data) {
-            return nullptr;
-        }
-        dataTmp.Free();
-
-        fz_buffer* buf = fz_new_buffer_from_data(ctx, (u8*)data, size);
-        fz_var(buf);
-        fz_try(ctx) {
-            stm = fz_open_buffer(ctx, buf);
-        }
-        fz_always(ctx) {
-            fz_drop_buffer(ctx, buf);
-        }
-        fz_catch(ctx) {
-            stm = nullptr;
-        }
-        return stm;
+        return FzOpenMemoryFile(ctx, path, fileSize);
     }
 
+    // big files are read on demand. They're not memory-mapped because a mapped
+    // file can't be truncated (e.g. when LaTeX rebuilds it or we save annotations
+    // to it) and an I/O error while reading mapped data crashes
     WCHAR* pathW = ToWstrTemp(path);
     fz_try(ctx) {
         stm = fz_open_file_w(ctx, pathW);
@@ -424,30 +670,28 @@ static fz_stream* FzOpenFile2(fz_context* ctx, const char* path) {
     return stm;
 }
 
+// MD5 of the whole stream, read in chunks so that big files don't have to fit in memory
 static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
-    i64 fileLen = -1;
-    fz_buffer* buf = nullptr;
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    u8* buf = AllocArray<u8>(64 * 1024);
+    AutoFree bufFree(buf);
 
     fz_try(ctx) {
-        fz_seek(ctx, stm, 0, 2);
-        fileLen = fz_tell(ctx, stm);
         fz_seek(ctx, stm, 0, 0);
-        buf = fz_read_all(ctx, stm, fileLen);
+        while (true) {
+            size_t n = fz_read(ctx, stm, buf, 64 * 1024);
+            if (n == 0) {
+                break;
+            }
+            fz_md5_update(&md5, buf, n);
+        }
     }
     fz_catch(ctx) {
         fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
         ZeroMemory(digest, 16);
         return;
     }
-    CrashIf(nullptr == buf);
-    u8* data;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    CrashIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
-
-    fz_md5 md5;
-    fz_md5_init(&md5);
-    fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
 }
 
@@ -488,8 +732,7 @@ static void AddChar(fz_stext_line* line, fz_stext_char* c, str::WStr& s, Vec<Rec
         tmp[0] = 0xD800 | ((c->c - 0x10000) >> 10) & 0x3FF;
         tmp[1] = 0xDC00 | (c->c - 0x10000) & 0x3FF;
         s.Append(tmp, 2);
-        rects.Append(r);
-        rects.Append(r);
+        rects.AppendN(r, 2);
         return;
     }
     WCHAR wc = c->c;
@@ -526,19 +769,34 @@ static void AddLineSep(str::WStr& s, Vec<Rect>& rects, const WCHAR* lineSep, siz
     }
 
     s.Append(lineSep);
-    for (size_t i = 0; i < lineSepLen; i++) {
-        rects.Append(Rect());
-    }
+    rects.AppendBlanks(lineSepLen);
 }
 
 static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
     const WCHAR* lineSep = L"\n";
 
     size_t lineSepLen = str::Len(lineSep);
-    str::WStr content;
+
+    // calculate the upper bound of the text size first so that
+    // the buffers are allocated only once
+    size_t maxLen = 0;
+    for (fz_stext_block* b = text->first_block; b; b = b->next) {
+        if (b->type != FZ_STEXT_BLOCK_TEXT) {
+            continue;
+        }
+        for (fz_stext_line* line = b->u.t.first_line; line; line = line->next) {
+            for (fz_stext_char* c = line->first_char; c; c = c->next) {
+                maxLen += WcharsPerRune(c->c);
+            }
+            maxLen += lineSepLen;
+        }
+    }
+
+    str::WStr content(maxLen + 1);
     // coordsOut is optional but we ask for it by default so we simplify the code
     // by always calculating it
     Vec<Rect> rects;
+    rects.Reserve(maxLen);
 
     fz_stext_block* block = text->first_block;
     while (block) {
@@ -614,12 +872,13 @@ static const WCHAR* LinkifyFindEnd(const WCHAR* start, WCHAR prevChar) {
         prev = end[-1];
     }
     // also ignore a closing parenthesis, if the URL doesn't contain any opening one
-    if (')' == prev && (!str::FindChar(start, '(') || str::FindChar(start, '(') >= end)) {
+    // (only search within the URL and not through the rest of the page text)
+    if (')' == prev && !wmemchr(start, '(', end - start)) {
         end--;
     }
 
     // cut the link at the first quotation mark, if it's also preceded by one
-    if (('"' == prevChar || '\'' == prevChar) && (quote = str::FindChar(start, prevChar)) != nullptr && quote < end) {
+    if (('"' == prevChar || '\'' == prevChar) && (quote = wmemchr(start, prevChar, end - start)) != nullptr) {
         end = quote;
     }
 
@@ -664,9 +923,10 @@ inline bool IsEmailDomainChar(WCHAR c) {
     return iswalnum(c) || '-' == c;
 }
 
-static const WCHAR* LinkifyFindEmail(const WCHAR* pageText, const WCHAR* at) {
+// scans back from the '@' but not past begin (the end of the previous link)
+static const WCHAR* LinkifyFindEmail(const WCHAR* begin, const WCHAR* at) {
     const WCHAR* start;
-    for (start = at; start > pageText && IsEmailUsernameChar(*(start - 1)); start--) {
+    for (start = at; start > begin && IsEmailUsernameChar(*(start - 1)); start--) {
         // do nothing
     }
     return start != at ? start : nullptr;
@@ -694,19 +954,60 @@ static const WCHAR* LinkifyEmailAddress(const WCHAR* start) {
     return end;
 }
 
+static inline bool IsLinkifyTrigger(WCHAR c) {
+    return 'h' == c || 'w' == c || 'm' == c || '@' == c;
+}
+
+// returns the first char at or after s that might start a link ('h'ttp, 'w'ww.,
+// 'm'ailto: or the '@' of an email address) or the terminating zero
+static const WCHAR* LinkifyFindTrigger(const WCHAR* s) {
+#if USE_SSE2
+    __m128i triggers[4] = {_mm_set1_epi16('h'), _mm_set1_epi16('w'), _mm_set1_epi16('m'), _mm_set1_epi16('@')};
+    __m128i zero = _mm_setzero_si128();
+#endif
+    for (;;) {
+#if USE_SSE2
+        // only load aligned blocks which can't cross into the next (possibly
+        // unmapped) memory page past the end of the string
+        if (((uintptr_t)s & 15) == 0) {
+            __m128i v = _mm_load_si128((const __m128i*)s);
+            __m128i m = _mm_cmpeq_epi16(v, zero);
+            for (__m128i& t : triggers) {
+                m = _mm_or_si128(m, _mm_cmpeq_epi16(v, t));
+            }
+            int mask = _mm_movemask_epi8(m);
+            if (mask == 0) {
+                s += 8;
+                continue;
+            }
+            unsigned long idx;
+            _BitScanForward(&idx, (unsigned long)mask);
+            return s + idx / 2;
+        }
+#endif
+        if (!*s || IsLinkifyTrigger(*s)) {
+            return s;
+        }
+        s++;
+    }
+}
+
+// a single pass over the text which only stops at chars that might start a link
 // caller needs to delete the result
 // TODO: return Vec<IPageElement*> directly
 static LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
     LinkRectList* list = new LinkRectList;
 
-    for (const WCHAR* start = pageText; *start; start++) {
+    // end of the last link, email addresses don't extend back before it
+    const WCHAR* prevEnd = pageText;
+    for (const WCHAR* start = LinkifyFindTrigger(pageText); *start; start = LinkifyFindTrigger(start + 1)) {
         const WCHAR* end = nullptr;
         bool multiline = false;
         const WCHAR* protocol = nullptr;
 
         if ('@' == *start) {
             // potential email address without mailto:
-            const WCHAR* email = LinkifyFindEmail(pageText, start);
+            const WCHAR* email = LinkifyFindEmail(prevEnd, start);
             end = email ? LinkifyEmailAddress(email) : nullptr;
             protocol = L"mailto:";
             if (end != nullptr) {
@@ -745,15 +1046,97 @@ static LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
         if (multiline) {
             end = LinkifyMultilineText(list, pageText, start, end + 1, coords);
         }
+        if (!*end) {
+            break;
+        }
 
+        // continue after the link (end is the first char not part of it)
         start = end;
+        prevEnd = end;
     }
 
     return list;
 }
 
+// maps RGB colors to palette index, open addressing
+constexpr int kPaletteHashSize = 1024; // must be a power of 2 much bigger than 256
+
+struct PaletteMap {
+    // 0 means an empty slot, keys have the (otherwise unused) top byte set
+    u32 keys[kPaletteHashSize];
+    u8 idxs[kPaletteHashSize];
+    int n = 0;
+
+    PaletteMap() {
+        memset(keys, 0, sizeof(keys));
+    }
+};
+
+// returns index of color c in the palette, adding it if necessary
+// returns -1 if palette is full (has 256 colors)
+static inline int PaletteIndex(PaletteMap& m, u32* palette, u32 c) {
+    u32 key = c | 0xff000000;
+    u32 h = (key * 2654435761u) >> 22; // top 10 bits
+    for (;;) {
+        u32 k = m.keys[h];
+        if (k == key) {
+            return m.idxs[h];
+        }
+        if (k == 0) {
+            if (m.n == 256) {
+                return -1;
+            }
+            m.keys[h] = key;
+            m.idxs[h] = (u8)m.n;
+            palette[m.n] = c;
+            return m.n++;
+        }
+        h = (h + 1) & (kPaletteHashSize - 1);
+    }
+}
+
+static inline u32 PixelToRGBQuad(const u8* s, bool isBgr) {
+    RGBQUAD c;
+    if (isBgr) {
+        c.rgbBlue = s[0];
+        c.rgbGreen = s[1];
+        c.rgbRed = s[2];
+    } else {
+        c.rgbRed = s[0];
+        c.rgbGreen = s[1];
+        c.rgbBlue = s[2];
+    }
+    c.rgbReserved = 0;
+    return *(u32*)&c;
+}
+
+// check a sample of pixels to cheaply reject pages with many colors
+// (anti-aliased text, photos) before doing a full pass
+static bool MightFitInPalette(fz_pixmap* pixmap, bool isBgr) {
+    constexpr size_t kMaxSamples = 4096;
+    size_t nPixels = (size_t)pixmap->w * (size_t)pixmap->h;
+    if (nPixels <= kMaxSamples * 4) {
+        return true;
+    }
+    size_t step = nPixels / kMaxSamples;
+    u32 palette[256];
+    PaletteMap m;
+    const u8* samples = pixmap->samples;
+    for (size_t i = 0; i < nPixels; i += step) {
+        if (PaletteIndex(m, palette, PixelToRGBQuad(samples + i * 4, isBgr)) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
+// pixmap must be RGBA or, if isBgr is true, BGRA
+static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap, bool isBgr) {
+    if (!MightFitInPalette(pixmap, isBgr)) {
+        return nullptr;
+    }
+
     int w = pixmap->w;
     int h = pixmap->h;
     int rows8 = ((w + 3) / 4) * 4;
@@ -767,44 +1150,55 @@ static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
     u8* dest = bmpData;
     u8* source = pixmap->samples;
     u32* palette = (u32*)bmi.Get()->bmiColors;
-    u8 grayIdxs[256]{};
+    PaletteMap m;
+
+    // most pixels have the color of the previous one (e.g. the background)
+    // so we only look up the palette index when the color changes.
+    // alpha is the top byte for both RGBA and BGRA
+    constexpr u32 kColorMask = 0x00ffffff;
+    u32 prevColor = 0;
+    int prevK = -1;
+#if USE_SSE2
+    __m128i colorMask = _mm_set1_epi32((int)kColorMask);
+    __m128i prevColors = _mm_setzero_si128();
+#endif
 
-    int paletteSize = 0;
-    RGBQUAD c;
     for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
-
-            /* find this color in the palette */
-            int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
-            if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(u32*)&c ? grayIdxs[c.rgbRed] : paletteSize;
-            } else {
-                for (k = 0; k < paletteSize && palette[k] != *(u32*)&c; k++) {
-                    ;
+        int i = 0;
+        while (i < w) {
+#if USE_SSE2
+            // 4 pixels at a time while they have the previous color
+            if (prevK >= 0 && i + 4 <= w) {
+                __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)source), colorMask);
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, prevColors)) == 0xFFFF) {
+                    memset(dest, prevK, 4);
+                    dest += 4;
+                    source += 16;
+                    i += 4;
+                    continue;
                 }
             }
-            /* add it to the palette if it isn't in there and if there's still space left */
-            if (k == paletteSize) {
-                if (++paletteSize > 256) {
+#endif
+            u32 color = *(const u32*)source & kColorMask;
+            if (prevK < 0 || color != prevColor) {
+                prevK = PaletteIndex(m, palette, PixelToRGBQuad(source, isBgr));
+                if (prevK < 0) {
                     free(bmpData);
                     return nullptr;
                 }
-                if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
-                }
-                palette[k] = *(u32*)&c;
+                prevColor = color;
+#if USE_SSE2
+                prevColors = _mm_set1_epi32((int)color);
+#endif
             }
+            source += 4;
             /* 8-bit data consists of indices into the color palette */
-            *dest++ = k;
+            *dest++ = (u8)prevK;
+            i++;
         }
         dest += rows8 - w;
     }
+    int paletteSize = m.n;
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
@@ -862,7 +1256,7 @@ static fz_pixmap* FzConvertPixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspac
 
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
-        RenderedBitmap* res = TryRenderAsPaletteImage(pixmap);
+        RenderedBitmap* res = TryRenderAsPaletteImage(pixmap, false);
         if (res) {
             return res;
         }
@@ -928,101 +1322,334 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
-static TocItem* NewTocItemWithDestination(TocItem* parent, char* title, IPageDestination* dest) {
-    auto res = new TocItem(parent, title, 0);
-    res->dest = dest;
-    return res;
+// gives the DIB section of FzNewDIBPixmap() back to the pool
+static void ReleaseDIBPixmap(HBITMAP hbmp, HANDLE hMap, Size size) {
+    if (!ReleasePooledMemoryBitmap(hbmp, hMap, size)) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+    }
 }
 
-// don't delete the result
-NO_INLINE static IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
-    if (!pageInfo) {
+// creates a top-down 32-bit DIB section and wraps its memory as a BGRA fz_pixmap
+// so that fitz renders directly into memory usable by GDI (no conversion and copy)
+// the caller owns hbmpOut and hMapOut, the pixmap doesn't free its samples
+static fz_pixmap* FzNewDIBPixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut) {
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    if (w <= 0 || h <= 0) {
         return nullptr;
     }
-    Vec<IPageElement*> res;
-
-    for (auto pel : pageInfo->links) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
-    }
-
-    for (auto* pel : pageInfo->autoLinks) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
+    size_t imgSize = (size_t)w * 4 * (size_t)h;
+    if (imgSize > (size_t)INT_MAX) {
+        return nullptr;
     }
 
-    for (auto* pel : pageInfo->comments) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
+    // tiles of the same size are rendered over and over while scrolling
+    HANDLE hMap = nullptr;
+    void* data = nullptr;
+    HBITMAP hbmp = NewPooledMemoryBitmap(Size(w, h), &hMap, &data);
+    if (!hbmp) {
+        return nullptr;
     }
 
-    size_t imageIdx = 0;
-    fz_point p = {(float)pt.x, (float)pt.y};
-    for (auto& img : pageInfo->images) {
-        fz_rect ir = img->rect;
-        if (IsPointInRect(ir, p)) {
-            res.Append(img->imageElement);
-        }
-        imageIdx++;
+    fz_pixmap* pix = nullptr;
+    fz_var(pix);
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, nullptr, 1, (u8*)data);
     }
-    if (res.IsEmpty()) {
+    fz_catch(ctx) {
+        ReleaseDIBPixmap(hbmp, hMap, Size(w, h));
         return nullptr;
     }
-    return res[0];
+    *hbmpOut = hbmp;
+    *hMapOut = hMap;
+    return pix;
 }
 
-static void BuildGetElementsInfo(FzPageInfo* pageInfo) {
-    if (!pageInfo || pageInfo->gotAllElements) {
-        return;
-    }
-    pageInfo->gotAllElements = true;
-    auto& els = pageInfo->allElements;
-
-    // since all elements lists are in last-to-first order, append
-    // item types in inverse order and reverse the whole list at the end
-    size_t imageIdx = 0;
-    for (auto& img : pageInfo->images) {
-        auto image = img->imageElement;
-        els.Append(image);
-        imageIdx++;
+// 8-bit DIB with a gray palette (for pages without color, a quarter of the
+// memory of 32-bit) or 1-bit black and white DIB (for bilevel scans, 1/32)
+static HBITMAP NewGrayDIBSection(int w, int h, int bitCount, HANDLE* hMapOut, void** dataOut) {
+    size_t stride = (((size_t)w * bitCount + 31) / 32) * 4;
+    size_t imgSize = stride * (size_t)h;
+    if (w <= 0 || h <= 0 || imgSize > (size_t)INT_MAX) {
+        return nullptr;
     }
 
-    for (auto& pel : pageInfo->links) {
-        els.Append(pel);
+    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
+    if (!bmi.Get()) {
+        return nullptr;
     }
-
-    for (auto& pel : pageInfo->autoLinks) {
-        els.Append(pel);
+    int nColors = 1 << bitCount;
+    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = w;
+    bmih->biHeight = -h;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = (WORD)bitCount;
+    bmih->biSizeImage = (DWORD)imgSize;
+    bmih->biClrUsed = nColors;
+    for (int i = 0; i < nColors; i++) {
+        u8 v = (u8)(i * 255 / (nColors - 1));
+        bmi.Get()->bmiColors[i] = {v, v, v, 0};
     }
 
-    for (auto& comment : pageInfo->comments) {
-        els.Append(comment);
+    HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)imgSize, nullptr);
+    void* data = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp || !data) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
     }
-    els.Reverse();
+    *hMapOut = hMap;
+    *dataOut = data;
+    return hbmp;
 }
 
-static void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
-    if (!pageInfo || !stext) {
-        return;
+// like FzNewDIBPixmap() but for rendering in gray
+static fz_pixmap* FzNewGrayDIBPixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut) {
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    HANDLE hMap = nullptr;
+    void* data = nullptr;
+    HBITMAP hbmp = NewGrayDIBSection(w, h, 8, &hMap, &data);
+    if (!hbmp) {
+        return nullptr;
     }
 
-    Rect* coords;
-    WCHAR* pageText = FzTextPageToStr(stext, &coords);
-    if (!pageText) {
-        return;
+    fz_pixmap* pix = nullptr;
+    fz_var(pix);
+    fz_try(ctx) {
+        // rows of DIBs are padded to 4 bytes
+        int stride = ((w + 3) / 4) * 4;
+        pix = fz_new_pixmap_with_data(ctx, fz_device_gray(ctx), w, h, nullptr, 0, stride, (u8*)data);
+        pix->x = bbox.x0;
+        pix->y = bbox.y0;
+    }
+    fz_catch(ctx) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    *hbmpOut = hbmp;
+    *hMapOut = hMap;
+    return pix;
+}
+
+// scanned black and white pages rendered without scaling them down only have
+// pure black and white pixels, which fit in 1 bit. pix must be 8-bit gray
+static RenderedBitmap* TryRenderAsBilevelImage(fz_pixmap* pix) {
+    int w = pix->w;
+    int h = pix->h;
+    for (int y = 0; y < h; y++) {
+        u8* src = pix->samples + (size_t)y * pix->stride;
+        for (int x = 0; x < w; x++) {
+            if (src[x] != 0 && src[x] != 0xff) {
+                return nullptr;
+            }
+        }
+    }
+
+    HANDLE hMap = nullptr;
+    void* data = nullptr;
+    HBITMAP hbmp = NewGrayDIBSection(w, h, 1, &hMap, &data);
+    if (!hbmp) {
+        return nullptr;
+    }
+    size_t stride = (((size_t)w + 31) / 32) * 4;
+    for (int y = 0; y < h; y++) {
+        u8* src = pix->samples + (size_t)y * pix->stride;
+        u8* dst = (u8*)data + (size_t)y * stride;
+        memset(dst, 0, stride);
+        for (int x = 0; x < w; x++) {
+            if (src[x]) {
+                dst[x >> 3] |= 0x80 >> (x & 7);
+            }
+        }
+    }
+    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+}
+
+// checks (once per page) whether the page can be rendered in gray
+// without losing anything, e.g. for text documents and gray scans
+static bool HasOnlyGrayContent(fz_context* ctx, fz_display_list* list) {
+    int isColor = 0;
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        // without a passthrough device, the list stops running at the first color
+        dev = fz_new_test_device(ctx, &isColor, 0.01f, FZ_TEST_OPT_IMAGES | FZ_TEST_OPT_SHADINGS, nullptr);
+        fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, nullptr);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        return false;
+    }
+    return !isColor;
+}
+
+static TocItem* NewTocItemWithDestination(TocItem* parent, char* title, IPageDestination* dest) {
+    auto res = new TocItem(parent, title, 0);
+    res->dest = dest;
+    return res;
+}
+
+static int GridCellX(const FzElementsGrid& grid, float x) {
+    int col = (int)((x - grid.bounds.x) * grid.cols / grid.bounds.dx);
+    return std::clamp(col, 0, grid.cols - 1);
+}
+
+static int GridCellY(const FzElementsGrid& grid, float y) {
+    int row = (int)((y - grid.bounds.y) * grid.rows / grid.bounds.dy);
+    return std::clamp(row, 0, grid.rows - 1);
+}
+
+static void AddToElementsGrid(FzElementsGrid& grid, IPageElement* el, RectF rect) {
+    if (rect.IsEmpty()) {
+        return;
+    }
+    grid.elements.Append(el);
+    grid.rects.Append(rect);
+    grid.bounds = grid.bounds.IsEmpty() ? rect : grid.bounds.Union(rect);
+}
+
+// buckets the elements into roughly one cell per element (for pages
+// with few elements, it's a single cell i.e. a linear scan)
+static void BuildElementsGrid(FzPageInfo* pageInfo) {
+    FzElementsGrid& grid = pageInfo->elementsGrid;
+    grid = FzElementsGrid();
+    // same precedence as the lists had when they were scanned one after the other
+    for (auto* pel : pageInfo->links) {
+        AddToElementsGrid(grid, pel, pel->GetRect());
+    }
+    for (auto* pel : pageInfo->autoLinks) {
+        AddToElementsGrid(grid, pel, pel->GetRect());
+    }
+    for (auto* pel : pageInfo->comments) {
+        AddToElementsGrid(grid, pel, pel->GetRect());
+    }
+    for (auto& img : pageInfo->images) {
+        AddToElementsGrid(grid, img->imageElement, ToRectF(img->rect));
+    }
+    int n = grid.elements.isize();
+    if (n == 0) {
+        return;
+    }
+
+    float aspect = grid.bounds.dx / grid.bounds.dy;
+    grid.cols = std::clamp((int)sqrtf((float)n * aspect), 1, 64);
+    grid.rows = std::clamp((int)sqrtf((float)n / aspect), 1, 64);
+    int nCells = grid.cols * grid.rows;
+
+    // count the elements of each cell, then fill them in
+    Vec<int> counts;
+    counts.AppendBlanks(nCells);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < n; i++) {
+            RectF r = grid.rects[i];
+            int col0 = GridCellX(grid, r.x), col1 = GridCellX(grid, r.x + r.dx);
+            int row0 = GridCellY(grid, r.y), row1 = GridCellY(grid, r.y + r.dy);
+            for (int row = row0; row <= row1; row++) {
+                for (int col = col0; col <= col1; col++) {
+                    int cell = row * grid.cols + col;
+                    if (pass == 0) {
+                        counts[cell]++;
+                    } else {
+                        grid.cellElements[counts[cell]++] = i;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            int total = 0;
+            grid.cellStart.AppendBlanks(nCells + 1);
+            for (int cell = 0; cell < nCells; cell++) {
+                grid.cellStart[cell] = total;
+                total += counts[cell];
+                counts[cell] = grid.cellStart[cell];
+            }
+            grid.cellStart[nCells] = total;
+            grid.cellElements.AppendBlanks(total);
+        }
+    }
+}
+
+static void BuildGetElementsInfo(FzPageInfo* pageInfo) {
+    if (!pageInfo || pageInfo->gotAllElements) {
+        return;
+    }
+    pageInfo->gotAllElements = true;
+    auto& els = pageInfo->allElements;
+    els.Reset();
+
+    // since all elements lists are in last-to-first order, append
+    // item types in inverse order and reverse the whole list at the end
+    for (auto& img : pageInfo->images) {
+        auto image = img->imageElement;
+        els.Append(image);
+    }
+
+    for (auto& pel : pageInfo->links) {
+        els.Append(pel);
+    }
+
+    for (auto& pel : pageInfo->autoLinks) {
+        els.Append(pel);
+    }
+
+    for (auto& comment : pageInfo->comments) {
+        els.Append(comment);
+    }
+    els.Reverse();
+
+    BuildElementsGrid(pageInfo);
+}
+
+// don't delete the result
+NO_INLINE static IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
+    if (!pageInfo) {
+        return nullptr;
+    }
+    BuildGetElementsInfo(pageInfo);
+
+    const FzElementsGrid& grid = pageInfo->elementsGrid;
+    if (grid.elements.IsEmpty() || !grid.bounds.Contains(pt)) {
+        return nullptr;
+    }
+    int cell = GridCellY(grid, pt.y) * grid.cols + GridCellX(grid, pt.x);
+    // indexes in a cell are in ascending order i.e. in order of precedence
+    for (int i = grid.cellStart[cell]; i < grid.cellStart[cell + 1]; i++) {
+        int idx = grid.cellElements[i];
+        if (grid.rects[idx].Contains(pt)) {
+            return grid.elements[idx];
+        }
+    }
+    return nullptr;
+}
+
+static void FzLinkifyPageText(FzPageInfo* pageInfo, const WCHAR* pageText, Rect* coords) {
+    if (!pageInfo || !pageText) {
+        return;
     }
 
     LinkRectList* list = LinkifyText(pageText, coords);
-    free(pageText);
 
     for (size_t i = 0; i < list->links.size(); i++) {
         fz_rect bbox = list->coords.at(i);
         bool overlaps = false;
         for (auto pel : pageInfo->links) {
             overlaps = FzRectOverlap(bbox, pel->GetRect()) >= 0.25f;
+            if (overlaps) {
+                break;
+            }
         }
         if (overlaps) {
             continue;
@@ -1040,7 +1667,6 @@ static void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
         pageInfo->autoLinks.Append(pel);
     }
     delete list;
-    free(coords);
 }
 
 static void FzFindImagePositions(fz_context* ctx, int pageNo, Vec<FitzPageImageInfo*>& images, fz_stext_page* stext) {
@@ -1403,7 +2029,7 @@ static void fz_print_cb(void* user, const char* msg) {
     if (!str::EndsWith(msg, "\n")) {
         msg = str::JoinTemp(msg, "\n");
     }
-    log(msg);
+    logThrottled(msg);
 }
 
 static void InstallFitzErrorCallbacks(fz_context* ctx) {
@@ -1411,7 +2037,115 @@ static void InstallFitzErrorCallbacks(fz_context* ctx) {
     fz_set_error_callback(ctx, fz_print_cb, nullptr);
 }
 
-EngineMupdf::EngineMupdf() {
+// all documents share a budget for the memory fitz uses for caching fonts,
+// decoded images etc. The one being viewed gets half of it, the others split the rest
+constexpr size_t kMinStoreSize = 16 * 1024 * 1024;
+
+struct StoreBudget {
+    CRITICAL_SECTION access;
+    Vec<EngineMupdf*> engines;
+    EngineMupdf* foreground = nullptr;
+    size_t total = 0;
+
+    StoreBudget() {
+        InitializeCriticalSection(&access);
+    }
+};
+
+// engines are created on multiple threads, a function static is initialized thread-safely
+static StoreBudget& GetStoreBudget() {
+    static StoreBudget budget;
+    return budget;
+}
+
+// based on the amount of physical memory
+static size_t CalcStoreBudget() {
+    constexpr size_t kMB = 1024 * 1024;
+    u64 size = FZ_STORE_DEFAULT;
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) {
+        size = ms.ullTotalPhys / 16;
+    }
+    // 32-bit processes are constrained by address space
+    u64 maxSize = IsProcess64() ? 1024 * kMB : 384 * kMB;
+    size = std::clamp(size, (u64)FZ_STORE_DEFAULT, maxSize);
+    return (size_t)size;
+}
+
+// must be called with StoreBudget::access held
+static void DistributeStoreBudget(StoreBudget& budget) {
+    int n = budget.engines.Size();
+    if (n == 0) {
+        return;
+    }
+    if (budget.total == 0) {
+        budget.total = CalcStoreBudget();
+    }
+    bool hasForeground = budget.foreground != nullptr;
+    size_t foregroundSize = budget.total / n;
+    size_t backgroundSize = foregroundSize;
+    if (hasForeground && n > 1) {
+        foregroundSize = budget.total / 2;
+        backgroundSize = budget.total / 2 / (n - 1);
+    } else if (hasForeground) {
+        foregroundSize = budget.total;
+    }
+    backgroundSize = std::max(backgroundSize, kMinStoreSize);
+    for (EngineMupdf* e : budget.engines) {
+        size_t size = e == budget.foreground ? foregroundSize : backgroundSize;
+        fz_set_store_max(e->ctx, size);
+    }
+}
+
+static void AddToStoreBudget(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.access);
+    budget.engines.Append(e);
+    DistributeStoreBudget(budget);
+}
+
+static void RemoveFromStoreBudget(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.access);
+    budget.engines.Remove(e);
+    if (budget.foreground == e) {
+        budget.foreground = nullptr;
+    }
+    DistributeStoreBudget(budget);
+}
+
+void SetEngineMupdfForeground(EngineBase* engine) {
+    EngineMupdf* e = AsEngineMupdf(engine);
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.access);
+    if (e && !e->inStoreBudget) {
+        e = nullptr;
+    }
+    if (budget.foreground == e) {
+        return;
+    }
+    budget.foreground = e;
+    DistributeStoreBudget(budget);
+}
+
+// the caller must free()
+char* EngineMupdfGetStoreStats(EngineBase* engine) {
+    EngineMupdf* e = AsEngineMupdf(engine);
+    if (!e) {
+        return nullptr;
+    }
+    fz_store_stats stats;
+    fz_get_store_stats(e->ctx, &stats);
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.access);
+    constexpr float kMB = 1024.f * 1024.f;
+    return str::Format("store: %.1f of %.1f MB, %d items, %d hits, %d misses, %d evictions (%d documents, %.0f MB budget)",
+                       (float)stats.size / kMB, (float)stats.max / kMB, stats.items, (int)stats.hits,
+                       (int)stats.misses, (int)stats.evictions, budget.engines.Size(), (float)budget.total / kMB);
+}
+
+EngineMupdf::EngineMupdf(size_t maxStoreSize) {
     kind = kindEngineMupdf;
     defaultExt = str::Dup(".pdf");
     fileDPI = 72.0f;
@@ -1420,19 +2154,68 @@ EngineMupdf::EngineMupdf() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&docAccess);
+    InitializeCriticalSection(&contentTilesAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = fz_new_context(nullptr, &fz_locks_ctx, maxStoreSize);
     InstallFitzErrorCallbacks(ctx);
 
     pdf_install_load_system_font_funcs(ctx);
     fz_register_document_handlers(ctx);
+
+    if (ctx && maxStoreSize == FZ_STORE_DEFAULT) {
+        inStoreBudget = true;
+        AddToStoreBudget(this);
+    }
 }
 
 EngineMupdf::~EngineMupdf() {
+    if (inStoreBudget) {
+        RemoveFromStoreBudget(this);
+    }
+    if (mediaboxThread) {
+        EnterCriticalSection(ctxAccess);
+        abortMediaboxes = true;
+        LeaveCriticalSection(ctxAccess);
+        WaitForSingleObject(mediaboxThread, INFINITE);
+        CloseHandle(mediaboxThread);
+    }
+    if (warmUpThread) {
+        EnterCriticalSection(ctxAccess);
+        abortWarmUp = true;
+        LeaveCriticalSection(ctxAccess);
+        WaitForSingleObject(warmUpThread, INFINITE);
+        CloseHandle(warmUpThread);
+    }
+    if (fontListThread) {
+        EnterCriticalSection(ctxAccess);
+        abortFontList = true;
+        LeaveCriticalSection(ctxAccess);
+        WaitForSingleObject(fontListThread, INFINITE);
+        CloseHandle(fontListThread);
+    }
+    str::Free(fontListCache);
+    if (tocThread) {
+        EnterCriticalSection(ctxAccess);
+        abortToc = true;
+        LeaveCriticalSection(ctxAccess);
+        WaitForSingleObject(tocThread, INFINITE);
+        CloseHandle(tocThread);
+    }
+    if (indexThread) {
+        EnterCriticalSection(ctxAccess);
+        abortIndexes = true;
+        LeaveCriticalSection(ctxAccess);
+        WaitForSingleObject(indexThread, INFINITE);
+        CloseHandle(indexThread);
+    }
+    delete pageLabelsIndex;
+    delete namedDestsIndex;
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
@@ -1449,6 +2232,10 @@ EngineMupdf::~EngineMupdf() {
         if (pi->page) {
             fz_drop_page(ctx, pi->page);
         }
+        fz_drop_display_list(ctx, pi->list);
+        fz_drop_display_list(ctx, pi->contentsList);
+        fz_drop_display_list(ctx, pi->annotsList);
+        FreePageText(&pi->text);
     }
 
     fz_drop_outline(ctx, outline);
@@ -1457,21 +2244,29 @@ EngineMupdf::~EngineMupdf() {
     if (pdfInfo) {
         pdf_drop_obj(ctx, pdfInfo);
     }
+    for (pdf_obj* font : warmUpFonts) {
+        pdf_drop_obj(ctx, font);
+    }
 
     if (pdfdoc) {
         pdf_drop_page_tree(ctx, pdfdoc);
     }
 
+    for (FzContentTile& tile : contentTiles) {
+        fz_drop_pixmap(ctx, tile.pix);
+    }
+    DeleteCriticalSection(&contentTilesAccess);
+
     fz_drop_document(ctx, _doc);
-    drop_cached_fonts_for_ctx(ctx);
     fz_drop_context(ctx);
 
     delete pageLabels;
     delete tocTree;
     DeleteVecMembers(pages);
 
+    LeaveCriticalSection(&docAccess);
+    DeleteCriticalSection(&docAccess);
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
     LeaveCriticalSection(&pagesAccess);
@@ -1495,11 +2290,17 @@ class PasswordCloner : public PasswordUI {
 };
 
 EngineBase* EngineMupdf::Clone() {
-    ScopedCritSec scope(ctxAccess);
     if (!FilePath()) {
         // before port we could clone streams but it's no longer possible
         return nullptr;
     }
+    // clones are used for printing and for saving as PDF on a background
+    // thread, which need the real page sizes.
+    // Wait before taking ctxAccess, which mediaboxThread needs
+    if (mediaboxThread) {
+        WaitForSingleObject(mediaboxThread, INFINITE);
+    }
+    ScopedCritSec scope(ctxAccess);
 
     // use this document's encryption key (if any) to load the clone
     PasswordCloner* pwdUI = nullptr;
@@ -1510,13 +2311,20 @@ EngineBase* EngineMupdf::Clone() {
     }
 
     EngineMupdf* clone = new EngineMupdf();
+    // the clone takes the page sizes and labels from this engine instead of reading them again
+    clone->cloneOf = this;
     bool ok = clone->Load(FilePath(), pwdUI);
+    clone->cloneOf = nullptr;
     if (!ok) {
         delete clone;
         delete pwdUI;
         return nullptr;
     }
     delete pwdUI;
+    if (clone->mediaboxThread) {
+        WaitForSingleObject(clone->mediaboxThread, INFINITE);
+        clone->UpdatePageSizes();
+    }
 
     if (!decryptionKey && pdfdoc && pdfdoc->crypt) {
         free(clone->decryptionKey);
@@ -1684,6 +2492,8 @@ bool EngineMupdf::Load(const char* path, PasswordUI* pwdUI) {
     }
 
     fz_stream* file = nullptr;
+    loadedFileTime = file::GetModificationTime(fnCopy);
+    loadedFileSize = file::GetSize(fnCopy);
 
     fz_var(file);
     fz_try(ctx) {
@@ -2001,6 +2811,151 @@ static void FinishNonPDFLoading(EngineMupdf* e) {
     }
 }
 
+// this does the job of pdf_bound_page but without doing pdf_load_page()
+// returns an empty rect if the page object is broken
+static fz_rect PdfPageObjMediabox(fz_context* ctx, pdf_document* doc, int objNo) {
+    fz_rect mbox{};
+    fz_matrix page_ctm{};
+    pdf_obj* pageref = nullptr;
+    fz_var(pageref);
+    fz_var(mbox);
+    fz_try(ctx) {
+        pageref = pdf_load_object(ctx, doc, objNo);
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj(ctx, pageref);
+    }
+    fz_catch(ctx) {
+        mbox = {};
+    }
+    return mbox;
+}
+
+static DWORD WINAPI ReadMediaboxesThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    e->ReadMediaboxes();
+    return 0;
+}
+
+// sets the mediaboxes of all pages to the first page's and starts
+// reading the real ones in the background
+// must be called with ctxAccess held
+bool EngineMupdf::StartReadingMediaboxes() {
+    pdf_rev_page_map* map = pdfdoc->rev_page_map;
+    for (int i = 0; i < pageCount; i++) {
+        if (map[i].page < 0 || map[i].page >= pageCount) {
+            // corrupted file
+            return false;
+        }
+    }
+    fz_rect mbox{};
+    fz_var(mbox);
+    fz_try(ctx) {
+        pdf_obj* pageref = pdf_lookup_page_obj(ctx, pdfdoc, 0);
+        mbox = PdfPageObjMediabox(ctx, pdfdoc, pdf_to_num(ctx, pageref));
+    }
+    fz_catch(ctx) {
+        mbox = {};
+    }
+    if (fz_is_empty_rect(mbox)) {
+        return false;
+    }
+
+    RectF estimate = ToRectF(mbox);
+    for (int pageNo = 0; pageNo < pageCount; pageNo++) {
+        FzPageInfo* pageInfo = pages[pageNo];
+        pageInfo->mediabox = estimate;
+        pageInfo->pageNo = pageNo + 1;
+    }
+    readMediaboxes.AppendBlanks(pageCount);
+    mediaboxThread = CreateThread(nullptr, 0, ReadMediaboxesThread, this, 0, nullptr);
+    if (!mediaboxThread) {
+        return false;
+    }
+    SetThreadPriority(mediaboxThread, THREAD_PRIORITY_BELOW_NORMAL);
+    return true;
+}
+
+// runs on mediaboxThread, gives up ctxAccess regularly so that
+// pages can be rendered while it's running
+void EngineMupdf::ReadMediaboxes() {
+    int nPages = pageCount;
+    for (int start = 0; start < nPages; start += kMediaboxesPerLock) {
+        ScopedCritSec scope(ctxAccess);
+        if (abortMediaboxes) {
+            return;
+        }
+        pdf_rev_page_map* map = pdfdoc->rev_page_map;
+        if (!map || pdfdoc->map_page_count != nPages) {
+            // the page tree has been modified, keep the estimates
+            break;
+        }
+        int end = std::min(start + kMediaboxesPerLock, nPages);
+        for (int i = start; i < end; i++) {
+            int pageNo = map[i].page;
+            fz_rect mbox = PdfPageObjMediabox(ctx, pdfdoc, map[i].object);
+            if (fz_is_empty_rect(mbox)) {
+                logfa("cannot find page size for page %d", pageNo);
+                mbox = {0, 0, 612, 792};
+            }
+            readMediaboxes[pageNo] = ToRectF(mbox);
+        }
+    }
+    ScopedCritSec scope(ctxAccess);
+    mediaboxesRead = true;
+}
+
+void EngineMupdf::GetMemStats(EngineMemStats& stats) {
+    fz_store_stats store;
+    fz_get_store_stats(ctx, &store);
+    stats.cacheSize += (i64)store.size;
+    stats.cacheItems += store.items;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        for (FzPageInfo* pi : pages) {
+            if (pi && pi->page) {
+                stats.loadedPages++;
+            }
+        }
+    }
+    // not taking ctxAccess, which can be held for a whole rendering.
+    // The values might be a bit stale, which is good enough for stats
+    stats.displayListsSize += (i64)displayListsSize;
+    stats.displayLists += pagesWithList.isize();
+}
+
+bool EngineMupdf::IsPageSizeUpdatePending() {
+    ScopedCritSec scope(ctxAccess);
+    return mediaboxThread && !mediaboxesApplied;
+}
+
+// picks up the mediaboxes once mediaboxThread has read all of them
+bool EngineMupdf::UpdatePageSizes() {
+    if (!mediaboxThread) {
+        return false;
+    }
+    ScopedCritSec scope(&pagesAccess);
+    ScopedCritSec ctxScope(ctxAccess);
+    if (!mediaboxesRead || mediaboxesApplied) {
+        return false;
+    }
+    mediaboxesApplied = true;
+    bool changed = false;
+    for (int pageNo = 0; pageNo < pageCount; pageNo++) {
+        RectF mbox = readMediaboxes[pageNo];
+        FzPageInfo* pageInfo = pages[pageNo];
+        if (mbox.IsEmpty() || mbox == pageInfo->mediabox) {
+            continue;
+        }
+        pageInfo->mediabox = mbox;
+        changed = true;
+    }
+    readMediaboxes.Reset();
+    return changed;
+}
+
 bool EngineMupdf::FinishLoading() {
     pdfdoc = pdf_specifics(ctx, _doc);
 
@@ -2049,8 +3004,23 @@ bool EngineMupdf::FinishLoading() {
         return false;
     }
 
-    if (!loadPageTreeFailed) {
-        // this does the job of pdf_bound_page but without doing pdf_load_page()
+    bool shareWithOrig = cloneOf && cloneOf->pdfdoc && cloneOf->pageCount == nPages;
+    if (!loadPageTreeFailed && shareWithOrig) {
+        // cloneOf->ctxAccess is held by Clone(). Its mediaboxThread has finished
+        // but the UI might not have picked up the mediaboxes yet
+        bool useRead = cloneOf->mediaboxesRead && !cloneOf->mediaboxesApplied;
+        for (int pageNo = 0; pageNo < nPages; pageNo++) {
+            RectF mbox = cloneOf->pages[pageNo]->mediabox;
+            if (useRead && !cloneOf->readMediaboxes[pageNo].IsEmpty()) {
+                mbox = cloneOf->readMediaboxes[pageNo];
+            }
+            FzPageInfo* pageInfo = pages[pageNo];
+            pageInfo->mediabox = mbox;
+            pageInfo->pageNo = pageNo + 1;
+        }
+    } else if (!loadPageTreeFailed && nPages >= kMinPagesForLazyMediaboxes) {
+        loadPageTreeFailed = !StartReadingMediaboxes();
+    } else if (!loadPageTreeFailed) {
         pdf_rev_page_map* map = pdfdoc->rev_page_map;
         for (int i = 0; i < nPages && !loadPageTreeFailed; i++) {
             int pageNo = map[i].page;
@@ -2059,22 +3029,7 @@ bool EngineMupdf::FinishLoading() {
                 loadPageTreeFailed = true;
                 continue;
             }
-            int objNo = map[i].object;
-            fz_rect mbox{};
-            fz_matrix page_ctm{};
-            pdf_obj* pageref = nullptr;
-            fz_var(pageref);
-            fz_var(mbox);
-            fz_try(ctx) {
-                pageref = pdf_load_object(ctx, pdfdoc, objNo);
-                pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-                mbox = fz_transform_rect(mbox, page_ctm);
-                pdf_drop_obj(ctx, pageref);
-            }
-            fz_catch(ctx) {
-                loadPageTreeFailed = true;
-                mbox = {};
-            }
+            fz_rect mbox = PdfPageObjMediabox(ctx, pdfdoc, map[i].object);
             if (fz_is_empty_rect(mbox)) {
                 logfa("cannot find page size for page %d", i);
                 mbox.x0 = 0;
@@ -2100,6 +3055,7 @@ bool EngineMupdf::FinishLoading() {
             fz_try(ctx) {
                 page = pdf_load_page(ctx, pdfdoc, pageNo);
                 pageInfo->page = (fz_page*)page;
+                loadedPages.Append(pageInfo);
                 mbox = pdf_bound_page(ctx, page);
             }
             fz_catch(ctx) {
@@ -2185,14 +3141,21 @@ bool EngineMupdf::FinishLoading() {
 
     pdf_obj* labels = nullptr;
     fz_var(labels);
-    fz_try(ctx) {
-        labels = pdf_dict_getp(ctx, pdf_trailer(ctx, pdfdoc), "Root/PageLabels");
-        if (labels) {
-            pageLabels = BuildPageLabelVec(ctx, labels, PageCount());
+    if (shareWithOrig) {
+        if (cloneOf->pageLabels) {
+            pageLabels = new StrVec();
+            *pageLabels = *cloneOf->pageLabels;
+        }
+    } else {
+        fz_try(ctx) {
+            labels = pdf_dict_getp(ctx, pdf_trailer(ctx, pdfdoc), "Root/PageLabels");
+            if (labels) {
+                pageLabels = BuildPageLabelVec(ctx, labels, PageCount());
+            }
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load page labels");
         }
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load page labels");
     }
     if (pageLabels) {
         hasPageLabels = true;
@@ -2201,6 +3164,14 @@ bool EngineMupdf::FinishLoading() {
     // TODO: support javascript
     CrashIf(pdf_js_supported(ctx, pdfdoc));
 
+    if (cloneOf) {
+        // clones are only used for printing and saving as PDF, which need
+        // neither warmed up resources for the first pages nor the ToC
+        // (GetToc() still builds it on demand)
+        return true;
+    }
+    StartWarmUp();
+    StartBuildingToc();
     return true;
 }
 
@@ -2215,6 +3186,8 @@ static NO_INLINE IPageDestination* DestFromAttachment(EngineMupdf* engine, fz_ou
     return dest;
 }
 
+// ctxAccess is only held for each item so that rendering isn't blocked
+// by building the tree on tocThread
 TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment) {
     TocItem* root = nullptr;
     TocItem* curr = nullptr;
@@ -2233,13 +3206,21 @@ TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& id
             name = str::Dup("");
         }
 
-        int pageNo = FzGetPageNo(ctx, _doc, nullptr, outline);
-
+        int pageNo = 0;
         IPageDestination* dest = nullptr;
-        if (isAttachment) {
-            dest = DestFromAttachment(this, outline);
-        } else {
-            dest = NewPageDestinationMupdf(ctx, _doc, nullptr, outline);
+        {
+            ScopedCritSec cs(ctxAccess);
+            if (abortToc) {
+                free(name);
+                break;
+            }
+            if (isAttachment) {
+                pageNo = FzGetPageNo(ctx, _doc, nullptr, outline);
+                dest = DestFromAttachment(this, outline);
+            } else {
+                pageNo = FzGetOutlinePageNo(ctx, _doc, outline);
+                dest = NewPageDestinationMupdf(ctx, _doc, nullptr, outline);
+            }
         }
         TocItem* item = NewTocItemWithDestination(parent, name, dest);
 
@@ -2278,19 +3259,42 @@ TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& id
     return root;
 }
 
-// TODO: maybe build in FinishLoading
+static DWORD WINAPI TocThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    e->tocTree = e->BuildToc();
+    return 0;
+}
+
+// must be called with ctxAccess held
+void EngineMupdf::StartBuildingToc() {
+    if (outline == nullptr && attachments == nullptr) {
+        return;
+    }
+    tocThread = CreateThread(nullptr, 0, TocThread, this, 0, nullptr);
+    if (tocThread) {
+        SetThreadPriority(tocThread, THREAD_PRIORITY_BELOW_NORMAL);
+    }
+}
+
 TocTree* EngineMupdf::GetToc() {
-    if (tocTree) {
+    if (tocThread) {
+        // the ToC is usually ready by the time it's shown
+        WaitForSingleObject(tocThread, INFINITE);
         return tocTree;
     }
+    if (!tocTree) {
+        tocTree = BuildToc();
+    }
+    return tocTree;
+}
+
+TocTree* EngineMupdf::BuildToc() {
     if (outline == nullptr && attachments == nullptr) {
         return nullptr;
     }
 
     int idCounter = 0;
 
-    ScopedCritSec cs(ctxAccess);
-
     TocItem* root = nullptr;
     TocItem* att = nullptr;
     if (outline) {
@@ -2311,8 +3315,103 @@ MakeTree:
     }
     TocItem* realRoot = new TocItem();
     realRoot->child = root;
-    tocTree = new TocTree(realRoot);
-    return tocTree;
+    return new TocTree(realRoot);
+}
+
+static DWORD WINAPI IndexThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    e->BuildIndexes();
+    return 0;
+}
+
+// starts building the indexes on the first call, returns true once they're built
+bool EngineMupdf::IndexesReady() const {
+    if (!indexThread) {
+        ScopedCritSec scope(ctxAccess);
+        if (!indexThread) {
+            indexThread = CreateThread(nullptr, 0, IndexThread, (LPVOID)this, 0, nullptr);
+            if (indexThread) {
+                SetThreadPriority(indexThread, THREAD_PRIORITY_BELOW_NORMAL);
+            }
+        }
+        return false;
+    }
+    return WaitForSingleObject(indexThread, 0) == WAIT_OBJECT_0;
+}
+
+// runs on indexThread. Named destinations are resolved to pages
+// so that looking them up doesn't need ctx
+void EngineMupdf::BuildIndexes() {
+    // page labels don't change after loading
+    if (pageLabels) {
+        auto index = new dict::MapStrToInt(pageLabels->size());
+        for (int i = 0; i < pageLabels->Size(); i++) {
+            // for duplicate labels the first page wins, as with pageLabels->Find()
+            index->Insert(pageLabels->at(i), i + 1);
+        }
+        pageLabelsIndex = index;
+    }
+
+    // like pdf_lookup_dest(), PDF 1.1 destinations in a dictionary take precedence
+    // over those in the name tree
+    pdf_obj* dests = nullptr;
+    int nDests = 0;
+    fz_var(dests);
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            pdf_obj* root = pdf_dict_get(ctx, pdf_trailer(ctx, pdfdoc), PDF_NAME(Root));
+            dests = pdf_keep_obj(ctx, pdf_dict_get(ctx, root, PDF_NAME(Dests)));
+            if (!dests) {
+                dests = pdf_load_name_tree(ctx, pdfdoc, PDF_NAME(Dests));
+            }
+            nDests = pdf_dict_len(ctx, dests);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "failed to load named destinations");
+            return;
+        }
+    }
+
+    auto index = new dict::MapStrToInt(nDests);
+    int i = 0;
+    while (i < nDests) {
+        ScopedCritSec scope(ctxAccess);
+        if (abortIndexes) {
+            break;
+        }
+        int end = std::min(i + kNamedDestsPerLock, nDests);
+        for (; i < end; i++) {
+            const char* name = nullptr;
+            char* uri = nullptr;
+            fz_var(uri);
+            fz_try(ctx) {
+                name = pdf_to_name(ctx, pdf_dict_get_key(ctx, dests, i));
+                uri = pdf_parse_link_dest(ctx, pdfdoc, pdf_dict_get_val(ctx, dests, i));
+            }
+            fz_catch(ctx) {
+                uri = nullptr;
+            }
+            if (!uri || str::IsEmpty(name)) {
+                fz_free(ctx, uri);
+                continue;
+            }
+            NamedDestPos pos;
+            pos.pageNo = ResolveLink(ctx, _doc, uri, &pos.x, &pos.y);
+            fz_free(ctx, uri);
+            if (index->Insert(name, namedDestsPos.Size())) {
+                namedDestsPos.Append(pos);
+            }
+        }
+    }
+
+    ScopedCritSec scope(ctxAccess);
+    pdf_drop_obj(ctx, dests);
+    if (i < nDests) {
+        delete index;
+        return;
+    }
+    namedDestsIndex = index;
 }
 
 IPageDestination* EngineMupdf::GetNamedDest(const char* name) {
@@ -2320,6 +3419,16 @@ IPageDestination* EngineMupdf::GetNamedDest(const char* name) {
         return nullptr;
     }
 
+    if (IndexesReady() && namedDestsIndex) {
+        int idx;
+        if (!namedDestsIndex->Get(name, &idx)) {
+            return nullptr;
+        }
+        NamedDestPos& pos = namedDestsPos[idx];
+        RectF r{pos.x, pos.y, 0, 0};
+        return NewSimpleDest(pos.pageNo, r, 0);
+    }
+
     ScopedCritSec scope1(&pagesAccess);
     ScopedCritSec scope2(ctxAccess);
 
@@ -2367,16 +3476,51 @@ IPageDestination* EngineMupdf::GetNamedDest(const char* name) {
 }
 
 // return a page but only if is fully loaded
+// its page elements stay valid even if its fz_page has been dropped since
 FzPageInfo* EngineMupdf::GetFzPageInfoFast(int pageNo) {
     ScopedCritSec scope(&pagesAccess);
     CrashIf(pageNo < 1 || pageNo > pageCount);
     FzPageInfo* pageInfo = pages[pageNo - 1];
-    if (!pageInfo->page || !pageInfo->fullyLoaded) {
+    if (!pageInfo->fullyLoaded) {
         return nullptr;
     }
     return pageInfo;
 }
 
+// must be called with pagesAccess held
+void EngineMupdf::MarkPageUsed(FzPageInfo* pageInfo) {
+    if (loadedPages.size() > 0 && loadedPages.Last() == pageInfo) {
+        return;
+    }
+    loadedPages.Remove(pageInfo);
+    loadedPages.Append(pageInfo);
+}
+
+// drops the least recently used pages above kMaxLoadedPages. Their page
+// elements are kept because they might've been handed out, as are pages
+// with annotations, since Annotation points into their pdf_page
+// must be called with pagesAccess and ctxAccess held
+void EngineMupdf::DropUnusedPages() {
+    int nLoaded = loadedPages.isize();
+    for (int i = 0; i < loadedPages.isize() && nLoaded > kMaxLoadedPages;) {
+        FzPageInfo* pageInfo = loadedPages[i];
+        if (pdfdoc && pdf_first_annot(ctx, pdf_page_from_fz_page(ctx, pageInfo->page))) {
+            i++;
+            continue;
+        }
+        fz_drop_page(ctx, pageInfo->page);
+        pageInfo->page = nullptr;
+        FreePageText(&pageInfo->text);
+        loadedPages.RemoveAt(i);
+        nLoaded--;
+        nDroppedPages++;
+        if (nDroppedPages % 256 == 0) {
+            logf("EngineMupdf: dropped %d pages so far, %d loaded, %d kB in %d display lists\n", nDroppedPages,
+                 loadedPages.isize(), (int)(displayListsSize / 1024), pagesWithList.isize());
+        }
+    }
+}
+
 static IPageElement* NewFzComment(const char* comment, int pageNo, RectF rect) {
     auto res = new PageElementComment(comment);
     res->pageNo = pageNo;
@@ -2501,11 +3645,15 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
     if (!page) {
         return nullptr;
     }
+    MarkPageUsed(pageInfo);
+    DropUnusedPages();
 
     if (pdfdoc && pageInfo->commentsNeedRebuilding) {
         DeleteVecMembers(pageInfo->comments);
         MakePageElementCommentsFromAnnotations(ctx, pageInfo);
         pageInfo->commentsNeedRebuilding = false;
+        // allElements and elementsGrid refer to the deleted comments
+        pageInfo->gotAllElements = false;
     }
 
     if (loadQuick || pageInfo->fullyLoaded) {
@@ -2515,13 +3663,25 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
     CrashIf(pageInfo->pageNo != pageNo);
 
     pageInfo->fullyLoaded = true;
+    // called on render threads, free the temp strings of links etc. right away
+    TempAllocatorScope tempScope;
 
+    // the display list has usually just been recorded by RenderPage(). If not,
+    // the page is likely to be rendered soon, so record and cache it now
+    fz_display_list* list = GetDisplayList(pageInfo, RenderTarget::View, nullptr);
     fz_stext_page* stext = nullptr;
     fz_var(stext);
     fz_stext_options opts{};
     opts.flags = FZ_STEXT_PRESERVE_IMAGES;
     fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, page, &opts);
+        if (list) {
+            stext = fz_new_stext_page_from_display_list(ctx, list, &opts);
+        } else {
+            stext = fz_new_stext_page_from_page(ctx, page, &opts);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_display_list(ctx, list);
     }
     fz_catch(ctx) {
     }
@@ -2542,12 +3702,47 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         return pageInfo;
     }
 
-    FzLinkifyPageText(pageInfo, stext);
+    // linkifying is deferred until the elements of the page are asked for
+    // (i.e. usually when the mouse moves over it), see LinkifyPage()
+    pageInfo->linkifyPending = true;
     FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
+    // image blocks from FZ_STEXT_PRESERVE_IMAGES are skipped
+    PageText& text = pageInfo->text;
+    FreePageText(&text);
+    text.text = FzTextPageToStr(stext, &text.coords);
+    text.len = (int)str::Len(text.text);
     fz_drop_stext_page(ctx, stext);
     return pageInfo;
 }
 
+// only loads the page, which is all that's needed e.g. for extracting text.
+// Unlike GetFzPageInfo(), comments aren't built from annotations and,
+// if the page is already loaded, ctxAccess isn't taken
+FzPageInfo* EngineMupdf::LoadFzPageOnly(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    int pageIdx = pageNo - 1;
+    FzPageInfo* pageInfo = pages[pageIdx];
+    if (pageInfo->page) {
+        MarkPageUsed(pageInfo);
+        return pageInfo;
+    }
+
+    ScopedCritSec ctxScope(ctxAccess);
+    fz_try(ctx) {
+        pageInfo->page = fz_load_page(ctx, _doc, pageIdx);
+    }
+    fz_catch(ctx) {
+    }
+    if (!pageInfo->page) {
+        return nullptr;
+    }
+    MarkPageUsed(pageInfo);
+    DropUnusedPages();
+    return pageInfo;
+}
+
 RectF EngineMupdf::PageMediabox(int pageNo) {
     FzPageInfo* pi = pages[pageNo - 1];
     return pi->mediabox;
@@ -2577,7 +3772,7 @@ RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
     RectF mediabox = pageInfo->mediabox;
 
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
+        list = GetDisplayList(pageInfo, target, nullptr);
         if (list) {
             dev = fz_new_bbox_device(ctx, &rect);
             fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
@@ -2627,10 +3822,218 @@ RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rota
     return ToRectF(rect2);
 }
 
+// must be called under ctxAccess
+void EngineMupdf::DropDisplayList(FzPageInfo* pageInfo) {
+    // contentsList is kept when list is out of date
+    fz_drop_display_list(ctx, pageInfo->contentsList);
+    pageInfo->contentsList = nullptr;
+    if (!pageInfo->list) {
+        return;
+    }
+    fz_drop_display_list(ctx, pageInfo->list);
+    pageInfo->list = nullptr;
+    fz_drop_display_list(ctx, pageInfo->annotsList);
+    pageInfo->annotsList = nullptr;
+    displayListsSize -= pageInfo->listSize;
+    pageInfo->listSize = 0;
+    pagesWithList.Remove(pageInfo);
+}
+
+// returns display list for the page, re-using a cached one if possible
+// if !addToCache a newly recorded list isn't cached (e.g. when extracting text
+// for all pages, which would evict the lists of the pages being viewed)
+// the caller must fz_drop_display_list() the result
+// must be called under ctxAccess
+fz_display_list* EngineMupdf::GetDisplayList(FzPageInfo* pageInfo, RenderTarget target, fz_cookie* cookie,
+                                             bool addToCache) {
+    // only the annotations have changed so for PDF pages we keep
+    // recording the content separately and only re-record the annotations
+    bool separateContents = false;
+    if (pageInfo->listOutOfDate) {
+        fz_display_list* contentsList = pageInfo->contentsList;
+        pageInfo->contentsList = nullptr;
+        DropDisplayList(pageInfo);
+        pageInfo->contentsList = contentsList;
+        pageInfo->listOutOfDate = false;
+        separateContents = pdfdoc != nullptr;
+    }
+
+    bool isPrint = target == RenderTarget::Print;
+    if (pageInfo->list && !isPrint) {
+        // move to the end of LRU list
+        pagesWithList.Remove(pageInfo);
+        pagesWithList.Append(pageInfo);
+        return fz_keep_display_list(ctx, pageInfo->list);
+    }
+
+    fz_page* page = pageInfo->page;
+    fz_display_list* list = nullptr;
+    fz_display_list* contentsList = nullptr;
+    fz_display_list* annotsList = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(list);
+    fz_var(contentsList);
+    fz_var(annotsList);
+    fz_var(dev);
+    fz_try(ctx) {
+        fz_rect bounds = fz_bound_page(ctx, page);
+        if (pdfdoc) {
+            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
+            // or "Print". "Export" is not used
+            const char* usage = isPrint ? "Print" : "View";
+            pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+            bool useContentsList = !isPrint && (separateContents || pageInfo->contentsList);
+            if (useContentsList && !pageInfo->contentsList) {
+                contentsList = fz_new_display_list(ctx, bounds);
+                dev = fz_new_list_device(ctx, contentsList);
+                pdf_run_page_contents_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+                fz_close_device(ctx, dev);
+                fz_drop_device(ctx, dev);
+                dev = nullptr;
+            } else if (useContentsList) {
+                contentsList = fz_keep_display_list(ctx, pageInfo->contentsList);
+            }
+            if (useContentsList) {
+                annotsList = fz_new_display_list(ctx, bounds);
+                dev = fz_new_list_device(ctx, annotsList);
+                pdf_run_page_annots_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+                pdf_run_page_widgets_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+                fz_close_device(ctx, dev);
+                fz_drop_device(ctx, dev);
+                dev = nullptr;
+            }
+            list = fz_new_display_list(ctx, bounds);
+            dev = fz_new_list_device(ctx, list);
+            if (useContentsList) {
+                // replaying the recorded content is much faster than interpreting it
+                fz_run_display_list(ctx, contentsList, dev, fz_identity, fz_infinite_rect, cookie);
+                fz_run_display_list(ctx, annotsList, dev, fz_identity, fz_infinite_rect, cookie);
+            } else {
+                pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+            }
+        } else {
+            list = fz_new_display_list(ctx, bounds);
+            dev = fz_new_list_device(ctx, list);
+            // TODO: to have uniform background needs to set custom css
+            // background-color and clear pixmap with the same color
+            fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+        }
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        fz_drop_display_list(ctx, contentsList);
+        fz_drop_display_list(ctx, annotsList);
+        return nullptr;
+    }
+
+    // don't cache partial results of aborted renders and print-only content
+    bool wasAborted = cookie && cookie->abort;
+    if (isPrint || wasAborted || !addToCache) {
+        fz_drop_display_list(ctx, contentsList);
+        fz_drop_display_list(ctx, annotsList);
+        return list;
+    }
+
+    pageInfo->list = fz_keep_display_list(ctx, list);
+    pageInfo->listSize = fz_display_list_size(ctx, list);
+    fz_drop_display_list(ctx, pageInfo->contentsList);
+    pageInfo->contentsList = contentsList;
+    fz_drop_display_list(ctx, pageInfo->annotsList);
+    pageInfo->annotsList = annotsList;
+    if (contentsList) {
+        pageInfo->listSize += fz_display_list_size(ctx, contentsList);
+        pageInfo->listSize += fz_display_list_size(ctx, annotsList);
+    }
+    displayListsSize += pageInfo->listSize;
+    pagesWithList.Append(pageInfo);
+
+    // evict least recently used but always keep the one we just added
+    while (displayListsSize > kMaxDisplayListsSize && pagesWithList.size() > 1) {
+        DropDisplayList(pagesWithList[0]);
+    }
+    return list;
+}
+
+static bool IsSameTile(const FzContentTile& tile, int pageNo, fz_matrix ctm, fz_pixmap* pix) {
+    fz_pixmap* tpix = tile.pix;
+    if (tile.pageNo != pageNo || memcmp(&tile.ctm, &ctm, sizeof(ctm)) != 0) {
+        return false;
+    }
+    return tpix->x == pix->x && tpix->y == pix->y && tpix->w == pix->w && tpix->h == pix->h && tpix->n == pix->n &&
+           tpix->stride == pix->stride;
+}
+
+// copies the cached page contents into pix, if we've rasterized them before
+bool EngineMupdf::LoadContentTile(fz_context* tctx, int pageNo, fz_matrix ctm, fz_pixmap* pix) {
+    ScopedCritSec scope(&contentTilesAccess);
+    int n = contentTiles.isize();
+    for (int i = 0; i < n; i++) {
+        FzContentTile tile = contentTiles[i];
+        if (!IsSameTile(tile, pageNo, ctm, pix)) {
+            continue;
+        }
+        memcpy(pix->samples, tile.pix->samples, (size_t)pix->stride * pix->h);
+        // move to the end as most recently used
+        contentTiles.RemoveAt(i);
+        contentTiles.Append(tile);
+        return true;
+    }
+    return false;
+}
+
+void EngineMupdf::SaveContentTile(fz_context* tctx, int pageNo, fz_matrix ctm, fz_pixmap* pix) {
+    size_t size = (size_t)pix->stride * pix->h;
+    if (size > kMaxContentTilesSize / 4) {
+        return;
+    }
+    fz_pixmap* copy = nullptr;
+    fz_try(tctx) {
+        copy = fz_clone_pixmap(tctx, pix);
+    }
+    fz_catch(tctx) {
+        return;
+    }
+
+    ScopedCritSec scope(&contentTilesAccess);
+    for (int i = 0; i < contentTiles.isize(); i++) {
+        if (IsSameTile(contentTiles[i], pageNo, ctm, pix)) {
+            // rendered by another thread in the meantime
+            fz_drop_pixmap(tctx, copy);
+            return;
+        }
+    }
+    FzContentTile tile;
+    tile.pageNo = pageNo;
+    tile.ctm = ctm;
+    tile.pix = copy;
+    contentTiles.Append(tile);
+    contentTilesSize += size;
+    while (contentTilesSize > kMaxContentTilesSize && contentTiles.size() > 1) {
+        fz_pixmap* old = contentTiles[0].pix;
+        contentTilesSize -= (size_t)old->stride * old->h;
+        fz_drop_pixmap(tctx, old);
+        contentTiles.RemoveAt(0);
+    }
+}
+
+// draft renders scale images with nearest neighbor instead of interpolating them
+static fz_device* NewDrawDevice(fz_context* ctx, fz_matrix ctm, fz_pixmap* pix, bool draft) {
+    fz_device* dev = fz_new_draw_device(ctx, ctm, pix);
+    if (draft) {
+        fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+    }
+    return dev;
+}
+
 RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    // the page is fully loaded after rendering, from the display list
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
@@ -2644,101 +4047,247 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         fzcookie = &cookie->cookie;
     }
 
-    ScopedCritSec cs(ctxAccess);
-
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = ToFzRect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+
+    // interpreting the page content touches the document, so it has to happen
+    // under ctxAccess. We record it into a display list which is immutable and
+    // can be rasterized without holding the lock, so that different pages / tiles
+    // of the same document draw in parallel
+    fz_display_list* list = nullptr;
+    // for the screen, the page contents and the annotations are also drawn separately
+    // so that after an annotation edit, only the annotations have to be re-drawn
+    // over the cached contents
+    fz_display_list* contentsList = nullptr;
+    fz_display_list* annotsList = nullptr;
+    fz_context* tctx = nullptr;
+    fz_matrix ctm;
+    fz_irect ibounds;
+    {
+        ScopedCritSec cs(ctxAccess);
+
+        fz_rect pRect;
+        if (pageRect) {
+            pRect = ToFzRect(*pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, zoom, rotation);
+        ibounds = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+        list = GetDisplayList(pageInfo, args.target, fzcookie);
+        if (!list) {
+            return nullptr;
+        }
+        if (args.target == RenderTarget::View && pageInfo->list == list && pageInfo->contentsList &&
+            pageInfo->annotsList) {
+            contentsList = fz_keep_display_list(ctx, pageInfo->contentsList);
+            annotsList = fz_keep_display_list(ctx, pageInfo->annotsList);
+        }
+
+        // a cloned context shares the store, fonts and colorspaces with ctx
+        // (synchronized via fz_locks_ctx) but has its own error stack
+        tctx = fz_clone_context(ctx);
+        if (!tctx) {
+            fz_drop_display_list(ctx, list);
+            fz_drop_display_list(ctx, contentsList);
+            fz_drop_display_list(ctx, annotsList);
+            return nullptr;
+        }
+    }
+    // a clone has its own copy of the anti-aliasing settings
+    if (args.draft) {
+        fz_set_aa_level(tctx, kDraftAaLevel);
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* csRgb = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
+    if (fzcookie && fzcookie->abort) {
+        fz_drop_display_list(tctx, list);
+        fz_drop_display_list(tctx, contentsList);
+        fz_drop_display_list(tctx, annotsList);
+        fz_drop_context(tctx);
+        return nullptr;
+    }
 
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
 
     fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
+    fz_var(hbmp);
+    fz_var(hMap);
 
-    const char* usage = "View";
-    switch (args.target) {
-        case RenderTarget::Print:
-            usage = "Print";
-            break;
-    }
-
-    pdf_page* pdfpage = nullptr;
-    fz_var(pdfpage);
-    if (pdfdoc) {
-        fz_try(ctx) {
-            pdfpage = pdf_page_from_fz_page(ctx, page);
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-            // or "Print". "Export" is not used
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-            fz_close_device(ctx, dev);
+    fz_try(tctx) {
+        if (pageInfo->grayContent < 0) {
+            pageInfo->grayContent = HasOnlyGrayContent(tctx, list) ? 1 : 0;
         }
-        fz_always(ctx) {
-            if (dev) {
-                fz_drop_device(ctx, dev);
-            }
-            fz_drop_pixmap(ctx, pix);
+        bool isGray = pageInfo->grayContent == 1;
+        // render straight into a DIB section
+        if (isGray) {
+            pix = FzNewGrayDIBPixmap(tctx, ibounds, &hbmp, &hMap);
+        } else {
+            pix = FzNewDIBPixmap(tctx, ibounds, &hbmp, &hMap);
         }
-        fz_catch(ctx) {
-            delete bitmap;
-            return nullptr;
+        if (!pix) {
+            // e.g. out of GDI resources. NewRenderedFzPixmap() will report that
+            pix = fz_new_pixmap_with_bbox(tctx, fz_device_rgb(tctx), ibounds, nullptr, 1);
         }
-    } else {
-        fz_try(ctx) {
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            // TODO: to have uniform background needs to set custom css
-            // background-color and clear pixmap with the same color
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // fz_clear_pixmap(ctx, pix);
-            // fz_fill_pixmap_with_color(ctx, pix, )
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
+        if (contentsList && annotsList) {
+            if (!LoadContentTile(tctx, pageNo, ctm, pix)) {
+                fz_clear_pixmap_with_value(tctx, pix, 0xff);
+                dev = NewDrawDevice(tctx, ctm, pix, args.draft);
+                fz_run_display_list(tctx, contentsList, dev, fz_identity, fz_infinite_rect, fzcookie);
+                fz_close_device(tctx, dev);
+                fz_drop_device(tctx, dev);
+                dev = nullptr;
+                // draft quality content must not be re-used for full quality renders
+                if (!args.draft && (!fzcookie || !fzcookie->abort)) {
+                    SaveContentTile(tctx, pageNo, ctm, pix);
+                }
+            }
+            dev = NewDrawDevice(tctx, ctm, pix, args.draft);
+            fz_run_display_list(tctx, annotsList, dev, fz_identity, fz_infinite_rect, fzcookie);
+            fz_close_device(tctx, dev);
+        } else {
+            fz_clear_pixmap_with_value(tctx, pix, 0xff);
+            dev = NewDrawDevice(tctx, ctm, pix, args.draft);
+            fz_run_display_list(tctx, list, dev, fz_identity, fz_infinite_rect, fzcookie);
+            fz_close_device(tctx, dev);
         }
-        fz_always(ctx) {
-            fz_drop_pixmap(ctx, pix);
+        if (hbmp) {
+            if (isGray) {
+                bitmap = TryRenderAsBilevelImage(pix);
+            } else if (!pageInfo->notPaletteImage) {
+                // tiles of a page tend to agree, so don't re-scan pages
+                // that we already know have more than 256 colors
+                bitmap = TryRenderAsPaletteImage(pix, true);
+                if (!bitmap) {
+                    pageInfo->notPaletteImage = true;
+                }
+            }
+            if (bitmap && isGray) {
+                DeleteObject(hbmp);
+                CloseHandle(hMap);
+            } else if (bitmap) {
+                ReleaseDIBPixmap(hbmp, hMap, Size(pix->w, pix->h));
+            } else {
+                bitmap = new RenderedBitmap(hbmp, Size(pix->w, pix->h), hMap);
+                bitmap->pooled = !isGray;
+            }
+            hbmp = nullptr;
+            hMap = nullptr;
+        } else {
+            bitmap = NewRenderedFzPixmap(tctx, pix);
         }
-        fz_catch(ctx) {
-            delete bitmap;
-            return nullptr;
+    }
+    fz_always(tctx) {
+        fz_drop_device(tctx, dev);
+        fz_drop_pixmap(tctx, pix);
+        fz_drop_display_list(tctx, list);
+        fz_drop_display_list(tctx, contentsList);
+        fz_drop_display_list(tctx, annotsList);
+    }
+    fz_catch(tctx) {
+        delete bitmap;
+        bitmap = nullptr;
+        if (hbmp) {
+            DeleteObject(hbmp);
+            CloseHandle(hMap);
         }
     }
+    fz_drop_context(tctx);
 
+    // builds links, images and text (for ExtractPageText()) from the
+    // display list cached above, without interpreting the page again
+    if (!fzcookie || !fzcookie->abort) {
+        GetFzPageInfo(pageNo, false);
+    }
     return bitmap;
 }
 
+bool EngineMupdf::DrawPageOnDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    FzPageInfo* pageInfo = GetFzPageInfo(args.pageNo, true);
+    if (!pageInfo || !pageInfo->page) {
+        return false;
+    }
+
+    // same as in RenderPage(), the display list is drawn without holding ctxAccess
+    fz_display_list* list = nullptr;
+    fz_context* tctx = nullptr;
+    fz_matrix ctm;
+    fz_rect pRect;
+    {
+        ScopedCritSec cs(ctxAccess);
+        pRect = args.pageRect ? ToFzRect(*args.pageRect) : fz_bound_page(ctx, pageInfo->page);
+        ctm = viewctm(pageInfo->page, args.zoom, args.rotation);
+        list = GetDisplayList(pageInfo, args.target, nullptr);
+        if (!list) {
+            return false;
+        }
+        tctx = fz_clone_context(ctx);
+        if (!tctx) {
+            fz_drop_display_list(ctx, list);
+            return false;
+        }
+    }
+
+    // move what RenderPage() would put at the top-left of the bitmap to offset
+    fz_irect ibounds = fz_round_rect(fz_transform_rect(pRect, ctm));
+    ctm = fz_concat(ctm, fz_translate((float)(offset.x - ibounds.x0), (float)(offset.y - ibounds.y0)));
+    fz_rect clip = fz_transform_rect(pRect, ctm);
+    bool ok = FzDrawDisplayListGdi(tctx, list, ctm, clip, hdc);
+
+    fz_drop_display_list(tctx, list);
+    fz_drop_context(tctx);
+    return ok;
+}
+
 // don't delete the result
 IPageElement* EngineMupdf::GetElementAtPos(int pageNo, PointF pt) {
     FzPageInfo* pageInfo = GetFzPageInfoFast(pageNo);
+    LinkifyPage(pageInfo);
     return FzGetElementAtPos(pageInfo, pt);
 }
 
+// adds the links auto-detected in the text of a fully loaded page
+void EngineMupdf::LinkifyPage(FzPageInfo* pageInfo) {
+    if (!pageInfo) {
+        return;
+    }
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!pageInfo->linkifyPending) {
+            return;
+        }
+        pageInfo->linkifyPending = false;
+        pageInfo->gotAllElements = false;
+        if (pageInfo->text.text) {
+            FzLinkifyPageText(pageInfo, pageInfo->text.text, pageInfo->text.coords);
+            return;
+        }
+    }
+
+    // the text extracted while loading the page has already been handed out
+    PageText text = ExtractPageText(pageInfo->pageNo);
+    if (text.text) {
+        ScopedCritSec scope(&pagesAccess);
+        FzLinkifyPageText(pageInfo, text.text, text.coords);
+    }
+    FreePageText(&text);
+}
+
 Vec<IPageElement*> EngineMupdf::GetElements(int pageNo) {
     auto pageInfo = GetFzPageInfoFast(pageNo);
     if (!pageInfo) {
         return Vec<IPageElement*>();
     }
 
+    LinkifyPage(pageInfo);
     BuildGetElementsInfo(pageInfo);
     return pageInfo->allElements;
 }
@@ -2875,28 +4424,60 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 }
 
 PageText EngineMupdf::ExtractPageText(int pageNo) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    {
+        // already extracted when the page was fully loaded (e.g. for rendering)
+        ScopedCritSec scope(&pagesAccess);
+        CrashIf(pageNo < 1 || pageNo > pageCount);
+        FzPageInfo* pageInfo = pages[pageNo - 1];
+        if (pageInfo->text.text) {
+            PageText res = pageInfo->text;
+            pageInfo->text = {};
+            return res;
+        }
+    }
+
+    FzPageInfo* pageInfo = LoadFzPageOnly(pageNo);
     if (!pageInfo) {
         return {};
     }
 
-    ScopedCritSec scope(ctxAccess);
+    // like in RenderPage(), only recording the page needs ctxAccess. Text
+    // extraction from the display list can run in parallel for several pages
+    fz_display_list* list = nullptr;
+    fz_context* tctx = nullptr;
+    {
+        ScopedCritSec scope(ctxAccess);
+        list = GetDisplayList(pageInfo, RenderTarget::View, nullptr, false);
+        if (!list) {
+            return {};
+        }
+        tctx = fz_clone_context(ctx);
+        if (!tctx) {
+            fz_drop_display_list(ctx, list);
+            return {};
+        }
+    }
 
     fz_stext_page* stext = nullptr;
     fz_var(stext);
     fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
+    fz_try(tctx) {
+        stext = fz_new_stext_page_from_display_list(tctx, list, &opts);
     }
-    fz_catch(ctx) {
+    fz_always(tctx) {
+        fz_drop_display_list(tctx, list);
+    }
+    fz_catch(tctx) {
     }
     if (!stext) {
+        fz_drop_context(tctx);
         return {};
     }
     PageText res;
     // TODO: convert to return PageText
     WCHAR* text = FzTextPageToStr(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
+    fz_drop_stext_page(tctx, stext);
+    fz_drop_context(tctx);
     res.text = text;
     res.len = (int)str::Len(text);
     return res;
@@ -2924,49 +4505,211 @@ static void pdf_extract_fonts(fz_context* ctx, pdf_obj* res, Vec<pdf_obj*>& font
     }
 }
 
-char* EngineMupdf::ExtractFontList() {
+static DWORD WINAPI WarmUpThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    e->WarmUpResources();
+    return 0;
+}
+
+// must be called with ctxAccess held
+void EngineMupdf::StartWarmUp() {
+    warmUpThread = CreateThread(nullptr, 0, WarmUpThread, this, 0, nullptr);
+    if (warmUpThread) {
+        SetThreadPriority(warmUpThread, THREAD_PRIORITY_LOWEST);
+    }
+}
+
+static bool IsType3Font(fz_context* ctx, pdf_obj* font) {
+    pdf_obj* subtype = pdf_dict_get(ctx, font, PDF_NAME(Subtype));
+    return pdf_name_eq(ctx, subtype, PDF_NAME(Type3));
+}
+
+// runs on warmUpThread. Loading a font or colorspace puts it into the fz_store
+// where the interpreter finds it later. Only one is loaded per ctxAccess hold
+// so that rendering isn't blocked for long
+void EngineMupdf::WarmUpResources() {
+    int nPages = std::min(pageCount, kWarmUpPages);
     Vec<pdf_obj*> fontList;
-    Vec<pdf_obj*> resList;
+    Vec<pdf_obj*> csList;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        {
+            ScopedCritSec scope(ctxAccess);
+            if (abortWarmUp) {
+                break;
+            }
+            Vec<pdf_obj*> fonts;
+            Vec<pdf_obj*> resList;
+            fz_try(ctx) {
+                pdf_obj* pageObj = pdf_lookup_page_obj(ctx, pdfdoc, pageNo - 1);
+                pdf_obj* resources = pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(Resources));
+                pdf_extract_fonts(ctx, resources, fonts, resList);
+                if (warmUpFontsPages == pageNo - 1) {
+                    for (pdf_obj* font : fonts) {
+                        if (!warmUpFonts.Contains(font)) {
+                            warmUpFonts.Append(pdf_keep_obj(ctx, font));
+                        }
+                    }
+                    warmUpFontsPages = pageNo;
+                }
+                // the store is keyed by the (indirect) objects the interpreter
+                // looks up in the resources, so collect those
+                for (pdf_obj* res : resList) {
+                    pdf_obj* dict = pdf_dict_get(ctx, res, PDF_NAME(Font));
+                    for (int k = 0; k < pdf_dict_len(ctx, dict); k++) {
+                        pdf_obj* font = pdf_dict_get_val(ctx, dict, k);
+                        if (pdf_is_indirect(ctx, font) && !IsType3Font(ctx, font) && !fontList.Contains(font)) {
+                            fontList.Append(pdf_keep_obj(ctx, font));
+                        }
+                    }
+                    dict = pdf_dict_get(ctx, res, PDF_NAME(ColorSpace));
+                    for (int k = 0; k < pdf_dict_len(ctx, dict); k++) {
+                        pdf_obj* cs = pdf_dict_get_val(ctx, dict, k);
+                        if (pdf_is_indirect(ctx, cs) && !csList.Contains(cs)) {
+                            csList.Append(pdf_keep_obj(ctx, cs));
+                        }
+                    }
+                }
+            }
+            fz_catch(ctx) {
+                fz_warn(ctx, "failed to collect resources of page %d", pageNo);
+            }
+            for (pdf_obj* res : resList) {
+                pdf_unmark_obj(ctx, res);
+            }
+        }
 
-    // collect all fonts from all page objects
-    int nPages = PageCount();
-    for (int i = 1; i <= nPages; i++) {
-        auto pageInfo = GetFzPageInfo(i, false);
-        if (!pageInfo) {
-            continue;
+        for (pdf_obj* font : fontList) {
+            ScopedCritSec scope(ctxAccess);
+            pdf_font_desc* desc = nullptr;
+            fz_var(desc);
+            fz_try(ctx) {
+                if (!abortWarmUp) {
+                    desc = pdf_load_font(ctx, pdfdoc, nullptr, font);
+                }
+            }
+            fz_catch(ctx) {
+                fz_warn(ctx, "failed to pre-load font %d", pdf_to_num(ctx, font));
+            }
+            pdf_drop_font(ctx, desc);
+            pdf_drop_obj(ctx, font);
         }
-        fz_page* fzpage = pageInfo->page;
-        if (!fzpage) {
-            continue;
+        fontList.Reset();
+
+        for (pdf_obj* cs : csList) {
+            ScopedCritSec scope(ctxAccess);
+            fz_colorspace* colorspace = nullptr;
+            fz_var(colorspace);
+            fz_try(ctx) {
+                if (!abortWarmUp) {
+                    colorspace = pdf_load_colorspace(ctx, cs);
+                }
+            }
+            fz_catch(ctx) {
+                fz_warn(ctx, "failed to pre-load colorspace %d", pdf_to_num(ctx, cs));
+            }
+            fz_drop_colorspace(ctx, colorspace);
+            pdf_drop_obj(ctx, cs);
+        }
+        csList.Reset();
+    }
+}
+
+static DWORD WINAPI FontListThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    int generation;
+    {
+        ScopedCritSec scope(e->ctxAccess);
+        generation = e->fontListGeneration;
+    }
+    char* fonts = e->ExtractFontList();
+    ScopedCritSec scope(e->ctxAccess);
+    if (e->abortFontList || generation != e->fontListGeneration) {
+        // StartExtractingFontList() will start over
+        str::Free(fonts);
+        return 0;
+    }
+    str::Free(e->fontListCache);
+    e->fontListCache = fonts;
+    e->fontListExtracted = true;
+    return 0;
+}
+
+// returns true if fontListCache is up to date, otherwise
+// makes sure that it's being extracted on fontListThread
+bool EngineMupdf::StartExtractingFontList() {
+    ScopedCritSec scope(ctxAccess);
+    if (fontListExtracted) {
+        return true;
+    }
+    if (fontListThread) {
+        if (WaitForSingleObject(fontListThread, 0) != WAIT_OBJECT_0) {
+            return false;
+        }
+        // the font list has been invalidated since the thread finished
+        CloseHandle(fontListThread);
+    }
+    fontListThread = CreateThread(nullptr, 0, FontListThread, this, 0, nullptr);
+    if (!fontListThread) {
+        fontListCache = ExtractFontList();
+        fontListExtracted = true;
+        return true;
+    }
+    SetThreadPriority(fontListThread, THREAD_PRIORITY_BELOW_NORMAL);
+    return false;
+}
+
+// walks the resources of the page objects instead of loading all pages.
+// ctxAccess is only held for each page so that rendering isn't blocked
+char* EngineMupdf::ExtractFontList() {
+    if (!pdfdoc) {
+        return nullptr;
+    }
+    Vec<pdf_obj*> fontList;
+    int nWarmedUpPages = 0;
+    {
+        ScopedCritSec scope(ctxAccess);
+        for (pdf_obj* font : warmUpFonts) {
+            fontList.Append(font);
         }
+        nWarmedUpPages = warmUpFontsPages;
+    }
 
+    // collect all fonts from all page objects
+    int nPages = PageCount();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
         ScopedCritSec scope(ctxAccess);
-        pdf_page* page = pdf_page_from_fz_page(ctx, fzpage);
+        if (abortFontList) {
+            return nullptr;
+        }
+        Vec<pdf_obj*> resList;
         fz_try(ctx) {
-            pdf_obj* resources = pdf_page_resources(ctx, page);
-            pdf_extract_fonts(ctx, resources, fontList, resList);
-            pdf_annot* annot;
-            for (annot = pdf_first_annot(ctx, page); annot; annot = pdf_next_annot(ctx, annot)) {
-                pdf_obj* o = pdf_annot_ap(ctx, annot);
-                if (o) {
-                    // TODO(port): not sure this is the right thing
-                    resources = pdf_xobject_resources(ctx, o);
-                    pdf_extract_fonts(ctx, resources, fontList, resList);
+            pdf_obj* pageObj = pdf_lookup_page_obj(ctx, pdfdoc, pageNo - 1);
+            if (pageNo > nWarmedUpPages) {
+                pdf_obj* resources = pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(Resources));
+                pdf_extract_fonts(ctx, resources, fontList, resList);
+            }
+            pdf_obj* annots = pdf_dict_get(ctx, pageObj, PDF_NAME(Annots));
+            for (int k = 0; k < pdf_array_len(ctx, annots); k++) {
+                pdf_obj* annot = pdf_array_get(ctx, annots, k);
+                pdf_obj* ap = pdf_dict_getp(ctx, annot, "AP/N");
+                if (pdf_is_dict(ctx, ap) && !pdf_is_stream(ctx, ap)) {
+                    // the appearance for the current state e.g. of a checkbox
+                    ap = pdf_dict_get(ctx, ap, pdf_dict_get(ctx, annot, PDF_NAME(AS)));
+                }
+                if (pdf_is_stream(ctx, ap)) {
+                    pdf_extract_fonts(ctx, pdf_xobject_resources(ctx, ap), fontList, resList);
                 }
             }
         }
         fz_catch(ctx) {
         }
+        for (pdf_obj* res : resList) {
+            pdf_unmark_obj(ctx, res);
+        }
     }
 
-    // start ctxAccess scope here so that we don't also have to
-    // ask for pagesAccess (as is required for GetFzPage)
     ScopedCritSec scope(ctxAccess);
 
-    for (pdf_obj* res : resList) {
-        pdf_unmark_obj(ctx, res);
-    }
-
     StrVec fonts;
     for (size_t i = 0; i < fontList.size(); i++) {
         const char *name = nullptr, *type = nullptr, *encoding = nullptr;
@@ -3146,7 +4889,12 @@ char* EngineMupdf::GetProperty(DocumentProperty prop) {
     }
 
     if (DocumentProperty::FontList == prop) {
-        return ExtractFontList();
+        // the font list might be invalidated while it's being extracted
+        while (!StartExtractingFontList()) {
+            WaitForSingleObject(fontListThread, INFINITE);
+        }
+        ScopedCritSec scope(ctxAccess);
+        return str::Dup(fontListCache);
     }
 
     static struct {
@@ -3246,8 +4994,12 @@ const pdf_write_options pdf_default_write_options2 = {
 // this is used after the PDF was modified by the user (e.g. by adding / changing
 // annotations).
 // if filePath is not given, we save under the same name
+// unless optimize is set, only the changed objects are appended to the original
+// data (an incremental update) when that's possible, which is much faster for big
+// files than rewriting all of them
 // TODO: if the file is locked, this might fail.
-bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, std::function<void(const char*)> showErrorFunc) {
+bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, std::function<void(const char*)> showErrorFunc,
+                            bool optimize) {
     CrashIf(!engine);
     if (!engine) {
         return false;
@@ -3263,24 +5015,49 @@ bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, std::function<
         path = currPath;
     }
     fz_context* ctx = epdf->ctx;
+    ScopedCritSec scope(epdf->ctxAccess);
 
     pdf_write_options save_opts{};
     save_opts = pdf_default_write_options2;
-    save_opts.do_incremental = pdf_can_be_saved_incrementally(ctx, epdf->pdfdoc);
+    // redacted content must not stay in the file, so that requires a full rewrite
+    bool incremental = !optimize && !epdf->pdfdoc->redacted;
+    save_opts.do_incremental = incremental && pdf_can_be_saved_incrementally(ctx, epdf->pdfdoc);
+    // an update is only valid for the file the document was loaded from
+    if (save_opts.do_incremental && EngineMupdfFileChangedSinceLoad(engine)) {
+        logf("EngineMupdfSaveUpdated: '%s' has changed since it was loaded, doing a full save\n", currPath);
+        save_opts.do_incremental = 0;
+    }
     save_opts.do_compress = 1;
     save_opts.do_compress_images = 1;
     save_opts.do_compress_fonts = 1;
-    if (epdf->pdfdoc->redacted) {
+    if (optimize) {
+        // also removes duplicate objects
+        save_opts.do_garbage = 3;
+    } else if (epdf->pdfdoc->redacted) {
         save_opts.do_garbage = 1;
     }
 
+    // an incremental update is appended to the destination, so for
+    // a new file the original data has to be copied there first
+    if (save_opts.do_incremental && !str::EqI(path, currPath) && !path::IsSame(path, currPath)) {
+        bool copied = file::Copy(path, currPath, false) || engine->SaveFileAs(path);
+        if (!copied) {
+            save_opts.do_incremental = 0;
+        }
+    }
+
     bool ok = false;
     fz_var(ok);
     fz_try(ctx) {
         pdf_save_document(ctx, epdf->pdfdoc, path, &save_opts);
         ok = true;
+        if (save_opts.do_incremental && str::EqI(path, currPath)) {
+            // the objects we've loaded are still at the same offsets in the updated file
+            epdf->loadedFileTime = file::GetModificationTime(currPath);
+            epdf->loadedFileSize = file::GetSize(currPath);
+        }
         auto dur = TimeSinceInMs(timeStart);
-        logf("Saved annotations to '%s' in  %.2f ms\n", path, dur);
+        logf("Saved annotations to '%s' in  %.2f ms (incremental: %d)\n", path, dur, save_opts.do_incremental);
     }
     fz_catch(ctx) {
         const char* mupdfErr = fz_caught_message(epdf->ctx);
@@ -3298,7 +5075,7 @@ bool EngineMupdf::HasClipOptimizations(int pageNo) {
     }
 
     FzPageInfo* pageInfo = GetFzPageInfoFast(pageNo);
-    if (!pageInfo || !pageInfo->page) {
+    if (!pageInfo) {
         return false;
     }
 
@@ -3328,7 +5105,9 @@ int EngineMupdf::GetPageByLabel(const char* label) const {
         return EngineBase::GetPageByLabel(label);
     }
     int pageNo = 0;
-    if (pageLabels) {
+    if (pageLabels && IndexesReady() && pageLabelsIndex) {
+        pageLabelsIndex->Get(label, &pageNo);
+    } else if (pageLabels) {
         pageNo = pageLabels->Find(label) + 1;
     }
 
@@ -3360,6 +5139,15 @@ int EngineMupdf::GetAnnotations(Vec<Annotation*>* annotsOut) {
     return nAnnots;
 }
 
+void SetEngineMupdfJpxDecodeThreads(int n) {
+    fz_set_jpx_decode_threads(n);
+}
+
+void SetEngineMupdfFontListCacheDir(const char* dir) {
+    AutoFreeStr path = dir ? path::Join(dir, kFontListCacheFileName) : nullptr;
+    set_system_font_list_cache_path(path);
+}
+
 bool IsEngineMupdfSupportedFileType(Kind kind) {
     if (kind == kindFilePDF) {
         return true;
@@ -3438,8 +5226,9 @@ EngineBase* CreateEngineMupdfFromFile(const char* path, Kind kind, int displayDP
     return engine;
 }
 
-EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, PasswordUI* pwdUI) {
-    EngineMupdf* engine = new EngineMupdf();
+EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, PasswordUI* pwdUI,
+                                        size_t maxStoreSize) {
+    EngineMupdf* engine = new EngineMupdf(maxStoreSize ? maxStoreSize : FZ_STORE_DEFAULT);
     if (!engine->Load(stream, nameHint, pwdUI)) {
         delete engine;
         return nullptr;
@@ -3457,11 +5246,137 @@ EngineBase* CreateEngineMupdfFromData(const ByteSlice& data, const char* nameHin
     return engine;
 }
 
+// for Explorer thumbnails of many files, a fully loaded engine is too expensive:
+// FinishLoading() walks the whole page tree and loads outline, attachments and
+// page labels. This only opens page 1 (or its embedded /Thumb image, if it's big enough)
+// and renders with less anti-aliasing, which isn't visible at that size
+RenderedBitmap* EngineMupdfRenderThumbnail(IStream* stream, Size size) {
+    if (!stream || size.IsEmpty()) {
+        return nullptr;
+    }
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        return nullptr;
+    }
+    fz_set_aa_level(ctx, 4);
+
+    fz_stream* stm = nullptr;
+    pdf_document* doc = nullptr;
+    fz_page* page = nullptr;
+    fz_image* thumb = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    RenderedBitmap* bmp = nullptr;
+
+    fz_var(stm);
+    fz_var(doc);
+    fz_var(page);
+    fz_var(thumb);
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(bmp);
+
+    fz_try(ctx) {
+        stm = FzOpenIStream(ctx, stream);
+        doc = pdf_open_document_with_stream(ctx, stm);
+        if (pdf_needs_password(ctx, doc)) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "document is password protected");
+        }
+
+        pdf_obj* thumbObj = pdf_dict_get(ctx, pdf_lookup_page_obj(ctx, doc, 0), PDF_NAME(Thumb));
+        if (pdf_is_stream(ctx, thumbObj)) {
+            int w = pdf_dict_get_int(ctx, thumbObj, PDF_NAME(Width));
+            int h = pdf_dict_get_int(ctx, thumbObj, PDF_NAME(Height));
+            // upscaling the (usually tiny) embedded thumbnail would look blurry
+            if (w >= size.dx || h >= size.dy) {
+                thumb = pdf_load_image(ctx, doc, thumbObj);
+            }
+        }
+
+        fz_rect bounds;
+        if (thumb) {
+            bounds = fz_make_rect(0, 0, (float)thumb->w, (float)thumb->h);
+        } else {
+            page = fz_load_page(ctx, (fz_document*)doc, 0);
+            bounds = fz_bound_page(ctx, page);
+        }
+        float zoom = std::min(size.dx / (bounds.x1 - bounds.x0), size.dy / (bounds.y1 - bounds.y0));
+        int dx = std::max((int)((bounds.x1 - bounds.x0) * zoom), 1);
+        int dy = std::max((int)((bounds.y1 - bounds.y0) * zoom), 1);
+
+        pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), dx, dy, nullptr, 0);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        dev = fz_new_draw_device(ctx, fz_identity, pix);
+        if (thumb) {
+            fz_fill_image(ctx, dev, thumb, fz_scale((float)dx, (float)dy), 1.f, fz_default_color_params);
+        } else {
+            fz_matrix ctm = fz_pre_translate(fz_scale(zoom, zoom), -bounds.x0, -bounds.y0);
+            fz_run_page(ctx, page, dev, ctm, nullptr);
+        }
+        fz_close_device(ctx, dev);
+        bmp = NewRenderedFzPixmap(ctx, pix);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_image(ctx, thumb);
+        fz_drop_page(ctx, page);
+        pdf_drop_document(ctx, doc);
+        fz_drop_stream(ctx, stm);
+    }
+    fz_catch(ctx) {
+        logf("EngineMupdfRenderThumbnail: %s\n", fz_caught_message(ctx));
+        bmp = nullptr;
+    }
+    fz_drop_context(ctx);
+    return bmp;
+}
+
 int EngineMupdfGetAnnotations(EngineBase* engine, Vec<Annotation*>* annotsOut) {
     EngineMupdf* epdf = AsEngineMupdf(engine);
     return epdf->GetAnnotations(annotsOut);
 }
 
+// frees the loaded page and its cached display list. For callers that look at
+// every page once, e.g. the search filter, which would otherwise keep all pages loaded
+void EngineMupdf::ReleasePage(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    FzPageInfo* pageInfo = pages[pageNo - 1];
+    if (pageInfo->fullyLoaded) {
+        // links and images have been handed out and must stay valid
+        return;
+    }
+    ScopedCritSec ctxScope(ctxAccess);
+    DropDisplayList(pageInfo);
+    if (pageInfo->page) {
+        fz_drop_page(ctx, pageInfo->page);
+        pageInfo->page = nullptr;
+        loadedPages.Remove(pageInfo);
+    }
+}
+
+void EngineMupdfReleasePage(EngineBase* engine, int pageNo) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    epdf->ReleasePage(pageNo);
+}
+
+bool EngineMupdfFontListReady(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    return !epdf || epdf->StartExtractingFontList();
+}
+
+// true if the file isn't the one that was loaded anymore (or if it wasn't loaded from a file)
+bool EngineMupdfFileChangedSinceLoad(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    const char* path = epdf->FilePath();
+    if (!path || epdf->loadedFileSize < 0) {
+        return true;
+    }
+    FILETIME modified = file::GetModificationTime(path);
+    return file::GetSize(path) != epdf->loadedFileSize || CompareFileTime(&modified, &epdf->loadedFileTime) != 0;
+}
+
 bool EngineMupdfHasUnsavedAnnotations(EngineBase* engine) {
     EngineMupdf* epdf = AsEngineMupdf(engine);
     if (!epdf->pdfdoc) {
@@ -3474,6 +5389,82 @@ bool EngineMupdfHasUnsavedAnnotations(EngineBase* engine) {
     return epdf->modifiedAnnotations;
 }
 
+static void Md5UpdateRawStream(fz_context* ctx, fz_md5* md5, pdf_obj* obj) {
+    if (!pdf_is_stream(ctx, obj)) {
+        return;
+    }
+    fz_buffer* buf = pdf_load_raw_stream(ctx, obj);
+    fz_md5_update(md5, buf->data, buf->len);
+    fz_drop_buffer(ctx, buf);
+}
+
+static void Md5UpdateRect(fz_context* ctx, fz_md5* md5, pdf_obj* obj) {
+    fz_rect r = pdf_to_rect(ctx, obj);
+    fz_md5_update(md5, (const unsigned char*)&r, sizeof(r));
+}
+
+// digest of what a page looks like: its size, rotation, the raw data of its content streams
+// and of the images, forms and annotation appearances it uses. Fonts aren't included
+// as TeX re-subsets them on every compile without changing how existing glyphs look.
+// Used to find out which pages didn't change when a document is reloaded
+bool EngineMupdfGetPageDigests(EngineBase* engine, Vec<u64>& digests) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf || !epdf->pdfdoc) {
+        return false;
+    }
+    ScopedCritSec scope(epdf->ctxAccess);
+    fz_context* ctx = epdf->ctx;
+    bool ok = true;
+    for (int i = 0; i < epdf->pageCount && ok; i++) {
+        fz_md5 md5;
+        fz_md5_init(&md5);
+        fz_try(ctx) {
+            pdf_obj* pageObj = pdf_lookup_page_obj(ctx, epdf->pdfdoc, i);
+            Md5UpdateRect(ctx, &md5, pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(MediaBox)));
+            Md5UpdateRect(ctx, &md5, pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(CropBox)));
+            fz_md5_update_int64(&md5, pdf_to_int(ctx, pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(Rotate))));
+
+            pdf_obj* contents = pdf_dict_get(ctx, pageObj, PDF_NAME(Contents));
+            if (pdf_is_array(ctx, contents)) {
+                int n = pdf_array_len(ctx, contents);
+                for (int j = 0; j < n; j++) {
+                    Md5UpdateRawStream(ctx, &md5, pdf_array_get(ctx, contents, j));
+                }
+            } else {
+                Md5UpdateRawStream(ctx, &md5, contents);
+            }
+
+            pdf_obj* res = pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(Resources));
+            pdf_obj* xobjs = pdf_dict_get(ctx, res, PDF_NAME(XObject));
+            int n = pdf_dict_len(ctx, xobjs);
+            for (int j = 0; j < n; j++) {
+                const char* name = pdf_to_name(ctx, pdf_dict_get_key(ctx, xobjs, j));
+                fz_md5_update(&md5, (const unsigned char*)name, str::Len(name));
+                Md5UpdateRawStream(ctx, &md5, pdf_dict_get_val(ctx, xobjs, j));
+            }
+
+            pdf_obj* annots = pdf_dict_get(ctx, pageObj, PDF_NAME(Annots));
+            n = pdf_array_len(ctx, annots);
+            for (int j = 0; j < n; j++) {
+                pdf_obj* annot = pdf_array_get(ctx, annots, j);
+                Md5UpdateRect(ctx, &md5, pdf_dict_get(ctx, annot, PDF_NAME(Rect)));
+                pdf_obj* ap = pdf_dict_get(ctx, pdf_dict_get(ctx, annot, PDF_NAME(AP)), PDF_NAME(N));
+                Md5UpdateRawStream(ctx, &md5, ap);
+            }
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "cannot calculate digest of page %d", i + 1);
+            ok = false;
+        }
+        u8 digest[16];
+        fz_md5_final(&md5, digest);
+        u64 v;
+        memcpy(&v, digest, sizeof(v));
+        digests.Append(v);
+    }
+    return ok;
+}
+
 bool EngineMupdfSupportsAnnotations(EngineBase* engine) {
     EngineMupdf* epdf = AsEngineMupdf(engine);
     return (epdf->pdfdoc != nullptr);
@@ -3547,12 +5538,22 @@ void EngineMupdf::InvalideAnnotationsForPage(int pageNo) {
     if (!pdfdoc) {
         return;
     }
+    {
+        // the fonts used by annotations are part of the font list
+        ScopedCritSec scope(ctxAccess);
+        str::FreePtr(&fontListCache);
+        fontListExtracted = false;
+        fontListGeneration++;
+    }
     ScopedCritSec scope(&pagesAccess);
     CrashIf(pageNo < 1 || pageNo > pageCount);
     int pageIdx = pageNo - 1;
     FzPageInfo* pageInfo = pages[pageIdx];
     if (pageInfo) {
         pageInfo->commentsNeedRebuilding = true;
+        pageInfo->listOutOfDate = true;
+        pageInfo->notPaletteImage = false;
+        pageInfo->grayContent = -1;
     }
 }
 
@@ -2,6 +2,9 @@
    License: GPLv3 */
 
 struct Annotation;
+namespace dict {
+class MapStrToInt;
+}
 
 struct FitzPageImageInfo {
     fz_rect rect = fz_unit_rect;
@@ -12,6 +15,37 @@ struct FitzPageImageInfo {
     }
 };
 
+// a rendered tile of FzPageInfo::contentsList, so that annotations can be
+// drawn over it without rendering the page content again
+struct FzContentTile {
+    int pageNo = 0;
+    fz_matrix ctm{};
+    // also has the position and size of the tile
+    fz_pixmap* pix = nullptr;
+};
+
+// where a named destination points to, see EngineMupdf::BuildIndexes()
+struct NamedDestPos {
+    int pageNo = 0;
+    float x = 0;
+    float y = 0;
+};
+
+// uniform grid over the elements of a page, so that hit-testing
+// (on every mouse move) only looks at the elements near the cursor
+struct FzElementsGrid {
+    // in the order in which they take precedence when they overlap
+    Vec<IPageElement*> elements;
+    Vec<RectF> rects;
+    RectF bounds{};
+    int cols = 0;
+    int rows = 0;
+    // cellElements[cellStart[i]] to cellElements[cellStart[i + 1] - 1] are
+    // the indexes of the elements overlapping cell i
+    Vec<int> cellStart;
+    Vec<int> cellElements;
+};
+
 struct FzPageInfo {
     int pageNo = 0; // 1-based
     fz_page* page = nullptr;
@@ -23,10 +57,13 @@ struct FzPageInfo {
 
     // auto-detected links
     Vec<IPageElement*> autoLinks;
+    // set when the page is fully loaded but autoLinks haven't been detected yet
+    bool linkifyPending = false;
     // comments are made out of annotations
     Vec<IPageElement*> comments;
 
     Vec<IPageElement*> allElements;
+    FzElementsGrid elementsGrid;
     bool gotAllElements = false;
 
     RectF mediabox{};
@@ -35,13 +72,37 @@ struct FzPageInfo {
     // if false, only loaded page (fast)
     // if true, loaded expensive info (extracted text etc.)
     bool fullyLoaded = false;
+    // text extracted while fully loading, handed out once by ExtractPageText()
+    // guarded by pagesAccess
+    PageText text;
 
     bool commentsNeedRebuilding = true;
+
+    // page content recorded for re-rendering at different zoom levels,
+    // rotations and tiles without re-interpreting content streams.
+    // guarded by ctxAccess
+    fz_display_list* list = nullptr;
+    // for PDF pages whose annotations have changed, the content without the
+    // annotations so that list can be re-recorded without interpreting it again
+    fz_display_list* contentsList = nullptr;
+    // the annotations and widgets of list, only set together with contentsList
+    fz_display_list* annotsList = nullptr;
+    // size of list, contentsList and annotsList
+    size_t listSize = 0;
+    // set when annotations change
+    bool listOutOfDate = false;
+    // set after a rendering of this page didn't fit in 8-bit palette
+    // a stale value only costs a wasted (or skipped) palette scan
+    bool notPaletteImage = false;
+    // 1 if the page has no color content and is rendered in 8-bit gray,
+    // 0 if it has color, -1 if not yet known
+    int grayContent = -1;
 };
 
 class EngineMupdf : public EngineBase {
   public:
-    EngineMupdf();
+    // maxStoreSize limits the memory used by fitz for caching fonts, images etc.
+    explicit EngineMupdf(size_t maxStoreSize = FZ_STORE_DEFAULT);
     ~EngineMupdf() override;
     EngineBase* Clone() override;
 
@@ -49,6 +110,7 @@ class EngineMupdf : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool DrawPageOnDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -61,6 +123,7 @@ class EngineMupdf : public EngineBase {
     char* GetProperty(DocumentProperty prop) override;
 
     bool BenchLoadPage(int pageNo) override;
+    void GetMemStats(EngineMemStats& stats) override;
 
     Vec<IPageElement*> GetElements(int pageNo) override;
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
@@ -74,13 +137,21 @@ class EngineMupdf : public EngineBase {
     char* GetPageLabel(int pageNo) const override;
     int GetPageByLabel(const char* label) const override;
 
+    bool IsPageSizeUpdatePending() override;
+    bool UpdatePageSizes() override;
+
     int GetAnnotations(Vec<Annotation*>* annotsOut);
+    void ReleasePage(int pageNo);
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
+    // ctxAccess guards ctx and the document. It's separate from fitz locks
+    // so that contexts cloned for rendering don't block on it
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    CRITICAL_SECTION docAccess;
 
+    // used by fitz to synchronize ctx and its clones (fz_clone_context)
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
     fz_context* ctx = nullptr;
@@ -97,24 +168,108 @@ class EngineMupdf : public EngineBase {
 
     TocTree* tocTree = nullptr;
 
+    // pages that have a cached display list, least recently used first
+    Vec<FzPageInfo*> pagesWithList;
+    size_t displayListsSize = 0;
+
+    // least recently used first. guarded by contentTilesAccess
+    Vec<FzContentTile> contentTiles;
+    size_t contentTilesSize = 0;
+    CRITICAL_SECTION contentTilesAccess;
+
+    // pages with a loaded fz_page, least recently used first. guarded by pagesAccess
+    Vec<FzPageInfo*> loadedPages;
+    int nDroppedPages = 0;
+
+    // for documents with many pages, mediaboxes are read on mediaboxThread
+    // into readMediaboxes. guarded by ctxAccess
+    HANDLE mediaboxThread = nullptr;
+    Vec<RectF> readMediaboxes;
+    bool mediaboxesRead = false;
+    bool mediaboxesApplied = false;
+    bool abortMediaboxes = false;
+
+    // fonts and colorspaces used by the first pages are loaded into
+    // the fz_store on warmUpThread after loading. guarded by ctxAccess
+    HANDLE warmUpThread = nullptr;
+    bool abortWarmUp = false;
+    // fonts of pages 1 to warmUpFontsPages found by WarmUpResources(), so that
+    // ExtractFontList() doesn't have to collect them again. guarded by ctxAccess
+    Vec<pdf_obj*> warmUpFonts;
+    int warmUpFontsPages = 0;
+
+    // the font list (DocumentProperty::FontList) is extracted on fontListThread,
+    // see StartExtractingFontList(). guarded by ctxAccess
+    HANDLE fontListThread = nullptr;
+    char* fontListCache = nullptr;
+    bool fontListExtracted = false;
+    // incremented when the font list is invalidated, so that fontListThread
+    // doesn't publish a list extracted before that
+    int fontListGeneration = 0;
+    bool abortFontList = false;
+
+    // tocTree is built on tocThread after loading, GetToc() waits for it.
+    // abortToc is guarded by ctxAccess
+    HANDLE tocThread = nullptr;
+    bool abortToc = false;
+
+    // hash indexes of pageLabels and of the named destinations, built on indexThread
+    // after the first lookup (until then, lookups are slow). They're only read once
+    // the thread has finished, so lookups don't need any locks. abortIndexes is
+    // guarded by ctxAccess
+    mutable HANDLE indexThread = nullptr;
+    dict::MapStrToInt* pageLabelsIndex = nullptr;
+    dict::MapStrToInt* namedDestsIndex = nullptr;
+    Vec<NamedDestPos> namedDestsPos;
+    bool abortIndexes = false;
+
+    // engines created with the default store size share a global budget
+    // for their stores, see DistributeStoreBudget()
+    bool inStoreBudget = false;
+
     // used to track "dirty" state of annotations. not perfect because if we add and delete
     // the same annotation, we should be back to 0
     bool modifiedAnnotations = false;
 
+    // the file as it was when it was loaded, to detect changes on disk
+    FILETIME loadedFileTime{};
+    i64 loadedFileSize = -1;
+
+    // only set while Clone() loads this engine
+    EngineMupdf* cloneOf = nullptr;
+
     bool Load(const char* filePath, PasswordUI* pwdUI = nullptr);
     bool Load(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr);
     // TODO(port): fz_stream can no-longer be re-opened (fz_clone_stream)
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, const char* nameHing, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
+    bool StartReadingMediaboxes();
+    void ReadMediaboxes();
+    void StartWarmUp();
+    void WarmUpResources();
+    void StartBuildingToc();
+    bool IndexesReady() const;
+    void BuildIndexes();
+    TocTree* BuildToc();
     RenderedBitmap* GetPageImage(int pageNo, RectF rect, int imageIdx);
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
+    FzPageInfo* LoadFzPageOnly(int pageNo);
+    void MarkPageUsed(FzPageInfo* pageInfo);
+    void DropUnusedPages();
+    fz_display_list* GetDisplayList(FzPageInfo* pageInfo, RenderTarget target, fz_cookie* cookie,
+                                    bool addToCache = true);
+    void DropDisplayList(FzPageInfo* pageInfo);
+    void LinkifyPage(FzPageInfo* pageInfo);
+    bool LoadContentTile(fz_context* tctx, int pageNo, fz_matrix ctm, fz_pixmap* pix);
+    void SaveContentTile(fz_context* tctx, int pageNo, fz_matrix ctm, fz_pixmap* pix);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
     char* ExtractFontList();
+    bool StartExtractingFontList();
 
     ByteSlice LoadStreamFromPDFFile(const char* filePath);
     void InvalideAnnotationsForPage(int pageNo);
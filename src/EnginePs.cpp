@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include <zlib.h>
 #include "utils/ByteReader.h"
+#include "utils/CryptoUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
@@ -19,6 +20,88 @@
 
 Kind kindEnginePostScript = "enginePostScript";
 
+// Ghostscript is stopped if the converted PDF doesn't grow for that long
+constexpr DWORD kGhostscriptIdleTimeoutMs = 40000;
+// how often to check if the converted PDF is still growing
+constexpr DWORD kGhostscriptPollMs = 500;
+
+static char* gPsCacheDir = nullptr;
+
+void SetEnginePsCacheDir(const char* dir) {
+    str::ReplaceWithCopy(&gPsCacheDir, dir);
+}
+
+// the converted PDF is re-used as long as the content of the PostScript file doesn't change
+// the caller must free()
+static char* GetPsCachePath(const char* path) {
+    if (!gPsCacheDir) {
+        return nullptr;
+    }
+    u8 digest[16]{};
+    if (!CalcFileFingerprint(path, digest)) {
+        return nullptr;
+    }
+    AutoFreeStr name = str::MemToHex(digest, dimof(digest));
+    return path::Join(gPsCacheDir, str::JoinTemp(name, kPsCacheExt));
+}
+
+static EngineBase* CreateEngineFromPdfData(const ByteSlice& pdfData, const char* nameHint) {
+    IStream* strm = CreateStreamFromData(pdfData);
+    ScopedComPtr<IStream> stream(strm);
+    if (!stream) {
+        return nullptr;
+    }
+    return CreateEngineMupdfFromStream(stream, nameHint);
+}
+
+static EngineBase* LoadCachedPdf(const char* cachePath) {
+    ByteSlice pdfData = file::ReadFile(cachePath);
+    if (pdfData.empty()) {
+        return nullptr;
+    }
+    EngineBase* engine = CreateEngineFromPdfData(pdfData, cachePath);
+    pdfData.Free();
+    if (!engine) {
+        file::Delete(cachePath);
+        return nullptr;
+    }
+    // mark as recently used for CleanUpTextCache()
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(cachePath, now);
+    return engine;
+}
+
+// Ghostscript's pdfwrite device writes pages to the output file as it converts
+// them, so a big file taking long to convert isn't mistaken for a hang
+static DWORD WaitForGhostscript(HANDLE process, const char* outPath) {
+    DWORD exitCode = EXIT_FAILURE;
+    // allow to disable the timeout
+    bool noTimeout = GetEnvironmentVariable(L"SUMATRAPDF_NO_GHOSTSCRIPT_TIMEOUT", nullptr, 0) != 0;
+    i64 lastSize = -1;
+    DWORD idleMs = 0;
+    for (;;) {
+        DWORD res = WaitForSingleObject(process, noTimeout ? INFINITE : kGhostscriptPollMs);
+        if (res != WAIT_TIMEOUT) {
+            break;
+        }
+        i64 size = file::GetSize(outPath);
+        if (size != lastSize) {
+            lastSize = size;
+            idleMs = 0;
+            continue;
+        }
+        idleMs += kGhostscriptPollMs;
+        if (idleMs >= kGhostscriptIdleTimeoutMs) {
+            logf("WaitForGhostscript: no progress for %d ms, stopping\n", (int)idleMs);
+            break;
+        }
+    }
+    GetExitCodeProcess(process, &exitCode);
+    TerminateProcess(process, 1);
+    return exitCode;
+}
+
 static char* GetGhostscriptPath() {
     const char* gsProducts[] = {
         "AFPL Ghostscript",
@@ -142,7 +225,8 @@ static Rect ExtractDSCPageSize(const WCHAR* path) {
 }
 #endif
 
-static EngineBase* ps2pdf(const char* path) {
+// if cachePath is set, the converted PDF is saved there
+static EngineBase* ps2pdf(const char* path, const char* cachePath) {
     // TODO: read from gswin32c's stdout instead of using a TEMP file
     AutoFreeStr shortPath = path::ShortPath(path);
     AutoFreeStr tmpFile = path::GetTempFilePath("PsE");
@@ -180,15 +264,7 @@ static EngineBase* ps2pdf(const char* path) {
     }
 
     // TODO: should show a message box and do it in a background thread
-    DWORD timeoutInMs = 40000;
-    // allow to disable the timeout
-    if (GetEnvironmentVariable(L"SUMATRAPDF_NO_GHOSTSCRIPT_TIMEOUT", nullptr, 0)) {
-        timeoutInMs = INFINITE;
-    }
-    DWORD exitCode = EXIT_FAILURE;
-    WaitForSingleObject(process, timeoutInMs);
-    GetExitCodeProcess(process, &exitCode);
-    TerminateProcess(process, 1);
+    DWORD exitCode = WaitForGhostscript(process, tmpFile);
     CloseHandle(process);
     if (exitCode != EXIT_SUCCESS) {
         return nullptr;
@@ -199,17 +275,15 @@ static EngineBase* ps2pdf(const char* path) {
         return nullptr;
     }
 
-    IStream* strm = CreateStreamFromData(pdfData);
-    pdfData.Free();
-    ScopedComPtr<IStream> stream(strm);
-    if (!stream) {
-        return nullptr;
+    EngineBase* engine = CreateEngineFromPdfData(pdfData, tmpFile);
+    if (engine && cachePath && dir::CreateForFile(cachePath)) {
+        file::WriteFile(cachePath, pdfData);
     }
-
-    return CreateEngineMupdfFromStream(stream, tmpFile);
+    pdfData.Free();
+    return engine;
 }
 
-static EngineBase* psgz2pdf(const char* fileName) {
+static EngineBase* psgz2pdf(const char* fileName, const char* cachePath) {
     AutoFreeStr tmpFile(path::GetTempFilePath("PsE"));
     ScopedFile tmpFileScope(tmpFile);
     if (!tmpFile) {
@@ -240,7 +314,7 @@ static EngineBase* psgz2pdf(const char* fileName) {
     fclose(outFile);
     gzclose(inFile);
 
-    return ps2pdf(tmpFile);
+    return ps2pdf(tmpFile, cachePath);
 }
 
 // EnginePs is mostly a proxy for a PdfEngine that's fed whatever
@@ -277,6 +351,14 @@ class EnginePs : public EngineBase {
         return pdfEngine->PageContentBox(pageNo, target);
     }
 
+    bool IsPageSizeUpdatePending() override {
+        return pdfEngine->IsPageSizeUpdatePending();
+    }
+
+    bool UpdatePageSizes() override {
+        return pdfEngine->UpdatePageSizes();
+    }
+
     RenderedBitmap* RenderPage(RenderPageArgs& args) override {
         return pdfEngine->RenderPage(args);
     }
@@ -357,10 +439,14 @@ class EnginePs : public EngineBase {
             return false;
         }
         SetFilePath(fileName);
-        if (file::StartsWith(fileName, "\x1F\x8B")) {
-            pdfEngine = psgz2pdf(fileName);
-        } else {
-            pdfEngine = ps2pdf(fileName);
+        AutoFreeStr cachePath = GetPsCachePath(fileName);
+        if (cachePath && file::Exists(cachePath)) {
+            pdfEngine = LoadCachedPdf(cachePath);
+        }
+        if (!pdfEngine && file::StartsWith(fileName, "\x1F\x8B")) {
+            pdfEngine = psgz2pdf(fileName, cachePath);
+        } else if (!pdfEngine) {
+            pdfEngine = ps2pdf(fileName, cachePath);
         }
 
         if (str::EndsWithI(FilePath(), ".eps")) {
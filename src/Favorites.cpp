@@ -159,13 +159,7 @@ void Favorites::ResetMenuIds() {
 }
 
 FileState* Favorites::GetFavByFilePath(const char* filePath) {
-    // it's likely that we'll ask about the info for the same
-    // file as in previous call, so use one element cache
-    FileState* fs = gFileHistory.Get(idxCache);
-    if (!fs || !str::Eq(fs->filePath, filePath)) {
-        fs = gFileHistory.FindByName(filePath, &idxCache);
-    }
-    return fs;
+    return gFileHistory.FindByName(filePath, nullptr);
 }
 
 bool Favorites::IsPageInFavorites(const char* filePath, int pageNo) {
@@ -228,6 +222,7 @@ void Favorites::AddOrReplace(const char* filePath, int pageNo, const char* name,
         fav->favorites->Append(fn);
         fav->favorites->Sort(SortByPageNo);
     }
+    version++;
 }
 
 void Favorites::Remove(const char* filePath, int pageNo) {
@@ -242,6 +237,7 @@ void Favorites::Remove(const char* filePath, int pageNo) {
 
     fav->favorites->Remove(fn);
     DeleteFavorite(fn);
+    version++;
 
     if (!gGlobalPrefs->rememberOpenedFiles && 0 == fav->favorites->size()) {
         gFileHistory.Remove(fav);
@@ -259,6 +255,7 @@ void Favorites::RemoveAllForFile(const char* filePath) {
         DeleteFavorite(fav->favorites->at(i));
     }
     fav->favorites->Reset();
+    version++;
 
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Remove(fav);
@@ -427,6 +424,47 @@ static void AppendFavMenus(HMENU m, const char* currFilePath) {
 
 #include "Accelerators.h"
 
+// what the favorites menu was last built for. Menu ids of favorites are
+// assigned when building it, so it can only be re-used if it's the same menu
+struct FavMenuState {
+    MainWindow* win = nullptr;
+    HMENU menu = nullptr;
+    DocController* ctrl = nullptr;
+    int pageNo = 0;
+    int favoritesVersion = 0;
+    int pathChanges = 0;
+    Vec<FileState*>* states = nullptr;
+};
+
+static FavMenuState gFavMenuState;
+
+static FavMenuState GetFavMenuState(MainWindow* win, HMENU menu) {
+    FavMenuState res;
+    res.win = win;
+    res.menu = menu;
+    res.ctrl = win->IsDocLoaded() ? win->ctrl : nullptr;
+    res.pageNo = res.ctrl ? win->currPageNo : 0;
+    res.favoritesVersion = gFavorites.version;
+    res.pathChanges = gFileStatePathChanges;
+    res.states = gFileHistory.states;
+    return res;
+}
+
+// the favorites menu is rebuilt when it's opened (see UpdateAppMenu()),
+// which isn't necessary if nothing has changed since the last time
+bool IsFavMenuUpToDate(MainWindow* win, HMENU menu) {
+    FavMenuState curr = GetFavMenuState(win, menu);
+    FavMenuState& last = gFavMenuState;
+    return curr.win == last.win && curr.menu == last.menu && curr.ctrl == last.ctrl && curr.pageNo == last.pageNo &&
+           curr.favoritesVersion == last.favoritesVersion && curr.pathChanges == last.pathChanges &&
+           curr.states == last.states;
+}
+
+// menus are re-created e.g. when changing the language, and a new menu might get the same handle
+void InvalidateFavMenu() {
+    gFavMenuState = FavMenuState();
+}
+
 // Called when a user opens "Favorites" top-level menu. We need to construct
 // the menu:
 // - disable add/remove menu items if no document is opened
@@ -460,6 +498,7 @@ void RebuildFavMenu(MainWindow* win, HMENU menu) {
         AppendFavMenus(menu, win->ctrl->GetFilePath());
     }
     MenuSetEnabled(menu, CmdFavoriteToggle, HasFavorites());
+    gFavMenuState = GetFavMenuState(win, menu);
 }
 
 void ToggleFavorites(MainWindow* win) {
@@ -19,9 +19,12 @@ they are for navigation only. Presentation settings are remembered on a
 per-file basis in FileHistory.
 */
 
+struct MainWindow;
+
 // Favorites is a convenience interface into gFileHistory
 struct Favorites {
-    size_t idxCache = (size_t)-1;
+    // incremented when a favorite is added or removed
+    int version = 0;
 
     Favorites() = default;
 
@@ -41,6 +44,8 @@ void AddFavoriteForCurrentPage(MainWindow* win, int pageNo);
 void AddFavoriteForCurrentPage(MainWindow* win);
 void DelFavorite(const char* filePath, int pageNo);
 void RebuildFavMenu(MainWindow* win, HMENU menu);
+bool IsFavMenuUpToDate(MainWindow* win, HMENU menu);
+void InvalidateFavMenu();
 void CreateFavorites(MainWindow* win);
 void ToggleFavorites(MainWindow* win);
 void PopulateFavTreeIfNeeded(MainWindow* win);
@@ -2,12 +2,14 @@
 License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 
 #include "Settings.h"
 #include "GlobalPrefs.h"
 #include "FileHistory.h"
+#include "Favorites.h"
 
 /* Handling of file history list.
 
@@ -35,6 +37,9 @@ quits.
 // (to keep the settings file within reasonable bounds)
 #define FILE_HISTORY_MAX_FILES 1000
 
+// the index is long-lived, so start small (it grows as needed)
+#define PATH_INDEX_INITIAL_SIZE 256
+
 // sorts the most often used files first
 static int cmpOpenCount(const void* a, const void* b) {
     FileState* dsA = *(FileState**)a;
@@ -55,17 +60,98 @@ static int cmpOpenCount(const void* a, const void* b) {
     return dsA->index < dsB->index ? -1 : 1;
 }
 
+FileHistory::~FileHistory() {
+    delete pathIndex;
+}
+
+// paths are compared case-insensitively (as with str::EqI)
+static char* PathIndexKeyTemp(const char* path) {
+    return str::ToLowerInPlace(str::DupTemp(path));
+}
+
+bool FileHistory::IsIndexValid() const {
+    if (!pathIndex || !states || indexedPathChanges != gFileStatePathChanges) {
+        return false;
+    }
+    return indexedCount == states->isize();
+}
+
+void FileHistory::InvalidateIndex() const {
+    delete pathIndex;
+    pathIndex = nullptr;
+}
+
+void FileHistory::BuildIndex() const {
+    delete pathIndex;
+    pathIndex = new dict::MapStrToInt(PATH_INDEX_INITIAL_SIZE);
+    indexedStates.Reset();
+    indexedCount = 0;
+    indexedPathChanges = gFileStatePathChanges;
+    indexHasDuplicates = false;
+    if (!states) {
+        return;
+    }
+    for (FileState* fs : *states) {
+        AddToIndex(fs);
+    }
+}
+
+// for duplicate paths, the one added last is found (like the linear
+// search found the last one in states)
+void FileHistory::AddToIndex(FileState* fs) const {
+    int idx = 0;
+    if (pathIndex->Insert(PathIndexKeyTemp(fs->filePath), indexedStates.isize(), &idx)) {
+        indexedStates.Append(fs);
+    } else {
+        indexedStates[idx] = fs;
+        indexHasDuplicates = true;
+    }
+    indexedCount++;
+}
+
+void FileHistory::RemoveFromIndex(FileState* fs) const {
+    if (indexHasDuplicates) {
+        // another state with the same path might have to be found instead
+        InvalidateIndex();
+        return;
+    }
+    int idx = 0;
+    char* key = PathIndexKeyTemp(fs->filePath);
+    if (pathIndex->Get(key, &idx) && indexedStates[idx] == fs) {
+        pathIndex->Remove(key, &idx);
+        indexedStates[idx] = nullptr;
+    }
+    indexedCount--;
+}
+
 void FileHistory::Append(FileState* fs) const {
     CrashIf(!fs->filePath);
+    bool updateIndex = IsIndexValid();
     states->Append(fs);
+    if (updateIndex) {
+        AddToIndex(fs);
+    }
+}
+
+// the favorites menu is only rebuilt if it might have changed
+static void InvalidateFavMenuIfHasFavorites(FileState* fs) {
+    if (fs->favorites->size() > 0) {
+        InvalidateFavMenu();
+    }
 }
 
 void FileHistory::Remove(FileState* fs) const {
+    bool updateIndex = IsIndexValid() && states->Contains(fs);
     states->Remove(fs);
+    if (updateIndex) {
+        RemoveFromIndex(fs);
+    }
+    InvalidateFavMenuIfHasFavorites(fs);
 }
 
 void FileHistory::UpdateStatesSource(Vec<FileState*>* states) {
     this->states = states;
+    InvalidateIndex();
 }
 
 void FileHistory::Clear(bool keepFavorites) const {
@@ -78,10 +164,12 @@ void FileHistory::Clear(bool keepFavorites) const {
             states->at(i)->openCount = 0;
             keep.Append(states->at(i));
         } else {
+            InvalidateFavMenuIfHasFavorites(states->at(i));
             DeleteDisplayState(states->at(i));
         }
     }
     *states = keep;
+    InvalidateIndex();
 }
 
 FileState* FileHistory::Get(size_t index) const {
@@ -92,39 +180,35 @@ FileState* FileHistory::Get(size_t index) const {
 }
 
 FileState* FileHistory::FindByPath(const char* filePath) const {
-    int idxExact = -1;
-    int n = states->isize();
-    for (int i = 0; i < n; i++) {
-        FileState* fs = states->at(i);
-        if (str::EqI(fs->filePath, filePath)) {
-            idxExact = i;
-        }
+    if (!filePath) {
+        return nullptr;
     }
-    if (idxExact == -1) {
+    if (!IsIndexValid()) {
+        BuildIndex();
+    }
+    int idx = 0;
+    if (!pathIndex->Get(PathIndexKeyTemp(filePath), &idx)) {
         return nullptr;
     }
-    return states->at(idxExact);
+    return indexedStates[idx];
 }
 
 // returns an exact match by path or match by just file name
 // TODO: audit the uses of FindByName and maybe convert to FindByPath
 FileState* FileHistory::FindByName(const char* filePath, size_t* idxOut) const {
-    int idxExact = -1;
-    int idxFileNameMatch = -1;
-    const char* fileName = path::GetBaseNameTemp(filePath);
-    int n = states->isize();
-    for (int i = 0; i < n; i++) {
-        FileState* fs = states->at(i);
-        if (str::EqI(fs->filePath, filePath)) {
-            idxExact = i;
-        } else if (str::EndsWithI(fs->filePath, fileName)) {
-            idxFileNameMatch = i;
+    int idFound = -1;
+    FileState* exact = FindByPath(filePath);
+    if (exact) {
+        idFound = states->Find(exact);
+    } else {
+        const char* fileName = path::GetBaseNameTemp(filePath);
+        int n = states->isize();
+        for (int i = 0; i < n; i++) {
+            if (str::EndsWithI(states->at(i)->filePath, fileName)) {
+                idFound = i;
+            }
         }
     }
-    int idFound = idxExact;
-    if (idFound == -1) {
-        idFound = idxFileNameMatch;
-    }
     if (idFound == -1) {
         return nullptr;
     }
@@ -139,15 +223,20 @@ FileState* FileHistory::MarkFileLoaded(const char* filePath) const {
     // if a history entry with the same name already exists,
     // then reuse it. That way we don't have duplicates and
     // the file moves to the front of the list
+    // (FindByPath() makes sure that the index is up to date)
     FileState* fs = FindByPath(filePath);
     if (!fs) {
         fs = NewDisplayState(filePath);
         fs->useDefaultState = true;
+        states->InsertAt(0, fs);
+        AddToIndex(fs);
     } else {
+        // moving the state doesn't change the index
         states->Remove(fs);
+        states->InsertAt(0, fs);
         fs->isMissing = false;
     }
-    states->InsertAt(0, fs);
+    SetFileUnreachable(filePath, false);
     fs->openCount++;
     return fs;
 }
@@ -232,11 +321,29 @@ void FileHistory::Purge(bool alwaysUseDefaultState) const {
         } else {
             continue;
         }
+        InvalidateFavMenuIfHasFavorites(state);
         DeleteDisplayState(state);
+        InvalidateIndex();
     }
 }
 
-// list of recently closed documents, most recent at the end
+// files in the history on drives that couldn't be checked (e.g. disconnected
+// network shares), set by FileExistenceChecker. They're shown as unavailable
+// instead of being removed and a file is cleared from it once it's opened again
+static StrVec gUnreachableFiles;
+
+void SetFileUnreachable(const char* path, bool isUnreachable) {
+    if (isUnreachable) {
+        gUnreachableFiles.AppendIfNotExists(path);
+    } else {
+        gUnreachableFiles.Remove(path);
+    }
+}
+
+bool IsFileUnreachable(const char* path) {
+    return gUnreachableFiles.Contains(path);
+}
+
 StrVec gClosedDocuments;
 
 int RecentlyCloseDocumentsCount() {
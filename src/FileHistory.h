@@ -10,12 +10,25 @@
 // Frequent Read list (space permitting)
 #define kFileHistoryMaxFrequent 10
 
+namespace dict {
+class MapStrToInt;
+}
+
 struct FileHistory {
     // owned by gGlobalPrefs->fileStates
     Vec<FileState*>* states = nullptr;
 
+    // index of states by lower-cased path into indexedStates, kept in sync by
+    // the methods below. It's rebuilt when states has been changed elsewhere
+    // (detected by its size) or a path has changed (see gFileStatePathChanges)
+    mutable dict::MapStrToInt* pathIndex = nullptr;
+    mutable Vec<FileState*> indexedStates;
+    mutable int indexedCount = 0;
+    mutable int indexedPathChanges = 0;
+    mutable bool indexHasDuplicates = false;
+
     FileHistory() = default;
-    ~FileHistory() = default;
+    ~FileHistory();
 
     void Clear(bool keepFavorites) const;
     void Append(FileState* state) const;
@@ -28,8 +41,20 @@ struct FileHistory {
     void GetFrequencyOrder(Vec<FileState*>& list) const;
     void Purge(bool alwaysUseDefaultState = false) const;
     void UpdateStatesSource(Vec<FileState*>* states);
+
+    bool IsIndexValid() const;
+    void BuildIndex() const;
+    void InvalidateIndex() const;
+    void AddToIndex(FileState* state) const;
+    void RemoveFromIndex(FileState* state) const;
 };
 
+// files that couldn't be checked at startup in reasonable time (or are on a
+// network or removable drive that's not connected). They're not hidden because they
+// might become available again. Only accessed on the UI thread
+void SetFileUnreachable(const char* path, bool isUnreachable);
+bool IsFileUnreachable(const char* path);
+
 int RecentlyCloseDocumentsCount();
 void RememberRecentlyClosedDocument(const char* path);
 char* PopRecentlyClosedDocument();
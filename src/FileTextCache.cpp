@@ -0,0 +1,528 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
+#include "utils/DirIter.h"
+#include "utils/FileUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
+#include "GlobalPrefs.h"
+#include "TextSelection.h"
+
+#include "AppTools.h"
+#include "FileTextCache.h"
+
+#include "utils/Log.h"
+
+// text cache files live next to the thumbnails
+constexpr const char* kTextCacheDirName = "sumatrapdfcache";
+constexpr const char* kTextCacheExt = ".txtcache";
+constexpr const char* kTextCachePattern = "*.txtcache";
+constexpr const char* kPageSizesCacheExt = ".pagesizes";
+constexpr const char* kPageSizesCachePattern = "*.pagesizes";
+constexpr const char* kContentBoxesCacheExt = ".contentboxes";
+constexpr const char* kContentBoxesCachePattern = "*.contentboxes";
+
+// bump when the file layout or the way text is extracted changes
+constexpr u32 kTextCacheVersion = 1;
+constexpr u32 kTextCacheMagic = 0x43545853; // 'STXC'
+constexpr u32 kPageSizesCacheVersion = 1;
+constexpr u32 kPageSizesCacheMagic = 0x43535053; // 'SPSC'
+constexpr u32 kContentBoxesCacheVersion = 1;
+constexpr u32 kContentBoxesCacheMagic = 0x43424353; // 'SCBC'
+
+// don't cache the text of documents with more text than that
+constexpr size_t kMaxTextCacheFileSize = 64 * 1024 * 1024;
+// least recently used cache files are deleted above that
+constexpr i64 kMaxTextCacheDirSize = 256 * 1024 * 1024;
+
+/*
+File layout (all values little-endian):
+
+TextCacheHeader
+TextCachePage[nPages] - offset 0 means the text of the page isn't cached
+for each cached page:
+  WCHAR text[len + 1] - zero terminated
+  (padding to 4 bytes)
+  Rect coords[len]
+*/
+
+struct TextCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 nPages;
+    u32 reserved;
+};
+
+struct TextCachePage {
+    u32 offset;
+    u32 len;
+};
+
+/*
+Page sizes cache file layout:
+
+PageSizesCacheHeader
+i32 dx, dy [nPages]
+*/
+
+struct PageSizesCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 nPages;
+    u32 reserved;
+};
+
+/*
+Content boxes cache file layout:
+
+PageSizesCacheHeader (with kContentBoxesCacheMagic)
+ContentBoxesCachePage[nPages]
+*/
+
+struct ContentBoxesCachePage {
+    float x, y, dx, dy;
+    u32 known;
+};
+
+static size_t AlignTo4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+TextCacheFile::~TextCacheFile() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (hMap) {
+        CloseHandle(hMap);
+    }
+    if (hFile && hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+}
+
+bool TextCacheFile::GetPageText(int pageNo, PageText* pageTextOut) const {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+    const TextCachePage* pages = (const TextCachePage*)(data + sizeof(TextCacheHeader));
+    const TextCachePage& page = pages[pageNo - 1];
+    if (page.offset == 0) {
+        return false;
+    }
+    size_t textSize = ((size_t)page.len + 1) * sizeof(WCHAR);
+    size_t coordsOffset = AlignTo4(page.offset + textSize);
+    size_t end = coordsOffset + (size_t)page.len * sizeof(Rect);
+    if (page.offset >= size || end > size || end < page.offset) {
+        return false;
+    }
+    WCHAR* text = (WCHAR*)(data + page.offset);
+    if (text[page.len] != 0) {
+        return false;
+    }
+    pageTextOut->text = text;
+    pageTextOut->coords = page.len > 0 ? (Rect*)(data + coordsOffset) : nullptr;
+    pageTextOut->len = (int)page.len;
+    return true;
+}
+
+static char* GetCachePathForFingerprint(const char* fingerPrint, const char* ext) {
+    char* cacheDir = AppGenDataFilenameTemp(kTextCacheDirName);
+    if (!cacheDir) {
+        return nullptr;
+    }
+    return path::Join(cacheDir, str::JoinTemp(fingerPrint, ext));
+}
+
+static char* GetCachePathForFile(const char* filePath, const char* ext) {
+    u8 digest[16]{};
+    if (!CalcFileFingerprint(filePath, digest)) {
+        return nullptr;
+    }
+    AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
+    return GetCachePathForFingerprint(fingerPrint, ext);
+}
+
+// pages of reflowable documents depend on window size and font settings
+bool IsReflowableEngine(EngineBase* engine) {
+    Kind kind = engine->kind;
+    return kind == kindEngineEpub || kind == kindEngineFb2 || kind == kindEngineMobi || kind == kindEnginePdb ||
+           kind == kindEngineChm || kind == kindEngineHtml || kind == kindEngineTxt;
+}
+
+// returns nullptr if what's been extracted from this document shouldn't be cached on disk
+static const char* GetCacheableFilePath(EngineBase* engine) {
+    if (!gGlobalPrefs->rememberOpenedFiles) {
+        return nullptr;
+    }
+    const char* filePath = engine->FilePath();
+    if (!filePath || !file::Exists(filePath)) {
+        return nullptr;
+    }
+    // don't leak the text or layout of encrypted documents
+    if (engine->IsPasswordProtected()) {
+        return nullptr;
+    }
+    if (IsReflowableEngine(engine)) {
+        return nullptr;
+    }
+    return filePath;
+}
+
+// returns nullptr if text of this document shouldn't be cached on disk
+// the caller must free() the result
+char* GetTextCachePath(EngineBase* engine) {
+    const char* filePath = GetCacheableFilePath(engine);
+    if (!filePath) {
+        return nullptr;
+    }
+    if (engine->IsImageCollection()) {
+        return nullptr;
+    }
+    return GetCachePathForFile(filePath, kTextCacheExt);
+}
+
+// returns nullptr if there's no valid cache file for a document with nPages
+TextCacheFile* OpenTextCacheFile(const char* cachePath, int nPages) {
+    WCHAR* pathW = ToWstrTemp(cachePath);
+    // FILE_WRITE_ATTRIBUTES to mark the file as recently used
+    DWORD access = GENERIC_READ | FILE_WRITE_ATTRIBUTES;
+    HANDLE hFile = CreateFileW(pathW, access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+
+    TextCacheFile* res = new TextCacheFile();
+    res->hFile = hFile;
+    LARGE_INTEGER fileSize;
+    size_t minSize = sizeof(TextCacheHeader) + (size_t)nPages * sizeof(TextCachePage);
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart < (i64)minSize ||
+        fileSize.QuadPart > (i64)kMaxTextCacheFileSize) {
+        goto Error;
+    }
+    res->size = (size_t)fileSize.QuadPart;
+    res->hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!res->hMap) {
+        goto Error;
+    }
+    res->data = (const u8*)MapViewOfFile(res->hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!res->data) {
+        goto Error;
+    }
+    {
+        const TextCacheHeader* hdr = (const TextCacheHeader*)res->data;
+        if (hdr->magic != kTextCacheMagic || hdr->version != kTextCacheVersion || hdr->nPages != (u32)nPages) {
+            goto Error;
+        }
+    }
+    res->nPages = nPages;
+
+    {
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        SetFileTime(hFile, nullptr, nullptr, &now);
+    }
+    return res;
+
+Error:
+    delete res;
+    file::Delete(cachePath);
+    return nullptr;
+}
+
+// pagesText[i] is nullptr for pages whose text hasn't been extracted
+// pagesText may point into mappedFile, which is deleted after its data has
+// been copied, since a file can't be overwritten while it's mapped
+bool SaveTextCacheFile(const char* cachePath, PageTextSlot** pagesText, int nPages, TextCacheFile* mappedFile) {
+    size_t size = sizeof(TextCacheHeader) + (size_t)nPages * sizeof(TextCachePage);
+    for (int i = 0; i < nPages; i++) {
+        PageTextSlot* pt = pagesText[i];
+        if (pt) {
+            size = AlignTo4(size + ((size_t)pt->len + 1) * sizeof(WCHAR));
+            size += (size_t)pt->len * sizeof(Rect);
+        }
+    }
+    u8* d = nullptr;
+    if (size <= kMaxTextCacheFileSize) {
+        d = AllocArray<u8>(size);
+    }
+    if (!d) {
+        delete mappedFile;
+        return false;
+    }
+    TextCacheHeader* hdr = (TextCacheHeader*)d;
+    hdr->magic = kTextCacheMagic;
+    hdr->version = kTextCacheVersion;
+    hdr->nPages = (u32)nPages;
+    TextCachePage* pages = (TextCachePage*)(d + sizeof(TextCacheHeader));
+    size_t off = sizeof(TextCacheHeader) + (size_t)nPages * sizeof(TextCachePage);
+    for (int i = 0; i < nPages; i++) {
+        PageTextSlot* pt = pagesText[i];
+        if (!pt) {
+            continue;
+        }
+        pages[i].offset = (u32)off;
+        pages[i].len = (u32)pt->len;
+        if (pt->len > 0) {
+            memcpy(d + off, pt->text, (size_t)pt->len * sizeof(WCHAR));
+        }
+        off = AlignTo4(off + ((size_t)pt->len + 1) * sizeof(WCHAR));
+        Rect* coords = (Rect*)(d + off);
+        for (int j = 0; j < pt->len; j++) {
+            coords[j] = pt->coords[j];
+        }
+        off += (size_t)pt->len * sizeof(Rect);
+    }
+    CrashIf(off != size);
+    delete mappedFile;
+
+    bool ok = dir::CreateForFile(cachePath) && file::WriteFile(cachePath, {d, size});
+    free(d);
+    if (!ok) {
+        file::Delete(cachePath);
+    }
+    return ok;
+}
+
+struct TextCacheFileInfo {
+    char* path;
+    i64 size;
+    FILETIME lastUsed;
+};
+
+static int CmpByLastUsedDesc(const TextCacheFileInfo* a, const TextCacheFileInfo* b) {
+    return CompareFileTime(&b->lastUsed, &a->lastUsed);
+}
+
+// deletes least recently used cache files above kMaxTextCacheDirSize
+void CleanUpTextCache() {
+    char* cacheDir = AppGenDataFilenameTemp(kTextCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    Vec<TextCacheFileInfo> files;
+    DirTraverse(cacheDir, false, [&files](WIN32_FIND_DATAW* fd, const char* path) -> bool {
+        if (str::EndsWithI(path, kTextCacheExt) || str::EndsWithI(path, kPageSizesCacheExt) ||
+            str::EndsWithI(path, kArchiveEntriesCacheExt) || str::EndsWithI(path, kPsCacheExt) ||
+            str::EndsWithI(path, kEbookLayoutCacheExt) || str::EndsWithI(path, kContentBoxesCacheExt)) {
+            files.Append({str::Dup(path), GetFileSize(fd), fd->ftLastWriteTime});
+        }
+        return true;
+    });
+    files.SortTyped(CmpByLastUsedDesc);
+
+    i64 total = 0;
+    for (TextCacheFileInfo& fi : files) {
+        total += fi.size;
+        if (total > kMaxTextCacheDirSize) {
+            file::Delete(fi.path);
+        }
+        free(fi.path);
+    }
+}
+
+// sizes of comic book pages are only known after reading the images
+// returns nullptr if they shouldn't be cached on disk
+static char* GetPageSizesCachePath(EngineBase* engine) {
+    if (!gGlobalPrefs->rememberOpenedFiles || engine->kind != kindEngineComicBooks) {
+        return nullptr;
+    }
+    const char* filePath = engine->FilePath();
+    if (!filePath || !file::Exists(filePath)) {
+        return nullptr;
+    }
+    return GetCachePathForFile(filePath, kPageSizesCacheExt);
+}
+
+// returns true if the sizes of all pages were restored from the cache
+bool LoadPageSizesCache(EngineBase* engine) {
+    AutoFreeStr cachePath = GetPageSizesCachePath(engine);
+    if (!cachePath) {
+        return false;
+    }
+    ByteSlice d = file::ReadFile(cachePath);
+    if (d.empty()) {
+        return false;
+    }
+    int nPages = engine->PageCount();
+    size_t expectedSize = sizeof(PageSizesCacheHeader) + (size_t)nPages * 2 * sizeof(i32);
+    const PageSizesCacheHeader* hdr = (const PageSizesCacheHeader*)d.data();
+    bool ok = d.size() == expectedSize && hdr->magic == kPageSizesCacheMagic &&
+              hdr->version == kPageSizesCacheVersion && hdr->nPages == (u32)nPages;
+    if (ok) {
+        const i32* sizes = (const i32*)(d.data() + sizeof(PageSizesCacheHeader));
+        Vec<Size> pageSizes;
+        for (int i = 0; i < nPages; i++) {
+            pageSizes.Append(Size(sizes[i * 2], sizes[i * 2 + 1]));
+        }
+        EngineCbxSetPageSizes(engine, pageSizes);
+    } else {
+        file::Delete(cachePath);
+    }
+    d.Free();
+    return ok;
+}
+
+// only saves the sizes once all of them are known and if they're not saved yet
+void SavePageSizesCache(EngineBase* engine) {
+    Vec<Size> pageSizes;
+    if (!EngineCbxGetPageSizes(engine, pageSizes)) {
+        return;
+    }
+    for (Size& size : pageSizes) {
+        if (size.IsEmpty()) {
+            return;
+        }
+    }
+    AutoFreeStr cachePath = GetPageSizesCachePath(engine);
+    if (!cachePath || file::Exists(cachePath)) {
+        return;
+    }
+    str::Str d;
+    PageSizesCacheHeader hdr{kPageSizesCacheMagic, kPageSizesCacheVersion, (u32)pageSizes.size(), 0};
+    d.Append((const char*)&hdr, sizeof(hdr));
+    for (Size& size : pageSizes) {
+        i32 dxdy[2] = {(i32)size.dx, (i32)size.dy};
+        d.Append((const char*)dxdy, sizeof(dxdy));
+    }
+    if (dir::CreateForFile(cachePath)) {
+        file::WriteFile(cachePath, d.AsByteSlice());
+    }
+}
+
+// returns nullptr if content boxes of this document shouldn't be cached on disk
+// content boxes of ebook pages are cheap (and depend on the layout settings) while
+// those of image documents decode the whole image and EngineMulti opens every file,
+// so these are only computed when fitting content
+bool ComputesContentBoxesInBackground(EngineBase* engine) {
+    if (IsReflowableEngine(engine) || engine->IsImageCollection()) {
+        return false;
+    }
+    return engine->kind != kindEngineMulti;
+}
+
+static char* GetContentBoxesCachePath(EngineBase* engine) {
+    const char* filePath = GetCacheableFilePath(engine);
+    if (!filePath || !ComputesContentBoxesInBackground(engine)) {
+        return nullptr;
+    }
+    return GetCachePathForFile(filePath, kContentBoxesCacheExt);
+}
+
+bool LoadContentBoxesCache(EngineBase* engine, Vec<RectF>& boxes, Vec<bool>& known) {
+    AutoFreeStr cachePath = GetContentBoxesCachePath(engine);
+    if (!cachePath) {
+        return false;
+    }
+    ByteSlice d = file::ReadFile(cachePath);
+    if (d.empty()) {
+        return false;
+    }
+    int nPages = engine->PageCount();
+    size_t expectedSize = sizeof(PageSizesCacheHeader) + (size_t)nPages * sizeof(ContentBoxesCachePage);
+    const PageSizesCacheHeader* hdr = (const PageSizesCacheHeader*)d.data();
+    bool ok = d.size() == expectedSize && hdr->magic == kContentBoxesCacheMagic &&
+              hdr->version == kContentBoxesCacheVersion && hdr->nPages == (u32)nPages;
+    if (ok) {
+        const ContentBoxesCachePage* pages = (const ContentBoxesCachePage*)(d.data() + sizeof(PageSizesCacheHeader));
+        for (int i = 0; i < nPages; i++) {
+            const ContentBoxesCachePage& page = pages[i];
+            boxes.Append(RectF(page.x, page.y, page.dx, page.dy));
+            known.Append(page.known != 0);
+        }
+    } else {
+        file::Delete(cachePath);
+    }
+    d.Free();
+    return ok;
+}
+
+void SaveContentBoxesCache(EngineBase* engine, const Vec<RectF>& boxes, const Vec<bool>& known) {
+    AutoFreeStr cachePath = GetContentBoxesCachePath(engine);
+    if (!cachePath) {
+        return;
+    }
+    str::Str d;
+    PageSizesCacheHeader hdr{kContentBoxesCacheMagic, kContentBoxesCacheVersion, (u32)boxes.size(), 0};
+    d.Append((const char*)&hdr, sizeof(hdr));
+    for (int i = 0; i < boxes.isize(); i++) {
+        RectF box = boxes.at(i);
+        ContentBoxesCachePage page{box.x, box.y, box.dx, box.dy, known.at(i) ? 1u : 0u};
+        d.Append((const char*)&page, sizeof(page));
+    }
+    if (dir::CreateForFile(cachePath)) {
+        file::WriteFile(cachePath, d.AsByteSlice());
+    }
+}
+
+void UpdateArchiveEntriesCacheDir() {
+    const char* dir = nullptr;
+    if (gGlobalPrefs->rememberOpenedFiles) {
+        dir = AppGenDataFilenameTemp(kTextCacheDirName);
+    }
+    SetArchiveEntriesCacheDir(dir);
+    SetEnginePsCacheDir(dir);
+    SetEngineEbookLayoutCacheDir(dir);
+    SetEngineMupdfFontListCacheDir(dir);
+}
+
+static void RemoveTextCacheFiles(const char* fingerPrint) {
+    AutoFreeStr path = GetCachePathForFingerprint(fingerPrint, kTextCacheExt);
+    if (path) {
+        file::Delete(path);
+    }
+    path = GetCachePathForFingerprint(fingerPrint, kPageSizesCacheExt);
+    if (path) {
+        file::Delete(path);
+    }
+    path = GetCachePathForFingerprint(fingerPrint, kContentBoxesCacheExt);
+    if (path) {
+        file::Delete(path);
+    }
+    // there can be a layout cache file for each combination of ebook settings
+    AutoFreeStr layoutPattern = GetCachePathForFingerprint(fingerPrint, str::JoinTemp("-*", kEbookLayoutCacheExt));
+    if (layoutPattern) {
+        StrVec layoutPaths;
+        CollectPathsFromDirectory(layoutPattern, layoutPaths, false);
+        for (char* layoutPath : layoutPaths) {
+            file::Delete(layoutPath);
+        }
+    }
+}
+
+void RemoveTextCache(const char* filePath, const char* fingerPrint) {
+    u8 digest[16]{};
+    AutoFreeStr currFingerPrint;
+    if (CalcFileFingerprint(filePath, digest)) {
+        currFingerPrint = str::MemToHex(digest, dimof(digest));
+        RemoveTextCacheFiles(currFingerPrint);
+    }
+    if (fingerPrint && !str::EqI(fingerPrint, currFingerPrint)) {
+        RemoveTextCacheFiles(fingerPrint);
+    }
+}
+
+void DeleteTextCacheFiles() {
+    char* cacheDir = AppGenDataFilenameTemp(kTextCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    StrVec filePaths;
+    const char* archiveEntriesPattern = str::JoinTemp("*", kArchiveEntriesCacheExt);
+    const char* psPattern = str::JoinTemp("*", kPsCacheExt);
+    const char* layoutPattern = str::JoinTemp("*", kEbookLayoutCacheExt);
+    for (const char* pattern : {kTextCachePattern, kPageSizesCachePattern, kContentBoxesCachePattern,
+                                archiveEntriesPattern, psPattern, layoutPattern, kFontListCacheFileName}) {
+        CollectPathsFromDirectory(path::JoinTemp(cacheDir, pattern), filePaths, false);
+    }
+    for (char* path : filePaths) {
+        file::Delete(path);
+    }
+}
@@ -0,0 +1,46 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// text extracted from a document, saved in the cache directory so that
+// it doesn't have to be extracted again the next time the document is opened
+
+struct PageTextSlot;
+
+// a memory-mapped cache file. PageText returned by GetPageText() points
+// into the mapping and is valid for the lifetime of TextCacheFile
+struct TextCacheFile {
+    HANDLE hFile = nullptr;
+    HANDLE hMap = nullptr;
+    const u8* data = nullptr;
+    size_t size = 0;
+    int nPages = 0;
+
+    TextCacheFile() = default;
+    ~TextCacheFile();
+
+    bool GetPageText(int pageNo, PageText* pageTextOut) const;
+};
+
+bool IsReflowableEngine(EngineBase* engine);
+char* GetTextCachePath(EngineBase* engine);
+TextCacheFile* OpenTextCacheFile(const char* cachePath, int nPages);
+bool SaveTextCacheFile(const char* cachePath, PageTextSlot** pagesText, int nPages, TextCacheFile* mappedFile);
+
+// sizes of comic book pages, so that they don't have to be read from the images again
+bool LoadPageSizesCache(EngineBase* engine);
+void SavePageSizesCache(EngineBase* engine);
+
+// content boxes of pages (for fitting content), known[i] is false if the
+// content box of page i + 1 hasn't been computed
+bool ComputesContentBoxesInBackground(EngineBase* engine);
+bool LoadContentBoxesCache(EngineBase* engine, Vec<RectF>& boxes, Vec<bool>& known);
+void SaveContentBoxesCache(EngineBase* engine, const Vec<RectF>& boxes, const Vec<bool>& known);
+
+// lists of files in big archives are cached in the same directory
+void UpdateArchiveEntriesCacheDir();
+
+// fingerPrint is FileState::fingerprint, which still finds the cache files
+// of a document that has been changed or removed since it was last opened
+void RemoveTextCache(const char* filePath, const char* fingerPrint);
+void CleanUpTextCache();
+void DeleteTextCacheFiles();
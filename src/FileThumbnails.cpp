@@ -2,39 +2,57 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
-#include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/DirIter.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "Settings.h"
 #include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
 #include "FzImgReader.h"
 #include "FileHistory.h"
 
 #include "AppTools.h"
+#include "ThumbnailStore.h"
 #include "FileThumbnails.h"
 
-constexpr const char* kThumbnailsDirName = "sumatrapdfcache";
 constexpr const char* kPngExt = "*.png";
+// a background thread stops creating missing thumbnails after that
+// much time (loading a document can't be aborted)
+constexpr DWORD kThumbnailsCreateBudgetMs = 10 * 1000;
 
+// protects gThumbnailRequests and gIsLoadingThumbnails
+static CRITICAL_SECTION gThumbnailsAccess;
+static bool gThumbnailsAccessInitialized = false;
+
+// the first call must come from the ui thread (before any thread is started)
+static void InitThumbnailsAccess() {
+    if (gThumbnailsAccessInitialized) {
+        return;
+    }
+    InitializeCriticalSection(&gThumbnailsAccess);
+    // thumbnails are shared with the previewer (which uses the same directory
+    // as long as the default one in %LOCALAPPDATA% is used)
+    SetThumbnailStoreDir(AppGenDataFilenameTemp(kThumbnailsDirName));
+    gThumbnailsAccessInitialized = true;
+}
+
+static ThumbnailKey GetThumbnailKey(const char* filePath) {
+    ThumbnailKey key;
+    CalcThumbnailPathDigest(filePath, key.pathDigest);
+    return key;
+}
+
+// path of the .png thumbnail of older versions
 static char* GetThumbnailPathTemp(const char* filePath) {
-    // create a fingerprint of a (normalized) path for the file name
-    // I'd have liked to also include the file's last modification time
-    // in the fingerprint (much quicker than hashing the entire file's
-    // content), but that's too expensive for files on slow drives
     u8 digest[16]{};
-    // TODO: why is this happening? Seen in crash reports e.g. 35043
-    if (!filePath) {
+    if (!CalcThumbnailPathDigest(filePath, digest)) {
         return nullptr;
     }
-    char* path = str::DupTemp(filePath);
-    if (path::HasVariableDriveLetter(path)) {
-        // ignore the drive letter, if it might change
-        path[0] = '?';
-    }
-    CalcMD5Digest((u8*)path, str::Len(path), digest);
     AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
 
     char* thumbsDir = AppGenDataFilenameTemp(kThumbnailsDirName);
@@ -46,13 +64,115 @@ static char* GetThumbnailPathTemp(const char* filePath) {
     return res;
 }
 
+// the start page shows the top of the first page. If checkContent is set, a thumbnail that
+// the previewer created for the same content is also found (which requires reading the file)
+static RenderedBitmap* LoadThumbnailForFile(const char* filePath, bool checkContent) {
+    InitThumbnailsAccess();
+    ThumbnailKey key = GetThumbnailKey(filePath);
+    Size size(kThumbnailDx, kThumbnailDy);
+    RenderedBitmap* bmp = LoadThumbnailFromStore(key, size, true);
+    if (!bmp && checkContent && path::IsOnFixedDrive(filePath) &&
+        CalcThumbnailContentDigest(filePath, key.contentDigest)) {
+        bmp = LoadThumbnailFromStore(key, size, true);
+    }
+    return bmp;
+}
+
+// when the thumbnail of filePath was created (from the store or a .png file)
+static bool GetThumbnailTime(const char* filePath, FILETIME* created) {
+    InitThumbnailsAccess();
+    if (GetThumbnailStoreTime(GetThumbnailKey(filePath), created)) {
+        return true;
+    }
+    char* bmpPath = GetThumbnailPathTemp(filePath);
+    if (!bmpPath || !file::Exists(bmpPath)) {
+        return false;
+    }
+    *created = file::GetModificationTime(bmpPath);
+    return true;
+}
+
+// if the file is newer than the thumbnail, the thumbnail is outdated
+static bool IsThumbnailOutdated(const char* filePath) {
+    FILETIME created;
+    if (!GetThumbnailTime(filePath, &created)) {
+        return false;
+    }
+    FILETIME fileTime = file::GetModificationTime(filePath);
+    return FileTimeDiffInSecs(fileTime, created) > 0;
+}
+
+static void SaveThumbnailToPath(RenderedBitmap* thumbnail, const char* bmpPath) {
+    char* thumbsPath = path::GetDirTemp(bmpPath);
+    if (dir::Create(thumbsPath)) {
+        CrashIf(!str::EndsWithI(bmpPath, ".png"));
+        Gdiplus::Bitmap bmp(thumbnail->GetBitmap(), nullptr);
+        CLSID tmpClsid = GetEncoderClsid(L"image/png");
+        WCHAR* bmpPathW = ToWstrTemp(bmpPath);
+        bmp.Save(bmpPathW, &tmpClsid, nullptr);
+    }
+}
+
+// bmp is the first page at kThumbnailStoreDx width (see CreateThumbnailForFile in SumatraPDF.cpp).
+// Returns the part shown on the start page
+static RenderedBitmap* SaveThumbnailForFile(const char* filePath, RenderedBitmap* bmp) {
+    InitThumbnailsAccess();
+    ThumbnailKey key = GetThumbnailKey(filePath);
+    // also lets the previewer find the thumbnail (the file has just been read, so this is quick)
+    if (path::IsOnFixedDrive(filePath)) {
+        CalcThumbnailContentDigest(filePath, key.contentDigest);
+    }
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    RenderedBitmap* thumb = ScaleThumbnail(bmp, Size(kThumbnailDx, kThumbnailDy), true);
+    char* bmpPath = GetThumbnailPathTemp(filePath);
+    if (SaveThumbnailToStore(key, bmp, now)) {
+        // replaces the .png thumbnail of older versions
+        if (bmpPath) {
+            file::Delete(bmpPath);
+        }
+    } else if (bmpPath && thumb) {
+        // fall back to a .png file if the store can't be used
+        SaveThumbnailToPath(thumb, bmpPath);
+    }
+    return thumb;
+}
+
+// older versions saved a .png file per document (only the part shown on the start page,
+// so it isn't moved into the store; it's replaced when the thumbnail is created again)
+static RenderedBitmap* LoadPngThumbnail(const char* filePath) {
+    char* bmpPath = GetThumbnailPathTemp(filePath);
+    if (!bmpPath || !file::Exists(bmpPath)) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = LoadRenderedBitmap(bmpPath);
+    if (!bmp || bmp->Size().IsEmpty()) {
+        delete bmp;
+        return nullptr;
+    }
+    return bmp;
+}
+
 void DeleteThumbnailCacheDirectory() {
+    InitThumbnailsAccess();
+    CloseThumbnailStore();
     char* thumbsDir = AppGenDataFilenameTemp(kThumbnailsDirName);
     dir::RemoveAll(thumbsDir);
 }
 
 // removes thumbnails that don't belong to any frequently used item in file history
 void CleanUpThumbnailCache(const FileHistory& fileHistory) {
+    Vec<FileState*> list;
+    fileHistory.GetFrequencyOrder(list);
+    int nKeep = std::min(list.isize(), kFileHistoryMaxFrequent * 2 + 1);
+
+    InitThumbnailsAccess();
+    Vec<ThumbnailKey> keep;
+    for (int i = 0; i < nKeep; i++) {
+        keep.Append(GetThumbnailKey(list[i]->filePath));
+    }
+    CleanUpThumbnailStore(keep);
+
     char* thumbsDir = AppGenDataFilenameTemp(kThumbnailsDirName);
     char* pattern = path::JoinTemp(thumbsDir, kPngExt);
 
@@ -64,14 +184,8 @@ void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     }
 
     // remove files that should not be deleted
-    Vec<FileState*> list;
-    fileHistory.GetFrequencyOrder(list);
-    int n = 0;
-    for (auto& fs : list) {
-        if (n++ > kFileHistoryMaxFrequent * 2) {
-            break;
-        }
-        char* path = GetThumbnailPathTemp(fs->filePath);
+    for (int i = 0; i < nKeep; i++) {
+        char* path = GetThumbnailPathTemp(list[i]->filePath);
         if (path) {
             filePaths.Remove(path);
         }
@@ -82,18 +196,19 @@ void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     }
 }
 
+// paths of files whose thumbnails have been requested by LoadThumbnailsAsync()
+// (only accessed on ui thread)
+static StrVec gThumbnailsRequested;
+
 bool LoadThumbnail(FileState* ds) {
     delete ds->thumbnail;
     ds->thumbnail = nullptr;
 
-    char* bmpPath = GetThumbnailPathTemp(ds->filePath);
-    if (!bmpPath) {
-        return false;
+    RenderedBitmap* bmp = LoadThumbnailForFile(ds->filePath, false);
+    if (!bmp) {
+        bmp = LoadPngThumbnail(ds->filePath);
     }
-
-    RenderedBitmap* bmp = LoadRenderedBitmap(bmpPath);
-    if (!bmp || bmp->Size().IsEmpty()) {
-        delete bmp;
+    if (!bmp) {
         return false;
     }
 
@@ -106,51 +221,32 @@ bool HasThumbnail(FileState* ds) {
         return false;
     }
 
-    char* bmpPath = GetThumbnailPathTemp(ds->filePath);
-    if (!bmpPath) {
-        return true;
-    }
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
-    FILETIME fileTime = file::GetModificationTime(ds->filePath);
     // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (IsThumbnailOutdated(ds->filePath)) {
         delete ds->thumbnail;
         ds->thumbnail = nullptr;
+        gThumbnailsRequested.Remove(ds->filePath);
     }
 
     return ds->thumbnail != nullptr;
 }
 
-// takes ownership of bmp
+// takes ownership of bmp, which is rendered at kThumbnailStoreDx width
+// and saved for the previewer as well
 void SetThumbnail(FileState* ds, RenderedBitmap* bmp) {
     CrashIf(bmp && bmp->Size().IsEmpty());
-    if (!ds || !bmp || bmp->Size().IsEmpty()) {
+    if (!ds || !ds->filePath || !bmp || bmp->Size().IsEmpty()) {
         delete bmp;
         return;
     }
-    delete ds->thumbnail;
-    ds->thumbnail = bmp;
-    SaveThumbnail(ds);
-}
-
-void SaveThumbnail(FileState* ds) {
-    if (!ds->thumbnail) {
+    RenderedBitmap* thumb = SaveThumbnailForFile(ds->filePath, bmp);
+    delete bmp;
+    if (!thumb) {
         return;
     }
-
-    char* path = ds->filePath;
-    char* bmpPath = GetThumbnailPathTemp(path);
-    if (!bmpPath) {
-        return;
-    }
-    char* thumbsPath = path::GetDirTemp(bmpPath);
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, ".png"));
-        Gdiplus::Bitmap bmp(ds->thumbnail->GetBitmap(), nullptr);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        WCHAR* bmpPathW = ToWstrTemp(bmpPath);
-        bmp.Save(bmpPathW, &tmpClsid, nullptr);
-    }
+    delete ds->thumbnail;
+    ds->thumbnail = thumb;
+    gThumbnailsRequested.Remove(ds->filePath);
 }
 
 void RemoveThumbnail(FileState* ds) {
@@ -158,10 +254,130 @@ void RemoveThumbnail(FileState* ds) {
         return;
     }
 
+    RemoveThumbnailFromStore(GetThumbnailKey(ds->filePath));
     char* bmpPath = GetThumbnailPathTemp(ds->filePath);
     if (bmpPath) {
         file::Delete(bmpPath);
     }
     delete ds->thumbnail;
     ds->thumbnail = nullptr;
+    gThumbnailsRequested.Remove(ds->filePath);
+}
+
+struct ThumbnailRequest {
+    AutoFreeStr filePath;
+    bool create = false;
+    FileHistory* fileHistory = nullptr;
+    std::function<void()> onLoaded;
+};
+
+static Vec<ThumbnailRequest*> gThumbnailRequests;
+static bool gIsLoadingThumbnails = false;
+
+// renders the first page at the store's size, like ControllerCallbackHandler::RenderThumbnail
+static RenderedBitmap* CreateThumbnailFromFile(const char* filePath) {
+    // password protected documents don't get thumbnails
+    EngineBase* engine = CreateEngineFromFile(filePath, nullptr, false);
+    if (!engine) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = nullptr;
+    RectF pageRect = engine->PageMediabox(1);
+    if (!engine->IsPasswordProtected() && !pageRect.IsEmpty()) {
+        pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
+        float zoom = kThumbnailStoreDx / (float)pageRect.dx;
+        if (pageRect.dy > (float)kThumbnailStoreDy / zoom) {
+            pageRect.dy = (float)kThumbnailStoreDy / zoom;
+        }
+        pageRect = engine->Transform(pageRect, 1, 1.0f, 0, true);
+        RenderPageArgs args(1, zoom, 0, &pageRect);
+        bmp = engine->RenderPage(args);
+    }
+    delete engine;
+    if (bmp && bmp->Size().IsEmpty()) {
+        delete bmp;
+        bmp = nullptr;
+    }
+    return bmp;
+}
+
+static RenderedBitmap* LoadThumbnailForRequest(ThumbnailRequest* req, bool canCreate) {
+    if (!IsThumbnailOutdated(req->filePath)) {
+        RenderedBitmap* bmp = LoadThumbnailForFile(req->filePath, true);
+        if (!bmp) {
+            bmp = LoadPngThumbnail(req->filePath);
+        }
+        if (bmp) {
+            return bmp;
+        }
+    }
+    // creating thumbnails for files on slow drives would take too long
+    if (!req->create || !canCreate || !path::IsOnFixedDrive(req->filePath)) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = CreateThumbnailFromFile(req->filePath);
+    if (!bmp) {
+        return nullptr;
+    }
+    RenderedBitmap* thumb = SaveThumbnailForFile(req->filePath, bmp);
+    delete bmp;
+    return thumb;
+}
+
+static void LoadThumbnailsThread() {
+    DWORD timeStart = GetTickCount();
+    for (;;) {
+        ThumbnailRequest* req;
+        {
+            ScopedCritSec scope(&gThumbnailsAccess);
+            if (gThumbnailRequests.size() == 0) {
+                gIsLoadingThumbnails = false;
+                break;
+            }
+            req = gThumbnailRequests.PopAt(0);
+        }
+        bool canCreate = GetTickCount() - timeStart < kThumbnailsCreateBudgetMs;
+        RenderedBitmap* bmp = LoadThumbnailForRequest(req, canCreate);
+        // each thumbnail is shown as soon as it's been loaded
+        uitask::Post([req, bmp] {
+            FileState* fs = req->fileHistory->FindByPath(req->filePath);
+            if (fs && bmp && !fs->thumbnail) {
+                fs->thumbnail = bmp;
+                req->onLoaded();
+            } else {
+                delete bmp;
+            }
+            delete req;
+        });
+    }
+    DecDangerousThreadCount();
+}
+
+// loads thumbnails of files from the thumbnail cache on a background thread,
+// in the order of states. If create is true, missing thumbnails are created
+// (within a time budget). A thumbnail is set on its FileState (if it's still in
+// fileHistory) on the ui thread, which then calls onLoaded
+void LoadThumbnailsAsync(FileHistory& fileHistory, const Vec<FileState*>& states, bool create,
+                         const std::function<void()>& onLoaded) {
+    InitThumbnailsAccess();
+    ScopedCritSec scope(&gThumbnailsAccess);
+    for (FileState* fs : states) {
+        if (fs->thumbnail || !fs->filePath || gThumbnailsRequested.Contains(fs->filePath)) {
+            continue;
+        }
+        gThumbnailsRequested.Append(fs->filePath);
+        auto req = new ThumbnailRequest();
+        req->filePath.SetCopy(fs->filePath);
+        req->create = create;
+        req->fileHistory = &fileHistory;
+        req->onLoaded = onLoaded;
+        gThumbnailRequests.Append(req);
+    }
+    if (gThumbnailRequests.size() == 0 || gIsLoadingThumbnails) {
+        return;
+    }
+    gIsLoadingThumbnails = true;
+    // saving a thumbnail must not be interrupted by exiting the app
+    IncDangerousThreadCount();
+    RunAsync(LoadThumbnailsThread);
 }
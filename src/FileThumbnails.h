@@ -8,8 +8,9 @@ constexpr int kThumbnailDy = 150;
 bool LoadThumbnail(FileState* ds);
 bool HasThumbnail(FileState* ds);
 void SetThumbnail(FileState* ds, RenderedBitmap* bmp);
-void SaveThumbnail(FileState* ds);
 void RemoveThumbnail(FileState* ds);
+void LoadThumbnailsAsync(FileHistory& fileHistory, const Vec<FileState*>& states, bool create,
+                         const std::function<void()>& onLoaded);
 
 void DeleteThumbnailCacheDirectory();
 void CleanUpThumbnailCache(const FileHistory& fileHistory);
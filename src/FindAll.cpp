@@ -0,0 +1,401 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+/* "Find All": searches the whole document at once on several threads
+   and shows all matches in a list, while also highlighting them */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+#include "wingui/Layout.h"
+#include "wingui/WinGui.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "DisplayModel.h"
+#include "ProgressUpdateUI.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "MainWindow.h"
+#include "WindowTab.h"
+#include "Commands.h"
+#include "SearchAndDDE.h"
+#include "Selection.h"
+#include "SumatraPDF.h"
+#include "Translations.h"
+#include "FindAll.h"
+
+#include "utils/Log.h"
+
+// pages are searched in chunks of that many pages
+constexpr int kFindAllChunkPages = 16;
+constexpr int kMaxFindAllThreads = 4;
+// number of characters shown before and after a match in the list
+constexpr int kFindAllContextChars = 32;
+
+constexpr COLORREF kFindAllHitColor = RGB(0xff, 0xd2, 0x00);
+
+// matches on pages of a single chunk
+struct FindAllChunk {
+    int chunkNo = 0;
+    TextSearchHits hits;
+    // text around each match
+    StrVec contexts;
+};
+
+struct FindAllWnd : Wnd, ProgressUpdateUI {
+    void OnSize(UINT msg, UINT type, SIZE size) override;
+    void OnClose() override;
+
+    void UpdateProgress(int, int) override {
+    }
+    bool WasCanceled() override;
+
+    WindowTab* tab = nullptr;
+    LayoutBase* mainLayout = nullptr;
+    Static* staticStatus = nullptr;
+    ListBox* listBox = nullptr;
+
+    // unique for every search, to recognize results of an aborted search
+    int searchId = 0;
+    AutoFreeWstr text;
+    bool matchCase = false;
+
+    // shared with search threads
+    HANDLE threads[kMaxFindAllThreads] = {};
+    int nThreads = 0;
+    int nPages = 0;
+    int nChunks = 0;
+    LONG nextChunk = 0;
+    LONG canceled = 0;
+
+    // only accessed on ui thread
+    // received chunks that can't be shown before the chunks preceding them
+    Vec<FindAllChunk*> chunks;
+    int nChunksShown = 0;
+    // all matches shown in listBox
+    TextSearchHits hits;
+
+    ~FindAllWnd() override;
+
+    void StartSearch(const WCHAR* text, bool matchCase);
+    void StopSearch();
+    void SearchChunks();
+    void ChunkReceived(FindAllChunk* chunk);
+    void UpdateStatus();
+    void ListBoxSelectionChanged();
+};
+
+static Vec<FindAllWnd*> gFindAllWnds;
+static int gNextFindAllSearchId = 1;
+
+static bool FindAllWndStillValid(FindAllWnd* wnd, int searchId) {
+    return gFindAllWnds.Contains(wnd) && wnd->searchId == searchId;
+}
+
+FindAllWnd::~FindAllWnd() {
+    StopSearch();
+    gFindAllWnds.Remove(this);
+    delete mainLayout;
+}
+
+bool FindAllWnd::WasCanceled() {
+    return InterlockedCompareExchange(&canceled, 0, 0) != 0;
+}
+
+void FindAllWnd::OnSize(UINT msg, UINT, SIZE size) {
+    if (msg != WM_SIZE || !mainLayout) {
+        return;
+    }
+    int dx = (int)size.cx;
+    int dy = (int)size.cy;
+    if (dx == 0 || dy == 0) {
+        return;
+    }
+    InvalidateRect(hwnd, nullptr, false);
+    LayoutToSize(mainLayout, {dx, dy});
+}
+
+void FindAllWnd::OnClose() {
+    WindowTab* t = tab;
+    // deletes this
+    CloseFindAllWindow(t);
+    // remove the highlights
+    if (MainWindowStillValid(t->win) && t->win->CurrentTab() == t) {
+        RepaintAsync(t->win, 0);
+    }
+}
+
+static char* GetHitContext(DocumentTextCache* textCache, const TextSearchHit& hit) {
+    int len;
+    const WCHAR* s = textCache->GetTextForPage(hit.startPage, &len);
+    int start = std::max(hit.startGlyph - kFindAllContextChars, 0);
+    int end = hit.startPage == hit.endPage ? hit.endGlyph : len;
+    end = std::min(end + kFindAllContextChars, len);
+    AutoFreeWstr ctx = str::Dup(s + start, end - start);
+    str::NormalizeWSInPlace(ctx);
+    return ToUtf8(ctx);
+}
+
+static DWORD WINAPI FindAllThread(LPVOID data) {
+    FindAllWnd* wnd = (FindAllWnd*)data;
+    wnd->SearchChunks();
+    DestroyTempAllocator();
+    return 0;
+}
+
+// takes chunks until all have been searched, posting results to ui thread
+void FindAllWnd::SearchChunks() {
+    DisplayModel* dm = tab->AsFixed();
+    TextSearch search(dm->GetEngine(), dm->textCache);
+    search.SetSensitive(matchCase);
+    int id = searchId;
+    while (!WasCanceled()) {
+        int chunkNo = (int)InterlockedIncrement(&nextChunk) - 1;
+        if (chunkNo >= nChunks) {
+            break;
+        }
+        auto chunk = new FindAllChunk();
+        chunk->chunkNo = chunkNo;
+        int firstPage = chunkNo * kFindAllChunkPages + 1;
+        int lastPage = std::min(firstPage + kFindAllChunkPages - 1, nPages);
+        search.FindAllInPages(text, firstPage, lastPage, chunk->hits, this);
+        for (const TextSearchHit& hit : chunk->hits.hits) {
+            AutoFreeStr ctx = GetHitContext(dm->textCache, hit);
+            chunk->contexts.Append(ctx);
+        }
+        uitask::Post([this, id, chunk] {
+            if (!FindAllWndStillValid(this, id)) {
+                delete chunk;
+                return;
+            }
+            ChunkReceived(chunk);
+        });
+    }
+}
+
+void FindAllWnd::StartSearch(const WCHAR* textIn, bool matchCaseIn) {
+    StopSearch();
+    searchId = gNextFindAllSearchId++;
+    text.SetCopy(textIn);
+    matchCase = matchCaseIn;
+
+    hits.hits.Reset();
+    hits.rectPages.Reset();
+    hits.rects.Reset();
+    listBox->SetModel(new ListBoxModelStrings());
+
+    DisplayModel* dm = tab->AsFixed();
+    nPages = dm->PageCount();
+    nChunks = (nPages + kFindAllChunkPages - 1) / kFindAllChunkPages;
+    nextChunk = 0;
+    canceled = 0;
+    nChunksShown = 0;
+    chunks.Reset();
+    chunks.AppendBlanks(nChunks);
+
+    // text extraction happens while searching, so it's most of the work
+    int n = std::min(GetPhysicalProcessorCount(), kMaxFindAllThreads);
+    n = std::min(n, nChunks);
+    for (int i = 0; i < n; i++) {
+        HANDLE h = CreateThread(nullptr, 0, FindAllThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        threads[nThreads++] = h;
+    }
+    UpdateStatus();
+}
+
+// results that are still being posted are ignored because of searchId
+void FindAllWnd::StopSearch() {
+    if (nThreads > 0) {
+        InterlockedExchange(&canceled, 1);
+        WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+        for (int i = 0; i < nThreads; i++) {
+            CloseHandle(threads[i]);
+            threads[i] = nullptr;
+        }
+        nThreads = 0;
+    }
+    DeleteVecMembers(chunks);
+    searchId = 0;
+}
+
+// appends the chunks that are next in document order to the list
+void FindAllWnd::ChunkReceived(FindAllChunk* chunk) {
+    chunks[chunk->chunkNo] = chunk;
+    auto model = (ListBoxModelStrings*)listBox->model;
+    bool added = false;
+    while (nChunksShown < nChunks && chunks[nChunksShown]) {
+        FindAllChunk* c = chunks[nChunksShown];
+        int rectOffset = hits.rects.isize();
+        int n = c->hits.hits.isize();
+        for (int i = 0; i < n; i++) {
+            TextSearchHit hit = c->hits.hits[i];
+            hit.firstRect += rectOffset;
+            hits.hits.Append(hit);
+
+            AutoFreeStr label = tab->ctrl->GetPageLabel(hit.startPage);
+            AutoFreeStr s = str::Format("%s: %s", label.Get(), c->contexts[i]);
+            model->strings.Append(s);
+            ListBox_AddString(listBox->hwnd, ToWstrTemp(s));
+        }
+        hits.rectPages.Append(c->hits.rectPages.LendData(), c->hits.rectPages.size());
+        hits.rects.Append(c->hits.rects.LendData(), c->hits.rects.size());
+        added |= n > 0;
+        delete c;
+        chunks[nChunksShown] = nullptr;
+        nChunksShown++;
+    }
+    UpdateStatus();
+    if (added && tab->win->CurrentTab() == tab) {
+        RepaintAsync(tab->win, 0);
+    }
+}
+
+void FindAllWnd::UpdateStatus() {
+    int nHits = hits.hits.isize();
+    AutoFreeStr s;
+    if (nChunksShown < nChunks) {
+        int nPagesSearched = std::min(nChunksShown * kFindAllChunkPages, nPages);
+        s = str::Format(_TRA("Searching %d of %d..."), nPagesSearched, nPages);
+    } else if (nHits == 0) {
+        s = str::Dup(_TRA("No matches were found"));
+    } else {
+        s = str::Format(_TRA("%d matches"), nHits);
+    }
+    staticStatus->SetText(s.Get());
+}
+
+void FindAllWnd::ListBoxSelectionChanged() {
+    int idx = listBox->GetCurrentSelection();
+    if (idx < 0 || idx >= hits.hits.isize()) {
+        return;
+    }
+    MainWindow* win = tab->win;
+    if (win->CurrentTab() != tab) {
+        SelectTabInWindow(tab);
+    }
+    DisplayModel* dm = tab->AsFixed();
+    const TextSearchHit& hit = hits.hits[idx];
+    if (!dm->PageShown(hit.startPage)) {
+        win->ctrl->GoToPage(hit.startPage, true);
+    }
+    dm->textSelection->StartAt(hit.startPage, hit.startGlyph);
+    dm->textSelection->SelectUpTo(hit.endPage, hit.endGlyph);
+    // Find Next continues from the selected match
+    dm->textSearch->SetLastResult(dm->textSelection);
+    UpdateTextSelection(win, false);
+    dm->ShowResultRectToScreen(&dm->textSelection->result);
+    RepaintAsync(win, 0);
+}
+
+static void CreateMainLayout(FindAllWnd* wnd) {
+    HWND parent = wnd->hwnd;
+    auto vbox = new VBox();
+    vbox->alignMain = MainAxisAlign::MainStart;
+    vbox->alignCross = CrossAxisAlign::Stretch;
+
+    {
+        auto w = new Static();
+        StaticCreateArgs args;
+        args.parent = parent;
+        HWND hwnd = w->Create(args);
+        CrashIf(!hwnd);
+        wnd->staticStatus = w;
+        vbox->AddChild(w);
+    }
+
+    {
+        ListBoxCreateArgs args;
+        args.parent = parent;
+        args.idealSizeLines = 24;
+        auto w = new ListBox();
+        w->SetInsetsPt(4, 0);
+        w->Create(args);
+        w->SetModel(new ListBoxModelStrings());
+        w->onSelectionChanged = std::bind(&FindAllWnd::ListBoxSelectionChanged, wnd);
+        wnd->listBox = w;
+        vbox->AddChild(w, 1);
+    }
+
+    auto padding = new Padding(vbox, DpiScaledInsets(parent, 4, 8));
+    wnd->mainLayout = padding;
+}
+
+// searches the whole document for the text in the find box
+void FindAll(MainWindow* win) {
+    if (!win->AsFixed() || !NeedsFindUI(win)) {
+        return;
+    }
+    WCHAR* text = HwndGetTextWTemp(win->hwndFindEdit);
+    if (str::IsEmpty(text)) {
+        // let the user enter the text first
+        FindFirst(win);
+        return;
+    }
+    AbortFinding(win, true);
+    WORD state = (WORD)SendMessageW(win->hwndToolbar, TB_GETSTATE, CmdFindMatch, 0);
+    bool matchCase = (state & TBSTATE_CHECKED) != 0;
+
+    WindowTab* tab = win->CurrentTab();
+    FindAllWnd* wnd = tab->findAllWnd;
+    if (!wnd) {
+        wnd = new FindAllWnd();
+        CreateCustomArgs args;
+        HMODULE h = GetModuleHandleW(nullptr);
+        WCHAR* iconName = MAKEINTRESOURCEW(GetAppIconID());
+        args.icon = LoadIconW(h, iconName);
+        args.bgColor = MkGray(0xee);
+        args.title = _TRA("Find All");
+        wnd->CreateCustom(args);
+        CreateMainLayout(wnd);
+        wnd->tab = tab;
+        tab->findAllWnd = wnd;
+        gFindAllWnds.Append(wnd);
+
+        int dy = std::max(ClientRect(win->hwndCanvas).dy, 480);
+        LayoutAndSizeToContent(wnd->mainLayout, 480, dy, wnd->hwnd);
+        HwndPositionToTheRightOf(wnd->hwnd, win->hwndFrame);
+        wnd->SetIsVisible(true);
+    }
+    wnd->StartSearch(text, matchCase);
+}
+
+// must be called before the document of the tab is closed or replaced
+void CloseFindAllWindow(WindowTab* tab) {
+    if (!tab || !tab->findAllWnd) {
+        return;
+    }
+    FindAllWnd* wnd = tab->findAllWnd;
+    tab->findAllWnd = nullptr;
+    // this also closes the window
+    delete wnd;
+}
+
+// highlights all matches on visible pages
+void PaintFindAllHits(MainWindow* win, HDC hdc) {
+    WindowTab* tab = win->CurrentTab();
+    DisplayModel* dm = win->AsFixed();
+    if (!tab || !tab->findAllWnd || !dm) {
+        return;
+    }
+    TextSearchHits& hits = tab->findAllWnd->hits;
+    Vec<Rect> rects;
+    int n = hits.rects.isize();
+    for (int i = 0; i < n; i++) {
+        int pageNo = hits.rectPages[i];
+        if (!dm->PageVisible(pageNo)) {
+            continue;
+        }
+        rects.Append(dm->CvtToScreen(pageNo, ToRectF(hits.rects[i])));
+    }
+    if (rects.size() > 0) {
+        PaintTransparentRectangles(hdc, win->canvasRc, rects, kFindAllHitColor, 0x5f, 0);
+    }
+}
@@ -0,0 +1,8 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct FindAllWnd;
+
+void FindAll(MainWindow* win);
+void CloseFindAllWindow(WindowTab* tab);
+void PaintFindAllHits(MainWindow* win, HDC hdc);
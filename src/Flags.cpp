@@ -38,6 +38,10 @@
     V(WithPreview, "with-preview")               \
     V(Rand, "rand")                              \
     V(Regress, "regress")                        \
+    V(RegressTest, "regress-test")               \
+    V(RegressOut, "regress-out")                 \
+    V(RegressBaseline, "regress-baseline")       \
+    V(RegressTolerance, "regress-tolerance")     \
     V(Extract, "x")                              \
     V(Tester, "tester")                          \
     V(TestApp, "testapp")                        \
@@ -64,14 +68,20 @@
     V(StressTest, "stress-test")                 \
     V(N, "n")                                    \
     V(Max, "max")                                \
+    V(StressPerf, "stress-perf")                 \
     V(Render, "render")                          \
     V(ExtractText, "extract-text")               \
     V(Bench, "bench")                            \
+    V(BenchIterations, "bench-iterations")       \
+    V(BenchOut, "bench-out")                     \
+    V(BenchBaseline, "bench-baseline")           \
+    V(BenchScenarios, "bench-scenarios")         \
     V(Dir, "d")                                  \
     V(InstallDir, "install-dir")                 \
     V(Lang, "lang")                              \
     V(UpdateSelfTo, "update-self-to")            \
     V(ArgDeleteFile, "delete-file")              \
+    V(RenderWorker, "render-worker")             \
     V(BgCol, "bgcolor")                          \
     V(BgCol2, "bg-color")                        \
     V(FwdSearchOffset, "fwdsearch-offset")       \
@@ -86,6 +96,7 @@
     V(TestBrowser, "test-browser")               \
     V(Adobe, "a")                                \
     V(DDE, "dde")                                \
+    V(TimeTrace, "time-trace")                   \
     V(SetColorRange, "set-color-range")
 
 #define MAKE_ARG(__arg, __name) __arg,
@@ -571,6 +582,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.appdataDir = str::Dup(param);
             continue;
         }
+        if (arg == Arg::TimeTrace) {
+            i.timeTracePath = str::Dup(param);
+            continue;
+        }
         if (arg == Arg::Plugin) {
             // -plugin [<URL>] <parent HWND>
             // <parent HWND> is a (numeric) window handle to
@@ -617,6 +632,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
         if (arg == Arg::Max) {
             i.stressTestMax = paramInt;
         }
+        if (arg == Arg::StressPerf) {
+            i.stressPerfThreshold = paramInt;
+            continue;
+        }
         if (arg == Arg::Render) {
             i.testRenderPage = true;
             i.pageNumber = paramInt;
@@ -642,6 +661,22 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.exitImmediately = true;
             continue;
         }
+        if (arg == Arg::BenchIterations) {
+            i.benchIterations = paramInt;
+            continue;
+        }
+        if (arg == Arg::BenchOut) {
+            i.benchOutPath = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::BenchScenarios) {
+            i.benchScenarios = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::BenchBaseline) {
+            i.benchBaselinePath = str::Dup(param);
+            continue;
+        }
         if (arg == Arg::Dir || arg == Arg::InstallDir) {
             i.installDir = str::Dup(param);
             continue;
@@ -664,6 +699,26 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.deleteFile = str::Dup(param);
             continue;
         }
+        if (arg == Arg::RenderWorker) {
+            i.renderWorker = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::RegressTest) {
+            i.regressTest = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::RegressOut) {
+            i.regressOutPath = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::RegressBaseline) {
+            i.regressBaselinePath = str::Dup(param);
+            continue;
+        }
+        if (arg == Arg::RegressTolerance) {
+            i.regressTolerance = paramInt;
+            continue;
+        }
         if (arg == Arg::Search) {
             i.search = str::Dup(param);
             continue;
@@ -720,6 +775,10 @@ Flags::~Flags() {
     str::Free(destName);
     str::Free(pluginURL);
     str::Free(appdataDir);
+    str::Free(timeTracePath);
+    str::Free(benchOutPath);
+    str::Free(benchBaselinePath);
+    str::Free(benchScenarios);
     str::Free(inverseSearchCmdLine);
     str::Free(stressTestPath);
     str::Free(stressTestFilter);
@@ -727,6 +786,10 @@ Flags::~Flags() {
     str::Free(lang);
     str::Free(updateSelfTo);
     str::Free(deleteFile);
+    str::Free(renderWorker);
+    str::Free(regressTest);
+    str::Free(regressOutPath);
+    str::Free(regressBaselinePath);
     str::Free(search);
     str::Free(dde);
 }
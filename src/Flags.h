@@ -37,6 +37,16 @@ struct Flags {
     //   to benchmark. It can also be a string "loadonly" which means we'll
     //   only benchmark loading of the catalog
     StrVec pathsToBenchmark;
+    // -bench-iterations <n> : how many times each file is benchmarked. The first
+    // iteration is timed as load_cold, with the file evicted from the OS cache
+    int benchIterations = 1;
+    // -bench-out <path> : saves the statistics of -bench as .csv or .json
+    char* benchOutPath = nullptr;
+    // -bench-scenarios <names> : comma separated subset of render, search,
+    // selection, toc and thumbnail to benchmark (all by default)
+    char* benchScenarios = nullptr;
+    // -bench-baseline <path> : compares the results of -bench to a .csv saved with -bench-out
+    char* benchBaselinePath = nullptr;
     bool exitWhenDone = false;
     bool printDialog = false;
     char* printerName = nullptr;
@@ -58,9 +68,20 @@ struct Flags {
     bool exitImmediately = false;
     bool silent = false;
     char* appdataDir = nullptr;
+    // -time-trace <path> : save timings of startup phases in Chrome trace format
+    char* timeTracePath = nullptr;
     char* inverseSearchCmdLine = nullptr;
     bool invertColors = false;
     bool regress = false;
+    // -regress-test <name> : runs only this regression test (used by -regress,
+    // which runs each test in a separate process)
+    char* regressTest = nullptr;
+    // -regress-out <path> : saves the time and peak memory of each test as .csv or .json
+    char* regressOutPath = nullptr;
+    // -regress-baseline <path> : fails the run if a test is more than -regress-tolerance
+    // percent slower than in a .csv saved with -regress-out
+    char* regressBaselinePath = nullptr;
+    int regressTolerance = 20;
     bool tester = false;
     // -new-window, if true and we're using tabs, opens
     // the document in new window
@@ -76,6 +97,9 @@ struct Flags {
     int stressParallelCount = 1;
     bool stressRandomizeFiles = false;
     int stressTestMax = 0;
+    // -stress-perf <percent> : report load and render times and memory use that
+    // exceed their recorded budgets by more than <percent>
+    int stressPerfThreshold = 0;
 
     // related to testing
     bool testRenderPage = false;
@@ -105,6 +129,8 @@ struct Flags {
     // for internal use
     char* updateSelfTo = nullptr;
     char* deleteFile = nullptr;
+    // name of the pipe over which a render worker process gets its requests
+    char* renderWorker = nullptr;
 
     // for some commands, will sleep for sleepMs milliseconds
     // before proceeding
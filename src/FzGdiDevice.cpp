@@ -0,0 +1,517 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+
+#include "FzGdiDevice.h"
+
+#include "utils/Log.h"
+
+// a fitz device drawing on a GDI DC. Coordinates produced by ctm are
+// used directly as logical coordinates of the DC (i.e. device pixels for
+// printer DCs in MM_TEXT mode)
+struct FzGdiDevice {
+    fz_device super;
+    // nullptr when only checking whether GDI can draw the content
+    HDC hdc = nullptr;
+    bool unsupported = false;
+};
+
+// GDI only supports 16 entries for user defined dash patterns
+constexpr int kMaxGdiDashes = 16;
+
+static void Unsupported(fz_context* ctx, FzGdiDevice* dev, const char* what) {
+    if (!dev->unsupported) {
+        logf("FzGdiDevice: %s can't be drawn with GDI\n", what);
+    }
+    dev->unsupported = true;
+    if (!dev->hdc) {
+        // no need to look any further
+        fz_throw(ctx, FZ_ERROR_ABORT, "content not supported by GDI");
+    }
+}
+
+static COLORREF ToColorRef(fz_context* ctx, fz_colorspace* cs, const float* color, fz_color_params cp) {
+    float rgb[3] = {0, 0, 0};
+    if (cs && color) {
+        fz_convert_color(ctx, cs, color, fz_device_rgb(ctx), rgb, nullptr, cp);
+    }
+    auto toByte = [](float v) { return (BYTE)std::clamp((int)(v * 255.f + 0.5f), 0, 255); };
+    return RGB(toByte(rgb[0]), toByte(rgb[1]), toByte(rgb[2]));
+}
+
+struct GdiPathWalker {
+    HDC hdc;
+    fz_matrix ctm;
+};
+
+static POINT ToGdiPoint(GdiPathWalker* w, float x, float y) {
+    fz_point pt = fz_transform_point_xy(x, y, w->ctm);
+    return {(LONG)lrintf(pt.x), (LONG)lrintf(pt.y)};
+}
+
+static void GdiMoveTo(fz_context*, void* arg, float x, float y) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pt = ToGdiPoint(w, x, y);
+    MoveToEx(w->hdc, pt.x, pt.y, nullptr);
+}
+
+static void GdiLineTo(fz_context*, void* arg, float x, float y) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pt = ToGdiPoint(w, x, y);
+    LineTo(w->hdc, pt.x, pt.y);
+}
+
+static void GdiCurveTo(fz_context*, void* arg, float x1, float y1, float x2, float y2, float x3, float y3) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    POINT pts[3] = {ToGdiPoint(w, x1, y1), ToGdiPoint(w, x2, y2), ToGdiPoint(w, x3, y3)};
+    PolyBezierTo(w->hdc, pts, 3);
+}
+
+static void GdiClosePath(fz_context*, void* arg) {
+    GdiPathWalker* w = (GdiPathWalker*)arg;
+    CloseFigure(w->hdc);
+}
+
+static const fz_path_walker gGdiPathWalker = {GdiMoveTo, GdiLineTo, GdiCurveTo, GdiClosePath};
+
+// adds the path to the DC's current path (between BeginPath and EndPath)
+static void AddPath(fz_context* ctx, HDC hdc, const fz_path* path, fz_matrix ctm) {
+    GdiPathWalker w{hdc, ctm};
+    fz_walk_path(ctx, path, &gGdiPathWalker, &w);
+}
+
+static bool CanDrawText(fz_context* ctx, const fz_text* text) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        if (fz_font_t3_procs(ctx, span->font) || !fz_font_ft_face(ctx, span->font)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// glyphs are drawn as outlines so that we don't depend on fonts installed
+// on the printer or having to embed them
+static void AddTextPath(fz_context* ctx, HDC hdc, const fz_text* text, fz_matrix ctm) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        fz_matrix trm = span->trm;
+        for (int i = 0; i < span->len; i++) {
+            fz_text_item* it = &span->items[i];
+            if (it->gid < 0) {
+                continue;
+            }
+            trm.e = it->x;
+            trm.f = it->y;
+            fz_path* path = fz_outline_glyph(ctx, span->font, it->gid, trm);
+            if (!path) {
+                continue;
+            }
+            fz_try(ctx) {
+                AddPath(ctx, hdc, path, ctm);
+            }
+            fz_always(ctx) {
+                fz_drop_path(ctx, path);
+            }
+            fz_catch(ctx) {
+                fz_rethrow(ctx);
+            }
+        }
+    }
+}
+
+static bool CanStroke(const fz_stroke_state* stroke) {
+    return stroke->dash_len <= kMaxGdiDashes && (stroke->dash_len == 0 || stroke->dash_phase == 0);
+}
+
+static HPEN CreateStrokePen(const fz_stroke_state* stroke, fz_matrix ctm, COLORREF col) {
+    float expansion = fz_matrix_expansion(ctm);
+    // a line width of 0 means the thinnest line the device can draw
+    DWORD width = (DWORD)std::max(lrintf(stroke->linewidth * expansion), 1L);
+
+    DWORD style = PS_GEOMETRIC;
+    switch (stroke->start_cap) {
+        case FZ_LINECAP_ROUND:
+            style |= PS_ENDCAP_ROUND;
+            break;
+        case FZ_LINECAP_SQUARE:
+            style |= PS_ENDCAP_SQUARE;
+            break;
+        default:
+            style |= PS_ENDCAP_FLAT;
+            break;
+    }
+    switch (stroke->linejoin) {
+        case FZ_LINEJOIN_ROUND:
+            style |= PS_JOIN_ROUND;
+            break;
+        case FZ_LINEJOIN_BEVEL:
+            style |= PS_JOIN_BEVEL;
+            break;
+        default:
+            style |= PS_JOIN_MITER;
+            break;
+    }
+
+    DWORD dashes[kMaxGdiDashes];
+    int nDashes = 0;
+    if (stroke->dash_len > 0) {
+        style |= PS_USERSTYLE;
+        for (int i = 0; i < stroke->dash_len && i < kMaxGdiDashes; i++) {
+            dashes[nDashes++] = (DWORD)std::max(lrintf(stroke->dash_list[i] * expansion), 1L);
+        }
+    } else {
+        style |= PS_SOLID;
+    }
+
+    LOGBRUSH lb{BS_SOLID, col, 0};
+    return ExtCreatePen(style, width, &lb, nDashes, nDashes > 0 ? dashes : nullptr);
+}
+
+static void FillCurrentPath(HDC hdc, bool evenOdd, COLORREF col) {
+    SetPolyFillMode(hdc, evenOdd ? ALTERNATE : WINDING);
+    HBRUSH brush = CreateSolidBrush(col);
+    HGDIOBJ prevBrush = SelectObject(hdc, brush);
+    FillPath(hdc);
+    SelectObject(hdc, prevBrush);
+    DeleteObject(brush);
+}
+
+static void StrokeCurrentPath(HDC hdc, const fz_stroke_state* stroke, fz_matrix ctm, COLORREF col) {
+    HPEN pen = CreateStrokePen(stroke, ctm, col);
+    HGDIOBJ prevPen = SelectObject(hdc, pen);
+    SetMiterLimit(hdc, stroke->miterlimit, nullptr);
+    StrokePath(hdc);
+    SelectObject(hdc, prevPen);
+    DeleteObject(pen);
+}
+
+static void ClipToCurrentPath(HDC hdc, bool evenOdd) {
+    SetPolyFillMode(hdc, evenOdd ? ALTERNATE : WINDING);
+    SelectClipPath(hdc, RGN_AND);
+}
+
+static void ClipToCurrentPathStroke(HDC hdc, const fz_stroke_state* stroke, fz_matrix ctm) {
+    HPEN pen = CreateStrokePen(stroke, ctm, 0);
+    HGDIOBJ prevPen = SelectObject(hdc, pen);
+    SetMiterLimit(hdc, stroke->miterlimit, nullptr);
+    WidenPath(hdc);
+    SelectObject(hdc, prevPen);
+    DeleteObject(pen);
+    ClipToCurrentPath(hdc, false);
+}
+
+static void GdiFillPath(fz_context* ctx, fz_device* d, const fz_path* path, int evenOdd, fz_matrix ctm,
+                        fz_colorspace* cs, const float* color, float alpha, fz_color_params cp) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (alpha < 1.f) {
+        Unsupported(ctx, dev, "transparent fill");
+    }
+    if (!dev->hdc || dev->unsupported) {
+        return;
+    }
+    BeginPath(dev->hdc);
+    AddPath(ctx, dev->hdc, path, ctm);
+    EndPath(dev->hdc);
+    FillCurrentPath(dev->hdc, evenOdd, ToColorRef(ctx, cs, color, cp));
+}
+
+static void GdiStrokePath(fz_context* ctx, fz_device* d, const fz_path* path, const fz_stroke_state* stroke,
+                          fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha, fz_color_params cp) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (alpha < 1.f || !CanStroke(stroke)) {
+        Unsupported(ctx, dev, "transparent or dashed stroke");
+    }
+    if (!dev->hdc || dev->unsupported) {
+        return;
+    }
+    BeginPath(dev->hdc);
+    AddPath(ctx, dev->hdc, path, ctm);
+    EndPath(dev->hdc);
+    StrokeCurrentPath(dev->hdc, stroke, ctm, ToColorRef(ctx, cs, color, cp));
+}
+
+// every clip_* call is matched by a pop_clip, which restores the saved DC
+static void GdiClipPath(fz_context* ctx, fz_device* d, const fz_path* path, int evenOdd, fz_matrix ctm,
+                        fz_rect scissor) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (!dev->hdc) {
+        return;
+    }
+    SaveDC(dev->hdc);
+    BeginPath(dev->hdc);
+    AddPath(ctx, dev->hdc, path, ctm);
+    EndPath(dev->hdc);
+    ClipToCurrentPath(dev->hdc, evenOdd);
+}
+
+static void GdiClipStrokePath(fz_context* ctx, fz_device* d, const fz_path* path, const fz_stroke_state* stroke,
+                              fz_matrix ctm, fz_rect scissor) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (!CanStroke(stroke)) {
+        Unsupported(ctx, dev, "dashed stroke clip");
+    }
+    if (!dev->hdc) {
+        return;
+    }
+    SaveDC(dev->hdc);
+    BeginPath(dev->hdc);
+    AddPath(ctx, dev->hdc, path, ctm);
+    EndPath(dev->hdc);
+    ClipToCurrentPathStroke(dev->hdc, stroke, ctm);
+}
+
+static void GdiFillText(fz_context* ctx, fz_device* d, const fz_text* text, fz_matrix ctm, fz_colorspace* cs,
+                        const float* color, float alpha, fz_color_params cp) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (alpha < 1.f || !CanDrawText(ctx, text)) {
+        Unsupported(ctx, dev, "transparent or Type3 text");
+    }
+    if (!dev->hdc || dev->unsupported) {
+        return;
+    }
+    BeginPath(dev->hdc);
+    AddTextPath(ctx, dev->hdc, text, ctm);
+    EndPath(dev->hdc);
+    FillCurrentPath(dev->hdc, false, ToColorRef(ctx, cs, color, cp));
+}
+
+static void GdiStrokeText(fz_context* ctx, fz_device* d, const fz_text* text, const fz_stroke_state* stroke,
+                          fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha, fz_color_params cp) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (alpha < 1.f || !CanDrawText(ctx, text) || !CanStroke(stroke)) {
+        Unsupported(ctx, dev, "transparent or Type3 text");
+    }
+    if (!dev->hdc || dev->unsupported) {
+        return;
+    }
+    BeginPath(dev->hdc);
+    AddTextPath(ctx, dev->hdc, text, ctm);
+    EndPath(dev->hdc);
+    StrokeCurrentPath(dev->hdc, stroke, ctm, ToColorRef(ctx, cs, color, cp));
+}
+
+static void GdiClipText(fz_context* ctx, fz_device* d, const fz_text* text, fz_matrix ctm, fz_rect scissor) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (!CanDrawText(ctx, text)) {
+        Unsupported(ctx, dev, "Type3 text clip");
+    }
+    if (!dev->hdc) {
+        return;
+    }
+    SaveDC(dev->hdc);
+    BeginPath(dev->hdc);
+    AddTextPath(ctx, dev->hdc, text, ctm);
+    EndPath(dev->hdc);
+    ClipToCurrentPath(dev->hdc, false);
+}
+
+static void GdiClipStrokeText(fz_context* ctx, fz_device* d, const fz_text* text, const fz_stroke_state* stroke,
+                              fz_matrix ctm, fz_rect scissor) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (!CanDrawText(ctx, text) || !CanStroke(stroke)) {
+        Unsupported(ctx, dev, "Type3 text clip");
+    }
+    if (!dev->hdc) {
+        return;
+    }
+    SaveDC(dev->hdc);
+    BeginPath(dev->hdc);
+    AddTextPath(ctx, dev->hdc, text, ctm);
+    EndPath(dev->hdc);
+    ClipToCurrentPathStroke(dev->hdc, stroke, ctm);
+}
+
+// images are sent at the resolution they're needed at, transparent
+// pixels (e.g. of PNG images in XPS documents) are blended with white
+static void DrawImage(fz_context* ctx, HDC hdc, fz_image* image, fz_matrix ctm) {
+    int w = 0, h = 0;
+    fz_matrix ctm2 = ctm;
+    fz_pixmap* pix = fz_get_pixmap_from_image(ctx, image, nullptr, &ctm2, &w, &h);
+    fz_pixmap* rgb = nullptr;
+    u8* data = nullptr;
+    fz_var(rgb);
+    fz_var(data);
+    fz_try(ctx) {
+        rgb = fz_convert_pixmap(ctx, pix, fz_device_bgr(ctx), nullptr, nullptr, fz_default_color_params, 1);
+        // 24-bit DIB rows are padded to 4 bytes
+        int dx = rgb->w;
+        int dy = rgb->h;
+        size_t stride = (((size_t)dx * 3) + 3) & ~(size_t)3;
+        data = AllocArray<u8>(stride * (size_t)dy);
+        if (!data) {
+            fz_throw(ctx, FZ_ERROR_MEMORY, "out of memory");
+        }
+        int n = rgb->n;
+        for (int y = 0; y < dy; y++) {
+            const u8* s = rgb->samples + (size_t)y * rgb->stride;
+            u8* d = data + (size_t)y * stride;
+            for (int x = 0; x < dx; x++, s += n, d += 3) {
+                if (rgb->alpha) {
+                    // samples are premultiplied
+                    int a = s[n - 1];
+                    d[0] = (u8)(s[0] + 255 - a);
+                    d[1] = (u8)(s[1] + 255 - a);
+                    d[2] = (u8)(s[2] + 255 - a);
+                } else {
+                    d[0] = s[0];
+                    d[1] = s[1];
+                    d[2] = s[2];
+                }
+            }
+        }
+
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = dx;
+        bmi.bmiHeader.biHeight = -dy;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 24;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        // the image's pixels are mapped to the unit square which ctm maps to the page
+        int prevMode = SetGraphicsMode(hdc, GM_ADVANCED);
+        XFORM xf = {ctm2.a / dx, ctm2.b / dx, ctm2.c / dy, ctm2.d / dy, ctm2.e, ctm2.f};
+        SetWorldTransform(hdc, &xf);
+        SetStretchBltMode(hdc, HALFTONE);
+        StretchDIBits(hdc, 0, 0, dx, dy, 0, 0, dx, dy, data, &bmi, DIB_RGB_COLORS, SRCCOPY);
+        ModifyWorldTransform(hdc, nullptr, MWT_IDENTITY);
+        SetGraphicsMode(hdc, prevMode);
+    }
+    fz_always(ctx) {
+        free(data);
+        fz_drop_pixmap(ctx, rgb);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+static void GdiFillImage(fz_context* ctx, fz_device* d, fz_image* image, fz_matrix ctm, float alpha,
+                         fz_color_params cp) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (alpha < 1.f || image->mask || image->use_colorkey) {
+        Unsupported(ctx, dev, "transparent image");
+    }
+    if (!dev->hdc || dev->unsupported) {
+        return;
+    }
+    DrawImage(ctx, dev->hdc, image, ctm);
+}
+
+static void GdiFillImageMask(fz_context* ctx, fz_device* d, fz_image* image, fz_matrix ctm, fz_colorspace* cs,
+                             const float* color, float alpha, fz_color_params cp) {
+    Unsupported(ctx, (FzGdiDevice*)d, "image mask");
+}
+
+static void GdiClipImageMask(fz_context* ctx, fz_device* d, fz_image* image, fz_matrix ctm, fz_rect scissor) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    Unsupported(ctx, dev, "image mask clip");
+    if (dev->hdc) {
+        SaveDC(dev->hdc);
+    }
+}
+
+static void GdiPopClip(fz_context* ctx, fz_device* d) {
+    FzGdiDevice* dev = (FzGdiDevice*)d;
+    if (dev->hdc) {
+        RestoreDC(dev->hdc, -1);
+    }
+}
+
+static void GdiFillShade(fz_context* ctx, fz_device* d, fz_shade* shade, fz_matrix ctm, float alpha,
+                         fz_color_params cp) {
+    Unsupported(ctx, (FzGdiDevice*)d, "shading");
+}
+
+static void GdiBeginMask(fz_context* ctx, fz_device* d, fz_rect area, int luminosity, fz_colorspace* cs,
+                         const float* bc, fz_color_params cp) {
+    Unsupported(ctx, (FzGdiDevice*)d, "soft mask");
+}
+
+// groups of opaque content without blending look the same when drawn directly
+static void GdiBeginGroup(fz_context* ctx, fz_device* d, fz_rect area, fz_colorspace* cs, int isolated, int knockout,
+                          int blendmode, float alpha) {
+    if (alpha < 1.f || blendmode != FZ_BLEND_NORMAL) {
+        Unsupported(ctx, (FzGdiDevice*)d, "transparency group");
+    }
+}
+
+// the content of tiling patterns would only be drawn once
+static int GdiBeginTile(fz_context* ctx, fz_device* d, fz_rect area, fz_rect view, float xstep, float ystep,
+                        fz_matrix ctm, int id) {
+    Unsupported(ctx, (FzGdiDevice*)d, "tiling pattern");
+    return 0;
+}
+
+static fz_device* NewGdiDevice(fz_context* ctx, HDC hdc) {
+    FzGdiDevice* dev = fz_new_derived_device(ctx, FzGdiDevice);
+    dev->hdc = hdc;
+    dev->unsupported = false;
+
+    dev->super.fill_path = GdiFillPath;
+    dev->super.stroke_path = GdiStrokePath;
+    dev->super.clip_path = GdiClipPath;
+    dev->super.clip_stroke_path = GdiClipStrokePath;
+
+    dev->super.fill_text = GdiFillText;
+    dev->super.stroke_text = GdiStrokeText;
+    dev->super.clip_text = GdiClipText;
+    dev->super.clip_stroke_text = GdiClipStrokeText;
+
+    dev->super.fill_shade = GdiFillShade;
+    dev->super.fill_image = GdiFillImage;
+    dev->super.fill_image_mask = GdiFillImageMask;
+    dev->super.clip_image_mask = GdiClipImageMask;
+
+    dev->super.pop_clip = GdiPopClip;
+
+    dev->super.begin_mask = GdiBeginMask;
+    dev->super.begin_group = GdiBeginGroup;
+    dev->super.begin_tile = GdiBeginTile;
+
+    return (fz_device*)dev;
+}
+
+static bool RunGdiDevice(fz_context* ctx, fz_display_list* list, fz_matrix ctm, fz_rect clip, HDC hdc) {
+    fz_device* dev = nullptr;
+    bool ok = false;
+    fz_var(dev);
+    fz_var(ok);
+    fz_try(ctx) {
+        dev = NewGdiDevice(ctx, hdc);
+        // fz_run_display_list stops at the FZ_ERROR_ABORT thrown by Unsupported()
+        fz_run_display_list(ctx, list, dev, ctm, clip, nullptr);
+        fz_close_device(ctx, dev);
+        ok = !((FzGdiDevice*)dev)->unsupported;
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    return ok;
+}
+
+bool FzDrawDisplayListGdi(fz_context* ctx, fz_display_list* list, fz_matrix ctm, fz_rect clip, HDC hdc) {
+    if (!RunGdiDevice(ctx, list, ctm, clip, nullptr)) {
+        return false;
+    }
+    if (!hdc) {
+        return true;
+    }
+
+    int saved = SaveDC(hdc);
+    fz_irect r = fz_round_rect(clip);
+    IntersectClipRect(hdc, r.x0, r.y0, r.x1, r.y1);
+    bool ok = RunGdiDevice(ctx, list, ctm, clip, hdc);
+    RestoreDC(hdc, saved);
+    return ok;
+}
@@ -0,0 +1,12 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// must be included after <mupdf/fitz.h>
+
+// draws a display list with GDI primitives (paths, glyph outlines and images),
+// e.g. for printing documents without rasterizing them into big bitmaps.
+// Returns false (and doesn't draw anything) if the list has content that
+// GDI can't reproduce (transparency, blend modes, soft masks, shadings,
+// tiling patterns, Type3 fonts). With a nullptr hdc, it only checks that
+// the list can be drawn
+bool FzDrawDisplayListGdi(fz_context* ctx, fz_display_list* list, fz_matrix ctm, fz_rect clip, HDC hdc);
@@ -209,8 +209,9 @@ Gdiplus::Bitmap* FzImageFromData(const ByteSlice& d) {
     return result;
 }
 
-Gdiplus::Bitmap* BitmapFromData(const ByteSlice& bmpData) {
-    auto res = BitmapFromDataWin(bmpData);
+// see BitmapFromDataWin() for scaledSize
+Gdiplus::Bitmap* BitmapFromData(const ByteSlice& bmpData, Size scaledSize) {
+    auto res = BitmapFromDataWin(bmpData, scaledSize);
     if (res) {
         return res;
     }
@@ -243,3 +244,37 @@ RenderedBitmap* LoadRenderedBitmap(const char* path) {
 
     return rendered;
 }
+
+RenderedBitmap* ThumbnailFromData(const ByteSlice& data, Size maxSize) {
+    Size size = BitmapSizeFromData(data);
+    if (size.IsEmpty() || maxSize.IsEmpty()) {
+        return nullptr;
+    }
+    float zoom = std::min(1.f, std::min(maxSize.dx / (float)size.dx, maxSize.dy / (float)size.dy));
+    Size thumbSize(std::max((int)(size.dx * zoom), 1), std::max((int)(size.dy * zoom), 1));
+
+    // WIC and webp already decode at thumbSize, others return the full size image
+    Gdiplus::Bitmap* bmp = BitmapFromData(data, thumbSize);
+    if (!bmp) {
+        return nullptr;
+    }
+    if (bmp->GetWidth() != (uint)thumbSize.dx || bmp->GetHeight() != (uint)thumbSize.dy) {
+        Gdiplus::Bitmap* scaled = new Gdiplus::Bitmap(thumbSize.dx, thumbSize.dy, PixelFormat32bppARGB);
+        Gdiplus::Graphics g(scaled);
+        g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+        g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+        g.Clear(Gdiplus::Color::White);
+        g.DrawImage(bmp, 0, 0, thumbSize.dx, thumbSize.dy);
+        delete bmp;
+        bmp = scaled;
+    }
+
+    HBITMAP hbmp;
+    RenderedBitmap* rendered = nullptr;
+    if (bmp->GetHBITMAP((Gdiplus::ARGB)Gdiplus::Color::White, &hbmp) == Gdiplus::Ok) {
+        rendered = new RenderedBitmap(hbmp, thumbSize);
+    }
+    delete bmp;
+
+    return rendered;
+}
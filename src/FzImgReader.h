@@ -3,5 +3,7 @@
 
 Gdiplus::Bitmap* FzImageFromData(const ByteSlice&);
 
-Gdiplus::Bitmap* BitmapFromData(const ByteSlice&);
+Gdiplus::Bitmap* BitmapFromData(const ByteSlice&, Size scaledSize = Size());
 RenderedBitmap* LoadRenderedBitmap(const char* path);
+// decodes an image scaled down to fit into maxSize (e.g. for thumbnails)
+RenderedBitmap* ThumbnailFromData(const ByteSlice&, Size maxSize);
@@ -15,6 +15,7 @@
 #include "utils/Log.h"
 
 GlobalPrefs* gGlobalPrefs = nullptr;
+int gFileStatePathChanges = 0;
 
 FileState* NewDisplayState(const char* filePath) {
     FileState* fs = (FileState*)DeserializeStruct(&gFileStateInfo, nullptr);
@@ -99,6 +100,19 @@ TabState* NewTabState(FileState* fs) {
     return state;
 }
 
+FileState* NewDisplayState(TabState* state) {
+    FileState* fs = NewDisplayState(state->filePath);
+    str::ReplaceWithCopy(&fs->displayMode, state->displayMode);
+    fs->pageNo = state->pageNo;
+    str::ReplaceWithCopy(&fs->zoom, state->zoom);
+    fs->rotation = state->rotation;
+    fs->scrollPos = state->scrollPos;
+    fs->showToc = state->showToc;
+    *fs->tocState = *state->tocState;
+    fs->useDefaultState = false;
+    return fs;
+}
+
 void ResetSessionState(Vec<SessionData*>* sessionData) {
     CrashIf(!sessionData);
     if (!sessionData) {
@@ -123,6 +137,7 @@ void SetFileStatePath(FileState* fs, const char* path) {
         return;
     }
     str::ReplaceWithCopy(&fs->filePath, path);
+    gFileStatePathChanges++;
 }
 
 void SetFileStatePath(FileState* fs, const WCHAR* path) {
@@ -15,10 +15,14 @@ void DeleteGlobalPrefs(GlobalPrefs* gp);
 
 SessionData* NewSessionData();
 TabState* NewTabState(FileState* fs);
+FileState* NewDisplayState(TabState* state);
 void ResetSessionState(Vec<SessionData*>* sessionData);
 ParsedColor* GetParsedColor(const char* s, ParsedColor& parsed);
 
 void SetFileStatePath(FileState* fs, const char* path);
+// incremented whenever SetFileStatePath() changes a path, so that
+// lookups by path know when to update their indexes
+extern int gFileStatePathChanges;
 // void SetFileStatePath(FileState* fs, const WCHAR* path);
 
 #define GetPrefsColor(name) GetParsedColor(name, name##Parsed)
@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
@@ -71,7 +72,7 @@ bool ValidReparseIdx(ptrdiff_t idx, HtmlPullParser* parser) {
 DrawInstr DrawInstr::Str(const char* s, size_t len, RectF bbox, bool rtl) {
     DrawInstr di(rtl ? DrawInstrType::RtlString : DrawInstrType::String, bbox);
     di.str.s = s;
-    di.str.len = len;
+    di.str.len = (u32)len;
     return di;
 }
 
@@ -90,7 +91,7 @@ DrawInstr DrawInstr::FixedSpace(float dx) {
 DrawInstr DrawInstr::Image(const ByteSlice& img, RectF bbox) {
     DrawInstr di(DrawInstrType::Image);
     di.str.s = (const char*)img.data();
-    di.str.len = img.size();
+    di.str.len = (u32)img.size();
     di.bbox = bbox;
     return di;
 }
@@ -98,28 +99,31 @@ DrawInstr DrawInstr::Image(const ByteSlice& img, RectF bbox) {
 DrawInstr DrawInstr::LinkStart(const char* s, size_t len) {
     DrawInstr di(DrawInstrType::LinkStart);
     di.str.s = s;
-    di.str.len = len;
+    di.str.len = (u32)len;
     return di;
 }
 
 DrawInstr DrawInstr::Anchor(const char* s, size_t len, RectF bbox) {
     DrawInstr di(DrawInstrType::Anchor);
     di.str.s = s;
-    di.str.len = len;
+    di.str.len = (u32)len;
     di.bbox = bbox;
     return di;
 }
 
 // parses size in the form "1em", "3pt" or "15px"
-static void ParseSizeWithUnit(const char* s, size_t len, float* size, StyleRule::Unit* unit) {
-    if (str::Parse(s, len, "%fem", size)) {
+static void ParseSizeWithUnit(const StrSpan& s, float* size, StyleRule::Unit* unit) {
+    StrSpan rest;
+    if (!str::ParseFloat(s, size, &rest)) {
+        *unit = StyleRule::inherit;
+    } else if (str::StartsWith(rest, "em")) {
         *unit = StyleRule::em;
-    } else if (str::Parse(s, len, "%fin", size)) {
+    } else if (str::StartsWith(rest, "in")) {
         *unit = StyleRule::pt;
         *size *= 72; // 1 inch is 72 points
-    } else if (str::Parse(s, len, "%fpt", size)) {
+    } else if (str::StartsWith(rest, "pt")) {
         *unit = StyleRule::pt;
-    } else if (str::Parse(s, len, "%fpx", size)) {
+    } else if (str::StartsWith(rest, "px")) {
         *unit = StyleRule::px;
     } else {
         *unit = StyleRule::inherit;
@@ -136,7 +140,7 @@ StyleRule StyleRule::Parse(CssPullParser* parser) {
                 break;
             // TODO: some documents use Css_Padding_Left for indentation
             case Css_Text_Indent:
-                ParseSizeWithUnit(prop->s, prop->sLen, &rule.textIndent, &rule.textIndentUnit);
+                ParseSizeWithUnit(StrSpan(prop->s, prop->sLen), &rule.textIndent, &rule.textIndentUnit);
                 break;
         }
     }
@@ -196,6 +200,7 @@ HtmlFormatter::~HtmlFormatter() {
     delete textMeasure;
     mui::FreeGraphicsForMeasureText(gfx);
     delete htmlParser;
+    delete cssClasses;
 }
 
 void HtmlFormatter::AppendInstr(const DrawInstr& di) {
@@ -474,13 +479,20 @@ void HtmlFormatter::UpdateLinkBboxes(HtmlPage* page) {
     }
 }
 
+// queues a page whose layout is complete, to be returned by Next()
+void HtmlFormatter::FinishPage(HtmlPage* page) {
+    UpdateLinkBboxes(page);
+    // pages are kept for as long as the document is open
+    page->instructions.Compact();
+    pagesToSend.Append(page);
+}
+
 void HtmlFormatter::ForceNewPage() {
     bool createdNewPage = FlushCurrLine(true);
     if (createdNewPage) {
         return;
     }
-    UpdateLinkBboxes(currPage);
-    pagesToSend.Append(currPage);
+    FinishPage(currPage);
 
     EmitNewPage();
     currX = NewLineX();
@@ -513,8 +525,7 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
     if (currY + totalLineDy > pageDy) {
         // current line too big to fit in current page,
         // so need to start another page
-        UpdateLinkBboxes(currPage);
-        pagesToSend.Append(currPage);
+        FinishPage(currPage);
         // instructions for each page need to be self-contained
         // so we have to carry over some state (like current font)
         CrashIf(!CurrFont());
@@ -725,7 +736,7 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
             break;
         }
         textMeasure->SetFont(CurrFont());
-        RectF bbox = textMeasure->Measure(buf, strLen);
+        RectF bbox = textMeasure->MeasureCached(buf, strLen);
         if (bbox.dx <= pageDx - currX) {
             AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
             currX += bbox.dx;
@@ -761,7 +772,7 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
         }
 
         textMeasure->SetFont(CurrFont());
-        bbox = ToGdipRectF(textMeasure->Measure(buf, lenThatFits));
+        bbox = ToGdipRectF(textMeasure->MeasureCached(buf, lenThatFits));
         CrashIf(bbox.dx > pageDx);
         // s is UTF-8 and buf is UTF-16, so one
         // WCHAR doesn't always equal one char
@@ -870,12 +881,11 @@ void HtmlFormatter::HandleTagFont(HtmlToken* t) {
     AttrInfo* attr = t->GetAttrByName("face");
     const WCHAR* faceName = CurrFont()->GetName();
     if (attr) {
-        WCHAR* buf = ToWstrTemp(attr->val, attr->valLen);
-        size_t strLen = str::Len(buf);
         // multiple font names can be comma separated
-        if (strLen > 0 && *buf != ',') {
-            str::TransCharsInPlace(buf, L",", L"\0");
-            faceName = buf;
+        StrSpan names = attr->Val();
+        StrSpan name;
+        if (str::NextPart(names, ',', name) && !name.empty()) {
+            faceName = ToWstrTemp(name);
         }
     }
 
@@ -884,7 +894,7 @@ void HtmlFormatter::HandleTagFont(HtmlToken* t) {
     if (attr) {
         // the sizes are in the range from 1 (tiny) to 7 (huge)
         int size = 3; // normal size
-        str::Parse(attr->val, attr->valLen, "%d", &size);
+        str::ParseInt(attr->Val(), &size);
         // sizes can also be relative to the current size
         if (attr->valLen > 0 && ('-' == *attr->val || '+' == *attr->val)) {
             size += 3;
@@ -969,71 +979,144 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
-StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
-    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
-        if (tag == rule.tag && classHash == rule.classHash) {
+static u32 StyleRuleHash(HtmlTag tag, int classId) {
+    return ((u32)classId * 0x85EBCA6B) ^ ((u32)tag * 0x9E3779B1);
+}
+
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, int classId) {
+    if (styleRuleSlots.size() == 0) {
+        return nullptr;
+    }
+    size_t mask = styleRuleSlots.size() - 1;
+    for (size_t i = StyleRuleHash(tag, classId) & mask;; i = (i + 1) & mask) {
+        int idx = styleRuleSlots.at(i);
+        if (idx == 0) {
+            return nullptr;
+        }
+        StyleRule& rule = styleRules.at(idx - 1);
+        if (tag == rule.tag && classId == rule.classId) {
             return &rule;
         }
     }
-    return nullptr;
+}
+
+// rule must not be in styleRules yet
+void HtmlFormatter::AddStyleRule(const StyleRule& rule) {
+    styleRules.Append(rule);
+    size_t nSlots = styleRuleSlots.size();
+    size_t first = styleRules.size() - 1;
+    // at most half of the slots are used, so that lookups stay short
+    if (styleRules.size() * 2 > nSlots) {
+        nSlots = std::max(nSlots * 2, (size_t)64);
+        styleRuleSlots.Reset();
+        int* slots = styleRuleSlots.AppendBlanks(nSlots);
+        memset(slots, 0, nSlots * sizeof(int));
+        first = 0;
+    }
+    size_t mask = nSlots - 1;
+    for (size_t n = first; n < styleRules.size(); n++) {
+        StyleRule& r = styleRules.at(n);
+        size_t i = StyleRuleHash(r.tag, r.classId) & mask;
+        while (styleRuleSlots.at(i) != 0) {
+            i = (i + 1) & mask;
+        }
+        styleRuleSlots.at(i) = (int)n + 1;
+    }
+}
+
+void HtmlFormatter::InvalidateComputedStyles() {
+    for (ComputedStyle& cs : computedStyles) {
+        cs.valid = false;
+    }
+}
+
+void HtmlFormatter::ResetStyleRules() {
+    styleRules.Reset();
+    styleRuleSlots.Reset();
+    InvalidateComputedStyles();
 }
 
 StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
+    // TODO: support multiple class names
+    AttrInfo* classAttr = t->GetAttrByName("class");
+    AttrInfo* styleAttr = t->GetAttrByName("style");
+    // a class that no selector uses doesn't change the style
+    int classId = -1;
+    if (classAttr && cssClasses) {
+        classId = FindCssClassId(cssClasses, classAttr->val, classAttr->valLen);
+    }
+    u32 styleHash = styleAttr ? MurmurHash2(styleAttr->val, styleAttr->valLen) : 0;
+    u8 attrs = (classId != -1 ? 1 : 0) | (styleAttr ? 2 : 0);
+    u32 h = StyleRuleHash(t->tag, classId) ^ (styleHash * 31);
+    ComputedStyle& cached = computedStyles[h % kComputedStylesCount];
+    if (cached.valid && cached.tag == t->tag && cached.classId == classId && cached.styleHash == styleHash &&
+        cached.attrs == attrs) {
+        return cached.rule;
+    }
+
     StyleRule rule;
     // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
+    StyleRule* prevRule = FindStyleRule(Tag_Body, -1);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
+    prevRule = FindStyleRule(Tag_Any, -1);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
+    prevRule = FindStyleRule(t->tag, -1);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    // TODO: support multiple class names
-    AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
+    if (classId != -1) {
+        prevRule = FindStyleRule(Tag_Any, classId);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
+        prevRule = FindStyleRule(t->tag, classId);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
     }
-    attr = t->GetAttrByName("style");
-    if (attr) {
-        StyleRule newRule = StyleRule::Parse(attr->val, attr->valLen);
+    if (styleAttr) {
+        StyleRule newRule = StyleRule::Parse(styleAttr->val, styleAttr->valLen);
         rule.Merge(newRule);
     }
+
+    cached.valid = true;
+    cached.tag = t->tag;
+    cached.classId = classId;
+    cached.styleHash = styleHash;
+    cached.attrs = attrs;
+    cached.rule = rule;
     return rule;
 }
 
 void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
+    if (!cssClasses) {
+        cssClasses = new StringInterner();
+    }
     CssPullParser parser(data, len);
     while (parser.NextRule()) {
         StyleRule rule = StyleRule::Parse(&parser);
         const CssSelector* sel;
+        CssSelectorKey key;
         while ((sel = parser.NextSelector()) != nullptr) {
-            if (Tag_NotFound == sel->tag) {
+            if (!CompileCssSelector(sel, cssClasses, &key)) {
                 continue;
             }
-            StyleRule* prevRule = FindStyleRule(sel->tag, sel->clazz, sel->clazzLen);
+            StyleRule* prevRule = FindStyleRule(key.tag, key.classId);
             if (prevRule) {
                 prevRule->Merge(rule);
             } else {
-                rule.tag = sel->tag;
-                rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
+                rule.tag = key.tag;
+                rule.classId = key.classId;
+                AddStyleRule(rule);
             }
         }
     }
+    // styles computed so far might have changed
+    InvalidateComputedStyles();
 }
 
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
@@ -1047,7 +1130,7 @@ void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
 
     const char* start = t->s + t->sLen + 1;
     while (t && !t->IsError() && (!t->IsEndTag() || t->tag != Tag_Style)) {
-        t = htmlParser->Next();
+        t = NextHtmlToken();
     }
     if (!t || !t->IsEndTag() || Tag_Style != t->tag) {
         return;
@@ -1353,7 +1436,7 @@ HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
         if (finishedParsing) {
             return nullptr;
         }
-        HtmlToken* t = htmlParser->Next();
+        HtmlToken* t = NextHtmlToken();
         if (!t || t->IsError()) {
             break;
         }
@@ -1370,14 +1453,17 @@ HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
     AutoCloseTags(tagNesting.size());
     FlushCurrLine(true);
 
-    UpdateLinkBboxes(currPage);
-    pagesToSend.Append(currPage);
+    FinishPage(currPage);
     currPage = nullptr;
     // call ourselves recursively to return accumulated pages
     finishedParsing = true;
     return Next();
 }
 
+HtmlToken* HtmlFormatter::NextHtmlToken() {
+    return htmlParser->Next();
+}
+
 // convenience method to format the whole html
 Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
     Vec<HtmlPage*>* pages = new Vec<HtmlPage*>();
@@ -1391,8 +1477,174 @@ Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
 // should be underlined at a baseline
+static size_t BitmapMemSize(Bitmap* bmp) {
+    return (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * 4;
+}
+
+HtmlImageCache::HtmlImageCache(size_t maxMemSize) : maxMemSize(maxMemSize) {
+    InitializeCriticalSection(&access);
+}
+
+HtmlImageCache::~HtmlImageCache() {
+    StopPrefetching();
+    for (Entry& e : entries) {
+        delete e.bmp;
+    }
+    DeleteCriticalSection(&access);
+}
+
+HtmlImageCache::Entry* HtmlImageCache::Find(const u8* data) {
+    for (Entry& e : entries) {
+        if (e.data == data) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+void HtmlImageCache::Add(const u8* data, Bitmap* bmp) {
+    Entry e;
+    e.data = data;
+    e.bmp = bmp;
+    e.memSize = BitmapMemSize(bmp);
+    e.lastUsed = ++useCount;
+    entries.Append(e);
+    memSize += e.memSize;
+}
+
+Bitmap* HtmlImageCache::Get(const ByteSlice& img) {
+    {
+        ScopedCritSec scope(&access);
+        Entry* e = Find(img.data());
+        if (e) {
+            e->lastUsed = ++useCount;
+            return e->bmp;
+        }
+    }
+
+    Bitmap* bmp = BitmapFromData(img);
+    if (!bmp) {
+        return nullptr;
+    }
+
+    ScopedCritSec scope(&access);
+    // decodeThread might have decoded it in the meantime
+    Entry* e = Find(img.data());
+    if (e) {
+        delete bmp;
+        e->lastUsed = ++useCount;
+        return e->bmp;
+    }
+    // only Get() evicts images, so a bitmap is never deleted while it's being drawn
+    size_t size = BitmapMemSize(bmp);
+    while (entries.size() > 0 && memSize + size > maxMemSize) {
+        int lru = 0;
+        for (int i = 1; i < entries.isize(); i++) {
+            if (entries[i].lastUsed < entries[lru].lastUsed) {
+                lru = i;
+            }
+        }
+        memSize -= entries[lru].memSize;
+        delete entries[lru].bmp;
+        entries.RemoveAtFast(lru);
+    }
+    Add(img.data(), bmp);
+    return bmp;
+}
+
+void HtmlImageCache::Prefetch(const ByteSlice& img) {
+    if (img.empty()) {
+        return;
+    }
+    ScopedCritSec scope(&access);
+    if (abortDecode || memSize >= maxMemSize || Find(img.data())) {
+        return;
+    }
+    for (ByteSlice& d : toDecode) {
+        if (d.data() == img.data()) {
+            return;
+        }
+    }
+    toDecode.Append(img);
+    if (decodeThreadRunning) {
+        return;
+    }
+    // a previous thread is done with the queue and only has to exit
+    if (decodeThread) {
+        WaitForSingleObject(decodeThread, INFINITE);
+        CloseHandle(decodeThread);
+    }
+    decodeThread = CreateThread(nullptr, 0, DecodeThread, this, 0, nullptr);
+    decodeThreadRunning = decodeThread != nullptr;
+    if (!decodeThreadRunning) {
+        toDecode.Reset();
+    }
+}
+
+void HtmlImageCache::PrefetchPage(Vec<DrawInstr>* drawInstructions) {
+    if (!drawInstructions) {
+        return;
+    }
+    for (DrawInstr& i : *drawInstructions) {
+        if (DrawInstrType::Image == i.type) {
+            Prefetch(i.GetImage());
+        }
+    }
+}
+
+DWORD WINAPI HtmlImageCache::DecodeThread(LPVOID data) {
+    HtmlImageCache* cache = (HtmlImageCache*)data;
+    cache->DecodePrefetched();
+    return 0;
+}
+
+void HtmlImageCache::DecodePrefetched() {
+    for (;;) {
+        ByteSlice img;
+        {
+            ScopedCritSec scope(&access);
+            if (abortDecode || toDecode.size() == 0 || memSize >= maxMemSize) {
+                toDecode.Reset();
+                decodeThreadRunning = false;
+                return;
+            }
+            img = toDecode[0];
+            toDecode.RemoveAt(0);
+            if (Find(img.data())) {
+                continue;
+            }
+        }
+
+        Bitmap* bmp = BitmapFromData(img);
+        if (!bmp) {
+            continue;
+        }
+        ScopedCritSec scope(&access);
+        if (abortDecode || Find(img.data())) {
+            delete bmp;
+            continue;
+        }
+        Add(img.data(), bmp);
+    }
+}
+
+void HtmlImageCache::StopPrefetching() {
+    HANDLE thread;
+    {
+        ScopedCritSec scope(&access);
+        abortDecode = true;
+        toDecode.Reset();
+        thread = decodeThread;
+        decodeThread = nullptr;
+    }
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+}
+
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
-                  bool showBbox, Color textColor, bool* abortCookie) {
+                  bool showBbox, Color textColor, bool* abortCookie, HtmlImageCache* imageCache) {
     Pen debugPen(Color(255, 0, 0), 1);
     // Pen linePen(Color(0, 0, 0), 2.f);
     Pen linePen(Color(0x5F, 0x4B, 0x32), 2.f);
@@ -1444,15 +1696,16 @@ void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawI
             status = g->DrawLine(&linePen, p1, p2);
             CrashIf(status != Ok);
         } else if (DrawInstrType::Image == i.type) {
-            // TODO: cache the bitmap somewhere (?)
-            Bitmap* bmp = BitmapFromData(i.GetImage());
+            Bitmap* bmp = imageCache ? imageCache->Get(i.GetImage()) : BitmapFromData(i.GetImage());
             if (bmp) {
                 status = g->DrawImage(bmp, ToGdipRectF(bbox), 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(),
                                       UnitPixel);
                 // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
                 CrashIf(status != Ok && status != Win32Error);
             }
-            delete bmp;
+            if (!imageCache) {
+                delete bmp;
+            }
         } else if (DrawInstrType::LinkStart == i.type) {
             // TODO: set text color to blue
             float y = floorf(bbox.y + bbox.dy + 0.5f);
@@ -21,7 +21,7 @@ using Gdiplus::Win32Error;
 
 // Layout information for a given page is a list of
 // draw instructions that define what to draw and where.
-enum class DrawInstrType {
+enum class DrawInstrType : u8 {
     Unknown = 0,
     // a piece of text
     String = 1,
@@ -47,6 +47,9 @@ enum class DrawInstrType {
     RtlString,
 };
 
+// books can have millions of instructions, so they're packed into
+// 32 bytes (pointers are only 4-byte aligned, which x86 and ARM64 don't mind)
+#pragma pack(push, 4)
 struct DrawInstr {
     DrawInstrType type{DrawInstrType::Unknown};
     union {
@@ -54,7 +57,7 @@ struct DrawInstr {
         // InstrString, InstrLinkStart, InstrAnchor, InstrRtlString, InstrImage
         struct {
             const char* s;
-            size_t len;
+            u32 len;
         } str{nullptr, 0};
         mui::CachedFont* font; // InstrSetFont
     };
@@ -77,12 +80,17 @@ struct DrawInstr {
     static DrawInstr LinkStart(const char* s, size_t len);
     static DrawInstr Anchor(const char* s, size_t len, RectF bbox);
 };
+#pragma pack(pop)
+
+static_assert(sizeof(DrawInstr) <= 32, "DrawInstr should stay small");
 
 class CssPullParser;
+class StringInterner;
 
 struct StyleRule {
     HtmlTag tag = Tag_NotFound;
-    u32 classHash = 0;
+    // index into HtmlFormatter::cssClasses, -1 for rules without a class
+    int classId = -1;
 
     enum Unit { px, pt, em, inherit };
 
@@ -98,6 +106,21 @@ struct StyleRule {
     static StyleRule Parse(const char* s, size_t len);
 };
 
+// style computed for a tag with a given class and inline style
+struct ComputedStyle {
+    bool valid = false;
+    HtmlTag tag = Tag_NotFound;
+    int classId = -1;
+    u32 styleHash = 0;
+    // which of class and style attributes the tag has
+    u8 attrs = 0;
+    StyleRule rule;
+};
+
+// publisher EPUBs can have thousands of CSS rules and most tags
+// share the same few combinations of class and inline style
+constexpr size_t kComputedStylesCount = 64;
+
 struct DrawStyle {
     mui::CachedFont* font = nullptr;
     AlignAttr align{AlignAttr::NotFound};
@@ -194,6 +217,7 @@ class HtmlFormatter {
     void JustifyCurrLine(AlignAttr align);
     bool FlushCurrLine(bool isParagraphBreak);
     void UpdateLinkBboxes(HtmlPage* page);
+    void FinishPage(HtmlPage* page);
 
     bool EmitImage(const ByteSlice* img);
     void EmitHr();
@@ -218,12 +242,16 @@ class HtmlFormatter {
     void RevertStyleChange();
 
     void ParseStyleSheet(const char* data, size_t len);
-    StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
+    StyleRule* FindStyleRule(HtmlTag tag, int classId);
+    void AddStyleRule(const StyleRule& rule);
+    void ResetStyleRules();
+    void InvalidateComputedStyles();
     StyleRule ComputeStyleRule(HtmlToken* t);
 
     void AppendInstr(const DrawInstr& di);
     bool IsCurrLineEmpty();
     virtual bool IgnoreText();
+    virtual HtmlToken* NextHtmlToken();
 
     void DumpLineDebugInfo();
 
@@ -259,6 +287,13 @@ class HtmlFormatter {
     bool keepTagNesting = false;
     // set from CSS and to be checked by the individual tag handlers
     Vec<StyleRule> styleRules;
+    // class names used by selectors of styleRules
+    StringInterner* cssClasses = nullptr;
+    // hash table of (tag, classId) for styleRules with open addressing.
+    // Slots are indexes into styleRules + 1 (0 for empty slots)
+    Vec<int> styleRuleSlots;
+    // cache of ComputeStyleRule() results, cleared whenever styleRules change
+    ComputedStyle computedStyles[kComputedStylesCount];
 
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
@@ -292,8 +327,55 @@ class HtmlFormatter {
     Vec<HtmlPage*>* FormatAllPages(bool skipEmptyPages = true);
 };
 
+// decoding images is much slower than drawing them
+constexpr size_t kHtmlImageCacheMemSize = 64 * 1024 * 1024;
+
+// decoded images of a document, so that DrawHtmlPage() doesn't decode an image
+// again for every page (or tile of a page) it's drawn on. Images of pages about
+// to be shown can be decoded ahead of time on a background thread.
+// Get() must only be called by one thread at a time (e.g. under the engine's lock)
+class HtmlImageCache {
+    struct Entry {
+        const u8* data = nullptr;
+        Gdiplus::Bitmap* bmp = nullptr;
+        size_t memSize = 0;
+        u64 lastUsed = 0;
+    };
+
+    CRITICAL_SECTION access;
+    Vec<Entry> entries;
+    size_t memSize = 0;
+    size_t maxMemSize = 0;
+    u64 useCount = 0;
+
+    // images waiting to be decoded by decodeThread
+    Vec<ByteSlice> toDecode;
+    HANDLE decodeThread = nullptr;
+    bool decodeThreadRunning = false;
+    bool abortDecode = false;
+
+    Entry* Find(const u8* data);
+    void Add(const u8* data, Gdiplus::Bitmap* bmp);
+    static DWORD WINAPI DecodeThread(LPVOID data);
+    void DecodePrefetched();
+
+  public:
+    explicit HtmlImageCache(size_t maxMemSize = kHtmlImageCacheMemSize);
+    HtmlImageCache(HtmlImageCache const&) = delete;
+    HtmlImageCache& operator=(HtmlImageCache const&) = delete;
+    ~HtmlImageCache();
+
+    // the bitmap is owned by the cache and stays valid until the next call to Get()
+    Gdiplus::Bitmap* Get(const ByteSlice& img);
+    // decodes img on a background thread if it isn't cached and fits in the cache
+    void Prefetch(const ByteSlice& img);
+    void PrefetchPage(Vec<DrawInstr>* drawInstructions);
+    // must be called before the image data goes away
+    void StopPrefetching();
+};
+
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
-                  bool showBbox, Color textColor, bool* abortCookie = nullptr);
+                  bool showBbox, Color textColor, bool* abortCookie = nullptr, HtmlImageCache* imageCache = nullptr);
 
 mui::TextRenderMethod GetTextRenderMethod();
 void SetTextRenderMethod(mui::TextRenderMethod method);
@@ -0,0 +1,215 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include <psapi.h>
+#include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
+#include "utils/WinUtil.h"
+
+#include "Settings.h"
+#include "GlobalPrefs.h"
+#include "IdleTasks.h"
+
+#include "utils/Log.h"
+
+// the user is considered idle that long after the last keyboard or mouse input
+constexpr DWORD kIdleAfterInputMs = 2000;
+// how often we check whether we're idle again
+constexpr DWORD kIdleCheckMs = 500;
+// the longest pause between steps for keeping idleTasksCpuUsage
+constexpr DWORD kMaxStepPauseMs = 2000;
+
+struct IdleTask {
+    const void* owner = nullptr;
+    std::function<bool()> step;
+    bool canceled = false;
+};
+
+struct IdleTasks {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE hasTasks;
+    CONDITION_VARIABLE stepFinished;
+    // the first one runs next
+    Vec<IdleTask*> tasks;
+    // the task whose step is currently running
+    IdleTask* running = nullptr;
+    HANDLE hThread = nullptr;
+
+    IdleTasks() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&hasTasks);
+        InitializeConditionVariable(&stepFinished);
+    }
+    ~IdleTasks() {
+        DeleteCriticalSection(&access);
+    }
+};
+
+static IdleTasks gIdleTasks;
+
+static int GetIdleTasksCpuUsage() {
+    int percent = gGlobalPrefs ? gGlobalPrefs->idleTasksCpuUsage : 0;
+    return std::min(percent, 100);
+}
+
+// limit based on amount of physical memory, unless set by the user
+static u64 GetIdleTasksMemoryLimit() {
+    constexpr u64 kMB = 1024 * 1024;
+    int sizeMB = gGlobalPrefs ? gGlobalPrefs->idleTasksMemoryLimit : 0;
+    if (sizeMB > 0) {
+        return (u64)sizeMB * kMB;
+    }
+    u64 size = 512 * kMB;
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) {
+        size = ms.ullTotalPhys / 4;
+    }
+    // 32-bit processes are constrained by address space
+    u64 maxSize = IsProcess64() ? 8192 * kMB : 1024 * kMB;
+    return std::clamp(size, (u64)256 * kMB, maxSize);
+}
+
+static bool IsUserIdle() {
+    LASTINPUTINFO lii{};
+    lii.cbSize = sizeof(lii);
+    if (!GetLastInputInfo(&lii)) {
+        return true;
+    }
+    return GetTickCount() - lii.dwTime >= kIdleAfterInputMs;
+}
+
+static bool IsOnBattery() {
+    SYSTEM_POWER_STATUS ps{};
+    if (!GetSystemPowerStatus(&ps)) {
+        return false;
+    }
+    // 1 is battery saver
+    return ps.ACLineStatus == 0 || ps.SystemStatusFlag == 1;
+}
+
+static bool IsOverMemoryLimit() {
+    PROCESS_MEMORY_COUNTERS_EX pmc{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) {
+        return false;
+    }
+    return (u64)pmc.PrivateUsage > GetIdleTasksMemoryLimit();
+}
+
+static bool CanRunIdleTasks() {
+    return GetIdleTasksCpuUsage() > 0 && IsUserIdle() && !IsOnBattery() && !IsOverMemoryLimit();
+}
+
+// returns nullptr if the thread should exit
+static IdleTask* WaitForIdleTask() {
+    IdleTasks& it = gIdleTasks;
+    for (;;) {
+        {
+            ScopedCritSec scope(&it.access);
+            while (it.tasks.IsEmpty()) {
+                // the thread is started again by ScheduleIdleTask()
+                if (!SleepConditionVariableCS(&it.hasTasks, &it.access, 60 * 1000) && it.tasks.IsEmpty()) {
+                    CloseHandle(it.hThread);
+                    it.hThread = nullptr;
+                    return nullptr;
+                }
+            }
+        }
+        if (!CanRunIdleTasks()) {
+            Sleep(kIdleCheckMs);
+            continue;
+        }
+        ScopedCritSec scope(&it.access);
+        if (it.tasks.IsEmpty()) {
+            continue;
+        }
+        it.running = it.tasks[0];
+        return it.running;
+    }
+}
+
+static DWORD WINAPI IdleTasksThread(void*) {
+    SetThreadName("IdleTasksThread");
+    // also lowers the priority of reading the documents
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    IdleTasks& it = gIdleTasks;
+    for (;;) {
+        IdleTask* task = WaitForIdleTask();
+        if (!task) {
+            break;
+        }
+        auto timeStart = TimeGet();
+        bool moreSteps = task->step();
+        double durMs = TimeSinceInMs(timeStart);
+        {
+            ScopedCritSec scope(&it.access);
+            it.running = nullptr;
+            if (!moreSteps || task->canceled) {
+                it.tasks.Remove(task);
+                delete task;
+            }
+            WakeAllConditionVariable(&it.stepFinished);
+        }
+        // a step that took t ms is followed by a pause, so that we're busy
+        // for at most idleTasksCpuUsage percent of the time
+        int percent = std::max(GetIdleTasksCpuUsage(), 1);
+        double pauseMs = durMs * (100 - percent) / percent;
+        Sleep((DWORD)std::min(pauseMs, (double)kMaxStepPauseMs));
+    }
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    return 0;
+}
+
+void ScheduleIdleTask(const void* owner, const std::function<bool()>& step) {
+    if (GetIdleTasksCpuUsage() <= 0) {
+        return;
+    }
+    auto task = new IdleTask();
+    task->owner = owner;
+    task->step = step;
+
+    IdleTasks& it = gIdleTasks;
+    ScopedCritSec scope(&it.access);
+    it.tasks.InsertAt(0, task);
+    if (!it.hThread) {
+        it.hThread = CreateThread(nullptr, 0, IdleTasksThread, nullptr, 0, nullptr);
+    }
+    WakeAllConditionVariable(&it.hasTasks);
+}
+
+void RunIdleTasksFirst(const void* owner) {
+    IdleTasks& it = gIdleTasks;
+    ScopedCritSec scope(&it.access);
+    // keep the order of owner's tasks
+    int nMoved = 0;
+    for (int i = 0; i < it.tasks.isize(); i++) {
+        IdleTask* task = it.tasks[i];
+        if (task->owner == owner) {
+            it.tasks.RemoveAt(i);
+            it.tasks.InsertAt(nMoved++, task);
+        }
+    }
+}
+
+void CancelIdleTasks(const void* owner) {
+    IdleTasks& it = gIdleTasks;
+    ScopedCritSec scope(&it.access);
+    for (int i = it.tasks.isize() - 1; i >= 0; i--) {
+        IdleTask* task = it.tasks[i];
+        if (task->owner != owner) {
+            continue;
+        }
+        if (task == it.running) {
+            // removed by the thread once the step finishes
+            task->canceled = true;
+            continue;
+        }
+        it.tasks.RemoveAt(i);
+        delete task;
+    }
+    while (it.running && it.running->owner == owner) {
+        SleepConditionVariableCS(&it.stepFinished, &it.access, INFINITE);
+    }
+}
@@ -0,0 +1,16 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// expensive work that isn't needed right away (e.g. extracting the text of all
+// pages so that searching is fast) is done in small steps on a single background
+// thread while the user isn't interacting with the computer and it isn't running
+// on battery. Steps take up to GlobalPrefs::idleTasksCpuUsage percent of the time
+// and pause while we use more than GlobalPrefs::idleTasksMemoryLimit
+
+// a step returns false when there's nothing left to do. owner identifies
+// the document the task belongs to. New tasks run before older ones
+void ScheduleIdleTask(const void* owner, const std::function<bool()>& step);
+// e.g. for the document in the tab that has just been selected
+void RunIdleTasksFirst(const void* owner);
+// removes the tasks of owner, waits for a step that is currently running
+void CancelIdleTasks(const void* owner);
@@ -97,39 +97,96 @@ char* GetInstallerLogPath() {
     return path::Join(dir, "sumatra-install-log.txt");
 }
 
+struct ExtractFilesData {
+    lzma::SimpleArchive* archive = nullptr;
+    const char* destDir = nullptr;
+    LONG nextIdx = -1;
+    LONG nExtracted = 0;
+    // index of a file that failed to extract, -1 if none
+    LONG failedIdx = -1;
+    bool failedCorrupted = false;
+};
+
+static void ExtractFilesFromQueue(ExtractFilesData* d) {
+    int nFiles = d->archive->filesCount;
+    while (d->failedIdx < 0) {
+        int i = (int)InterlockedIncrement(&d->nextIdx);
+        if (i >= nFiles) {
+            break;
+        }
+        lzma::FileInfo* fi = &d->archive->files[i];
+        char* filePath = path::JoinTemp(d->destDir, fi->name);
+        bool corrupted = false;
+        bool ok = lzma::ExtractFileByIdxToPath(d->archive, i, filePath, nullptr, &corrupted);
+        if (!ok) {
+            if (InterlockedCompareExchange(&d->failedIdx, i, -1) == -1) {
+                d->failedCorrupted = corrupted;
+            }
+            break;
+        }
+        logf("  extracted '%s'\n", filePath);
+        InterlockedIncrement(&d->nExtracted);
+    }
+}
+
+static DWORD WINAPI ExtractFilesThread(void* data) {
+    ExtractFilesFromQueue((ExtractFilesData*)data);
+    DestroyTempAllocator();
+    return 0;
+}
+
+// files are decompressed on several threads, straight to disk. This thread
+// only waits for them and updates the progress (which isn't thread-safe)
 static bool ExtractFiles(lzma::SimpleArchive* archive, const char* destDir) {
     logf("ExtractFiles(): dir '%s'\n", destDir);
-    lzma::FileInfo* fi;
-    u8* uncompressed;
-
     int nFiles = archive->filesCount;
 
-    for (int i = 0; i < nFiles; i++) {
-        fi = &archive->files[i];
-        uncompressed = lzma::GetFileDataByIdx(archive, i, nullptr);
-
-        if (!uncompressed) {
-            NotifyFailed(
-                _TRA("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!"));
-            return false;
+    ExtractFilesData data;
+    data.archive = archive;
+    data.destDir = destDir;
+    int nThreads = std::min(nFiles, std::min(GetPhysicalProcessorCount(), MAXIMUM_WAIT_OBJECTS));
+    Vec<HANDLE> threads;
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, ExtractFilesThread, &data, 0, nullptr);
+        if (h) {
+            threads.Append(h);
         }
-        char* filePath = path::JoinTemp(destDir, fi->name);
-
-        ByteSlice d = {uncompressed, fi->uncompressedSize};
-        bool ok = file::WriteFile(filePath, d);
-        free(uncompressed);
+    }
+    if (threads.IsEmpty()) {
+        ExtractFilesFromQueue(&data);
+    }
 
-        if (!ok) {
-            char* msg = str::Format(_TRA("Couldn't write %s to disk"), filePath);
-            NotifyFailed(msg);
-            str::Free(msg);
-            return false;
+    int nProgress = 0;
+    auto updateProgress = [&data, &nProgress] {
+        for (; nProgress < (int)data.nExtracted; nProgress++) {
+            ProgressStep();
         }
-        logf("  extracted '%s'\n", filePath);
-        ProgressStep();
+    };
+    while (threads.size() > 0) {
+        DWORD res = WaitForMultipleObjects((DWORD)threads.size(), threads.LendData(), TRUE, 100);
+        updateProgress();
+        if (res != WAIT_TIMEOUT) {
+            break;
+        }
+    }
+    updateProgress();
+    for (HANDLE h : threads) {
+        CloseHandle(h);
     }
 
-    return true;
+    if (data.failedIdx < 0) {
+        return true;
+    }
+    if (data.failedCorrupted) {
+        NotifyFailed(
+            _TRA("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!"));
+        return false;
+    }
+    char* filePath = path::JoinTemp(destDir, archive->files[data.failedIdx].name);
+    char* msg = str::Format(_TRA("Couldn't write %s to disk"), filePath);
+    NotifyFailed(msg);
+    str::Free(msg);
+    return false;
 }
 
 static bool CopySelfToDir(const char* destDir) {
@@ -396,6 +453,7 @@ static void OnButtonInstall() {
     needsElevation |= (gWnd->prevInstall.typ == PreviousInstallationType::Machine);
     if (needsElevation && !IsProcessRunningElevated()) {
         RestartElevatedForAllUsers();
+        FlushLogging();
         ::ExitProcess(0);
     }
     StartInstallation(gWnd);
@@ -1097,6 +1155,7 @@ int RunInstaller() {
         if (gCli->allUsers && !IsProcessRunningElevated()) {
             log("allUsers but not elevated: re-starting as elevated\n");
             RestartElevatedForAllUsers();
+            FlushLogging();
             ::ExitProcess(0);
         }
         gInstallStarted = true;
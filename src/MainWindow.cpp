@@ -114,6 +114,24 @@ void CreateMovePatternLazy(MainWindow* win) {
     CrashIf(!win->brMovePattern);
 }
 
+CanvasGdiObjects::~CanvasGdiObjects() {
+    if (bmpDC) {
+        DeleteDC(bmpDC);
+    }
+    if (font) {
+        DeleteObject(font);
+    }
+    DeleteBrushes();
+}
+
+void CanvasGdiObjects::DeleteBrushes() {
+    for (HBRUSH brush : brushes) {
+        DeleteObject(brush);
+    }
+    brushes.Reset();
+    brushColors.Reset();
+}
+
 MainWindow::~MainWindow() {
     FinishStressTest(this);
 
@@ -257,6 +275,7 @@ void MainWindow::UpdateCanvasSize() {
     // about the change of the canvas size
     delete buffer;
     buffer = new DoubleBuffer(hwndCanvas, canvasRc);
+    bufferDm = nullptr;
 
     if (IsDocLoaded()) {
         // the display model needs to know the full size (including scroll bars)
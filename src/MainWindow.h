@@ -66,6 +66,22 @@ struct StaticLinkInfo {
     ~StaticLinkInfo();
 };
 
+// GDI objects used for painting the canvas, kept instead of being
+// created for each WM_PAINT (see Canvas.cpp)
+struct CanvasGdiObjects {
+    // for blitting bitmaps (e.g. a tab's snapshot)
+    HDC bmpDC = nullptr;
+    HFONT font = nullptr;
+    Vec<COLORREF> brushColors;
+    Vec<HBRUSH> brushes;
+
+    CanvasGdiObjects() = default;
+    CanvasGdiObjects(const CanvasGdiObjects&) = delete;
+    CanvasGdiObjects& operator=(const CanvasGdiObjects&) = delete;
+    ~CanvasGdiObjects();
+    void DeleteBrushes();
+};
+
 /* Describes information related to one window with (optional) a document
    on the screen */
 struct MainWindow {
@@ -119,6 +135,9 @@ struct MainWindow {
     bool tocVisible = false;
     // set to temporarily disable UpdateTocSelection
     bool tocKeepSelection = false;
+    // all ToC items sorted by page number (in tree order for the same page)
+    // so that UpdateTocSelection doesn't have to visit the whole tree
+    Vec<TocItem*> tocItemsByPage;
 
     // state related to favorites
     HWND hwndFavBox = nullptr;
@@ -149,6 +168,15 @@ struct MainWindow {
     bool isMenuHidden = false; // not persisted at shutdown
 
     DoubleBuffer* buffer = nullptr;
+    // what buffer shows, so that scrolling can move its pixels instead
+    // of painting everything again (see RepaintScrolledAsync)
+    DisplayModel* bufferDm = nullptr;
+    Rect bufferViewPort;
+    float bufferZoom = 0;
+    int bufferRotation = 0;
+    // false if buffer shows something that doesn't move with the
+    // document (e.g. a gradient background or a "rendering..." message)
+    bool bufferCanScroll = false;
 
     MouseAction mouseAction = MouseAction::Idle;
     bool dragRightClick = false; // if true, drag was initiated with right mouse click
@@ -189,6 +217,14 @@ struct MainWindow {
 
     int wheelAccumDelta = 0;
     UINT_PTR delayedRepaintTimer = 0;
+    // repaints are limited to one per display refresh, requests in between are coalesced
+    bool pacedRepaintPending = false;
+    LARGE_INTEGER lastPaintTime{};
+    // frame statistics shown with gShowFrameRate, reset every second
+    LARGE_INTEGER frameStatsStart{};
+    int nRepaintRequests = 0;
+    int nPaints = 0;
+    double paintMsTotal = 0;
 
     HANDLE printThread = nullptr;
     bool printCanceled = false;
@@ -196,6 +232,10 @@ struct MainWindow {
     HANDLE findThread = nullptr;
     bool findCanceled = false;
 
+    // copying a text selection that spans many pages
+    HANDLE copyTextThread = nullptr;
+    bool copyTextCanceled = false;
+
     ILinkHandler* linkHandler = nullptr;
     IPageElement* linkOnLastButtonDown = nullptr;
     AutoFreeStr urlOnLastButtonDown;
@@ -204,6 +244,7 @@ struct MainWindow {
     Point annotationBeingMovedOffset;
     HBITMAP bmpMovePattern = nullptr;
     HBRUSH brMovePattern = nullptr;
+    CanvasGdiObjects canvasGdi;
 
     DocControllerCallback* cbHandler = nullptr;
 
@@ -249,6 +290,7 @@ struct MainWindow {
 
 void UpdateTreeCtrlColors(MainWindow*);
 void RepaintAsync(MainWindow*, int delay);
+void RepaintScrolledAsync(MainWindow*);
 void ClearFindBox(MainWindow*);
 void CreateMovePatternLazy(MainWindow*);
 void ClearMouseState(MainWindow*);
@@ -11,6 +11,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "mui/Mui.h"
 #include "utils/WinUtil.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
@@ -34,6 +35,9 @@
 #include "ExternalViewers.h"
 #include "Favorites.h"
 #include "FileThumbnails.h"
+#include "FileTextCache.h"
+#include "TileCache.h"
+#include "ResourceStats.h"
 #include "Selection.h"
 #include "SumatraAbout.h"
 #include "Translations.h"
@@ -288,6 +292,10 @@ static MenuDef menuDefGoTo[] = {
         _TRN("Pa&ge..."),
         CmdGoToPage,
     },
+    {
+        _TRN("Page O&verview"),
+        CmdShowPageOverview,
+    },
     {
         kMenuSeparator,
         0,
@@ -308,6 +316,10 @@ static MenuDef menuDefGoTo[] = {
         _TRN("Fin&d..."),
         CmdFindFirst,
     },
+    {
+        _TRN("Find &All"),
+        CmdFindAll,
+    },
     {
         nullptr,
         0,
@@ -481,6 +493,14 @@ static MenuDef menuDefDebug[] = {
         "Highlight links",
         CmdDebugShowLinks,
     },
+    {
+        "Show store stats",
+        CmdDebugShowStoreStats,
+    },
+    {
+        "Show resource stats",
+        CmdDebugShowResourceStats,
+    },
     {
         "Download symbols",
         CmdDebugDownloadSymbols,
@@ -493,6 +513,14 @@ static MenuDef menuDefDebug[] = {
         "Show notification",
         CmdDebugShowNotif,
     },
+    {
+        "Record time trace",
+        CmdDebugToggleTimeTrace,
+    },
+    {
+        "Save time trace",
+        CmdDebugSaveTimeTrace,
+    },
     {
         nullptr,
         0,
@@ -790,7 +818,9 @@ static UINT_PTR disableIfNoDocument[] = {
     CmdNavigateBack,
     CmdNavigateForward,
     CmdGoToPage,
+    CmdShowPageOverview,
     CmdFindFirst,
+    CmdFindAll,
     CmdSaveAs,
     CmdCreateShortcutToFile,
     CmdSendByEmail,
@@ -936,6 +966,7 @@ UINT_PTR removeIfAnnotsNotSupported[] = {
 };
 
 UINT_PTR removeIfChm[] = {
+    CmdShowPageOverview,
     CmdSinglePageView,
     CmdFacingView,
     CmdBookView,
@@ -1504,6 +1535,7 @@ static void MenuUpdateStateForWindow(MainWindow* win) {
     EngineBase* engine = dm ? dm->GetEngine() : nullptr;
     if (engine) {
         MenuSetEnabled(win->menu, CmdFindFirst, !engine->IsImageCollection());
+        MenuSetEnabled(win->menu, CmdFindAll, !engine->IsImageCollection());
     }
 
     if (win->IsDocLoaded() && !fileExists) {
@@ -1516,6 +1548,9 @@ static void MenuUpdateStateForWindow(MainWindow* win) {
 #endif
 
     MenuSetChecked(win->menu, CmdDebugShowLinks, gDebugShowLinks);
+    MenuSetChecked(win->menu, CmdDebugShowStoreStats, gDebugShowStoreStats);
+    MenuSetChecked(win->menu, CmdDebugShowResourceStats, gDebugShowResourceStats);
+    MenuSetChecked(win->menu, CmdDebugToggleTimeTrace, gTimeTraceEnabled);
 }
 
 void OnAboutContextMenu(MainWindow* win, int x, int y) {
@@ -1563,6 +1598,8 @@ void OnAboutContextMenu(MainWindow* win, int x, int y) {
             // just hide documents with favorites
             gFileHistory.MarkFileInexistent(fs->filePath, true);
         } else {
+            RemoveTextCache(fs->filePath, fs->fingerprint);
+            RemoveTileCache(fs->filePath, fs->fingerprint);
             gFileHistory.Remove(fs);
             DeleteDisplayState(fs);
         }
@@ -2058,6 +2095,7 @@ HMENU BuildMenu(MainWindow* win) {
     FillBuildMenuCtx(tab, &buildCtx, Point{0, 0});
 
     HMENU mainMenu = BuildMenuFromMenuDef(menuDefMenubar, CreateMenu(), &buildCtx);
+    InvalidateFavMenu();
 
 #if defined(ENABLE_THEME) && 0
     // Build the themes sub-menu of the settings menu
@@ -2083,7 +2121,7 @@ void UpdateAppMenu(MainWindow* win, HMENU m) {
     UINT_PTR id = (UINT_PTR)GetMenuItemID(m, 0);
     if (id == menuDefFile[0].idOrSubmenu) {
         RebuildFileMenu(win->CurrentTab(), m);
-    } else if (id == menuDefFavorites[0].idOrSubmenu) {
+    } else if (id == menuDefFavorites[0].idOrSubmenu && !IsFavMenuUpToDate(win, m)) {
         MenuEmpty(m);
         BuildMenuFromMenuDef(menuDefFavorites, m, nullptr);
         RebuildFavMenu(win, m);
@@ -2,7 +2,6 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
-#include "utils/BitReader.h"
 #include "utils/ByteOrderDecoder.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
@@ -11,6 +10,7 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
+#include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -191,10 +191,33 @@ static_assert(kCdicHeaderLen == sizeof(CdicHeader), "wrong size of CdicHeader st
 
 #define kCdicsMax 32
 
+// codes up to this length are decoded with a single lookup
+#define kHuffFastBits 12
+// don't memoize entry expansions for absurdly big dictionaries
+#define kHuffMaxMemoEntries (1 << 20)
+
+// what a thread decompressing HuffDic records modifies
+struct HuffDicState {
+    Vec<u32> recursionGuard;
+
+    // expansions of dictionary entries that refer to other entries, as they
+    // tend to be used many times. memoStart[code] is the offset in memoData + 1
+    // (0 if not expanded yet)
+    Vec<u32> memoStart;
+    Vec<u32> memoLen;
+    str::Str memoData;
+};
+
 class HuffDicDecompressor {
     u32 cacheTable[kCacheItemCount]{};
     u32 baseTable[kBaseTableItemCount]{};
 
+    // indexed by the top kHuffFastBits of the bit stream. For codes not longer
+    // than that (and all codes fully described by cacheTable) code length and
+    // the value the code is subtracted from. fastCodeLen is 0 for longer codes
+    u8 fastCodeLen[1 << kHuffFastBits]{};
+    u32 fastMaxCode[1 << kHuffFastBits]{};
+
     size_t dictsCount = 0;
     // owned by the creator (in our case: by the PdbReader)
     u8* dicts[kCdicsMax]{};
@@ -202,26 +225,33 @@ class HuffDicDecompressor {
 
     u32 codeLength = 0;
 
-    Vec<u32> recursionGuard;
-
   public:
     HuffDicDecompressor();
 
     bool SetHuffData(u8* huffData, size_t huffDataLen);
     bool AddCdicData(u8* cdicData, u32 cdicDataLen);
-    bool Decompress(u8* src, size_t srcSize, str::Str& dst);
-    bool DecodeOne(u32 code, str::Str& dst);
+    // once set up, can be used from several threads at once (each with its own state)
+    bool Decompress(u8* src, size_t srcSize, str::Str& dst, HuffDicState& state) const;
+    bool DecodeOne(u32 code, str::Str& dst, HuffDicState& state) const;
+
+  private:
+    void BuildFastTable();
 };
 
 HuffDicDecompressor::HuffDicDecompressor() {
 }
 
-bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
+bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst, HuffDicState& state) const {
     u16 dict = (u16)(code >> codeLength);
     if (dict >= dictsCount) {
         logf("invalid dict value\n");
         return false;
     }
+    u32 memoIdx = code;
+    if (memoIdx < state.memoStart.size() && state.memoStart[memoIdx] != 0) {
+        dst.Append(state.memoData.Get() + state.memoStart[memoIdx] - 1, state.memoLen[memoIdx]);
+        return true;
+    }
     code &= ((1 << (codeLength)) - 1);
     u16 offset = UInt16BE(dicts[dict] + code * 2);
 
@@ -237,15 +267,29 @@ bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
     }
 
     if (!(symLen & 0x8000)) {
-        if (recursionGuard.Contains(code)) {
+        if (state.recursionGuard.Contains(code)) {
             logf("infinite recursion\n");
             return false;
         }
-        recursionGuard.Append(code);
-        if (!Decompress(p, symLen, dst)) {
+        state.recursionGuard.Append(code);
+        size_t start = dst.size();
+        if (!Decompress(p, symLen, dst, state)) {
             return false;
         }
-        recursionGuard.Pop();
+        state.recursionGuard.Pop();
+
+        if (state.memoStart.size() == 0) {
+            size_t nEntries = dictsCount << codeLength;
+            if (nEntries <= kHuffMaxMemoEntries) {
+                state.memoStart.AppendBlanks(nEntries);
+                state.memoLen.AppendBlanks(nEntries);
+            }
+        }
+        if (memoIdx < state.memoStart.size()) {
+            state.memoStart[memoIdx] = (u32)state.memoData.size() + 1;
+            state.memoLen[memoIdx] = (u32)(dst.size() - start);
+            state.memoData.Append(dst.Get() + start, dst.size() - start);
+        }
     } else {
         symLen &= 0x7fff;
         if (symLen > 127) {
@@ -257,59 +301,106 @@ bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
     return true;
 }
 
-bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst) {
-    u32 bitsConsumed = 0;
-    u32 bits = 0;
+void HuffDicDecompressor::BuildFastTable() {
+    for (u32 prefix = 0; prefix < (1 << kHuffFastBits); prefix++) {
+        u32 bits = prefix << (32 - kHuffFastBits);
+        u32 v = cacheTable[bits >> 24];
+        u32 codeLen = v & 0x1f;
+        fastCodeLen[prefix] = 0;
+        if (!codeLen) {
+            // let the slow path report the corruption
+            continue;
+        }
+        if ((v & 0x80) != 0) {
+            fastCodeLen[prefix] = (u8)codeLen;
+            fastMaxCode[prefix] = v >> 8;
+            continue;
+        }
+        // same search as in Decompress() but only as long as
+        // the prefix bits are enough to decide
+        codeLen -= 1;
+        for (;;) {
+            codeLen++;
+            if (codeLen > kHuffFastBits) {
+                break;
+            }
+            if (baseTable[codeLen * 2 - 2] <= (bits >> (32 - codeLen))) {
+                fastCodeLen[prefix] = (u8)codeLen;
+                fastMaxCode[prefix] = baseTable[codeLen * 2 - 1];
+                break;
+            }
+        }
+    }
+}
 
-    BitReader br(src, srcSize);
+bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst, HuffDicState& state) const {
+    // not yet consumed bits of src, starting at the most significant bit
+    u64 bitBuf = 0;
+    u32 bitsInBuf = 0;
+    size_t srcPos = 0;
+    size_t bitsLeft = srcSize * 8;
+    u32 bits = 0;
 
     for (;;) {
-        if (bitsConsumed > br.BitsLeft()) {
-            logf("not enough data\n");
-            return false;
-        }
-        br.Eat(bitsConsumed);
-        if (0 == br.BitsLeft()) {
+        if (0 == bitsLeft) {
             break;
         }
+        // bits past the end of src are 0
+        while (bitsInBuf <= 56) {
+            u64 b = srcPos < srcSize ? src[srcPos] : 0;
+            bitBuf |= b << (56 - bitsInBuf);
+            bitsInBuf += 8;
+            srcPos++;
+        }
 
-        bits = br.Peek(32);
-        if (br.BitsLeft() < 8 && 0 == bits) {
+        bits = (u32)(bitBuf >> 32);
+        if (bitsLeft < 8 && 0 == bits) {
             break;
         }
-        u32 v = cacheTable[bits >> 24];
-        u32 codeLen = v & 0x1f;
-        if (!codeLen) {
-            logf("corrupted table, zero code len\n");
-            return false;
-        }
-        bool isTerminal = (v & 0x80) != 0;
 
         u32 code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
+        u32 codeLen = fastCodeLen[bits >> (32 - kHuffFastBits)];
+        if (codeLen) {
+            code = fastMaxCode[bits >> (32 - kHuffFastBits)] - (bits >> (32 - codeLen));
         } else {
-            u32 baseVal;
-            codeLen -= 1;
-            do {
-                codeLen++;
-                if (codeLen > 32) {
-                    logf("code len > 32 bits\n");
-                    return false;
-                }
-                baseVal = baseTable[codeLen * 2 - 2];
-                code = (bits >> (32 - codeLen));
-            } while (baseVal > code);
-            code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+            u32 v = cacheTable[bits >> 24];
+            codeLen = v & 0x1f;
+            if (!codeLen) {
+                logf("corrupted table, zero code len\n");
+                return false;
+            }
+            bool isTerminal = (v & 0x80) != 0;
+            if (isTerminal) {
+                code = (v >> 8) - (bits >> (32 - codeLen));
+            } else {
+                u32 baseVal;
+                codeLen -= 1;
+                do {
+                    codeLen++;
+                    if (codeLen > 32) {
+                        logf("code len > 32 bits\n");
+                        return false;
+                    }
+                    baseVal = baseTable[codeLen * 2 - 2];
+                    code = (bits >> (32 - codeLen));
+                } while (baseVal > code);
+                code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+            }
         }
 
-        if (!DecodeOne(code, dst)) {
+        if (!DecodeOne(code, dst, state)) {
+            return false;
+        }
+        if (codeLen > bitsLeft) {
+            logf("not enough data\n");
             return false;
         }
-        bitsConsumed = codeLen;
+        bitBuf <<= codeLen;
+        bitsInBuf -= codeLen;
+        bitsLeft -= codeLen;
     }
 
-    if (br.BitsLeft() > 0 && 0 != bits) {
+    if (bitsLeft > 0 && 0 != bits) {
         logf("compressed data left\n");
     }
     return true;
@@ -360,6 +451,7 @@ bool HuffDicDecompressor::SetHuffData(u8* huffData, size_t huffDataLen) {
         baseTable[i] = d.UInt32();
     }
     CrashIf(d.Offset() != kHuffRecordMinLen);
+    BuildFastTable();
     return true;
 }
 
@@ -464,13 +556,16 @@ static bool IsValidCompression(int comprType) {
 MobiDoc::MobiDoc(const char* filePath) {
     docTocIndex = kInvalidSize;
     fileName = str::Dup(filePath);
+    InitializeCriticalSection(&decodeAccess);
 }
 
 MobiDoc::~MobiDoc() {
     free(fileName);
     free(images);
     delete huffDic;
-    delete doc;
+    DeleteVecMembers(huffStates);
+    free(html);
+    DeleteCriticalSection(&decodeAccess);
     delete pdbReader;
     for (size_t i = 0; i < props.size(); i++) {
         free(props.at(i).value);
@@ -523,6 +618,7 @@ bool MobiDoc::ParseHeader() {
         docRecCount--;
     }
     docUncompressedSize = palmDocHdr.uncompressedDocSize;
+    docRecMaxSize = palmDocHdr.maxRecSize;
 
     if (kPalmDocHeaderLen == recSize) {
         // TODO: calculate imageFirstRec / imagesCount
@@ -816,7 +912,7 @@ static size_t GetRealRecordSize(const u8* recData, size_t recLen, size_t trailer
 
 // Load a given record of a document into strOut, uncompressing if necessary.
 // Returns false if error.
-bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
+bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut, HuffDicState* state) {
     auto rec = pdbReader->GetRecord(recNo);
     u8* recData = rec.data();
     if (nullptr == recData) {
@@ -839,7 +935,7 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
         return ok;
     }
     if (COMPRESSION_HUFF == compressionType && huffDic) {
-        bool ok = huffDic->Decompress((u8*)recData, recSize, strOut);
+        bool ok = huffDic->Decompress((u8*)recData, recSize, strOut, *state);
         if (!ok) {
             logf("HuffDic decompression failed\n");
         }
@@ -857,52 +953,215 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
     return false;
 }
 
+// replace unexpected \0 with spaces
+// cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
+static void ReplaceZeros(str::Str& s) {
+    char* curr = s.Get();
+    char* end = curr + s.size();
+    while ((curr = (char*)memchr(curr, '\0', end - curr)) != nullptr) {
+        *curr = ' ';
+    }
+}
+
+// must be called with decodeAccess held
+void MobiDoc::AppendHtml(const char* s, size_t len) {
+    if (len > htmlCap - htmlLen) {
+        // only happens for broken documents where records decompress
+        // to more than the maximum record size
+        logf("MobiDoc: html doesn't fit into %d bytes\n", (int)htmlCap);
+        len = htmlCap - htmlLen;
+    }
+    memcpy(html + htmlLen, s, len);
+    htmlLen += len;
+    html[htmlLen] = 0;
+}
+
+// decodes a single text record into out, converted to UTF-8 if possible
+// can be called from several threads at once (with different states)
+bool MobiDoc::DecodeDocRecord(size_t recNo, str::Str& out, HuffDicState* state) {
+    // keep whatever could be decoded
+    bool ok = LoadDocRecordIntoBuffer(recNo, out, state);
+    ReplaceZeros(out);
+    if (convertPerRecord && textEncoding != CP_UTF8 && out.size() > 0) {
+        char* recUtf8 = strconv::ToMultiByte(out.Get(), textEncoding, CP_UTF8);
+        if (recUtf8) {
+            out.Reset();
+            out.AppendAndFree(recUtf8);
+        }
+    }
+    return ok;
+}
+
+constexpr int kMaxMobiDecodeThreads = 8;
+// it's not worth starting a thread for fewer records
+constexpr size_t kMinRecordsPerDecodeThread = 16;
+
+struct MobiDecodeBand {
+    MobiDoc* doc = nullptr;
+    size_t firstRecNo = 0;
+    size_t nRecs = 0;
+    int bandNo = 0;
+    int nBands = 1;
+    str::Str* recs = nullptr;
+    bool* failed = nullptr;
+};
+
+// records are interleaved between bands so that they take about as long
+void MobiDoc::DecodeBand(MobiDecodeBand* band) {
+    HuffDicState* state = huffStates[band->bandNo];
+    for (size_t i = band->bandNo; i < band->nRecs; i += band->nBands) {
+        band->failed[i] = !DecodeDocRecord(band->firstRecNo + i, band->recs[i], state);
+    }
+}
+
+DWORD WINAPI MobiDoc::DecodeBandThread(LPVOID data) {
+    MobiDecodeBand* band = (MobiDecodeBand*)data;
+    band->doc->DecodeBand(band);
+    return 0;
+}
+
+// decodes records firstRecNo ... firstRecNo + nRecs - 1 into recs, in parallel if there are enough
+// must be called with decodeAccess held (or before the document is shared with other threads)
+void MobiDoc::DecodeDocRecords(size_t firstRecNo, size_t nRecs, str::Str* recs, bool* failed) {
+    int maxBands = std::clamp(GetPhysicalProcessorCount(), 1, kMaxMobiDecodeThreads);
+    int nBands = (int)std::clamp(nRecs / kMinRecordsPerDecodeThread, (size_t)1, (size_t)maxBands);
+    while (huffStates.isize() < nBands) {
+        huffStates.Append(new HuffDicState());
+    }
+
+    MobiDecodeBand bands[kMaxMobiDecodeThreads];
+    HANDLE threads[kMaxMobiDecodeThreads] = {};
+    int nThreads = 0;
+    for (int i = 0; i < nBands; i++) {
+        MobiDecodeBand& b = bands[i];
+        b.doc = this;
+        b.firstRecNo = firstRecNo;
+        b.nRecs = nRecs;
+        b.bandNo = i;
+        b.nBands = nBands;
+        b.recs = recs;
+        b.failed = failed;
+    }
+    // the first band is done on this thread
+    for (int i = 1; i < nBands; i++) {
+        HANDLE h = CreateThread(nullptr, 0, DecodeBandThread, &bands[i], 0, nullptr);
+        if (!h) {
+            DecodeBand(&bands[i]);
+            continue;
+        }
+        threads[nThreads++] = h;
+    }
+    DecodeBand(&bands[0]);
+    if (nThreads > 0) {
+        WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
 bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
     this->pdbReader = pdbReader;
     if (!ParseHeader()) {
         return false;
     }
 
-    CrashIf(doc != nullptr);
-    doc = new str::Str(docUncompressedSize);
-    size_t nFailed = 0;
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc)) {
-            nFailed++;
+    CrashIf(html != nullptr);
+    if (textEncoding != CP_UTF8) {
+        CPINFO cpInfo;
+        convertPerRecord = GetCPInfo(textEncoding, &cpInfo) && cpInfo.MaxCharSize == 1;
+    }
+
+    if (!convertPerRecord) {
+        // a character might span two records, so the whole document
+        // has to be decoded before it can be converted
+        str::Str doc(docUncompressedSize);
+        str::Str* recs = new str::Str[docRecCount];
+        bool* failed = AllocArray<bool>(docRecCount);
+        if (!failed) {
+            delete[] recs;
+            return false;
+        }
+        DecodeDocRecords(1, docRecCount, recs, failed);
+        for (size_t i = 0; i < docRecCount; i++) {
+            doc.Append(recs[i].Get(), recs[i].size());
+            if (failed[i]) {
+                failedRecCount++;
+            }
         }
+        delete[] recs;
+        free(failed);
+        decodedRecCount = docRecCount;
+        char* docUtf8 = strconv::ToMultiByte(doc.Get(), textEncoding, CP_UTF8);
+        if (docUtf8) {
+            htmlLen = str::Len(docUtf8);
+            html = docUtf8;
+        } else {
+            htmlLen = doc.size();
+            html = doc.StealData();
+        }
+        htmlCap = htmlLen;
+    } else {
+        // each record decompresses to at most docRecMaxSize bytes
+        // and a single-byte character takes at most 3 bytes in UTF-8
+        size_t recMaxSize = std::max(docRecMaxSize, (size_t)4096);
+        htmlCap = std::max(docUncompressedSize, docRecCount * recMaxSize);
+        if (textEncoding != CP_UTF8) {
+            htmlCap *= 3;
+        }
+        html = AllocArray<char>(htmlCap + 1);
+        if (!html) {
+            return false;
+        }
+        // the rest is decoded when MobiFormatter gets to it
+        DecodeHtmlData(kMobiDecodeAhead);
     }
 
     // TODO: this is a heuristic for https://github.com/sumatrapdfreader/sumatrapdf/issues/1314
     // It has 29 records that fail to decompress because infinite recursion
     // is detected.
     // Figure out if this is a bug in my decoding.
-    if (nFailed > docRecCount / 2) {
+    // Note: when decoding on demand, only the records decoded so far are considered
+    if (failedRecCount > decodedRecCount / 2) {
         return false;
     }
+    return true;
+}
 
-    // replace unexpected \0 with spaces
-    // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
-    char* s = doc->Get();
-    char* end = s + doc->size();
-    while ((s = (char*)memchr(s, '\0', end - s)) != nullptr) {
-        *s = ' ';
-    }
-    if (textEncoding != CP_UTF8) {
-        char* docUtf8 = strconv::ToMultiByte(doc->Get(), textEncoding, CP_UTF8);
-        if (docUtf8) {
-            doc->Reset();
-            doc->AppendAndFree(docUtf8);
+// upper limit of records decoded at once (to limit temporary memory use)
+constexpr size_t kMaxRecordsPerDecodeBatch = 1024;
+
+ByteSlice MobiDoc::DecodeHtmlData(size_t minLen) {
+    ScopedCritSec scope(&decodeAccess);
+    size_t recMaxSize = std::max(docRecMaxSize, (size_t)4096);
+    while (htmlLen < minLen && decodedRecCount < docRecCount) {
+        // records are usually (close to) docRecMaxSize bytes
+        size_t nRecs = (minLen - htmlLen) / recMaxSize + 1;
+        nRecs = std::min(nRecs, docRecCount - decodedRecCount);
+        nRecs = std::min(nRecs, kMaxRecordsPerDecodeBatch);
+        str::Str* recs = new str::Str[nRecs];
+        bool* failed = AllocArray<bool>(nRecs);
+        if (!failed) {
+            delete[] recs;
+            break;
+        }
+        DecodeDocRecords(decodedRecCount + 1, nRecs, recs, failed);
+        for (size_t i = 0; i < nRecs; i++) {
+            AppendHtml(recs[i].Get(), recs[i].size());
+            if (failed[i]) {
+                failedRecCount++;
+            }
         }
+        delete[] recs;
+        free(failed);
+        decodedRecCount += nRecs;
     }
-    return true;
+    return {(u8*)html, htmlLen};
 }
 
 // don't free the result
-ByteSlice MobiDoc::GetHtmlData() const {
-    if (doc) {
-        return doc->AsByteSlice();
-    }
-    return {};
+ByteSlice MobiDoc::GetHtmlData() {
+    return DecodeHtmlData((size_t)-1);
 }
 
 char* MobiDoc::GetProperty(DocumentProperty prop) {
@@ -915,13 +1174,14 @@ char* MobiDoc::GetProperty(DocumentProperty prop) {
 }
 
 bool MobiDoc::HasToc() {
+    ByteSlice doc = GetHtmlData();
     if (docTocIndex != kInvalidSize) {
-        return docTocIndex < doc->size();
+        return docTocIndex < doc.size();
     }
-    docTocIndex = doc->size(); // no ToC
+    docTocIndex = doc.size(); // no ToC
 
     // search for <reference type=toc filepos=\d+/>
-    HtmlPullParser parser(doc->AsByteSlice());
+    HtmlPullParser parser(doc);
     HtmlToken* tok;
     while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
         if (!tok->IsStartTag() && !tok->IsEmptyElementEndTag() || !tok->NameIs("reference")) {
@@ -940,7 +1200,7 @@ bool MobiDoc::HasToc() {
         unsigned int pos;
         if (str::Parse(val, L"%u%$", &pos)) {
             docTocIndex = pos;
-            return docTocIndex < doc->size();
+            return docTocIndex < doc.size();
         }
     }
     return false;
@@ -957,7 +1217,8 @@ bool MobiDoc::ParseToc(EbookTocVisitor* visitor) {
 
     // there doesn't seem to be a standard for Mobi ToCs, so we try to
     // determine the author's intentions by looking at commonly used tags
-    HtmlPullParser parser(doc->Get() + docTocIndex, doc->size() - docTocIndex);
+    ByteSlice doc = GetHtmlData();
+    HtmlPullParser parser((const char*)doc.data() + docTocIndex, doc.size() - docTocIndex);
     HtmlToken* tok;
     while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
         if (itemLink && tok->IsText()) {
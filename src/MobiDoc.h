@@ -3,6 +3,11 @@
 
 class HuffDicDecompressor;
 class PdbReader;
+struct HuffDicState;
+struct MobiDecodeBand;
+
+// how much html MobiFormatter keeps decoded ahead of what it's laying out
+constexpr size_t kMobiDecodeAhead = 256 * 1024;
 
 class MobiDoc {
     char* fileName = nullptr;
@@ -11,6 +16,7 @@ class MobiDoc {
 
     PdbDocType docType = PdbDocType::Unknown;
     size_t docRecCount = 0;
+    size_t docRecMaxSize = 0;
     int compressionType = 0;
     size_t docUncompressedSize = 0;
     int textEncoding = CP_UTF8;
@@ -24,6 +30,20 @@ class MobiDoc {
     ByteSlice* images = nullptr;
 
     HuffDicDecompressor* huffDic = nullptr;
+    // one for each thread decoding records
+    Vec<HuffDicState*> huffStates;
+
+    // html of the first decodedRecCount text records. Text records are only
+    // decoded when needed but the buffer is allocated upfront for the whole
+    // document because laid out pages point into it
+    char* html = nullptr;
+    size_t htmlLen = 0;
+    size_t htmlCap = 0;
+    size_t decodedRecCount = 0;
+    size_t failedRecCount = 0;
+    // records are converted to UTF-8 one by one (false for multi-byte code pages)
+    bool convertPerRecord = true;
+    CRITICAL_SECTION decodeAccess;
 
     struct Metadata {
         DocumentProperty prop;
@@ -34,20 +54,26 @@ class MobiDoc {
     explicit MobiDoc(const char* filePath);
 
     bool ParseHeader();
-    bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut);
+    bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut, HuffDicState* state);
+    bool DecodeDocRecord(size_t recNo, str::Str& out, HuffDicState* state);
+    void DecodeDocRecords(size_t firstRecNo, size_t nRecs, str::Str* recs, bool* failed);
+    void DecodeBand(MobiDecodeBand* band);
+    static DWORD WINAPI DecodeBandThread(LPVOID data);
+    void AppendHtml(const char* s, size_t len);
     void LoadImages();
     bool LoadImage(size_t imageNo);
     bool LoadForPdbReader(PdbReader* pdbReader);
     bool DecodeExthHeader(const u8* data, size_t dataLen);
 
   public:
-    str::Str* doc = nullptr;
-
     size_t imagesCount = 0;
 
     ~MobiDoc();
 
-    ByteSlice GetHtmlData() const;
+    // decodes the whole document
+    ByteSlice GetHtmlData();
+    // decodes (at least) the first minLen bytes of the document, can be called from any thread
+    ByteSlice DecodeHtmlData(size_t minLen);
     ByteSlice* GetCoverImage();
     ByteSlice* GetImage(size_t imgRecIndex) const;
     const char* GetFileName() const {
@@ -0,0 +1,537 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+/* "Page Overview": a scrollable grid with thumbnails of all pages.
+   Only thumbnails of visible pages are rendered, with a lower priority
+   than the pages in the main window, and only a few rows of thumbnails
+   around the visible ones are kept in memory */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/Dpi.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+#include "wingui/WinGui.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "DisplayModel.h"
+#include "RenderCache.h"
+#include "MainWindow.h"
+#include "WindowTab.h"
+#include "SumatraPDF.h"
+#include "SumatraConfig.h"
+#include "Translations.h"
+#include "PageOverview.h"
+
+#include "utils/Log.h"
+
+// size of the box a thumbnail is fitted into (at 96 dpi)
+constexpr int kThumbnailDx = 120;
+constexpr int kThumbnailDy = 160;
+constexpr int kThumbnailPadding = 8;
+constexpr int kOverviewColumns = 3;
+// at most that many thumbnails are queued for rendering at once
+constexpr int kMaxPendingThumbnails = 16;
+// thumbnails further away from the visible ones are freed
+constexpr int kKeepThumbnailRows = 8;
+
+constexpr COLORREF kOverviewBgColor = RGB(0xee, 0xee, 0xee);
+constexpr COLORREF kOverviewTextColor = RGB(0x00, 0x00, 0x00);
+constexpr COLORREF kThumbnailFrameColor = RGB(0xaa, 0xaa, 0xaa);
+constexpr COLORREF kPlaceholderColor = RGB(0xff, 0xff, 0xff);
+constexpr COLORREF kCurrentPageColor = RGB(0x99, 0xc5, 0xf2);
+
+struct OverviewThumbnail {
+    RenderedBitmap* bmp = nullptr;
+    // rotation of the document when bmp was rendered
+    int rotation = 0;
+    bool isPending = false;
+    // rendering failed, don't try again until the thumbnail is freed
+    bool failed = false;
+};
+
+struct PageOverviewWnd : Wnd {
+    ~PageOverviewWnd() override;
+
+    void OnPaint(HDC hdc, PAINTSTRUCT* ps) override;
+    bool OnEraseBkgnd(HDC) override;
+    void OnSize(UINT msg, UINT type, SIZE size) override;
+    void OnClose() override;
+    LRESULT WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) override;
+
+    WindowTab* tab = nullptr;
+    // unique for every window, to recognize thumbnails rendered for a closed one
+    int overviewId = 0;
+    HFONT font = nullptr;
+
+    // indexed by pageNo - 1
+    Vec<OverviewThumbnail> thumbs;
+    int nPending = 0;
+
+    // layout, in pixels
+    int thumbDx = 0;
+    int thumbDy = 0;
+    int padding = 0;
+    int labelDy = 0;
+    int cellDx = 0;
+    int cellDy = 0;
+    int nCols = 1;
+    int nRows = 0;
+    int offsetX = 0;
+    int viewDy = 0;
+    int scrollY = 0;
+
+    void UpdateLayout();
+    void ScrollTo(int y);
+    void ScrollToPage(int pageNo);
+    Rect CellRect(int pageNo) const;
+    Rect ThumbnailRect(int pageNo, float* zoom) const;
+    int PageAt(Point pt) const;
+    void GetVisiblePages(int* first, int* last) const;
+    void RequestVisibleThumbnails();
+    void FreeThumbnailsAwayFrom(int first, int last);
+    void ThumbnailRendered(int pageNo, int rotation, RenderedBitmap* bmp);
+    void GoToPage(int pageNo);
+};
+
+static Vec<PageOverviewWnd*> gPageOverviewWnds;
+static int gNextPageOverviewId = 1;
+
+static bool PageOverviewWndStillValid(PageOverviewWnd* wnd, int overviewId) {
+    return gPageOverviewWnds.Contains(wnd) && wnd->overviewId == overviewId;
+}
+
+struct OverviewThumbnailTask : RenderingCallback {
+    PageOverviewWnd* wnd = nullptr;
+    int overviewId = 0;
+    int pageNo = 0;
+    int rotation = 0;
+
+    OverviewThumbnailTask(PageOverviewWnd* wnd, int pageNo, int rotation)
+        : wnd(wnd), overviewId(wnd->overviewId), pageNo(pageNo), rotation(rotation) {
+    }
+    ~OverviewThumbnailTask() override = default;
+
+    // called on a render thread (or with nullptr if the request was dropped)
+    void Callback(RenderedBitmap* bmp) override {
+        auto w = wnd;
+        int id = overviewId;
+        int no = pageNo;
+        int rot = rotation;
+        uitask::Post([w, id, no, rot, bmp] {
+            if (!PageOverviewWndStillValid(w, id)) {
+                delete bmp;
+                return;
+            }
+            w->ThumbnailRendered(no, rot, bmp);
+        });
+        delete this;
+    }
+};
+
+PageOverviewWnd::~PageOverviewWnd() {
+    DisplayModel* dm = tab ? tab->AsFixed() : nullptr;
+    if (dm) {
+        // thumbnails that are currently being rendered are ignored because of overviewId
+        gRenderCache.ClearThumbnailQueue(dm);
+    }
+    gPageOverviewWnds.Remove(this);
+    for (OverviewThumbnail& thumb : thumbs) {
+        delete thumb.bmp;
+    }
+}
+
+bool PageOverviewWnd::OnEraseBkgnd(HDC) {
+    // avoid flicker, OnPaint() paints everything
+    return true;
+}
+
+void PageOverviewWnd::OnSize(UINT msg, UINT, SIZE) {
+    // the layout is only known once the window has been created
+    if (msg != WM_SIZE || cellDx == 0) {
+        return;
+    }
+    UpdateLayout();
+}
+
+void PageOverviewWnd::OnClose() {
+    // deletes this
+    ClosePageOverviewWindow(tab);
+}
+
+void PageOverviewWnd::UpdateLayout() {
+    Rect rc = ClientRect(hwnd);
+    nCols = std::max((rc.dx - 2 * padding) / cellDx, 1);
+    nRows = (thumbs.isize() + nCols - 1) / nCols;
+    offsetX = std::max((rc.dx - nCols * cellDx) / 2, 0);
+    viewDy = rc.dy;
+
+    SCROLLINFO si{};
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_PAGE;
+    si.nMin = 0;
+    si.nMax = nRows * cellDy + 2 * padding - 1;
+    si.nPage = (UINT)std::max(viewDy, 0);
+    SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+
+    // re-clamps the scroll position
+    int y = scrollY;
+    scrollY = -1;
+    ScrollTo(y);
+}
+
+void PageOverviewWnd::ScrollTo(int y) {
+    int maxY = std::max(nRows * cellDy + 2 * padding - viewDy, 0);
+    y = std::clamp(y, 0, maxY);
+    if (y == scrollY) {
+        return;
+    }
+    scrollY = y;
+    SetScrollPos(hwnd, SB_VERT, scrollY, TRUE);
+    HwndScheduleRepaint(hwnd);
+
+    // the render queue should only contain thumbnails that are still visible
+    int first, last;
+    GetVisiblePages(&first, &last);
+    gRenderCache.ClearThumbnailQueue(tab->AsFixed(), first, last);
+    FreeThumbnailsAwayFrom(first, last);
+}
+
+// scrolls the least amount necessary to make the whole cell of pageNo visible
+void PageOverviewWnd::ScrollToPage(int pageNo) {
+    if (pageNo < 1 || pageNo > thumbs.isize()) {
+        return;
+    }
+    int y = padding + ((pageNo - 1) / nCols) * cellDy;
+    if (y < scrollY) {
+        ScrollTo(y - padding);
+    } else if (y + cellDy > scrollY + viewDy) {
+        ScrollTo(y + cellDy + padding - viewDy);
+    }
+}
+
+// in client coordinates
+Rect PageOverviewWnd::CellRect(int pageNo) const {
+    int idx = pageNo - 1;
+    int x = offsetX + (idx % nCols) * cellDx;
+    int y = padding + (idx / nCols) * cellDy - scrollY;
+    return Rect(x, y, cellDx, cellDy);
+}
+
+// the rectangle of the thumbnail within the cell of pageNo and the zoom to render it at
+Rect PageOverviewWnd::ThumbnailRect(int pageNo, float* zoom) const {
+    DisplayModel* dm = tab->AsFixed();
+    EngineBase* engine = dm->GetEngine();
+    RectF page = engine->Transform(engine->PageMediabox(pageNo), pageNo, 1.0f, dm->GetRotation());
+    if (page.IsEmpty()) {
+        *zoom = 0;
+        return {};
+    }
+    *zoom = std::min((float)thumbDx / page.dx, (float)thumbDy / page.dy);
+    int dx = std::max((int)(page.dx * *zoom + 0.5f), 1);
+    int dy = std::max((int)(page.dy * *zoom + 0.5f), 1);
+    Rect cell = CellRect(pageNo);
+    int x = cell.x + padding + (thumbDx - dx) / 2;
+    int y = cell.y + padding + (thumbDy - dy) / 2;
+    return Rect(x, y, dx, dy);
+}
+
+int PageOverviewWnd::PageAt(Point pt) const {
+    int x = pt.x - offsetX;
+    int y = pt.y + scrollY - padding;
+    if (x < 0 || y < 0 || x >= nCols * cellDx) {
+        return kInvalidPageNo;
+    }
+    int pageNo = (y / cellDy) * nCols + x / cellDx + 1;
+    if (pageNo > thumbs.isize()) {
+        return kInvalidPageNo;
+    }
+    return pageNo;
+}
+
+void PageOverviewWnd::GetVisiblePages(int* first, int* last) const {
+    int firstRow = std::max(scrollY - padding, 0) / cellDy;
+    int lastRow = std::max(scrollY + viewDy - padding - 1, 0) / cellDy;
+    *first = std::min(firstRow * nCols + 1, thumbs.isize());
+    *last = std::min((lastRow + 1) * nCols, thumbs.isize());
+}
+
+void PageOverviewWnd::RequestVisibleThumbnails() {
+    DisplayModel* dm = tab->AsFixed();
+    int rotation = dm->GetRotation();
+    int first, last;
+    GetVisiblePages(&first, &last);
+    for (int pageNo = first; pageNo <= last && nPending < kMaxPendingThumbnails; pageNo++) {
+        OverviewThumbnail& thumb = thumbs[pageNo - 1];
+        bool isCurrent = thumb.bmp && thumb.rotation == rotation;
+        if (isCurrent || thumb.isPending || thumb.failed) {
+            continue;
+        }
+        float zoom;
+        ThumbnailRect(pageNo, &zoom);
+        if (zoom <= 0) {
+            thumb.failed = true;
+            continue;
+        }
+        thumb.isPending = true;
+        nPending++;
+        gRenderCache.RenderThumbnail(dm, pageNo, zoom, new OverviewThumbnailTask(this, pageNo, rotation));
+    }
+}
+
+void PageOverviewWnd::FreeThumbnailsAwayFrom(int first, int last) {
+    int keep = kKeepThumbnailRows * nCols;
+    int n = thumbs.isize();
+    for (int i = 0; i < n; i++) {
+        int pageNo = i + 1;
+        if (pageNo >= first - keep && pageNo <= last + keep) {
+            continue;
+        }
+        OverviewThumbnail& thumb = thumbs[i];
+        delete thumb.bmp;
+        thumb.bmp = nullptr;
+        thumb.failed = false;
+    }
+}
+
+void PageOverviewWnd::ThumbnailRendered(int pageNo, int rotation, RenderedBitmap* bmp) {
+    OverviewThumbnail& thumb = thumbs[pageNo - 1];
+    if (thumb.isPending) {
+        thumb.isPending = false;
+        nPending--;
+    }
+    if (bmp) {
+        delete thumb.bmp;
+        thumb.bmp = bmp;
+        thumb.rotation = rotation;
+    } else {
+        // requests for pages that are no longer visible get dropped,
+        // for visible pages this means that rendering failed
+        int first, last;
+        GetVisiblePages(&first, &last);
+        thumb.failed = pageNo >= first && pageNo <= last;
+    }
+    // also requests the next thumbnails
+    HwndScheduleRepaint(hwnd);
+}
+
+void PageOverviewWnd::GoToPage(int pageNo) {
+    MainWindow* win = tab->win;
+    if (win->CurrentTab() != tab) {
+        SelectTabInWindow(tab);
+    }
+    win->ctrl->GoToPage(pageNo, true);
+}
+
+void PageOverviewWnd::OnPaint(HDC hdcIn, PAINTSTRUCT*) {
+    Rect rc = ClientRect(hwnd);
+    DoubleBuffer buffer(hwnd, rc);
+    HDC hdc = buffer.GetDC();
+
+    AutoDeleteBrush brBg(CreateSolidBrush(kOverviewBgColor));
+    AutoDeleteBrush brPlaceholder(CreateSolidBrush(kPlaceholderColor));
+    AutoDeleteBrush brCurrent(CreateSolidBrush(kCurrentPageColor));
+    AutoDeletePen penFrame(CreatePen(PS_SOLID, 1, kThumbnailFrameColor));
+    RECT r = ToRECT(rc);
+    FillRect(hdc, &r, brBg);
+
+    ScopedSelectObject fontPrev(hdc, font);
+    ScopedSelectObject penPrev(hdc, penFrame);
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, kOverviewTextColor);
+
+    DisplayModel* dm = tab->AsFixed();
+    int rotation = dm->GetRotation();
+    int currPageNo = dm->CurrentPageNo();
+    int first, last;
+    GetVisiblePages(&first, &last);
+    for (int pageNo = first; pageNo <= last; pageNo++) {
+        Rect cell = CellRect(pageNo);
+        if (pageNo == currPageNo) {
+            r = ToRECT(cell);
+            FillRect(hdc, &r, brCurrent);
+        }
+
+        float zoom;
+        Rect rThumb = ThumbnailRect(pageNo, &zoom);
+        OverviewThumbnail& thumb = thumbs[pageNo - 1];
+        if (thumb.bmp && thumb.rotation == rotation) {
+            // center the bitmap, it might be a pixel off
+            Size size = thumb.bmp->Size();
+            int x = rThumb.x + (rThumb.dx - size.dx) / 2;
+            int y = rThumb.y + (rThumb.dy - size.dy) / 2;
+            rThumb = Rect(x, y, size.dx, size.dy);
+            thumb.bmp->StretchDIBits(hdc, rThumb);
+        } else if (!rThumb.IsEmpty()) {
+            r = ToRECT(rThumb);
+            FillRect(hdc, &r, brPlaceholder);
+        }
+        if (!rThumb.IsEmpty()) {
+            rThumb.Inflate(1, 1);
+            DrawRect(hdc, rThumb);
+        }
+
+        AutoFreeStr label = dm->GetPageLabel(pageNo);
+        Rect rLabel(cell.x, cell.y + padding + thumbDy, cell.dx, labelDy);
+        r = ToRECT(rLabel);
+        uint format = DT_SINGLELINE | DT_CENTER | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS;
+        HdcDrawText(hdc, label, -1, &r, format);
+    }
+
+    buffer.Flush(hdcIn);
+
+    RequestVisibleThumbnails();
+}
+
+LRESULT PageOverviewWnd::WndProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    if (WM_VSCROLL == msg) {
+        int lineDy = cellDy / 4;
+        switch (LOWORD(wp)) {
+            case SB_TOP:
+                ScrollTo(0);
+                break;
+            case SB_BOTTOM:
+                ScrollTo(INT_MAX);
+                break;
+            case SB_LINEUP:
+                ScrollTo(scrollY - lineDy);
+                break;
+            case SB_LINEDOWN:
+                ScrollTo(scrollY + lineDy);
+                break;
+            case SB_PAGEUP:
+                ScrollTo(scrollY - viewDy);
+                break;
+            case SB_PAGEDOWN:
+                ScrollTo(scrollY + viewDy);
+                break;
+            case SB_THUMBTRACK:
+            case SB_THUMBPOSITION: {
+                SCROLLINFO si{};
+                si.cbSize = sizeof(si);
+                si.fMask = SIF_TRACKPOS;
+                GetScrollInfo(hwnd, SB_VERT, &si);
+                ScrollTo(si.nTrackPos);
+                break;
+            }
+        }
+        return 0;
+    }
+
+    if (WM_MOUSEWHEEL == msg) {
+        // one row per notch
+        int delta = GET_WHEEL_DELTA_WPARAM(wp);
+        ScrollTo(scrollY - MulDiv(delta, cellDy, WHEEL_DELTA));
+        return 0;
+    }
+
+    if (WM_KEYDOWN == msg) {
+        switch (wp) {
+            case VK_HOME:
+                ScrollTo(0);
+                return 0;
+            case VK_END:
+                ScrollTo(INT_MAX);
+                return 0;
+            case VK_PRIOR:
+                ScrollTo(scrollY - viewDy);
+                return 0;
+            case VK_NEXT:
+                ScrollTo(scrollY + viewDy);
+                return 0;
+            case VK_UP:
+                ScrollTo(scrollY - cellDy);
+                return 0;
+            case VK_DOWN:
+                ScrollTo(scrollY + cellDy);
+                return 0;
+            case VK_ESCAPE:
+                // deletes this
+                ClosePageOverviewWindow(tab);
+                return 0;
+        }
+    }
+
+    if (WM_LBUTTONUP == msg) {
+        Point pt = Point(GET_X_LPARAM(lp), GET_Y_LPARAM(lp));
+        int pageNo = PageAt(pt);
+        if (pageNo != kInvalidPageNo) {
+            GoToPage(pageNo);
+        }
+        return 0;
+    }
+
+    return WndProcDefault(hwnd, msg, wp, lp);
+}
+
+// shows thumbnails of all pages of the current document
+void ShowPageOverview(MainWindow* win) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm) {
+        return;
+    }
+    WindowTab* tab = win->CurrentTab();
+    PageOverviewWnd* wnd = tab->pageOverviewWnd;
+    if (wnd) {
+        SetForegroundWindow(wnd->hwnd);
+        return;
+    }
+
+    wnd = new PageOverviewWnd();
+    CreateCustomArgs args;
+    HMODULE h = GetModuleHandleW(nullptr);
+    WCHAR* iconName = MAKEINTRESOURCEW(GetAppIconID());
+    args.icon = LoadIconW(h, iconName);
+    args.bgColor = MkGray(0xee);
+    args.title = _TRA("Page Overview");
+    args.style = WS_OVERLAPPEDWINDOW | WS_VSCROLL;
+    args.visible = false;
+    wnd->CreateCustom(args);
+    wnd->tab = tab;
+    wnd->overviewId = gNextPageOverviewId++;
+    wnd->font = GetDefaultGuiFont();
+    wnd->thumbs.AppendBlanks(dm->PageCount());
+    tab->pageOverviewWnd = wnd;
+    gPageOverviewWnds.Append(wnd);
+
+    HWND hwnd = wnd->hwnd;
+    wnd->thumbDx = DpiScale(hwnd, kThumbnailDx);
+    wnd->thumbDy = DpiScale(hwnd, kThumbnailDy);
+    wnd->padding = DpiScale(hwnd, kThumbnailPadding);
+    wnd->labelDy = TextSizeInHwnd(hwnd, "0", wnd->font).dy + wnd->padding;
+    wnd->cellDx = wnd->thumbDx + 2 * wnd->padding;
+    wnd->cellDy = wnd->thumbDy + wnd->labelDy + wnd->padding;
+
+    int dx = kOverviewColumns * wnd->cellDx + 2 * wnd->padding + GetSystemMetrics(SM_CXVSCROLL);
+    int dy = std::max(ClientRect(win->hwndCanvas).dy, 2 * wnd->cellDy);
+    HwndResizeClientSize(hwnd, dx, dy);
+    HwndPositionToTheRightOf(hwnd, win->hwndFrame);
+    wnd->UpdateLayout();
+    wnd->ScrollToPage(dm->CurrentPageNo());
+    wnd->SetIsVisible(true);
+}
+
+// must be called before the document of the tab is closed or replaced
+void ClosePageOverviewWindow(WindowTab* tab) {
+    if (!tab || !tab->pageOverviewWnd) {
+        return;
+    }
+    PageOverviewWnd* wnd = tab->pageOverviewWnd;
+    tab->pageOverviewWnd = nullptr;
+    // this also closes the window
+    delete wnd;
+}
+
+// highlights the current page and makes sure it's visible
+void UpdatePageOverview(WindowTab* tab) {
+    if (!tab || !tab->pageOverviewWnd || !tab->AsFixed()) {
+        return;
+    }
+    PageOverviewWnd* wnd = tab->pageOverviewWnd;
+    wnd->ScrollToPage(tab->AsFixed()->CurrentPageNo());
+    HwndScheduleRepaint(wnd->hwnd);
+}
@@ -0,0 +1,8 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct PageOverviewWnd;
+
+void ShowPageOverview(MainWindow* win);
+void ClosePageOverviewWindow(WindowTab* tab);
+void UpdatePageOverview(WindowTab* tab);
@@ -7,7 +7,11 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#include <zlib.h>
 #include "utils/ScopedWin.h"
+#include "utils/ByteReader.h"
+#include "utils/FileUtil.h"
+#include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/WinUtil.h"
 
@@ -18,6 +22,8 @@ extern "C" {
 #include "EngineBase.h"
 #include "Annotation.h"
 #include "EngineMupdfImpl.h"
+#include "EngineAll.h"
+#include "ProgressUpdateUI.h"
 #include "PdfCreator.h"
 
 #include "utils/Log.h"
@@ -124,7 +130,7 @@ static fz_image* render_to_pixmap(fz_context* ctx, HBITMAP hbmp, Size size) {
 }
 
 static void fz_print_cb(void* user, const char* msg) {
-    log(msg);
+    logThrottled(msg);
 }
 
 static void installFitzErrorCallbacks(fz_context* ctx) {
@@ -245,19 +251,148 @@ bool PdfCreator::AddPageFromGdiplusBitmap(Gdiplus::Bitmap* bmp, float imgDpi) {
     return ok;
 }
 
+// like JpegSizeFromData in GdiPlusUtil.cpp but also returns the number of color
+// components and whether the image has an Adobe marker (for inverted CMYK)
+static bool JpegInfoFromData(const ByteSlice& d, Size& size, int& nComps, bool& isAdobe) {
+    ByteReader r(d);
+    size_t len = r.len;
+    isAdobe = false;
+    for (size_t idx = 2; idx + 9 < len && r.Byte(idx) == 0xFF;) {
+        u8 marker = r.Byte(idx + 1);
+        if (marker == 0xEE && memcmp(r.d + idx + 4, "Adobe", 5) == 0) {
+            isAdobe = true;
+        }
+        if (0xC0 <= marker && marker <= 0xC3 || 0xC9 <= marker && marker <= 0xCB) {
+            if (r.Byte(idx + 4) != 8) {
+                // PDF only supports 8 bits per component for DCTDecode
+                return false;
+            }
+            size.dx = r.WordBE(idx + 7);
+            size.dy = r.WordBE(idx + 5);
+            nComps = r.Byte(idx + 9);
+            return true;
+        }
+        idx += (size_t)r.WordBE(idx + 2) + 2;
+    }
+    return false;
+}
+
+// JPEG and JPEG 2000 images are embedded without decoding them (only their
+// header is parsed), which is lossless and much faster than re-encoding them
+static bool AddPageFromJpegData(fz_context* ctx, pdf_document* doc, const ByteSlice& data, float imgDpi) {
+    Kind kind = GuessFileTypeFromContent(data);
+    Size size;
+    int nComps = 0;
+    bool isAdobe = false;
+    if (kind == kindFileJpeg) {
+        if (!JpegInfoFromData(data, size, nComps, isAdobe) || (nComps != 1 && nComps != 3 && nComps != 4)) {
+            return false;
+        }
+    } else if (kind == kindFileJp2) {
+        size = BitmapSizeFromHeader(data);
+    } else {
+        return false;
+    }
+    if (size.IsEmpty()) {
+        return false;
+    }
+
+    pdf_obj* imgDict = nullptr;
+    pdf_obj* imgRef = nullptr;
+    pdf_obj* resources = nullptr;
+    pdf_obj* page = nullptr;
+    fz_buffer* buf = nullptr;
+    fz_buffer* contents = nullptr;
+    fz_var(imgDict);
+    fz_var(imgRef);
+    fz_var(resources);
+    fz_var(page);
+    fz_var(buf);
+    fz_var(contents);
+
+    bool ok = true;
+    fz_var(ok);
+    fz_try(ctx) {
+        imgDict = pdf_new_dict(ctx, doc, 8);
+        pdf_dict_put(ctx, imgDict, PDF_NAME(Type), PDF_NAME(XObject));
+        pdf_dict_put(ctx, imgDict, PDF_NAME(Subtype), PDF_NAME(Image));
+        pdf_dict_put_int(ctx, imgDict, PDF_NAME(Width), size.dx);
+        pdf_dict_put_int(ctx, imgDict, PDF_NAME(Height), size.dy);
+        if (kind == kindFileJpeg) {
+            pdf_obj* cs = PDF_NAME(DeviceCMYK);
+            if (nComps == 1) {
+                cs = PDF_NAME(DeviceGray);
+            } else if (nComps == 3) {
+                cs = PDF_NAME(DeviceRGB);
+            }
+            pdf_dict_put(ctx, imgDict, PDF_NAME(ColorSpace), cs);
+            pdf_dict_put_int(ctx, imgDict, PDF_NAME(BitsPerComponent), 8);
+            pdf_dict_put(ctx, imgDict, PDF_NAME(Filter), PDF_NAME(DCTDecode));
+            if (nComps == 4 && isAdobe) {
+                // Adobe applications write CMYK JPEGs with inverted components
+                pdf_obj* decode = pdf_dict_put_array(ctx, imgDict, PDF_NAME(Decode), 8);
+                for (int i = 0; i < 4; i++) {
+                    pdf_array_push_int(ctx, decode, 1);
+                    pdf_array_push_int(ctx, decode, 0);
+                }
+            }
+        } else {
+            // JPXDecode images specify their color space and bit depth themselves
+            pdf_dict_put(ctx, imgDict, PDF_NAME(Filter), PDF_NAME(JPXDecode));
+        }
+        buf = fz_new_buffer_from_copied_data(ctx, data.data(), data.size());
+        imgRef = pdf_add_stream(ctx, doc, buf, imgDict, 1);
+
+        float zoom = 1.0f;
+        if (imgDpi > 0) {
+            zoom = 72.0f / imgDpi;
+        }
+        fz_rect bounds = {0, 0, size.dx * zoom, size.dy * zoom};
+        resources = pdf_new_dict(ctx, doc, 1);
+        pdf_obj* xobjs = pdf_dict_put_dict(ctx, resources, PDF_NAME(XObject), 1);
+        pdf_dict_puts(ctx, xobjs, "Im0", imgRef);
+        contents = fz_new_buffer(ctx, 64);
+        fz_append_printf(ctx, contents, "q %g 0 0 %g 0 0 cm /Im0 Do Q", bounds.x1, bounds.y1);
+
+        page = pdf_add_page(ctx, doc, bounds, 0, resources, contents);
+        pdf_insert_page(ctx, doc, -1, page);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj(ctx, page);
+        pdf_drop_obj(ctx, resources);
+        pdf_drop_obj(ctx, imgRef);
+        pdf_drop_obj(ctx, imgDict);
+        fz_drop_buffer(ctx, contents);
+        fz_drop_buffer(ctx, buf);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    return ok;
+}
+
 bool PdfCreator::AddPageFromImageData(const ByteSlice& data, float imgDpi) const {
     CrashIf(!ctx || !doc);
     if (!ctx || !doc || data.empty()) {
         return false;
     }
 
+    if (AddPageFromJpegData(ctx, doc, data, imgDpi)) {
+        return true;
+    }
+
     fz_image* img = nullptr;
+    fz_buffer* buf = nullptr;
     fz_var(img);
+    fz_var(buf);
 
     fz_try(ctx) {
-        fz_buffer* buf = fz_new_buffer_from_copied_data(ctx, data.data(), data.size());
+        buf = fz_new_buffer_from_copied_data(ctx, data.data(), data.size());
         img = fz_new_image_from_buffer(ctx, buf);
     }
+    fz_always(ctx) {
+        fz_drop_buffer(ctx, buf);
+    }
     fz_catch(ctx) {
         img = nullptr;
     }
@@ -269,30 +404,35 @@ bool PdfCreator::AddPageFromImageData(const ByteSlice& data, float imgDpi) const
     return ok;
 }
 
+// adapted from EngineMupdf::GetProperty
+static struct {
+    DocumentProperty prop;
+    const char* name;
+} pdfPropNames[] = {
+    {DocumentProperty::Title, "Title"},
+    {DocumentProperty::Author, "Author"},
+    {DocumentProperty::Subject, "Subject"},
+    {DocumentProperty::Copyright, "Copyright"},
+    {DocumentProperty::ModificationDate, "ModDate"},
+    {DocumentProperty::CreatorApp, "Creator"},
+    {DocumentProperty::PdfProducer, "Producer"},
+};
+
+static const char* PdfPropName(DocumentProperty prop) {
+    for (int i = 0; i < dimof(pdfPropNames); i++) {
+        if (pdfPropNames[i].prop == prop) {
+            return pdfPropNames[i].name;
+        }
+    }
+    return nullptr;
+}
+
 bool PdfCreator::SetProperty(DocumentProperty prop, const char* value) const {
     if (!ctx || !doc) {
         return false;
     }
 
-    // adapted from EngineMupdf::GetProperty
-    static struct {
-        DocumentProperty prop;
-        const char* name;
-    } pdfPropNames[] = {
-        {DocumentProperty::Title, "Title"},
-        {DocumentProperty::Author, "Author"},
-        {DocumentProperty::Subject, "Subject"},
-        {DocumentProperty::Copyright, "Copyright"},
-        {DocumentProperty::ModificationDate, "ModDate"},
-        {DocumentProperty::CreatorApp, "Creator"},
-        {DocumentProperty::PdfProducer, "Producer"},
-    };
-    const char* name = nullptr;
-    for (int i = 0; i < dimof(pdfPropNames) && !name; i++) {
-        if (pdfPropNames[i].prop == prop) {
-            name = pdfPropNames[i].name;
-        }
-    }
+    const char* name = PdfPropName(prop);
     if (!name) {
         return false;
     }
@@ -383,26 +523,412 @@ bool PdfCreator::SaveToFile(const char* filePath) const {
     return true;
 }
 
-bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi) {
-    PdfCreator* c = new PdfCreator();
+// RenderToFile doesn't go through pdf_document (which keeps all pages in memory
+// until it's saved): pages are rendered and compressed on several threads and
+// written to the file in order as soon as they're ready. JPEG pages of image
+// collections are written as they are
+
+constexpr int kMaxPdfExportThreads = 8;
+
+struct PdfExportPage {
+    int dx = 0;
+    int dy = 0;
+    // Flate compressed RGB samples (or the JPEG if isJpeg), nullptr if rendering failed
+    u8* data = nullptr;
+    uLong size = 0;
+    bool isJpeg = false;
+    int nComps = 3;
+    bool isAdobe = false;
+    bool isDone = false;
+};
+
+struct PdfExporter {
+    EngineBase* engine = nullptr;
+    float zoom = 1.f;
+    // indexed by pageNo - 1
+    Vec<PdfExportPage> pages;
+
+    CRITICAL_SECTION access;
+    HANDLE pageDone = nullptr;
+    // limits how many compressed pages wait for being written
+    HANDLE slots = nullptr;
+    int nextPage = 1;
+    bool stop = false;
+
+    HANDLE threads[kMaxPdfExportThreads] = {};
+    int nThreads = 0;
+
+    PdfExporter(EngineBase* engine, float zoom);
+    ~PdfExporter();
+
+    void Start();
+    bool Take(int pageNo, PdfExportPage& page);
+    void FreeSlot();
+    void Stop();
+};
+
+static u8* CompressBitmapRGB(HBITMAP hbmp, Size size, uLong* sizeOut) {
+    int w = size.dx;
+    int h = size.dy;
+    int stride = ((w * 3 + 3) / 4) * 4;
+    u8* data = AllocArray<u8>((size_t)stride * h);
+    if (!data) {
+        return nullptr;
+    }
+
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 24;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC hDC = GetDC(nullptr);
+    int res = GetDIBits(hDC, hbmp, 0, h, data, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hDC);
+    if (res == 0) {
+        free(data);
+        return nullptr;
+    }
+
+    // convert BGR to RGB and remove the padding (in place, rows only move up)
+    u8* d = data;
+    for (int y = 0; y < h; y++) {
+        u8* s = data + (size_t)y * stride;
+        for (int x = 0; x < w; x++) {
+            u8 b = s[0];
+            d[1] = s[1];
+            d[0] = s[2];
+            d[2] = b;
+            s += 3;
+            d += 3;
+        }
+    }
+
+    uLong srcSize = (uLong)(w * 3) * h;
+    uLongf dstSize = compressBound(srcSize);
+    u8* compressed = AllocArray<u8>(dstSize);
+    if (compressed && compress2(compressed, &dstSize, data, srcSize, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        free(compressed);
+        compressed = nullptr;
+    }
+    free(data);
+    *sizeOut = dstSize;
+    return compressed;
+}
+
+static bool GetExportJpeg(EngineBase* engine, int pageNo, PdfExportPage& page) {
+    if (!engine->IsImageCollection()) {
+        return false;
+    }
+    ByteSlice data = EngineImagesGetPageData(engine, pageNo);
+    Size size;
+    int nComps = 0;
+    bool isAdobe = false;
+    bool isJpeg = GuessFileTypeFromContent(data) == kindFileJpeg && JpegInfoFromData(data, size, nComps, isAdobe) &&
+                  (nComps == 1 || nComps == 3 || nComps == 4) && !size.IsEmpty();
+    if (!isJpeg) {
+        data.Free();
+        return false;
+    }
+    page.dx = size.dx;
+    page.dy = size.dy;
+    page.data = data.data();
+    page.size = (uLong)data.size();
+    page.isJpeg = true;
+    page.nComps = nComps;
+    page.isAdobe = isAdobe;
+    return true;
+}
+
+static void RenderExportPage(EngineBase* engine, int pageNo, float zoom, PdfExportPage& page) {
+    if (GetExportJpeg(engine, pageNo, page)) {
+        page.isDone = true;
+        return;
+    }
+    RenderPageArgs args(pageNo, zoom, 0, nullptr, RenderTarget::Export);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    if (bmp) {
+        Size size = bmp->Size();
+        page.dx = size.dx;
+        page.dy = size.dy;
+        page.data = CompressBitmapRGB(bmp->GetBitmap(), size, &page.size);
+    }
+    delete bmp;
+    page.isDone = true;
+}
+
+static DWORD WINAPI PdfExportThread(LPVOID data) {
+    PdfExporter* e = (PdfExporter*)data;
+    for (;;) {
+        WaitForSingleObject(e->slots, INFINITE);
+        int pageNo;
+        {
+            ScopedCritSec scope(&e->access);
+            if (e->stop || e->nextPage > e->pages.isize()) {
+                // let the other threads finish as well
+                ReleaseSemaphore(e->slots, 1, nullptr);
+                return 0;
+            }
+            pageNo = e->nextPage++;
+        }
+        PdfExportPage page;
+        RenderExportPage(e->engine, pageNo, e->zoom, page);
+        {
+            ScopedCritSec scope(&e->access);
+            e->pages.at(pageNo - 1) = page;
+        }
+        SetEvent(e->pageDone);
+    }
+}
+
+PdfExporter::PdfExporter(EngineBase* engine, float zoom) : engine(engine), zoom(zoom) {
+    InitializeCriticalSection(&access);
+    pages.AppendBlanks(engine->PageCount());
+}
+
+PdfExporter::~PdfExporter() {
+    Stop();
+    for (PdfExportPage& page : pages) {
+        free(page.data);
+    }
+    SafeCloseHandle(&pageDone);
+    SafeCloseHandle(&slots);
+    DeleteCriticalSection(&access);
+}
+
+// without threads, Take() renders the pages itself
+void PdfExporter::Start() {
+    int n = std::clamp(GetPhysicalProcessorCount(), 1, kMaxPdfExportThreads);
+    n = std::min(n, pages.isize());
+    pageDone = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    slots = CreateSemaphoreW(nullptr, 2 * n, LONG_MAX, nullptr);
+    if (!pageDone || !slots) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        HANDLE h = CreateThread(nullptr, 0, PdfExportThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        threads[nThreads++] = h;
+    }
+    logf("PdfExporter::Start: %d threads for %d pages\n", nThreads, pages.isize());
+}
+
+// waits until pageNo has been rendered and hands its data over to the
+// caller (who must free it and call FreeSlot)
+bool PdfExporter::Take(int pageNo, PdfExportPage& page) {
+    if (nThreads == 0) {
+        RenderExportPage(engine, pageNo, zoom, page);
+        return page.data != nullptr;
+    }
+    for (;;) {
+        {
+            ScopedCritSec scope(&access);
+            PdfExportPage& p = pages.at(pageNo - 1);
+            if (p.isDone) {
+                page = p;
+                p.data = nullptr;
+                return page.data != nullptr;
+            }
+        }
+        WaitForSingleObject(pageDone, INFINITE);
+    }
+}
+
+void PdfExporter::FreeSlot() {
+    if (nThreads > 0) {
+        ReleaseSemaphore(slots, 1, nullptr);
+    }
+}
+
+void PdfExporter::Stop() {
+    if (nThreads == 0) {
+        return;
+    }
+    {
+        ScopedCritSec scope(&access);
+        stop = true;
+    }
+    ReleaseSemaphore(slots, nThreads, nullptr);
+    WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+    nThreads = 0;
+}
+
+// writes the objects of a PDF file one after another and
+// keeps track of their offsets for the cross-reference table
+struct PdfFileWriter {
+    FILE* fp = nullptr;
+    i64 pos = 0;
+    // indexed by object number - 1
+    Vec<i64> offsets;
     bool ok = true;
+
+    void Write(const void* data, size_t size);
+    void WriteFmt(const char* fmt, ...);
+    void BeginObj(int objNo);
+    void EndObj();
+};
+
+void PdfFileWriter::Write(const void* data, size_t size) {
+    if (ok && size > 0 && fwrite(data, 1, size, fp) != size) {
+        ok = false;
+    }
+    pos += (i64)size;
+}
+
+void PdfFileWriter::WriteFmt(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    AutoFreeStr s = str::FmtV(fmt, args);
+    va_end(args);
+    Write(s.Get(), str::Len(s));
+}
+
+void PdfFileWriter::BeginObj(int objNo) {
+    while (offsets.isize() < objNo) {
+        offsets.Append(0);
+    }
+    offsets.at(objNo - 1) = pos;
+    WriteFmt("%d 0 obj\n", objNo);
+}
+
+void PdfFileWriter::EndObj() {
+    WriteFmt("endobj\n");
+}
+
+// strings are written as UTF-16BE so that they don't need escaping
+static void WritePdfTextString(PdfFileWriter& w, const char* s) {
+    WCHAR* ws = ToWstrTemp(s);
+    w.WriteFmt("<FEFF");
+    for (; *ws; ws++) {
+        w.WriteFmt("%04X", (unsigned int)*ws);
+    }
+    w.WriteFmt(">");
+}
+
+// object numbers: 1 is the catalog, 2 the page tree, 3 the document
+// information and each page has an image, a content stream and a page object
+constexpr int kPdfFirstPageObj = 4;
+
+static void WriteExportPage(PdfFileWriter& w, int pageIdx, const PdfExportPage& page, int dpi) {
+    int imgObj = kPdfFirstPageObj + pageIdx * 3;
+    const char* cs = page.nComps == 1 ? "DeviceGray" : page.nComps == 4 ? "DeviceCMYK" : "DeviceRGB";
+    w.BeginObj(imgObj);
+    w.WriteFmt("<< /Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace /%s ", page.dx, page.dy, cs);
+    if (page.isJpeg && page.nComps == 4 && page.isAdobe) {
+        // Adobe applications write CMYK JPEGs with inverted components
+        w.WriteFmt("/Decode [1 0 1 0 1 0 1 0] ");
+    }
+    w.WriteFmt("/BitsPerComponent 8 /Filter /%s ", page.isJpeg ? "DCTDecode" : "FlateDecode");
+    w.WriteFmt("/Length %d >>\nstream\n", (int)page.size);
+    w.Write(page.data, page.size);
+    w.WriteFmt("\nendstream\n");
+    w.EndObj();
+
+    float dx = page.dx * 72.f / dpi;
+    float dy = page.dy * 72.f / dpi;
+    AutoFreeStr content = str::Format("q %.2f 0 0 %.2f 0 0 cm /Im0 Do Q", dx, dy);
+    w.BeginObj(imgObj + 1);
+    w.WriteFmt("<< /Length %d >>\nstream\n%s\nendstream\n", (int)str::Len(content), content.Get());
+    w.EndObj();
+
+    w.BeginObj(imgObj + 2);
+    w.WriteFmt("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %.2f %.2f] ", dx, dy);
+    w.WriteFmt("/Resources << /XObject << /Im0 %d 0 R >> >> /Contents %d 0 R >>\n", imgObj, imgObj + 1);
+    w.EndObj();
+}
+
+static void WriteExportTrailer(PdfFileWriter& w, EngineBase* engine, int nPages) {
+    w.BeginObj(2);
+    w.WriteFmt("<< /Type /Pages /Count %d /Kids [", nPages);
+    for (int i = 0; i < nPages; i++) {
+        w.WriteFmt(i > 0 ? " %d 0 R" : "%d 0 R", kPdfFirstPageObj + i * 3 + 2);
+    }
+    w.WriteFmt("] >>\n");
+    w.EndObj();
+
+    w.BeginObj(3);
+    w.WriteFmt("<<");
+    for (int i = 0; i < dimof(propsToCopy); i++) {
+        AutoFreeStr value = engine->GetProperty(propsToCopy[i]);
+        if (value) {
+            w.WriteFmt(" /%s ", PdfPropName(propsToCopy[i]));
+            WritePdfTextString(w, value);
+        }
+    }
+    if (gPdfProducer) {
+        w.WriteFmt(" /Producer ");
+        WritePdfTextString(w, gPdfProducer);
+    }
+    w.WriteFmt(" >>\n");
+    w.EndObj();
+
+    i64 xrefPos = w.pos;
+    w.WriteFmt("xref\n0 %d\n0000000000 65535 f \n", w.offsets.isize() + 1);
+    for (i64 off : w.offsets) {
+        w.WriteFmt("%010lld 00000 n \n", off);
+    }
+    w.WriteFmt("trailer\n<< /Size %d /Root 1 0 R /Info 3 0 R >>\n", w.offsets.isize() + 1);
+    w.WriteFmt("startxref\n%lld\n%%EOF\n", xrefPos);
+}
+
+bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi, ProgressUpdateUI* progress) {
+    int nPages = engine->PageCount();
+    if (nPages <= 0) {
+        return false;
+    }
+    if (engine->IsImageCollection()) {
+        // images that can't be embedded as they are are rendered at their size
+        dpi = (int)engine->GetFileDPI();
+    }
+    PdfFileWriter w;
+    w.fp = _wfopen(ToWstrTemp(pdfFileName), L"wb");
+    if (!w.fp) {
+        return false;
+    }
+
+    // the second line marks the file as binary
+    w.Write("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n", 15);
+    w.BeginObj(1);
+    w.WriteFmt("<< /Type /Catalog /Pages 2 0 R >>\n");
+    w.EndObj();
+
     // render all pages to images
     float zoom = dpi / engine->GetFileDPI();
-    for (int i = 1; ok && i <= engine->PageCount(); i++) {
-        RenderPageArgs args(i, zoom, 0, nullptr, RenderTarget::Export);
-        RenderedBitmap* bmp = engine->RenderPage(args);
-        ok = false;
-        if (bmp) {
-            ok = AddPageFromHBITMAP(c, bmp->GetBitmap(), bmp->Size(), dpi);
+    PdfExporter exporter(engine, zoom);
+    exporter.Start();
+    bool ok = true;
+    for (int pageNo = 1; ok && pageNo <= nPages; pageNo++) {
+        PdfExportPage page;
+        ok = exporter.Take(pageNo, page);
+        if (ok) {
+            WriteExportPage(w, pageNo - 1, page, dpi);
+            ok = w.ok;
+        }
+        free(page.data);
+        exporter.FreeSlot();
+        if (progress) {
+            progress->UpdateProgress(pageNo, nPages);
+            ok = ok && !progress->WasCanceled();
         }
-        delete bmp;
+    }
+    exporter.Stop();
+
+    if (ok) {
+        WriteExportTrailer(w, engine, nPages);
+    }
+    ok = ok && w.ok;
+    if (fclose(w.fp) != 0) {
+        ok = false;
     }
     if (!ok) {
-        delete c;
-        return false;
+        file::Delete(pdfFileName);
     }
-    c->CopyProperties(engine);
-    ok = c->SaveToFile(pdfFileName);
-    delete c;
     return ok;
 }
@@ -4,6 +4,7 @@
 typedef struct fz_context fz_context;
 typedef struct fz_image fz_image;
 typedef struct pdf_document pdf_document;
+struct ProgressUpdateUI;
 
 class PdfCreator {
   public:
@@ -25,6 +26,8 @@ class PdfCreator {
     // this name is included in all saved PDF files
     static void SetProducerName(const char* name);
 
-    // creates a simple PDF with all pages rendered as a single image
-    static bool RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi = 150);
+    // creates a simple PDF with all pages rendered as a single image. progress
+    // is updated for every page and the file is deleted if it's canceled
+    static bool RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi = 150,
+                             ProgressUpdateUI* progress = nullptr);
 };
@@ -59,6 +59,10 @@ class Pdfsync : public Synchronizer {
     Vec<PdfsyncPoint> points;        // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+    // built with the index, so that searches don't have to go through all lines and points
+    Vec<size_t> linesByRecord;  // indexes into <lines>, sorted by record
+    Vec<size_t> linesBySource;  // indexes into <lines>, sorted by file, line and position in <lines>
+    Vec<size_t> pointsByRecord; // indexes into <points>, sorted by record and position in <points>
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -68,9 +72,13 @@ class SyncTex : public Synchronizer {
         engine = engineIn;
         scanner = nullptr;
         CrashIf(!str::EndsWithI(syncfilename, ".synctex"));
+        // parsing a big .synctex.gz takes seconds, so do it right away (i.e. when
+        // the document is (re)loaded after a compile) instead of on the first search
+        indexThread = CreateThread(nullptr, 0, IndexThread, this, 0, nullptr);
     }
 
     ~SyncTex() override {
+        WaitForIndexThread();
         synctex_scanner_free(scanner);
     }
 
@@ -79,9 +87,13 @@ class SyncTex : public Synchronizer {
 
   private:
     int RebuildIndexIfNeeded();
+    void WaitForIndexThread();
+    static DWORD WINAPI IndexThread(LPVOID data);
 
     EngineBase* engine; // needed for converting between coordinate systems
     synctex_scanner_t scanner;
+    // parses the sync file in the background, sets scanner
+    HANDLE indexThread = nullptr;
 };
 
 Synchronizer::Synchronizer(const char* syncFilePathIn) {
@@ -298,16 +310,37 @@ int Pdfsync::RebuildIndexIfNeeded() {
     fileIndex.at(0).end = lines.size();
     ReportIf(filestack.size() != 1);
 
+    linesByRecord.Reset();
+    linesBySource.Reset();
+    pointsByRecord.Reset();
+    for (size_t i = 0; i < lines.size(); i++) {
+        linesByRecord.Append(i);
+        linesBySource.Append(i);
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        pointsByRecord.Append(i);
+    }
+    std::sort(linesByRecord.begin(), linesByRecord.end(), [this](size_t a, size_t b) {
+        return lines[a].record < lines[b].record || (lines[a].record == lines[b].record && a < b);
+    });
+    std::sort(linesBySource.begin(), linesBySource.end(), [this](size_t a, size_t b) {
+        const PdfsyncLine& la = lines[a];
+        const PdfsyncLine& lb = lines[b];
+        if (la.file != lb.file) {
+            return la.file < lb.file;
+        }
+        return la.line < lb.line || (la.line == lb.line && a < b);
+    });
+    std::sort(pointsByRecord.begin(), pointsByRecord.end(), [this](size_t a, size_t b) {
+        return points[a].record < points[b].record || (points[a].record == points[b].record && a < b);
+    });
+
     return MarkIndexWasRebuilt();
 }
 
 // convert a coordinate from the sync file into a PDF coordinate
 #define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
 
-static int cmpLineRecords(const void* a, const void* b) {
-    return ((PdfsyncLine*)a)->record - ((PdfsyncLine*)b)->record;
-}
-
 int Pdfsync::DocToSource(int pageNo, Point pt, AutoFreeStr& filename, int* line, int* col) {
     int res = RebuildIndexIfNeeded();
     if (res != PDFSYNCERR_SUCCESS) {
@@ -359,14 +392,12 @@ int Pdfsync::DocToSource(int pageNo, Point pt, AutoFreeStr& filename, int* line,
     }
 
     // We have a record number, we need to find its declaration ('l ...') in the syncfile
-    PdfsyncLine cmp;
-    cmp.record = selected_record;
-    PdfsyncLine* found =
-        (PdfsyncLine*)bsearch(&cmp, lines.LendData(), lines.size(), sizeof(PdfsyncLine), cmpLineRecords);
-    CrashIf(!found);
-    if (!found) {
+    size_t* it = std::lower_bound(linesByRecord.begin(), linesByRecord.end(), selected_record,
+                                  [this](size_t ix, UINT record) { return lines[ix].record < record; });
+    if (it == linesByRecord.end() || lines[*it].record != selected_record) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
+    PdfsyncLine* found = &lines[*it];
 
     char* path = srcfiles[found->file];
     filename.SetCopy(path);
@@ -421,24 +452,29 @@ UINT Pdfsync::SourceToRecord(const char* srcfilename, int line, int, Vec<size_t>
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
     }
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
-    UINT min_distance = EPSILON_LINE; // distance to the closest record
-    size_t lineIx = (size_t)-1;       // closest record-line index
-
-    for (size_t isec = fileIndex.at(isrc).start; isec < fileIndex.at(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.at(isec).file != isrc) {
-            continue;
-        }
-
-        UINT d = abs((int)lines.at(isec).line - (int)line);
-        if (d < min_distance) {
+    // in linesBySource the lines of a file are sorted by line number, so the closest records
+    // are the first one at or after the requested line and the first one of the line before it.
+    // Of two equally close records, the one declared first is used
+    auto lowerBound = [this](size_t file, int lineNo) {
+        return std::lower_bound(linesBySource.begin(), linesBySource.end(), lineNo, [this, file](size_t ix, int l) {
+            return lines[ix].file < file || (lines[ix].file == file && (int)lines[ix].line < l);
+        });
+    };
+    int min_distance = EPSILON_LINE; // distance to the closest record
+    size_t lineIx = (size_t)-1;      // closest record-line index
+
+    size_t* it = lowerBound(isrc, line);
+    if (it != linesBySource.end() && lines[*it].file == isrc && (int)lines[*it].line - line < min_distance) {
+        min_distance = (int)lines[*it].line - line;
+        lineIx = *it;
+    }
+    if (it != linesBySource.begin() && lines[*(it - 1)].file == isrc) {
+        int prevLine = (int)lines[*(it - 1)].line;
+        size_t prevIx = *lowerBound(isrc, prevLine);
+        int d = line - prevLine;
+        if (d < min_distance || (d == min_distance && lineIx != (size_t)-1 && prevIx < lineIx)) {
             min_distance = d;
-            lineIx = isec;
-            if (0 == d) {
-                break; // We have found a record for the requested line!
-            }
+            lineIx = prevIx;
         }
     }
     if (lineIx == (size_t)-1) {
@@ -469,11 +505,24 @@ int Pdfsync::SourceToDoc(const char* srcfilename, int line, int col, int* page,
 
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
+    Vec<size_t> found_points;
+    for (size_t record : found_records) {
+        size_t* it = std::lower_bound(pointsByRecord.begin(), pointsByRecord.end(), record,
+                                      [this](size_t ix, size_t rec) { return points[ix].record < rec; });
+        for (; it != pointsByRecord.end() && points[*it].record == record; it++) {
+            found_points.Append(*it);
+        }
+    }
+    // in the order they're declared, as that determines the page
+    std::sort(found_points.begin(), found_points.end());
+
     int firstPage = UINT_MAX;
-    for (PdfsyncPoint& p : points) {
-        if (!found_records.Contains(p.record)) {
+    for (size_t i = 0; i < found_points.size(); i++) {
+        // the same record might've been found more than once
+        if (i > 0 && found_points[i] == found_points[i - 1]) {
             continue;
         }
+        PdfsyncPoint& p = points[found_points[i]];
         if (firstPage != UINT_MAX && firstPage != (int)p.page) {
             continue;
         }
@@ -494,77 +543,85 @@ int Pdfsync::SourceToDoc(const char* srcfilename, int line, int col, int* page,
 
 // SYNCTEX synchronizer
 
-int SyncTex::RebuildIndexIfNeeded() {
-    if (!NeedsToRebuildIndex()) {
-        logfa("SyncTex::RebuildIndexIfNeeded: no need to rebuild\n");
-        return PDFSYNCERR_SUCCESS;
-    }
-    synctex_scanner_free(scanner);
-    scanner = nullptr;
-    bool synctexExists = false;
+// the scanner keeps the nodes of each sheet and a (tag, line) hash of nodes, so
+// queries don't have to go through the whole document. Only parsing is slow
+static synctex_scanner_t LoadSyncTexScanner(const char* syncFilePath) {
     char* pathNoExt = path::GetPathNoExtTemp(syncFilePath);
+    char* pathSync = str::JoinTemp(pathNoExt, ".synctex");
     char* pathSyncGz = str::JoinTemp(pathNoExt, ".synctex.gz");
-    i64 fsize;
-    {
-        char* pathSync = str::JoinTemp(pathNoExt, ".synctex");
-        if (file::Exists(pathSync)) {
-            fsize = file::GetSize(pathSync);
-            logf("SyncTex::RebuildIndexIfNeeded: %s, size: %d\n", pathSync, (int)fsize);
-            synctexExists = true;
-        }
-        if (file::Exists(pathSyncGz)) {
-            fsize = file::GetSize(pathSyncGz);
-            logf("SyncTex::RebuildIndexIfNeeded: %s, size: %d\n", pathSyncGz, (int)fsize);
-            synctexExists = true;
-
-            // to see if we can read when gzopen in synctex_scanner_new_with_output_file cannot
-            ByteSlice d = file::ReadFile(pathSyncGz);
-            if (d.empty()) {
-                logf("SyncTex::RebuildIndexIfNeeded: file::ReadFile() '%s' failed\n", pathSyncGz);
-            } else {
-                logf("SyncTex::RebuildIndexIfNeeded: file::ReadFile() did read '%s'\n", pathSyncGz);
-                d.Free();
-            }
-        }
-        if (!synctexExists) {
-            logf("SyncTex::RebuildIndexIfNeeded: files %s and %s don't exist\n", pathSync, pathSyncGz);
-        }
+    bool synctexExists = file::Exists(pathSync) || file::Exists(pathSyncGz);
+    if (!synctexExists) {
+        logf("LoadSyncTexScanner: files %s and %s don't exist\n", pathSync, pathSyncGz);
     }
 
     bool didRepeat = false;
+    synctex_scanner_t scanner = nullptr;
 Repeat:
     WCHAR* ws = ToWstrTemp(syncFilePath);
     AutoFreeStr pathAnsi = strconv::WstrToAnsi(ws);
     scanner = synctex_scanner_new_with_output_file(pathAnsi, nullptr, 1);
     if (scanner) {
         logfa("synctex_scanner_new_with_output_file: ok for pathAnsi '%s'\n", pathAnsi.Get());
-        goto Exit;
+        return scanner;
     }
     if (!str::Eq(syncFilePath, pathAnsi)) {
-        logfa("synctex_scanner_new_with_output_file: retrying for syncFilePath '%s'\n", syncFilePath.Get());
+        logfa("synctex_scanner_new_with_output_file: retrying for syncFilePath '%s'\n", syncFilePath);
         scanner = synctex_scanner_new_with_output_file(syncFilePath, nullptr, 1);
     }
     if (scanner) {
-        logfa("synctex_scanner_new_with_output_file: ok forsyncFilePath '%s'\n", syncFilePath.Get());
-        goto Exit;
+        logfa("synctex_scanner_new_with_output_file: ok forsyncFilePath '%s'\n", syncFilePath);
+        return scanner;
     }
     if (!synctexExists || didRepeat) {
         logfa("synctex_scanner_new_with_output_file: failed for '%s'\n", pathAnsi.Get());
-        return PDFSYNCERR_SYNCFILE_NOTFOUND;
+        return nullptr;
     }
     // Note: https://github.com/sumatrapdfreader/sumatrapdf/discussions/2640#discussioncomment-2861368
     // reported failure to parse a large (12 MB) .synctex.gz even though file exists
     // theory: timing issue of us reading partially written file
     // retry with 1 sec delay once
-    logfa("SyncTex::RebuildIndexIfNeeded: retrying with 1 sec delay\n");
+    logfa("LoadSyncTexScanner: retrying with 1 sec delay\n");
     ::Sleep(1000);
 
-    fsize = file::GetSize(pathSyncGz);
-    logfa("SyncTex::RebuildIndexIfNeeded: %s, size: %d\n", pathSyncGz, (int)fsize);
+    i64 fsize = file::GetSize(pathSyncGz);
+    logfa("LoadSyncTexScanner: %s, size: %d\n", pathSyncGz, (int)fsize);
 
     didRepeat = true;
     goto Repeat;
-Exit:
+}
+
+DWORD WINAPI SyncTex::IndexThread(LPVOID data) {
+    SyncTex* self = (SyncTex*)data;
+    self->scanner = LoadSyncTexScanner(self->syncFilePath);
+    DestroyTempAllocator();
+    return 0;
+}
+
+void SyncTex::WaitForIndexThread() {
+    if (!indexThread) {
+        return;
+    }
+    WaitForSingleObject(indexThread, INFINITE);
+    CloseHandle(indexThread);
+    indexThread = nullptr;
+    // the time stamp is from before parsing started, so that
+    // changes made while parsing trigger another rebuild
+    if (scanner) {
+        needsToRebuildIndex = false;
+    }
+}
+
+int SyncTex::RebuildIndexIfNeeded() {
+    WaitForIndexThread();
+    if (!NeedsToRebuildIndex()) {
+        logfa("SyncTex::RebuildIndexIfNeeded: no need to rebuild\n");
+        return PDFSYNCERR_SUCCESS;
+    }
+    synctex_scanner_free(scanner);
+    scanner = LoadSyncTexScanner(syncFilePath);
+    if (!scanner) {
+        return PDFSYNCERR_SYNCFILE_NOTFOUND;
+    }
     return MarkIndexWasRebuilt();
 }
 
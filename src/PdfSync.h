@@ -38,14 +38,13 @@ class Synchronizer {
     // The result is returned in page and rects (list of rectangles to highlight).
     virtual int SourceToDoc(const char* srcfilename, int line, int col, int* page, Vec<Rect>& rects) = 0;
 
-  private:
+  protected:
     // true if the index needs to be recomputed (needs to be set to true when a change to the
     // pdfsync file is detected)
     bool needsToRebuildIndex = true;
     // time stamp of sync file when index was last built
     struct _stat syncfileTimestamp;
 
-  protected:
     bool NeedsToRebuildIndex() const;
     int MarkIndexWasRebuilt();
     char* PrependDir(const char* filename) const;
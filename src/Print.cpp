@@ -265,6 +265,235 @@ static RectF BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo) {
     return bounds;
 }
 
+// a page (or for selections, a part of a page) to render and print
+struct PrintPageItem {
+    int pageNo = 0;
+    float zoom = 0.f;
+    int rotation = 0;
+    RectF clip{};
+    bool hasClip = false;
+    Point offset{};
+    // the first item printed on a new sheet of paper
+    bool startsSheet = false;
+    // set by a PrintRenderer thread
+    RenderedBitmap* bmp = nullptr;
+    bool isRendered = false;
+    // drawn with vector graphics instead of a bitmap (see GlobalPrefs::vectorPrinting)
+    bool isVector = false;
+    AbortCookie* cookie = nullptr;
+};
+
+constexpr int kMaxPrintRenderThreads = 4;
+// pages with bigger bitmaps are rendered and printed in horizontal bands
+constexpr size_t kMaxPrintBandMemory = (size_t)64 * 1024 * 1024;
+// at printer resolution a single page can take hundreds of MB,
+// so the number of pages rendered ahead is limited by their size
+#if IS_64BIT
+constexpr size_t kMaxPrintAheadMemory = (size_t)1024 * 1024 * 1024;
+#else
+constexpr size_t kMaxPrintAheadMemory = (size_t)384 * 1024 * 1024;
+#endif
+
+// at printer resolution, large format pages (e.g. A0 at 600 dpi) take gigabytes
+// which often fails or has to be retried at lower quality. Such pages are split
+// into horizontal bands on paper which are rendered and printed one by one
+static bool CanPrintAsVector(EngineBase& engine, PrintPageItem& item) {
+    if (!gGlobalPrefs->vectorPrinting) {
+        return false;
+    }
+    RectF* clipRegion = item.hasClip ? &item.clip : nullptr;
+    RenderPageArgs args(item.pageNo, item.zoom, item.rotation, clipRegion, RenderTarget::Print);
+    return engine.DrawPageOnDC(nullptr, args, item.offset);
+}
+
+static void AddPrintItem(Vec<PrintPageItem>& items, EngineBase& engine, PrintPageItem& item) {
+    RectF pageRect = item.hasClip ? item.clip : engine.PageMediabox(item.pageNo);
+    RectF full = engine.Transform(pageRect, item.pageNo, item.zoom, item.rotation);
+    Rect fullPx = full.Round();
+    size_t rowSize = (size_t)std::max(fullPx.dx, 1) * 4;
+    int bandDy = (int)std::max(kMaxPrintBandMemory / rowSize, (size_t)1);
+    if (fullPx.dy <= bandDy) {
+        items.Append(item);
+        return;
+    }
+    // vector graphics don't need that much memory and every band would repeat them
+    if (CanPrintAsVector(engine, item)) {
+        item.isVector = true;
+        items.Append(item);
+        return;
+    }
+
+    bool startsSheet = item.startsSheet;
+    for (int y = fullPx.y; y < fullPx.y + fullPx.dy; y += bandDy) {
+        int dy = std::min(bandDy, fullPx.y + fullPx.dy - y);
+        RectF band(full.x, (float)y, full.dx, (float)dy);
+        PrintPageItem part = item;
+        part.clip = engine.Transform(band, item.pageNo, item.zoom, item.rotation, true).Intersect(pageRect);
+        part.hasClip = true;
+        part.offset.y += y - fullPx.y;
+        part.startsSheet = startsSheet;
+        startsSheet = false;
+        items.Append(part);
+    }
+}
+
+// renders the pages of a print job on worker threads, in order and
+// ahead of the print thread which sends them to the printer. At most
+// maxBitmaps pages are rendered or waiting to be printed at a time
+struct PrintRenderer {
+    EngineBase* engine = nullptr;
+    Vec<PrintPageItem>* items = nullptr;
+    CRITICAL_SECTION access;
+    // signaled whenever a page has been rendered
+    HANDLE pageRendered = nullptr;
+    // counts the bitmaps that can still be rendered
+    HANDLE slots = nullptr;
+    int nextToRender = 0;
+    bool stop = false;
+    HANDLE threads[kMaxPrintRenderThreads]{};
+    int nThreads = 0;
+
+    PrintRenderer(EngineBase* engine, Vec<PrintPageItem>* items) {
+        this->engine = engine;
+        this->items = items;
+        InitializeCriticalSection(&access);
+    }
+    PrintRenderer(PrintRenderer const&) = delete;
+    PrintRenderer& operator=(PrintRenderer const&) = delete;
+    ~PrintRenderer();
+
+    void Start(int maxBitmaps);
+    RenderedBitmap* Take(int idx, ProgressUpdateUI* progressUI);
+    void FreeSlot();
+    void Stop();
+};
+
+static DWORD WINAPI PrintRenderThread(LPVOID data) {
+    PrintRenderer* r = (PrintRenderer*)data;
+    for (;;) {
+        WaitForSingleObject(r->slots, INFINITE);
+        PrintPageItem* item = nullptr;
+        {
+            ScopedCritSec scope(&r->access);
+            if (r->stop || r->nextToRender >= r->items->isize()) {
+                // let the other threads find out as well
+                ReleaseSemaphore(r->slots, 1, nullptr);
+                return 0;
+            }
+            item = &r->items->at(r->nextToRender++);
+        }
+        // such pages are drawn by the print thread
+        bool isVector = item->isVector || CanPrintAsVector(*r->engine, *item);
+        RenderedBitmap* bmp = nullptr;
+        if (!isVector) {
+            RectF* clipRegion = item->hasClip ? &item->clip : nullptr;
+            RenderPageArgs args(item->pageNo, item->zoom, item->rotation, clipRegion, RenderTarget::Print,
+                                &item->cookie);
+            bmp = r->engine->RenderPage(args);
+        }
+        {
+            ScopedCritSec scope(&r->access);
+            delete item->cookie;
+            item->cookie = nullptr;
+            item->bmp = bmp;
+            item->isVector = isVector;
+            item->isRendered = true;
+        }
+        SetEvent(r->pageRendered);
+    }
+}
+
+// with a single bitmap at a time, printing can't overlap
+// with rendering, so pages are rendered on the print thread
+void PrintRenderer::Start(int maxBitmaps) {
+    int n = std::clamp(std::min(GetPhysicalProcessorCount(), maxBitmaps - 1), 0, kMaxPrintRenderThreads);
+    if (n == 0) {
+        return;
+    }
+    pageRendered = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    slots = CreateSemaphoreW(nullptr, maxBitmaps, LONG_MAX, nullptr);
+    if (!pageRendered || !slots) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        HANDLE h = CreateThread(nullptr, 0, PrintRenderThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        threads[nThreads++] = h;
+    }
+    logf("PrintRenderer::Start: %d threads, %d pages at a time\n", nThreads, maxBitmaps);
+}
+
+// waits until page idx has been rendered and returns it (the caller
+// must delete it and call FreeSlot). Returns nullptr if rendering
+// failed or printing was canceled in the meantime
+RenderedBitmap* PrintRenderer::Take(int idx, ProgressUpdateUI* progressUI) {
+    if (nThreads == 0) {
+        return nullptr;
+    }
+    for (;;) {
+        {
+            ScopedCritSec scope(&access);
+            PrintPageItem& item = items->at(idx);
+            if (item.isRendered) {
+                RenderedBitmap* bmp = item.bmp;
+                item.bmp = nullptr;
+                return bmp;
+            }
+        }
+        if (progressUI && progressUI->WasCanceled()) {
+            Stop();
+            return nullptr;
+        }
+        WaitForSingleObject(pageRendered, 100);
+    }
+}
+
+void PrintRenderer::FreeSlot() {
+    if (nThreads > 0 && !stop) {
+        ReleaseSemaphore(slots, 1, nullptr);
+    }
+}
+
+void PrintRenderer::Stop() {
+    if (nThreads == 0) {
+        return;
+    }
+    {
+        ScopedCritSec scope(&access);
+        if (stop) {
+            return;
+        }
+        stop = true;
+        for (PrintPageItem& item : *items) {
+            if (item.cookie) {
+                item.cookie->Abort();
+            }
+        }
+    }
+    ReleaseSemaphore(slots, nThreads, nullptr);
+    WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+}
+
+PrintRenderer::~PrintRenderer() {
+    Stop();
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+    for (PrintPageItem& item : *items) {
+        delete item.bmp;
+        item.bmp = nullptr;
+    }
+    if (pageRendered) {
+        CloseHandle(pageRendered);
+    }
+    if (slots) {
+        CloseHandle(slots);
+    }
+    DeleteCriticalSection(&access);
+}
+
 static bool PrintToDevice(const PrintData& pd) {
     ReportIf(!pd.engine);
     if (!pd.engine) {
@@ -374,6 +603,7 @@ static bool PrintToDevice(const PrintData& pd) {
         bPrintPortrait = false;
     }
 
+    Vec<PrintPageItem> items;
     if (pd.sel.size() > 0) {
         for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
             RectF bounds = BoundSelectionOnPage(pd.sel, pageNo);
@@ -381,12 +611,6 @@ static bool PrintToDevice(const PrintData& pd) {
                 continue;
             }
 
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
-            }
-
-            StartPage(hdc);
-
             SizeF bSize = bounds.Size();
             float zoom = std::min((float)printable.dx / bSize.dx, (float)printable.dy / bSize.dy);
             // use the correct zoom values, if the page fits otherwise
@@ -397,6 +621,7 @@ static bool PrintToDevice(const PrintData& pd) {
                 zoom = dpiFactor;
             }
 
+            bool startsSheet = true;
             for (size_t i = 0; i < pd.sel.size(); i++) {
                 if (pd.sel.at(i).pageNo != pageNo) {
                     continue;
@@ -410,44 +635,18 @@ static bool PrintToDevice(const PrintData& pd) {
                     offset.y += (int)(printable.dy - bSize.dy * zoom) / 2;
                 }
 
-                bool ok = false;
-                short shrink = 1;
-                do {
-                    RenderPageArgs args(pd.sel.at(i).pageNo, zoom / shrink, pd.rotation, clipRegion,
-                                        RenderTarget::Print);
-                    if (abortCookie) {
-                        args.cookie_out = &abortCookie->cookie;
-                    }
-                    RenderedBitmap* bmp = engine.RenderPage(args);
-                    if (abortCookie) {
-                        abortCookie->Clear();
-                    }
-                    if (bmp && bmp->GetBitmap()) {
-                        Rect rc(offset.x, offset.y, bmp->Size().dx * shrink, bmp->Size().dy * shrink);
-                        ok = bmp->StretchDIBits(hdc, rc);
-                    }
-                    delete bmp;
-                    shrink *= 2;
-                } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-            }
-            // TODO: abort if !ok?
-
-            res = EndPage(hdc);
-            if (res <= 0 || (progressUI && progressUI->WasCanceled())) {
-                bool wasCancelled = progressUI && progressUI->WasCanceled();
-                logf("PrintToDevice: EndPage() failed with %d or wasCancelled: %d\n", res, (int)wasCancelled);
-                AbortDoc(hdc);
-                return false;
+                PrintPageItem item;
+                item.pageNo = pageNo;
+                item.zoom = zoom;
+                item.rotation = pd.rotation;
+                item.clip = *clipRegion;
+                item.hasClip = true;
+                item.offset = offset;
+                item.startsSheet = startsSheet;
+                AddPrintItem(items, engine, item);
+                startsSheet = false;
             }
-            current++;
         }
-
-        res = EndDoc(hdc);
-        if (res <= 0) {
-            logf("PrintToDevice: EndDoc() failed with %d\n", res);
-            return false;
-        }
-        return true;
     }
 
     // print all the pages the user requested
@@ -458,15 +657,6 @@ static bool PrintToDevice(const PrintData& pd) {
                 (PrintRangeAdv::Odd == pd.advData.range && pageNo % 2 == 0)) {
                 continue;
             }
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
-            }
-
-            res = StartPage(hdc);
-            if (res <= 0) {
-                logf("PrintToDevice: StartPage() failed with %d\n", res);
-                continue;
-            }
 
             SizeF pSize = engine.PageMediabox(pageNo).Size();
             int rotation = 0;
@@ -525,10 +715,77 @@ static bool PrintToDevice(const PrintData& pd) {
                 }
             }
 
+            PrintPageItem item;
+            item.pageNo = (int)pageNo;
+            item.zoom = zoom;
+            item.rotation = rotation;
+            item.offset = offset;
+            item.startsSheet = true;
+            AddPrintItem(items, engine, item);
+        }
+    }
+
+    // render the following pages while the current one is sent to the printer
+    PrintRenderer renderer(&engine, &items);
+    if (items.size() > 1) {
+        SizeF size = items[0].hasClip ? items[0].clip.Size() : engine.PageMediabox(items[0].pageNo).Size();
+        double bmpSize = (double)size.dx * items[0].zoom * (double)size.dy * items[0].zoom * 4;
+        int maxBitmaps = (int)std::clamp((double)kMaxPrintAheadMemory / std::max(bmpSize, 1.0), 1.0,
+                                         (double)kMaxPrintRenderThreads + 1);
+        renderer.Start(maxBitmaps);
+    }
+
+    int nItems = items.isize();
+    int i = 0;
+    while (i < nItems) {
+        int sheetEnd = i + 1;
+        while (sheetEnd < nItems && !items[sheetEnd].startsSheet) {
+            sheetEnd++;
+        }
+
+        if (progressUI) {
+            progressUI->UpdateProgress(current, total);
+        }
+
+        res = StartPage(hdc);
+        if (res <= 0) {
+            logf("PrintToDevice: StartPage() failed with %d\n", res);
+            for (; i < sheetEnd; i++) {
+                delete renderer.Take(i, progressUI);
+                renderer.FreeSlot();
+            }
+            continue;
+        }
+
+        for (; i < sheetEnd; i++) {
+            PrintPageItem& item = items[i];
             bool ok = false;
+            bool tryVector = gGlobalPrefs->vectorPrinting;
+            // if there are no render threads, the page is rendered here
             short shrink = 1;
-            do {
-                RenderPageArgs args(pageNo, zoom / shrink, rotation, nullptr, RenderTarget::Print);
+            if (renderer.nThreads > 0) {
+                RenderedBitmap* bmp = renderer.Take(i, progressUI);
+                tryVector = item.isVector;
+                if (bmp && bmp->GetBitmap()) {
+                    Rect rc(item.offset.x, item.offset.y, bmp->Size().dx, bmp->Size().dy);
+                    ok = bmp->StretchDIBits(hdc, rc);
+                }
+                delete bmp;
+                renderer.FreeSlot();
+                if (!tryVector) {
+                    shrink = 2;
+                }
+            }
+            if (tryVector && !(progressUI && progressUI->WasCanceled())) {
+                RectF* clipRegion = item.hasClip ? &item.clip : nullptr;
+                RenderPageArgs args(item.pageNo, item.zoom, item.rotation, clipRegion, RenderTarget::Print);
+                ok = engine.DrawPageOnDC(hdc, args, item.offset);
+            }
+            // e.g. the printer driver might not be able to handle
+            // bitmaps that big, so retry at lower resolutions
+            while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled())) {
+                RectF* clipRegion = item.hasClip ? &item.clip : nullptr;
+                RenderPageArgs args(item.pageNo, item.zoom / shrink, item.rotation, clipRegion, RenderTarget::Print);
                 if (abortCookie) {
                     args.cookie_out = &abortCookie->cookie;
                 }
@@ -538,23 +795,23 @@ static bool PrintToDevice(const PrintData& pd) {
                 }
                 if (bmp && bmp->GetBitmap()) {
                     auto size = bmp->Size();
-                    Rect rc(offset.x, offset.y, size.dx * shrink, size.dy * shrink);
+                    Rect rc(item.offset.x, item.offset.y, size.dx * shrink, size.dy * shrink);
                     ok = bmp->StretchDIBits(hdc, rc);
                 }
                 delete bmp;
                 shrink *= 2;
-            } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
+            }
             // TODO: abort if !ok?
+        }
 
-            res = EndPage(hdc);
-            if (res <= 0 || (progressUI && progressUI->WasCanceled())) {
-                bool wasCancelled = progressUI && progressUI->WasCanceled();
-                logf("PrintToDevice: EndPage() failed with %d or wasCancelled: %d\n", res, (int)wasCancelled);
-                AbortDoc(hdc);
-                return false;
-            }
-            current++;
+        res = EndPage(hdc);
+        if (res <= 0 || (progressUI && progressUI->WasCanceled())) {
+            bool wasCancelled = progressUI && progressUI->WasCanceled();
+            logf("PrintToDevice: EndPage() failed with %d or wasCancelled: %d\n", res, (int)wasCancelled);
+            AbortDoc(hdc);
+            return false;
         }
+        current++;
     }
 
     res = EndDoc(hdc);
@@ -2,12 +2,56 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "RegistrySearchFilter.h"
 
 #include "utils/Log.h"
 
+static const char* kSearchFilterLimitNames[] = {"MaxFileSizeMB", "MaxPages", "MaxTextChars", "MaxSeconds"};
+
+static DWORD* GetSearchFilterLimits(SearchFilterBudget& budget, int i) {
+    DWORD* limits[] = {&budget.maxFileSizeMB, &budget.maxPages, &budget.maxTextChars, &budget.maxSeconds};
+    return limits[i];
+}
+
+void SearchFilterBudget::Start() {
+    for (int i = 0; i < dimof(kSearchFilterLimitNames); i++) {
+        DWORD val;
+        // the search host doesn't run as the user, so per-machine limits take precedence
+        if (ReadRegDWORD(HKEY_LOCAL_MACHINE, kSearchFilterLimitsKey, kSearchFilterLimitNames[i], val) ||
+            ReadRegDWORD(HKEY_CURRENT_USER, kSearchFilterLimitsKey, kSearchFilterLimitNames[i], val)) {
+            *GetSearchFilterLimits(*this, i) = val;
+        }
+    }
+    startTime = TimeGet();
+}
+
+bool SearchFilterBudget::IsFileTooBig(i64 size) const {
+    return maxFileSizeMB != 0 && size > (i64)maxFileSizeMB * 1024 * 1024;
+}
+
+bool SearchFilterBudget::IsStreamTooBig(IStream* stream) const {
+    STATSTG stat{};
+    if (FAILED(stream->Stat(&stat, STATFLAG_NONAME))) {
+        return false;
+    }
+    return IsFileTooBig((i64)stat.cbSize.QuadPart);
+}
+
+bool SearchFilterBudget::IsOverPages(int pageNo) const {
+    return maxPages != 0 && pageNo > (int)maxPages;
+}
+
+bool SearchFilterBudget::IsOverTextChars(i64 nChars) const {
+    return maxTextChars != 0 && nChars >= (i64)maxTextChars;
+}
+
+bool SearchFilterBudget::IsOverTime() const {
+    return maxSeconds != 0 && TimeSinceInMs(startTime) > maxSeconds * 1000.0;
+}
+
 bool InstallSearchFiler(const char* dllPath, bool allUsers) {
     struct {
         const char *key, *value, *data;
@@ -54,6 +98,16 @@ bool InstallSearchFiler(const char* dllPath, bool allUsers) {
             return false;
         }
     }
+    // write the default limits so that they're easy to find and change
+    // but keep the ones that have been customized when re-installing
+    SearchFilterBudget defaults;
+    for (int i = 0; i < dimof(kSearchFilterLimitNames); i++) {
+        DWORD val;
+        if (!ReadRegDWORD(hkey, kSearchFilterLimitsKey, kSearchFilterLimitNames[i], val)) {
+            LoggedWriteRegDWORD(hkey, kSearchFilterLimitsKey, kSearchFilterLimitNames[i],
+                                *GetSearchFilterLimits(defaults, i));
+        }
+    }
     return true;
 }
 
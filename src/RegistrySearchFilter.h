@@ -10,6 +10,30 @@
 #define kEpubFilterClsid "{FE4C7847-4260-43e3-A449-08ED76009F94}"
 #define kEpubFilterHandler "{FF68D1A0-DA54-4fbf-A406-06CFDB764CA9}"
 
+// limits for indexing a single document, so that pathological documents (huge scans,
+// zip bombs) don't get the search host killed. Stored as DWORD values under this key
+// (relative to HKLM or HKCU), 0 means no limit
+#define kSearchFilterLimitsKey "Software\\Classes\\CLSID\\" kPdfFilterClsid "\\Limits"
+
+struct SearchFilterBudget {
+    // applies to the file and, for EPUB, to the uncompressed size of its content
+    DWORD maxFileSizeMB = 256;
+    DWORD maxPages = 5000;
+    DWORD maxTextChars = 16 * 1024 * 1024;
+    DWORD maxSeconds = 60;
+
+    // set by Start()
+    LARGE_INTEGER startTime{};
+
+    // reads the limits from the registry and starts the clock
+    void Start();
+    bool IsFileTooBig(i64 size) const;
+    bool IsStreamTooBig(IStream* stream) const;
+    bool IsOverPages(int pageNo) const;
+    bool IsOverTextChars(i64 nChars) const;
+    bool IsOverTime() const;
+};
+
 bool InstallSearchFiler(const char* dllPath, bool allUsers);
 bool UninstallSearchFilter();
 bool IsSearchFilterInstalled();
\ No newline at end of file
@@ -3,8 +3,10 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/WinDynCalls.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
@@ -15,8 +17,12 @@
 #include "DisplayModel.h"
 #include "GlobalPrefs.h"
 #include "RenderCache.h"
+#include "RenderWorker.h"
+#include "TileCache.h"
 #include "TextSelection.h"
 
+#include <d2d1.h>
+
 #define NO_LOG
 #include "utils/Log.h"
 
@@ -30,6 +36,13 @@
 
 bool gShowTileLayout = false;
 
+// placeholders are rendered at this fraction of the zoom (1/16 of the pixels)
+constexpr float kPlaceholderZoomFactor = 0.25f;
+// pages are split into more tiles until a tile is expected to render faster than this (in ms)
+constexpr float kSlowTileMs = 100;
+// but into at most 16 times as many tiles as their size requires
+constexpr USHORT kMaxExtraTileRes = 2;
+
 RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)}) {
     // enable when debugging RenderCache logic
     // gEnableDbgLog = true;
@@ -41,41 +54,93 @@ RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSyst
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
 
-    startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, nullptr);
-    CrashIf(nullptr == renderThread);
+    startRendering = CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr);
 }
 
 RenderCache::~RenderCache() {
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    bool isRendering = false;
+    for (int i = 0; i < nRenderThreads; i++) {
+        CloseHandle(renderThreads[i]);
+        isRendering |= (curReqs[i] != nullptr);
+    }
     CloseHandle(startRendering);
-    if (curReq || 0 != requestCount || cacheCount != 0) {
-        logf("RenderCache::~RenderCache: curReq: 0x%p, requestCount: %d, cacheCount: %d\n", curReq, requestCount,
-             cacheCount);
+    if (isRendering || 0 != requestCount || 0 != thumbnailRequestCount || cache.size() != 0) {
+        logf("RenderCache::~RenderCache: isRendering: %d, requestCount: %d, thumbnailRequestCount: %d, "
+             "cacheCount: %d\n",
+             (int)isRendering, requestCount, thumbnailRequestCount, cache.isize());
         ReportIf(true);
     }
 
+    ReleaseD2DTarget();
+    if (d2dFactory) {
+        d2dFactory->Release();
+    }
+    if (paintDC) {
+        DeleteDC(paintDC);
+    }
+
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
     LeaveCriticalSection(&requestAccess);
     DeleteCriticalSection(&requestAccess);
 }
 
+BitmapCacheEntry::~BitmapCacheEntry() {
+    // the factory is multi-threaded, so this is fine
+    // on a render thread as well
+    if (d2dBitmap) {
+        d2dBitmap->Release();
+    }
+    if (savedToTileCache) {
+        DeleteTileSavedToCache(bitmap);
+    } else {
+        delete bitmap;
+    }
+}
+
+// must be called within cacheAccess
+BitmapCacheEntry** RenderCache::GetIndexBucket(DisplayModel* dm, int pageNo) {
+    uintptr_t h = (uintptr_t)dm;
+    h ^= h >> 9;
+    h = h * 31 + (uintptr_t)pageNo;
+    return &index[h % CACHE_INDEX_BUCKETS];
+}
+
+void RenderCache::AddToIndex(BitmapCacheEntry* entry) {
+    BitmapCacheEntry** bucket = GetIndexBucket(entry->dm, entry->pageNo);
+    entry->nextInBucket = *bucket;
+    *bucket = entry;
+}
+
+void RenderCache::RemoveFromIndex(BitmapCacheEntry* entry) {
+    BitmapCacheEntry** curr = GetIndexBucket(entry->dm, entry->pageNo);
+    while (*curr) {
+        if (*curr == entry) {
+            *curr = entry->nextInBucket;
+            entry->nextInBucket = nullptr;
+            return;
+        }
+        curr = &(*curr)->nextInBucket;
+    }
+    CrashIf(true);
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* e = cache[i];
+    BitmapCacheEntry* e = *GetIndexBucket(dm, pageNo);
+    for (; e; e = e->nextInBucket) {
         if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
             (kInvalidZoom == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
             e->refs++;
-            CrashIf(i != e->cacheIdx);
+            e->lastUsed = ++useCounter;
+            CrashIf(cache[e->cacheIdx] != e);
             return e;
         }
     }
@@ -98,8 +163,8 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     }
     int idx = entry->cacheIdx;
     CrashIf(idx < 0);
-    CrashIf(idx >= cacheCount);
-    if ((idx < 0) || (idx >= cacheCount)) {
+    CrashIf(idx >= cache.isize());
+    if ((idx < 0) || (idx >= cache.isize())) {
         return false;
     }
     CrashIf(entry->refs <= 0);
@@ -112,76 +177,166 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     logf("RenderCache::DropCacheEntry: pageNo: %d, rotation: %d, zoom: %.2f\n", entry->pageNo, entry->rotation,
          entry->zoom);
 
+    CrashIf(cacheSize < entry->size);
+    cacheSize -= entry->size;
+    RemoveFromIndex(entry);
     delete entry;
 
     // fast removal by replacing freed item with the item at the end
-    cache[idx] = nullptr;
-    int lastIdx = cacheCount - 1;
-    if ((lastIdx >= 0) && (idx != lastIdx)) {
-        cache[idx] = cache[lastIdx];
+    cache.RemoveAtFast(idx);
+    if (idx < cache.isize()) {
         cache[idx]->cacheIdx = idx;
-        cache[lastIdx] = nullptr;
     }
-    cacheCount--;
-    CrashIf(cacheCount < 0);
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
-    int n = rc->cacheCount;
-    if (n < MAX_BITMAPS_CACHED) {
-        return true;
+static size_t GetBitmapMemorySize(RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    if (!hbmp) {
+        return 0;
     }
+    BITMAP info{};
+    if (!GetObject(hbmp, sizeof(info), &info)) {
+        Size size = bmp->Size();
+        return (size_t)size.dx * (size_t)size.dy * 4;
+    }
+    return (size_t)info.bmWidthBytes * (size_t)info.bmHeight;
+}
 
-    DisplayModel* dm = req.dm;
-    // free an invisible page of the same DisplayModel ...
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm && !dm->PageVisibleNearby(entry->pageNo)) {
-            bool didDrop = rc->DropCacheEntry(entry);
-            if (didDrop) {
-                return true;
-            }
-        }
+// limit based on amount of physical memory, unless set by the user
+static size_t CalcMaxCacheSize() {
+    constexpr size_t kMB = 1024 * 1024;
+    int sizeMB = gGlobalPrefs ? gGlobalPrefs->renderCacheSize : 0;
+    if (sizeMB > 0) {
+        return (size_t)sizeMB * kMB;
+    }
+    u64 size = 256 * kMB;
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) {
+        size = ms.ullTotalPhys / 16;
     }
+    // 32-bit processes are constrained by address space
+    u64 maxSize = IsProcess64() ? 2048 * kMB : 384 * kMB;
+    size = std::clamp(size, (u64)64 * kMB, maxSize);
+    return (size_t)size;
+}
 
-    // ... or just the oldest cached page
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm) {
-            // don't free pages from the document we're currently displaying
-            // as it leads to flicker
-            // TODO: it can still flicker if the dm is from a visible tab
-            // in a different window, but it's harder to detect
-            continue;
+// the higher the score, the better candidate for eviction
+static int GetEvictionScore(BitmapCacheEntry* entry, DisplayModel* dm) {
+    if (entry->refs > 1) {
+        // currently being used e.g. painted
+        return -1;
+    }
+    DisplayModel* edm = entry->dm;
+    bool isNearby = edm->PageVisibleNearby(entry->pageNo);
+    if (isNearby && edm == dm && !entry->outOfDate) {
+        // don't free pages from the document we're currently displaying
+        // as it leads to flicker
+        // TODO: it can still flicker if the dm is from a visible tab
+        // in a different window, but it's harder to detect
+        return -1;
+    }
+    if (edm->IsPresentationSlide(entry->pageNo) && !entry->outOfDate &&
+        entry->zoom == edm->GetZoomReal(entry->pageNo)) {
+        // slides rendered ahead of time for a presentation, even if
+        // a different document is currently being rendered
+        return -1;
+    }
+    int score = 0;
+    if (!isNearby) {
+        score += 8;
+    }
+    if (entry->outOfDate) {
+        score += 4;
+    }
+    // a low resolution tile or a left-over from a different zoom level
+    if (entry->zoom != edm->GetZoomReal(entry->pageNo)) {
+        score += 2;
+    }
+    if (edm != dm) {
+        score += 1;
+    }
+    return score;
+}
+
+// free entries until there's enough space for a new bitmap of a given size
+static void FreeIfFull(RenderCache* rc, const PageRenderRequest& req, size_t newSize) {
+    for (;;) {
+        int n = rc->cache.isize();
+        bool isFull = (rc->cacheSize + newSize > rc->maxCacheSize) || (n >= MAX_BITMAPS_CACHED);
+        if (!isFull) {
+            return;
+        }
+        BitmapCacheEntry* toFree = nullptr;
+        int bestScore = -1;
+        for (auto entry : rc->cache) {
+            int score = GetEvictionScore(entry, req.dm);
+            if (score < 0) {
+                continue;
+            }
+            // for the same score prefer least recently used
+            if (score > bestScore || (score == bestScore && entry->lastUsed < toFree->lastUsed)) {
+                bestScore = score;
+                toFree = entry;
+            }
         }
-        bool didDrop = rc->DropCacheEntry(entry);
-        if (didDrop) {
-            return true;
+        if (!toFree) {
+            // everything in the cache is needed. We'll temporarily go over the limit
+            // rather than render the same pages over and over
+            logf("RenderCache: over limit, cacheSize: %d, count: %d\n", (int)rc->cacheSize, n);
+            return;
         }
+        rc->DropCacheEntry(toFree);
     }
-    return false;
 }
 
-void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
+// only full quality tiles of documents that haven't been changed in memory are saved
+static bool GetTileCacheKey(RenderCache* rc, const PageRenderRequest& req, TileCacheKey* key) {
+    if (req.renderCb || req.isPlaceholder || req.draft || EngineHasUnsavedAnnotations(req.dm->GetEngine())) {
+        return false;
+    }
+    memcpy(key->docDigest, req.dm->tileCacheDigest, sizeof(key->docDigest));
+    key->pageNo = req.pageNo;
+    key->rotation = NormalizeRotation(req.rotation);
+    key->zoom = req.zoom;
+    key->res = req.tile.res;
+    key->row = req.tile.row;
+    key->col = req.tile.col;
+    key->textColor = rc->textColor;
+    key->backgroundColor = rc->backgroundColor;
+    return true;
+}
+
+void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp, bool saveToTileCache) {
+    TIME_TRACE_PAGE("RenderCacheAdd", req.pageNo);
+    TileCacheKey tileKey;
+    saveToTileCache = saveToTileCache && bmp && GetTileCacheKey(this, req, &tileKey);
     ScopedCritSec scope(&cacheAccess);
     CrashIf(!req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
-    CrashIf(cacheCount > MAX_BITMAPS_CACHED);
+    if (maxCacheSize == 0) {
+        maxCacheSize = CalcMaxCacheSize();
+    }
 
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    bool hasSpace = FreeIfFull(this, req);
-    CrashIf(!hasSpace); // TODO: FreeIfFull() might actually fail to free
-    CrashIf(cacheCount > MAX_BITMAPS_CACHED);
+    size_t size = GetBitmapMemorySize(bmp);
+    FreeIfFull(this, req, size);
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
-    entry->cacheIdx = cacheCount;
-    cache[cacheCount] = entry;
-    cacheCount++;
+    entry->draft = req.draft;
+    // under cacheAccess so that the entry isn't deleted before savedToTileCache is set
+    entry->savedToTileCache = saveToTileCache && SaveTileToCache(tileKey, bmp);
+    entry->size = size;
+    entry->lastUsed = ++useCounter;
+    entry->cacheIdx = cache.isize();
+    cache.Append(entry);
+    AddToIndex(entry);
+    cacheSize += size;
 }
 
 static RectF GetTileRect(RectF pagerect, TilePosition tile) {
@@ -244,13 +399,12 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
     logf("RenderCache::FreePage: dm: 0x%p, pageNo: %d\n", dm, pageNo);
     ScopedCritSec scope(&cacheAccess);
 
-    // must go from end becaues freeing changes the cache
-    for (int i = cacheCount - 1; i >= 0; i--) {
-        BitmapCacheEntry* entry = cache[i];
-        bool shouldFree;
-        if (dm && pageNo != kInvalidPageNo) {
-            // a specific page
-            shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
+    if (dm && pageNo != kInvalidPageNo) {
+        // a specific page: only need to look at its index bucket
+        Vec<BitmapCacheEntry*> toFree;
+        BitmapCacheEntry* entry = *GetIndexBucket(dm, pageNo);
+        for (; entry; entry = entry->nextInBucket) {
+            bool shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
             if (tile) {
                 // a given tile of the page or all tiles not rendered at a given resolution
                 // (and at resolution 0 for quick zoom previews)
@@ -259,7 +413,21 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
                                    tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
                                    tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
             }
-        } else if (dm) {
+            if (shouldFree) {
+                toFree.Append(entry);
+            }
+        }
+        for (auto e : toFree) {
+            DropCacheEntry(e);
+        }
+        return;
+    }
+
+    // must go from end becaues freeing changes the cache
+    for (int i = cache.isize() - 1; i >= 0; i--) {
+        BitmapCacheEntry* entry = cache[i];
+        bool shouldFree;
+        if (dm) {
             // all pages of this DisplayModel
             shouldFree = (entry->dm == dm);
         } else {
@@ -277,6 +445,8 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
 
 void RenderCache::FreeForDisplayModel(DisplayModel* dm) {
     FreePage(dm);
+    // the tiles of the next document most likely have different sizes
+    FreePooledMemoryBitmaps();
 }
 
 void RenderCache::FreeNotVisible() {
@@ -284,16 +454,25 @@ void RenderCache::FreeNotVisible() {
 }
 
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
-// mark invisible pages as out-of-date to prevent inconsistencies
-void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
+// mark invisible pages as out-of-date to prevent inconsistencies.
+// Bitmaps of pages that didn't change are kept as they are
+void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm, const Vec<bool>* unchangedPages) {
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* entry = cache[i];
+    for (BitmapCacheEntry* entry : cache) {
         if (entry->dm != oldDm) {
             continue;
         }
+        int pageIdx = entry->pageNo - 1;
+        if (unchangedPages && pageIdx < unchangedPages->isize() && unchangedPages->at(pageIdx)) {
+            RemoveFromIndex(entry);
+            entry->dm = newDm;
+            AddToIndex(entry);
+            continue;
+        }
         if (oldDm->PageVisible(entry->pageNo)) {
+            RemoveFromIndex(entry);
             entry->dm = newDm;
+            AddToIndex(entry);
         }
         // make sure that the page is rerendered eventually
         entry->zoom = kInvalidZoom;
@@ -306,24 +485,33 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo) {
-        AbortCurrentRequest();
-    }
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
-    RectF mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    EngineBase* engine = dm->GetEngine();
+    RectF mediabox = engine->PageMediabox(pageNo);
+    for (auto e = *GetIndexBucket(dm, pageNo); e; e = e->nextInBucket) {
         if (e->dm == dm && e->pageNo == pageNo && !GetTileRect(mediabox, e->tile).Intersect(rect).IsEmpty()) {
             e->zoom = kInvalidZoom;
             e->outOfDate = true;
         }
     }
+    if (!IsEngineShared(engine)) {
+        return;
+    }
+    // the page changed for the other DisplayModels of this engine as well
+    for (BitmapCacheEntry* e : cache) {
+        if (e->dm != dm && e->pageNo == pageNo && e->dm->GetEngine() == engine &&
+            !GetTileRect(mediabox, e->tile).Intersect(rect).IsEmpty()) {
+            e->zoom = kInvalidZoom;
+            e->outOfDate = true;
+        }
+    }
 }
 
 // determine the count of tiles required for a page at a given zoom level
-USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) const {
+USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     auto engine = dm->GetEngine();
     RectF mediabox = engine->PageMediabox(pageNo);
     float zoom = dm->GetZoomReal(pageNo);
@@ -352,15 +540,44 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) const {
         res = (USHORT)ceilf(log(factorAvg) / log(2.0f));
     }
     // limit res to 30, so that (1 << res) doesn't overflow for 32-bit signed int
-    return std::min(res, (USHORT)30);
+    res = std::min(res, (USHORT)30);
+
+    // split pages that are slow to render into more tiles, so that they're rendered
+    // in parallel and painted as they become available (only helps if tiles don't
+    // have to render the whole page)
+    // (except for presentation slides, which are rendered ahead of time
+    // and should be a single tile for the whole screen)
+    float renderCost = dm->GetRenderCost(pageNo);
+    if (renderCost <= 0 || nRenderThreads < 2 || !engine->HasClipOptimizations(pageNo) ||
+        dm->IsPresentationSlide(pageNo)) {
+        return res;
+    }
+    float tileMs = renderCost * (pixelbox.dx / 1000.f) * (pixelbox.dy / 1000.f) / (float)(1ULL << (2 * res));
+    USHORT costRes = res;
+    while (tileMs > kSlowTileMs && costRes < res + kMaxExtraTileRes && costRes < 30 &&
+           (1 << (2 * (costRes - res + 1))) <= 2 * nRenderThreads) {
+        costRes++;
+        tileMs /= 4;
+    }
+    if (costRes == res) {
+        return res;
+    }
+    // don't re-render a page with more tiles if it's already been rendered at this zoom
+    ScopedCritSec scope(&cacheAccess);
+    for (auto e = *GetIndexBucket(dm, pageNo); e; e = e->nextInBucket) {
+        if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation && e->zoom == zoom && e->tile.res >= res &&
+            e->tile.res < costRes) {
+            return e->tile.res;
+        }
+    }
+    return costRes;
 }
 
 // get the maximum resolution available for the given page
 USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        auto e = cache[i];
+    for (auto e = *GetIndexBucket(dm, pageNo); e; e = e->nextInBucket) {
         if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation) {
             maxRes = std::max(e->tile.res, maxRes);
         }
@@ -385,13 +602,13 @@ bool RenderCache::ReduceTileSize() {
     }
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0) {
+    while (cache.size() > 0) {
         FreeForDisplayModel(cache[0]->dm);
     }
     while (requestCount > 0) {
         ClearQueueForDisplayModel(requests[0].dm);
     }
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
@@ -399,8 +616,10 @@ bool RenderCache::ReduceTileSize() {
 void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
     TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
     // only honor the request if there's a good chance that the
-    // rendered tile will actually be used
+    // rendered tile will actually be used (a coarse version of
+    // the whole page will be)
     if (tile.res > 1) {
+        RequestPlaceholder(dm, pageNo);
         return;
     }
 
@@ -411,6 +630,54 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
         tile.col = 1;
         RequestRendering(dm, pageNo, tile, false);
     }
+    // a slide that's rendered ahead of time isn't shown until it's fully rendered
+    if (dm->IsPresentationSlide(pageNo) && !dm->PageVisible(pageNo)) {
+        return;
+    }
+    // if there's nothing to show for the page yet, render a coarse version first. It's
+    // the most recent request, so it's rendered first and the engine can re-use
+    // the page's display list for rendering at the right zoom afterwards
+    RequestPlaceholder(dm, pageNo);
+}
+
+// quickly renders the whole page at a fraction of its zoom, so that there's something
+// to show (scaled up) for pages until they've been rendered or for pages that are
+// scrolled into view faster than they can be rendered. Like quick zoom previews,
+// it's kept as a tile of resolution 0
+void RenderCache::RequestPlaceholder(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    CrashIf(!dm);
+    if (!dm || dm->dontRenderFlag) {
+        return;
+    }
+
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo);
+    if (Exists(dm, pageNo, rotation)) {
+        // Paint() already has something to show for the page (if
+        // need be, scaled from a different zoom)
+        return;
+    }
+    TilePosition tile(0, 0, 0);
+
+    zoom *= kPlaceholderZoomFactor;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (curReq && curReq->dm == dm && curReq->pageNo == pageNo && curReq->tile == tile && curReq->zoom == zoom) {
+            return;
+        }
+    }
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* req = &(requests[i]);
+        if (req->dm == dm && req->pageNo == pageNo && req->tile == tile && req->zoom == zoom) {
+            return;
+        }
+    }
+
+    if (Render(dm, pageNo, rotation, zoom, &tile)) {
+        requests[requestCount - 1].isPlaceholder = true;
+        requests[requestCount - 1].draft = true;
+    }
 }
 
 /* Render a bitmap for page <pageNo> in <dm>. */
@@ -425,14 +692,21 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (!curReq || (curReq->pageNo != pageNo) || (curReq->dm != dm) || !(curReq->tile == tile)) {
+            continue;
+        }
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -461,15 +735,65 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         }
     }
 
-    if (Exists(dm, pageNo, rotation, zoom, &tile)) {
-        /* This page has already been rendered in the correct dimensions
-           and isn't about to be rerendered in different dimensions */
+    // while scrolling or zooming, tiles are rendered in draft quality and
+    // rendered again in full quality once the view has settled
+    bool draft = dm->IsInMotion();
+    BitmapCacheEntry* entry = Find(dm, pageNo, rotation, zoom, &tile);
+    if (entry) {
+        bool replaceDraft = entry->draft && !draft;
+        DropCacheEntry(entry);
+        if (!replaceDraft) {
+            /* This page has already been rendered in the correct dimensions
+               and isn't about to be rerendered in different dimensions */
+            return;
+        }
+    }
+
+    if (CopyFromSharedEngine(dm, pageNo, rotation, zoom, tile)) {
+        dm->RepaintDisplay();
         return;
     }
 
-    Render(dm, pageNo, rotation, zoom, &tile);
+    if (Render(dm, pageNo, rotation, zoom, &tile)) {
+        requests[requestCount - 1].draft = draft;
+    }
+}
+
+// a document shown in several tabs or windows has a single engine (see AcquireSharedEngine),
+// so a tile rendered for another DisplayModel can be copied instead of rendered again
+bool RenderCache::CopyFromSharedEngine(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile) {
+    EngineBase* engine = dm->GetEngine();
+    if (!IsEngineShared(engine)) {
+        return false;
+    }
+    RenderedBitmap* bmp = nullptr;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        for (BitmapCacheEntry* e : cache) {
+            if (e->dm == dm || e->outOfDate || e->draft || e->dm->GetEngine() != engine) {
+                continue;
+            }
+            if (e->pageNo == pageNo && e->rotation == rotation && e->zoom == zoom && e->tile == tile) {
+                bmp = e->bitmap->Clone();
+                break;
+            }
+        }
+    }
+    if (!bmp) {
+        return false;
+    }
+    PageRenderRequest req;
+    req.dm = dm;
+    req.pageNo = pageNo;
+    req.rotation = rotation;
+    req.zoom = zoom;
+    req.tile = tile;
+    Add(req, bmp);
+    return true;
 }
 
+static int GetRequestPriority(PageRenderRequest* req);
+
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect,
                          RenderingCallback& callback) {
     bool ok = Render(dm, pageNo, rotation, zoom, nullptr, &pageRect, &callback);
@@ -492,15 +816,28 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     }
 
     ScopedCritSec scope(&requestAccess);
+    if (nRenderThreads == 0) {
+        StartRenderThreads();
+    }
     PageRenderRequest* newRequest;
 
     /* add request to the queue */
     if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb) {
-            requests[0].renderCb->Callback();
+        /* queue is full -> remove the oldest of the least important items on the queue */
+        int dropIdx = 0;
+        int dropPriority = GetRequestPriority(&requests[0]);
+        for (int i = 1; i < requestCount && dropPriority > 0; i++) {
+            int priority = GetRequestPriority(&requests[i]);
+            if (priority < dropPriority) {
+                dropIdx = i;
+                dropPriority = priority;
+            }
+        }
+        if (requests[dropIdx].renderCb) {
+            requests[dropIdx].renderCb->Callback();
         }
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
+        memmove(&(requests[dropIdx]), &(requests[dropIdx + 1]),
+                sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - dropIdx - 1));
         newRequest = &(requests[MAX_PAGE_REQUESTS - 1]);
     } else {
         newRequest = &(requests[requestCount]);
@@ -525,18 +862,88 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
+    newRequest->queuedTime = TimeGet();
     newRequest->renderCb = renderCb;
+    newRequest->isThumbnail = false;
+    newRequest->isPlaceholder = false;
+    newRequest->draft = false;
 
-    SetEvent(startRendering);
+    ReleaseSemaphore(startRendering, 1, nullptr);
 
     return true;
 }
 
+/* Render the whole page <pageNo> of <dm> at a (small) zoom for a thumbnail. The callback
+   always gets called, with nullptr if the request was dropped. The most recent requests
+   are rendered first because they're most likely for thumbnails that are visible */
+void RenderCache::RenderThumbnail(DisplayModel* dm, int pageNo, float zoom, RenderingCallback* callback) {
+    CrashIf(!dm || !callback);
+    if (!dm || dm->dontRenderFlag) {
+        callback->Callback();
+        return;
+    }
+
+    ScopedCritSec scope(&requestAccess);
+    if (nRenderThreads == 0) {
+        StartRenderThreads();
+    }
+    PageRenderRequest* newRequest;
+    if (thumbnailRequestCount == MAX_THUMBNAIL_REQUESTS) {
+        // queue is full -> drop the oldest request
+        thumbnailRequests[0].renderCb->Callback();
+        memmove(&(thumbnailRequests[0]), &(thumbnailRequests[1]),
+                sizeof(PageRenderRequest) * (MAX_THUMBNAIL_REQUESTS - 1));
+        newRequest = &(thumbnailRequests[MAX_THUMBNAIL_REQUESTS - 1]);
+    } else {
+        newRequest = &(thumbnailRequests[thumbnailRequestCount]);
+        thumbnailRequestCount++;
+    }
+
+    int rotation = NormalizeRotation(dm->GetRotation());
+    newRequest->dm = dm;
+    newRequest->pageNo = pageNo;
+    newRequest->rotation = rotation;
+    newRequest->zoom = zoom;
+    newRequest->tile = TilePosition();
+    newRequest->pageRect = dm->GetEngine()->PageMediabox(pageNo);
+    newRequest->abort = false;
+    newRequest->abortCookie = nullptr;
+    newRequest->timestamp = GetTickCount();
+    newRequest->queuedTime = TimeGet();
+    newRequest->renderCb = callback;
+    newRequest->isThumbnail = true;
+    newRequest->draft = false;
+
+    ReleaseSemaphore(startRendering, 1, nullptr);
+}
+
+void RenderCache::ClearThumbnailQueue(DisplayModel* dm, int firstPage, int lastPage) {
+    ScopedCritSec scope(&requestAccess);
+    int curPos = 0;
+    for (int i = 0; i < thumbnailRequestCount; i++) {
+        PageRenderRequest* req = &(thumbnailRequests[i]);
+        bool shouldRemove = req->dm == dm && (firstPage == kInvalidPageNo || req->pageNo < firstPage ||
+                                              req->pageNo > lastPage);
+        if (shouldRemove) {
+            req->renderCb->Callback();
+            continue;
+        }
+        if (i != curPos) {
+            thumbnailRequests[curPos] = *req;
+        }
+        curPos++;
+    }
+    thumbnailRequestCount = curPos;
+}
+
 int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
-        return GetTickCount() - curReq->timestamp;
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
+            return GetTickCount() - curReq->timestamp;
+        }
     }
 
     for (int i = 0; i < requestCount; i++) {
@@ -548,33 +955,98 @@ int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile)
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
+// visible > nearby > prefetch
+static int GetRequestPriority(PageRenderRequest* req) {
+    if (req->renderCb) {
+        // explicitly requested e.g. for a thumbnail
+        return 2;
+    }
+    DisplayModel* dm = req->dm;
+    if (dm->PageVisible(req->pageNo)) {
+        if (IsTileVisible(dm, req->pageNo, req->tile)) {
+            return 2;
+        }
+        return 1;
+    }
+    if (dm->IsPresentationSlide(req->pageNo)) {
+        // the next slide should be ready before it's needed
+        return 2;
+    }
+    if (dm->PageVisibleNearby(req->pageNo)) {
+        return 1;
+    }
+    return 0;
+}
+
+// the result of rendering would be discarded because the
+// page has been zoomed or rotated since the request was made
+static bool IsRequestOutdated(PageRenderRequest* req) {
+    if (req->renderCb) {
+        return false;
+    }
+    DisplayModel* dm = req->dm;
+    float zoom = dm->GetZoomReal(req->pageNo);
+    if (req->isPlaceholder) {
+        zoom *= kPlaceholderZoomFactor;
+    }
+    return req->rotation != dm->GetRotation() || req->zoom != zoom;
+}
+
+// picks the most important request. For requests of the same priority
+// we prefer the most recent ones and those for the document the thread
+// has rendered last (its caches are likely warm)
+bool RenderCache::GetNextRequest(PageRenderRequest* req, int threadIdx, DisplayModel* prevDm) {
     ScopedCritSec scope(&requestAccess);
 
     if (requestCount == 0) {
-        return false;
+        // thumbnails only when there's nothing else to do, most recent first
+        if (thumbnailRequestCount == 0) {
+            return false;
+        }
+        thumbnailRequestCount--;
+        *req = thumbnailRequests[thumbnailRequestCount];
+        curReqs[threadIdx] = req;
+        return true;
     }
 
     CrashIf(requestCount < 0);
     CrashIf(requestCount > MAX_PAGE_REQUESTS);
+
+    int bestIdx = -1;
+    int bestScore = -1;
+    for (int i = requestCount - 1; i >= 0; i--) {
+        PageRenderRequest* r = &requests[i];
+        int score = GetRequestPriority(r) * 2;
+        if (r->dm == prevDm) {
+            score++;
+        }
+        if (score > bestScore) {
+            bestScore = score;
+            bestIdx = i;
+        }
+    }
+
+    *req = requests[bestIdx];
+    int nToMove = requestCount - bestIdx - 1;
+    if (nToMove > 0) {
+        memmove(&(requests[bestIdx]), &(requests[bestIdx + 1]), sizeof(PageRenderRequest) * nToMove);
+    }
     requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
+    curReqs[threadIdx] = req;
     CrashIf(requestCount < 0);
     CrashIf(req->abort);
 
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
+void RenderCache::ClearCurrentRequest(int threadIdx) {
     ScopedCritSec scope(&requestAccess);
+    PageRenderRequest* curReq = curReqs[threadIdx];
     if (curReq) {
         delete curReq->abortCookie;
+        curReq->abortCookie = nullptr;
     }
-    curReq = nullptr;
-
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
+    curReqs[threadIdx] = nullptr;
 }
 
 /* Wait until rendering of a page beloging to <dm> has finished. */
@@ -582,17 +1054,23 @@ bool RenderCache::ClearCurrentRequest() {
    user know he has to wait until we finish */
 void RenderCache::CancelRendering(DisplayModel* dm) {
     ClearQueueForDisplayModel(dm);
+    ClearThumbnailQueue(dm);
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        bool isRendering = false;
+        for (int i = 0; i < nRenderThreads; i++) {
+            isRendering |= (curReqs[i] && curReqs[i]->dm == dm);
+        }
+        if (!isRendering) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
+            ClearThumbnailQueue(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -606,8 +1084,10 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     int curPos = 0;
     for (int i = 0; i < reqCount; i++) {
         PageRenderRequest* req = &(requests[i]);
+        // placeholders are for a different resolution by design
         bool shouldRemove = req->dm == dm && (pageNo == kInvalidPageNo || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
+                            (!tile || (req->tile.res != tile->res && !req->isPlaceholder) ||
+                             !IsTileVisible(dm, req->pageNo, *tile, 0.5));
         if (i != curPos) {
             requests[curPos] = requests[i];
         }
@@ -622,38 +1102,143 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     }
 }
 
-void RenderCache::AbortCurrentRequest() {
+static void AbortRequest(PageRenderRequest* req) {
+    if (req->abortCookie) {
+        req->abortCookie->Abort();
+    }
+    req->abort = true;
+}
+
+// abort requests being rendered for a given dm and page (or all of them)
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (!curReq) {
+            continue;
+        }
+        if (dm && curReq->dm != dm) {
+            continue;
+        }
+        if (pageNo != kInvalidPageNo && curReq->pageNo != pageNo) {
+            continue;
+        }
+        AbortRequest(curReq);
+    }
+}
+
+// stop rendering pages that were scrolled out of view, zoomed
+// or rotated in the meantime so that the threads are free
+// for rendering the new view port
+void RenderCache::AbortNotVisibleRequests() {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < nRenderThreads; i++) {
+        PageRenderRequest* curReq = curReqs[i];
+        if (!curReq || curReq->renderCb || curReq->abort) {
+            continue;
+        }
+        if (!curReq->dm->PageVisibleNearby(curReq->pageNo) || IsRequestOutdated(curReq)) {
+            AbortRequest(curReq);
+        }
+    }
+}
+
+// prefetching and thumbnails run at lower priority and, where supported,
+// power throttled (on efficiency cores) so that rendering of the visible
+// pages and the UI thread get the CPU first
+static void SetRenderThreadBackground(bool background) {
+    SetThreadPriority(GetCurrentThread(), background ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL);
+    if (!DynSetThreadInformation) {
+        return;
+    }
+    THREAD_POWER_THROTTLING_STATE state{};
+    state.Version = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+    state.ControlMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+    state.StateMask = background ? THREAD_POWER_THROTTLING_EXECUTION_SPEED : 0;
+    DynSetThreadInformation(GetCurrentThread(), ThreadPowerThrottling, &state, sizeof(state));
+}
+
+static int GetRenderThreadsCount() {
+    int n = gGlobalPrefs ? gGlobalPrefs->renderThreads : 0;
+    if (n <= 0) {
+        // leave one core for the UI thread
+        n = GetPhysicalProcessorCount() - 1;
+    }
+    return std::clamp(n, 1, MAX_RENDER_THREADS);
+}
+
+// only one JPEG 2000 image is decoded at a time, so while one render thread
+// decodes one, the other render threads can keep all but one core busy
+static int GetJpxDecodeThreadsCount(int nRenderThreads) {
+    int n = gGlobalPrefs ? gGlobalPrefs->jpxDecodeThreads : 0;
+    if (n <= 0) {
+        n = GetPhysicalProcessorCount() - (nRenderThreads - 1);
+    }
+    return std::clamp(n, 1, MAX_RENDER_THREADS);
+}
+
+void RenderCache::StartRenderThreads() {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq) {
+    if (nRenderThreads > 0) {
         return;
     }
-    if (curReq->abortCookie) {
-        curReq->abortCookie->Abort();
+    int n = GetRenderThreadsCount();
+    for (int i = 0; i < n; i++) {
+        HANDLE h = CreateThread(nullptr, 0, RenderCacheThread, this, 0, nullptr);
+        CrashIf(nullptr == h);
+        if (!h) {
+            break;
+        }
+        renderThreads[nRenderThreads++] = h;
     }
-    curReq->abort = true;
+    SetEngineMupdfJpxDecodeThreads(GetJpxDecodeThreadsCount(nRenderThreads));
+    logf("RenderCache::StartRenderThreads: started %d threads\n", nRenderThreads);
 }
 
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
     RenderCache* cache = (RenderCache*)data;
+    int threadIdx = (int)InterlockedIncrement(&cache->nRenderThreadsStarted) - 1;
+    CrashIf(threadIdx < 0 || threadIdx >= MAX_RENDER_THREADS);
     PageRenderRequest req;
     RenderedBitmap* bmp;
+    DisplayModel* prevDm = nullptr;
+    bool isBackground = false;
+    size_t loggedTempHighWater = 1024 * 1024;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult) {
-                continue;
-            }
+        size_t tempHighWater = TempAllocatorHighWater();
+        if (tempHighWater > loggedTempHighWater) {
+            logfa("RenderCacheThread: temp allocator grew to %d kB\n", (int)(tempHighWater / 1024));
+            loggedTempHighWater = tempHighWater * 2;
+        }
+        // frees temp allocations made for this request, also
+        // when it's skipped with continue
+        TempAllocatorScope tempScope;
+        cache->ClearCurrentRequest(threadIdx);
+        DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
+        // Is it not a page render request?
+        if (WAIT_OBJECT_0 != waitResult) {
+            continue;
         }
 
-        if (!cache->GetNextRequest(&req)) {
+        // the request might have been removed from the queue in the meantime
+        if (!cache->GetNextRequest(&req, threadIdx, prevDm)) {
             continue;
         }
 
         if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb) {
             continue;
         }
+        if (IsRequestOutdated(&req)) {
+            continue;
+        }
+        prevDm = req.dm;
+
+        bool background = req.isThumbnail || GetRequestPriority(&req) == 0;
+        if (background != isBackground) {
+            SetRenderThreadBackground(background);
+            isBackground = background;
+        }
 
         if (req.dm->dontRenderFlag) {
             if (req.renderCb) {
@@ -662,18 +1247,29 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             continue;
         }
 
-        // make sure that we have extracted page text for
-        // all rendered pages to allow text selection and
-        // searching without any further delays
-        if (!req.dm->textCache->HasTextForPage(req.pageNo)) {
-            req.dm->textCache->GetTextForPage(req.pageNo);
+        // tiles of a document that has been opened before might not need rendering
+        TileCacheKey tileKey;
+        bmp = GetTileCacheKey(cache, req, &tileKey) ? LoadTileFromCache(tileKey) : nullptr;
+        if (bmp) {
+            cache->Add(req, bmp);
+            req.dm->RepaintDisplay();
+            continue;
         }
 
         CrashIf(req.abortCookie != nullptr);
+        TimeTraceAdd("RenderQueued", req.queuedTime, req.isThumbnail ? "thumbnail" : nullptr, req.pageNo);
         EngineBase* engine = req.dm->GetEngine();
         RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
+        args.draft = req.draft;
         auto timeStart = TimeGet();
-        bmp = engine->RenderPage(args);
+        req.dm->textCache->BeginRendering();
+        // a request rendered by a worker can't be aborted
+        bool inWorker = gGlobalPrefs->renderInWorkerProcesses && RenderPageInWorker(threadIdx, engine, args, &bmp);
+        if (!inWorker) {
+            bmp = engine->RenderPage(args);
+        }
+        req.dm->textCache->EndRendering();
+        TimeTraceAdd("RenderPage", timeStart, nullptr, req.pageNo);
         if (req.abort) {
             delete bmp;
             if (req.renderCb) {
@@ -682,24 +1278,44 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             continue;
         }
         auto durMs = TimeSinceInMs(timeStart);
+        if (bmp && !req.renderCb && !req.draft) {
+            Size size = bmp->Size();
+            if (!size.IsEmpty()) {
+                req.dm->UpdateRenderCost(req.pageNo, (float)durMs * 1e6f / ((float)size.dx * (float)size.dy));
+            }
+        }
         if (durMs > 100) {
             auto path = engine->FilePath();
             logfa("Slow rendering: %.2f ms, page: %d in '%s'\n", (float)durMs, req.pageNo, path);
         }
 
         if (req.renderCb) {
+            // thumbnails should look like the pages they're for
+            if (req.isThumbnail && bmp && !engine->IsImageCollection()) {
+                TIME_TRACE_PAGE("UpdateBitmapColors", req.pageNo);
+                UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
+            }
             // the callback must free the RenderedBitmap
             req.renderCb->Callback(bmp);
             req.renderCb = (RenderingCallback*)1; // will crash if accessed again, which should not happen
         } else {
             // don't replace colors for individual images
             if (bmp && !engine->IsImageCollection()) {
+                TIME_TRACE_PAGE("UpdateBitmapColors", req.pageNo);
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
             }
-            cache->Add(req, bmp);
+            cache->Add(req, bmp, true);
             req.dm->RepaintDisplay();
         }
-        ResetTempAllocator();
+
+        // make sure that we have extracted page text for
+        // all rendered pages to allow text selection and
+        // searching without any further delays. Doing it after rendering
+        // shows the page sooner and lets engines hand out text they've
+        // extracted while preparing the page for rendering (EngineMupdf)
+        if (!req.isThumbnail && !req.dm->textCache->HasTextForPage(req.pageNo)) {
+            req.dm->textCache->GetTextForPage(req.pageNo);
+        }
     }
     DestroyTempAllocator();
 }
@@ -708,6 +1324,7 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 //       (this is the only place that knows about Tiles, though)
 int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
                            bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement) {
+    TIME_TRACE_PAGE("PaintTile", pageNo);
     float zoom = dm->GetZoomReal(pageNo);
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     int renderDelay = 0;
@@ -723,6 +1340,9 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull()) {
             RequestRendering(dm, pageNo, tile);
         }
+    } else if (entry->draft && renderMissing && !dm->IsInMotion() && !IsRenderQueueFull()) {
+        // the view has settled, replace the draft with a full quality rendering
+        RequestRendering(dm, pageNo, tile);
     }
     RenderedBitmap* renderedBmp = entry ? entry->bitmap : nullptr;
     HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : nullptr;
@@ -740,13 +1360,20 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         return renderDelay;
     }
 
-    HDC bmpDC = CreateCompatibleDC(hdc);
-    if (bmpDC) {
-        Size bmpSize = renderedBmp->Size();
-        int xSrc = -std::min(tileOnScreen.x, 0);
-        int ySrc = -std::min(tileOnScreen.y, 0);
-        float factor = std::min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
+    Size bmpSize = renderedBmp->Size();
+    // bounds can be any part of the tile
+    int xSrc = bounds.x - tileOnScreen.x;
+    int ySrc = bounds.y - tileOnScreen.y;
+    float factor = std::min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
 
+    HDC bmpDC = nullptr;
+    if (!PaintTileD2D(hdc, bounds, entry, xSrc, ySrc, factor)) {
+        if (!paintDC) {
+            paintDC = CreateCompatibleDC(hdc);
+        }
+        bmpDC = paintDC;
+    }
+    if (bmpDC) {
         HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
         int xDst = bounds.x;
         int yDst = bounds.y;
@@ -763,14 +1390,13 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         }
 
         SelectObject(bmpDC, prevBmp);
-        DeleteDC(bmpDC);
+    }
 
-        if (gShowTileLayout) {
-            HPEN pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0xff, 0x00));
-            HGDIOBJ oldPen = SelectObject(hdc, pen);
-            DrawRect(hdc, bounds);
-            DeletePen(SelectObject(hdc, oldPen));
-        }
+    if (gShowTileLayout) {
+        HPEN pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0xff, 0x00));
+        HGDIOBJ oldPen = SelectObject(hdc, pen);
+        DrawRect(hdc, bounds);
+        DeletePen(SelectObject(hdc, oldPen));
     }
 
     if (entry->outOfDate) {
@@ -784,6 +1410,114 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     return 0;
 }
 
+bool RenderCache::CreateD2DTarget() {
+    if (!d2dFactory) {
+        HRESULT hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &d2dFactory);
+        if (FAILED(hr)) {
+            d2dFactory = nullptr;
+            return false;
+        }
+    }
+    auto format = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE);
+    auto props = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT, format, 96.f, 96.f);
+    HRESULT hr = d2dFactory->CreateDCRenderTarget(&props, &d2dTarget);
+    if (FAILED(hr)) {
+        d2dTarget = nullptr;
+        return false;
+    }
+    // invalidates the bitmaps created for the previous target
+    d2dTargetGen++;
+    return true;
+}
+
+void RenderCache::ReleaseD2DTarget() {
+    if (d2dTarget) {
+        d2dTarget->Release();
+        d2dTarget = nullptr;
+    }
+}
+
+// uploads the bitmap of the entry once, so that repaints (e.g. while scrolling)
+// only have to composite it
+ID2D1Bitmap* RenderCache::GetD2DBitmap(HDC hdc, BitmapCacheEntry* entry) {
+    if (entry->d2dBitmap && entry->d2dTargetGen == d2dTargetGen) {
+        return entry->d2dBitmap;
+    }
+    if (entry->d2dBitmap) {
+        entry->d2dBitmap->Release();
+        entry->d2dBitmap = nullptr;
+    }
+
+    Size size = entry->bitmap->Size();
+    if (size.IsEmpty()) {
+        return nullptr;
+    }
+    // rendered bitmaps can have any bit depth, Direct2D needs 32 bpp
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    u8* bits = AllocArray<u8>((size_t)size.dx * size.dy * 4);
+    if (!bits) {
+        return nullptr;
+    }
+    HBITMAP hbmp = entry->bitmap->GetBitmap();
+    int nLines = GetDIBits(hdc, hbmp, 0, (UINT)size.dy, bits, &bmi, DIB_RGB_COLORS);
+    if (nLines == size.dy) {
+        auto format = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE);
+        auto props = D2D1::BitmapProperties(format, 96.f, 96.f);
+        HRESULT hr = d2dTarget->CreateBitmap(D2D1::SizeU(size.dx, size.dy), bits, size.dx * 4, props,
+                                             &entry->d2dBitmap);
+        if (FAILED(hr)) {
+            entry->d2dBitmap = nullptr;
+        }
+    }
+    free(bits);
+    entry->d2dTargetGen = d2dTargetGen;
+    return entry->d2dBitmap;
+}
+
+// paints a tile with Direct2D, which keeps a copy of the bitmap in video memory and
+// scales it on the GPU (with better quality than StretchBlt). Returns false if the
+// tile has to be painted with GDI
+bool RenderCache::PaintTileD2D(HDC hdc, Rect bounds, BitmapCacheEntry* entry, int xSrc, int ySrc, float factor) {
+    if (isRemoteSession || !gGlobalPrefs || !gGlobalPrefs->gpuPagePainting) {
+        return false;
+    }
+    if (!d2dTarget && !CreateD2DTarget()) {
+        return false;
+    }
+    RECT rc = ToRECT(bounds);
+    HRESULT hr = d2dTarget->BindDC(hdc, &rc);
+    if (FAILED(hr)) {
+        return false;
+    }
+    ID2D1Bitmap* bmp = GetD2DBitmap(hdc, entry);
+    if (!bmp) {
+        return false;
+    }
+
+    d2dTarget->BeginDraw();
+    D2D1_RECT_F dst = D2D1::RectF(0, 0, (float)bounds.dx, (float)bounds.dy);
+    float x = xSrc * factor;
+    float y = ySrc * factor;
+    D2D1_RECT_F src = D2D1::RectF(x, y, x + bounds.dx * factor, y + bounds.dy * factor);
+    auto mode = D2D1_BITMAP_INTERPOLATION_MODE_LINEAR;
+    if (factor == 1.0f) {
+        mode = D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR;
+    }
+    d2dTarget->DrawBitmap(bmp, dst, 1.f, mode, src);
+    hr = d2dTarget->EndDraw();
+    if (hr == D2DERR_RECREATE_TARGET) {
+        // e.g. the graphics driver has been updated
+        ReleaseD2DTarget();
+    }
+    return SUCCEEDED(hr);
+}
+
 static int cmpTilePosition(const void* a, const void* b) {
     const TilePosition *ta = (const TilePosition*)a, *tb = (const TilePosition*)b;
     return ta->res != tb->res ? ta->res - tb->res : ta->row != tb->row ? ta->row - tb->row : ta->col - tb->col;
@@ -881,6 +1615,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
     }
     FreeNotVisible();
 #endif
+    AbortNotVisibleRequests();
 
     return renderDelayMin;
 }
@@ -1,17 +1,26 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+struct ID2D1Factory;
+struct ID2D1DCRenderTarget;
+struct ID2D1Bitmap;
+
 constexpr int RENDER_DELAY_FAILED = std::numeric_limits<int>::max() - 1;
 constexpr int RENDER_DELAY_UNDEFINED = std::numeric_limits<int>::max() - 2;
 
 #define INVALID_TILE_RES ((USHORT)-1)
 
 #define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-// TODO: this should be based on amount of memory taken by rendered pages
-// i.e. one big page can use as much memory as lots of small pages
-#define MAX_BITMAPS_CACHED 64
+// thumbnails (e.g. for the page overview) are queued separately
+#define MAX_THUMBNAIL_REQUESTS 32
+// upper limit for GlobalPrefs::renderThreads
+#define MAX_RENDER_THREADS 16
+// the cache is limited by the amount of memory taken by rendered bitmaps
+// (see GlobalPrefs::renderCacheSize). This is an additional limit
+// on the number of bitmaps so that we don't run out of GDI handles
+#define MAX_BITMAPS_CACHED 512
+// number of buckets in RenderCache::index
+#define CACHE_INDEX_BUCKETS 256
 
 struct PageInfo;
 
@@ -52,8 +61,22 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
+    // memory used by bitmap, in bytes
+    size_t size = 0;
+    // value of RenderCache::useCounter when the entry was last used
+    u64 lastUsed = 0;
     bool outOfDate = false;
+    // rendered in draft quality, replaced once the view has settled
+    bool draft = false;
+    // bitmap is being saved to the tile cache, see SaveTileToCache()
+    bool savedToTileCache = false;
     int refs = 1;
+    // next entry in the same RenderCache::index bucket
+    BitmapCacheEntry* nextInBucket = nullptr;
+    // copy of bitmap for painting with Direct2D, created on first use.
+    // Only valid for the render target of RenderCache::d2dTargetGen
+    ID2D1Bitmap* d2dBitmap = nullptr;
+    int d2dTargetGen = 0;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
                      RenderedBitmap* bitmap) {
@@ -64,9 +87,7 @@ struct BitmapCacheEntry {
         this->tile = tile;
         this->bitmap = bitmap;
     }
-    ~BitmapCacheEntry() {
-        delete bitmap;
-    }
+    ~BitmapCacheEntry();
 };
 
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
@@ -83,23 +104,48 @@ struct PageRenderRequest {
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
+    // for TimeTrace
+    LARGE_INTEGER queuedTime{};
     // owned by the PageRenderRequest (use it before reusing the request)
     // on rendering success, the callback gets handed the RenderedBitmap
     RenderingCallback* renderCb = nullptr;
+    // low priority request from the thumbnail queue
+    bool isThumbnail = false;
+    // quick low resolution rendering, see RenderCache::RequestPlaceholder
+    bool isPlaceholder = false;
+    // see RenderPageArgs::draft
+    bool draft = false;
 };
 
 struct RenderCache {
-    BitmapCacheEntry* cache[MAX_BITMAPS_CACHED]{};
-    int cacheCount = 0;
+    Vec<BitmapCacheEntry*> cache;
+    // entries hashed by (dm, pageNo) so that the per-page lookups
+    // done on every paint don't have to scan the whole cache
+    BitmapCacheEntry* index[CACHE_INDEX_BUCKETS]{};
+    // total size of bitmaps in cache
+    size_t cacheSize = 0;
+    // calculated on first use because it depends on GlobalPrefs
+    size_t maxCacheSize = 0;
+    u64 useCounter = 0;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
-    PageRenderRequest* curReq = nullptr;
+    // only rendered when there are no other requests. The results go
+    // to the callback and never into the cache, so they can't push out
+    // bitmaps of visible pages
+    PageRenderRequest thumbnailRequests[MAX_THUMBNAIL_REQUESTS]{};
+    int thumbnailRequestCount = 0;
+    // requests currently being rendered, indexed by render thread
+    PageRenderRequest* curReqs[MAX_RENDER_THREADS]{};
     CRITICAL_SECTION requestAccess;
-    HANDLE renderThread = nullptr;
+    // render threads are started lazily (on first request) because
+    // their number depends on GlobalPrefs which are loaded after we're constructed
+    HANDLE renderThreads[MAX_RENDER_THREADS]{};
+    int nRenderThreads = 0;
+    LONG nRenderThreadsStarted = 0;
 
     Size maxTileSize{};
     bool isRemoteSession = false;
@@ -107,7 +153,15 @@ struct RenderCache {
     COLORREF textColor = 0;
     COLORREF backgroundColor = 0;
 
-    /* Interface for page rendering thread */
+    // for painting tiles with Direct2D (if GpuPagePainting is set), only used on the UI thread
+    ID2D1Factory* d2dFactory = nullptr;
+    ID2D1DCRenderTarget* d2dTarget = nullptr;
+    int d2dTargetGen = 0;
+    // for blitting tiles with GDI, kept instead of being created for
+    // each tile that is painted (only used on the UI thread)
+    HDC paintDC = nullptr;
+
+    /* Interface for page rendering threads: semaphore signaled once per queued request */
     HANDLE startRendering = nullptr;
 
     RenderCache();
@@ -116,22 +170,29 @@ struct RenderCache {
     ~RenderCache();
 
     void RequestRendering(DisplayModel* dm, int pageNo);
+    void RequestPlaceholder(DisplayModel* dm, int pageNo);
     void Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect, RenderingCallback& callback);
+    void RenderThumbnail(DisplayModel* dm, int pageNo, float zoom, RenderingCallback* callback);
+    // removes thumbnail requests for pages outside of firstPage ... lastPage (or all of them)
+    void ClearThumbnailQueue(DisplayModel* dm, int firstPage = kInvalidPageNo, int lastPage = kInvalidPageNo);
     void CancelRendering(DisplayModel* dm);
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = kInvalidZoom, TilePosition* tile = nullptr);
     void FreeForDisplayModel(DisplayModel* dm);
-    void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
+    // unchangedPages[i] is set if page i + 1 looks the same in oldDm and newDm
+    void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm, const Vec<bool>* unchangedPages = nullptr);
     void Invalidate(DisplayModel* dm, int pageNo, RectF rect);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
-    void Add(PageRenderRequest& req, RenderedBitmap* bmp);
+    void StartRenderThreads();
+    void ClearCurrentRequest(int threadIdx);
+    bool GetNextRequest(PageRenderRequest* req, int threadIdx, DisplayModel* prevDm);
+    // bitmaps copied from another view or loaded from the tile cache aren't saved again
+    void Add(PageRenderRequest& req, RenderedBitmap* bmp, bool saveToTileCache = false);
 
-    USHORT GetTileRes(DisplayModel* dm, int pageNo) const;
+    USHORT GetTileRes(DisplayModel* dm, int pageNo);
     USHORT GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation);
     bool ReduceTileSize();
 
@@ -140,19 +201,28 @@ struct RenderCache {
     }
     int GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
+    bool CopyFromSharedEngine(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
                 RectF* pageRect = nullptr, RenderingCallback* renderCb = nullptr);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = kInvalidPageNo, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = kInvalidPageNo);
+    void AbortNotVisibleRequests();
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = kInvalidZoom,
                            TilePosition* tile = nullptr);
     bool DropCacheEntry(BitmapCacheEntry* entry);
+    BitmapCacheEntry** GetIndexBucket(DisplayModel* dm, int pageNo);
+    void AddToIndex(BitmapCacheEntry* entry);
+    void RemoveFromIndex(BitmapCacheEntry* entry);
     void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
     int PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
                   bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
+    bool CreateD2DTarget();
+    void ReleaseD2DTarget();
+    ID2D1Bitmap* GetD2DBitmap(HDC hdc, BitmapCacheEntry* entry);
+    bool PaintTileD2D(HDC hdc, Rect bounds, BitmapCacheEntry* entry, int xSrc, int ySrc, float factor);
 };
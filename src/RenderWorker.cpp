@@ -0,0 +1,378 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
+#include "RenderWorker.h"
+
+#include "utils/Log.h"
+
+/* The viewer talks to each worker over its own named pipe, in messages: a
+   RenderWorkerRequest followed by the path of the document, answered by a
+   RenderWorkerResponse. The worker renders into a file mapping and the viewer
+   takes over the worker's handle of it with DuplicateHandle() */
+
+// one worker per render thread, see MAX_RENDER_THREADS
+constexpr int kMaxRenderWorkers = 16;
+// a worker that doesn't answer within these times is considered hung and killed
+constexpr DWORD kRenderWorkerStartTimeoutMs = 10 * 1000;
+constexpr DWORD kRenderWorkerRenderTimeoutMs = 60 * 1000;
+constexpr DWORD kRenderWorkerMaxMsgSize = 64 * 1024;
+
+enum class RenderWorkerStatus : u32 {
+    Ok,
+    Failed,
+    // the worker can't open the document (e.g. because it needs a password)
+    CantOpen,
+};
+
+struct RenderWorkerRequest {
+    int pageNo;
+    float zoom;
+    int rotation;
+    RectF pageRect;
+    bool hasPageRect;
+    bool draft;
+    // followed by the UTF-8 path of the document (not zero-terminated)
+};
+
+struct RenderWorkerResponse {
+    RenderWorkerStatus status;
+    Size size;
+    // file mapping with size.dx x size.dy top-down 32-bit pixels,
+    // a handle value in the worker process
+    u64 hMap;
+};
+
+struct RenderWorker {
+    HANDLE hProcess = nullptr;
+    HANDLE hPipe = nullptr;
+    HANDLE ioEvent = nullptr;
+    // the last document the worker couldn't open
+    char* cantOpenPath = nullptr;
+};
+
+// each worker is only used by the render thread with the same index
+static RenderWorker gRenderWorkers[kMaxRenderWorkers];
+// kills the workers when the viewer exits (or crashes)
+static HANDLE gRenderWorkersJob = nullptr;
+// set when a worker couldn't be started, after which rendering is done in-process
+static bool gRenderWorkersDisabled = false;
+static LONG gRenderWorkerPipeCount = 0;
+
+static HANDLE GetRenderWorkersJob() {
+    if (gRenderWorkersJob) {
+        return gRenderWorkersJob;
+    }
+    HANDLE job = CreateJobObjectW(nullptr, nullptr);
+    if (!job) {
+        return nullptr;
+    }
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info{};
+    info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(job, JobObjectExtendedLimitInformation, &info, sizeof(info));
+    if (InterlockedCompareExchangePointer(&gRenderWorkersJob, job, nullptr) != nullptr) {
+        // another render thread was faster
+        CloseHandle(job);
+    }
+    return gRenderWorkersJob;
+}
+
+static void StopRenderWorker(RenderWorker* w) {
+    if (w->hProcess) {
+        TerminateProcess(w->hProcess, 1);
+    }
+    if (IsValidHandle(w->hPipe)) {
+        CloseHandle(w->hPipe);
+    }
+    w->hPipe = nullptr;
+    SafeCloseHandle(&w->hProcess);
+    SafeCloseHandle(&w->ioEvent);
+}
+
+// err is GetLastError() after starting an overlapped operation on the worker's pipe
+// (0 if it completed right away). Fails if the worker exits or doesn't finish in time
+static bool WaitForRenderWorkerIo(RenderWorker* w, OVERLAPPED* ov, DWORD err, DWORD timeoutMs, DWORD* n) {
+    if (err != 0 && err != ERROR_IO_PENDING) {
+        return false;
+    }
+    if (err == ERROR_IO_PENDING) {
+        HANDLE handles[2] = {ov->hEvent, w->hProcess};
+        DWORD res = WaitForMultipleObjects(w->hProcess ? 2 : 1, handles, FALSE, timeoutMs);
+        if (res != WAIT_OBJECT_0) {
+            // ov must stay valid until the cancelled operation has completed
+            CancelIoEx(w->hPipe, ov);
+            GetOverlappedResult(w->hPipe, ov, n, TRUE);
+            return false;
+        }
+    }
+    return GetOverlappedResult(w->hPipe, ov, n, FALSE);
+}
+
+static bool StartRenderWorker(RenderWorker* w) {
+    int pipeNo = (int)InterlockedIncrement(&gRenderWorkerPipeCount);
+    AutoFreeStr pipeName = str::Format("\\\\.\\pipe\\SumatraPDF-render-%u-%d", GetCurrentProcessId(), pipeNo);
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE;
+    DWORD mode = PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS;
+    DWORD bufSize = kRenderWorkerMaxMsgSize;
+    w->hPipe = CreateNamedPipeW(ToWstrTemp(pipeName), openMode, mode, 1, bufSize, bufSize, 0, nullptr);
+    if (!IsValidHandle(w->hPipe)) {
+        logf("StartRenderWorker: CreateNamedPipeW() failed with %d\n", (int)GetLastError());
+        StopRenderWorker(w);
+        return false;
+    }
+    w->ioEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    OVERLAPPED ov{};
+    ov.hEvent = w->ioEvent;
+    BOOL ok = ConnectNamedPipe(w->hPipe, &ov);
+    DWORD err = ok ? 0 : GetLastError();
+
+    AutoFreeStr cmdLine = str::Format("\"%s\" -render-worker \"%s\"", GetExePathTemp(), pipeName.Get());
+    STARTUPINFOW si{};
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi{};
+    // suspended until it's in the job, so that it can't outlive us
+    ok = CreateProcessW(nullptr, ToWstrTemp(cmdLine), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, nullptr,
+                        &si, &pi);
+    if (!ok) {
+        logf("StartRenderWorker: CreateProcessW() failed with %d\n", (int)GetLastError());
+        StopRenderWorker(w);
+        return false;
+    }
+    w->hProcess = pi.hProcess;
+    HANDLE job = GetRenderWorkersJob();
+    if (!job || !AssignProcessToJobObject(job, pi.hProcess)) {
+        logf("StartRenderWorker: AssignProcessToJobObject() failed with %d\n", (int)GetLastError());
+        CloseHandle(pi.hThread);
+        StopRenderWorker(w);
+        return false;
+    }
+    ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+
+    DWORD n = 0;
+    bool connected = err == ERROR_PIPE_CONNECTED;
+    connected = connected || WaitForRenderWorkerIo(w, &ov, err, kRenderWorkerStartTimeoutMs, &n);
+    // make sure it's our worker that got the pipe
+    ULONG clientPid = 0;
+    if (!connected || !GetNamedPipeClientProcessId(w->hPipe, &clientPid) || clientPid != GetProcessId(w->hProcess)) {
+        logf("StartRenderWorker: the worker didn't connect\n");
+        StopRenderWorker(w);
+        return false;
+    }
+    return true;
+}
+
+static bool CanRenderInWorker(EngineBase* engine) {
+    // workers only see what's saved to disk, so they'd show something else than
+    // the loaded document if it has unsaved annotations or the file has changed since.
+    // They also don't get the password the document was opened with
+    if (engine->kind != kindEngineMupdf || EngineMupdfHasUnsavedAnnotations(engine)) {
+        return false;
+    }
+    if (engine->IsPasswordProtected()) {
+        return false;
+    }
+    return !EngineMupdfFileChangedSinceLoad(engine);
+}
+
+bool RenderPageInWorker(int workerIdx, EngineBase* engine, RenderPageArgs& args, RenderedBitmap** bmpOut) {
+    *bmpOut = nullptr;
+    if (gRenderWorkersDisabled || workerIdx < 0 || workerIdx >= kMaxRenderWorkers || !CanRenderInWorker(engine)) {
+        return false;
+    }
+    RenderWorker* w = &gRenderWorkers[workerIdx];
+    const char* path = engine->FilePath();
+    size_t pathLen = str::Len(path);
+    if (str::Eq(path, w->cantOpenPath) || sizeof(RenderWorkerRequest) + pathLen > kRenderWorkerMaxMsgSize) {
+        return false;
+    }
+    if (!w->hProcess && !StartRenderWorker(w)) {
+        gRenderWorkersDisabled = true;
+        return false;
+    }
+
+    RenderWorkerRequest req{};
+    req.pageNo = args.pageNo;
+    req.zoom = args.zoom;
+    req.rotation = args.rotation;
+    if (args.pageRect) {
+        req.pageRect = *args.pageRect;
+        req.hasPageRect = true;
+    }
+    req.draft = args.draft;
+    str::Str msg;
+    msg.Append((const char*)&req, sizeof(req));
+    msg.Append(path, pathLen);
+
+    RenderWorkerResponse res{};
+    OVERLAPPED ov{};
+    ov.hEvent = w->ioEvent;
+    DWORD n = 0;
+    BOOL ok = WriteFile(w->hPipe, msg.Get(), (DWORD)msg.size(), nullptr, &ov);
+    bool done = WaitForRenderWorkerIo(w, &ov, ok ? 0 : GetLastError(), kRenderWorkerStartTimeoutMs, &n);
+    done = done && n == (DWORD)msg.size();
+    if (done) {
+        ov = {};
+        ov.hEvent = w->ioEvent;
+        ok = ReadFile(w->hPipe, &res, sizeof(res), nullptr, &ov);
+        done = WaitForRenderWorkerIo(w, &ov, ok ? 0 : GetLastError(), kRenderWorkerRenderTimeoutMs, &n);
+        done = done && n == sizeof(res);
+    }
+    if (!done) {
+        // most likely the document crashed or hung the worker, so it's
+        // not rendered in-process where it could do the same to the viewer.
+        // The worker is restarted for the next request
+        logf("RenderPageInWorker: the worker failed on page %d of '%s'\n", args.pageNo, path);
+        StopRenderWorker(w);
+        return true;
+    }
+    if (res.status == RenderWorkerStatus::CantOpen) {
+        str::ReplaceWithCopy(&w->cantOpenPath, path);
+        return false;
+    }
+    if (res.status != RenderWorkerStatus::Ok) {
+        return true;
+    }
+
+    HANDLE hMap = nullptr;
+    DWORD opts = DUPLICATE_SAME_ACCESS | DUPLICATE_CLOSE_SOURCE;
+    if (!DuplicateHandle(w->hProcess, (HANDLE)(uintptr_t)res.hMap, GetCurrentProcess(), &hMap, 0, FALSE, opts)) {
+        logf("RenderPageInWorker: DuplicateHandle() failed with %d\n", (int)GetLastError());
+        return true;
+    }
+    // fails if the mapping is smaller than the bitmap
+    HBITMAP hbmp = res.size.IsEmpty() ? nullptr : CreateMemoryBitmap(res.size, &hMap);
+    if (!hbmp) {
+        CloseHandle(hMap);
+        return true;
+    }
+    *bmpOut = new RenderedBitmap(hbmp, res.size, hMap);
+    return true;
+}
+
+// the worker keeps the last document open, until it changes on disk
+struct RenderWorkerDoc {
+    EngineBase* engine = nullptr;
+    char* path = nullptr;
+    FILETIME modified{};
+};
+
+static EngineBase* GetRenderWorkerEngine(RenderWorkerDoc* doc, const char* path) {
+    FILETIME modified = file::GetModificationTime(path);
+    if (str::Eq(doc->path, path) && CompareFileTime(&doc->modified, &modified) == 0) {
+        return doc->engine;
+    }
+    delete doc->engine;
+    str::ReplaceWithCopy(&doc->path, path);
+    doc->modified = modified;
+    doc->engine = CreateEngineFromFile(path, nullptr, false);
+    if (doc->engine && doc->engine->kind != kindEngineMupdf) {
+        delete doc->engine;
+        doc->engine = nullptr;
+    }
+    return doc->engine;
+}
+
+// returns the mapping with the pixels of bmp in the format of CreateMemoryBitmap()
+static HANDLE GetSharedPixels(RenderedBitmap* bmp) {
+    DIBSECTION ds{};
+    bool isMemoryBitmap = GetObject(bmp->GetBitmap(), sizeof(ds), &ds) == sizeof(ds) &&
+                          ds.dsBmih.biBitCount == 32 && ds.dsBmih.biHeight < 0;
+    if (bmp->hMap && isMemoryBitmap) {
+        HANDLE hMap = bmp->hMap;
+        bmp->hMap = nullptr;
+        return hMap;
+    }
+    // e.g. an 8-bit bitmap with a palette
+    Size size = bmp->Size();
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, &hMap);
+    if (!hbmp) {
+        SafeCloseHandle(&hMap);
+        return nullptr;
+    }
+    HDC hdc = CreateCompatibleDC(nullptr);
+    HGDIOBJ prevBmp = SelectObject(hdc, hbmp);
+    bool ok = BlitHBITMAP(bmp->GetBitmap(), hdc, Rect(0, 0, size.dx, size.dy));
+    GdiFlush();
+    SelectObject(hdc, prevBmp);
+    DeleteDC(hdc);
+    DeleteObject(hbmp);
+    if (!ok) {
+        SafeCloseHandle(&hMap);
+    }
+    return hMap;
+}
+
+static void RenderWorkerPage(RenderWorkerDoc* doc, RenderWorkerRequest* req, const char* path,
+                             RenderWorkerResponse* res) {
+    EngineBase* engine = GetRenderWorkerEngine(doc, path);
+    if (!engine) {
+        res->status = RenderWorkerStatus::CantOpen;
+        return;
+    }
+    res->status = RenderWorkerStatus::Failed;
+    if (req->pageNo < 1 || req->pageNo > engine->PageCount()) {
+        return;
+    }
+    RenderPageArgs args(req->pageNo, req->zoom, req->rotation, req->hasPageRect ? &req->pageRect : nullptr);
+    args.draft = req->draft;
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    if (!bmp) {
+        return;
+    }
+    HANDLE hMap = GetSharedPixels(bmp);
+    res->size = bmp->Size();
+    delete bmp;
+    if (hMap) {
+        // the viewer closes our handle when it takes it over
+        res->status = RenderWorkerStatus::Ok;
+        res->hMap = (u64)(uintptr_t)hMap;
+    }
+}
+
+int RunRenderWorker(const char* pipeName) {
+    HANDLE hPipe = CreateFileW(ToWstrTemp(pipeName), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0,
+                               nullptr);
+    if (!IsValidHandle(hPipe)) {
+        logf("RunRenderWorker: failed to open '%s'\n", pipeName);
+        return 1;
+    }
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(hPipe, &mode, nullptr, nullptr);
+
+    RenderWorkerDoc doc;
+    u8* msg = AllocArray<u8>(kRenderWorkerMaxMsgSize);
+    for (;;) {
+        TempAllocatorScope tempScope;
+        DWORD n = 0;
+        // fails when the viewer closes the pipe
+        BOOL ok = ReadFile(hPipe, msg, kRenderWorkerMaxMsgSize, &n, nullptr);
+        if (!ok || n < sizeof(RenderWorkerRequest)) {
+            break;
+        }
+        RenderWorkerRequest req;
+        memcpy(&req, msg, sizeof(req));
+        char* path = str::DupTemp((const char*)msg + sizeof(req), n - sizeof(req));
+        RenderWorkerResponse res{};
+        RenderWorkerPage(&doc, &req, path, &res);
+        if (!WriteFile(hPipe, &res, sizeof(res), &n, nullptr)) {
+            break;
+        }
+    }
+    delete doc.engine;
+    str::Free(doc.path);
+    free(msg);
+    CloseHandle(hPipe);
+    return 0;
+}
@@ -0,0 +1,15 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// renders pages of MuPDF documents in helper processes (SumatraPDF.exe -render-worker),
+// one per render thread. Each worker opens its own copy of the document, so a document
+// can be rendered on all cores in parallel and a crash or a hang while rendering a
+// damaged document only takes down the worker. Bitmaps are returned in shared memory
+
+// returns false if the page can't be rendered in a worker (e.g. the document has
+// unsaved annotations or the file changed since it was loaded) and must be rendered in-process.
+// Otherwise *bmpOut is the rendered page or nullptr if rendering failed
+bool RenderPageInWorker(int workerIdx, EngineBase* engine, RenderPageArgs& args, RenderedBitmap** bmpOut);
+
+// entry point of a worker process, returns the exit code
+int RunRenderWorker(const char* pipeName);
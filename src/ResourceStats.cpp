@@ -0,0 +1,182 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include <psapi.h>
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "DisplayModel.h"
+#include "RenderCache.h"
+#include "TextSelection.h"
+#include "MainWindow.h"
+#include "WindowTab.h"
+#include "SumatraPDF.h"
+#include "ResourceStats.h"
+
+#include "utils/Log.h"
+
+constexpr UINT kResourceStatsIntervalMs = 5000;
+
+bool gDebugShowResourceStats = false;
+static UINT_PTR gResourceStatsTimer = 0;
+static AutoFreeStr gLastResourceStats;
+
+struct EngineKindStats {
+    Kind kind = nullptr;
+    int nEngines = 0;
+    EngineMemStats mem;
+};
+
+struct ResourceStats {
+    PROCESS_MEMORY_COUNTERS_EX pmc{};
+    DWORD gdiObjects = 0;
+    DWORD gdiObjectsPeak = 0;
+    DWORD userObjects = 0;
+    DWORD userObjectsPeak = 0;
+
+    int nBitmaps = 0;
+    size_t bitmapsSize = 0;
+    size_t maxBitmapsSize = 0;
+    int nRenderRequests = 0;
+
+    int nTextCaches = 0;
+    i64 textSize = 0;
+    int nTextPages = 0;
+
+    Vec<EngineKindStats> engines;
+};
+
+static EngineKindStats& GetEngineKindStats(ResourceStats& stats, Kind kind) {
+    for (EngineKindStats& ks : stats.engines) {
+        if (ks.kind == kind) {
+            return ks;
+        }
+    }
+    EngineKindStats ks;
+    ks.kind = kind;
+    stats.engines.Append(ks);
+    return stats.engines.Last();
+}
+
+// must be called on the ui thread
+static void CollectResourceStats(ResourceStats& stats) {
+    HANDLE proc = GetCurrentProcess();
+    stats.pmc.cb = sizeof(stats.pmc);
+    GetProcessMemoryInfo(proc, (PROCESS_MEMORY_COUNTERS*)&stats.pmc, sizeof(stats.pmc));
+    stats.gdiObjects = GetGuiResources(proc, GR_GDIOBJECTS);
+    stats.gdiObjectsPeak = GetGuiResources(proc, GR_GDIOBJECTS_PEAK);
+    stats.userObjects = GetGuiResources(proc, GR_USEROBJECTS);
+    stats.userObjectsPeak = GetGuiResources(proc, GR_USEROBJECTS_PEAK);
+
+    RenderCache& rc = gRenderCache;
+    {
+        ScopedCritSec scope(&rc.cacheAccess);
+        stats.nBitmaps = rc.cache.isize();
+        stats.bitmapsSize = rc.cacheSize;
+        stats.maxBitmapsSize = rc.maxCacheSize;
+    }
+    {
+        ScopedCritSec scope(&rc.requestAccess);
+        stats.nRenderRequests = rc.requestCount;
+    }
+
+    // documents opened in several tabs share their engine and text
+    Vec<EngineBase*> seenEngines;
+    Vec<DocumentTextCache*> seenTextCaches;
+    for (MainWindow* win : gWindows) {
+        for (WindowTab* tab : win->Tabs()) {
+            DisplayModel* dm = tab->AsFixed();
+            if (!dm) {
+                continue;
+            }
+            EngineBase* engine = dm->GetEngine();
+            if (engine && !seenEngines.Contains(engine)) {
+                seenEngines.Append(engine);
+                EngineKindStats& ks = GetEngineKindStats(stats, engine->kind);
+                ks.nEngines++;
+                engine->GetMemStats(ks.mem);
+            }
+            DocumentTextCache* tc = dm->textCache;
+            if (tc && !seenTextCaches.Contains(tc)) {
+                seenTextCaches.Append(tc);
+                ScopedCritSec scope(&tc->access);
+                stats.nTextCaches++;
+                stats.textSize += tc->memSize;
+                stats.nTextPages += tc->nPagesExtracted;
+            }
+        }
+    }
+}
+
+static float ToMB(i64 n) {
+    return (float)n / (1024.f * 1024.f);
+}
+
+static char* FormatResourceStats(const ResourceStats& stats, bool multiLine) {
+    const char* sep = multiLine ? "\n" : "; ";
+    str::Str s;
+    const PROCESS_MEMORY_COUNTERS_EX& pmc = stats.pmc;
+    s.AppendFmt("process: %.1f MB private, %.1f MB working set (peak %.1f MB)", ToMB((i64)pmc.PrivateUsage),
+                ToMB((i64)pmc.WorkingSetSize), ToMB((i64)pmc.PeakWorkingSetSize));
+    s.Append(sep);
+    s.AppendFmt("handles: %d GDI (peak %d), %d USER (peak %d)", (int)stats.gdiObjects, (int)stats.gdiObjectsPeak,
+                (int)stats.userObjects, (int)stats.userObjectsPeak);
+    s.Append(sep);
+    s.AppendFmt("render cache: %d bitmaps, %.1f of %.1f MB, %d requests queued", stats.nBitmaps,
+                ToMB((i64)stats.bitmapsSize), ToMB((i64)stats.maxBitmapsSize), stats.nRenderRequests);
+    s.Append(sep);
+    s.AppendFmt("text: %d documents, %d pages, %.1f MB", stats.nTextCaches, stats.nTextPages, ToMB(stats.textSize));
+    for (const EngineKindStats& ks : stats.engines) {
+        const EngineMemStats& m = ks.mem;
+        s.Append(sep);
+        s.AppendFmt("%s: %d documents, cache %.1f MB in %d items, %d pages loaded", ks.kind, ks.nEngines,
+                    ToMB(m.cacheSize), m.cacheItems, m.loadedPages);
+        if (m.displayLists > 0) {
+            s.AppendFmt(", %d display lists %.1f MB", m.displayLists, ToMB(m.displayListsSize));
+        }
+    }
+    return s.StealData();
+}
+
+char* GetResourceStats(bool multiLine) {
+    ResourceStats stats;
+    CollectResourceStats(stats);
+    return FormatResourceStats(stats, multiLine);
+}
+
+const char* GetLastResourceStats() {
+    return gLastResourceStats.Get();
+}
+
+static void CALLBACK SampleResourceStats(HWND, UINT, UINT_PTR, DWORD) {
+    ResourceStats stats;
+    CollectResourceStats(stats);
+    AutoFreeStr line = FormatResourceStats(stats, false);
+    logf("resource stats: %s\n", line.Get());
+    gLastResourceStats.Set(FormatResourceStats(stats, true));
+    for (MainWindow* win : gWindows) {
+        win->RedrawAll(false);
+    }
+}
+
+void ToggleResourceStats() {
+    gDebugShowResourceStats = !gDebugShowResourceStats;
+    if (gResourceStatsTimer) {
+        KillTimer(nullptr, gResourceStatsTimer);
+        gResourceStatsTimer = 0;
+    }
+    gLastResourceStats.Set(nullptr);
+    if (gDebugShowResourceStats) {
+        gResourceStatsTimer = SetTimer(nullptr, 0, kResourceStatsIntervalMs, SampleResourceStats);
+        SampleResourceStats(nullptr, 0, 0, 0);
+        return;
+    }
+    for (MainWindow* win : gWindows) {
+        win->RedrawAll(true);
+    }
+}
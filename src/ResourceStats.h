@@ -0,0 +1,16 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// memory and GDI/USER handles used by the biggest consumers (the bitmaps in
+// RenderCache, extracted text, engine caches), for finding out where they go.
+// Nothing is collected unless asked for: while "Debug: Show Resource Stats"
+// is checked they're sampled every few seconds into the log and shown on the
+// canvas, and [GetResourceStats] returns them through the command pipe
+
+extern bool gDebugShowResourceStats;
+
+void ToggleResourceStats();
+// the caller must free()
+char* GetResourceStats(bool multiLine);
+// the last sample while gDebugShowResourceStats is set
+const char* GetLastResourceStats();
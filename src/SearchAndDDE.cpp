@@ -33,6 +33,7 @@
 #include "resource.h"
 #include "Commands.h"
 #include "AppTools.h"
+#include "ResourceStats.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
 #include "SumatraDialogs.h"
@@ -618,6 +619,16 @@ LRESULT OnDDEInitiate(HWND hwnd, WPARAM wp, LPARAM lp) {
 
 // DDE commands
 
+// commands received through the command pipe must not steal the focus
+// unless explicitly asked to (with <setfocus>)
+static bool gNoImplicitFocus = false;
+
+static void FocusAfterCmd(MainWindow* win) {
+    if (!gNoImplicitFocus) {
+        win->Focus();
+    }
+}
+
 /*
 Forward search (synchronization) DDE command
 
@@ -725,7 +736,7 @@ static const char* HandleSearchCmd(const char* cmd, DDEACK& ack) {
     bool wasModified = true;
     bool showProgress = true;
     FindTextOnThread(win, TextSearchDirection::Forward, term, wasModified, showProgress);
-    win->Focus();
+    FocusAfterCmd(win);
     return next;
 }
 
@@ -824,7 +835,7 @@ static const char* HandleGotoCmd(const char* cmd, DDEACK& ack) {
 
     win->linkHandler->GotoNamedDest(destName);
     ack.fAck = 1;
-    win->Focus();
+    FocusAfterCmd(win);
     return next;
 }
 
@@ -863,7 +874,7 @@ static const char* HandlePageCmd(__unused HWND hwnd, const char* cmd, DDEACK& ac
 
     win->ctrl->GoToPage(page, true);
     ack.fAck = 1;
-    win->Focus();
+    FocusAfterCmd(win);
     return next;
 }
 
@@ -977,6 +988,35 @@ static void HandleDdeCmds(HWND hwnd, const char* cmd, DDEACK& ack) {
     }
 }
 
+/*
+Query commands, only available through the command pipe. They reply
+with "OK <value>" and don't change (or focus) anything
+
+[GetPageCount("<pdffilepath>")]
+[GetCurrentPage("<pdffilepath>")]
+[GetResourceStats()]
+*/
+static bool HandleQueryCmd(const char* cmd, str::Str& result) {
+    if (str::Eq(cmd, "[GetResourceStats()]")) {
+        AutoFreeStr stats = GetResourceStats(false);
+        result.AppendFmt("OK %s", stats.Get());
+        return true;
+    }
+    AutoFreeStr pdfFile;
+    bool pageCount = str::Parse(cmd, "[GetPageCount(\"%s\")]", &pdfFile) != nullptr;
+    if (!pageCount && !str::Parse(cmd, "[GetCurrentPage(\"%s\")]", &pdfFile)) {
+        return false;
+    }
+    WindowTab* tab = FindTabByFile(pdfFile);
+    if (!tab || !tab->ctrl) {
+        result.Append("ERROR");
+        return true;
+    }
+    int n = pageCount ? tab->ctrl->PageCount() : tab->ctrl->CurrentPageNo();
+    result.AppendFmt("OK %d", n);
+    return true;
+}
+
 LRESULT OnDDExecute(HWND hwnd, WPARAM wp, LPARAM lp) {
     UINT_PTR lo = 0, hi = 0;
     if (!UnpackDDElParam(WM_DDE_EXECUTE, lp, &lo, &hi)) {
@@ -1025,3 +1065,246 @@ LRESULT OnCopyData(__unused HWND hwnd, WPARAM wp, LPARAM lp) {
     HandleDdeCmds(hwnd, cmd, ack);
     return ack.fAck ? TRUE : FALSE;
 }
+
+// Command pipe
+
+/*
+A named pipe (\\.\pipe\SumatraPDF-<session id>) that accepts the same commands
+as DDE, one line of commands at a time (terminated by '\n'). For each line
+the reply is a line with "OK" or "ERROR" (or "OK <value>" for query commands).
+
+Unlike DDE, a client doesn't have to wait for the reply before sending more
+commands: all lines received together are queued for the ui thread at once
+and the replies are written back as each command finishes.
+*/
+
+// shared by the pipe thread and the ui task, freed by whoever is last
+struct PipeCmd {
+    AutoFreeStr cmd;
+    AutoFreeStr result;
+    HANDLE done = nullptr;
+    LONG refs = 2;
+};
+
+static HANDLE gCommandPipeThread = nullptr;
+static HANDLE gCommandPipeStopEvent = nullptr;
+static bool gCommandPipeStopping = false;
+
+static void ReleasePipeCmd(PipeCmd* pc) {
+    if (InterlockedDecrement(&pc->refs) == 0) {
+        CloseHandle(pc->done);
+        delete pc;
+    }
+}
+
+static char* ExecutePipeCmd(const char* cmd) {
+    str::Str result;
+    if (HandleQueryCmd(cmd, result)) {
+        return result.StealData();
+    }
+    HWND hwnd = gLastActiveFrameHwnd;
+    if (!hwnd && gWindows.size() > 0) {
+        hwnd = gWindows.at(0)->hwndFrame;
+    }
+    DDEACK ack{};
+    gNoImplicitFocus = true;
+    HandleDdeCmds(hwnd, cmd, ack);
+    gNoImplicitFocus = false;
+    return str::Dup(ack.fAck ? "OK" : "ERROR");
+}
+
+static void ExecutePipeCmdTask(PipeCmd* pc) {
+    if (!gCommandPipeStopping) {
+        pc->result.Set(ExecutePipeCmd(pc->cmd));
+    }
+    SetEvent(pc->done);
+    ReleasePipeCmd(pc);
+}
+
+// returns false on error or if the server is being stopped
+static bool WaitForPipeIo(HANDLE hPipe, OVERLAPPED* ov, BOOL ok, DWORD* n) {
+    if (!ok && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    HANDLE handles[2] = {gCommandPipeStopEvent, ov->hEvent};
+    DWORD res = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+    if (res != WAIT_OBJECT_0 + 1) {
+        CancelIo(hPipe);
+        GetOverlappedResult(hPipe, ov, n, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(hPipe, ov, n, FALSE);
+}
+
+static bool WritePipeReply(HANDLE hPipe, OVERLAPPED* ov, const char* s) {
+    str::Str reply;
+    reply.Append(s ? s : "ERROR");
+    reply.AppendChar('\n');
+    DWORD n = 0;
+    BOOL ok = WriteFile(hPipe, reply.Get(), (DWORD)reply.size(), nullptr, ov);
+    return WaitForPipeIo(hPipe, ov, ok, &n) && n == (DWORD)reply.size();
+}
+
+// queues all complete lines in buf for the ui thread and replies in order
+static bool ExecutePipeLines(HANDLE hPipe, OVERLAPPED* ov, str::Str& buf) {
+    Vec<PipeCmd*> cmds;
+    char* s = buf.Get();
+    char* end = str::FindChar(s, '\n');
+    while (end) {
+        *end = 0;
+        str::TrimWSInPlace(s, str::TrimOpt::Both);
+        if (!str::IsEmpty(s)) {
+            auto pc = new PipeCmd();
+            pc->cmd.SetCopy(s);
+            pc->done = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+            cmds.Append(pc);
+            uitask::Post([pc] { ExecutePipeCmdTask(pc); });
+        }
+        s = end + 1;
+        end = str::FindChar(s, '\n');
+    }
+    buf.RemoveAt(0, (size_t)(s - buf.Get()));
+
+    bool ok = true;
+    for (PipeCmd* pc : cmds) {
+        if (ok) {
+            HANDLE handles[2] = {gCommandPipeStopEvent, pc->done};
+            DWORD res = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            ok = (res == WAIT_OBJECT_0 + 1) && WritePipeReply(hPipe, ov, pc->result);
+        }
+        ReleasePipeCmd(pc);
+    }
+    return ok;
+}
+
+static void HandlePipeClient(HANDLE hPipe, OVERLAPPED* ov) {
+    str::Str buf;
+    char tmp[4096];
+    for (;;) {
+        DWORD n = 0;
+        BOOL ok = ReadFile(hPipe, tmp, (DWORD)sizeof(tmp), nullptr, ov);
+        if (!WaitForPipeIo(hPipe, ov, ok, &n) || n == 0) {
+            return;
+        }
+        buf.Append(tmp, n);
+        // protect against a client that never sends a '\n'
+        if (buf.size() > 1024 * 1024) {
+            logf("HandlePipeClient: line too long\n");
+            return;
+        }
+        if (!ExecutePipeLines(hPipe, ov, buf)) {
+            return;
+        }
+    }
+}
+
+// other users of the session can't connect to the pipe: its DACL only
+// has an entry for the user SumatraPDF is running as
+// the caller must free() the result
+static SECURITY_DESCRIPTOR* NewCurrentUserSecurityDescriptor() {
+    HANDLE hToken = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken)) {
+        return nullptr;
+    }
+    defer {
+        CloseHandle(hToken);
+    };
+    DWORD cbUser = 0;
+    GetTokenInformation(hToken, TokenUser, nullptr, 0, &cbUser);
+    if (cbUser == 0) {
+        return nullptr;
+    }
+    TOKEN_USER* user = (TOKEN_USER*)AllocArray<u8>(cbUser);
+    defer {
+        free(user);
+    };
+    if (!GetTokenInformation(hToken, TokenUser, user, cbUser, &cbUser)) {
+        return nullptr;
+    }
+
+    PSID sid = user->User.Sid;
+    DWORD cbAcl = sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid);
+    // the ACL is allocated together with the security descriptor pointing to it
+    u8* d = AllocArray<u8>(sizeof(SECURITY_DESCRIPTOR) + cbAcl);
+    SECURITY_DESCRIPTOR* sd = (SECURITY_DESCRIPTOR*)d;
+    ACL* acl = (ACL*)(d + sizeof(SECURITY_DESCRIPTOR));
+    bool ok = InitializeAcl(acl, cbAcl, ACL_REVISION) && AddAccessAllowedAce(acl, ACL_REVISION, GENERIC_ALL, sid) &&
+              InitializeSecurityDescriptor(sd, SECURITY_DESCRIPTOR_REVISION) &&
+              SetSecurityDescriptorDacl(sd, TRUE, acl, FALSE);
+    if (!ok) {
+        free(d);
+        return nullptr;
+    }
+    return sd;
+}
+
+static DWORD WINAPI CommandPipeThread(LPVOID) {
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    WCHAR pipeName[64];
+    _snwprintf_s(pipeName, dimof(pipeName), _TRUNCATE, L"\\\\.\\pipe\\SumatraPDF-%u", sessionId);
+
+    // only the first SumatraPDF instance of a session gets to serve commands
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE;
+    DWORD mode = PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS;
+    SECURITY_DESCRIPTOR* sd = NewCurrentUserSecurityDescriptor();
+    if (!sd) {
+        logf("CommandPipeThread: NewCurrentUserSecurityDescriptor() failed with %d\n", (int)GetLastError());
+        DestroyTempAllocator();
+        return 0;
+    }
+    SECURITY_ATTRIBUTES sa{sizeof(sa), sd, FALSE};
+    HANDLE hPipe = CreateNamedPipeW(pipeName, openMode, mode, 1, 4096, 4096, 0, &sa);
+    free(sd);
+    if (!IsValidHandle(hPipe)) {
+        logf("CommandPipeThread: CreateNamedPipeW() failed with %d\n", (int)GetLastError());
+        DestroyTempAllocator();
+        return 0;
+    }
+
+    OVERLAPPED ov{};
+    ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    for (;;) {
+        DWORD n = 0;
+        BOOL ok = ConnectNamedPipe(hPipe, &ov);
+        if (!ok && GetLastError() == ERROR_PIPE_CONNECTED) {
+            ok = TRUE;
+        } else if (!WaitForPipeIo(hPipe, &ov, ok, &n)) {
+            if (WaitForSingleObject(gCommandPipeStopEvent, 0) == WAIT_OBJECT_0) {
+                break;
+            }
+            DisconnectNamedPipe(hPipe);
+            continue;
+        }
+        HandlePipeClient(hPipe, &ov);
+        DisconnectNamedPipe(hPipe);
+        if (WaitForSingleObject(gCommandPipeStopEvent, 0) == WAIT_OBJECT_0) {
+            break;
+        }
+    }
+    CloseHandle(ov.hEvent);
+    CloseHandle(hPipe);
+    DestroyTempAllocator();
+    return 0;
+}
+
+void StartCommandPipeServer() {
+    if (gCommandPipeThread) {
+        return;
+    }
+    gCommandPipeStopping = false;
+    gCommandPipeStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    gCommandPipeThread = CreateThread(nullptr, 0, CommandPipeThread, nullptr, 0, nullptr);
+}
+
+// must be called on the ui thread before uitask::Destroy()
+void StopCommandPipeServer() {
+    if (!gCommandPipeThread) {
+        return;
+    }
+    gCommandPipeStopping = true;
+    SetEvent(gCommandPipeStopEvent);
+    WaitForSingleObject(gCommandPipeThread, INFINITE);
+    SafeCloseHandle(&gCommandPipeThread);
+    SafeCloseHandle(&gCommandPipeStopEvent);
+}
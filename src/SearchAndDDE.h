@@ -9,6 +9,10 @@ LRESULT OnDDExecute(HWND hwnd, WPARAM wp, LPARAM lp);
 LRESULT OnDDETerminate(HWND hwnd, WPARAM wp, LPARAM lp);
 LRESULT OnCopyData(HWND hwnd, WPARAM wp, LPARAM lp);
 
+// accepts batches of DDE commands through a named pipe
+void StartCommandPipeServer();
+void StopCommandPipeServer();
+
 #define HIDE_FWDSRCHMARK_TIMER_ID 4
 #define HIDE_FWDSRCHMARK_DELAY_IN_MS 400
 #define HIDE_FWDSRCHMARK_DECAYINTERVAL_IN_MS 100
@@ -6,6 +6,7 @@
 #include <UIAutomationCoreApi.h>
 #include "utils/ScopedWin.h"
 #include "utils/Dpi.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -133,6 +134,15 @@ void PaintTransparentRectangles(HDC hdc, Rect screenRc, Vec<Rect>& rects, COLORR
     }
 }
 
+// prevent the selection from disappearing while the user is still at it
+// (OnSelectionStop removes it if it is still empty at the end)
+static void KeepEmptyTextSelection(MainWindow* win) {
+    if (!win->CurrentTab()->selectionOnPage) {
+        win->CurrentTab()->selectionOnPage = new Vec<SelectionOnPage>();
+        win->showSelection = true;
+    }
+}
+
 void PaintSelection(MainWindow* win, HDC hdc) {
     CrashIf(!win->AsFixed());
 
@@ -155,13 +165,7 @@ void PaintSelection(MainWindow* win, HDC hdc) {
         // during text selection or after selection is done
         if (MouseAction::SelectingText == win->mouseAction) {
             UpdateTextSelection(win);
-            if (!win->CurrentTab()->selectionOnPage) {
-                // prevent the selection from disappearing while the
-                // user is still at it (OnSelectionStop removes it
-                // if it is still empty at the end)
-                win->CurrentTab()->selectionOnPage = new Vec<SelectionOnPage>();
-                win->showSelection = true;
-            }
+            KeepEmptyTextSelection(win);
         }
 
         CrashIf(!win->CurrentTab()->selectionOnPage);
@@ -174,8 +178,45 @@ void PaintSelection(MainWindow* win, HDC hdc) {
         }
     }
 
+    // only the invalidated part of the canvas is repainted while selecting text
+    Rect screenRc = win->canvasRc;
+    RECT clipRc;
+    int clipType = GetClipBox(hdc, &clipRc);
+    if (clipType != NULLREGION && clipType != ERROR) {
+        screenRc = screenRc.Intersect(ToRect(clipRc));
+    }
     ParsedColor* parsedCol = GetPrefsColor(gGlobalPrefs->fixedPageUI.selectionColor);
-    PaintTransparentRectangles(hdc, win->canvasRc, rects, parsedCol->col);
+    PaintTransparentRectangles(hdc, screenRc, rects, parsedCol->col);
+}
+
+// invalidates only the rects that were added to or removed from the text selection
+// instead of repainting the whole canvas for every mouse move
+void RepaintTextSelection(MainWindow* win) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm) {
+        return;
+    }
+    bool hadSelection = win->CurrentTab()->selectionOnPage != nullptr;
+    UpdateTextSelection(win);
+    KeepEmptyTextSelection(win);
+    if (!hadSelection) {
+        RepaintAsync(win, 0);
+        return;
+    }
+
+    TextSelection* ts = dm->textSelection;
+    Rect dirty;
+    for (int i = 0; i < ts->changedRects.isize(); i++) {
+        Rect rc = dm->CvtToScreen(ts->changedPages[i], ToRectF(ts->changedRects[i]));
+        rc.Inflate(1, 1);
+        dirty = dirty.Union(rc);
+    }
+    dirty = dirty.Intersect(win->canvasRc);
+    if (dirty.IsEmpty()) {
+        return;
+    }
+    RECT rc = ToRECT(dirty);
+    InvalidateRect(win->hwndCanvas, &rc, FALSE);
 }
 
 void UpdateTextSelection(MainWindow* win, bool select) {
@@ -189,6 +230,9 @@ void UpdateTextSelection(MainWindow* win, bool select) {
         if (win->ctrl->ValidPageNo(pageNo)) {
             PointF pt = dm->CvtFromScreen(win->selectionRect.BR(), pageNo);
             dm->textSelection->SelectUpTo(pageNo, pt.x, pt.y);
+            if (dm->textSelection->changedRects.IsEmpty() && win->CurrentTab()->selectionOnPage) {
+                return;
+            }
         }
     }
 
@@ -298,10 +342,149 @@ char* GetSelectedText(WindowTab* tab, const char* lineSep, bool& isTextOnlySelec
     return s;
 }
 
+// text selections spanning more pages are copied on a thread, showing progress
+constexpr int kMinPagesToCopyOnThread = 16;
+
+static Kind kNotifGroupCopyProgress = "copyProgress";
+
+struct CopyTextThreadData : public ProgressUpdateUI {
+    MainWindow* win = nullptr;
+    // a copy, so that the selection can change while copying
+    TextSelection* sel = nullptr;
+    HANDLE thread = nullptr;
+    HGLOBAL text = nullptr;
+
+    ~CopyTextThreadData() override {
+        delete sel;
+        if (text) {
+            GlobalFree(text);
+        }
+        CloseHandle(thread);
+    }
+
+    void UpdateProgress(int current, int total) override {
+        uitask::Post([this, current, total] {
+            if (WasCanceled()) {
+                return;
+            }
+            auto wnd = GetNotificationForGroup(win->hwndCanvas, kNotifGroupCopyProgress);
+            if (!wnd || !UpdateNotificationProgress(wnd, current, total)) {
+                // canceled by closing the notification
+                win->copyTextCanceled = true;
+            }
+        });
+    }
+
+    bool WasCanceled() override {
+        return !MainWindowStillValid(win) || win->copyTextCanceled;
+    }
+};
+
+static void CopyTextEndTask(CopyTextThreadData* data) {
+    MainWindow* win = data->win;
+    if (!MainWindowStillValid(win) || win->copyTextThread != data->thread) {
+        // aborted by AbortCopyingText()
+        delete data;
+        return;
+    }
+    win->copyTextThread = nullptr;
+    RemoveNotificationsForGroup(win->hwndCanvas, kNotifGroupCopyProgress);
+    if (data->text && !win->copyTextCanceled && OpenClipboard(nullptr)) {
+        EmptyClipboard();
+        // on success, the clipboard owns the memory
+        if (SetClipboardData(CF_UNICODETEXT, data->text)) {
+            data->text = nullptr;
+        }
+        CloseClipboard();
+    }
+    delete data;
+}
+
+static DWORD WINAPI CopyTextThread(LPVOID threadData) {
+    CopyTextThreadData* data = (CopyTextThreadData*)threadData;
+    const char* lineSep = "\r\n";
+    // the first pass extracts the text of pages not yet in the text cache
+    // and counts the chars, so that the text is written straight into
+    // clipboard memory of the exact size in the second pass
+    i64 len = data->sel->ExtractText(lineSep, nullptr, 0, data);
+    if (len > 0) {
+        HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, ((size_t)len + 1) * sizeof(WCHAR));
+        WCHAR* dst = mem ? (WCHAR*)GlobalLock(mem) : nullptr;
+        if (dst) {
+            i64 len2 = data->sel->ExtractText(lineSep, dst, len, data);
+            dst[std::clamp(len2, (i64)0, len)] = 0;
+            GlobalUnlock(mem);
+            data->text = len2 > 0 ? mem : nullptr;
+        }
+        if (mem && !data->text) {
+            GlobalFree(mem);
+        }
+    }
+    uitask::Post([data] { CopyTextEndTask(data); });
+    DestroyTempAllocator();
+    return 0;
+}
+
+void AbortCopyingText(MainWindow* win) {
+    if (win->copyTextThread) {
+        win->copyTextCanceled = true;
+        WaitForSingleObject(win->copyTextThread, INFINITE);
+        // CopyTextEndTask() frees the thread data
+        win->copyTextThread = nullptr;
+        RemoveNotificationsForGroup(win->hwndCanvas, kNotifGroupCopyProgress);
+    }
+    win->copyTextCanceled = false;
+}
+
+// returns false if the selection is small enough to be copied right away
+static bool CopyTextSelectionOnThread(MainWindow* win, DisplayModel* dm) {
+    TextSelection* textSel = dm->textSelection;
+    int fromPage, fromGlyph, toPage, toGlyph;
+    textSel->GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
+    if (toPage - fromPage + 1 < kMinPagesToCopyOnThread) {
+        return false;
+    }
+
+    AbortCopyingText(win);
+    auto data = new CopyTextThreadData();
+    data->win = win;
+    data->sel = new TextSelection(dm->GetEngine(), dm->textCache);
+    data->sel->startPage = textSel->startPage;
+    data->sel->startGlyph = textSel->startGlyph;
+    data->sel->endPage = textSel->endPage;
+    data->sel->endGlyph = textSel->endGlyph;
+
+    NotificationCreateArgs args;
+    args.hwndParent = win->hwndCanvas;
+    args.timeoutMs = 0;
+    args.progressMsg = _TRA("Copying page %d of %d...");
+    args.groupId = kNotifGroupCopyProgress;
+    ShowNotification(args);
+
+    // started suspended so that the thread handle is set before CopyTextEndTask() can run
+    data->thread = CreateThread(nullptr, 0, CopyTextThread, data, CREATE_SUSPENDED, nullptr);
+    if (!data->thread) {
+        RemoveNotificationsForGroup(win->hwndCanvas, kNotifGroupCopyProgress);
+        delete data;
+        return false;
+    }
+    win->copyTextThread = data->thread;
+    ResumeThread(data->thread);
+    return true;
+}
+
 void CopySelectionToClipboard(MainWindow* win) {
     WindowTab* tab = win->CurrentTab();
     CrashIf(tab->selectionOnPage->size() == 0 && win->mouseAction != MouseAction::SelectingText);
 
+    DisplayModel* dm = win->AsFixed();
+    bool canCopyText = gDisableDocumentRestrictions || !dm || dm->GetEngine()->AllowsCopyingText();
+    if (dm && canCopyText && dm->textSelection->result.len > 0 && !dm->GetEngine()->IsImageCollection()) {
+        if (CopyTextSelectionOnThread(win, dm)) {
+            return;
+        }
+    }
+
     if (!OpenClipboard(nullptr)) {
         return;
     }
@@ -310,10 +493,9 @@ void CopySelectionToClipboard(MainWindow* win) {
         CloseClipboard();
     };
 
-    DisplayModel* dm = win->AsFixed();
     char* selText = nullptr;
     bool isTextOnlySelectionOut = false;
-    if (!gDisableDocumentRestrictions && (dm && !dm->GetEngine()->AllowsCopyingText())) {
+    if (!canCopyText) {
         NotificationCreateArgs args;
         args.hwndParent = win->hwndCanvas;
         args.msg = _TRA("Copying text was denied (copying as image only)");
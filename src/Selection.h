@@ -27,8 +27,10 @@ void PaintTransparentRectangles(HDC hdc, Rect screenRc, Vec<Rect>& rects, COLORR
                                 int margin = 1);
 void PaintSelection(MainWindow* win, HDC hdc);
 void UpdateTextSelection(MainWindow* win, bool select = true);
+void RepaintTextSelection(MainWindow* win);
 void ZoomToSelection(MainWindow* win, float factor, bool scrollToFit = true, bool relative = false);
 void CopySelectionToClipboard(MainWindow* win);
+void AbortCopyingText(MainWindow* win);
 void OnSelectAll(MainWindow* win, bool textOnly = false);
 bool NeedsSelectionEdgeAutoscroll(MainWindow* win, int x, int y);
 void OnSelectionEdgeAutoscroll(MainWindow* win, int x, int y);
@@ -80,6 +80,9 @@ struct ComicBookUI {
     // if true, default to displaying Comic Book files in manga mode (from
     // right to left if showing 2 pages at a time)
     bool cbxMangaMode;
+    // how images are scaled for display (lanczos, bicubic, gdiplus).
+    // lanczos is the sharpest, gdiplus uses Windows' own scaling
+    char* imageScaling;
 };
 
 // customization options for CHM UI. If UseFixedPageUI is true,
@@ -206,6 +209,10 @@ struct FileState {
     // Hex encoded MD5 fingerprint of file content (32 chars) followed by
     // crypt key (64 chars) - only applies for PDF documents
     char* decryptionKey;
+    // Hex encoded fingerprint of file content (32 chars) as used for the
+    // keys of cached tiles, text and layouts, updated whenever the
+    // document is opened
+    char* fingerprint;
     // if true, we use global defaults when opening this file (instead of
     // the values below)
     bool useDefaultState;
@@ -403,6 +410,49 @@ struct GlobalPrefs {
     // actual resolution of the main screen in DPI (if this value isn't
     // positive, the system's UI setting is used)
     int customScreenDPI;
+    // number of threads used for rendering pages (if this value isn't
+    // positive, the number of processor cores minus one is used)
+    int renderThreads;
+    // number of threads used for decoding a JPEG 2000 image (if this value
+    // isn't positive, the cores not used by the other rendering threads are
+    // used)
+    int jpxDecodeThreads;
+    // if true, PDF, XPS and other MuPDF documents are rendered in separate
+    // helper processes, one per rendering thread, so that a crash in a
+    // damaged document doesn't close the viewer
+    bool renderInWorkerProcesses;
+    // maximum amount of memory (in MB) used for caching rendered pages (if
+    // this value isn't positive, it's based on the amount of physical
+    // memory)
+    int renderCacheSize;
+    // maximum amount of disk space (in MB) used for saving rendered pages,
+    // so that documents show up faster when they're opened again (if this
+    // value isn't positive, rendered pages aren't saved)
+    int tileCacheSize;
+    // number of minutes after which documents in background tabs are
+    // unloaded to free memory (they're reloaded when the tab is selected
+    // again; if this value isn't positive, documents are never unloaded)
+    int hibernateTabsAfter;
+    // percentage of the time (of one processor core) used for preparing
+    // the text and the content boxes of open documents while the computer
+    // isn't used and isn't running on battery (if this value isn't
+    // positive, they're only prepared when needed)
+    int idleTasksCpuUsage;
+    // amount of memory (in MB) above which preparing open documents pauses
+    // (if this value isn't positive, it's based on the amount of physical
+    // memory)
+    int idleTasksMemoryLimit;
+    // how text of EPUB, FB2, MOBI and other ebooks is laid out and drawn
+    // (gdiplus, directwrite). directwrite uses DirectWrite and Direct2D,
+    // which can draw with the GPU
+    char* ebookTextRendering;
+    // if true, rendered pages are painted with Direct2D, which can use the
+    // GPU for scaling them (not used in remote desktop sessions)
+    bool gpuPagePainting;
+    // if true, PDF, XPS and similar documents are printed as vector
+    // graphics instead of bitmaps where possible, which makes print jobs of
+    // text documents much smaller
+    bool vectorPrinting;
     // information about opened files (in most recently used order)
     Vec<FileState*>* fileStates;
     // state of the last session, usage depends on RestoreSession
@@ -472,9 +522,10 @@ static const FieldInfo gComicBookUIFields[] = {
     {offsetof(ComicBookUI, windowMargin), SettingType::Compact, (intptr_t)&gWindowMargin_1_Info},
     {offsetof(ComicBookUI, pageSpacing), SettingType::Compact, (intptr_t)&gSize_1_Info},
     {offsetof(ComicBookUI, cbxMangaMode), SettingType::Bool, false},
+    {offsetof(ComicBookUI, imageScaling), SettingType::String, (intptr_t) "lanczos"},
 };
-static const StructInfo gComicBookUIInfo = {sizeof(ComicBookUI), 3, gComicBookUIFields,
-                                            "WindowMargin\0PageSpacing\0CbxMangaMode"};
+static const StructInfo gComicBookUIInfo = {sizeof(ComicBookUI), 4, gComicBookUIFields,
+                                            "WindowMargin\0PageSpacing\0CbxMangaMode\0ImageScaling"};
 
 static const FieldInfo gChmUIFields[] = {
     {offsetof(ChmUI, useFixedPageUI), SettingType::Bool, false},
@@ -562,6 +613,7 @@ static const FieldInfo gFileStateFields[] = {
     {offsetof(FileState, isMissing), SettingType::Bool, false},
     {offsetof(FileState, openCount), SettingType::Int, 0},
     {offsetof(FileState, decryptionKey), SettingType::String, 0},
+    {offsetof(FileState, fingerprint), SettingType::String, 0},
     {offsetof(FileState, useDefaultState), SettingType::Bool, false},
     {offsetof(FileState, displayMode), SettingType::String, (intptr_t) "automatic"},
     {offsetof(FileState, scrollPos), SettingType::Compact, (intptr_t)&gPointFInfo},
@@ -577,9 +629,9 @@ static const FieldInfo gFileStateFields[] = {
     {offsetof(FileState, tocState), SettingType::IntArray, 0},
 };
 static StructInfo gFileStateInfo = {
-    sizeof(FileState), 19, gFileStateFields,
-    "FilePath\0Favorites\0IsPinned\0IsMissing\0OpenCount\0DecryptionKey\0UseDefaultState\0DisplayMode\0ScrollPos\0PageN"
-    "o\0Zoom\0Rotation\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0DisplayR2L\0ReparseIdx\0TocState"};
+    sizeof(FileState), 20, gFileStateFields,
+    "FilePath\0Favorites\0IsPinned\0IsMissing\0OpenCount\0DecryptionKey\0Fingerprint\0UseDefaultState\0DisplayMode\0Scr"
+    "ollPos\0PageNo\0Zoom\0Rotation\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0DisplayR2L\0ReparseIdx\0TocState"};
 
 static const FieldInfo gPointF_1_Fields[] = {
     {offsetof(PointF, x), SettingType::Float, (intptr_t) "0"},
@@ -678,6 +730,17 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {offsetof(GlobalPrefs, useTabs), SettingType::Bool, true},
     {offsetof(GlobalPrefs, useSysColors), SettingType::Bool, false},
     {offsetof(GlobalPrefs, customScreenDPI), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, renderThreads), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, jpxDecodeThreads), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, renderInWorkerProcesses), SettingType::Bool, false},
+    {offsetof(GlobalPrefs, renderCacheSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, tileCacheSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, hibernateTabsAfter), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, idleTasksCpuUsage), SettingType::Int, 50},
+    {offsetof(GlobalPrefs, idleTasksMemoryLimit), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, ebookTextRendering), SettingType::String, (intptr_t) "gdiplus"},
+    {offsetof(GlobalPrefs, gpuPagePainting), SettingType::Bool, false},
+    {offsetof(GlobalPrefs, vectorPrinting), SettingType::Bool, false},
     {(size_t)-1, SettingType::Comment, 0},
     {offsetof(GlobalPrefs, fileStates), SettingType::Array, (intptr_t)&gFileStateInfo},
     {offsetof(GlobalPrefs, sessionData), SettingType::Array, (intptr_t)&gSessionDataInfo},
@@ -688,13 +751,15 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {(size_t)-1, SettingType::Comment, (intptr_t) "Settings below are not recognized by the current version"},
 };
 static const StructInfo gGlobalPrefsInfo = {
-    sizeof(GlobalPrefs), 58, gGlobalPrefsFields,
+    sizeof(GlobalPrefs), 69, gGlobalPrefsFields,
     "\0FixedPageUI\0ComicBookUI\0ChmUI\0\0SelectionHandlers\0ExternalViewers\0\0ZoomLevels\0ZoomIncrement\0\0PrinterDef"
     "aults\0ForwardSearch\0Annotations\0DefaultPasswords\0\0RememberOpenedFiles\0RememberStatePerDocument\0RestoreSessi"
     "on\0UiLanguage\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0Shortcuts\0EscToExit"
     "\0ReuseInstance\0ReloadModifiedDocuments\0\0MainWindowBackground\0FullPathInTitle\0ShowMenubar\0ShowToolbar\0ShowF"
     "avorites\0ShowToc\0NoHomeTab\0TocDy\0SidebarDx\0ToolbarSize\0TabWidth\0TreeFontSize\0SmoothScroll\0ShowStartPage\0"
-    "CheckForUpdates\0VersionToSkip\0WindowState\0WindowPos\0UseTabs\0UseSysColors\0CustomScreenDPI\0\0FileStates\0Sess"
-    "ionData\0ReopenOnce\0TimeOfLastUpdateCheck\0OpenCountWeek\0\0"};
+    "CheckForUpdates\0VersionToSkip\0WindowState\0WindowPos\0UseTabs\0UseSysColors\0CustomScreenDPI\0RenderThreads\0Jpx"
+    "DecodeThreads\0RenderInWorkerProcesses\0RenderCacheSize\0TileCacheSize\0HibernateTabsAfter\0IdleTasksCpuUsage\0Idl"
+    "eTasksMemoryLimit\0EbookTextRendering\0GpuPagePainting\0VectorPrinting\0\0FileStates\0SessionData\0ReopenOnce\0Tim"
+    "eOfLastUpdateCheck\0OpenCountWeek\0\0"};
 
 #endif
@@ -2,6 +2,7 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include <psapi.h>
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
@@ -18,6 +19,7 @@
 #include "GlobalPrefs.h"
 #include "ChmModel.h"
 #include "DisplayModel.h"
+#include "FileThumbnails.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
@@ -61,7 +63,88 @@ static bool IsFullRange(Vec<PageRange>& ranges) {
     return isFull;
 }
 
-static void BenchLoadRender(EngineBase* engine, int pagenum) {
+// samples of one measured phase (in ms, unless the name has a different unit)
+// of benchmarking one file, over all iterations
+struct BenchPhase {
+    AutoFreeStr file;
+    const char* name = nullptr;
+    Vec<double> samples;
+};
+
+struct BenchResults {
+    int iterations = 1;
+    // names of the scenarios to run, all of them if empty
+    StrVec scenarios;
+    Vec<BenchPhase*> phases;
+
+    ~BenchResults() {
+        DeleteVecMembers(phases);
+    }
+};
+
+// loading (which for ebooks includes laying out all pages) is always measured
+static const char* kBenchScenarios = "render,search,selection,toc,thumbnail";
+
+static bool IsBenchScenario(BenchResults& res, const char* name) {
+    return res.scenarios.size() == 0 || res.scenarios.Contains(name);
+}
+
+static void AddBenchSample(BenchResults& res, const char* file, const char* name, double value) {
+    for (BenchPhase* phase : res.phases) {
+        if (str::Eq(phase->name, name) && str::Eq(phase->file, file)) {
+            phase->samples.Append(value);
+            return;
+        }
+    }
+    BenchPhase* phase = new BenchPhase();
+    phase->file.SetCopy(file);
+    phase->name = name;
+    phase->samples.Append(value);
+    res.phases.Append(phase);
+}
+
+struct BenchStats {
+    int count = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double max = 0;
+};
+
+// percentiles use the nearest rank
+static BenchStats CalcBenchStats(const Vec<double>& samples) {
+    BenchStats stats;
+    Vec<double> sorted;
+    for (double v : samples) {
+        sorted.Append(v);
+        stats.mean += v;
+    }
+    stats.count = sorted.isize();
+    if (stats.count == 0) {
+        return stats;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    stats.mean /= stats.count;
+    stats.p50 = sorted.at((int)ceil(0.50 * stats.count) - 1);
+    stats.p95 = sorted.at((int)ceil(0.95 * stats.count) - 1);
+    stats.max = sorted.Last();
+    return stats;
+}
+
+// peak memory and GDI objects are for the whole process, so they
+// include the files benchmarked before
+static void AddBenchMemorySamples(BenchResults& res, const char* file) {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        AddBenchSample(res, file, "working_set_mb", (double)pmc.WorkingSetSize / (1024.0 * 1024.0));
+        AddBenchSample(res, file, "peak_working_set_mb", (double)pmc.PeakWorkingSetSize / (1024.0 * 1024.0));
+    }
+    AddBenchSample(res, file, "gdi_objects", (double)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+    AddBenchSample(res, file, "gdi_objects_peak", (double)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS_PEAK));
+}
+
+static void BenchLoadRender(EngineBase* engine, int pagenum, BenchResults& res, const char* file) {
     auto t = TimeGet();
     bool ok = engine->BenchLoadPage(pagenum);
 
@@ -71,21 +154,120 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
     }
     double timeMs = TimeSinceInMs(t);
     logf("pageload   %3d: %.2f ms\n", pagenum, timeMs);
+    AddBenchSample(res, file, "pageload", timeMs);
+
+    // the second rendering shows how much the engine's caches help
+    for (int warm = 0; warm < 2; warm++) {
+        t = TimeGet();
+        RenderPageArgs args(pagenum, 1.0, 0);
+        RenderedBitmap* rendered = engine->RenderPage(args);
+
+        if (!rendered) {
+            logf("Error: failed to render page %d\n", pagenum);
+            return;
+        }
+        delete rendered;
+        timeMs = TimeSinceInMs(t);
+        logf("pagerender %3d: %.2f ms%s\n", pagenum, timeMs, warm ? " (warm)" : "");
+        AddBenchSample(res, file, warm ? "render_warm" : "render_cold", timeMs);
+    }
+}
+
+// selects all the text of the document (as with Ctrl+A) and copies it
+static void BenchSelection(EngineBase* engine, DocumentTextCache* textCache, BenchResults& res, const char* file) {
+    auto t = TimeGet();
+    TextSelection sel(engine, textCache);
+    sel.StartAt(1, 0);
+    // -1 is the end of the last page
+    sel.SelectUpTo(engine->PageCount(), -1);
+    AutoFreeWstr text = sel.ExtractText("\r\n");
+    double timeMs = TimeSinceInMs(t);
+    logf("select all: %.2f ms, %d chars\n", timeMs, (int)str::Len(text));
+    AddBenchSample(res, file, "selection", timeMs);
+}
+
+// searches the whole document, once all the text has been extracted
+static void BenchText(EngineBase* engine, BenchResults& res, const char* file) {
+    bool benchSearch = IsBenchScenario(res, "search");
+    bool benchSelection = IsBenchScenario(res, "selection");
+    if (!benchSearch && !benchSelection) {
+        return;
+    }
+    DocumentTextCache* textCache = new DocumentTextCache(engine);
+    int nPages = engine->PageCount();
+    i64 nChars = 0;
+    auto t = TimeGet();
+    for (int i = 1; i <= nPages; i++) {
+        int len = 0;
+        textCache->GetTextForPage(i, &len);
+        nChars += len;
+    }
+    double timeMs = TimeSinceInMs(t);
+    logf("text extraction: %.2f ms\n", timeMs);
+    AddBenchSample(res, file, "text_extraction", timeMs);
+    AutoFreeStr memUse = textCache->FormatMemoryUse();
+    logf("text memory: %s\n", memUse.Get());
+    if (nChars == 0) {
+        delete textCache;
+        return;
+    }
+    if (benchSelection) {
+        BenchSelection(engine, textCache, res, file);
+    }
+    if (!benchSearch) {
+        delete textCache;
+        return;
+    }
+
+    double mb = (double)(nChars * sizeof(WCHAR)) / (1024.0 * 1024.0);
+    // a common word and one that isn't in most documents, which has to scan all the text
+    const WCHAR* texts[] = {L"the", L"sumatrapdf xyzzy"};
+    for (const WCHAR* text : texts) {
+        for (int matchCase = 0; matchCase < 2; matchCase++) {
+            for (int forward = 1; forward >= 0; forward--) {
+                TextSearch search(engine, textCache);
+                search.SetSensitive(matchCase != 0);
+                search.SetDirection(forward ? TextSearchDirection::Forward : TextSearchDirection::Backward);
+                t = TimeGet();
+                int nMatches = 0;
+                TextSel* sel = search.FindFirst(forward ? 1 : nPages, text);
+                while (sel) {
+                    nMatches++;
+                    sel = search.FindNext();
+                }
+                timeMs = TimeSinceInMs(t);
+                double mbPerSec = timeMs > 0 ? mb * 1000.0 / timeMs : 0;
+                const char* how = matchCase ? "match case" : "ignore case";
+                const char* dir = forward ? "forward" : "backward";
+                logf("search '%s' %s %s: %d matches, %.2f ms, %.1f MB/s\n", ToUtf8Temp(text), how, dir,
+                     nMatches, timeMs, mbPerSec);
+                AddBenchSample(res, file, "search", timeMs);
+            }
+        }
+    }
+    delete textCache;
+}
 
-    t = TimeGet();
-    RenderPageArgs args(pagenum, 1.0, 0);
-    RenderedBitmap* rendered = engine->RenderPage(args);
+// the phase of loading a file, the first iteration loads it with a cold cache
+static const char* BenchLoadPhase(bool cold) {
+    return cold ? "load_cold" : "load_warm";
+}
 
-    if (!rendered) {
-        logf("Error: failed to render page %d\n", pagenum);
+// opening a file without buffering (and no other open handles to it) makes
+// the system cache manager drop the cached data of the file. Without this
+// GuessFileType() would've already read the start of the file into the cache
+static void EvictFileFromCache(const char* path) {
+    WCHAR* pathW = ToWstrTemp(path);
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        logf("EvictFileFromCache: failed to open '%s'\n", path);
         return;
     }
-    delete rendered;
-    timeMs = TimeSinceInMs(t);
-    logf("pagerender %3d: %.2f ms\n", pagenum, timeMs);
+    CloseHandle(h);
 }
 
-static void BenchChmLoadOnly(const char* filePath) {
+static void BenchChmLoadOnly(const char* filePath, bool cold, BenchResults& res) {
     auto total = TimeGet();
     logf("Starting: %s\n", filePath);
 
@@ -97,32 +279,43 @@ static void BenchChmLoadOnly(const char* filePath) {
     }
 
     double timeMs = TimeSinceInMs(t);
-    logf("load: %.2f ms\n", timeMs);
+    logf("load: %.2f ms%s\n", timeMs, cold ? " (cold)" : "");
+    AddBenchSample(res, filePath, BenchLoadPhase(cold), timeMs);
+    AddBenchMemorySamples(res, filePath);
 
     delete chmModel;
 
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), filePath);
 }
 
-static void BenchFile(const char* path, const char* pagesSpec) {
-    if (!file::Exists(path)) {
+// renders the first page the way thumbnails for the Frequently Read list are
+// (cf. ControllerCallbackHandler::RenderThumbnail)
+static void BenchThumbnail(EngineBase* engine, BenchResults& res, const char* file) {
+    auto t = TimeGet();
+    RectF pageRect = engine->PageMediabox(1);
+    if (pageRect.IsEmpty()) {
         return;
     }
-
-    // ad-hoc: if enabled times layout instead of rendering and does layout
-    // using all text rendering methods, so that we can compare and find
-    // docs that take a long time to load
-
-    Kind kind = GuessFileType(path, true);
-    if (!kind) {
-        return;
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
+    float zoom = kThumbnailDx / (float)pageRect.dx;
+    if (pageRect.dy > (float)kThumbnailDy / zoom) {
+        pageRect.dy = (float)kThumbnailDy / zoom;
     }
-
-    if (ChmModel::IsSupportedFileType(kind) && !gGlobalPrefs->chmUI.useFixedPageUI) {
-        BenchChmLoadOnly(path);
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0, true);
+    RenderPageArgs args(1, zoom, 0, &pageRect);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    double timeMs = TimeSinceInMs(t);
+    if (!bmp) {
+        logf("Error: failed to render thumbnail\n");
         return;
     }
+    delete bmp;
+    logf("thumbnail: %.2f ms\n", timeMs);
+    AddBenchSample(res, file, "thumbnail", timeMs);
+}
 
+// cold is true for the first iteration, whose file was evicted from the OS cache
+static void BenchFileOnce(const char* path, const char* pagesSpec, bool cold, BenchResults& res) {
     auto total = TimeGet();
     logf("Starting: %s\n", path);
 
@@ -134,33 +327,79 @@ static void BenchFile(const char* path, const char* pagesSpec) {
     }
 
     double timeMs = TimeSinceInMs(t);
-    logf("load: %.2f ms\n", timeMs);
+    logf("load: %.2f ms%s\n", timeMs, cold ? " (cold)" : "");
+    AddBenchSample(res, path, BenchLoadPhase(cold), timeMs);
     int pages = engine->PageCount();
     logf("page count: %d\n", pages);
 
-    if (!pagesSpec) {
+    if (IsBenchScenario(res, "toc")) {
+        t = TimeGet();
+        TocTree* toc = engine->GetToc();
+        timeMs = TimeSinceInMs(t);
+        logf("toc: %.2f ms%s\n", timeMs, toc ? "" : " (no toc)");
+        AddBenchSample(res, path, "toc", timeMs);
+    }
+
+    if (IsBenchScenario(res, "thumbnail")) {
+        BenchThumbnail(engine, res, path);
+    }
+
+    bool benchRender = IsBenchScenario(res, "render");
+    if (!pagesSpec && benchRender) {
         for (int i = 1; i <= pages; i++) {
-            BenchLoadRender(engine, i);
+            BenchLoadRender(engine, i, res, path);
         }
     }
 
     CrashIf(pagesSpec && !IsBenchPagesInfo(pagesSpec));
     Vec<PageRange> ranges;
-    if (ParsePageRanges(pagesSpec, ranges)) {
+    if (benchRender && ParsePageRanges(pagesSpec, ranges)) {
         for (size_t i = 0; i < ranges.size(); i++) {
             for (int j = ranges.at(i).start; j <= ranges.at(i).end; j++) {
                 if (1 <= j && j <= pages) {
-                    BenchLoadRender(engine, j);
+                    BenchLoadRender(engine, j, res, path);
                 }
             }
         }
     }
 
+    BenchText(engine, res, path);
+    AddBenchMemorySamples(res, path);
+
     delete engine;
 
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), path);
 }
 
+static void BenchFile(const char* path, const char* pagesSpec, BenchResults& res) {
+    if (!file::Exists(path)) {
+        return;
+    }
+
+    // ad-hoc: if enabled times layout instead of rendering and does layout
+    // using all text rendering methods, so that we can compare and find
+    // docs that take a long time to load
+
+    Kind kind = GuessFileType(path, true);
+    if (!kind) {
+        return;
+    }
+
+    bool isChm = ChmModel::IsSupportedFileType(kind) && !gGlobalPrefs->chmUI.useFixedPageUI;
+    // the following iterations show the timings with the file in the OS cache
+    for (int i = 0; i < res.iterations; i++) {
+        bool cold = (i == 0);
+        if (cold) {
+            EvictFileFromCache(path);
+        }
+        if (isChm) {
+            BenchChmLoadOnly(path, cold, res);
+        } else {
+            BenchFileOnce(path, pagesSpec, cold, res);
+        }
+    }
+}
+
 static bool IsFileToBench(const char* path) {
     Kind kind = GuessFileType(path, true);
     if (IsSupportedFileType(kind, true)) {
@@ -181,26 +420,125 @@ static void CollectFilesToBench(char* dir, StrVec& files) {
     });
 }
 
-static void BenchDir(char* dir) {
+static void BenchDir(char* dir, BenchResults& res) {
     StrVec files;
     CollectFilesToBench(dir, files);
     for (size_t i = 0; i < files.size(); i++) {
-        BenchFile(files.at(i), nullptr);
+        BenchFile(files.at(i), nullptr, res);
+    }
+}
+
+static void LogBenchResults(BenchResults& res) {
+    logf("Results of %d iteration(s) (count, mean, p50, p95, max):\n", res.iterations);
+    for (BenchPhase* phase : res.phases) {
+        BenchStats s = CalcBenchStats(phase->samples);
+        logf("%-20s %5d %10.2f %10.2f %10.2f %10.2f  %s\n", phase->name, s.count, s.mean, s.p50, s.p95, s.max,
+             phase->file.Get());
+    }
+}
+
+// the file name comes last in .csv files so that it doesn't need quoting
+static bool SaveBenchResults(BenchResults& res, const char* path) {
+    bool isJson = str::EndsWithI(path, ".json");
+    str::Str out;
+    out.Append(isJson ? "[\n" : "phase,count,mean,p50,p95,max,file\n");
+    for (int i = 0; i < res.phases.isize(); i++) {
+        BenchPhase* phase = res.phases.at(i);
+        BenchStats s = CalcBenchStats(phase->samples);
+        if (!isJson) {
+            out.AppendFmt("%s,%d,%.3f,%.3f,%.3f,%.3f,%s\n", phase->name, s.count, s.mean, s.p50, s.p95, s.max,
+                          phase->file.Get());
+            continue;
+        }
+        str::Str file;
+        for (const char* c = phase->file.Get(); *c; c++) {
+            if (*c == '\\' || *c == '"') {
+                file.AppendChar('\\');
+            }
+            file.AppendChar(*c);
+        }
+        out.AppendFmt("  {\"file\": \"%s\", \"phase\": \"%s\", \"count\": %d, ", file.Get(), phase->name, s.count);
+        out.AppendFmt("\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f}%s\n", s.mean, s.p50, s.p95, s.max,
+                      i + 1 < res.phases.isize() ? "," : "");
+    }
+    if (isJson) {
+        out.Append("]\n");
+    }
+    return file::WriteFile(path, out.AsByteSlice());
+}
+
+// compares the medians to those in a .csv file saved with -bench-out
+static void CompareBenchResults(BenchResults& res, const char* baselinePath) {
+    ByteSlice data = file::ReadFile(baselinePath);
+    if (data.empty()) {
+        logf("Error: failed to read %s\n", baselinePath);
+        return;
+    }
+    StrVec lines;
+    Split(lines, (const char*)data.data(), "\n", true);
+    data.Free();
+
+    logf("Comparison with %s (p50 baseline -> current):\n", baselinePath);
+    int nRegressions = 0;
+    for (char* line : lines) {
+        str::TrimWSInPlace(line, str::TrimOpt::Right);
+        AutoFreeStr name;
+        int count;
+        float mean, p50, p95, max;
+        const char* file = str::Parse(line, "%S,%d,%f,%f,%f,%f,", &name, &count, &mean, &p50, &p95, &max);
+        if (!file) {
+            // e.g. the header
+            continue;
+        }
+        for (BenchPhase* phase : res.phases) {
+            if (!str::EqI(phase->file, file) || !str::Eq(phase->name, name)) {
+                continue;
+            }
+            BenchStats s = CalcBenchStats(phase->samples);
+            double diff = p50 > 0 ? (s.p50 - p50) * 100.0 / p50 : 0;
+            // ignore noise in very short phases
+            bool isRegression = diff > 10.0 && s.p50 - p50 > 1.0;
+            nRegressions += isRegression ? 1 : 0;
+            logf("%-20s %10.2f -> %10.2f (%+.1f%%)%s  %s\n", phase->name, p50, s.p50, diff,
+                 isRegression ? " REGRESSION" : "", phase->file.Get());
+        }
     }
+    logf("%d regression(s)\n", nRegressions);
 }
 
-void BenchFileOrDir(StrVec& pathsToBench) {
+void BenchFileOrDir(Flags* flags) {
+    StrVec& pathsToBench = flags->pathsToBenchmark;
+    BenchResults res;
+    res.iterations = std::max(flags->benchIterations, 1);
+    if (flags->benchScenarios) {
+        StrVec known;
+        Split(known, kBenchScenarios, ",");
+        Split(res.scenarios, flags->benchScenarios, ",", true);
+        for (char* name : res.scenarios) {
+            if (!known.Contains(name)) {
+                logf("Error: unknown benchmark scenario '%s' (known: %s)\n", name, kBenchScenarios);
+            }
+        }
+    }
     size_t n = pathsToBench.size() / 2;
     for (size_t i = 0; i < n; i++) {
         char* path = pathsToBench.at(2 * i);
         if (file::Exists(path)) {
-            BenchFile(path, pathsToBench.at(2 * i + 1));
+            BenchFile(path, pathsToBench.at(2 * i + 1), res);
         } else if (dir::Exists(path)) {
-            BenchDir(path);
+            BenchDir(path, res);
         } else {
             logf("Error: file or dir %s doesn't exist", path);
         }
     }
+
+    LogBenchResults(res);
+    if (flags->benchOutPath && !SaveBenchResults(res, flags->benchOutPath)) {
+        logf("Error: failed to save results to %s\n", flags->benchOutPath);
+    }
+    if (flags->benchBaselinePath) {
+        CompareBenchResults(res, flags->benchBaselinePath);
+    }
 }
 
 static bool IsStressTestSupportedFile(const char* filePath, const char* filter) {
@@ -424,6 +762,160 @@ static size_t GetAllMatchingFiles(const char* dir, const char* filter, StrVec& f
 a human advancing one page at a time. This is mostly to run through a large number
 of PDFs before a release to make sure we're crash proof. */
 
+// with -stress-perf <percent>, load and render times and memory use are compared
+// to budgets in kStressBudgetsFileName in the tested directory (or next to the
+// tested file). Values that exceed their budget by more than <percent> are
+// reported as regressions. Values without a budget become the budget, so the
+// first run records them
+
+constexpr const char* kStressBudgetsFileName = "stress-budgets.csv";
+
+struct StressBudget {
+    // relative to baseDir of StressPerf
+    AutoFreeStr path;
+    const char* kind = nullptr;
+    // 0 for values of the whole file
+    int pageNo = 0;
+    double budget = 0;
+};
+
+struct StressPerf {
+    AutoFreeStr baseDir;
+    AutoFreeStr budgetsPath;
+    int thresholdPercent = 0;
+    Vec<StressBudget*> budgets;
+    // number of stress tests not yet finished
+    int nActive = 0;
+    int nChecked = 0;
+    int nNew = 0;
+    int nRegressions = 0;
+
+    ~StressPerf() {
+        DeleteVecMembers(budgets);
+    }
+};
+
+static StressPerf* gStressPerf = nullptr;
+
+static const char* kStressBudgetKinds[] = {"load", "render", "memory"};
+
+static void LoadStressBudgets(StressPerf* perf) {
+    ByteSlice data = file::ReadFile(perf->budgetsPath);
+    if (data.empty()) {
+        return;
+    }
+    StrVec lines;
+    Split(lines, (const char*)data.data(), "\n", true);
+    data.Free();
+    for (char* line : lines) {
+        str::TrimWSInPlace(line, str::TrimOpt::Right);
+        AutoFreeStr kind;
+        int pageNo;
+        float budget;
+        const char* path = str::Parse(line, "%S,%d,%f,", &kind, &pageNo, &budget);
+        if (!path) {
+            // e.g. the header
+            continue;
+        }
+        for (const char* knownKind : kStressBudgetKinds) {
+            if (str::Eq(kind, knownKind)) {
+                StressBudget* b = new StressBudget();
+                b->path.SetCopy(path);
+                b->kind = knownKind;
+                b->pageNo = pageNo;
+                b->budget = budget;
+                perf->budgets.Append(b);
+            }
+        }
+    }
+}
+
+static void SaveStressBudgets(StressPerf* perf) {
+    str::Str out;
+    out.Append("kind,page,budget,file\n");
+    for (StressBudget* b : perf->budgets) {
+        out.AppendFmt("%s,%d,%.1f,%s\n", b->kind, b->pageNo, b->budget, b->path.Get());
+    }
+    if (!file::WriteFile(perf->budgetsPath, out.AsByteSlice())) {
+        printf("Error: failed to save %s\n", perf->budgetsPath.Get());
+    }
+}
+
+// times are in ms and memory in MB. Small differences in time are
+// ignored because the timer driving the stress test isn't very precise
+static void CheckStressBudget(const char* filePath, const char* kind, int pageNo, double value) {
+    StressPerf* perf = gStressPerf;
+    if (!perf) {
+        return;
+    }
+    const char* path = filePath;
+    if (str::StartsWithI(path, perf->baseDir)) {
+        path += str::Len(perf->baseDir);
+        path += *path == '\\' ? 1 : 0;
+    }
+    perf->nChecked++;
+    for (StressBudget* b : perf->budgets) {
+        if (b->pageNo != pageNo || !str::Eq(b->kind, kind) || !str::EqI(b->path, path)) {
+            continue;
+        }
+        double limit = b->budget * (100 + perf->thresholdPercent) / 100.0;
+        double minDiff = str::Eq(kind, "memory") ? 1.0 : 20.0;
+        if (value > limit && value - b->budget > minDiff) {
+            perf->nRegressions++;
+            printf("Regression: %s of page %d of %s: %.1f (budget: %.1f)\n", kind, pageNo, filePath, value, b->budget);
+            fflush(stdout);
+        }
+        return;
+    }
+    StressBudget* b = new StressBudget();
+    b->path.SetCopy(path);
+    b->kind = kind;
+    b->pageNo = pageNo;
+    b->budget = value;
+    perf->budgets.Append(b);
+    perf->nNew++;
+}
+
+static double GetWorkingSetMb() {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (double)pmc.WorkingSetSize / (1024.0 * 1024.0);
+}
+
+static void StartStressPerf(Flags* i) {
+    StressPerf* perf = new StressPerf();
+    if (dir::Exists(i->stressTestPath)) {
+        perf->baseDir.SetCopy(i->stressTestPath);
+    } else {
+        perf->baseDir.SetCopy(path::GetDirTemp(i->stressTestPath));
+    }
+    perf->budgetsPath.Set(path::Join(perf->baseDir, kStressBudgetsFileName));
+    perf->thresholdPercent = i->stressPerfThreshold;
+    LoadStressBudgets(perf);
+    printf("Checking against %d budgets in %s\n", perf->budgets.isize(), perf->budgetsPath.Get());
+    fflush(stdout);
+    gStressPerf = perf;
+}
+
+// called when a stress test finishes, the summary is shown after the last one
+static char* FinishStressPerf() {
+    StressPerf* perf = gStressPerf;
+    if (!perf || --perf->nActive > 0) {
+        return nullptr;
+    }
+    SaveStressBudgets(perf);
+    char* summary = str::Format("%d values checked, %d regression(s), %d new budget(s)", perf->nChecked,
+                                perf->nRegressions, perf->nNew);
+    printf("%s\n", summary);
+    fflush(stdout);
+    delete perf;
+    gStressPerf = nullptr;
+    return summary;
+}
+
 struct StressTest {
     MainWindow* win = nullptr;
     LARGE_INTEGER currPageRenderTime = {};
@@ -461,6 +953,9 @@ StressTest::StressTest(MainWindow* win, bool exitWhenDone) {
     this->win = win;
     this->exitWhenDone = exitWhenDone;
     timerId = gCurrStressTimerId++;
+    if (gStressPerf) {
+        gStressPerf->nActive++;
+    }
 }
 
 StressTest::~StressTest() {
@@ -490,10 +985,14 @@ static void Start(StressTest* st, TestFileProvider* fileProvider, int cycles) {
 static void Finished(StressTest* st, bool success) {
     st->win->stressTest = nullptr; // make sure we're not double-deleted
 
+    AutoFreeStr perfSummary = FinishStressPerf();
     if (success) {
         int secs = SecsSinceSystemTime(st->stressStartTime);
         AutoFreeStr tm(FormatTime(secs));
         AutoFreeStr s(str::Format("Stress test complete, rendered %d files in %s", st->nFilesProcessed, tm.Get()));
+        if (perfSummary) {
+            s.Set(str::Format("%s, %s", s.Get(), perfSummary.Get()));
+        }
         NotificationCreateArgs args;
         args.hwndParent = st->win->hwndCanvas;
         args.msg = s;
@@ -536,10 +1035,14 @@ static bool OpenFile(StressTest* st, const char* fileName) {
     // args->forceReuse = rand() % 3 != 1;
     args.forceReuse = true;
     args.noPlaceWindow = true;
+    auto timeStart = TimeGet();
     MainWindow* w = LoadDocument(&args);
     if (!w) {
         return false;
     }
+    if (w->IsDocLoaded()) {
+        CheckStressBudget(fileName, "load", 0, TimeSinceInMs(timeStart));
+    }
 
     if (w == st->win) { // MainWindow reused
         if (!st->win->IsDocLoaded()) {
@@ -722,6 +1225,9 @@ static bool GoToNextPage(StressTest* st) {
     ShowNotification(args);
 
     if (st->pagesToRender.size() == 0) {
+        if (gStressPerf && st->win->CurrentTab()) {
+            CheckStressBudget(st->win->CurrentTab()->filePath, "memory", 0, GetWorkingSetMb());
+        }
         if (GoToNextFile(st)) {
             return true;
         }
@@ -729,7 +1235,10 @@ static bool GoToNextPage(StressTest* st) {
         return false;
     }
 
-    RandomizeViewingState(st);
+    // changing the viewing state would make render times incomparable
+    if (!gStressPerf) {
+        RandomizeViewingState(st);
+    }
     st->currPageNo = st->pagesToRender.PopAt(0);
     st->win->ctrl->GoToPage(st->currPageNo, false);
     st->currPageRenderTime = TimeGet();
@@ -745,7 +1254,7 @@ static bool GoToNextPage(StressTest* st) {
         FindTextOnThread(st->win, TextSearchDirection::Forward, true);
     }
 
-    if (1 == rand() % 3) {
+    if (!gStressPerf && 1 == rand() % 3) {
         Rect rect = ClientRect(st->win->hwndFrame);
         int deltaX = (rand() % 40) - 23;
         rect.dx += deltaX;
@@ -799,8 +1308,14 @@ static void OnTimer(StressTest* st, int timerIdGot) {
                 return;
             }
         }
-    } else if (!GoToNextPage(st)) {
-        return;
+    } else {
+        if (gStressPerf && st->win->CurrentTab()) {
+            double timeInMs = TimeSinceInMs(st->currPageRenderTime);
+            CheckStressBudget(st->win->CurrentTab()->filePath, "render", st->currPageNo, timeInMs);
+        }
+        if (!GoToNextPage(st)) {
+            return;
+        }
     }
     MakeRandomSelection(st->win, st->currPageNo);
 
@@ -905,6 +1420,11 @@ void StartStressTest(Flags* i, MainWindow* win) {
     // forbid entering sleep mode during tests
     SetThreadExecutionState(ES_CONTINUOUS | ES_SYSTEM_REQUIRED | ES_DISPLAY_REQUIRED);
     srand((unsigned int)time(nullptr));
+    if (i->stressPerfThreshold > 0) {
+        StartStressPerf(i);
+        // test the same pages in every run
+        srand(0);
+    }
 
     // redirect stderr to NUL to disable (MuPDF) logging
     FILE* nul;
@@ -617,6 +617,14 @@ void DrawAboutPage(MainWindow* win, HDC hdc) {
 #define DOCLIST_MAX_THUMBNAILS_X 5
 #define DOCLIST_BOTTOM_BOX_DY DpiScale(win->hwndFrame, 50)
 
+static void RepaintAboutWindows() {
+    for (MainWindow* win : gWindows) {
+        if (win->IsAboutWindow()) {
+            win->RedrawAll();
+        }
+    }
+}
+
 void DrawStartPage(MainWindow* win, HDC hdc, FileHistory& fileHistory, COLORREF textColor, COLORREF backgroundColor) {
     HWND hwnd = win->hwndFrame;
     auto col = GetAppColor(AppColor::MainWindowText);
@@ -697,7 +705,15 @@ void DrawStartPage(MainWindow* win, HDC hdc, FileHistory& fileHistory, COLORREF
     SelectObject(hdc, fontLeftTxt);
     SelectObject(hdc, GetStockBrush(NULL_BRUSH));
 
+    COLORREF nameTextColor = GetAppColor(AppColor::MainWindowText);
+    COLORREF bgCol = GetAppColor(AppColor::MainWindowBg);
+    u8 r = (u8)((GetRed(nameTextColor) + GetRed(bgCol)) / 2);
+    u8 g = (u8)((GetGreen(nameTextColor) + GetGreen(bgCol)) / 2);
+    u8 b = (u8)((GetBlue(nameTextColor) + GetBlue(bgCol)) / 2);
+    COLORREF dimmedTextColor = MkColor(r, g, b);
+
     DeleteVecMembers(win->staticLinks);
+    Vec<FileState*> missingThumbnails;
     for (int h = 0; h < height; h++) {
         for (int w = 0; w < width; w++) {
             if (h * width + w >= (int)list.size()) {
@@ -712,11 +728,10 @@ void DrawStartPage(MainWindow* win, HDC hdc, FileHistory& fileHistory, COLORREF
             if (isRtl) {
                 page.x = rc.dx - page.x - page.dx;
             }
-            bool loadOk = true;
             if (!state->thumbnail) {
-                loadOk = LoadThumbnail(state);
+                missingThumbnails.Append(state);
             }
-            if (loadOk && state->thumbnail) {
+            if (state->thumbnail) {
                 Size thumbSize = state->thumbnail->Size();
                 if (thumbSize.dx != kThumbnailDx || thumbSize.dy != kThumbnailDy) {
                     page.dy = thumbSize.dy * kThumbnailDx / thumbSize.dx;
@@ -746,7 +761,15 @@ void DrawStartPage(MainWindow* win, HDC hdc, FileHistory& fileHistory, COLORREF
             char* path = state->filePath;
             const char* fileName = path::GetBaseNameTemp(path);
             UINT fmt = DT_SINGLELINE | DT_END_ELLIPSIS | DT_NOPREFIX | (isRtl ? DT_RIGHT : DT_LEFT);
+            // files that might not be available are dimmed
+            bool isUnreachable = IsFileUnreachable(path);
+            if (isUnreachable) {
+                SetTextColor(hdc, dimmedTextColor);
+            }
             HdcDrawText(hdc, fileName, -1, &rTmp, fmt);
+            if (isUnreachable) {
+                SetTextColor(hdc, nameTextColor);
+            }
 
             // note: this crashes asan build in windows code
             // see https://codeeval.dev/gist/bc761bb1ef1cce04e6a1d65e9d30201b
@@ -762,6 +785,12 @@ void DrawStartPage(MainWindow* win, HDC hdc, FileHistory& fileHistory, COLORREF
         }
     }
 
+    // thumbnails are loaded in the background, the page is repainted as they arrive
+    if (missingThumbnails.size() > 0) {
+        bool create = HasPermission(Perm::SavePreferences);
+        LoadThumbnailsAsync(fileHistory, missingThumbnails, create, RepaintAboutWindows);
+    }
+
     /* render bottom links */
     rc.y +=
         DOCLIST_MARGIN_TOP + height * kThumbnailDy + (height - 1) * DOCLIST_MARGIN_BETWEEN_Y + DOCLIST_MARGIN_BOTTOM;
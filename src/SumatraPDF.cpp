@@ -20,6 +20,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "utils/Archive.h"
 #include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 #include "wingui/Layout.h"
@@ -64,9 +65,16 @@
 #include "CrashHandler.h"
 #include "ExternalViewers.h"
 #include "Favorites.h"
+#include "ThumbnailStore.h"
 #include "FileThumbnails.h"
+#include "FileTextCache.h"
+#include "TileCache.h"
+#include "FindAll.h"
+#include "IdleTasks.h"
+#include "PageOverview.h"
 #include "Menu.h"
 #include "Print.h"
+#include "ResourceStats.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
 #include "StressTesting.h"
@@ -100,6 +108,9 @@ bool gDebugShowLinks = true;
 bool gDebugShowLinks = false;
 #endif
 
+/* if true, usage statistics of the fitz cache of the current document are shown */
+bool gDebugShowStoreStats = false;
+
 // used to show it in debug, but is not very useful,
 // so always disable
 bool gShowFrameRate = false;
@@ -684,9 +695,13 @@ struct ControllerCallbackHandler : DocControllerCallback {
     void Repaint() override {
         RepaintAsync(win, 0);
     }
+    void RepaintScrolled() override {
+        RepaintScrolledAsync(win);
+    }
     void PageNoChanged(DocController* ctrl, int pageNo) override;
     void UpdateScrollbars(Size canvas) override;
     void RequestRendering(int pageNo) override;
+    void RequestPlaceholderRendering(int pageNo) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) override;
     void GotoLink(IPageDestination* dest) override {
@@ -742,7 +757,8 @@ static void CreateThumbnailForFile(MainWindow* win, FileState* ds) {
     }
 
     char* filePath = str::Dup(win->ctrl->GetFilePath());
-    win->ctrl->CreateThumbnail(Size(kThumbnailDx, kThumbnailDy), [=](RenderedBitmap* bmp) {
+    // the whole first page is saved so that the previewer can use it as well
+    win->ctrl->CreateThumbnail(Size(kThumbnailStoreDx, kThumbnailStoreDy), [=](RenderedBitmap* bmp) {
         uitask::Post([=] {
             if (bmp) {
                 SetThumbnail(gFileHistory.FindByPath(filePath), bmp);
@@ -768,9 +784,20 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::RequestPlaceholderRendering(int pageNo) {
+    DisplayModel* dm = win->AsFixed();
+    if (dm && dm->ShouldCacheRendering(pageNo)) {
+        gRenderCache.RequestPlaceholder(dm, pageNo);
+    }
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
+    // a new DisplayModel might get the same address
+    if (win && win->bufferDm == dm) {
+        win->bufferDm = nullptr;
+    }
 }
 
 void ControllerCallbackHandler::FocusFrame(bool always) {
@@ -885,6 +912,7 @@ void ControllerCallbackHandler::PageNoChanged(DocController* ctrl, int pageNo) {
 
     UpdateTocSelection(win, pageNo);
     win->currPageNo = pageNo;
+    UpdatePageOverview(win->CurrentTab());
 
     NotificationWnd* wnd = GetNotificationForGroup(win->hwndCanvas, kNotifGroupPageInfo);
     if (!wnd) {
@@ -949,16 +977,21 @@ static DocController* CreateControllerForChm(const char* path, PasswordUI* pwdUI
 }
 
 DocController* CreateControllerForEngineOrFile(EngineBase* engine, const char* path, PasswordUI* pwdUI,
-                                               MainWindow* win) {
+                                               MainWindow* win, bool shareEngine) {
     // TODO: move this to MainWindow constructor
     if (!win->cbHandler) {
         win->cbHandler = new ControllerCallbackHandler(win);
     }
 
     bool chmInFixedUI = gGlobalPrefs->chmUI.useFixedPageUI;
+    if (!engine && shareEngine) {
+        // the same key HwndPasswordUI::GetPassword() would use
+        FileState* fs = gFileHistory.FindByName(path, nullptr);
+        engine = AcquireSharedEngine(path, fs ? fs->decryptionKey : nullptr);
+    }
     // TODO: sniff file content only once
     if (!engine) {
-        engine = CreateEngineFromFile(path, pwdUI, chmInFixedUI);
+        engine = CreateEngineFromFile(path, pwdUI, chmInFixedUI, true);
     }
     if (engine) {
         int nPages = engine ? engine->PageCount() : 0;
@@ -1016,6 +1049,9 @@ static void UpdateUiForCurrentTab(MainWindow* win) {
     ToolbarUpdateStateForWindow(win, true);
     UpdateToolbarState(win);
 
+    DisplayModel* dm = win->AsFixed();
+    SetEngineMupdfForeground(dm ? dm->GetEngine() : nullptr);
+
     int pageCount = win->ctrl ? win->ctrl->PageCount() : 0;
     UpdateToolbarPageText(win, pageCount);
     UpdateToolbarFindText(win);
@@ -1051,6 +1087,25 @@ static bool showTocByDefault(const char* path) {
 // placeWindow : if true then the Window will be moved/sized according
 //   to the 'state' information even if the window was already placed
 //   before (isNewWindow=false)
+// when a document is reloaded (e.g. after a LaTeX compile), finds the pages that didn't
+// change so that their rendered bitmaps and extracted text can be kept
+static void FindUnchangedPages(DisplayModel* prevDm, DisplayModel* dm, Vec<bool>& unchangedPages) {
+    Vec<u64> prevDigests;
+    Vec<u64> digests;
+    if (!EngineMupdfGetPageDigests(prevDm->GetEngine(), prevDigests) ||
+        !EngineMupdfGetPageDigests(dm->GetEngine(), digests)) {
+        return;
+    }
+    int n = std::min(prevDigests.isize(), digests.isize());
+    int nUnchanged = 0;
+    for (int i = 0; i < n; i++) {
+        bool unchanged = prevDigests[i] == digests[i];
+        unchangedPages.Append(unchanged);
+        nUnchanged += unchanged ? 1 : 0;
+    }
+    logf("FindUnchangedPages: %d of %d pages unchanged\n", nUnchanged, digests.isize());
+}
+
 static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, FileState* fs) {
     MainWindow* win = args->win;
     CrashIf(!win);
@@ -1106,6 +1161,9 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
     }
 
     AbortFinding(args->win, true);
+    AbortCopyingText(args->win);
+    CloseFindAllWindow(tab);
+    ClosePageOverviewWindow(tab);
 
     DocController* prevCtrl = win->ctrl;
     tab->ctrl = ctrl;
@@ -1133,7 +1191,11 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
                 dm->SetDisplayR2L(fs ? fs->displayR2L : gGlobalPrefs->comicBookUI.cbxMangaMode);
             }
             if (prevCtrl && prevCtrl->AsFixed() && str::Eq(win->ctrl->GetFilePath(), prevCtrl->GetFilePath())) {
-                gRenderCache.KeepForDisplayModel(prevCtrl->AsFixed(), dm);
+                DisplayModel* prevDm = prevCtrl->AsFixed();
+                Vec<bool> unchangedPages;
+                FindUnchangedPages(prevDm, dm, unchangedPages);
+                gRenderCache.KeepForDisplayModel(prevDm, dm, &unchangedPages);
+                dm->textCache->TakeUnchangedPages(prevDm->textCache, unchangedPages);
                 dm->CopyNavHistory(*prevCtrl->AsFixed());
             }
             // tell UI Automation about content change
@@ -1222,6 +1284,15 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
     // CrashIf(win->IsDocLoaded() && args->showWin && win->canvasRc.IsEmpty() && !win->AsChm());
 
     SetSidebarVisibility(win, showToc, gGlobalPrefs->showFavorites);
+    // ebooks are laid out in the background, new pages are picked up
+    // (and the ToC is shown) in OnEbookLayoutTimer()
+    if (win->AsFixed() && win->AsFixed()->GetEngine()->IsLayoutInProgress()) {
+        tab->showTocAfterLayout = showToc && !win->tocVisible;
+        SetTimer(win->hwndCanvas, EBOOK_LAYOUT_TIMER_ID, EBOOK_LAYOUT_DELAY_IN_MS, nullptr);
+    } else if (win->AsFixed() && win->AsFixed()->GetEngine()->IsPageSizeUpdatePending()) {
+        // so are page sizes of PDFs with many pages
+        SetTimer(win->hwndCanvas, EBOOK_LAYOUT_TIMER_ID, EBOOK_LAYOUT_DELAY_IN_MS, nullptr);
+    }
     // restore scroll state after the canvas size has been restored
     if ((args->showWin || ss.page != 1) && win->AsFixed()) {
         win->AsFixed()->SetScrollState(ss);
@@ -1256,6 +1327,20 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
     }
 }
 
+// the windows state based on the actual window's placement
+static int GetWindowState(MainWindow* win) {
+    if (win->isFullScreen) {
+        return WIN_STATE_FULLSCREEN;
+    }
+    if (IsZoomed(win->hwndFrame)) {
+        return WIN_STATE_MAXIMIZED;
+    }
+    if (IsIconic(win->hwndFrame)) {
+        return WIN_STATE_MINIMIZED;
+    }
+    return WIN_STATE_NORMAL;
+}
+
 void ReloadDocument(MainWindow* win, bool autoRefresh) {
     // TODO: must disable reload for EngineMulti representing a directory
     WindowTab* tab = win->CurrentTab();
@@ -1279,7 +1364,8 @@ void ReloadDocument(MainWindow* win, bool autoRefresh) {
 
     HwndPasswordUI pwdUI(win->hwndFrame);
     char* path = tab->filePath;
-    DocController* ctrl = CreateControllerForEngineOrFile(nullptr, path, &pwdUI, win);
+    // reloading must re-read the file instead of re-using the engine that is being replaced
+    DocController* ctrl = CreateControllerForEngineOrFile(nullptr, path, &pwdUI, win, false);
     // We don't allow PDF-repair if it is an autorefresh because
     // a refresh event can occur before the file is finished being written,
     // in which case the repair could fail. Instead, if the file is broken,
@@ -1294,18 +1380,7 @@ void ReloadDocument(MainWindow* win, bool autoRefresh) {
     tab->ctrl->GetDisplayState(fs);
     UpdateDisplayStateWindowRect(win, fs);
     UpdateSidebarDisplayState(tab, fs);
-    // Set the windows state based on the actual window's placement
-    int wstate = WIN_STATE_NORMAL;
-    if (win->isFullScreen) {
-        wstate = WIN_STATE_FULLSCREEN;
-    } else {
-        if (IsZoomed(win->hwndFrame)) {
-            wstate = WIN_STATE_MAXIMIZED;
-        } else if (IsIconic(win->hwndFrame)) {
-            wstate = WIN_STATE_MINIMIZED;
-        }
-    }
-    fs->windowState = wstate;
+    fs->windowState = GetWindowState(win);
     fs->useDefaultState = false;
 
     LoadArgs args(tab->filePath, win);
@@ -1638,6 +1713,31 @@ static void ShowFileNotFound(MainWindow* win, const char* path, bool noSavePrefs
     LoadDocumentMarkNotExist(win, path, noSavePrefs);
 }
 
+// the fingerprint has usually been calculated while the document was loading
+// (see PrefetchFileFingerprint()), so this doesn't read the file again
+static void UpdateFileStateFingerprint(const char* path) {
+    if (!file::Exists(path)) {
+        return;
+    }
+    char* filePath = str::Dup(path);
+    RunAsync([filePath] {
+        u8 digest[16]{};
+        char* fingerprint = nullptr;
+        if (CalcFileFingerprint(filePath, digest)) {
+            fingerprint = str::MemToHex(digest, dimof(digest));
+        }
+        uitask::Post([filePath, fingerprint] {
+            // the document might have been removed from history in the meantime
+            FileState* fs = gFileHistory.FindByPath(filePath);
+            if (fs && fingerprint) {
+                str::ReplaceWithCopy(&fs->fingerprint, fingerprint);
+            }
+            str::Free(fingerprint);
+            str::Free(filePath);
+        });
+    });
+}
+
 static void ShowErrorLoading(MainWindow* win, const char* path, bool noSavePrefs) {
     // TODO: same message as in Canvas.cpp to not introduce
     // new translation. Find a better message e.g. why failed.
@@ -1655,6 +1755,7 @@ static void ShowErrorLoading(MainWindow* win, const char* path, bool noSavePrefs
 MainWindow* LoadDocumentFinish(LoadArgs* args, bool lazyload) {
     MainWindow* win = args->win;
     const char* fullPath = args->FilePath();
+    TIME_TRACE("LoadDocumentFinish");
 
     bool openNewTab = gGlobalPrefs->useTabs && !args->forceReuse;
     CrashIf(openNewTab && args->forceReuse);
@@ -1731,6 +1832,9 @@ MainWindow* LoadDocumentFinish(LoadArgs* args, bool lazyload) {
         if (!lazyload && gGlobalPrefs->showStartPage) {
             CreateThumbnailForFile(win, ds);
         }
+        if (!lazyload) {
+            UpdateFileStateFingerprint(fullPath);
+        }
         // TODO: this seems to save the state of file that we just opened
         // add a way to skip saving currTab?
         if (!args->noSavePrefs) {
@@ -1805,6 +1909,9 @@ void LoadDocumentAsync(LoadArgs* argsIn) {
 
     auto wndNotif = ShowLoadingNotif(win, path);
     LoadArgs* args = argsIn->Clone();
+    if (!args->engine && file::Exists(path)) {
+        PrefetchFileFingerprint(path);
+    }
 
     RunAsync([args, wndNotif] {
         IncDangerousThreadCount();
@@ -1845,6 +1952,7 @@ MainWindow* LoadDocument(LoadArgs* args, bool lazyload) {
     MainWindow* win = args->win;
     bool failEarly = AdjustPathForMaybeMovedFile(args);
     const char* path = args->FilePath();
+    TIME_TRACE_ARG("LoadDocument", path);
 
     // fail fast if the file doesn't exist and there is a window the user
     // has just been interacting with
@@ -1862,6 +1970,10 @@ MainWindow* LoadDocument(LoadArgs* args, bool lazyload) {
     HwndPasswordUI pwdUI(win->hwndFrame);
     DocController* ctrl = nullptr;
     if (!lazyload) {
+        // read while the document is being parsed, the caches key on it
+        if (!args->engine && file::Exists(path)) {
+            PrefetchFileFingerprint(path);
+        }
         ctrl = CreateControllerForEngineOrFile(args->engine, path, &pwdUI, win);
         {
             auto durMs = TimeSinceInMs(timeStart);
@@ -1883,6 +1995,151 @@ MainWindow* LoadDocument(LoadArgs* args, bool lazyload) {
     return LoadDocumentFinish(args, lazyload);
 }
 
+// remember what the canvas looks like before switching away from a tab so that
+// it can be shown while the pages are rendered again after a reload
+static void TakeTabSnapshot(MainWindow* win, WindowTab* tab) {
+    tab->DeleteSnapshot();
+    DisplayModel* dm = tab->AsFixed();
+    if (!dm || !win->buffer) {
+        return;
+    }
+    HDC hdcBuffer = win->buffer->GetDC();
+    Rect r = win->buffer->rect;
+    HBITMAP bmp = CreateCompatibleBitmap(hdcBuffer, r.dx, r.dy);
+    if (!bmp) {
+        return;
+    }
+    HDC hdc = CreateCompatibleDC(hdcBuffer);
+    HGDIOBJ prev = SelectObject(hdc, bmp);
+    BitBlt(hdc, 0, 0, r.dx, r.dy, hdcBuffer, 0, 0, SRCCOPY);
+    SelectObject(hdc, prev);
+    DeleteDC(hdc);
+    tab->snapshot = bmp;
+    tab->snapshotViewPort = dm->GetViewPort();
+    tab->snapshotZoom = dm->GetZoomVirtual();
+}
+
+static bool CanHibernateTab(WindowTab* tab) {
+    if (tab == tab->win->CurrentTab() || tab->IsAboutTab() || tab->editAnnotsWindow) {
+        return false;
+    }
+    DisplayModel* dm = tab->AsFixed();
+    if (!dm) {
+        return false;
+    }
+    EngineBase* engine = dm->GetEngine();
+    // reloading would ask for the password again
+    if (engine->IsPasswordProtected()) {
+        return false;
+    }
+    // not checking whether the file still exists: that might block on a sleeping
+    // network share. WakeUpHibernatedTab() shows an error if it can't be loaded
+    return engine->kind != kindEngineMupdf || !EngineMupdfHasUnsavedAnnotations(engine);
+}
+
+// frees the document of a background tab but keeps enough state
+// to restore it when the tab is selected again
+static void HibernateTab(WindowTab* tab) {
+    UpdateTabFileDisplayStateForTab(tab);
+    FileState* fs = NewDisplayState(tab->filePath);
+    tab->ctrl->GetDisplayState(fs);
+    UpdateSidebarDisplayState(tab, fs);
+    fs->useDefaultState = false;
+
+    // the text being copied on a thread might be from this tab's document
+    AbortCopyingText(tab->win);
+    CloseFindAllWindow(tab);
+    ClosePageOverviewWindow(tab);
+    tab->currToc = nullptr;
+    delete tab->ctrl;
+    tab->ctrl = nullptr;
+    tab->hibernatedState = fs;
+}
+
+void HibernateBackgroundTabs(MainWindow* win) {
+    int minutes = gGlobalPrefs->hibernateTabsAfter;
+    bool keepChecking = false;
+    if (minutes > 0) {
+        u64 now = GetTickCount64();
+        u64 timeout = (u64)minutes * 60 * 1000;
+        for (WindowTab* tab : win->Tabs()) {
+            if (!CanHibernateTab(tab)) {
+                continue;
+            }
+            if (now - tab->lastShownTime >= timeout) {
+                HibernateTab(tab);
+            } else {
+                keepChecking = true;
+            }
+        }
+    }
+    if (!keepChecking) {
+        KillTimer(win->hwndCanvas, HIBERNATE_TABS_TIMER_ID);
+    }
+}
+
+static void FinishWakeUpHibernatedTab(MainWindow* win, WindowTab* tab, const char* path, DocController* ctrl,
+                                      NotificationWnd* wndNotif) {
+    // the window or the tab might have been closed in the meantime
+    if (!MainWindowStillValid(win)) {
+        // the window's callback handler is gone, ctrl only needs CleanUp() while being deleted
+        static ControllerCallbackHandler gNoWindowCbHandler(nullptr);
+        if (ctrl) {
+            ctrl->cb = &gNoWindowCbHandler;
+        }
+        delete ctrl;
+        return;
+    }
+    if (!win->Tabs().Contains(tab) || !str::Eq(tab->filePath, path)) {
+        RemoveNotification(wndNotif);
+        delete ctrl;
+        return;
+    }
+    RemoveNotification(wndNotif);
+    tab->isLoading = false;
+    if (tab != win->CurrentTab() || !tab->hibernatedState) {
+        // the document is loaded again once the tab is selected
+        delete ctrl;
+        return;
+    }
+
+    FileState* fs = tab->hibernatedState;
+    tab->hibernatedState = nullptr;
+    fs->windowState = GetWindowState(win);
+    LoadArgs args(tab->filePath, win);
+    args.showWin = true;
+    args.placeWindow = false;
+    ReplaceDocumentInCurrentTab(&args, ctrl, fs);
+    tab->reloadOnFocus = false;
+    DeleteDisplayState(fs);
+}
+
+// loads the document of the current tab (if it's hibernated or hasn't been loaded since
+// restoring the session) on a background thread so that the window stays responsive
+void WakeUpHibernatedTab(MainWindow* win) {
+    WindowTab* tab = win->CurrentTab();
+    if (!tab || !tab->hibernatedState || tab->isLoading) {
+        return;
+    }
+    tab->isLoading = true;
+    // until the document is loaded, the canvas shows the tab's snapshot or thumbnail
+    win->RedrawAll(true);
+
+    auto wndNotif = ShowLoadingNotif(win, tab->filePath);
+    char* path = str::Dup(tab->filePath);
+    RunAsync([win, tab, path, wndNotif] {
+        IncDangerousThreadCount();
+        SetThreadName("WakeUpHibernatedTab");
+        HwndPasswordUI pwdUI(win->hwndFrame);
+        DocController* ctrl = CreateControllerForEngineOrFile(nullptr, path, &pwdUI, win);
+        uitask::Post([win, tab, path, ctrl, wndNotif] {
+            FinishWakeUpHibernatedTab(win, tab, path, ctrl, wndNotif);
+            str::Free(path);
+        });
+        DecDangerousThreadCount();
+    });
+}
+
 // Loads document data into the MainWindow.
 void LoadModelIntoTab(WindowTab* tab) {
     if (!tab) {
@@ -1890,6 +2147,14 @@ void LoadModelIntoTab(WindowTab* tab) {
     }
 
     MainWindow* win = tab->win;
+    WindowTab* prevTab = win->CurrentTab();
+    if (prevTab && prevTab != tab) {
+        prevTab->lastShownTime = GetTickCount64();
+        if (gGlobalPrefs->hibernateTabsAfter > 0) {
+            TakeTabSnapshot(win, prevTab);
+            SetTimer(win->hwndCanvas, HIBERNATE_TABS_TIMER_ID, HIBERNATE_TABS_CHECK_IN_MS, nullptr);
+        }
+    }
     if (gEnableLazyLoad && win->ctrl && !tab->ctrl) {
         char* msg = str::Format(_TRA("Please wait - rendering..."));
         NotificationCreateArgs args;
@@ -1906,6 +2171,9 @@ void LoadModelIntoTab(WindowTab* tab) {
 
     win->currentTabTemp = tab;
     win->ctrl = tab->ctrl;
+    if (win->AsFixed()) {
+        RunIdleTasksFirst(win->AsFixed()->GetEngine());
+    }
 
     if (win->AsChm()) {
         win->AsChm()->SetParentHwnd(win->hwndCanvas);
@@ -1942,10 +2210,14 @@ void LoadModelIntoTab(WindowTab* tab) {
     }
 
     SetFocus(win->hwndFrame);
-    if (gEnableLazyLoad && !tab->ctrl) {
-        ReloadDocument(win, false);
+    if (tab->hibernatedState) {
+        WakeUpHibernatedTab(win);
     } else {
-        if (tab->reloadOnFocus) {
+        // the snapshot is only needed while a hibernated tab is being reloaded
+        tab->DeleteSnapshot();
+        if (gEnableLazyLoad && !tab->ctrl) {
+            ReloadDocument(win, false);
+        } else if (tab->reloadOnFocus) {
             tab->reloadOnFocus = false;
             ReloadDocument(win, true);
         }
@@ -2055,6 +2327,21 @@ void MainWindowRerender(MainWindow* win, bool includeNonClientArea) {
     }
 }
 
+// only re-renders the tiles of pageNo that intersect with rect (in page coordinates),
+// e.g. after an annotation has been changed
+void MainWindowRerenderRect(MainWindow* win, int pageNo, RectF rect) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm) {
+        return;
+    }
+    if (rect.IsEmpty() || !dm->ValidPageNo(pageNo)) {
+        MainWindowRerender(win);
+        return;
+    }
+    gRenderCache.Invalidate(dm, pageNo, rect);
+    win->RedrawAll(true);
+}
+
 static void RerenderEverything() {
     for (auto* win : gWindows) {
         MainWindowRerender(win);
@@ -2141,6 +2428,9 @@ static void CloseDocumentInCurrentTab(MainWindow* win, bool keepUIEnabled, bool
     }
     ClearTocBox(win);
     AbortFinding(win, true);
+    AbortCopyingText(win);
+    CloseFindAllWindow(win->CurrentTab());
+    ClosePageOverviewWindow(win->CurrentTab());
 
     win->linkOnLastButtonDown = nullptr;
     delete win->annotationOnLastButtonDown;
@@ -2199,7 +2489,9 @@ bool SaveAnnotationsToMaybeNewPdfFile(WindowTab* tab) {
     str::WStr fileFilter(256);
     fileFilter.Append(_TR("PDF documents"));
     fileFilter.Append(L"\1*.pdf\1");
-    fileFilter.Append(L"\1*.*\1");
+    // rewrites the whole file instead of appending the changes
+    fileFilter.Append(_TR("PDF documents (optimized)"));
+    fileFilter.Append(L"\1*.pdf\1");
     str::TransCharsInPlace(fileFilter.Get(), L"\1", L"\0");
 
     // TODO: automatically construct "foo.pdf" => "foo Copy.pdf"
@@ -2223,7 +2515,8 @@ bool SaveAnnotationsToMaybeNewPdfFile(WindowTab* tab) {
         return false;
     }
     char* dstFilePath = ToUtf8Temp(dstFileName);
-    ok = EngineMupdfSaveUpdated(engine, dstFilePath, [&tab, &dstFilePath](const char* mupdfErr) {
+    bool optimize = ofn.nFilterIndex == 2;
+    auto showErrorFunc = [&tab, &dstFilePath](const char* mupdfErr) {
         str::Str msg;
         // TODO: duplicated string
         msg.AppendFmt(_TRA("Saving of '%s' failed with: '%s'"), dstFilePath, mupdfErr);
@@ -2232,7 +2525,8 @@ bool SaveAnnotationsToMaybeNewPdfFile(WindowTab* tab) {
         args.warning = true;
         args.timeoutMs = 0;
         args.msg = msg.Get();
-    });
+    };
+    ok = EngineMupdfSaveUpdated(engine, dstFilePath, showErrorFunc, optimize);
     if (!ok) {
         return false;
     }
@@ -2436,6 +2730,7 @@ void CloseTab(WindowTab* tab, bool quitIfLast) {
     }
     MainWindow* win = tab->win;
     AbortFinding(win, true);
+    AbortCopyingText(win);
     ClearFindBox(win);
 
     if (tab) {
@@ -2515,6 +2810,7 @@ void CloseWindow(MainWindow* win, bool quitIfLast, bool forceClose) {
     }
 
     AbortFinding(win, true);
+    AbortCopyingText(win);
     AbortPrinting(win);
 
     for (auto& tab : win->Tabs()) {
@@ -2623,6 +2919,93 @@ static bool AppendFileFilterForDoc(DocController* ctrl, str::WStr& fileFilter) {
     return true;
 }
 
+static bool ConvertToPdf(EngineBase* engine, const char* dstPath, ProgressUpdateUI* progress) {
+    if (engine->kind == kindEngineComicBooks || engine->kind == kindEngineImageDir) {
+        return PdfCreator::RenderToFile(dstPath, engine, 150, progress);
+    }
+    bool ok = engine->SaveFileAsPDF(dstPath);
+    if (!ok && gIsDebugBuild && !(progress && progress->WasCanceled())) {
+        // rendering includes all page annotations
+        ok = PdfCreator::RenderToFile(dstPath, engine, 150, progress);
+    }
+    return ok;
+}
+
+// converting to PDF happens on a copy of the engine, so that the document
+// can be used (or closed) in the meantime. Closing the notification cancels it
+struct SaveAsPdfData : ProgressUpdateUI {
+    MainWindow* win = nullptr;
+    EngineBase* engine = nullptr;
+    AutoFreeStr dstPath;
+    bool markUntrusted = false;
+    NotificationWnd* wnd = nullptr;
+    bool isCanceled = false;
+
+    ~SaveAsPdfData() override {
+        delete engine;
+    }
+
+    void UpdateProgress(int current, int total) override {
+        auto wnd = this->wnd;
+        uitask::Post([=] { UpdateNotificationProgress(wnd, current, total); });
+    }
+
+    bool WasCanceled() override {
+        return isCanceled || !MainWindowStillValid(win);
+    }
+};
+
+static void FinishSaveAsPdf(SaveAsPdfData* data, bool ok) {
+    MainWindow* win = data->win;
+    bool canceled = data->isCanceled;
+    if (data->wnd) {
+        // don't treat removing the notification as canceling
+        data->isCanceled = true;
+        RemoveNotification(data->wnd);
+    }
+    if (ok && data->markUntrusted) {
+        file::SetZoneIdentifier(data->dstPath);
+    }
+    if (!ok && !canceled && MainWindowStillValid(win)) {
+        MessageBoxWarning(win->hwndFrame, _TR("Failed to save a file"));
+    }
+    delete data;
+}
+
+static bool SaveAsPdfOnThread(MainWindow* win, EngineBase* engine, const char* dstPath, bool markUntrusted) {
+    EngineBase* clone = engine->Clone();
+    if (!clone) {
+        return false;
+    }
+    auto data = new SaveAsPdfData();
+    data->win = win;
+    data->engine = clone;
+    data->dstPath = str::Dup(dstPath);
+    data->markUntrusted = markUntrusted;
+
+    NotificationCreateArgs args;
+    args.hwndParent = win->hwndCanvas;
+    args.timeoutMs = 0;
+    args.progressMsg = _TRA("Saving page %d of %d...");
+    // don't use a groupId so that several conversions can run at the same time
+    args.groupId = nullptr;
+    args.onRemoved = [data](NotificationWnd*) {
+        data->isCanceled = true;
+        data->wnd = nullptr;
+    };
+    data->wnd = ShowNotification(args);
+
+    RunAsync([data] {
+        IncDangerousThreadCount();
+        SetThreadName("SaveAsPdf");
+        bool ok = ConvertToPdf(data->engine, data->dstPath, data);
+        uitask::Post([data, ok] { FinishSaveAsPdf(data, ok); });
+        DestroyTempAllocator();
+        DecDangerousThreadCount();
+    });
+    return true;
+}
+
 static void SaveCurrentFileAs(MainWindow* win) {
     if (!HasPermission(Perm::DiskAccess)) {
         return;
@@ -2773,11 +3156,12 @@ static void SaveCurrentFileAs(MainWindow* win) {
         // Convert the file into a PDF one
         char* producerName = str::JoinTemp(kAppName, " ", CURR_VERSION_STRA);
         PdfCreator::SetProducerName(producerName);
-        ok = engine->SaveFileAsPDF(realDstFileName);
-        if (!ok && gIsDebugBuild) {
-            // rendering includes all page annotations
-            ok = PdfCreator::RenderToFile(realDstFileName, engine);
+        bool markUntrusted = IsUntrustedFile(win->ctrl->GetFilePath(), gPluginURL);
+        if (SaveAsPdfOnThread(win, engine, realDstFileName, markUntrusted)) {
+            // errors are reported once the conversion is done
+            return;
         }
+        ok = ConvertToPdf(engine, realDstFileName, nullptr);
     } else if (!file::Exists(srcFileName) && engine) {
         // Recreate inexistant files from memory...
         ok = engine->SaveFileAs(realDstFileName);
@@ -3442,6 +3826,23 @@ static void RelayoutFrame(MainWindow* win, bool updateToolbars = true, int sideb
     }
 }
 
+// the window has been moved to a monitor with a different DPI
+static void FrameOnDpiChanged(MainWindow* win, RECT* suggestedRect) {
+    if (gGlobalPrefs->customScreenDPI == 0) {
+        int dpi = DpiGetForHwnd(win->hwndFrame);
+        for (WindowTab* tab : win->Tabs()) {
+            DisplayModel* dm = tab->AsFixed();
+            if (dm) {
+                dm->SetScreenDpi(dpi);
+            }
+        }
+    }
+    // resizing relayouts the current document and repaints it, starting with the visible pages
+    Rect rc = ToRect(*suggestedRect);
+    SetWindowPos(win->hwndFrame, nullptr, rc.x, rc.y, rc.dx, rc.dy, SWP_NOZORDER | SWP_NOACTIVATE);
+    RepaintAsync(win, 0);
+}
+
 static void FrameOnSize(MainWindow* win, __unused int dx, __unused int dy) {
     RelayoutFrame(win);
 
@@ -3502,6 +3903,8 @@ static void OpenAdvancedOptions() {
 
     // TODO: disable/hide the menu item when there's no prefs file
     //       (happens e.g. when run in portable mode from a CD)?
+    // make sure the editor sees the current settings
+    FlushSettings();
     char* path = GetSettingsPathTemp();
     OpenFileWithTextEditor(path);
 }
@@ -3518,6 +3921,8 @@ static void ShowOptionsDialog(HWND hwnd) {
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Clear(true);
         CleanUpThumbnailCache(gFileHistory);
+        DeleteTextCacheFiles();
+        DeleteTileCacheFiles();
     }
     UpdateDocumentColors();
 
@@ -3984,6 +4389,10 @@ static void OnFrameKeyEsc(MainWindow* win) {
         AbortFinding(win, true);
         return;
     }
+    if (win->copyTextThread) {
+        AbortCopyingText(win);
+        return;
+    }
     if (GetNotificationForGroup(win->hwndCanvas, kNotifGroupPersistentWarning)) {
         RemoveNotificationsForGroup(win->hwndCanvas, kNotifGroupPersistentWarning);
         return;
@@ -4607,6 +5016,26 @@ void ClearHistory(MainWindow* win) {
     */
 }
 
+// saves what was recorded after "Record time trace" next to the log file.
+// can be loaded in chrome://tracing or https://ui.perfetto.dev
+static void SaveTimeTrace(MainWindow* win) {
+    TempStr dir = GetSpecialFolderTemp(CSIDL_LOCAL_APPDATA, true);
+    if (!dir) {
+        return;
+    }
+    TempStr path = path::JoinTemp(dir, "sumatra-trace.json");
+    const char* msg = "Couldn't save time trace. Use 'Record time trace' first";
+    AutoFreeStr msgOk;
+    if (TimeTraceSave(path)) {
+        msgOk.Set(str::Format("Saved time trace to '%s'", path));
+        msg = msgOk.Get();
+    }
+    logf("SaveTimeTrace: %s\n", msg);
+    if (win) {
+        ShowTemporaryNotification(win->hwndCanvas, msg, kNotif5SecsTimeOut);
+    }
+}
+
 static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     int wmId = LOWORD(wp);
 
@@ -5070,6 +5499,14 @@ static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, L
             FindToggleMatchCase(win);
             break;
 
+        case CmdFindAll:
+            FindAll(win);
+            break;
+
+        case CmdShowPageOverview:
+            ShowPageOverview(win);
+            break;
+
         case CmdFindNextSel:
             FindSelection(win, TextSearchDirection::Forward);
             break;
@@ -5176,6 +5613,29 @@ static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, L
             }
             break;
 
+        case CmdDebugShowStoreStats:
+            gDebugShowStoreStats = !gDebugShowStoreStats;
+            for (auto& w : gWindows) {
+                w->RedrawAll(true);
+            }
+            break;
+
+        case CmdDebugShowResourceStats:
+            ToggleResourceStats();
+            break;
+
+        case CmdDebugToggleTimeTrace:
+            if (gTimeTraceEnabled) {
+                TimeTraceDisable();
+            } else {
+                TimeTraceEnable();
+            }
+            break;
+
+        case CmdDebugSaveTimeTrace:
+            SaveTimeTrace(win);
+            break;
+
 #if defined(DEBUG)
         case CmdDebugTestApp:
             extern void TestApp(HINSTANCE hInstance);
@@ -5380,6 +5840,13 @@ LRESULT CALLBACK WndProcSumatraFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
             }
             break;
 
+        case WM_DPICHANGED:
+            if (win) {
+                FrameOnDpiChanged(win, (RECT*)lp);
+                return 0;
+            }
+            break;
+
         case WM_INITMENUPOPUP:
             // TODO: should I just build the menu from scratch every time?
             UpdateAppMenu(win, (HMENU)wp);
@@ -5542,6 +6009,7 @@ LRESULT CALLBACK WndProcSumatraFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
             // TODO: check for unfinished print jobs in WM_QUERYENDSESSION?
             if (wp == TRUE) {
                 SaveSettings();
+                FlushSettings();
                 // we must quit so that we restore opened files on start.
                 DestroyWindow(hwnd);
             }
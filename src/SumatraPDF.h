@@ -25,6 +25,14 @@ constexpr int kHideCursorDelayInMs = 3000;
 #define AUTO_RELOAD_TIMER_ID 5
 #define AUTO_RELOAD_DELAY_IN_MS 100
 
+// polls for ebook pages laid out in the background
+#define EBOOK_LAYOUT_TIMER_ID 7
+#define EBOOK_LAYOUT_DELAY_IN_MS 250
+
+// checks for background tabs whose documents can be unloaded
+#define HIBERNATE_TABS_TIMER_ID 8
+#define HIBERNATE_TABS_CHECK_IN_MS (60 * 1000)
+
 // permissions that can be revoked through sumatrapdfrestrict.ini or the -restrict command line flag
 enum class Perm : uint {
     // enables Update checks, crash report submitting and hyperlinks
@@ -82,6 +90,7 @@ struct Flags;
 // all defined in SumatraPDF.cpp
 extern Flags* gCli;
 extern bool gDebugShowLinks;
+extern bool gDebugShowStoreStats;
 extern bool gShowFrameRate;
 
 extern const char* gPluginURL;
@@ -119,6 +128,8 @@ void UpdateDocumentColors();
 void UpdateFixedPageScrollbarsVisibility();
 void UpdateTabFileDisplayStateForTab(WindowTab* tab);
 void ReloadDocument(MainWindow* win, bool autoRefresh);
+void HibernateBackgroundTabs(MainWindow* win);
+void WakeUpHibernatedTab(MainWindow* win);
 void ToggleFullScreen(MainWindow* win, bool presentation = false);
 void RelayoutWindow(MainWindow* win);
 void DuplicateTabInNewWindow(WindowTab* tab);
@@ -173,8 +184,9 @@ MainWindow* LoadDocument(LoadArgs* args, bool lazyload = false);
 MainWindow* LoadDocumentFinish(LoadArgs* args, bool lazyload);
 void LoadDocumentAsync(LoadArgs* args);
 MainWindow* CreateAndShowMainWindow(SessionData* data = nullptr);
+// if shareEngine is set, a document that is already open in another tab or window re-uses its engine
 DocController* CreateControllerForEngineOrFile(EngineBase* engine, const char* path, PasswordUI* pwdUI,
-                                               MainWindow* win);
+                                               MainWindow* win, bool shareEngine = true);
 
 uint MbRtlReadingMaybe();
 void MessageBoxWarning(HWND hwnd, const WCHAR* msg, const WCHAR* title = nullptr);
@@ -188,6 +200,7 @@ void RebuildMenuBarForWindow(MainWindow* win);
 void DeleteMainWindow(MainWindow* win);
 void SwitchToDisplayMode(MainWindow* win, DisplayMode displayMode, bool keepContinuous = false);
 void MainWindowRerender(MainWindow* win, bool includeNonClientArea = false);
+void MainWindowRerenderRect(MainWindow* win, int pageNo, RectF rect);
 LRESULT CALLBACK WndProcSumatraFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
 void ShutdownCleanup();
 bool DocIsSupportedFileType(Kind);
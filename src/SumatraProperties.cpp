@@ -16,10 +16,12 @@
 #include "EngineBase.h"
 #include "EngineAll.h"
 #include "DisplayModel.h"
+#include "TextSelection.h"
 #include "AppTools.h"
 #include "AppColors.h"
 #include "SumatraPDF.h"
 #include "MainWindow.h"
+#include "WindowTab.h"
 #include "resource.h"
 #include "Commands.h"
 #include "SumatraAbout.h"
@@ -36,6 +38,10 @@ constexpr const WCHAR* kPropertiesWinClassName = L"SUMATRA_PDF_PROPERTIES";
 #define kRectPadding 8
 #define kTxtPaddingDy 2
 
+// how often to check if the font list has been extracted in the background
+constexpr UINT_PTR kFontListTimerID = 1;
+constexpr UINT kFontListCheckMs = 100;
+
 LRESULT CALLBACK WndProcProperties(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
 
 struct PropertyEl {
@@ -83,6 +89,8 @@ struct PropertiesLayout {
 
     HWND hwnd = nullptr;
     HWND hwndParent = nullptr;
+    // set while the font list is extracted in the background, see UpdateFontList()
+    EngineBase* fontListEngine = nullptr;
     Button* btnCopyToClipboard = nullptr;
     Button* btnGetFonts = nullptr;
     Vec<PropertyEl*> props;
@@ -403,6 +411,23 @@ static void CopyPropertiesToClipboard(HWND hwnd) {
     CopyTextToClipboard(lines.LendData());
 }
 
+static void ResizePropertiesWindow(PropertiesLayout* layoutData) {
+    HWND hwnd = layoutData->hwnd;
+    // get the dimensions required for the about box's content
+    HDC hdc = GetDC(hwnd);
+    auto rc = CalcPropertiesLayout(layoutData, hdc);
+    ReleaseDC(hwnd, hdc);
+
+    // resize the window to just match these dimensions
+    // (as long as they fit into the current monitor's work area)
+    Rect wRc = WindowRect(hwnd);
+    Rect cRc = ClientRect(hwnd);
+    Rect work = GetWorkAreaRect(WindowRect(layoutData->hwndParent), hwnd);
+    wRc.dx = std::min(rc.dx + wRc.dx - cRc.dx, work.dx);
+    wRc.dy = std::min(rc.dy + wRc.dy - cRc.dy, work.dy);
+    MoveWindow(hwnd, wRc.x, wRc.y, wRc.dx, wRc.dy, FALSE);
+}
+
 static bool gDidRegister = false;
 static bool CreatePropertiesWindow(HWND hParent, PropertiesLayout* layoutData, bool extended) {
     HMODULE h = GetModuleHandleW(nullptr);
@@ -457,26 +482,64 @@ static bool CreatePropertiesWindow(HWND hParent, PropertiesLayout* layoutData, b
         b->onClicked = [hwnd] { ShowExtendedProperties(hwnd); };
     }
 
-    // get the dimensions required for the about box's content
-    PAINTSTRUCT ps;
-    HDC hdc = BeginPaint(hwnd, &ps);
-    auto rc = CalcPropertiesLayout(layoutData, hdc);
-    EndPaint(hwnd, &ps);
-
-    // resize the new window to just match these dimensions
-    // (as long as they fit into the current monitor's work area)
-    Rect wRc = WindowRect(hwnd);
-    Rect cRc = ClientRect(hwnd);
-    Rect work = GetWorkAreaRect(WindowRect(hParent), hwnd);
-    wRc.dx = std::min(rc.dx + wRc.dx - cRc.dx, work.dx);
-    wRc.dy = std::min(rc.dy + wRc.dy - cRc.dy, work.dy);
-    MoveWindow(hwnd, wRc.x, wRc.y, wRc.dx, wRc.dy, FALSE);
+    ResizePropertiesWindow(layoutData);
     CenterDialog(hwnd, hParent);
 
     ShowWindow(hwnd, SW_SHOW);
+    if (layoutData->fontListEngine) {
+        SetTimer(hwnd, kFontListTimerID, kFontListCheckMs, nullptr);
+    }
     return true;
 }
 
+// the fonts of an ebook are only known once it has been laid out in the background
+static bool IsFontListReady(EngineBase* engine) {
+    return EngineMupdfFontListReady(engine) && !engine->IsLayoutInProgress();
+}
+
+// checks if the font list that's extracted in the background is ready
+static void UpdateFontList(HWND hwnd) {
+    PropertiesLayout* pl = FindPropertyWindowByHwnd(hwnd);
+    MainWindow* win = pl ? FindMainWindowByHwnd(pl->hwndParent) : nullptr;
+    if (!win) {
+        KillTimer(hwnd, kFontListTimerID);
+        return;
+    }
+    // the document might have been closed in the meantime
+    EngineBase* engine = nullptr;
+    for (WindowTab* tab : win->Tabs()) {
+        DisplayModel* dm = tab->AsFixed();
+        if (dm && dm->GetEngine() == pl->fontListEngine) {
+            engine = pl->fontListEngine;
+            break;
+        }
+    }
+    if (engine && !IsFontListReady(engine)) {
+        return;
+    }
+    KillTimer(hwnd, kFontListTimerID);
+    pl->fontListEngine = nullptr;
+    if (!engine) {
+        return;
+    }
+
+    char* fonts = engine->GetProperty(DocumentProperty::FontList);
+    for (PropertyEl* el : pl->props) {
+        if (str::Eq(el->leftTxt, _TRA("Fonts:"))) {
+            if (str::IsEmpty(fonts)) {
+                pl->props.Remove(el);
+                delete el;
+                str::Free(fonts);
+            } else {
+                el->rightTxt.Set(fonts);
+            }
+            break;
+        }
+    }
+    ResizePropertiesWindow(pl);
+    InvalidateRect(hwnd, nullptr, TRUE);
+}
+
 static void GetProps(DocController* ctrl, PropertiesLayout* layoutData, bool extended) {
     CrashIf(!ctrl);
 
@@ -559,13 +622,22 @@ static void GetProps(DocController* ctrl, PropertiesLayout* layoutData, bool ext
     layoutData->AddProperty(_TRA("Denied Permissions:"), str);
 
     if (extended) {
-        // Note: FontList extraction can take a while
-        str = ctrl->GetProperty(DocumentProperty::FontList);
+        // FontList extraction can take a while, so for large PDF documents (and ebooks
+        // that are still being laid out) the list is filled in once it's ready (see UpdateFontList())
+        if (dm && !IsFontListReady(dm->GetEngine())) {
+            layoutData->fontListEngine = dm->GetEngine();
+            str = str::Dup(_TRA("Loading..."));
+        } else {
+            str = ctrl->GetProperty(DocumentProperty::FontList);
+        }
         if (str) {
             // add a space between basic and extended file properties
             layoutData->AddProperty(" ", str::Dup(" "));
         }
         layoutData->AddProperty(_TRA("Fonts:"), str);
+        if (dm) {
+            layoutData->AddProperty(_TRA("Text Memory:"), dm->textCache->FormatMemoryUse());
+        }
     }
 }
 
@@ -674,6 +746,12 @@ LRESULT CALLBACK WndProcProperties(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
             OnPaintProperties(hwnd);
             break;
 
+        case WM_TIMER:
+            if (wp == kFontListTimerID) {
+                UpdateFontList(hwnd);
+            }
+            break;
+
         case WM_CHAR:
             if (VK_ESCAPE == wp) {
                 DestroyWindow(hwnd);
@@ -14,6 +14,8 @@
 #include "mui/Mui.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
@@ -51,6 +53,8 @@
 #include "Caption.h"
 #include "CrashHandler.h"
 #include "FileThumbnails.h"
+#include "FileTextCache.h"
+#include "TileCache.h"
 #include "Print.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
@@ -67,6 +71,7 @@
 #include "Installer.h"
 #include "ExternalViewers.h"
 #include "AppColors.h"
+#include "RenderWorker.h"
 
 #include "utils/Log.h"
 
@@ -75,6 +80,7 @@
 // being set up
 class FileExistenceChecker : public ThreadBase {
     StrVec paths;
+    StrVec unreachablePaths;
 
     void GetFilePathsToCheck();
     void HideMissingFiles();
@@ -112,8 +118,12 @@ void FileExistenceChecker::HideMissingFiles() {
     for (const char* path : paths) {
         gFileHistory.MarkFileInexistent(path, true);
     }
+    for (const char* path : unreachablePaths) {
+        SetFileUnreachable(path, true);
+    }
     // update the Frequently Read page in case it's been displayed already
-    if (paths.size() > 0 && gWindows.size() > 0 && gWindows.at(0)->IsAboutWindow()) {
+    bool changed = paths.size() > 0 || unreachablePaths.size() > 0;
+    if (changed && gWindows.size() > 0 && gWindows.at(0)->IsAboutWindow()) {
         gWindows.at(0)->RedrawAll(true);
     }
 }
@@ -124,13 +134,99 @@ void FileExistenceChecker::Terminate() {
     delete this;
 }
 
+// checking a path on a disconnected network drive or a sleeping NAS can
+// take a long time so it's done on a separate thread that we stop waiting for
+constexpr DWORD kFileProbeTimeoutMs = 2000;
+
+enum class ProbeResult {
+    Exists,
+    Missing,
+    // not on a fixed drive
+    Unreachable,
+    TimedOut,
+};
+
+struct FileProbe {
+    char* path = nullptr;
+    ProbeResult res = ProbeResult::Unreachable;
+    // the thread and the caller both own the probe because
+    // the caller might stop waiting for the thread
+    LONG refCount = 2;
+
+    void Release() {
+        if (InterlockedDecrement(&refCount) == 0) {
+            str::Free(path);
+            delete this;
+        }
+    }
+};
+
+static DWORD WINAPI FileProbeThread(void* data) {
+    FileProbe* probe = (FileProbe*)data;
+    bool isFixed = path::IsOnFixedDrive(probe->path);
+    if (DocumentPathExists(probe->path)) {
+        probe->res = ProbeResult::Exists;
+    } else {
+        probe->res = isFixed ? ProbeResult::Missing : ProbeResult::Unreachable;
+    }
+    probe->Release();
+    DestroyTempAllocator();
+    return 0;
+}
+
+static ProbeResult ProbeFile(const char* path) {
+    FileProbe* probe = new FileProbe();
+    probe->path = str::Dup(path);
+    AutoCloseHandle h(CreateThread(nullptr, 0, FileProbeThread, probe, 0, nullptr));
+    if (!h.IsValid()) {
+        probe->refCount = 1;
+        probe->Release();
+        return ProbeResult::Unreachable;
+    }
+    ProbeResult res = ProbeResult::TimedOut;
+    if (WaitForSingleObject(h, kFileProbeTimeoutMs) == WAIT_OBJECT_0) {
+        res = probe->res;
+    }
+    probe->Release();
+    return res;
+}
+
+// "C:" or "\\server\share", paths with the same root are likely to be equally slow
+static char* GetPathRootTemp(const char* path) {
+    if (!str::StartsWith(path, "\\\\")) {
+        return str::DupTemp(path, std::min(str::Len(path), (size_t)2));
+    }
+    const char* s = str::FindChar(path + 2, '\\');
+    if (s) {
+        s = str::FindChar(s + 1, '\\');
+    }
+    return s ? str::DupTemp(path, s - path) : str::DupTemp(path);
+}
+
 void FileExistenceChecker::Run() {
-    // filters all file paths on network drives, removable drives and
-    // all paths which still exist from the list (remaining paths will
-    // be marked as inexistent in gFileHistory)
+    // filters all paths which still exist from the list. Remaining paths on fixed
+    // drives will be marked as inexistent in gFileHistory. Paths on network and
+    // removable drives are only marked as unreachable because they might come back
+    StrVec slowRoots;
     for (size_t i = 0; i < paths.size(); i++) {
         const char* path = paths[i];
-        if (!path || !path::IsOnFixedDrive(path) || DocumentPathExists(path)) {
+        if (!path) {
+            paths.RemoveAt(i--);
+            continue;
+        }
+        // don't wait for each file on a drive that has already timed out
+        char* root = GetPathRootTemp(path);
+        ProbeResult res = ProbeResult::TimedOut;
+        if (!slowRoots.Contains(root)) {
+            res = ProbeFile(path);
+            if (res == ProbeResult::TimedOut) {
+                slowRoots.Append(root);
+            }
+        }
+        if (res == ProbeResult::Unreachable || res == ProbeResult::TimedOut) {
+            unreachablePaths.Append(path);
+        }
+        if (res != ProbeResult::Missing) {
             paths.RemoveAt(i--);
         }
     }
@@ -304,57 +400,30 @@ static MainWindow* LoadOnStartup(const char* filePath, const Flags& flags, bool
     return win;
 }
 
-static void RestoreTabOnStartup(MainWindow* win, TabState* state, bool lazyload = true) {
+// creates the tab without loading the document. It's loaded in the background
+// when the tab is selected for the first time (see WakeUpHibernatedTab)
+static void RestoreTabOnStartup(MainWindow* win, TabState* state) {
     LoadArgs args(state->filePath, win);
     args.noSavePrefs = true;
-    if (!LoadDocument(&args, lazyload)) {
+    if (!LoadDocument(&args, true)) {
         return;
     }
     WindowTab* tab = win->CurrentTab();
-    if (!tab || !tab->ctrl) {
+    if (!tab || tab->ctrl || tab->hibernatedState) {
         return;
     }
 
-    DocController* ctrl = tab->ctrl;
-    DisplayModel* dm = tab->AsFixed();
-
     // validate page number from session state
     // TODO: figure out how this happens in the first place i.e.
     // why TabState->pageNo etc. gets saved as 0
     if (state->pageNo < 1) {
         state->pageNo = 1;
         state->scrollPos = {-1, -1};
-    } else {
-        int nPages = ctrl->PageCount();
-        if (state->pageNo > nPages) {
-            state->pageNo = nPages;
-            state->scrollPos = {-1, -1};
-        }
     }
-
+    // a too large page number is corrected once the document is loaded
+    tab->hibernatedState = NewDisplayState(state);
+    tab->showToc = state->showToc;
     tab->tocState = *state->tocState;
-    SetSidebarVisibility(win, state->showToc, gGlobalPrefs->showFavorites);
-
-    DisplayMode displayMode = DisplayModeFromString(state->displayMode, DisplayMode::Automatic);
-    if (displayMode != DisplayMode::Automatic) {
-        SwitchToDisplayMode(win, displayMode);
-    }
-
-    if (dm) {
-        ScrollState scrollState = {state->pageNo, state->scrollPos.x, state->scrollPos.y};
-        dm->SetScrollState(scrollState);
-    } else {
-        ctrl->GoToPage(state->pageNo, true);
-    }
-
-    float zoom = ZoomFromString(state->zoom, kInvalidZoom);
-    if (zoom != kInvalidZoom) {
-        if (dm) {
-            dm->Relayout(zoom, state->rotation);
-        } else {
-            ctrl->SetZoomVirtual(zoom, nullptr);
-        }
-    }
 }
 
 static bool SetupPluginMode(Flags& i) {
@@ -942,6 +1011,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     HWND existingHwnd = nullptr;
     WindowTab* tabToSelect = nullptr;
     const char* logFilePath = nullptr;
+    LARGE_INTEGER timeStart = TimeGet();
 
     CrashIf(hInstance != GetInstance());
 
@@ -999,10 +1069,19 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
         gLogToConsole = true;
     }
 
+    // log file and logview are written on a thread so
+    // FlushLogging() must be called before ExitProcess()
+    gLogAsync = true;
+
     Flags flags;
     ParseFlags(GetCommandLineW(), flags);
     gCli = &flags;
 
+    if (flags.timeTracePath) {
+        TimeTraceEnable(timeStart);
+        TimeTraceAdd("InitProcess", timeStart);
+    }
+
     CheckIsStoreBuild();
     bool isInstaller = flags.install || flags.runInstallNow || IsInstallerAndNamedAsSuch();
     bool isUninstaller = flags.uninstall;
@@ -1026,8 +1105,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
             return TesterMain();
         }
         if (flags.regress) {
-            extern int RegressMain(); // in Regress.cpp
-            return RegressMain();
+            extern int RegressMain(Flags*); // in Regress.cpp
+            return RegressMain(&flags);
         }
     }
 #endif
@@ -1063,11 +1142,13 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
         exitCode = RunInstaller();
         // exit immediately. for some reason exit handlers try to
         // pull in libmupdf.dll which we don't have access to in the installer
+        FlushLogging();
         return exitCode;
     }
 
     if (isUninstaller) {
         exitCode = RunUninstaller();
+        FlushLogging();
         ::ExitProcess(exitCode);
     }
 
@@ -1096,6 +1177,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
         }
         if (flags.exitWhenDone) {
             HandleRedirectedConsoleOnShutdown();
+            FlushLogging();
             ::ExitProcess(0);
         }
     }
@@ -1106,6 +1188,12 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     // (default policy is to disallow everything)
     InitializePolicies(flags.restrictedUse);
 
+    if (flags.renderWorker) {
+        exitCode = RunRenderWorker(flags.renderWorker);
+        FlushLogging();
+        ::ExitProcess(exitCode);
+    }
+
 #if defined(DEBUG)
     if (flags.testRenderPage) {
         TestRenderPage(flags);
@@ -1133,11 +1221,17 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     }
 #endif
 
-    DetectExternalViewers();
+    {
+        TIME_TRACE("DetectExternalViewers");
+        DetectExternalViewers();
+    }
 
     LoadSettings();
     UpdateGlobalPrefs(flags);
-    SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
+    {
+        TIME_TRACE("SetCurrentLang");
+        SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
+    }
 
 #if defined(DEBUG)
     void TestBrowser(); // scratch.cpp
@@ -1158,7 +1252,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     }
 
     if (flags.pathsToBenchmark.Size() > 0) {
-        BenchFileOrDir(flags.pathsToBenchmark);
+        BenchFileOrDir(&flags);
     }
 
     if (flags.exitImmediately) {
@@ -1170,13 +1264,16 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     GetFixedPageUiColors(gRenderCache.textColor, gRenderCache.backgroundColor);
 
     gIsStartup = true;
-    if (!RegisterWinClass()) {
-        goto Exit;
-    }
+    {
+        TIME_TRACE("InstanceInit");
+        if (!RegisterWinClass()) {
+            goto Exit;
+        }
 
-    CrashIf(hInstance != GetModuleHandle(nullptr));
-    if (!InstanceInit()) {
-        goto Exit;
+        CrashIf(hInstance != GetModuleHandle(nullptr));
+        if (!InstanceInit()) {
+            goto Exit;
+        }
     }
 
     if (flags.hwndPluginParent) {
@@ -1264,6 +1361,7 @@ ContinueOpenWindow:
     }
 
     if (restoreSession) {
+        TIME_TRACE("RestoreSession");
         for (SessionData* data : *gGlobalPrefs->sessionData) {
             win = CreateAndShowMainWindow(data);
             for (TabState* state : *data->tabStates) {
@@ -1275,17 +1373,17 @@ ContinueOpenWindow:
                 // the current fix is to not call SaveSettings() below but maybe there's a better way
                 // maybe make a copy of TabState so that it isn't invalidated
                 // https://github.com/sumatrapdfreader/sumatrapdf/issues/1674
-                RestoreTabOnStartup(win, state, gEnableLazyLoad);
+                RestoreTabOnStartup(win, state);
             }
             TabsSelect(win, data->tabIndex - 1);
-            if (gEnableLazyLoad) {
-                ReloadDocument(win, false);
-            }
+            // TabsSelect() doesn't load the document if the last tab is selected
+            WakeUpHibernatedTab(win);
         }
     }
     ResetSessionState(gGlobalPrefs->sessionData);
 
     for (const char* path : flags.fileNames) {
+        TIME_TRACE_ARG("LoadOnStartup", path);
         if (restoreSession) {
             auto tab = FindTabByFile(path);
             if (tab) {
@@ -1352,6 +1450,7 @@ ContinueOpenWindow:
     }
     // call this once it's clear whether Perm::SavePreferences has been granted
     RegisterSettingsForFileChanges();
+    StartCommandPipeServer();
 
     // Change current directory for 2 reasons:
     // * prevent dll hijacking (LoadLibrary first loads from current directory
@@ -1369,13 +1468,21 @@ ContinueOpenWindow:
     CheckForUpdateAsync(win, UpdateCheck::Automatic);
 
     BringWindowToTop(win->hwndFrame);
+    TimeTraceAdd("Startup", timeStart);
 
     exitCode = RunMessageLoop();
+    StopCommandPipeServer();
     SafeCloseHandle(&hMutex);
     CleanUpThumbnailCache(gFileHistory);
+    WaitForTextCacheWrites();
+    CleanUpTextCache();
+    CleanUpTileCache();
 
 Exit:
     logf("Exiting with exit code: %d\n", exitCode);
+    if (flags.timeTracePath && !TimeTraceSave(flags.timeTracePath)) {
+        logf("Failed to save time trace to '%s'\n", flags.timeTracePath);
+    }
     UnregisterSettingsForFileChanges();
 
     HandleRedirectedConsoleOnShutdown();
@@ -1387,6 +1494,7 @@ Exit:
     if (fastExit) {
         // leave all the remaining clean-up to the OS
         // (as recommended for a quick exit)
+        FlushLogging();
         ::ExitProcess(exitCode);
     }
     str::Free(logFilePath);
@@ -1395,6 +1503,7 @@ Exit:
     while (gWindows.size() > 0) {
         DeleteMainWindow(gWindows.at(0));
     }
+    WaitForTextCacheWrites();
 
     DeleteCachedCursors();
     DeleteObject(GetDefaultGuiFont());
@@ -1404,6 +1513,9 @@ Exit:
     CleanupEngineDjVu();
     destroy_system_font_list();
 
+    // write settings that are still waiting for SettingsWriterThread
+    FlushSettings();
+
     // wait for FileExistenceChecker to terminate
     // (which should be necessary only very rarely)
     while (gFileExistenceChecker) {
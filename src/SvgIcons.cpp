@@ -9,12 +9,16 @@ extern "C" {
 #include "utils/BaseUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
 
 #include "wingui/UIModels.h"
 
 #include "DocController.h"
 #include "EngineBase.h"
 #include "EngineMupdfImpl.h"
+#include "AppTools.h"
+
+#include "utils/Log.h"
 
 // https://github.com/tabler/tabler-icons/blob/master/icons/folder.svg
 static const char* gIconFileOpen =
@@ -269,11 +273,8 @@ fz_pixmap* BuildIconsPixmap(MupdfContext* muctx, int dx, int dy) {
     return dstPixmap;
 }
 
-HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
-    int w = pixmap->w;
-    int h = pixmap->h;
-    int n = pixmap->n;
-    int imgSize = pixmap->stride * h;
+HBITMAP CreateBitmapFromPixels(const u8* samples, int w, int h, int stride, int n) {
+    int imgSize = stride * h;
     int bitsCount = n * 8;
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
@@ -293,35 +294,133 @@ HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
     uint usage = DIB_RGB_COLORS;
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
     if (data) {
-        u8* samples = pixmap->samples;
         memcpy(data, samples, imgSize);
     }
     return hbmp;
 }
 
-HBITMAP BuildIconsBitmap(int dx, int dy) {
-    MupdfContext* muctx = new MupdfContext();
-    fz_pixmap* pixmap = BuildIconsPixmap(muctx, dx, dy);
-    // ClearPixmap(pixmap);
-#if 1
-#if 0
-    RenderedBitmap* rbmp = NewRenderedFzPixmap(muctx->ctx, pixmap);
-    HBITMAP bmp = rbmp->hbmp;
-#else
-    HBITMAP bmp = CreateBitmapFromPixmap(pixmap);
-#endif
-    fz_drop_pixmap(muctx->ctx, pixmap);
-    delete muctx;
-    return bmp;
-#else
-    int nIcons = dimof(gAllIcons);
-    int bmpDx = dx * nIcons;
-    int bmpDy = dy;
-    u8* bits = pixmap->samples;
-    HBITMAP res = CreateBitmap(bmpDx, bmpDy, 1, 24, bits);
-    fz_drop_pixmap(muctx->ctx, pixmap);
-    delete muctx;
+HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
+    return CreateBitmapFromPixels(pixmap->samples, pixmap->w, pixmap->h, (int)pixmap->stride, pixmap->n);
+}
+
+// rendering the svg icons is slow enough to be noticeable when opening a window
+// so they're rendered once per size (i.e. per dpi) and also saved to disk.
+// The icons don't depend on the theme, so the size is the only key
+constexpr const char* kIconsCacheDirName = "sumatrapdfcache";
+constexpr u32 kIconsCacheMagic = 0x49425453; // 'STBI'
+
+struct IconsCacheHeader {
+    u32 magic;
+    // changes when the icons change, so that we don't use outdated renderings
+    u32 iconsHash;
+    i32 dx;
+    i32 dy;
+    i32 nIcons;
+    i32 stride;
+};
 
+struct CachedIcons {
+    int dx = 0;
+    int dy = 0;
+    int stride = 0;
+    // RGB pixels of all icons next to each other
+    u8* samples = nullptr;
+};
+
+// only accessed on the ui thread
+static Vec<CachedIcons*> gCachedIcons;
+
+static u32 CalcIconsHash() {
+    u32 res = 0;
+    for (const char* svgData : gAllIcons) {
+        res = res * 31 + MurmurHash2(svgData, str::Len(svgData));
+    }
     return res;
-#endif
+}
+
+static TempStr IconsCachePathTemp(int dx, int dy) {
+    char* dir = AppGenDataFilenameTemp(kIconsCacheDirName);
+    if (!dir) {
+        return nullptr;
+    }
+    char fileName[64];
+    snprintf(fileName, dimof(fileName), "toolbaricons-%dx%d-%08x.bin", dx, dy, CalcIconsHash());
+    return path::JoinTemp(dir, fileName);
+}
+
+static CachedIcons* LoadCachedIcons(int dx, int dy) {
+    char* path = IconsCachePathTemp(dx, dy);
+    if (!path) {
+        return nullptr;
+    }
+    ByteSlice d = file::ReadFile(path);
+    if (d.empty()) {
+        return nullptr;
+    }
+    int nIcons = (int)dimof(gAllIcons);
+    const IconsCacheHeader* hdr = (const IconsCacheHeader*)d.data();
+    bool ok = d.size() >= sizeof(IconsCacheHeader) && hdr->magic == kIconsCacheMagic;
+    ok = ok && hdr->iconsHash == CalcIconsHash() && hdr->dx == dx && hdr->dy == dy && hdr->nIcons == nIcons;
+    ok = ok && hdr->stride >= dx * nIcons * 3 && d.size() == sizeof(IconsCacheHeader) + (size_t)hdr->stride * dy;
+    if (!ok) {
+        d.Free();
+        return nullptr;
+    }
+    auto icons = new CachedIcons();
+    icons->dx = dx;
+    icons->dy = dy;
+    icons->stride = hdr->stride;
+    icons->samples = (u8*)memdup(d.data() + sizeof(IconsCacheHeader), (size_t)hdr->stride * dy);
+    d.Free();
+    return icons;
+}
+
+static void SaveCachedIcons(CachedIcons* icons) {
+    char* path = IconsCachePathTemp(icons->dx, icons->dy);
+    if (!path) {
+        return;
+    }
+    IconsCacheHeader hdr{};
+    hdr.magic = kIconsCacheMagic;
+    hdr.iconsHash = CalcIconsHash();
+    hdr.dx = icons->dx;
+    hdr.dy = icons->dy;
+    hdr.nIcons = (int)dimof(gAllIcons);
+    hdr.stride = icons->stride;
+    str::Str d;
+    d.Append((const char*)&hdr, sizeof(hdr));
+    d.Append((const char*)icons->samples, (size_t)icons->stride * icons->dy);
+    bool ok = dir::CreateForFile(path) && file::WriteFile(path, d.AsByteSlice());
+    if (!ok) {
+        logf("SaveCachedIcons: failed to write '%s'\n", path);
+    }
+}
+
+static CachedIcons* GetCachedIcons(int dx, int dy) {
+    for (CachedIcons* icons : gCachedIcons) {
+        if (icons->dx == dx && icons->dy == dy) {
+            return icons;
+        }
+    }
+    CachedIcons* icons = LoadCachedIcons(dx, dy);
+    if (!icons) {
+        MupdfContext* muctx = new MupdfContext();
+        fz_pixmap* pixmap = BuildIconsPixmap(muctx, dx, dy);
+        icons = new CachedIcons();
+        icons->dx = dx;
+        icons->dy = dy;
+        icons->stride = (int)pixmap->stride;
+        icons->samples = (u8*)memdup(pixmap->samples, (size_t)pixmap->stride * pixmap->h);
+        fz_drop_pixmap(muctx->ctx, pixmap);
+        delete muctx;
+        SaveCachedIcons(icons);
+    }
+    gCachedIcons.Append(icons);
+    return icons;
+}
+
+HBITMAP BuildIconsBitmap(int dx, int dy) {
+    CachedIcons* icons = GetCachedIcons(dx, dy);
+    int nIcons = (int)dimof(gAllIcons);
+    return CreateBitmapFromPixels(icons->samples, dx * nIcons, dy, icons->stride, 3);
 }
@@ -225,6 +225,7 @@ void ClearTocBox(MainWindow* win) {
 
     win->currPageNo = 0;
     win->tocLoaded = false;
+    win->tocItemsByPage.Reset();
 }
 
 void ToggleTocBox(MainWindow* win) {
@@ -241,41 +242,40 @@ void ToggleTocBox(MainWindow* win) {
     }
 }
 
-// find the closest item in tree view to a given page number
-static TocItem* TreeItemForPageNo(TreeView* treeView, int pageNo) {
-    TocItem* bestMatch = nullptr;
-    int bestMatchPageNo = 0;
-
-    TreeModel* tm = treeView->treeModel;
-    if (!tm) {
-        return 0;
-    }
-    int nItems = 0;
-    VisitTreeModelItems(tm, [&](TreeModel* tm, TreeItem ti) {
-        auto tocItem = (TocItem*)ti;
-        if (!tocItem) {
-            return true;
-        }
-        if (!bestMatch) {
-            // if nothing else matches, match the root node
-            bestMatch = tocItem;
-        }
-        ++nItems;
-        int page = tocItem->pageNo;
-        if ((page <= pageNo) && (page >= bestMatchPageNo) && (page >= 1)) {
-            bestMatch = tocItem;
-            bestMatchPageNo = page;
-            if (pageNo == bestMatchPageNo) {
-                // we can stop earlier if we found the exact match
-                return false;
-            }
-        }
+static void BuildTocPageIndex(MainWindow* win, TocTree* tocTree) {
+    Vec<TocItem*>& items = win->tocItemsByPage;
+    items.Reset();
+    VisitTreeModelItems(tocTree, [&](TreeModel*, TreeItem ti) {
+        items.Append((TocItem*)ti);
         return true;
     });
+    // stable, so that for the same page the first item in tree order comes first
+    std::stable_sort(items.begin(), items.end(), [](TocItem* a, TocItem* b) { return a->pageNo < b->pageNo; });
+}
+
+// find the closest item in tree view to a given page number
+static TocItem* TreeItemForPageNo(MainWindow* win, int pageNo) {
+    TreeModel* tm = win->tocTreeView->treeModel;
+    Vec<TocItem*>& items = win->tocItemsByPage;
     // if there's only one item, we want to unselect it so that it can
     // be selected by the user
-    if (nItems < 2) {
-        return 0;
+    if (!tm || items.size() < 2) {
+        return nullptr;
+    }
+
+    // the last item (in tree order) with the highest page <= pageNo
+    // or the first one if it's exactly on pageNo
+    auto isBefore = [](int page, TocItem* ti) { return page < ti->pageNo; };
+    TocItem** end = std::upper_bound(items.begin(), items.end(), pageNo, isBefore);
+    TocItem** first = std::upper_bound(items.begin(), end, 0, isBefore);
+    if (first == end) {
+        // if nothing else matches, match the root node
+        return (TocItem*)tm->Root();
+    }
+    TocItem* bestMatch = end[-1];
+    if (bestMatch->pageNo == pageNo) {
+        auto isAfter = [](TocItem* ti, int page) { return ti->pageNo < page; };
+        bestMatch = *std::lower_bound(first, end, pageNo, isAfter);
     }
     return bestMatch;
 }
@@ -306,7 +306,7 @@ void UpdateTocSelection(MainWindow* win, int currPageNo) {
     }
 
     auto treeView = win->tocTreeView;
-    auto item = TreeItemForPageNo(treeView, currPageNo);
+    auto item = TreeItemForPageNo(win, currPageNo);
     // only select the items that are visible i.e. are top nodes or
     // children of expanded node
     TreeItem toSelect = (TreeItem)FindVisibleParentTreeItem(treeView, item);
@@ -417,9 +417,17 @@ static void AddFavoriteFromToc(MainWindow* win, TocItem* dti) {
     AddFavoriteWithLabelAndName(win, pageNo, pageLabel, name);
 }
 
-static void SaveAttachment(WindowTab* tab, const char* fileName, int attachmentNo) {
+static ByteSlice LoadAttachment(WindowTab* tab, TocItem* ti, int attachmentNo) {
     EngineBase* engine = tab->AsFixed()->GetEngine();
-    ByteSlice data = EngineMupdfLoadAttachment(engine, attachmentNo);
+    // the attachment is in one of the files of a folder
+    if (engine->kind == kindEngineMulti) {
+        return EngineMultiLoadAttachment(engine, ti, attachmentNo);
+    }
+    return EngineMupdfLoadAttachment(engine, attachmentNo);
+}
+
+static void SaveAttachment(WindowTab* tab, TocItem* ti, const char* fileName, int attachmentNo) {
+    ByteSlice data = LoadAttachment(tab, ti, attachmentNo);
     if (data.empty()) {
         return;
     }
@@ -430,9 +438,8 @@ static void SaveAttachment(WindowTab* tab, const char* fileName, int attachmentN
     str::Free(data.data());
 }
 
-static void OpenAttachment(WindowTab* tab, const char* fileName, int attachmentNo) {
-    EngineBase* engine = tab->AsFixed()->GetEngine();
-    ByteSlice data = EngineMupdfLoadAttachment(engine, attachmentNo);
+static void OpenAttachment(WindowTab* tab, TocItem* ti, const char* fileName, int attachmentNo) {
+    ByteSlice data = LoadAttachment(tab, ti, attachmentNo);
     if (data.empty()) {
         return;
     }
@@ -644,11 +651,11 @@ static void TocContextMenu(ContextMenuEvent* ev) {
             OpenEmbeddedFile(tab, dest);
             break;
         case CmdSaveAttachment: {
-            SaveAttachment(tab, fileName, attachmentNo);
+            SaveAttachment(tab, dti, fileName, attachmentNo);
             break;
         }
         case CmdOpenAttachment: {
-            OpenAttachment(tab, fileName, attachmentNo);
+            OpenAttachment(tab, dti, fileName, attachmentNo);
         }
     }
 }
@@ -722,6 +729,7 @@ void LoadTocTree(MainWindow* win) {
     AutoExpandTopLevelItems(tocTree->root->child);
 
     treeView->SetTreeModel(tocTree);
+    BuildTocPageIndex(win, tocTree);
 
     treeView->onTreeItemCustomDraw = nullptr;
     if (ShouldCustomDraw(win)) {
@@ -41,6 +41,8 @@ static bool gSaveHtml = false;
 static bool gSaveImages = false;
 // if true, we'll do a layout of mobi files
 static bool gLayout = false;
+// if true, we'll time decompressing the text of mobi files
+static bool gBenchDecode = false;
 // directory to which we'll save mobi html and images
 #define kMobiSaveDir "..\\ebooks-converted"
 
@@ -48,6 +50,7 @@ static int Usage() {
     printf("Tester.exe\n");
     printf("  -mobi dirOrFile : run mobi tests in a given directory or for a given file\n");
     printf("  -layout - will also layout mobi files\n");
+    printf("  -bench-decode - will time decompressing the text of mobi files\n");
     printf("  -save-html] - will save html content of mobi file\n");
     printf("  -save-images - will save images extracted from mobi files\n");
     printf("  -zip-create - creates a sample zip file that needs to be manually checked that it worked\n");
@@ -112,12 +115,22 @@ static void MobiLayout(MobiDoc* mobiDoc) {
 
 static void MobiTestFile(const char* filePath) {
     printf("Testing file '%s'\n", filePath);
+    auto timeStart = TimeGet();
     MobiDoc* mobiDoc = MobiDoc::CreateFromFile(filePath);
     if (!mobiDoc) {
         printf(" error: failed to parse the file\n");
         return;
     }
 
+    if (gBenchDecode) {
+        printf("Spent %.2f ms loading %s\n", TimeSinceInMs(timeStart), filePath);
+        timeStart = TimeGet();
+        ByteSlice html = mobiDoc->GetHtmlData();
+        double ms = TimeSinceInMs(timeStart);
+        double mbPerSec = ms > 0 ? (double)html.size() / (1024.0 * 1024.0) / (ms / 1000.0) : 0;
+        printf("Spent %.2f ms decompressing the rest of %d bytes (%.1f MB/s)\n", ms, (int)html.size(), mbPerSec);
+    }
+
     if (gLayout) {
         auto t = TimeGet();
         MobiLayout(mobiDoc);
@@ -218,6 +231,9 @@ int TesterMain() {
         } else if (str::Eq(arg, "-layout")) {
             gLayout = true;
             ++i;
+        } else if (str::Eq(arg, "-bench-decode")) {
+            gBenchDecode = true;
+            ++i;
         } else if (str::Eq(arg, "-save-html")) {
             gSaveHtml = true;
             ++i;
@@ -4,6 +4,8 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
+#include "utils/TextMatcher.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
@@ -14,6 +16,17 @@
 #include "TextSelection.h"
 #include "TextSearch.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
+// pages ahead are searched in parallel in chunks of that many pages
+constexpr int kParallelSearchChunkPages = 8;
+constexpr int kMaxParallelSearchThreads = 8;
+
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
 // ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
 // cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
@@ -37,6 +50,9 @@ TextSearch::~TextSearch() {
 void TextSearch::Clear() {
     str::ReplaceWithCopy(&findText, nullptr);
     str::ReplaceWithCopy(&anchor, nullptr);
+    str::ReplaceWithCopy(&regex, nullptr);
+    delete matcher;
+    matcher = nullptr;
     str::ReplaceWithCopy(&lastText, nullptr);
     Reset();
 }
@@ -100,6 +116,15 @@ void TextSearch::SetText(const WCHAR* text) {
         this->findText[str::Len(this->findText) - 1] = '\0';
     }
 
+    // "/pattern/" searches for a regular expression
+    size_t n = str::Len(this->findText);
+    if (n >= 3 && this->findText[0] == '/' && this->findText[n - 1] == '/') {
+        regex = str::Dup(this->findText + 1, n - 2);
+        str::ReplaceWithCopy(&anchor, nullptr);
+        UpdateMatcher();
+    }
+
+    UpdateAnchorStart();
     markAllPagesNonSkip(pagesToSkip);
 }
 
@@ -109,6 +134,8 @@ void TextSearch::SetSensitive(bool sensitive) {
     }
     this->caseSensitive = sensitive;
 
+    UpdateAnchorStart();
+    UpdateMatcher();
     markAllPagesNonSkip(pagesToSkip);
 }
 
@@ -119,7 +146,7 @@ void TextSearch::SetDirection(TextSearchDirection direction) {
     }
     forward = fwd;
     if (findText) {
-        int n = (int)str::Len(findText);
+        int n = regex ? lastMatchLen : (int)str::Len(findText);
         if (fwd) {
             findIndex += n;
         } else {
@@ -141,24 +168,196 @@ void TextSearch::SetLastResult(TextSelection* sel) {
     forward = true;
 }
 
-static WCHAR CharToLower2(WCHAR c) {
-    WCHAR buf[1] = {c};
-    CharLowerBuffW(buf, 1);
-    return buf[0];
+static WCHAR* BuildLowerCaseTable() {
+    WCHAR* table = AllocArray<WCHAR>(0x10000);
+    for (int i = 0; i < 0x10000; i++) {
+        table[i] = (WCHAR)i;
+    }
+    // 0 would be taken as the end of the string
+    CharLowerBuffW(table + 1, 0xffff);
+    return table;
+}
+
+// CharLowerBuffW() of every UTF-16 code unit, so that case folding
+// is a single lookup instead of a call into user32 for every char
+static const WCHAR* GetLowerCaseTable() {
+    // function-local statics are initialized only once, even with several search threads
+    static WCHAR* table = BuildLowerCaseTable();
+    return table;
 }
 
-static inline WCHAR CharToLower(WCHAR c) {
-    // fast path that hopefully will be inlined
-    if (c >= 'a' && c <= 'z') {
-        return c;
+void TextSearch::UpdateMatcher() {
+    delete matcher;
+    matcher = nullptr;
+    if (regex) {
+        matcher = CompileTextMatcher(regex, caseSensitive ? nullptr : GetLowerCaseTable());
     }
-    if (c >= '0' && c <= '9') {
-        return c;
+}
+
+// collect the chars that are equal to the first char of the anchor when ignoring case
+// (e.g. 'k', 'K' and KELVIN SIGN), so that they can be looked for without case folding
+void TextSearch::UpdateAnchorStart() {
+    nAnchorStart = 0;
+    if (!anchor) {
+        return;
     }
-    if (c >= 'A' && c <= 'Z') {
-        return c + 32;
+    if (caseSensitive) {
+        anchorStart[nAnchorStart++] = anchor[0];
+        return;
+    }
+    const WCHAR* lower = GetLowerCaseTable();
+    WCHAR c = lower[anchor[0]];
+    for (int i = 1; i < 0x10000; i++) {
+        if (lower[i] != c) {
+            continue;
+        }
+        if (nAnchorStart == kMaxAnchorStartChars) {
+            // FindAnchor() falls back to case folding every char
+            nAnchorStart = 0;
+            return;
+        }
+        anchorStart[nAnchorStart++] = (WCHAR)i;
     }
-    return CharToLower2(c);
+}
+
+bool TextSearch::AnchorMatchesAt(const WCHAR* s) const {
+    const WCHAR* a = anchor;
+    if (caseSensitive) {
+        for (; *a; a++, s++) {
+            if (*a != *s) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // the terminating 0 of s never matches since anchor doesn't contain 0
+    const WCHAR* lower = GetLowerCaseTable();
+    for (; *a; a++, s++) {
+        if (lower[*a] != lower[*s]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if USE_SSE2
+// returns a mask with 2 bits set for every char in v equal to one of starts
+static inline int MatchAnchorStart(__m128i v, const __m128i* starts) {
+    __m128i m = _mm_cmpeq_epi16(v, starts[0]);
+    for (int i = 1; i < kMaxAnchorStartChars; i++) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi16(v, starts[i]));
+    }
+    return _mm_movemask_epi8(m);
+}
+#endif
+
+// find the first occurence of anchor at or after s
+const WCHAR* TextSearch::FindAnchor(const WCHAR* s) const {
+    if (nAnchorStart == 0) {
+        const WCHAR* lower = GetLowerCaseTable();
+        WCHAR c = lower[anchor[0]];
+        for (; *s; s++) {
+            if (lower[*s] == c && AnchorMatchesAt(s)) {
+                return s;
+            }
+        }
+        return nullptr;
+    }
+
+#if USE_SSE2
+    // unused slots repeat the first char
+    __m128i starts[kMaxAnchorStartChars];
+    for (int i = 0; i < kMaxAnchorStartChars; i++) {
+        starts[i] = _mm_set1_epi16((short)anchorStart[i < nAnchorStart ? i : 0]);
+    }
+    __m128i zero = _mm_setzero_si128();
+#endif
+
+    while (*s) {
+#if USE_SSE2
+        // only load aligned blocks which can't cross into the next (possibly
+        // unmapped) memory page past the end of the string
+        if (((uintptr_t)s & 15) == 0) {
+            __m128i v = _mm_load_si128((const __m128i*)s);
+            int mask = MatchAnchorStart(v, starts) | _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+            if (mask == 0) {
+                s += 8;
+                continue;
+            }
+            unsigned long idx;
+            _BitScanForward(&idx, (unsigned long)mask);
+            s += idx / 2;
+            if (!*s) {
+                return nullptr;
+            }
+        } else
+#endif
+        {
+            bool isStart = false;
+            for (int i = 0; i < nAnchorStart && !isStart; i++) {
+                isStart = *s == anchorStart[i];
+            }
+            if (!isStart) {
+                s++;
+                continue;
+            }
+        }
+        if (AnchorMatchesAt(s)) {
+            return s;
+        }
+        s++;
+    }
+    return nullptr;
+}
+
+// find the last occurence of anchor starting before end
+// (like StrRStrI(), the match itself may extend past end)
+const WCHAR* TextSearch::FindAnchorBackward(const WCHAR* begin, const WCHAR* end) const {
+    const WCHAR* s = end;
+    if (nAnchorStart == 0) {
+        const WCHAR* lower = GetLowerCaseTable();
+        WCHAR c = lower[anchor[0]];
+        while (s > begin) {
+            s--;
+            if (lower[*s] == c && AnchorMatchesAt(s)) {
+                return s;
+            }
+        }
+        return nullptr;
+    }
+
+#if USE_SSE2
+    __m128i starts[kMaxAnchorStartChars];
+    for (int i = 0; i < kMaxAnchorStartChars; i++) {
+        starts[i] = _mm_set1_epi16((short)anchorStart[i < nAnchorStart ? i : 0]);
+    }
+    // [begin, end) is known to be valid, so unaligned loads are fine
+    while (s - begin >= 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s - 8));
+        int mask = MatchAnchorStart(v, starts);
+        while (mask != 0) {
+            unsigned long idx;
+            _BitScanReverse(&idx, (unsigned long)mask);
+            const WCHAR* c = s - 8 + idx / 2;
+            if (AnchorMatchesAt(c)) {
+                return c;
+            }
+            // clear both bits of that char
+            mask &= ~(3 << (idx & ~1));
+        }
+        s -= 8;
+    }
+#endif
+
+    while (s > begin) {
+        s--;
+        for (int i = 0; i < nAnchorStart; i++) {
+            if (*s == anchorStart[i] && AnchorMatchesAt(s)) {
+                return s;
+            }
+        }
+    }
+    return nullptr;
 }
 
 // try to match "findText" from "start" with whitespace tolerance
@@ -166,6 +365,7 @@ static inline WCHAR CharToLower(WCHAR c) {
 TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
     const WCHAR *match = findText, *end = start;
     const PageAndOffset notFound = {-1, -1};
+    const WCHAR* lower = GetLowerCaseTable();
     int currentPage = findPage;
     const WCHAR* currentPageText = pageText;
     bool lookingAtWs;
@@ -188,9 +388,7 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
         if (caseSensitive) {
             isMatch = *match == *end;
         } else {
-            WCHAR matchLower = CharToLower(*match);
-            WCHAR matchEnd = CharToLower(*end);
-            isMatch = matchLower == matchEnd;
+            isMatch = lower[*match] == lower[*end];
         }
         if (isMatch) {
             /* characters are identical */;
@@ -264,6 +462,10 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     // get here with pageNo != 0 the findText has already been set so I didn't add
     // a findText = textCache->GetData(findPage) here.
     findPage = pageNo;
+    TIME_TRACE_PAGE("FindTextInPage", pageNo);
+    if (regex) {
+        return FindRegexInPage(pageNo, finalGlyph);
+    }
 
     const WCHAR* found;
     PageAndOffset fg;
@@ -271,14 +473,9 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
         if (!anchor) {
             found = GetNextIndex(pageText, findIndex, forward);
         } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
-            } else {
-                found = StrStrI(s, anchor);
-            }
+            found = FindAnchor(pageText + findIndex);
         } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            found = FindAnchorBackward(pageText, pageText + findIndex);
         }
         if (!found) {
             return false;
@@ -304,22 +501,85 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     return true;
 }
 
+// matches of regular expressions don't extend to the next page
+bool TextSearch::FindRegexInPage(int pageNo, PageAndOffset* finalGlyph) {
+    if (!matcher) {
+        return false;
+    }
+    int len = (int)str::Len(pageText);
+    int start, end;
+    for (;;) {
+        bool found;
+        if (forward) {
+            found = findIndex < len && matcher->Find(pageText, len, findIndex, &start, &end);
+        } else {
+            found = findIndex > 0 && matcher->FindLast(pageText, len, findIndex, &start, &end);
+        }
+        if (!found) {
+            return false;
+        }
+        findIndex = start + (forward ? 1 : 0);
+        if (matchWordStart && start > 0 && isWordChar(pageText[start - 1]) && isWordChar(pageText[start])) {
+            continue;
+        }
+        if (matchWordEnd && isWordChar(pageText[end - 1]) && isWordChar(pageText[end])) {
+            continue;
+        }
+        searchHitStartAt = pageNo;
+        StartAt(pageNo, start);
+        SelectUpTo(pageNo, end);
+        findIndex = forward ? end : start;
+        // try again if the found text is completely outside the page's mediabox
+        if (result.len > 0) {
+            break;
+        }
+    }
+
+    lastMatchLen = end - start;
+    if (finalGlyph) {
+        *finalGlyph = {pageNo, end};
+    }
+    return true;
+}
+
+// the document might have grown since the last search
+// (for ebooks that are laid out in the background)
+void TextSearch::UpdatePageCount() {
+    int n = engine->PageCount();
+    if (n == nPages) {
+        return;
+    }
+    CrashIf(n < nPages || n > textCache->nPages);
+    while (pagesToSkip.isize() < n) {
+        pagesToSkip.Append(false);
+    }
+    nPages = n;
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
     if (str::IsEmpty(findText)) {
         return false;
     }
+    TIME_TRACE_PAGE("TextSearch", pageNo);
+    UpdatePageCount();
+    if (1 <= pageNo && pageNo <= nPages) {
+        // pages ahead of us are extracted in parallel while we search
+        textCache->StartPrefetch(pageNo);
+    }
+
+    SkipPagesInParallel(pageNo, tracker);
 
     int next = forward ? 1 : -1;
     while (1 <= pageNo && pageNo <= nPages && (!tracker || !tracker->WasCanceled())) {
-        if (tracker) {
-            tracker->UpdateProgress(pageNo, nPages);
-        }
-
         if (pagesToSkip[pageNo - 1]) {
             pageNo += next;
             continue;
         }
 
+        if (tracker) {
+            tracker->UpdateProgress(pageNo, nPages);
+        }
+
         Reset();
 
         pageText = textCache->GetTextForPage(pageNo, &findIndex);
@@ -350,6 +610,141 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
     return false;
 }
 
+// takes the search text and options of other, for searching in parallel
+void TextSearch::CopySearch(const TextSearch* other) {
+    Clear();
+    findText = str::Dup(other->findText);
+    anchor = str::Dup(other->anchor);
+    regex = str::Dup(other->regex);
+    memcpy(anchorStart, other->anchorStart, sizeof(anchorStart));
+    nAnchorStart = other->nAnchorStart;
+    caseSensitive = other->caseSensitive;
+    matchWordStart = other->matchWordStart;
+    matchWordEnd = other->matchWordEnd;
+    forward = true;
+    UpdateMatcher();
+}
+
+// state shared by the threads of SkipPagesInParallel()
+struct ParallelPageSearch {
+    TextSearch* search = nullptr;
+    ProgressUpdateUI* tracker = nullptr;
+    int startPage = 0;
+    int nPages = 0;
+    // 1 when searching forward, -1 when searching backward
+    int step = 1;
+    int nChunks = 0;
+    // chunks are taken in order, i.e. nearest to startPage first
+    LONG nextChunk = 0;
+    // nearest chunk with a match so far, chunks after it don't have to be searched
+    LONG nearestHitChunk = 0;
+    LONG nPagesSearched = 0;
+};
+
+DWORD WINAPI TextSearch::SkipPagesThread(LPVOID data) {
+    ParallelPageSearch* ps = (ParallelPageSearch*)data;
+    TextSearch* orig = ps->search;
+    TextSearch search(orig->engine, orig->textCache);
+    search.CopySearch(orig);
+    while (!ps->tracker || !ps->tracker->WasCanceled()) {
+        int chunkNo = (int)InterlockedIncrement(&ps->nextChunk) - 1;
+        if (chunkNo >= ps->nChunks) {
+            break;
+        }
+        for (int i = 0; i < kParallelSearchChunkPages; i++) {
+            if (chunkNo > InterlockedCompareExchange(&ps->nearestHitChunk, 0, 0)) {
+                // a nearer match has already been found
+                break;
+            }
+            int pageNo = ps->startPage + (chunkNo * kParallelSearchChunkPages + i) * ps->step;
+            if (pageNo < 1 || pageNo > ps->nPages) {
+                break;
+            }
+            if (orig->pagesToSkip[pageNo - 1]) {
+                continue;
+            }
+            search.Reset();
+            search.pageText = search.textCache->GetTextForPage(pageNo);
+            search.findIndex = 0;
+            InterlockedIncrement(&ps->nPagesSearched);
+            if (!search.pageText) {
+                continue;
+            }
+            if (!search.FindTextInPage(pageNo, nullptr)) {
+                // each thread writes different pages
+                orig->pagesToSkip[pageNo - 1] = true;
+                continue;
+            }
+            LONG nearest = InterlockedCompareExchange(&ps->nearestHitChunk, 0, 0);
+            while (chunkNo < nearest) {
+                LONG prev = InterlockedCompareExchange(&ps->nearestHitChunk, chunkNo, nearest);
+                if (prev == nearest) {
+                    break;
+                }
+                nearest = prev;
+            }
+            break;
+        }
+    }
+    DestroyTempAllocator();
+    return 0;
+}
+
+// searches pages from pageNo on in the search direction on several threads
+// and marks those without a match in pagesToSkip, up to the page with the nearest
+// match. the caller then only has to search that page
+void TextSearch::SkipPagesInParallel(int pageNo, ProgressUpdateUI* tracker) {
+    if (pageNo < 1 || pageNo > nPages) {
+        return;
+    }
+    int nPagesLeft = forward ? nPages - pageNo + 1 : pageNo;
+    if (nPagesLeft < 2 * kParallelSearchChunkPages) {
+        return;
+    }
+    int nThreads = std::clamp(GetPhysicalProcessorCount(), 1, kMaxParallelSearchThreads);
+    if (nThreads < 2) {
+        return;
+    }
+
+    ParallelPageSearch ps;
+    ps.search = this;
+    ps.tracker = tracker;
+    ps.startPage = pageNo;
+    ps.nPages = nPages;
+    ps.step = forward ? 1 : -1;
+    ps.nChunks = (nPagesLeft + kParallelSearchChunkPages - 1) / kParallelSearchChunkPages;
+    ps.nearestHitChunk = ps.nChunks;
+
+    HANDLE threads[kMaxParallelSearchThreads] = {};
+    int n = 0;
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, SkipPagesThread, &ps, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        threads[n++] = h;
+    }
+    if (n == 0) {
+        return;
+    }
+    while (WaitForMultipleObjects(n, threads, TRUE, 100) == WAIT_TIMEOUT) {
+        if (!tracker) {
+            continue;
+        }
+        if (tracker->WasCanceled()) {
+            // makes the threads stop after the page they're searching
+            InterlockedExchange(&ps.nearestHitChunk, -1);
+            break;
+        }
+        int nSearched = std::min((int)InterlockedCompareExchange(&ps.nPagesSearched, 0, 0), nPagesLeft - 1);
+        tracker->UpdateProgress(pageNo + nSearched * ps.step, nPages);
+    }
+    WaitForMultipleObjects(n, threads, TRUE, INFINITE);
+    for (int i = 0; i < n; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
 TextSel* TextSearch::FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker) {
     SetText(text);
 
@@ -388,3 +783,43 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
     }
     return nullptr;
 }
+
+// appends all matches starting on pages firstPage to lastPage to hitsOut
+// several TextSearch instances sharing a DocumentTextCache can
+// search different pages in parallel
+void TextSearch::FindAllInPages(const WCHAR* text, int firstPage, int lastPage, TextSearchHits& hitsOut,
+                                ProgressUpdateUI* tracker) {
+    SetText(text);
+    if (str::IsEmpty(findText)) {
+        return;
+    }
+    UpdatePageCount();
+    forward = true;
+    lastPage = std::min(lastPage, nPages);
+
+    for (int pageNo = firstPage; pageNo <= lastPage; pageNo++) {
+        if (tracker && tracker->WasCanceled()) {
+            return;
+        }
+        Reset();
+        pageText = textCache->GetTextForPage(pageNo);
+        findIndex = 0;
+        PageAndOffset fg;
+        while (FindTextInPage(pageNo, &fg)) {
+            TextSearchHit hit;
+            GetGlyphRange(&hit.startPage, &hit.startGlyph, &hit.endPage, &hit.endGlyph);
+            hit.firstRect = hitsOut.rects.isize();
+            hit.nRects = result.len;
+            for (int i = 0; i < result.len; i++) {
+                hitsOut.rectPages.Append(result.pages[i]);
+                hitsOut.rects.Append(result.rects[i]);
+            }
+            hitsOut.hits.Append(hit);
+            if (fg.page != pageNo) {
+                // the match extends to the next page
+                break;
+            }
+        }
+    }
+    Reset();
+}
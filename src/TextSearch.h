@@ -4,6 +4,28 @@
 enum class TextSearchDirection : bool { Backward = false, Forward = true };
 
 struct ProgressUpdateUI;
+struct TextMatcher;
+
+// a match found by TextSearch::FindAllInPages()
+struct TextSearchHit {
+    int startPage = 0;
+    int startGlyph = 0;
+    int endPage = 0;
+    int endGlyph = 0;
+    // range of the rectangles covering the match in TextSearchHits
+    int firstRect = 0;
+    int nRects = 0;
+};
+
+struct TextSearchHits {
+    Vec<TextSearchHit> hits;
+    // page of each rectangle and the rectangle in user coordinates
+    Vec<int> rectPages;
+    Vec<Rect> rects;
+};
+
+// max number of chars that are equal when ignoring case, for the fast anchor search
+constexpr int kMaxAnchorStartChars = 4;
 
 class TextSearch : public TextSelection {
   public:
@@ -15,6 +37,8 @@ class TextSearch : public TextSelection {
     void SetLastResult(TextSelection* sel);
     TextSel* FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker = nullptr);
     TextSel* FindNext(ProgressUpdateUI* tracker = nullptr);
+    void FindAllInPages(const WCHAR* text, int firstPage, int lastPage, TextSearchHits& hitsOut,
+                        ProgressUpdateUI* tracker = nullptr);
 
     int GetCurrentPageNo() const;
     int GetSearchHitStartPageNo() const;
@@ -28,6 +52,13 @@ class TextSearch : public TextSelection {
 
     WCHAR* findText = nullptr;
     WCHAR* anchor = nullptr;
+    // chars a match of anchor can start with (0 if there are too many)
+    WCHAR anchorStart[kMaxAnchorStartChars] = {};
+    int nAnchorStart = 0;
+    // pattern of a search for "/regex/" and its compiled form (nullptr if it's invalid)
+    WCHAR* regex = nullptr;
+    TextMatcher* matcher = nullptr;
+    int lastMatchLen = 0;
     int findPage = 0;
     int searchHitStartAt = 0; // when text found spans several pages, searchHitStartAt < findPage
     bool forward = true;
@@ -40,8 +71,18 @@ class TextSearch : public TextSelection {
 
     void SetText(const WCHAR* text);
     bool FindTextInPage(int pageNo, PageAndOffset* finalGlyph);
+    bool FindRegexInPage(int pageNo, PageAndOffset* finalGlyph);
+    void UpdateMatcher();
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker);
+    void CopySearch(const TextSearch* other);
+    void SkipPagesInParallel(int pageNo, ProgressUpdateUI* tracker);
+    static DWORD WINAPI SkipPagesThread(LPVOID data);
     PageAndOffset MatchEnd(const WCHAR* start) const;
+    void UpdateAnchorStart();
+    bool AnchorMatchesAt(const WCHAR* s) const;
+    const WCHAR* FindAnchor(const WCHAR* s) const;
+    const WCHAR* FindAnchorBackward(const WCHAR* begin, const WCHAR* end) const;
+    void UpdatePageCount();
 
     void Clear();
     void Reset();
@@ -3,14 +3,24 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/Timer.h"
+#include "utils/TimeTrace.h"
 
 #include "wingui/UIModels.h"
 
 #include "DocController.h"
 #include "EngineBase.h"
+#include "EngineAll.h"
+#include "AppTools.h"
+#include "FileTextCache.h"
+#include "IdleTasks.h"
+#include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 
+#include "utils/Log.h"
+
 uint distSq(int x, int y) {
     return x * x + y * y;
 }
@@ -19,56 +29,606 @@ bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
 
+// how long prefetch threads wait before checking whether rendering has finished
+constexpr int kPrefetchRenderPauseMs = 50;
+
+// pages with fewer glyphs are hit-tested by looking at every glyph
+constexpr int kMinGlyphsForGrid = 512;
+constexpr int kGlyphsPerGridCell = 4;
+constexpr int kMaxGridCols = 1024;
+
+static PageTextSlot** AllocPageTextSlots(int nPages) {
+    PageTextSlot** slots = AllocArray<PageTextSlot*>(nPages);
+    for (int i = 0; i < nPages; i++) {
+        slots[i] = new PageTextSlot();
+        InitializeCriticalSection(&slots[i]->access);
+    }
+    return slots;
+}
+
+// Packs rects into coords by grouping consecutive glyphs with the same y and dy
+// into lines. Takes ownership of rects, which is kept if the page can't be packed
+static void PackPageCoords(PageCoords* coords, Rect* rects, int len) {
+    *coords = {};
+    coords->rects = rects;
+    if (len == 0 || !rects) {
+        return;
+    }
+    PackedGlyph* glyphs = AllocArray<PackedGlyph>(len);
+    Vec<GlyphLine> lines;
+    GlyphLine* line = nullptr;
+    for (int i = 0; i < len; i++) {
+        Rect r = rects[i];
+        if (r.x == 0 && r.y == 0 && r.dx == 0 && r.dy == 0) {
+            glyphs[i] = {kNoGlyphLine, 0, 0};
+            continue;
+        }
+        int dxLine = line ? r.x - line->x : 0;
+        bool sameLine = line && line->y == r.y && line->dy == r.dy && dxLine >= INT16_MIN && dxLine <= INT16_MAX;
+        if (!sameLine) {
+            if (lines.isize() >= kNoGlyphLine) {
+                // too many lines to pack
+                free(glyphs);
+                return;
+            }
+            GlyphLine l;
+            l.x = r.x;
+            l.y = r.y;
+            l.dy = r.dy;
+            lines.Append(l);
+            line = &lines.Last();
+            dxLine = 0;
+        }
+        if (r.dx < 0 || r.dx > UINT16_MAX) {
+            free(glyphs);
+            return;
+        }
+        glyphs[i] = {(u16)(lines.size() - 1), (i16)dxLine, (u16)r.dx};
+    }
+    coords->glyphs = glyphs;
+    coords->nLines = lines.isize();
+    coords->lines = lines.StealData();
+    coords->rects = nullptr;
+    free(rects);
+}
+
+static void FreePageCoords(PageCoords* coords) {
+    free(coords->rects);
+    free(coords->glyphs);
+    free(coords->lines);
+    *coords = {};
+}
+
+static void FreePageTextSlots(PageTextSlot** slots, int nPages) {
+    for (int i = 0; i < nPages; i++) {
+        PageTextSlot* slot = slots[i];
+        if (!slot->fromDisk) {
+            FreePageCoords(&slot->coords);
+            free(slot->text);
+        }
+        delete slot->grid;
+        DeleteCriticalSection(&slot->access);
+        delete slot;
+    }
+    free(slots);
+}
+
+static i64 PageCoordsMemSize(const PageCoords& coords, int len) {
+    if (coords.rects) {
+        return (i64)len * sizeof(Rect);
+    }
+    return (i64)len * sizeof(PackedGlyph) + (i64)coords.nLines * sizeof(GlyphLine);
+}
+
+// line breaks and other glyphs without a bounding box have x and dx of 0
+static bool HasGlyphBox(Rect r) {
+    return r.x || r.dx;
+}
+
+static Point GlyphCenter(Rect r) {
+    return Point(r.x + r.dx / 2, r.y + r.dy / 2);
+}
+
+GlyphGrid::~GlyphGrid() {
+    free(cellStart);
+    free(glyphs);
+}
+
+static GlyphGrid* BuildGlyphGrid(const PageCoords& coords, int len) {
+    if (len < kMinGlyphsForGrid) {
+        return nullptr;
+    }
+    GlyphGrid* grid = new GlyphGrid();
+    // bounding box of the glyph centers
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    int nGlyphs = 0;
+    for (int i = 0; i < len; i++) {
+        Rect r = coords[i];
+        if (!HasGlyphBox(r)) {
+            continue;
+        }
+        Point c = GlyphCenter(r);
+        x0 = std::min(x0, c.x);
+        y0 = std::min(y0, c.y);
+        x1 = std::max(x1, c.x);
+        y1 = std::max(y1, c.y);
+        grid->maxGlyphDx = std::max(grid->maxGlyphDx, std::abs(r.dx));
+        grid->maxGlyphDy = std::max(grid->maxGlyphDy, std::abs(r.dy));
+        nGlyphs++;
+    }
+    if (nGlyphs == 0) {
+        delete grid;
+        return nullptr;
+    }
+
+    // square cells with kGlyphsPerGridCell glyphs on average
+    double area = ((double)x1 - x0 + 1) * ((double)y1 - y0 + 1);
+    int cellSize = std::max((int)sqrt(area * kGlyphsPerGridCell / nGlyphs), 1);
+    grid->x = x0;
+    grid->y = y0;
+    grid->nCols = std::min((x1 - x0) / cellSize + 1, kMaxGridCols);
+    grid->nRows = std::min((y1 - y0) / cellSize + 1, kMaxGridCols);
+    grid->cellDx = (x1 - x0) / grid->nCols + 1;
+    grid->cellDy = (y1 - y0) / grid->nRows + 1;
+
+    // counting sort of the glyphs by cell
+    int nCells = grid->nCols * grid->nRows;
+    grid->cellStart = AllocArray<int>(nCells + 1);
+    grid->glyphs = AllocArray<int>(nGlyphs);
+    for (int i = 0; i < len; i++) {
+        Rect r = coords[i];
+        if (HasGlyphBox(r)) {
+            Point c = GlyphCenter(r);
+            int cell = ((c.y - y0) / grid->cellDy) * grid->nCols + (c.x - x0) / grid->cellDx;
+            grid->cellStart[cell + 1]++;
+        }
+    }
+    for (int i = 0; i < nCells; i++) {
+        grid->cellStart[i + 1] += grid->cellStart[i];
+    }
+    int* pos = AllocArray<int>(nCells);
+    memcpy(pos, grid->cellStart, nCells * sizeof(int));
+    for (int i = 0; i < len; i++) {
+        Rect r = coords[i];
+        if (HasGlyphBox(r)) {
+            Point c = GlyphCenter(r);
+            int cell = ((c.y - y0) / grid->cellDy) * grid->nCols + (c.x - x0) / grid->cellDx;
+            grid->glyphs[pos[cell]++] = i;
+        }
+    }
+    free(pos);
+    return grid;
+}
+
+static i64 GlyphGridMemSize(const GlyphGrid* grid) {
+    if (!grid) {
+        return 0;
+    }
+    int nCells = grid->nCols * grid->nRows;
+    return sizeof(GlyphGrid) + (i64)(nCells + 1) * sizeof(int) + (i64)grid->cellStart[nCells] * sizeof(int);
+}
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
-    pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    pagesText = AllocPageTextSlots(nPages);
+    memSize = nPages * (sizeof(PageTextSlot*) + sizeof(PageTextSlot));
 
     InitializeCriticalSection(&access);
 }
 
 DocumentTextCache::~DocumentTextCache() {
+    StopPrefetch();
+    SaveToDisk();
+
     EnterCriticalSection(&access);
 
-    int n = engine->PageCount();
-    for (int i = 0; i < n; i++) {
-        PageText* pageText = &pagesText[i];
-        free(pageText->coords);
-        free(pageText->text);
+    if (pagesText) {
+        FreePageTextSlots(pagesText, nPages);
     }
-    free(pagesText);
+    for (PageTextSlot** slots : oldPagesText) {
+        free(slots);
+    }
+    delete diskCache;
+    free(diskCachePath);
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
 }
 
-bool DocumentTextCache::HasTextForPage(int pageNo) const {
+PageTextSlot* DocumentTextCache::GetSlot(int pageNo) {
+    ScopedCritSec scope(&access);
     CrashIf(pageNo < 1 || pageNo > nPages);
-    PageText* pageText = &pagesText[pageNo - 1];
-    return pageText->text != nullptr;
+    return pagesText[pageNo - 1];
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
-    CrashIf(pageNo < 1 || pageNo > nPages);
+void DocumentTextCache::ExtractText(PageTextSlot* slot, int pageNo) {
+    ScopedCritSec scope(&slot->access);
+    if (slot->extracted) {
+        // another thread was faster
+        return;
+    }
+    TIME_TRACE_PAGE("ExtractPageText", pageNo);
+    PageText pageText = engine->ExtractPageText(pageNo);
+    if (!pageText.text) {
+        free(pageText.coords);
+        pageText.text = str::Dup(L"");
+        pageText.coords = nullptr;
+        pageText.len = 0;
+    }
+    slot->text = pageText.text;
+    slot->len = pageText.len;
+    PackPageCoords(&slot->coords, pageText.coords, pageText.len);
+    InterlockedExchange(&slot->extracted, 1);
 
-    ScopedCritSec scope(&access);
-    PageText* pageText = &pagesText[pageNo - 1];
+    ScopedCritSec scope2(&access);
+    memSize += (slot->len + 1) * sizeof(WCHAR) + PageCoordsMemSize(slot->coords, slot->len);
+    nPagesExtracted++;
+    nCharsExtracted += slot->len;
+    nPagesNotOnDisk++;
+}
 
-    if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
-        if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
+// when a document is reloaded, takes the text of pages that didn't change
+// (unchangedPages[i] is set for page i + 1) from the cache of the previous version
+void DocumentTextCache::TakeUnchangedPages(DocumentTextCache* prev, const Vec<bool>& unchangedPages) {
+    prev->StopPrefetch();
+    // the idle task extracting text must not fill the slots we take
+    CancelIdleTasks(prev->engine);
+    int n = std::min({nPages, prev->nPages, unchangedPages.isize()});
+    for (int i = 0; i < n; i++) {
+        PageTextSlot* from = prev->pagesText[i];
+        PageTextSlot* to = GetSlot(i + 1);
+        // text from the previous version's disk cache is owned by that cache
+        if (!unchangedPages[i] || !from->extracted || from->fromDisk) {
+            continue;
+        }
+        // same lock order as in ExtractText()
+        ScopedCritSec scope(&to->access);
+        if (to->extracted) {
+            continue;
         }
-        debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+        to->text = from->text;
+        to->len = from->len;
+        to->coords = from->coords;
+        to->grid = from->grid;
+        to->gridBuilt = from->gridBuilt;
+        InterlockedExchange(&to->extracted, 1);
+        from->text = nullptr;
+        from->len = 0;
+        from->coords = {};
+        from->grid = nullptr;
+        from->gridBuilt = false;
+        InterlockedExchange(&from->extracted, 0);
+
+        ScopedCritSec scope2(&access);
+        memSize += (to->len + 1) * sizeof(WCHAR) + PageCoordsMemSize(to->coords, to->len);
+        memSize += GlyphGridMemSize(to->grid);
+        nPagesExtracted++;
+        nCharsExtracted += to->len;
+        nPagesNotOnDisk++;
+    }
+}
+
+bool DocumentTextCache::HasTextForPage(int pageNo) {
+    PageTextSlot* slot = GetSlot(pageNo);
+    return InterlockedCompareExchange(&slot->extracted, 0, 0) != 0;
+}
+
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, PageCoords* coordsOut) {
+    PageTextSlot* slot = GetSlot(pageNo);
+    if (!InterlockedCompareExchange(&slot->extracted, 0, 0)) {
+        ExtractText(slot, pageNo);
     }
 
     if (lenOut) {
-        *lenOut = pageText->len;
+        *lenOut = slot->len;
     }
     if (coordsOut) {
-        *coordsOut = pageText->coords;
+        *coordsOut = slot->coords;
+    }
+    return slot->text;
+}
+
+// the grid is only built for pages that are hit-tested, e.g. when selecting text
+const GlyphGrid* DocumentTextCache::GetGlyphGrid(int pageNo) {
+    PageTextSlot* slot = GetSlot(pageNo);
+    if (!InterlockedCompareExchange(&slot->extracted, 0, 0)) {
+        ExtractText(slot, pageNo);
+    }
+
+    ScopedCritSec scope(&slot->access);
+    if (!slot->gridBuilt) {
+        slot->grid = BuildGlyphGrid(slot->coords, slot->len);
+        slot->gridBuilt = true;
+        ScopedCritSec scope2(&access);
+        memSize += GlyphGridMemSize(slot->grid);
+    }
+    return slot->grid;
+}
+
+// for documents that grow while being laid out in the background
+void DocumentTextCache::SetPageCount(int newPageCount) {
+    ScopedCritSec scope(&access);
+    CrashIf(newPageCount < nPages);
+    PageTextSlot** newPagesText = AllocPageTextSlots(newPageCount);
+    for (int i = 0; i < nPages; i++) {
+        DeleteCriticalSection(&newPagesText[i]->access);
+        delete newPagesText[i];
+        newPagesText[i] = pagesText[i];
+    }
+    oldPagesText.Append(pagesText);
+    pagesText = newPagesText;
+    memSize += (newPageCount - nPages) * (sizeof(PageTextSlot*) + sizeof(PageTextSlot));
+    nPages = newPageCount;
+}
+
+// text of closed documents, saved on a thread that
+// exists as long as there are documents to save
+struct TextCacheSave {
+    char* path = nullptr;
+    PageTextSlot** pagesText = nullptr;
+    int nPages = 0;
+    TextCacheFile* diskCache = nullptr;
+};
+
+struct TextCacheWriter {
+    CRITICAL_SECTION access;
+    Vec<TextCacheSave*> queue;
+    // path of the file currently being written
+    char* writingPath = nullptr;
+    HANDLE hThread = nullptr;
+    // signaled after each file has been written
+    CONDITION_VARIABLE written;
+
+    TextCacheWriter() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&written);
+    }
+    ~TextCacheWriter() {
+        DeleteCriticalSection(&access);
+    }
+};
+
+static TextCacheWriter gTextCacheWriter;
+
+// how long opening a document waits for the text cache of the same file to be written
+constexpr DWORD kTextCacheLoadWaitMs = 500;
+// how long exiting waits for the text cache of closed documents to be written
+constexpr DWORD kTextCacheExitWaitMs = 5000;
+
+static void WriteTextCacheSave(TextCacheSave* save) {
+    PageTextSlot** texts = AllocArray<PageTextSlot*>(save->nPages);
+    for (int i = 0; i < save->nPages; i++) {
+        PageTextSlot* slot = save->pagesText[i];
+        if (slot->extracted) {
+            texts[i] = slot;
+        }
+    }
+    SaveTextCacheFile(save->path, texts, save->nPages, save->diskCache);
+    free(texts);
+}
+
+static DWORD WINAPI TextCacheWriterThread(void*) {
+    SetThreadName("TextCacheWriterThread");
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    TextCacheWriter* writer = &gTextCacheWriter;
+    for (;;) {
+        TextCacheSave* save = nullptr;
+        {
+            ScopedCritSec scope(&writer->access);
+            if (writer->queue.size() == 0) {
+                CloseHandle(writer->hThread);
+                writer->hThread = nullptr;
+                WakeAllConditionVariable(&writer->written);
+                break;
+            }
+            save = writer->queue.PopAt(0);
+            writer->writingPath = save->path;
+        }
+        WriteTextCacheSave(save);
+        {
+            ScopedCritSec scope(&writer->access);
+            writer->writingPath = nullptr;
+            WakeAllConditionVariable(&writer->written);
+        }
+        FreePageTextSlots(save->pagesText, save->nPages);
+        str::Free(save->path);
+        delete save;
+    }
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    DestroyTempAllocator();
+    return 0;
+}
+
+// must be called with gTextCacheWriter.access held
+static bool IsTextCacheSavePending(const char* path) {
+    TextCacheWriter* writer = &gTextCacheWriter;
+    if (str::EqI(writer->writingPath, path)) {
+        return true;
+    }
+    for (TextCacheSave* save : writer->queue) {
+        if (str::EqI(save->path, path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// waits until path (or all files if path is nullptr) has been written or timeoutMs
+// have passed. Returns false on timeout
+static bool WaitForTextCacheWriter(const char* path, DWORD timeoutMs) {
+    TextCacheWriter* writer = &gTextCacheWriter;
+    ScopedCritSec scope(&writer->access);
+    auto timeStart = TimeGet();
+    for (;;) {
+        bool pending = path ? IsTextCacheSavePending(path) : writer->hThread != nullptr;
+        if (!pending) {
+            return true;
+        }
+        DWORD elapsedMs = (DWORD)TimeSinceInMs(timeStart);
+        if (elapsedMs >= timeoutMs) {
+            return false;
+        }
+        SleepConditionVariableCS(&writer->written, &writer->access, timeoutMs - elapsedMs);
     }
-    return pageText->text;
+}
+
+// waits until the text of all closed documents has been saved (e.g. before exiting)
+void WaitForTextCacheWrites() {
+    if (!WaitForTextCacheWriter(nullptr, kTextCacheExitWaitMs)) {
+        logf("WaitForTextCacheWrites: gave up after %d ms\n", (int)kTextCacheExitWaitMs);
+    }
+}
+
+// uses the text saved the previous time this document was opened
+// must be called before the text of any page is requested
+void DocumentTextCache::LoadFromDisk() {
+    CrashIf(diskCachePath);
+    diskCachePath = GetTextCachePath(engine);
+    if (!diskCachePath) {
+        return;
+    }
+    // the document might've been closed a moment ago. If its text is
+    // still being saved, it's extracted again instead of waiting longer
+    if (!WaitForTextCacheWriter(diskCachePath, kTextCacheLoadWaitMs)) {
+        return;
+    }
+    diskCache = OpenTextCacheFile(diskCachePath, nPages);
+    if (!diskCache) {
+        return;
+    }
+    for (int i = 0; i < nPages; i++) {
+        PageTextSlot* slot = pagesText[i];
+        CrashIf(slot->extracted);
+        PageText pageText;
+        if (diskCache->GetPageText(i + 1, &pageText)) {
+            slot->text = pageText.text;
+            slot->len = pageText.len;
+            slot->coords.rects = pageText.coords;
+            slot->fromDisk = true;
+            slot->extracted = 1;
+            nPagesExtracted++;
+            nCharsExtracted += slot->len;
+        }
+    }
+}
+
+// if there's new text since LoadFromDisk(), hands the text of all pages over to
+// TextCacheWriterThread which saves and frees it. No text is available afterwards
+void DocumentTextCache::SaveToDisk() {
+    if (!diskCachePath || nPagesNotOnDisk == 0) {
+        return;
+    }
+    // the text might include unsaved annotations which
+    // wouldn't be there the next time the file is opened
+    if (EngineHasUnsavedAnnotations(engine)) {
+        return;
+    }
+    auto save = new TextCacheSave();
+    {
+        ScopedCritSec scope(&access);
+        save->path = diskCachePath;
+        save->pagesText = pagesText;
+        save->nPages = nPages;
+        save->diskCache = diskCache;
+        diskCachePath = nullptr;
+        pagesText = nullptr;
+        nPages = 0;
+        diskCache = nullptr;
+    }
+
+    TextCacheWriter* writer = &gTextCacheWriter;
+    ScopedCritSec scope(&writer->access);
+    writer->queue.Append(save);
+    if (!writer->hThread) {
+        writer->hThread = CreateThread(nullptr, 0, TextCacheWriterThread, nullptr, 0, nullptr);
+    }
+}
+
+static DWORD WINAPI TextPrefetchThread(LPVOID data) {
+    DocumentTextCache* cache = (DocumentTextCache*)data;
+    cache->PrefetchPages();
+    return 0;
+}
+
+// extracts text of pages not yet extracted, starting at
+// prefetchStartPage and wrapping around at the end
+void DocumentTextCache::PrefetchPages() {
+    for (;;) {
+        while (InterlockedCompareExchange(&nPagesRendering, 0, 0) > 0) {
+            if (InterlockedCompareExchange(&abortPrefetch, 0, 0)) {
+                return;
+            }
+            Sleep(kPrefetchRenderPauseMs);
+        }
+        if (InterlockedCompareExchange(&abortPrefetch, 0, 0)) {
+            return;
+        }
+        int n;
+        {
+            ScopedCritSec scope(&access);
+            n = nPages;
+        }
+        int idx = (int)InterlockedIncrement(&nPrefetchPagesTaken) - 1;
+        if (idx >= n) {
+            return;
+        }
+        int pageNo = (prefetchStartPage - 1 + idx) % n + 1;
+        PageTextSlot* slot = GetSlot(pageNo);
+        if (!InterlockedCompareExchange(&slot->extracted, 0, 0)) {
+            ExtractText(slot, pageNo);
+        }
+    }
+}
+
+// starts extracting text of all pages on low priority
+// background threads. Does nothing if already started
+void DocumentTextCache::StartPrefetch(int startPageNo) {
+    if (nPrefetchThreads > 0) {
+        return;
+    }
+    CrashIf(startPageNo < 1 || startPageNo > nPages);
+    prefetchStartPage = startPageNo;
+    // leave a core for the UI and rendering
+    int nThreads = std::clamp(GetPhysicalProcessorCount() - 1, 1, kMaxTextPrefetchThreads);
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, TextPrefetchThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        SetThreadPriority(h, THREAD_PRIORITY_LOWEST);
+        prefetchThreads[nPrefetchThreads++] = h;
+    }
+}
+
+// waits for the page currently being extracted by each
+// prefetch thread to finish
+void DocumentTextCache::StopPrefetch() {
+    if (nPrefetchThreads == 0) {
+        return;
+    }
+    InterlockedExchange(&abortPrefetch, 1);
+    WaitForMultipleObjects(nPrefetchThreads, prefetchThreads, TRUE, INFINITE);
+    for (int i = 0; i < nPrefetchThreads; i++) {
+        CloseHandle(prefetchThreads[i]);
+        prefetchThreads[i] = nullptr;
+    }
+    nPrefetchThreads = 0;
+}
+
+// e.g. "120 of 300 pages, 1.21 MB (8.4 bytes per char)"
+char* DocumentTextCache::FormatMemoryUse() {
+    ScopedCritSec scope(&access);
+    TempStr size = FormatFileSizeTemp(memSize);
+    double perChar = nCharsExtracted > 0 ? (double)memSize / (double)nCharsExtracted : 0;
+    return str::Format("%d of %d pages, %s (%.1f bytes per char)", nPagesExtracted, nPages, size, perChar);
+}
+
+// rendering is more urgent than prefetching text
+void DocumentTextCache::BeginRendering() {
+    InterlockedIncrement(&nPagesRendering);
+}
+
+void DocumentTextCache::EndRendering() {
+    InterlockedDecrement(&nPagesRendering);
 }
 
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
@@ -85,6 +645,106 @@ void TextSelection::Reset() {
     result.pages = nullptr;
     free(result.rects);
     result.rects = nullptr;
+    resultFromPage = -1;
+    changedPages.Reset();
+    changedRects.Reset();
+}
+
+static int GridCol(const GlyphGrid* grid, int x) {
+    return std::clamp((x - grid->x) / grid->cellDx, 0, grid->nCols - 1);
+}
+
+static int GridRow(const GlyphGrid* grid, int y) {
+    return std::clamp((y - grid->y) / grid->cellDy, 0, grid->nRows - 1);
+}
+
+struct ClosestGlyph {
+    int glyph = -1;
+    uint dist = UINT_MAX;
+
+    // ties go to the glyph that comes first in the text
+    void Update(int i, uint d) {
+        if (d < dist || (d == dist && i < glyph)) {
+            glyph = i;
+            dist = d;
+        }
+    }
+};
+
+// same result as looking at every glyph in FindClosestGlyph() but only looks at
+// the glyphs in cells around x/y
+static int FindClosestGlyphInGrid(const GlyphGrid* grid, const PageCoords& coords, double x, double y) {
+    Point pti = ToPoint(PointF(x, y));
+    int px = (int)x, py = (int)y;
+
+    // the glyphs the cursor is over have their center at
+    // most the size of the largest glyph away
+    ClosestGlyph over;
+    int col0 = GridCol(grid, pti.x - grid->maxGlyphDx), col1 = GridCol(grid, pti.x + grid->maxGlyphDx);
+    int row0 = GridRow(grid, pti.y - grid->maxGlyphDy), row1 = GridRow(grid, pti.y + grid->maxGlyphDy);
+    for (int row = row0; row <= row1; row++) {
+        for (int col = col0; col <= col1; col++) {
+            int cell = row * grid->nCols + col;
+            for (int j = grid->cellStart[cell]; j < grid->cellStart[cell + 1]; j++) {
+                int i = grid->glyphs[j];
+                Rect r = coords[i];
+                if (r.Contains(pti)) {
+                    Point c = GlyphCenter(r);
+                    over.Update(i, distSq(px - c.x, py - c.y));
+                }
+            }
+        }
+    }
+    if (over.glyph >= 0) {
+        return over.glyph;
+    }
+
+    // look at rings of cells around the cursor until the glyphs
+    // in cells further away can't be closer
+    ClosestGlyph closest;
+    int col = GridCol(grid, px), row = GridRow(grid, py);
+    for (int ring = 0;; ring++) {
+        for (int r = row - ring; r <= row + ring; r++) {
+            if (r < 0 || r >= grid->nRows) {
+                continue;
+            }
+            int step = (r == row - ring || r == row + ring) ? 1 : 2 * ring;
+            for (int c = col - ring; c <= col + ring; c += step) {
+                if (c < 0 || c >= grid->nCols) {
+                    continue;
+                }
+                int cell = r * grid->nCols + c;
+                for (int j = grid->cellStart[cell]; j < grid->cellStart[cell + 1]; j++) {
+                    int i = grid->glyphs[j];
+                    Point center = GlyphCenter(coords[i]);
+                    closest.Update(i, distSq(px - center.x, py - center.y));
+                }
+            }
+        }
+
+        // distance from the cursor to the cells not yet looked at
+        int bound = INT_MAX;
+        if (col - ring > 0) {
+            bound = std::min(bound, px - (grid->x + (col - ring) * grid->cellDx) + 1);
+        }
+        if (col + ring < grid->nCols - 1) {
+            bound = std::min(bound, grid->x + (col + ring + 1) * grid->cellDx - px);
+        }
+        if (row - ring > 0) {
+            bound = std::min(bound, py - (grid->y + (row - ring) * grid->cellDy) + 1);
+        }
+        if (row + ring < grid->nRows - 1) {
+            bound = std::min(bound, grid->y + (row + ring + 1) * grid->cellDy - py);
+        }
+        if (bound == INT_MAX) {
+            // all cells have been looked at
+            break;
+        }
+        if (closest.glyph >= 0 && bound > 0 && (u64)bound * bound > closest.dist) {
+            break;
+        }
+    }
+    return closest.glyph;
 }
 
 // returns the index of the glyph closest to the right of the given coordinates
@@ -92,7 +752,7 @@ void TextSelection::Reset() {
 // glyph following it, which will be the first glyph (not) to be selected)
 static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
+    PageCoords coords;
     ts->textCache->GetTextForPage(pageNo, &textLen, &coords);
     PointF pt = PointF(x, y);
 
@@ -101,25 +761,30 @@ static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
     bool overGlyph = false;
     int result = -1;
 
-    for (int i = 0; i < textLen; i++) {
-        Rect& coord = coords[i];
-        if (!coord.x && !coord.dx) {
-            continue;
-        }
-        if (overGlyph && !coord.Contains(pti)) {
-            continue;
-        }
+    const GlyphGrid* grid = ts->textCache->GetGlyphGrid(pageNo);
+    if (grid) {
+        result = FindClosestGlyphInGrid(grid, coords, x, y);
+    } else {
+        for (int i = 0; i < textLen; i++) {
+            Rect coord = coords[i];
+            if (!HasGlyphBox(coord)) {
+                continue;
+            }
+            if (overGlyph && !coord.Contains(pti)) {
+                continue;
+            }
 
-        uint dist = distSq((int)x - coord.x - coord.dx / 2, (int)y - coord.y - coord.dy / 2);
-        if (dist < maxDist) {
-            result = i;
-            maxDist = dist;
-        }
-        // prefer glyphs the cursor is actually over
-        if (!overGlyph && coord.Contains(pti)) {
-            overGlyph = true;
-            result = i;
-            maxDist = dist;
+            uint dist = distSq((int)x - coord.x - coord.dx / 2, (int)y - coord.y - coord.dy / 2);
+            if (dist < maxDist) {
+                result = i;
+                maxDist = dist;
+            }
+            // prefer glyphs the cursor is actually over
+            if (!overGlyph && coord.Contains(pti)) {
+                overGlyph = true;
+                result = i;
+                maxDist = dist;
+            }
         }
     }
 
@@ -143,22 +808,75 @@ static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
     return result;
 }
 
-static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, StrVec* lines = nullptr) {
+// collects the lines of a selection, separated by lineSep. Without dst
+// it only counts the chars, so that the text can be written into a
+// buffer of the exact size in a second pass
+struct SelectionTextWriter {
+    const WCHAR* lineSep = nullptr;
+    int lineSepLen = 0;
+    WCHAR* dst = nullptr;
+    i64 dstLen = 0;
+    i64 len = 0;
+
+    void Append(const WCHAR* s, int n) {
+        if (dst && len + n <= dstLen) {
+            memcpy(dst + len, s, n * sizeof(WCHAR));
+        }
+        len += n;
+    }
+    void AppendLine(const WCHAR* s, int n) {
+        if (len > 0) {
+            Append(lineSep, lineSepLen);
+        }
+        Append(s, n);
+    }
+};
+
+static void AppendResultRect(TextSelection* ts, int pageNo, Rect bbox) {
+    int currLen = ts->result.len;
+    int left = ts->result.cap - currLen;
+    CrashIf(left < 0);
+    if (left == 0) {
+        int newCap = ts->result.cap * 2;
+        if (newCap < 64) {
+            newCap = 64;
+        }
+        int* newPages = (int*)realloc(ts->result.pages, sizeof(int) * newCap);
+        Rect* newRects = (Rect*)realloc(ts->result.rects, sizeof(Rect) * newCap);
+        CrashIf(!newPages);
+        CrashIf(!newRects);
+        ts->result.pages = newPages;
+        ts->result.rects = newRects;
+        ts->result.cap = newCap;
+    }
+
+    ts->result.pages[currLen] = pageNo;
+    ts->result.rects[currLen] = bbox;
+    ts->result.len++;
+}
+
+static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length,
+                            SelectionTextWriter* writer = nullptr) {
     int len;
-    Rect* coords;
+    PageCoords coords;
     const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &coords);
     CrashIf(len < glyph + length);
     Rect mediabox = ts->engine->PageMediabox(pageNo).Round();
-    Rect *c = &coords[glyph], *end = c + length;
-    while (c < end) {
+    int i = glyph, end = glyph + length;
+    while (i < end) {
         // skip line breaks
-        for (; c < end && !c->x && !c->dx; c++) {
+        for (; i < end && !coords[i].x && !coords[i].dx; i++) {
             // no-op
         }
 
-        Rect bbox, *c0 = c;
-        for (; c < end && (c->x || c->dx); c++) {
-            bbox = bbox.Union(*c);
+        Rect bbox;
+        int i0 = i;
+        for (; i < end; i++) {
+            Rect c = coords[i];
+            if (!c.x && !c.dx) {
+                break;
+            }
+            bbox = bbox.Union(c);
         }
         bbox = bbox.Intersect(mediabox);
         // skip text that's completely outside a page's mediabox
@@ -166,43 +884,57 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
             continue;
         }
 
-        if (lines) {
-            char* s = ToUtf8Temp(text + (c0 - coords), c - c0);
-            lines->Append(s);
+        if (writer) {
+            writer->AppendLine(text + i0, i - i0);
             continue;
         }
 
         // cut the right edge, if it overlaps the next character
-        if (c < coords + len && (c->x || c->dx) && bbox.x < c->x && bbox.x + bbox.dx > c->x) {
-            bbox.dx = c->x - bbox.x;
+        Rect next = i < len ? coords[i] : Rect();
+        if ((next.x || next.dx) && bbox.x < next.x && bbox.x + bbox.dx > next.x) {
+            bbox.dx = next.x - bbox.x;
         }
 
-        int currLen = ts->result.len;
-        int left = ts->result.cap - currLen;
-        CrashIf(left < 0);
-        if (left == 0) {
-            int newCap = ts->result.cap * 2;
-            if (newCap < 64) {
-                newCap = 64;
-            }
-            int* newPages = (int*)realloc(ts->result.pages, sizeof(int) * newCap);
-            Rect* newRects = (Rect*)realloc(ts->result.rects, sizeof(Rect) * newCap);
-            CrashIf(!newPages);
-            CrashIf(!newRects);
-            ts->result.pages = newPages;
-            ts->result.rects = newRects;
-            ts->result.cap = newCap;
-        }
+        AppendResultRect(ts, pageNo, bbox);
+    }
+}
+
+// the rects of a page before and after a selection change usually only differ
+// at one end (where the selection was extended or shrunk)
+static void AddChangedRects(TextSelection* ts, int pageNo, Rect* prev, int nPrev, Rect* curr, int nCurr) {
+    int nSame = 0;
+    while (nSame < nPrev && nSame < nCurr && prev[nSame] == curr[nSame]) {
+        nSame++;
+    }
+    int nSameEnd = 0;
+    while (nSameEnd < nPrev - nSame && nSameEnd < nCurr - nSame &&
+           prev[nPrev - 1 - nSameEnd] == curr[nCurr - 1 - nSameEnd]) {
+        nSameEnd++;
+    }
+    for (int i = nSame; i < nPrev - nSameEnd; i++) {
+        ts->changedPages.Append(pageNo);
+        ts->changedRects.Append(prev[i]);
+    }
+    for (int i = nSame; i < nCurr - nSameEnd; i++) {
+        ts->changedPages.Append(pageNo);
+        ts->changedRects.Append(curr[i]);
+    }
+}
 
-        ts->result.pages[currLen] = pageNo;
-        ts->result.rects[currLen] = bbox;
-        ts->result.len++;
+// number of glyphs of a page that are selected between fromPage/fromGlyph and toPage/toGlyph
+static int SelectedGlyphsOnPage(int pageNo, int textLen, int fromPage, int fromGlyph, int toPage, int toGlyph,
+                                int* glyphOut) {
+    *glyphOut = 0;
+    if (fromPage == -1 || pageNo < fromPage || pageNo > toPage) {
+        return 0;
     }
+    *glyphOut = pageNo == fromPage ? fromGlyph : 0;
+    return (pageNo == toPage ? toGlyph : textLen) - *glyphOut;
 }
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
+    PageCoords coords;
     textCache->GetTextForPage(pageNo, &textLen, &coords);
 
     int glyphIx = FindClosestGlyph(this, pageNo, x, y);
@@ -249,24 +981,57 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
         endGlyph = textLen + glyphIx + 1;
     }
 
-    result.len = 0;
-    int fromPage = std::min(startPage, endPage), toPage = std::max(startPage, endPage);
-    int fromGlyph = (fromPage == endPage ? endGlyph : startGlyph);
-    int toGlyph = (fromPage == endPage ? startGlyph : endGlyph);
-    if (fromPage == toPage && fromGlyph > toGlyph) {
-        std::swap(fromGlyph, toGlyph);
+    int fromPage, fromGlyph, toPage, toGlyph;
+    GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
+    changedPages.Reset();
+    changedRects.Reset();
+    if (fromPage == resultFromPage && fromGlyph == resultFromGlyph && toPage == resultToPage &&
+        toGlyph == resultToGlyph) {
+        return;
     }
 
-    for (int page = fromPage; page <= toPage; page++) {
+    // while the selection is dragged, the selected glyphs of most pages don't
+    // change and their rects are taken over from the previous result
+    TextSel prev = result;
+    result = TextSel{};
+    int firstPage = resultFromPage == -1 ? fromPage : std::min(fromPage, resultFromPage);
+    int lastPage = resultFromPage == -1 ? toPage : std::max(toPage, resultToPage);
+    int prevIdx = 0;
+    for (int page = firstPage; page <= lastPage; page++) {
+        while (prevIdx < prev.len && prev.pages[prevIdx] < page) {
+            prevIdx++;
+        }
+        int prevStart = prevIdx;
+        while (prevIdx < prev.len && prev.pages[prevIdx] == page) {
+            prevIdx++;
+        }
+
         int textLen;
         textCache->GetTextForPage(page, &textLen);
-
-        int glyph = page == fromPage ? fromGlyph : 0;
-        int length = (page == toPage ? toGlyph : textLen) - glyph;
+        int glyph, prevGlyph;
+        int length = SelectedGlyphsOnPage(page, textLen, fromPage, fromGlyph, toPage, toGlyph, &glyph);
+        int prevLength = SelectedGlyphsOnPage(page, textLen, resultFromPage, resultFromGlyph, resultToPage,
+                                              resultToGlyph, &prevGlyph);
+        if (length > 0 && glyph == prevGlyph && length == prevLength) {
+            for (int i = prevStart; i < prevIdx; i++) {
+                AppendResultRect(this, page, prev.rects[i]);
+            }
+            continue;
+        }
+        int start = result.len;
         if (length > 0) {
             FillResultRects(this, page, glyph, length);
         }
+        AddChangedRects(this, page, prev.rects + prevStart, prevIdx - prevStart, result.rects + start,
+                        result.len - start);
     }
+    free(prev.pages);
+    free(prev.rects);
+
+    resultFromPage = fromPage;
+    resultFromGlyph = fromGlyph;
+    resultToPage = toPage;
+    resultToGlyph = toGlyph;
 }
 
 void TextSelection::SelectWordAt(int pageNo, double x, double y) {
@@ -296,25 +1061,43 @@ void TextSelection::CopySelection(TextSelection* orig) {
 }
 
 WCHAR* TextSelection::ExtractText(const char* lineSep) {
-    StrVec lines;
+    i64 len = ExtractText(lineSep, nullptr, 0);
+    WCHAR* res = AllocArray<WCHAR>((size_t)len + 1);
+    if (res) {
+        ExtractText(lineSep, res, len);
+    }
+    return res;
+}
+
+// writes up to dstLen chars of the selected text into dst (which isn't zero-terminated)
+// and returns the length of the whole text. With dst == nullptr, it only returns the length.
+// Returns -1 if canceled through progress (which is updated for every page)
+i64 TextSelection::ExtractText(const char* lineSep, WCHAR* dst, i64 dstLen, ProgressUpdateUI* progress) {
+    SelectionTextWriter writer;
+    writer.lineSep = ToWstrTemp(lineSep);
+    writer.lineSepLen = (int)str::Len(writer.lineSep);
+    writer.dst = dst;
+    writer.dstLen = dstLen;
 
     int fromPage, fromGlyph, toPage, toGlyph;
     GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
 
     for (int page = fromPage; page <= toPage; page++) {
+        if (progress) {
+            if (progress->WasCanceled()) {
+                return -1;
+            }
+            progress->UpdateProgress(page - fromPage + 1, toPage - fromPage + 1);
+        }
         int textLen;
         textCache->GetTextForPage(page, &textLen);
         int glyph = page == fromPage ? fromGlyph : 0;
         int length = (page == toPage ? toGlyph : textLen) - glyph;
         if (length > 0) {
-            FillResultRects(this, page, glyph, length, &lines);
+            FillResultRects(this, page, glyph, length, &writer);
         }
     }
-
-    char* res = Join(lines, lineSep);
-    WCHAR* ws = ToWstr(res);
-    str::Free(res);
-    return ws;
+    return writer.len;
 }
 
 void TextSelection::GetGlyphRange(int* fromPage, int* fromGlyph, int* toPage, int* toGlyph) const {
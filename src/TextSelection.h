@@ -1,21 +1,150 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+// a line of glyphs sharing y and dy
+struct GlyphLine {
+    int x = 0;
+    int y = 0;
+    int dy = 0;
+};
+
+// line is kNoGlyphLine for glyphs without a bounding box (e.g. line breaks)
+struct PackedGlyph {
+    u16 line;
+    // relative to the x of the line
+    i16 x;
+    u16 dx;
+};
+
+constexpr u16 kNoGlyphLine = 0xffff;
+
+// bounding boxes of the glyphs of a page. Instead of a Rect (16 bytes)
+// per glyph, glyphs of a line share y and dy and only store x and dx (6 bytes)
+struct PageCoords {
+    // one Rect per glyph if the page couldn't be packed
+    // or if the text is from the cache file
+    Rect* rects = nullptr;
+    PackedGlyph* glyphs = nullptr;
+    GlyphLine* lines = nullptr;
+    int nLines = 0;
+
+    Rect operator[](int i) const {
+        if (rects) {
+            return rects[i];
+        }
+        PackedGlyph g = glyphs[i];
+        if (g.line == kNoGlyphLine) {
+            return {};
+        }
+        const GlyphLine& l = lines[g.line];
+        return Rect(l.x + g.x, l.y, g.dx, l.dy);
+    }
+};
+
+// glyphs of a page bucketed by the grid cell their center is in, so that
+// hit-testing on dense pages doesn't have to look at every glyph
+struct GlyphGrid {
+    // top-left of the first cell
+    int x = 0;
+    int y = 0;
+    int cellDx = 0;
+    int cellDy = 0;
+    int nCols = 0;
+    int nRows = 0;
+    // size of the largest glyph
+    int maxGlyphDx = 0;
+    int maxGlyphDy = 0;
+    // glyphs in cell i are glyphs[cellStart[i]] to glyphs[cellStart[i + 1] - 1]
+    int* cellStart = nullptr;
+    int* glyphs = nullptr;
+
+    ~GlyphGrid();
+};
+
+// text of a single page. Once extracted is set, text and coords don't change
+// and can be read without taking any lock
+struct PageTextSlot {
+    WCHAR* text = nullptr;
+    int len = 0;
+    PageCoords coords;
+    LONG extracted = 0;
+    // built on the first hit-test (nullptr for pages with few glyphs)
+    GlyphGrid* grid = nullptr;
+    bool gridBuilt = false;
+    // text and coords.rects point into diskCache
+    bool fromDisk = false;
+    // held while extracting the text of this page
+    CRITICAL_SECTION access;
+};
+
+// max number of threads extracting text in the background
+constexpr int kMaxTextPrefetchThreads = 4;
+
+struct TextCacheFile;
+struct ProgressUpdateUI;
+
 struct DocumentTextCache {
     EngineBase* engine = nullptr;
     int nPages = 0;
-    PageText* pagesText = nullptr;
-    int debugSize = 0;
+    // slots don't move when the document grows, so they
+    // can be accessed without holding access
+    PageTextSlot** pagesText = nullptr;
+    // replaced arrays, kept around for readers that might still access them
+    Vec<PageTextSlot**> oldPagesText;
 
+    // heap memory used for the text of the document (not counting
+    // text from diskCache, which is memory-mapped)
+    i64 memSize = 0;
+    int nPagesExtracted = 0;
+    i64 nCharsExtracted = 0;
+
+    // guards nPages, pagesText and memory accounting changes
     CRITICAL_SECTION access;
 
+    // background extraction of the text of all pages
+    HANDLE prefetchThreads[kMaxTextPrefetchThreads] = {};
+    int nPrefetchThreads = 0;
+    // number of pages that have been handed out to prefetch threads
+    LONG nPrefetchPagesTaken = 0;
+    int prefetchStartPage = 1;
+    LONG abortPrefetch = 0;
+    // prefetching pauses while pages are being rendered
+    LONG nPagesRendering = 0;
+
+    // text from the previous time the document was opened
+    char* diskCachePath = nullptr;
+    TextCacheFile* diskCache = nullptr;
+    // number of pages extracted that aren't in diskCache
+    int nPagesNotOnDisk = 0;
+
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
-    bool HasTextForPage(int pageNo) const;
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    bool HasTextForPage(int pageNo);
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, PageCoords* coordsOut = nullptr);
+    const GlyphGrid* GetGlyphGrid(int pageNo);
+    void SetPageCount(int newPageCount);
+    void TakeUnchangedPages(DocumentTextCache* prev, const Vec<bool>& unchangedPages);
+
+    void LoadFromDisk();
+    void SaveToDisk();
+
+    void StartPrefetch(int startPageNo);
+    void StopPrefetch();
+    void PrefetchPages();
+    void BeginRendering();
+    void EndRendering();
+
+    char* FormatMemoryUse();
+
+  private:
+    PageTextSlot* GetSlot(int pageNo);
+    void ExtractText(PageTextSlot* slot, int pageNo);
 };
 
+// DocumentTextCache::SaveToDisk() saves on a background thread
+void WaitForTextCacheWrites();
+
 // TODO: replace with Vec<TextSel>
 struct TextSel {
     int len = 0;
@@ -44,9 +173,20 @@ struct TextSelection {
     void SelectWordAt(int pageNo, double x, double y);
     void CopySelection(TextSelection* orig);
     WCHAR* ExtractText(const char* lineSep);
+    i64 ExtractText(const char* lineSep, WCHAR* dst, i64 dstLen, ProgressUpdateUI* progress = nullptr);
     void Reset();
 
     TextSel result{};
+    // rects (in page coordinates) that were added to or removed from result by the
+    // last SelectUpTo(), so that only they have to be repainted
+    Vec<int> changedPages;
+    Vec<Rect> changedRects;
+
+    // the glyph range result has been computed for (-1 if none)
+    int resultFromPage = -1;
+    int resultFromGlyph = -1;
+    int resultToPage = -1;
+    int resultToGlyph = -1;
 
     void GetGlyphRange(int* fromPage, int* fromGlyph, int* toPage, int* toGlyph) const;
 };
@@ -0,0 +1,469 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ImageResample.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+
+#include "ThumbnailStore.h"
+
+/* The store is a header, an index of kThumbnailSlots entries and as many slots
+   of kThumbnailStoreDx x kThumbnailStoreDy top-down BGRA pixels. Version 1 only
+   had the top of the first page, at the size of the start page's thumbnails */
+constexpr const char* kThumbnailStoreName = "thumbnails.bin";
+constexpr u32 kThumbnailStoreMagic = 0x53544853; // 'STHS'
+constexpr u32 kThumbnailStoreVersion = 2;
+constexpr int kThumbnailSlots = 64;
+// serializes access to the store between (and within) SumatraPDF and previewer processes
+constexpr const WCHAR* kThumbnailStoreMutexName = L"SumatraPDF-ThumbnailStore";
+constexpr DWORD kThumbnailStoreLockTimeoutMs = 2 * 1000;
+constexpr size_t kContentDigestChunkSize = 64 * 1024;
+
+struct ThumbnailStoreHeader {
+    u32 magic;
+    u32 version;
+    u32 nSlots;
+    u32 slotDx;
+    u32 slotDy;
+    // incremented whenever a thumbnail is used, to find the least recently used slot
+    u32 useCounter;
+};
+
+struct ThumbnailStoreEntry {
+    // both are all 0 for unused slots
+    u8 pathDigest[16];
+    u8 contentDigest[16];
+    u32 dx;
+    u32 dy;
+    // when the thumbnail was created, to detect outdated thumbnails
+    FILETIME created;
+    u32 lastUsed;
+    u32 reserved;
+};
+
+constexpr size_t kThumbnailSlotSize = (size_t)kThumbnailStoreDx * kThumbnailStoreDy * 4;
+constexpr size_t kThumbnailStorePixelsOffset =
+    sizeof(ThumbnailStoreHeader) + kThumbnailSlots * sizeof(ThumbnailStoreEntry);
+constexpr size_t kThumbnailStoreSize = kThumbnailStorePixelsOffset + kThumbnailSlots * kThumbnailSlotSize;
+
+struct ThumbnailStore {
+    AutoFreeStr dir;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMap = nullptr;
+    u8* data = nullptr;
+    // don't try again if the store couldn't be opened
+    bool failed = false;
+};
+
+// only accessed with gThumbnailStoreMutex held
+static ThumbnailStore gThumbnailStore;
+static HANDLE gThumbnailStoreMutex = nullptr;
+
+struct ScopedThumbnailStoreLock {
+    bool locked = false;
+
+    ScopedThumbnailStoreLock() {
+        if (!gThumbnailStoreMutex) {
+            return;
+        }
+        DWORD res = WaitForSingleObject(gThumbnailStoreMutex, kThumbnailStoreLockTimeoutMs);
+        // a process that crashed while holding the mutex can at worst
+        // leave a slot that is never found (see SaveThumbnailToStore)
+        locked = (res == WAIT_OBJECT_0) || (res == WAIT_ABANDONED);
+    }
+    ~ScopedThumbnailStoreLock() {
+        if (locked) {
+            ReleaseMutex(gThumbnailStoreMutex);
+        }
+    }
+};
+
+static bool IsZeroDigest(const u8 digest[16]) {
+    for (int i = 0; i < 16; i++) {
+        if (digest[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// create a fingerprint of a (normalized) path
+// I'd have liked to also include the file's last modification time
+// in the fingerprint (much quicker than hashing the entire file's
+// content), but that's too expensive for files on slow drives
+bool CalcThumbnailPathDigest(const char* filePath, u8 digest[16]) {
+    // TODO: why is this happening? Seen in crash reports e.g. 35043
+    if (!filePath) {
+        return false;
+    }
+    char* path = str::DupTemp(filePath);
+    if (path::HasVariableDriveLetter(path)) {
+        // ignore the drive letter, if it might change
+        path[0] = '?';
+    }
+    CalcMD5Digest((u8*)path, str::Len(path), digest);
+    return true;
+}
+
+bool CalcThumbnailContentDigest(IStream* stream, u8 digest[16]) {
+    STATSTG stat{};
+    if (!stream || FAILED(stream->Stat(&stat, STATFLAG_NONAME))) {
+        return false;
+    }
+    u64 size = stat.cbSize.QuadPart;
+    size_t headSize = (size_t)std::min(size, (u64)kContentDigestChunkSize);
+    size_t tailSize = (size_t)std::min(size - headSize, (u64)kContentDigestChunkSize);
+
+    u8* buf = AllocArray<u8>(kContentDigestChunkSize);
+    AutoFree bufFree(buf);
+    DigestCalc calc(DigestKind::MD5);
+    calc.Update(&size, sizeof(size));
+    bool ok = ReadDataFromStream(stream, buf, headSize, 0);
+    if (ok) {
+        calc.Update(buf, headSize);
+    }
+    if (ok && tailSize > 0) {
+        ok = ReadDataFromStream(stream, buf, tailSize, (size_t)(size - tailSize));
+        calc.Update(buf, tailSize);
+    }
+    // callers expect to read the stream from the start
+    LARGE_INTEGER zero{};
+    stream->Seek(zero, STREAM_SEEK_SET, nullptr);
+    if (!ok) {
+        return false;
+    }
+    calc.Final(digest);
+    return true;
+}
+
+bool CalcThumbnailContentDigest(const char* filePath, u8 digest[16]) {
+    if (!filePath) {
+        return false;
+    }
+    ScopedComPtr<IStream> stream;
+    DWORD mode = STGM_READ | STGM_SHARE_DENY_NONE;
+    HRESULT hr = SHCreateStreamOnFileEx(ToWstrTemp(filePath), mode, FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, &stream);
+    if (FAILED(hr)) {
+        return false;
+    }
+    return CalcThumbnailContentDigest(stream, digest);
+}
+
+// must be called with gThumbnailStoreMutex held
+static void CloseThumbnailStoreLocked() {
+    ThumbnailStore& store = gThumbnailStore;
+    if (store.data) {
+        UnmapViewOfFile(store.data);
+    }
+    SafeCloseHandle(&store.hMap);
+    if (store.hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(store.hFile);
+    }
+    store.hFile = INVALID_HANDLE_VALUE;
+    store.data = nullptr;
+    store.failed = false;
+}
+
+void SetThumbnailStoreDir(const char* dir) {
+    if (!gThumbnailStoreMutex) {
+        HANDLE h = CreateMutexW(nullptr, FALSE, kThumbnailStoreMutexName);
+        // the previewer can get here from several threads at once
+        if (h && InterlockedCompareExchangePointer((PVOID*)&gThumbnailStoreMutex, h, nullptr) != nullptr) {
+            CloseHandle(h);
+        }
+    }
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || str::Eq(gThumbnailStore.dir, dir)) {
+        return;
+    }
+    CloseThumbnailStoreLocked();
+    gThumbnailStore.dir.SetCopy(dir);
+}
+
+void CloseThumbnailStore() {
+    ScopedThumbnailStoreLock lock;
+    if (lock.locked) {
+        CloseThumbnailStoreLocked();
+    }
+}
+
+// must be called with gThumbnailStoreMutex held
+static bool OpenThumbnailStore() {
+    ThumbnailStore& store = gThumbnailStore;
+    if (store.data) {
+        return true;
+    }
+    if (store.failed || !store.dir) {
+        return false;
+    }
+    store.failed = true;
+
+    if (!dir::Create(store.dir)) {
+        return false;
+    }
+    char* path = path::JoinTemp(store.dir, kThumbnailStoreName);
+    WCHAR* pathW = ToWstrTemp(path);
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE hFile =
+        CreateFileW(pathW, GENERIC_READ | GENERIC_WRITE, share, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size{};
+    GetFileSizeEx(hFile, &size);
+    bool sizeOk = size.QuadPart == (LONGLONG)kThumbnailStoreSize;
+    // extends the file to the full size, if necessary
+    HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READWRITE, 0, (DWORD)kThumbnailStoreSize, nullptr);
+    u8* data = hMap ? (u8*)MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, kThumbnailStoreSize) : nullptr;
+    if (!data) {
+        SafeCloseHandle(&hMap);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    auto hdr = (ThumbnailStoreHeader*)data;
+    bool isValid = sizeOk && hdr->magic == kThumbnailStoreMagic && hdr->version == kThumbnailStoreVersion &&
+                   hdr->nSlots == kThumbnailSlots && hdr->slotDx == kThumbnailStoreDx &&
+                   hdr->slotDy == kThumbnailStoreDy;
+    if (!isValid) {
+        // new or from a different version
+        ZeroMemory(data, kThumbnailStorePixelsOffset);
+        hdr->magic = kThumbnailStoreMagic;
+        hdr->version = kThumbnailStoreVersion;
+        hdr->nSlots = kThumbnailSlots;
+        hdr->slotDx = kThumbnailStoreDx;
+        hdr->slotDy = kThumbnailStoreDy;
+    }
+
+    store.hFile = hFile;
+    store.hMap = hMap;
+    store.data = data;
+    store.failed = false;
+    return true;
+}
+
+static ThumbnailStoreEntry* GetThumbnailStoreEntries() {
+    return (ThumbnailStoreEntry*)(gThumbnailStore.data + sizeof(ThumbnailStoreHeader));
+}
+
+static u8* GetThumbnailStorePixels(int slot) {
+    return gThumbnailStore.data + kThumbnailStorePixelsOffset + slot * kThumbnailSlotSize;
+}
+
+// prefers the thumbnail saved for the path over one for the same content
+static int FindThumbnailStoreSlot(const ThumbnailKey& key) {
+    ThumbnailStoreEntry* entries = GetThumbnailStoreEntries();
+    if (!IsZeroDigest(key.pathDigest)) {
+        for (int i = 0; i < kThumbnailSlots; i++) {
+            if (entries[i].dx != 0 && memeq(entries[i].pathDigest, key.pathDigest, sizeof(key.pathDigest))) {
+                return i;
+            }
+        }
+    }
+    if (!IsZeroDigest(key.contentDigest)) {
+        for (int i = 0; i < kThumbnailSlots; i++) {
+            if (entries[i].dx != 0 && memeq(entries[i].contentDigest, key.contentDigest, sizeof(key.contentDigest))) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static void MarkThumbnailStoreSlotUsed(int slot) {
+    auto hdr = (ThumbnailStoreHeader*)gThumbnailStore.data;
+    hdr->useCounter++;
+    GetThumbnailStoreEntries()[slot].lastUsed = hdr->useCounter;
+}
+
+static void InitTopDownBitmapInfo(BITMAPINFO& bmi, Size size) {
+    bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    bmi.bmiHeader.biSizeImage = size.dx * 4 * size.dy;
+}
+
+// src must be opaque (ResampleBitmap() blends transparent pixels with white)
+static RenderedBitmap* ScaleThumbnailPixels(const ImagePixels& src, Size size, bool cropTop) {
+    if (src.dx <= 0 || src.dy <= 0 || size.IsEmpty()) {
+        return nullptr;
+    }
+    float zoom = size.dx / (float)src.dx;
+    if (!cropTop) {
+        zoom = std::min(zoom, size.dy / (float)src.dy);
+    }
+    int dx = std::clamp((int)(src.dx * zoom + 0.5f), 1, size.dx);
+    int dy = std::clamp((int)(src.dy * zoom + 0.5f), 1, size.dy);
+
+    BITMAPINFO bmi;
+    InitTopDownBitmapInfo(bmi, Size(dx, dy));
+    void* bits = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!hbmp || !bits) {
+        DeleteObject(hbmp);
+        return nullptr;
+    }
+    ImagePixels dst{(u8*)bits, dx, dy, dx * 4};
+    RectF srcRect(0, 0, dx / zoom, dy / zoom);
+    if (!ResampleBitmap(src, srcRect, dst, ResampleFilter::Bicubic)) {
+        DeleteObject(hbmp);
+        return nullptr;
+    }
+    return new RenderedBitmap(hbmp, Size(dx, dy));
+}
+
+// copies the pixels of bmp as opaque top-down BGRA
+static bool GetThumbnailPixels(RenderedBitmap* bmp, u8* dst) {
+    Size size = bmp->Size();
+    BITMAPINFO bmi;
+    InitTopDownBitmapInfo(bmi, size);
+    HDC hdc = GetDC(nullptr);
+    int nLines = GetDIBits(hdc, bmp->GetBitmap(), 0, size.dy, dst, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hdc);
+    if (nLines != size.dy) {
+        return false;
+    }
+    // the alpha channel of bitmaps rendered with GDI is 0
+    int nPixels = size.dx * size.dy;
+    for (int i = 0; i < nPixels; i++) {
+        dst[4 * i + 3] = 0xff;
+    }
+    return true;
+}
+
+RenderedBitmap* ScaleThumbnail(RenderedBitmap* bmp, Size size, bool cropTop) {
+    Size bmpSize = bmp ? bmp->Size() : Size();
+    if (bmpSize.IsEmpty()) {
+        return nullptr;
+    }
+    AutoFree pixels((u8*)malloc((size_t)bmpSize.dx * bmpSize.dy * 4));
+    if (!pixels || !GetThumbnailPixels(bmp, (u8*)pixels.Get())) {
+        return nullptr;
+    }
+    ImagePixels src{(u8*)pixels.Get(), bmpSize.dx, bmpSize.dy, bmpSize.dx * 4};
+    return ScaleThumbnailPixels(src, size, cropTop);
+}
+
+RenderedBitmap* LoadThumbnailFromStore(const ThumbnailKey& key, Size size, bool cropTop, FILETIME* created) {
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || !OpenThumbnailStore()) {
+        return nullptr;
+    }
+    int slot = FindThumbnailStoreSlot(key);
+    if (slot < 0) {
+        return nullptr;
+    }
+    ThumbnailStoreEntry& entry = GetThumbnailStoreEntries()[slot];
+    int dx = (int)entry.dx;
+    int dy = (int)entry.dy;
+    if (dx > kThumbnailStoreDx || dy > kThumbnailStoreDy) {
+        return nullptr;
+    }
+    ImagePixels src{GetThumbnailStorePixels(slot), dx, dy, dx * 4};
+    RenderedBitmap* bmp = ScaleThumbnailPixels(src, size, cropTop);
+    if (!bmp) {
+        return nullptr;
+    }
+    // a thumbnail saved by the previewer can be found by path from now on
+    if (IsZeroDigest(entry.pathDigest)) {
+        memcpy(entry.pathDigest, key.pathDigest, sizeof(entry.pathDigest));
+    }
+    MarkThumbnailStoreSlotUsed(slot);
+    if (created) {
+        *created = entry.created;
+    }
+    return bmp;
+}
+
+bool SaveThumbnailToStore(const ThumbnailKey& key, RenderedBitmap* bmp, FILETIME created) {
+    Size size = bmp->Size();
+    if (size.IsEmpty() || size.dx > kThumbnailStoreDx || size.dy > kThumbnailStoreDy) {
+        return false;
+    }
+    if (IsZeroDigest(key.pathDigest) && IsZeroDigest(key.contentDigest)) {
+        return false;
+    }
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || !OpenThumbnailStore()) {
+        return false;
+    }
+    ThumbnailStoreEntry* entries = GetThumbnailStoreEntries();
+    int slot = FindThumbnailStoreSlot(key);
+    if (slot < 0) {
+        // unused slots have lastUsed == 0
+        slot = 0;
+        for (int i = 1; i < kThumbnailSlots; i++) {
+            if (entries[i].lastUsed < entries[slot].lastUsed) {
+                slot = i;
+            }
+        }
+    }
+    ThumbnailStoreEntry& entry = entries[slot];
+    // the slot is only found once it has been completely written
+    ZeroMemory(&entry, sizeof(entry));
+    if (!GetThumbnailPixels(bmp, GetThumbnailStorePixels(slot))) {
+        return false;
+    }
+    memcpy(entry.pathDigest, key.pathDigest, sizeof(entry.pathDigest));
+    memcpy(entry.contentDigest, key.contentDigest, sizeof(entry.contentDigest));
+    entry.dy = (u32)size.dy;
+    entry.created = created;
+    entry.dx = (u32)size.dx;
+    MarkThumbnailStoreSlotUsed(slot);
+    return true;
+}
+
+void RemoveThumbnailFromStore(const ThumbnailKey& key) {
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || !OpenThumbnailStore()) {
+        return;
+    }
+    int slot = FindThumbnailStoreSlot(key);
+    if (slot >= 0) {
+        ZeroMemory(&GetThumbnailStoreEntries()[slot], sizeof(ThumbnailStoreEntry));
+    }
+}
+
+bool GetThumbnailStoreTime(const ThumbnailKey& key, FILETIME* created) {
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || !OpenThumbnailStore()) {
+        return false;
+    }
+    int slot = FindThumbnailStoreSlot(key);
+    if (slot < 0) {
+        return false;
+    }
+    *created = GetThumbnailStoreEntries()[slot].created;
+    return true;
+}
+
+void CleanUpThumbnailStore(const Vec<ThumbnailKey>& keep) {
+    ScopedThumbnailStoreLock lock;
+    if (!lock.locked || !OpenThumbnailStore()) {
+        return;
+    }
+    ThumbnailStoreEntry* entries = GetThumbnailStoreEntries();
+    for (int i = 0; i < kThumbnailSlots; i++) {
+        ThumbnailStoreEntry& entry = entries[i];
+        if (entry.dx == 0 || IsZeroDigest(entry.pathDigest)) {
+            continue;
+        }
+        bool isKept = false;
+        for (const ThumbnailKey& key : keep) {
+            if (memeq(entry.pathDigest, key.pathDigest, sizeof(key.pathDigest))) {
+                isKept = true;
+                break;
+            }
+        }
+        if (!isKept) {
+            ZeroMemory(&entry, sizeof(entry));
+        }
+    }
+}
@@ -0,0 +1,43 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// thumbnails of the first page of documents, kept in a single memory-mapped
+// file that is shared by SumatraPDF (for the start page) and the previewer dll
+// (for Explorer thumbnails), so that either can use what the other has rendered
+
+constexpr const char* kThumbnailsDirName = "sumatrapdfcache";
+
+// the whole first page is scaled to this width (and cut off at this height)
+constexpr int kThumbnailStoreDx = 256;
+constexpr int kThumbnailStoreDy = 384;
+
+// a document is found by the digest of its (normalized) path or by the digest
+// of its content. The previewer only gets a stream, so it only knows the latter.
+// A digest that's all 0 is unknown
+struct ThumbnailKey {
+    u8 pathDigest[16]{};
+    u8 contentDigest[16]{};
+};
+
+bool CalcThumbnailPathDigest(const char* filePath, u8 digest[16]);
+// hashes the size and the first and last 64 kB of the file
+bool CalcThumbnailContentDigest(const char* filePath, u8 digest[16]);
+bool CalcThumbnailContentDigest(IStream* stream, u8 digest[16]);
+
+// must be called before any other function
+void SetThumbnailStoreDir(const char* dir);
+void CloseThumbnailStore();
+
+// scales the stored thumbnail to fit into size or, if cropTop is set,
+// to the width of size cutting off the page at the height of size.
+// If created is given, it's set to when the thumbnail was created
+RenderedBitmap* LoadThumbnailFromStore(const ThumbnailKey& key, Size size, bool cropTop, FILETIME* created = nullptr);
+// replaces the least recently used thumbnail if there's no free slot
+bool SaveThumbnailToStore(const ThumbnailKey& key, RenderedBitmap* bmp, FILETIME created);
+void RemoveThumbnailFromStore(const ThumbnailKey& key);
+bool GetThumbnailStoreTime(const ThumbnailKey& key, FILETIME* created);
+// removes thumbnails saved for a path that isn't in keep (thumbnails only
+// saved by the previewer don't have a path and are only replaced when the store is full)
+void CleanUpThumbnailStore(const Vec<ThumbnailKey>& keep);
+
+RenderedBitmap* ScaleThumbnail(RenderedBitmap* bmp, Size size, bool cropTop);
@@ -0,0 +1,404 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/CryptoUtil.h"
+#include "utils/DirIter.h"
+#include "utils/FileUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/UIModels.h"
+
+#include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
+#include "GlobalPrefs.h"
+
+#include "AppTools.h"
+#include "TileCache.h"
+
+#include <zlib.h>
+
+#include "utils/Log.h"
+
+// a sub-directory of the text cache directory, see FileTextCache.cpp
+constexpr const char* kTileCacheDirName = "sumatrapdfcache\\tiles";
+constexpr const char* kTileCacheExt = ".tile";
+
+// bump when the file layout or the way pages are rendered changes
+constexpr u32 kTileCacheVersion = 1;
+constexpr u32 kTileCacheMagic = 0x4C495453; // 'STIL'
+
+// tiles are dropped rather than saved if the writer falls that far behind
+constexpr size_t kMaxQueuedTileCacheWrites = 64 * 1024 * 1024;
+
+/*
+File layout (all values little-endian):
+
+TileCacheHeader
+zlib compressed, top-down BGRA pixels of dx * dy
+*/
+
+struct TileCacheHeader {
+    u32 magic;
+    u32 version;
+    i32 dx;
+    i32 dy;
+    u32 compressedSize;
+    u32 reserved;
+};
+
+struct TileCacheWrite {
+    TileCacheKey key;
+    Size size;
+    RenderedBitmap* bmp = nullptr;
+    // set by DeleteTileSavedToCache() if the tile is deleted before it's been saved
+    bool ownsBitmap = false;
+};
+
+// tiles are read, compressed and written on a thread that
+// exists as long as there are tiles to write
+struct TileCacheWriter {
+    CRITICAL_SECTION access;
+    Vec<TileCacheWrite*> queue;
+    // the tile whose pixels are currently read
+    TileCacheWrite* writing = nullptr;
+    size_t queuedSize = 0;
+    HANDLE hThread = nullptr;
+    // the cache is cleaned up after a part of it has been written
+    i64 writtenSize = 0;
+
+    TileCacheWriter() {
+        InitializeCriticalSection(&access);
+    }
+    ~TileCacheWriter() {
+        DeleteCriticalSection(&access);
+    }
+};
+
+static TileCacheWriter gTileCacheWriter;
+
+static i64 GetMaxTileCacheSize() {
+    int sizeMB = gGlobalPrefs ? gGlobalPrefs->tileCacheSize : 0;
+    return sizeMB > 0 ? (i64)sizeMB * 1024 * 1024 : 0;
+}
+
+bool GetTileCacheDigest(EngineBase* engine, u8 digest[16]) {
+    memset(digest, 0, 16);
+    if (GetMaxTileCacheSize() == 0 || !gGlobalPrefs->rememberOpenedFiles) {
+        return false;
+    }
+    const char* filePath = engine->FilePath();
+    if (!filePath || !file::Exists(filePath)) {
+        return false;
+    }
+    // don't leak the content of encrypted documents
+    if (engine->IsPasswordProtected()) {
+        return false;
+    }
+    // pages of reflowable documents depend on window size and font settings
+    // and images render (about) as fast as they're read from the cache
+    Kind kind = engine->kind;
+    if (kind == kindEngineEpub || kind == kindEngineFb2 || kind == kindEngineMobi || kind == kindEnginePdb ||
+        kind == kindEngineChm || kind == kindEngineHtml || kind == kindEngineTxt || engine->IsImageCollection()) {
+        return false;
+    }
+    return CalcFileFingerprint(filePath, digest);
+}
+
+static bool IsEmptyDigest(const u8 digest[16]) {
+    for (int i = 0; i < 16; i++) {
+        if (digest[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns nullptr if tiles of the document aren't saved
+static char* GetTileCachePath(const TileCacheKey& key) {
+    if (IsEmptyDigest(key.docDigest) || GetMaxTileCacheSize() == 0) {
+        return nullptr;
+    }
+    char* cacheDir = AppGenDataFilenameTemp(kTileCacheDirName);
+    if (!cacheDir) {
+        return nullptr;
+    }
+    AutoFreeStr fingerPrint = str::MemToHex(key.docDigest, dimof(key.docDigest));
+    u32 zoomBits = 0;
+    memcpy(&zoomBits, &key.zoom, sizeof(zoomBits));
+    AutoFreeStr fileName =
+        str::Format("%s-%d-%d-%08x-%d-%d-%d-%06x-%06x%s", fingerPrint.Get(), key.pageNo, key.rotation, zoomBits,
+                    (int)key.res, (int)key.row, (int)key.col, key.textColor, key.backgroundColor, kTileCacheExt);
+    return path::Join(cacheDir, fileName);
+}
+
+RenderedBitmap* LoadTileFromCache(const TileCacheKey& key) {
+    AutoFreeStr cachePath = GetTileCachePath(key);
+    if (!cachePath) {
+        return nullptr;
+    }
+    ByteSlice d = file::ReadFile(cachePath);
+    if (d.empty()) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = nullptr;
+    const TileCacheHeader* hdr = (const TileCacheHeader*)d.data();
+    bool ok = d.size() >= sizeof(TileCacheHeader) && hdr->magic == kTileCacheMagic &&
+              hdr->version == kTileCacheVersion && hdr->dx > 0 && hdr->dy > 0 &&
+              d.size() == sizeof(TileCacheHeader) + (size_t)hdr->compressedSize;
+    HANDLE hMap = nullptr;
+    Size size = ok ? Size(hdr->dx, hdr->dy) : Size();
+    HBITMAP hbmp = ok ? CreateMemoryBitmap(size, &hMap) : nullptr;
+    DIBSECTION ds{};
+    if (hbmp && GetObject(hbmp, sizeof(ds), &ds) == sizeof(ds)) {
+        uLongf pixelsSize = (uLongf)size.dx * (uLongf)size.dy * 4;
+        uLongf n = pixelsSize;
+        const Bytef* src = (const Bytef*)d.data() + sizeof(TileCacheHeader);
+        if (uncompress((Bytef*)ds.dsBm.bmBits, &n, src, hdr->compressedSize) == Z_OK && n == pixelsSize) {
+            bmp = new RenderedBitmap(hbmp, size, hMap);
+        }
+    }
+    d.Free();
+    if (!bmp) {
+        logf("LoadTileFromCache: '%s' is damaged\n", cachePath.Get());
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        SafeCloseHandle(&hMap);
+        file::Delete(cachePath);
+        return nullptr;
+    }
+    // mark as recently used for CleanUpTileCache()
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(cachePath, now);
+    return bmp;
+}
+
+// top-down BGRA pixels of hbmp, whatever its format
+static u8* GetTilePixels(HBITMAP hbmp, Size size) {
+    size_t pixelsSize = (size_t)size.dx * (size_t)size.dy * 4;
+    // most tiles are DIB sections in that format (see CreateMemoryBitmap()), read
+    // directly since GetDIBits() fails while the bitmap is selected for painting
+    DIBSECTION ds{};
+    if (GetObject(hbmp, sizeof(ds), &ds) == sizeof(ds) && ds.dsBm.bmBits && ds.dsBmih.biBitCount == 32 &&
+        ds.dsBmih.biWidth == size.dx && ds.dsBmih.biHeight == -size.dy) {
+        u8* pixels = AllocArray<u8>(pixelsSize);
+        if (pixels) {
+            memcpy(pixels, ds.dsBm.bmBits, pixelsSize);
+        }
+        return pixels;
+    }
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    u8* pixels = AllocArray<u8>(pixelsSize);
+    if (!pixels) {
+        return nullptr;
+    }
+    HDC hdc = GetDC(nullptr);
+    int nLines = GetDIBits(hdc, hbmp, 0, size.dy, pixels, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hdc);
+    if (nLines != size.dy) {
+        free(pixels);
+        return nullptr;
+    }
+    return pixels;
+}
+
+static void WriteTileCacheFile(TileCacheWrite* w) {
+    AutoFreeStr path = GetTileCachePath(w->key);
+    // it might have been saved when the document was opened before
+    if (!path || file::Exists(path)) {
+        return;
+    }
+    u8* pixels = GetTilePixels(w->bmp->GetBitmap(), w->size);
+    if (!pixels) {
+        return;
+    }
+    uLongf pixelsSize = (uLongf)w->size.dx * (uLongf)w->size.dy * 4;
+    uLongf compressedSize = compressBound(pixelsSize);
+    u8* d = AllocArray<u8>(sizeof(TileCacheHeader) + compressedSize);
+    if (!d) {
+        free(pixels);
+        return;
+    }
+    Bytef* dst = (Bytef*)d + sizeof(TileCacheHeader);
+    if (compress2(dst, &compressedSize, (const Bytef*)pixels, pixelsSize, Z_BEST_SPEED) == Z_OK) {
+        TileCacheHeader* hdr = (TileCacheHeader*)d;
+        hdr->magic = kTileCacheMagic;
+        hdr->version = kTileCacheVersion;
+        hdr->dx = w->size.dx;
+        hdr->dy = w->size.dy;
+        hdr->compressedSize = (u32)compressedSize;
+        size_t size = sizeof(TileCacheHeader) + compressedSize;
+        if (dir::CreateForFile(path) && file::WriteFile(path, {d, size})) {
+            gTileCacheWriter.writtenSize += (i64)size;
+        } else {
+            file::Delete(path);
+        }
+    }
+    free(pixels);
+    free(d);
+}
+
+static DWORD WINAPI TileCacheWriterThread(void*) {
+    SetThreadName("TileCacheWriterThread");
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    TileCacheWriter* writer = &gTileCacheWriter;
+    for (;;) {
+        TileCacheWrite* w = nullptr;
+        {
+            ScopedCritSec scope(&writer->access);
+            if (writer->queue.size() == 0) {
+                CloseHandle(writer->hThread);
+                writer->hThread = nullptr;
+                break;
+            }
+            w = writer->queue.PopAt(0);
+            writer->writing = w;
+        }
+        WriteTileCacheFile(w);
+        bool deleteBitmap;
+        {
+            ScopedCritSec scope(&writer->access);
+            writer->writing = nullptr;
+            writer->queuedSize -= (size_t)w->size.dx * (size_t)w->size.dy * 4;
+            deleteBitmap = w->ownsBitmap;
+        }
+        if (deleteBitmap) {
+            delete w->bmp;
+        }
+        delete w;
+
+        i64 maxSize = GetMaxTileCacheSize();
+        if (writer->writtenSize > maxSize / 8) {
+            CleanUpTileCache();
+            writer->writtenSize = 0;
+        }
+    }
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    DestroyTempAllocator();
+    return 0;
+}
+
+bool SaveTileToCache(const TileCacheKey& key, RenderedBitmap* bmp) {
+    Size size = bmp ? bmp->Size() : Size();
+    if (size.IsEmpty() || IsEmptyDigest(key.docDigest)) {
+        return false;
+    }
+    size_t pixelsSize = (size_t)size.dx * (size_t)size.dy * 4;
+    TileCacheWriter* writer = &gTileCacheWriter;
+    ScopedCritSec scope(&writer->access);
+    if (writer->queuedSize + pixelsSize > kMaxQueuedTileCacheWrites) {
+        return false;
+    }
+    auto w = new TileCacheWrite();
+    w->key = key;
+    w->size = size;
+    w->bmp = bmp;
+    writer->queue.Append(w);
+    writer->queuedSize += pixelsSize;
+    if (!writer->hThread) {
+        writer->hThread = CreateThread(nullptr, 0, TileCacheWriterThread, nullptr, 0, nullptr);
+    }
+    return true;
+}
+
+void DeleteTileSavedToCache(RenderedBitmap* bmp) {
+    TileCacheWriter* writer = &gTileCacheWriter;
+    {
+        ScopedCritSec scope(&writer->access);
+        if (writer->writing && writer->writing->bmp == bmp) {
+            writer->writing->ownsBitmap = true;
+            return;
+        }
+        for (TileCacheWrite* w : writer->queue) {
+            if (w->bmp == bmp) {
+                w->ownsBitmap = true;
+                return;
+            }
+        }
+    }
+    delete bmp;
+}
+
+static void RemoveTileCacheFiles(const char* fingerPrint) {
+    char* cacheDir = AppGenDataFilenameTemp(kTileCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    char* pattern = path::JoinTemp(cacheDir, str::JoinTemp(fingerPrint, "-*", kTileCacheExt));
+    StrVec tilePaths;
+    CollectPathsFromDirectory(pattern, tilePaths, false);
+    for (char* tilePath : tilePaths) {
+        file::Delete(tilePath);
+    }
+}
+
+void RemoveTileCache(const char* filePath, const char* fingerPrint) {
+    u8 digest[16]{};
+    AutoFreeStr currFingerPrint;
+    if (CalcFileFingerprint(filePath, digest)) {
+        currFingerPrint = str::MemToHex(digest, dimof(digest));
+        RemoveTileCacheFiles(currFingerPrint);
+    }
+    if (fingerPrint && !str::EqI(fingerPrint, currFingerPrint)) {
+        RemoveTileCacheFiles(fingerPrint);
+    }
+}
+
+struct TileCacheFileInfo {
+    char* path;
+    i64 size;
+    FILETIME lastUsed;
+};
+
+static int CmpByLastUsedDesc(const TileCacheFileInfo* a, const TileCacheFileInfo* b) {
+    return CompareFileTime(&b->lastUsed, &a->lastUsed);
+}
+
+void CleanUpTileCache() {
+    char* cacheDir = AppGenDataFilenameTemp(kTileCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    Vec<TileCacheFileInfo> files;
+    DirTraverse(cacheDir, false, [&files](WIN32_FIND_DATAW* fd, const char* path) -> bool {
+        if (str::EndsWithI(path, kTileCacheExt)) {
+            files.Append({str::Dup(path), GetFileSize(fd), fd->ftLastWriteTime});
+        }
+        return true;
+    });
+    files.SortTyped(CmpByLastUsedDesc);
+
+    i64 maxSize = GetMaxTileCacheSize();
+    i64 total = 0;
+    for (TileCacheFileInfo& fi : files) {
+        total += fi.size;
+        if (total > maxSize) {
+            file::Delete(fi.path);
+        }
+        free(fi.path);
+    }
+}
+
+void DeleteTileCacheFiles() {
+    char* cacheDir = AppGenDataFilenameTemp(kTileCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    StrVec filePaths;
+    CollectPathsFromDirectory(path::JoinTemp(cacheDir, str::JoinTemp("*", kTileCacheExt)), filePaths, false);
+    for (char* path : filePaths) {
+        file::Delete(path);
+    }
+}
@@ -0,0 +1,36 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// rendered tiles saved in the cache directory (up to GlobalPrefs::tileCacheSize),
+// so that the pages of a document that's opened again show up without waiting
+// for them to be rendered
+
+struct TileCacheKey {
+    // see GetTileCacheDigest()
+    u8 docDigest[16]{};
+    int pageNo = 0;
+    int rotation = 0;
+    float zoom = 0.f;
+    // TilePosition
+    USHORT res = 0;
+    USHORT row = 0;
+    USHORT col = 0;
+    COLORREF textColor = 0;
+    COLORREF backgroundColor = 0;
+};
+
+// returns false if the tiles of this document shouldn't be saved
+bool GetTileCacheDigest(EngineBase* engine, u8 digest[16]);
+// the caller must make sure that the document hasn't been changed in memory (e.g. annotations)
+RenderedBitmap* LoadTileFromCache(const TileCacheKey& key);
+// bmp is saved on a background thread. If this returns true, the caller
+// must delete bmp with DeleteTileSavedToCache() (and not modify it)
+bool SaveTileToCache(const TileCacheKey& key, RenderedBitmap* bmp);
+// deletes bmp once it's been saved
+void DeleteTileSavedToCache(RenderedBitmap* bmp);
+
+// fingerPrint is FileState::fingerprint, see RemoveTextCache()
+void RemoveTileCache(const char* filePath, const char* fingerPrint);
+// deletes the least recently used tiles above GlobalPrefs::tileCacheSize
+void CleanUpTileCache();
+void DeleteTileCacheFiles();
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/TimeTrace.h"
 #include "Translations.h"
 
 #include "utils/Log.h"
@@ -20,31 +21,28 @@ extern const char** GetOriginalStrings();
 
 namespace trans {
 
-// translation info about a single string
-// we set str/trans once by parsing translations.txt file
-// after the user changes the language
-struct Translation {
-    // index points inside allStrings;
-    u16 idxStr = 0;
-    // translation of str/origStr in gCurrLangCode
-    // index points inside allTranslations
-    u16 idxTrans = 0;
-    // translation in WCHAR*, points inside allTranslationsW
-    u16 idxTransW = 0;
-};
+// translations come from translations.bin (compiled from translations.txt
+// by do/trans_gen_bin.go), which is used directly from the resource section.
+// All numbers are little-endian u32 (or i32):
+//   magic, nStrings, nLangs
+//   disp[nStrings]    displacements of a minimal perfect hash of the english strings
+//   strs[nStrings]    offset of the english string in each hash slot
+//   nLangs times:
+//     langCode        offset of the language code
+//     trans[nStrings] offset of the translation in each hash slot (0 if untranslated)
+//   pool              zero-terminated utf-8 strings, offsets are relative to its start
+constexpr u32 kTranslationsMagic = 0x534e5254; // "TRNS"
 
 struct TranslationCache {
-    // english string from translations.txt file
-    // we lazily match it to origStr
-    str::Str allStrings;
-    str::Str allTranslations;
-    str::WStr allTranslationsW;
-    // TODO: maybe also cache str::WStr allTranslationsW
-    // we currently return a temp converted string but there's a chance their
-    // lifetime could survive temp allocator lifetime
-    Translation* translations = nullptr;
-    int nTranslations = 0;
-    int nUntranslated = 0;
+    int nStrings = 0;
+    const i32* disp = nullptr;
+    const u32* strs = nullptr;
+    // nullptr for languages without translations (e.g. English)
+    const u32* trans = nullptr;
+    const char* pool = nullptr;
+    // WCHAR* versions of translations, converted when first asked for
+    // (possibly on several threads at once, see GetTranslation())
+    WCHAR** transW = nullptr;
 };
 
 // used locally, gCurrLangCode points into gLangCodes
@@ -52,133 +50,85 @@ static const char* gCurrLangCode = nullptr;
 static int gCurrLangIdx = 0;
 static TranslationCache* gTranslationCache = nullptr;
 
-static void UnescapeStringIntoStr(char* s, str::Str& str) {
-    for (; *s; s++) {
-        if (*s == '\\') {
-            char c = s[1];
-            switch (c) {
-                case 't':
-                    str.AppendChar('\t');
-                    break;
-                case 'n':
-                    str.AppendChar('\n');
-                    break;
-                case 'r':
-                    str.AppendChar('\r');
-                    break;
-                default:
-                    str.AppendChar(c);
-                    break;
-            }
-            s++;
-        } else {
-            str.AppendChar(*s);
-        }
-    }
-    str.AppendChar(0);
-}
-
 static void FreeTranslations() {
     if (!gTranslationCache) {
         return;
     }
-    delete gTranslationCache;
+    auto c = gTranslationCache;
+    for (int i = 0; i < c->nStrings; i++) {
+        free(c->transW[i]);
+    }
+    free(c->transW);
+    delete c;
     gTranslationCache = nullptr;
 }
 
-static void ParseTranslationsTxt(const ByteSlice& d, const char* langCode) {
-    langCode = str::JoinTemp(langCode, ":");
-    int nLangCode = str::Len(langCode);
-
-    // parse into lines
-    char* s = (char*)d.data();
-    StrVec lines;
-    Split(lines, s, "\n", true);
-    int nStrings = 0;
-    for (char* l : lines) {
-        if (l[0] == ':') {
-            nStrings++;
-        }
+static bool InitTranslations(const ByteSlice& d, const char* langCode) {
+    const u32* data = (const u32*)d.data();
+    size_t nNums = d.size() / sizeof(u32);
+    if (nNums < 3 || data[0] != kTranslationsMagic) {
+        return false;
+    }
+    u32 nStrings = data[1];
+    u32 nLangs = data[2];
+    size_t poolStart = 3 + 2 * (size_t)nStrings + (size_t)nLangs * (1 + nStrings);
+    if (nStrings == 0 || poolStart > nNums) {
+        return false;
     }
-    int nLines = lines.Size();
-    logf("ParseTranslationsTxt: %d lines, nStrings: %d\n", nLines, nStrings);
 
     FreeTranslations();
-    gTranslationCache = new TranslationCache();
-    // make index of first string to be 1 so that 0 can be
-    // "missing" value in transIdx
-    gTranslationCache->allStrings.AppendChar(' ');
-    gTranslationCache->allTranslations.AppendChar(' ');
-    gTranslationCache->allTranslationsW.AppendChar(' ');
-    auto c = gTranslationCache;
-    c->nTranslations = nStrings;
-    c->translations = AllocArray<Translation>(c->nTranslations);
-    c->nUntranslated = 0;
-
-    char* orig;
-    char* trans;
-    char* line;
-    int i = 2; // skip first 2 header lines
-    int nTrans = 0;
-    while (i < nLines) {
-        orig = lines[i];
-        CrashIf(*orig != ':');
-        orig += 1; // skip the ':' at the beginning
-        i++;
-        trans = nullptr;
-        while (i < nLines && lines[i][0] != ':') {
-            if (!trans) {
-                line = lines[i];
-                if (str::StartsWith(line, langCode)) {
-                    trans = line + nLangCode;
-                }
-            }
-            i++;
+    auto c = new TranslationCache();
+    c->nStrings = (int)nStrings;
+    c->disp = (const i32*)(data + 3);
+    c->strs = data + 3 + nStrings;
+    c->pool = (const char*)(data + poolStart);
+    c->transW = AllocArray<WCHAR*>(nStrings);
+    const u32* lang = data + 3 + 2 * nStrings;
+    for (u32 i = 0; i < nLangs; i++) {
+        if (str::Eq(c->pool + lang[0], langCode)) {
+            c->trans = lang + 1;
+            break;
         }
-        if (!trans) {
-            c->nUntranslated++;
-        }
-        Translation& translation = c->translations[nTrans++];
-        size_t idxStr = c->allStrings.size();
-        // when this fires, we'll have to bump strIdx form u16 to u32
-        CrashIf(idxStr > 64 * 1024);
-        translation.idxStr = (u16)idxStr;
-        UnescapeStringIntoStr(orig, c->allStrings);
-        char* toConvert = c->allStrings.LendData() + idxStr; // after insertion because could re-allocate
-        if (trans) {
-            size_t idxTrans = c->allTranslations.size();
-            CrashIf(idxTrans > 64 * 1024);
-            translation.idxTrans = (u16)idxTrans;
-            UnescapeStringIntoStr(trans, c->allTranslations);
-            toConvert = c->allTranslations.LendData() + idxTrans; // after insertion because could re-allocate
-        }
-        // if we don't have a translation, we cache WCHAR* version from original string
-        auto ws = ToWstrTemp(toConvert);
-        size_t idxTransW = c->allTranslationsW.size();
-        CrashIf(idxTransW > 64 * 1024);
-        translation.idxTransW = (u16)idxTransW;
-        size_t wsLen = str::Len(ws);
-        c->allTranslationsW.Append(ws, wsLen + 1);
+        lang += 1 + nStrings;
     }
-    CrashIf(nTrans != c->nTranslations);
-    if (c->nUntranslated > 0 && !str::Eq(langCode, "en:")) {
-        logf("Untranslated strings: %d for lang '%s'\n", c->nUntranslated, langCode);
+    if (!c->trans && !str::Eq(langCode, "en")) {
+        logf("InitTranslations: no translations for lang '%s'\n", langCode);
+    }
+    gTranslationCache = c;
+    return true;
+}
+
+// must match transHash() in do/trans_gen_bin.go
+static u32 TransHash(u32 d, const char* s) {
+    if (d == 0) {
+        d = 0x01000193;
+    }
+    for (; *s; s++) {
+        d = (d * 0x01000193) ^ (u8)*s;
     }
+    return d;
 }
 
-static Translation* FindTranslation(const char* s) {
+// returns the hash slot of s or -1 if s isn't in translations.txt
+static int FindTranslation(const char* s) {
     CrashIf(!s);
     CrashIf(!gTranslationCache);
     auto c = gTranslationCache;
-    for (int i = 0; i < c->nTranslations; i++) {
-        Translation& trans = c->translations[i];
-        size_t idx = trans.idxStr;
-        const char* s2 = c->allStrings.LendData() + idx;
-        if (str::Eq(s, s2)) {
-            return &trans;
-        }
+    u32 n = (u32)c->nStrings;
+    i32 d = c->disp[TransHash(0, s) % n];
+    u32 slot = d < 0 ? (u32)(-d - 1) : TransHash((u32)d, s) % n;
+    if (slot >= n || !str::Eq(s, c->pool + c->strs[slot])) {
+        return -1;
     }
-    return nullptr;
+    return (int)slot;
+}
+
+static const char* GetTranslationForSlot(int slot) {
+    auto c = gTranslationCache;
+    if (c->trans && c->trans[slot] != 0) {
+        return c->pool + c->trans[slot];
+    }
+    return c->pool + c->strs[slot];
 }
 
 // don't free
@@ -186,21 +136,20 @@ const char* GetTranslationA(const char* s) {
     if (gCurrLangIdx == 0) {
         return s;
     }
-    Translation* trans = FindTranslation(s);
+    int slot = FindTranslation(s);
     // we don't have a translation for this string
-    if (!trans || trans->idxTrans == 0) {
+    if (slot < 0 || !gTranslationCache->trans || gTranslationCache->trans[slot] == 0) {
         logf("Didn't find translation for '%s'\n", s);
         return s;
     }
-    auto idx = trans->idxTrans;
-    return gTranslationCache->allTranslations.LendData() + idx;
+    return GetTranslationForSlot(slot);
 }
 
 // don't free
 const WCHAR* GetTranslation(const char* s) {
-    Translation* trans = FindTranslation(s);
+    int slot = FindTranslation(s);
     // we don't have a translation for this string
-    if (!trans || trans->idxTransW == 0) {
+    if (slot < 0) {
         logf("GetTranslation: didn't find translation for '%s'\n", s);
         // shouldn't happen
         // ReportIf(true);
@@ -208,8 +157,19 @@ const WCHAR* GetTranslation(const char* s) {
         // are not freed and survive long enough they can't be temp strings
         return ToWstr(s);
     }
-    auto idx = trans->idxTransW;
-    return gTranslationCache->allTranslationsW.LendData() + idx;
+    WCHAR** wsPtr = &gTranslationCache->transW[slot];
+    WCHAR* ws = (WCHAR*)InterlockedCompareExchangePointer((void**)wsPtr, nullptr, nullptr);
+    if (ws) {
+        return ws;
+    }
+    // if another thread has converted it in the meantime, its copy is used
+    ws = ToWstr(GetTranslationForSlot(slot));
+    WCHAR* prev = (WCHAR*)InterlockedCompareExchangePointer((void**)wsPtr, ws, nullptr);
+    if (prev) {
+        free(ws);
+        return prev;
+    }
+    return ws;
 }
 
 int GetLangsCount() {
@@ -235,10 +195,10 @@ void SetCurrentLangByCode(const char* langCode) {
     gCurrLangIdx = idx;
     gCurrLangCode = GetLangCodeByIdx(idx);
 
-    ByteSlice d = LoadDataResource(2);
-    CrashIf(d.empty());
-    ParseTranslationsTxt(d, langCode);
-    free(d.data());
+    TIME_TRACE("SetCurrentLangByCode");
+    ByteSlice d = LockDataResource(2);
+    bool ok = InitTranslations(d, gCurrLangCode);
+    CrashIf(!ok);
 }
 
 const char* ValidateLangCode(const char* langCode) {
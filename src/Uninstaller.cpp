@@ -359,6 +359,7 @@ static void RelaunchElevatedFromTempDirectory(Flags* cli) {
     }
     logf("  re-launching '%s' with args '%s' as elevated\n", installerTempPath, cmdLine.Get());
     LaunchElevated(installerTempPath, cmdLine.Get());
+    FlushLogging();
     ::ExitProcess(0);
 }
 
@@ -2,11 +2,13 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/CryptoUtil.h"
 #include "utils/ThreadUtil.h"
 #include "utils/UITask.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/HttpUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 
 #include "wingui/Layout.h"
@@ -56,6 +58,16 @@ constexpr const char* kUpdateInfoURL = "https://www.sumatrapdfreader.org/update-
 // (this might e.g. happen if a user checks manually very quickly after startup)
 bool gUpdateCheckInProgress = false;
 
+// automatic checks happen at startup, so they wait a bit and then download
+// at a limited rate so that they don't compete with loading documents
+constexpr DWORD kAutoUpdateCheckDelayMs = 10 * 1000;
+constexpr int kAutoUpdateMaxBytesPerSec = 512 * 1024;
+
+// remembers the random name of the installer being downloaded, so that
+// an interrupted download is resumed the next time
+constexpr const char* kInstallerDownloadFileName = "update-download.txt";
+constexpr const char* kInstallerNamePrefix = "sumatra-installer-";
+
 struct UpdateInfo {
     HWND hwndParent = nullptr;
     const char* latestVer = nullptr;
@@ -65,6 +77,9 @@ struct UpdateInfo {
     const char* portable32 = nullptr;
 
     const char* dlURL = nullptr;
+    // size and SHA-256 of the file at dlURL, if the update info has them
+    i64 dlSize = -1;
+    const char* dlSha256 = nullptr;
     const char* installerPath = nullptr;
 
     UpdateInfo() = default;
@@ -75,6 +90,7 @@ struct UpdateInfo {
         str::Free(portable64);
         str::Free(portable32);
         str::Free(dlURL);
+        str::Free(dlSha256);
         str::Free(installerPath);
     }
 };
@@ -91,6 +107,10 @@ PortableExe64: https://www.sumatrapdfreader.org/dl/prerel/14276/SumatraPDF-prere
 PortableExe32: https://www.sumatrapdfreader.org/dl/prerel/14276/SumatraPDF-prerel.exe
 PortableZip64: https://www.sumatrapdfreader.org/dl/prerel/14276/SumatraPDF-prerel-64.zip
 PortableZip32: https://www.sumatrapdfreader.org/dl/prerel/14276/SumatraPDF-prerel.zip
+
+Each of the executables can optionally have its size and SHA-256 (hex), e.g.:
+Installer64Size: 12345678
+Installer64Sha256: 0123...
 */
 static UpdateInfo* ParseUpdateInfo(const char* d) {
     // if a user configures os-wide proxy that is not a regular ie proxy
@@ -124,21 +144,32 @@ static UpdateInfo* ParseUpdateInfo(const char* d) {
 
     // figure out which executable to download
     const char* dlURL = nullptr;
+    const char* dlKey = nullptr;
     bool isDll = IsDllBuild();
     if (IsProcess64()) {
         if (isDll) {
             dlURL = res->installer64;
+            dlKey = "Installer64";
         } else {
             dlURL = res->portable64;
+            dlKey = "PortableExe64";
         }
     } else {
         if (isDll) {
             dlURL = res->installer32;
+            dlKey = "Installer32";
         } else {
             dlURL = res->portable32;
+            dlKey = "PortableExe32";
         }
     }
     res->dlURL = str::Dup(dlURL);
+    const char* size = node->GetValue(str::JoinTemp(dlKey, "Size"));
+    const char* sha256 = node->GetValue(str::JoinTemp(dlKey, "Sha256"));
+    if (size && str::Len(sha256) == 64) {
+        res->dlSize = _atoi64(size);
+        res->dlSha256 = str::Dup(sha256);
+    }
     return res;
 }
 
@@ -197,6 +228,82 @@ static bool ShouldCheckForUpdate(UpdateCheck updateCheckType) {
     return checkUpdate;
 }
 
+// returns false if the downloaded file isn't the one described by the update info
+// (or if it doesn't describe it, in which case a download can't be reused)
+static bool VerifyInstaller(UpdateInfo* updateInfo, const char* path) {
+    if (!updateInfo->dlSha256) {
+        return false;
+    }
+    if (file::GetSize(path) != updateInfo->dlSize) {
+        logf("VerifyInstaller: '%s' doesn't have the expected size\n", path);
+        return false;
+    }
+    u8 digest[32]{};
+    if (!CalcFileDigest(path, DigestKind::SHA2, digest)) {
+        return false;
+    }
+    AutoFreeStr hex = str::MemToHex(digest, dimof(digest));
+    if (!str::EqI(hex, updateInfo->dlSha256)) {
+        logf("VerifyInstaller: '%s' doesn't have the expected SHA-256\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void DeleteInstallerDownload(const char* path) {
+    file::Delete(path);
+    file::Delete(str::JoinTemp(path, ".part"));
+    file::Delete(str::JoinTemp(path, ".part.etag"));
+}
+
+// reads the SHA-256 and the path of the last installer download; the path
+// is only accepted if it's one of our downloads in the user's temp directory
+static bool ReadInstallerDownloadInfo(const char* infoPath, StrVec& lines) {
+    ByteSlice info = file::ReadFile(infoPath);
+    defer {
+        info.Free();
+    };
+    if (!info) {
+        return false;
+    }
+    Split(lines, (const char*)info.data(), "\n", true);
+    if (lines.Size() != 2) {
+        return false;
+    }
+    char* path = lines[1];
+    return str::StartsWithI(path::GetBaseNameTemp(path), kInstallerNamePrefix) &&
+           path::IsSame(path::GetDirTemp(path), GetTempDirTemp());
+}
+
+// the installer must be named .exe or it won't be able to self-elevate with "runas".
+// It has a random name in the user's temp directory, the same one for the
+// same build (so that an interrupted download is resumed) if it can be verified
+static char* GetInstallerDownloadPathTemp(UpdateInfo* updateInfo) {
+    char* infoPath = AppGenDataFilenameTemp(kInstallerDownloadFileName);
+    StrVec lines;
+    bool hasPrev = infoPath && ReadInstallerDownloadInfo(infoPath, lines);
+    if (hasPrev && updateInfo->dlSha256 && str::EqI(lines[0], updateInfo->dlSha256)) {
+        return str::DupTemp(lines[1]);
+    }
+    if (hasPrev) {
+        // the previous download is for a different build and can't be resumed
+        DeleteInstallerDownload(lines[1]);
+    }
+
+    GUID guid{};
+    if (FAILED(CoCreateGuid(&guid))) {
+        return nullptr;
+    }
+    AutoFreeStr rnd = str::MemToHex((const u8*)&guid, sizeof(guid));
+    char* path = path::JoinTemp(GetTempDirTemp(), str::JoinTemp(kInstallerNamePrefix, rnd, ".exe"));
+    if (infoPath && updateInfo->dlSha256) {
+        file::WriteFile(infoPath, str::JoinTemp(updateInfo->dlSha256, "\n", path));
+    } else if (infoPath) {
+        file::Delete(infoPath);
+    }
+    return path;
+}
+
 static void NotifyUserOfUpdate(UpdateInfo* updateInfo) {
     const WCHAR* mainInstr = _TR("New version available");
     WCHAR* verTmp = ToWstrTemp(updateInfo->latestVer);
@@ -260,6 +367,19 @@ static void NotifyUserOfUpdate(UpdateInfo* updateInfo) {
         return;
     }
 
+    // keep the installer from being modified between verifying and running it
+    AutoCloseHandle hFile = file::OpenReadOnly(installerPath);
+    bool isVerified = hFile.IsValid();
+    if (isVerified && updateInfo->dlSha256) {
+        isVerified = VerifyInstaller(updateInfo, installerPath);
+    }
+    if (!isVerified) {
+        logf("NotifyUserOfUpdate: '%s' failed verification\n", installerPath);
+        DeleteInstallerDownload(installerPath);
+        SumatraLaunchBrowser(WEBSITE_DOWNLOAD_PAGE_URL);
+        return;
+    }
+
     // TODO: we don't really handle a case when it's a dll build but not installed
     // maybe in that case go to website
     str::Str cmd;
@@ -355,17 +475,37 @@ static DWORD ShowAutoUpdateDialog(HWND hwndParent, HttpRsp* rsp, UpdateCheck upd
     // download the installer to make update feel instant to the user
     logf("ShowAutoUpdateDialog: starting to download '%s'\n", updateInfo->dlURL);
     gUpdateCheckInProgress = true;
-    RunAsync([hwndForNotif, updateInfo] { // NOLINT
-        char* installerPath = path::GetTempFilePath("sumatra-installer");
-        // the installer must be named .exe or it won't be able to self-elevate
-        // with "runas"
-        installerPath = str::JoinTemp(installerPath, ".exe");
-        bool ok = HttpGetToFile(updateInfo->dlURL, installerPath);
-        logf("ShowAutoUpdateDialog: HttpGetToFile(): ok=%d, downloaded to '%s'\n", (int)ok, installerPath);
+    bool isAuto = updateCheckType == UpdateCheck::Automatic;
+    RunAsync([hwndForNotif, updateInfo, isAuto] { // NOLINT
+        char* installerPath = GetInstallerDownloadPathTemp(updateInfo);
+        bool ok = installerPath && VerifyInstaller(updateInfo, installerPath);
+        if (installerPath && !ok) {
+            if (!updateInfo->dlSha256) {
+                // can't tell if a partial download is from this build
+                DeleteInstallerDownload(installerPath);
+            }
+            int maxBytesPerSec = 0;
+            if (isAuto) {
+                SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+                maxBytesPerSec = kAutoUpdateMaxBytesPerSec;
+            }
+            ok = HttpGetToFile(updateInfo->dlURL, installerPath, maxBytesPerSec);
+            if (ok && updateInfo->dlSha256 && !VerifyInstaller(updateInfo, installerPath)) {
+                // the resumed part might have been bad, try once more from scratch
+                DeleteInstallerDownload(installerPath);
+                ok = HttpGetToFile(updateInfo->dlURL, installerPath, maxBytesPerSec) &&
+                     VerifyInstaller(updateInfo, installerPath);
+                if (!ok) {
+                    DeleteInstallerDownload(installerPath);
+                }
+            }
+            if (isAuto) {
+                SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+            }
+            logf("ShowAutoUpdateDialog: HttpGetToFile(): ok=%d, downloaded to '%s'\n", (int)ok, installerPath);
+        }
         if (ok) {
             updateInfo->installerPath = str::Dup(installerPath);
-        } else {
-            file::Delete(installerPath);
         }
 
         // process the rest on ui thread to avoid threading issues
@@ -427,7 +567,7 @@ void CheckForUpdateAsync(MainWindow* win, UpdateCheck updateCheckType) {
         url.Append("&force");
     }
     char* uri = url.Get();
-    HttpGetAsync(uri, [=](HttpRsp* rsp) {
+    auto onRsp = [=](HttpRsp* rsp) {
         uitask::Post([=] {
             DWORD err = ShowAutoUpdateDialog(hwnd, rsp, updateCheckType);
             if ((err != 0) && (updateCheckType == UpdateCheck::UserInitiated)) {
@@ -437,6 +577,17 @@ void CheckForUpdateAsync(MainWindow* win, UpdateCheck updateCheckType) {
                 MessageBoxWarning(hwnd, msg, _TR("SumatraPDF Update"));
             }
         });
+    };
+    if (UpdateCheck::UserInitiated == updateCheckType) {
+        HttpGetAsync(uri, onRsp);
+        return;
+    }
+    HttpRsp* rsp = new HttpRsp;
+    rsp->url.SetCopy(uri);
+    RunAsync([rsp, onRsp] { // NOLINT
+        Sleep(kAutoUpdateCheckDelayMs);
+        HttpGet(rsp->url, rsp);
+        onRsp(rsp);
     });
 }
 
@@ -22,9 +22,12 @@
 #include "Selection.h"
 #include "Translations.h"
 #include "EditAnnotations.h"
+#include "FindAll.h"
+#include "PageOverview.h"
 
 WindowTab::WindowTab(MainWindow* win) {
     this->win = win;
+    lastShownTime = GetTickCount64();
 }
 
 void WindowTab::SetFilePath(const char* path) {
@@ -43,8 +46,21 @@ WindowTab::~WindowTab() {
         AsChm()->RemoveParentHwnd();
     }
     delete selectionOnPage;
+    CloseFindAllWindow(this);
+    ClosePageOverviewWindow(this);
     delete ctrl;
     CloseAndDeleteEditAnnotationsWindow(editAnnotsWindow);
+    if (hibernatedState) {
+        DeleteDisplayState(hibernatedState);
+    }
+    DeleteSnapshot();
+}
+
+void WindowTab::DeleteSnapshot() {
+    if (snapshot) {
+        DeleteObject(snapshot);
+        snapshot = nullptr;
+    }
 }
 
 bool WindowTab::IsDocLoaded() const {
@@ -4,6 +4,8 @@
 struct SelectionOnPage;
 struct WatchedFile;
 struct EditAnnotationsWindow;
+struct FindAllWnd;
+struct PageOverviewWnd;
 struct MainWindow;
 
 /* Data related to a single document loaded into a tab/window */
@@ -24,6 +26,8 @@ struct WindowTab {
     // state of the table of contents
     bool showToc = false;
     bool showTocPresentation = false;
+    // ToC can only be shown once the document has been completely laid out
+    bool showTocAfterLayout = false;
     // an array of ids for ToC items that have been expanded/collapsed by user
     Vec<int> tocState;
     // canvas dimensions when the document was last visible
@@ -40,6 +44,21 @@ struct WindowTab {
     DisplayMode prevDisplayMode{DisplayMode::Automatic};
     TocTree* currToc = nullptr; // not owned by us
     EditAnnotationsWindow* editAnnotsWindow = nullptr;
+    FindAllWnd* findAllWnd = nullptr;
+    PageOverviewWnd* pageOverviewWnd = nullptr;
+
+    // when the tab was last selected (for unloading documents of background tabs)
+    u64 lastShownTime = 0;
+    // state of the document if it has been unloaded to free memory
+    // (it's reloaded when the tab is selected again)
+    FileState* hibernatedState = nullptr;
+    // the document of a hibernated tab is being loaded in the background
+    bool isLoading = false;
+    // how the canvas looked when the tab was last selected, shown
+    // until the reloaded pages have been rendered
+    HBITMAP snapshot = nullptr;
+    Rect snapshotViewPort;
+    float snapshotZoom{kInvalidZoom};
 
     // TODO: terrible hack
     bool askedToSaveAnnotations = false;
@@ -63,6 +82,7 @@ struct WindowTab {
     bool IsDocLoaded() const;
     void MoveDocBy(int dx, int dy) const;
     void ToggleZoom() const;
+    void DeleteSnapshot();
 };
 
 bool SaveDataToFile(HWND hwndParent, char* fileName, ByteSlice data);
@@ -35,6 +35,11 @@ HRESULT EpubFilter::OnInit() {
     log("EpubFilter::OnInit()\n");
 
     CleanUp();
+    m_budget.Start();
+    if (m_budget.IsStreamTooBig(m_pStream)) {
+        logf("EpubFilter: not indexing a document larger than %d MB\n", (int)m_budget.maxFileSizeMB);
+        return E_FAIL;
+    }
 
     // TODO: EpubDoc::CreateFromStream never returns with
     //       m_pStream instead of a clone - why?
@@ -52,6 +57,11 @@ HRESULT EpubFilter::OnInit() {
     if (!stream) {
         return E_FAIL;
     }
+    // EpubDoc uncompresses all of the content, so refuse zip bombs before loading it
+    if (IsContentTooBig(stream)) {
+        logf("EpubFilter: not indexing a document with more than %d MB of content\n", (int)m_budget.maxFileSizeMB);
+        return E_FAIL;
+    }
 
     m_epubDoc = EpubDoc::CreateFromStream(stream);
     if (!m_epubDoc) {
@@ -62,6 +72,19 @@ HRESULT EpubFilter::OnInit() {
     return S_OK;
 }
 
+bool EpubFilter::IsContentTooBig(IStream* stream) {
+    MultiFormatArchive* archive = OpenZipArchive(stream, false);
+    if (!archive) {
+        return false;
+    }
+    i64 totalSize = 0;
+    for (auto* fileInfo : archive->GetFileInfos()) {
+        totalSize += (i64)fileInfo->fileSizeUncompressed;
+    }
+    delete archive;
+    return m_budget.IsFileTooBig(totalSize);
+}
+
 // copied from SumatraProperties.cpp
 static bool IsoDateParse(const char* isoDate, SYSTEMTIME* timeOut) {
     ZeroMemory(timeOut, sizeof(SYSTEMTIME));
@@ -74,52 +97,65 @@ static bool IsoDateParse(const char* isoDate, SYSTEMTIME* timeOut) {
     // don't bother about the day of week, we won't display it anyway
 }
 
-static WCHAR* ExtractHtmlText(EpubDoc* doc) {
+static WCHAR* ExtractHtmlText(EpubDoc* doc, const SearchFilterBudget& budget) {
     log("ExtractHtmlText()\n");
 
-    ByteSlice d = doc->GetHtmlData();
-    size_t len = d.size();
-
-    str::Str text(len / 2);
-    HtmlPullParser p(d);
-    HtmlToken* t;
+    str::Str text;
     Vec<HtmlTag> tagNesting;
-    while ((t = p.Next()) != nullptr && !t->IsError()) {
-        if (t->IsText() && !tagNesting.Contains(Tag_Head) && !tagNesting.Contains(Tag_Script) &&
-            !tagNesting.Contains(Tag_Style)) {
-            // trim whitespace (TODO: also normalize within text?)
-            while (t->sLen > 0 && str::IsWs(t->s[0])) {
-                t->s++;
-                t->sLen--;
-            }
-            while (t->sLen > 0 && str::IsWs(t->s[t->sLen - 1])) {
-                t->sLen--;
-            }
-            if (t->sLen > 0) {
-                text.AppendAndFree(ResolveHtmlEntities(t->s, t->sLen));
-                text.AppendChar(' ');
-            }
-        } else if (t->IsStartTag()) {
-            // TODO: force-close tags similar to HtmlFormatter.cpp's AutoCloseOnOpen?
-            if (!IsTagSelfClosing(t->tag)) {
-                tagNesting.Append(t->tag);
-            }
-        } else if (t->IsEndTag()) {
-            if (!IsInlineTag(t->tag) && text.size() > 0 && text.Last() == ' ') {
-                text.RemoveLast();
-                text.Append("\r\n");
+    int nTokens = 0;
+    bool overBudget = false;
+    // chapters are loaded one at a time, so that indexing stops
+    // before reading the rest of the book when over budget
+    int nChapters = doc->GetChapterCount();
+    for (int chapterNo = 0; chapterNo < nChapters && !overBudget; chapterNo++) {
+        ByteSlice d = doc->GetChapterHtml(chapterNo);
+        if (d.empty()) {
+            continue;
+        }
+        HtmlPullParser p(d);
+        HtmlToken* t;
+        while ((t = p.Next()) != nullptr && !t->IsError()) {
+            if (budget.IsOverTextChars((i64)text.size()) || (++nTokens % 1024 == 0 && budget.IsOverTime())) {
+                logf("EpubFilter: stopped indexing after %d chars\n", (int)text.size());
+                overBudget = true;
+                break;
             }
-            // when closing a tag, if the top tag doesn't match but
-            // there are only potentially self-closing tags on the
-            // stack between the matching tag, we pop all of them
-            if (tagNesting.Contains(t->tag)) {
-                while (tagNesting.Last() != t->tag) {
+            if (t->IsText() && !tagNesting.Contains(Tag_Head) && !tagNesting.Contains(Tag_Script) &&
+                !tagNesting.Contains(Tag_Style)) {
+                // trim whitespace (TODO: also normalize within text?)
+                while (t->sLen > 0 && str::IsWs(t->s[0])) {
+                    t->s++;
+                    t->sLen--;
+                }
+                while (t->sLen > 0 && str::IsWs(t->s[t->sLen - 1])) {
+                    t->sLen--;
+                }
+                if (t->sLen > 0) {
+                    text.AppendAndFree(ResolveHtmlEntities(t->s, t->sLen));
+                    text.AppendChar(' ');
+                }
+            } else if (t->IsStartTag()) {
+                // TODO: force-close tags similar to HtmlFormatter.cpp's AutoCloseOnOpen?
+                if (!IsTagSelfClosing(t->tag)) {
+                    tagNesting.Append(t->tag);
+                }
+            } else if (t->IsEndTag()) {
+                if (!IsInlineTag(t->tag) && text.size() > 0 && text.Last() == ' ') {
+                    text.RemoveLast();
+                    text.Append("\r\n");
+                }
+                // when closing a tag, if the top tag doesn't match but
+                // there are only potentially self-closing tags on the
+                // stack between the matching tag, we pop all of them
+                if (tagNesting.Contains(t->tag)) {
+                    while (tagNesting.Last() != t->tag) {
+                        tagNesting.Pop();
+                    }
+                }
+                if (tagNesting.size() > 0 && tagNesting.Last() == t->tag) {
                     tagNesting.Pop();
                 }
             }
-            if (tagNesting.size() > 0 && tagNesting.Last() == t->tag) {
-                tagNesting.Pop();
-            }
         }
     }
 
@@ -185,7 +221,7 @@ HRESULT EpubFilter::GetNextChunkValue(ChunkValue& chunkValue) {
 
         case STATE_EPUB_CONTENT:
             m_state = STATE_EPUB_END;
-            ws = ExtractHtmlText(m_epubDoc);
+            ws = ExtractHtmlText(m_epubDoc, m_budget);
             if (!str::IsEmpty(ws)) {
                 chunkValue.SetTextValue(PKEY_Search_Contents, ws, CHUNK_TEXT);
                 str::Free(ws);
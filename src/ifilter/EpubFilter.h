@@ -16,6 +16,7 @@ public:
     HRESULT GetNextChunkValue(ChunkValue &chunkValue) override;
 
     VOID CleanUp();
+    bool IsContentTooBig(IStream *stream);
 
     // IPersist
     IFACEMETHODIMP GetClassID(CLSID *pClassID) {
@@ -25,4 +26,5 @@ public:
 private:
     EPUB_FILTER_STATE m_state;
     EpubDoc *m_epubDoc;
+    SearchFilterBudget m_budget;
 };
@@ -17,7 +17,7 @@
 class ChunkValue
 {
 public:
-    ChunkValue() : m_fIsValid(false), m_pszValue(nullptr)
+    ChunkValue() : m_fIsValid(false), m_pszValue(nullptr), m_cchValue(0)
     {
         PropVariantInit(&m_propVariant);
         Clear();
@@ -32,6 +32,7 @@ public:
         PropVariantClear(&m_propVariant);
         CoTaskMemFree(m_pszValue);
         m_pszValue = nullptr;
+        m_cchValue = 0;
     }
 
     BOOL IsValid() { return m_fIsValid; }
@@ -57,6 +58,7 @@ public:
     }
 
     PWSTR GetString() { return m_pszValue; };
+    size_t GetStringLen() { return m_cchValue; };
 
     HRESULT CopyChunk(STAT_CHUNK *pStatChunk)
     {
@@ -95,6 +97,7 @@ public:
         else
         {
             m_pszValue = pszCoTaskValue;
+            m_cchValue = cch - 1;
         }
 
         return hr;
@@ -123,6 +126,8 @@ private:
     STAT_CHUNK  m_chunk;
     PROPVARIANT m_propVariant;
     PWSTR m_pszValue;
+    // GetText() is called many times for a long chunk
+    size_t m_cchValue;
 
 };
 
@@ -234,7 +239,7 @@ public:
         if (m_currentChunk.GetChunkType() != CHUNK_TEXT)
             return FILTER_E_NO_TEXT;
 
-        ULONG cchTotal = static_cast<ULONG>(wcslen(m_currentChunk.GetString()));
+        ULONG cchTotal = static_cast<ULONG>(m_currentChunk.GetStringLen());
         ULONG cchLeft = cchTotal - m_iText;
         ULONG cchToCopy = std::min(*pcwcBuffer - 1, cchLeft);
 
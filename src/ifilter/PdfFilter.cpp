@@ -17,12 +17,22 @@
 
 #include "utils/Log.h"
 
+// the search host indexes many documents, so memory use per document is limited:
+// fonts and images cached by fitz, the text of a single page and the indexed text
+// (and the number of pages and time, see SearchFilterBudget)
+constexpr size_t kMaxFitzStoreSize = 32 * 1024 * 1024;
+constexpr int kMaxTextChunkChars = 64 * 1024;
+
 void _uploadDebugReportIfFunc(__unused bool cond, __unused const char* condStr) {
     // no-op implementation to satisfy SubmitBugReport()
 }
 
 VOID PdfFilter::CleanUp() {
     logf("PdfFilter::Cleanup()\n");
+    str::FreePtr(&m_pageText);
+    m_pageTextLen = 0;
+    m_iPageTextOffset = 0;
+    m_nTextChars = 0;
     if (m_pdfEngine) {
         delete m_pdfEngine;
         m_pdfEngine = nullptr;
@@ -33,6 +43,11 @@ VOID PdfFilter::CleanUp() {
 HRESULT PdfFilter::OnInit() {
     logf("PdfFilter::OnInit()\n");
     CleanUp();
+    m_budget.Start();
+    if (m_budget.IsStreamTooBig(m_pStream)) {
+        logf("PdfFilter: not indexing a document larger than %d MB\n", (int)m_budget.maxFileSizeMB);
+        return E_FAIL;
+    }
 
     // TODO: EngineMupdf::CreateFromStream never returns with
     //       m_pStream instead of a clone - why?
@@ -51,7 +66,7 @@ HRESULT PdfFilter::OnInit() {
         return E_FAIL;
     }
 
-    m_pdfEngine = CreateEngineMupdfFromStream(stream, "foo.pdf");
+    m_pdfEngine = CreateEngineMupdfFromStream(stream, "foo.pdf", nullptr, kMaxFitzStoreSize);
     if (!m_pdfEngine) {
         return E_FAIL;
     }
@@ -76,6 +91,61 @@ static bool PdfDateParse(const char* pdfDate, SYSTEMTIME* timeOut) {
     // don't bother about the day of week, we won't display it anyway
 }
 
+// returns the text a page at a time, in chunks of at most kMaxTextChunkChars,
+// so that only a single page is loaded and only a chunk is copied at a time
+bool PdfFilter::GetNextTextChunk(ChunkValue& chunkValue) {
+    bool isNewPage = false;
+    while (m_iPageTextOffset >= m_pageTextLen) {
+        str::FreePtr(&m_pageText);
+        m_pageTextLen = 0;
+        m_iPageTextOffset = 0;
+        if (m_budget.IsOverTextChars(m_nTextChars) || m_budget.IsOverTime()) {
+            logf("PdfFilter: stopped indexing at page %d after %d chars\n", m_iPageNo, (int)m_nTextChars);
+            return false;
+        }
+        if (++m_iPageNo > m_pdfEngine->PageCount()) {
+            return false;
+        }
+        if (m_budget.IsOverPages(m_iPageNo)) {
+            logf("PdfFilter: stopped indexing after %d pages\n", (int)m_budget.maxPages);
+            return false;
+        }
+        PageText pageText = m_pdfEngine->ExtractPageText(m_iPageNo);
+        EngineMupdfReleasePage(m_pdfEngine, m_iPageNo);
+        // coordinates aren't needed for indexing
+        free(pageText.coords);
+        m_pageText = pageText.text;
+        m_pageTextLen = pageText.len;
+        isNewPage = true;
+    }
+
+    int n = std::min(m_pageTextLen - m_iPageTextOffset, kMaxTextChunkChars);
+    if (m_budget.maxTextChars != 0) {
+        n = (int)std::min((i64)n, (i64)m_budget.maxTextChars - m_nTextChars);
+    }
+    const WCHAR* s = m_pageText + m_iPageTextOffset;
+    // don't split surrogate pairs
+    if (n > 0 && m_iPageTextOffset + n < m_pageTextLen && IS_HIGH_SURROGATE(s[n - 1])) {
+        n--;
+    }
+    if (n <= 0) {
+        logf("PdfFilter: stopped indexing at page %d after %d chars\n", m_iPageNo, (int)m_nTextChars);
+        return false;
+    }
+    str::WStr chunk(n + n / 8);
+    for (int i = 0; i < n; i++) {
+        if (s[i] == '\n') {
+            chunk.AppendChar('\r');
+        }
+        chunk.AppendChar(s[i]);
+    }
+    CHUNK_BREAKTYPE breakType = isNewPage ? CHUNK_EOP : CHUNK_NO_BREAK;
+    chunkValue.SetTextValue(PKEY_Search_Contents, chunk.Get(), CHUNK_TEXT, 0, 0, 0, breakType);
+    m_iPageTextOffset += n;
+    m_nTextChars += n;
+    return true;
+}
+
 // Start, Author, Title, Date, Content, End
 
 static const char* PdfFilterStateToStr(PdfFilterState state) {
@@ -100,6 +170,7 @@ HRESULT PdfFilter::GetNextChunkValue(ChunkValue& chunkValue) {
             if (!str::IsEmpty(prop)) {
                 ws = ToWstr(prop);
                 chunkValue.SetTextValue(PKEY_Author, ws);
+                str::FreePtr(&ws);
                 str::FreePtr(&prop);
                 return S_OK;
             }
@@ -116,6 +187,7 @@ HRESULT PdfFilter::GetNextChunkValue(ChunkValue& chunkValue) {
             if (!str::IsEmpty(prop)) {
                 ws = ToWstr(prop);
                 chunkValue.SetTextValue(PKEY_Title, ws);
+                str::FreePtr(&ws);
                 str::FreePtr(&prop);
                 return S_OK;
             }
@@ -143,17 +215,7 @@ HRESULT PdfFilter::GetNextChunkValue(ChunkValue& chunkValue) {
             [[fallthrough]];
 
         case PdfFilterState::Content:
-            while (++m_iPageNo <= m_pdfEngine->PageCount()) {
-                PageText pageText = m_pdfEngine->ExtractPageText(m_iPageNo);
-                if (str::IsEmpty(pageText.text)) {
-                    FreePageText(&pageText);
-                    continue;
-                }
-                ws = pageText.text;
-                WCHAR* str = str::Replace(ws, L"\n", L"\r\n");
-                chunkValue.SetTextValue(PKEY_Search_Contents, str, CHUNK_TEXT);
-                str::FreePtr(&str);
-                FreePageText(&pageText);
+            if (GetNextTextChunk(chunkValue)) {
                 return S_OK;
             }
             m_state = PdfFilterState::End;
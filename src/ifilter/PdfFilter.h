@@ -16,6 +16,7 @@ public:
     HRESULT GetNextChunkValue(ChunkValue &chunkValue) override;
 
     VOID CleanUp();
+    bool GetNextTextChunk(ChunkValue &chunkValue);
 
     // IPersist
     IFACEMETHODIMP GetClassID(CLSID *pClassID) {
@@ -26,4 +27,11 @@ private:
     PdfFilterState m_state{PdfFilterState::End};
     int m_iPageNo = -1;
     EngineBase *m_pdfEngine = nullptr;
+    // text of page m_iPageNo, returned in chunks starting at m_iPageTextOffset
+    WCHAR *m_pageText = nullptr;
+    int m_pageTextLen = 0;
+    int m_iPageTextOffset = 0;
+    // number of chars returned for the whole document
+    i64 m_nTextChars = 0;
+    SearchFilterBudget m_budget;
 };
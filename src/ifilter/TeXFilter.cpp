@@ -9,7 +9,11 @@
 #include "TeXFilter.h"
 
 HRESULT TeXFilter::OnInit() {
+    m_budget.Start();
     if (!m_pData) {
+        if (m_budget.IsStreamTooBig(m_pStream)) {
+            return E_FAIL;
+        }
         // load content of LaTeX file into m_pData
         HRESULT res;
         ByteSlice data = GetDataFromStream(m_pStream, &res);
@@ -30,6 +34,7 @@ HRESULT TeXFilter::OnInit() {
     m_state = STATE_TEX_START;
     m_pPtr = m_pData;
     m_iDepth = 0;
+    m_nTextChars = 0;
 
     return S_OK;
 }
@@ -217,7 +222,9 @@ HRESULT TeXFilter::GetNextChunkValue(ChunkValue& chunkValue) {
     WCHAR *start, *end;
 
 ContinueParsing:
-    if (!*m_pPtr && m_state == STATE_TEX_PREAMBLE) {
+    if (m_budget.IsOverTextChars(m_nTextChars) || m_budget.IsOverTime()) {
+        m_state = STATE_TEX_END;
+    } else if (!*m_pPtr && m_state == STATE_TEX_PREAMBLE) {
         // if there was no preamble, treat the whole document as content
         m_pPtr = m_pData;
         m_iDepth = 0;
@@ -276,7 +283,12 @@ ContinueParsing:
             }
             goto ContinueParsing;
         case STATE_TEX_CONTENT:
-            chunkValue.SetTextValue(PKEY_Search_Contents, ExtractBracedBlock(), CHUNK_TEXT);
+            start = ExtractBracedBlock();
+            if (m_budget.maxTextChars != 0 && m_nTextChars + str::Len(start) > (i64)m_budget.maxTextChars) {
+                start[m_budget.maxTextChars - m_nTextChars] = '\0';
+            }
+            m_nTextChars += str::Len(start);
+            chunkValue.SetTextValue(PKEY_Search_Contents, start, CHUNK_TEXT);
             return S_OK;
         default:
             return FILTER_E_END_OF_CHUNKS;
@@ -32,4 +32,7 @@ private:
     TEX_FILTER_STATE m_state;
     WCHAR *m_pData, *m_pPtr, *m_pBuffer;
     int m_iDepth;
+    // number of chars returned for the whole document
+    i64 m_nTextChars = 0;
+    SearchFilterBudget m_budget;
 };
@@ -94,8 +94,34 @@ class FontListItem {
     FontListItem* next;
 };
 
-// Global, thread-safe font cache. Font objects live forever.
-static FontListItem* gFontsCache = nullptr;
+// Global, thread-safe font cache. Font objects live forever because
+// CachedFont pointers are kept e.g. in laid out pages, so there's no eviction.
+// Items are only added (under gMuiCs) at the head of a bucket after they're
+// fully constructed, so lookups can walk the buckets without locking
+constexpr size_t kFontCacheBuckets = 256;
+static FontListItem* gFontsCache[kFontCacheBuckets];
+// returned if no font can be created
+static CachedFont* gLastCachedFont = nullptr;
+
+static size_t FontCacheBucket(const WCHAR* name, float sizePt, FontStyle style) {
+    u32 sizeBits;
+    memcpy(&sizeBits, &sizePt, sizeof(sizeBits));
+    u32 h = MurmurHash2(name, str::Len(name) * sizeof(WCHAR));
+    h ^= sizeBits * 0x9E3779B1u;
+    h ^= (u32)style * 0x85EBCA77u;
+    h ^= h >> 15;
+    return h % kFontCacheBuckets;
+}
+
+static CachedFont* FindCachedFont(size_t bucket, const WCHAR* name, float sizePt, FontStyle style) {
+    auto item = (FontListItem*)ReadPointerAcquire((PVOID*)&gFontsCache[bucket]);
+    for (; item; item = item->next) {
+        if (item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
+            return &item->cf;
+        }
+    }
+    return nullptr;
+}
 
 // Graphics objects cannot be used across threads. We have a per-thread
 // cache so that it's easy to grab Graphics object to be used for
@@ -157,6 +183,7 @@ void GraphicsCacheEntry::Free() const {
 void Initialize() {
     InitializeCriticalSection(&gMuiCs);
     gGraphicsCache = new Vec<GraphicsCacheEntry>();
+    InitializeGlyphCache();
     // allocate the first entry in gGraphicsCache for UI thread, ref count
     // ensures it stays alive forever
     AllocGraphicsForMeasureText();
@@ -168,7 +195,13 @@ void Destroy() {
         e.Free();
     }
     delete gGraphicsCache;
-    delete gFontsCache;
+    FreeGlyphCache();
+    FreeDWriteFactories();
+    for (FontListItem*& item : gFontsCache) {
+        delete item;
+        item = nullptr;
+    }
+    gLastCachedFont = nullptr;
     DeleteCriticalSection(&gMuiCs);
 }
 
@@ -183,6 +216,10 @@ bool CachedFont::SameAs(const WCHAR* otherName, float otherSizePt, FontStyle oth
 }
 
 HFONT CachedFont::GetHFont() {
+    auto res = (HFONT)ReadPointerAcquire((PVOID*)&hFont);
+    if (res) {
+        return res;
+    }
     LOGFONTW lf;
     EnterMuiCriticalSection();
     if (!hFont) {
@@ -193,23 +230,30 @@ HFONT CachedFont::GetHFont() {
         Status status = font->GetLogFontW(gfx, &lf);
         FreeGraphicsForMeasureText(gfx);
         CrashIf(status != Ok);
-        hFont = CreateFontIndirectW(&lf);
-        CrashIf(!hFont);
+        HFONT h = CreateFontIndirectW(&lf);
+        CrashIf(!h);
+        WritePointerRelease((PVOID*)&hFont, h);
     }
+    res = hFont;
     LeaveMuiCriticalSection();
-    return hFont;
+    return res;
 }
 
 // convenience function: given cached style, get a Font object matching the font
 // properties.
 // Caller should not delete the font - it's cached for performance and deleted at exit
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
-    ScopedMuiCritSec muiCs;
+    size_t bucket = FontCacheBucket(name, sizePt, style);
+    CachedFont* res = FindCachedFont(bucket, name, sizePt, style);
+    if (res) {
+        return res;
+    }
 
-    for (FontListItem* item = gFontsCache; item; item = item->next) {
-        if (item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
-            return &item->cf;
-        }
+    ScopedMuiCritSec muiCs;
+    // another thread might have added it in the meantime
+    res = FindCachedFont(bucket, name, sizePt, style);
+    if (res) {
+        return res;
     }
 
     Font* font = new Font(name, sizePt, style);
@@ -219,15 +263,15 @@ CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
         if (font->GetLastStatus() != Status::Ok) {
             // if no font is available, return the last successfully created one
             delete font;
-            if (gFontsCache) {
-                return &gFontsCache->cf;
-            }
-            return nullptr;
+            return gLastCachedFont;
         }
     }
 
     FontListItem* item = new FontListItem(name, sizePt, style, font, nullptr);
-    ListInsert(&gFontsCache, item);
+    item->next = gFontsCache[bucket];
+    // publish only after item is fully constructed
+    WritePointerRelease((PVOID*)&gFontsCache[bucket], item);
+    gLastCachedFont = &item->cf;
     return &item->cf;
 }
 
@@ -2,11 +2,25 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "Mui.h"
 
+#include <d2d1.h>
+#include <dwrite.h>
+
+#pragma comment(lib, "d2d1.lib")
+#pragma comment(lib, "dwrite.lib")
+
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 /*
 TODO:
  - text drawing is still too slow. each html page takes ~20ms to draw, which is
@@ -29,6 +43,7 @@ be in mui to avoid circular dependency */
 
 using Gdiplus::Bitmap;
 using Gdiplus::Color;
+using Gdiplus::FontFamily;
 using Gdiplus::Graphics;
 using Gdiplus::Ok;
 using Gdiplus::Region;
@@ -39,6 +54,75 @@ using Gdiplus::StringFormatFlagsDirectionRightToLeft;
 
 namespace mui {
 
+ITextRender::~ITextRender() {
+    DeleteVecMembers(advancesCache);
+}
+
+static bool HasCachedAdvance(WCHAR c) {
+    return c >= kGlyphAdvancesFirstChar && c < kGlyphAdvancesEndChar;
+}
+
+// measuring 1 and 2 chars cancels out the per-string overhead
+static float MeasureAdvance(ITextRender* textMeasure, WCHAR c) {
+    WCHAR s[2] = {c, c};
+    float dx1 = textMeasure->Measure(s, 1).dx;
+    float dx2 = textMeasure->Measure(s, 2).dx;
+    return std::max(dx2 - dx1, 0.f);
+}
+
+GlyphAdvances* ITextRender::GetAdvances(const WCHAR* s, size_t sLen) {
+    if (!currFont || sLen == 0) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < sLen; i++) {
+        if (!HasCachedAdvance(s[i])) {
+            return nullptr;
+        }
+    }
+
+    GlyphAdvances* ga = nullptr;
+    for (GlyphAdvances* el : advancesCache) {
+        if (el->font == currFont) {
+            ga = el;
+            break;
+        }
+    }
+    if (!ga) {
+        ga = new GlyphAdvances();
+        ga->font = currFont;
+        for (float& dx : ga->dx) {
+            dx = -1.f;
+        }
+        WCHAR c = 'x';
+        RectF r = Measure(&c, 1);
+        float dx = MeasureAdvance(this, c);
+        ga->dx[c - kGlyphAdvancesFirstChar] = dx;
+        ga->overhead = r.dx - dx;
+        ga->dy = r.dy;
+        advancesCache.Append(ga);
+    }
+
+    for (size_t i = 0; i < sLen; i++) {
+        float& dx = ga->dx[s[i] - kGlyphAdvancesFirstChar];
+        if (dx < 0) {
+            dx = MeasureAdvance(this, s[i]);
+        }
+    }
+    return ga;
+}
+
+RectF ITextRender::MeasureCached(const WCHAR* s, size_t sLen) {
+    GlyphAdvances* ga = GetAdvances(s, sLen);
+    if (!ga) {
+        return Measure(s, sLen);
+    }
+    float dx = ga->overhead;
+    for (size_t i = 0; i < sLen; i++) {
+        dx += ga->dx[s[i] - kGlyphAdvancesFirstChar];
+    }
+    return RectF(0.0f, 0.0f, dx, ga->dy);
+}
+
 TextRenderGdi* TextRenderGdi::Create(Graphics* gfx) {
     TextRenderGdi* res = new TextRenderGdi();
     res->gfx = gfx;
@@ -477,6 +561,676 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// glyphs are rasterized with 4x horizontal oversampling, from which
+// a bitmap for each of 4 subpixel pen positions is box filtered
+constexpr int kGlyphSubpixels = 4;
+constexpr int kGlyphCacheBuckets = 4096;
+// when exceeded, all glyphs are thrown away
+constexpr int kGlyphCacheMaxGlyphs = 32 * 1024;
+constexpr int kGlyphCacheMaxFonts = 64;
+// bigger glyphs are drawn by GDI+
+constexpr float kGlyphCacheMaxEmSize = 200.f;
+// GDI+ DrawString() leaves 1/6 em of space before the text
+constexpr float kDrawStringPadding = 1.f / 6.f;
+
+struct GlyphBitmap {
+    // relative to the pen position rounded down to a pixel and the baseline
+    int x = 0;
+    int y = 0;
+    int dx = 0;
+    int dy = 0;
+    // multiple of 4
+    int stride = 0;
+    // 0 (transparent) ... 64 (opaque)
+    u8* coverage = nullptr;
+};
+
+struct CachedGlyph {
+    CachedGlyph* next = nullptr;
+    CachedFont* font = nullptr;
+    // in 1/16th of a pixel
+    int emSize = 0;
+    WCHAR c = 0;
+    // false if GDI can't rasterize it
+    bool ok = false;
+    // in pixels
+    float advance = 0.f;
+    GlyphBitmap bmps[kGlyphSubpixels];
+};
+
+struct GlyphCacheFont {
+    CachedFont* font = nullptr;
+    int emSize = 0;
+    HFONT hfont = nullptr;
+    // scales the outlines of hfont (whose size is a whole number of pixels) to emSize
+    MAT2 mat{};
+    float ascent = 0.f;
+};
+
+struct GlyphCache {
+    CRITICAL_SECTION cs;
+    HDC hdc = nullptr;
+    HFONT selectedFont = nullptr;
+    HGDIOBJ prevFont = nullptr;
+    Vec<GlyphCacheFont> fonts;
+    CachedGlyph* buckets[kGlyphCacheBuckets] = {};
+    int nGlyphs = 0;
+    // glyphs and their bitmaps
+    PoolAllocator allocator;
+};
+
+static GlyphCache* gGlyphCache = nullptr;
+
+void InitializeGlyphCache() {
+    gGlyphCache = new GlyphCache();
+    InitializeCriticalSection(&gGlyphCache->cs);
+}
+
+static void FreeGlyphCacheFonts(GlyphCache* gc) {
+    if (gc->prevFont) {
+        SelectObject(gc->hdc, gc->prevFont);
+    }
+    gc->prevFont = nullptr;
+    gc->selectedFont = nullptr;
+    for (GlyphCacheFont& f : gc->fonts) {
+        DeleteObject(f.hfont);
+    }
+    gc->fonts.Reset();
+}
+
+static void FreeGlyphs(GlyphCache* gc) {
+    for (CachedGlyph*& g : gc->buckets) {
+        g = nullptr;
+    }
+    gc->nGlyphs = 0;
+    gc->allocator.Reset();
+}
+
+void FreeGlyphCache() {
+    if (!gGlyphCache) {
+        return;
+    }
+    FreeGlyphCacheFonts(gGlyphCache);
+    DeleteDC(gGlyphCache->hdc);
+    DeleteCriticalSection(&gGlyphCache->cs);
+    delete gGlyphCache;
+    gGlyphCache = nullptr;
+}
+
+static FIXED ToFixed(float v) {
+    LONG l = (LONG)(v * 65536.f);
+    FIXED res;
+    memcpy(&res, &l, sizeof(res));
+    return res;
+}
+
+static int FloorDiv(int v, int d) {
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+// em size of font in pixels of gfx (ignoring its transformation), 0 if unknown
+static float GetEmSize(Graphics* gfx, CachedFont* font) {
+    Gdiplus::Unit unit = font->font->GetUnit();
+    if (unit == Gdiplus::UnitPoint) {
+        return font->font->GetSize() * gfx->GetDpiY() / 72.f;
+    }
+    if (unit == Gdiplus::UnitPixel) {
+        return font->font->GetSize();
+    }
+    return 0.f;
+}
+
+static GlyphCacheFont* GetGlyphCacheFont(GlyphCache* gc, Graphics* gfx, CachedFont* font, float emSize) {
+    int emKey = (int)(emSize * 16.f + 0.5f);
+    for (GlyphCacheFont& f : gc->fonts) {
+        if (f.font == font && f.emSize == emKey) {
+            return &f;
+        }
+    }
+
+    LOGFONTW lf{};
+    if (font->font->GetLogFontW(gfx, &lf) != Ok) {
+        return nullptr;
+    }
+    int pixelSize = std::max((int)(emSize + 0.5f), 1);
+    lf.lfHeight = -pixelSize;
+    lf.lfWidth = 0;
+    lf.lfEscapement = 0;
+    lf.lfOrientation = 0;
+    lf.lfQuality = ANTIALIASED_QUALITY;
+    HFONT hfont = CreateFontIndirectW(&lf);
+    if (!hfont) {
+        return nullptr;
+    }
+
+    FontFamily family;
+    font->font->GetFamily(&family);
+    INT style = font->font->GetStyle();
+    float emHeight = (float)family.GetEmHeight(style);
+
+    GlyphCacheFont f;
+    f.font = font;
+    f.emSize = emKey;
+    f.hfont = hfont;
+    float k = emSize / (float)pixelSize;
+    f.mat.eM11 = ToFixed(k * kGlyphSubpixels);
+    f.mat.eM22 = ToFixed(k);
+    f.ascent = emHeight > 0 ? emSize * (float)family.GetCellAscent(style) / emHeight : emSize;
+    gc->fonts.Append(f);
+    return &gc->fonts.Last();
+}
+
+static void RasterizeGlyph(GlyphCache* gc, GlyphCacheFont* f, CachedGlyph* g) {
+    if (!gc->hdc) {
+        gc->hdc = CreateCompatibleDC(nullptr);
+    }
+    if (gc->selectedFont != f->hfont) {
+        HGDIOBJ prev = SelectObject(gc->hdc, f->hfont);
+        if (!gc->prevFont) {
+            gc->prevFont = prev;
+        }
+        gc->selectedFont = f->hfont;
+    }
+
+    GLYPHMETRICS gm{};
+    DWORD size = GetGlyphOutlineW(gc->hdc, g->c, GGO_GRAY8_BITMAP, &gm, 0, nullptr, &f->mat);
+    if (size == GDI_ERROR) {
+        return;
+    }
+    g->ok = true;
+    g->advance = (float)gm.gmCellIncX / (float)kGlyphSubpixels;
+    if (size == 0) {
+        // e.g. space
+        return;
+    }
+    u8* samples = AllocArray<u8>(size);
+    if (!samples) {
+        g->ok = false;
+        return;
+    }
+    if (GetGlyphOutlineW(gc->hdc, g->c, GGO_GRAY8_BITMAP, &gm, size, samples, &f->mat) == GDI_ERROR) {
+        free(samples);
+        g->ok = false;
+        return;
+    }
+
+    // rows of samples are DWORD aligned
+    int nSamples = (int)gm.gmBlackBoxX;
+    int samplesStride = (nSamples + 3) & ~3;
+    int dy = (int)gm.gmBlackBoxY;
+    for (int sub = 0; sub < kGlyphSubpixels; sub++) {
+        GlyphBitmap& b = g->bmps[sub];
+        // in samples, relative to the pen position rounded down to a pixel
+        int left = gm.gmptGlyphOrigin.x + sub;
+        b.x = FloorDiv(left, kGlyphSubpixels);
+        b.dx = FloorDiv(left + nSamples + kGlyphSubpixels - 1, kGlyphSubpixels) - b.x;
+        b.y = -gm.gmptGlyphOrigin.y;
+        b.dy = dy;
+        b.stride = (b.dx + 3) & ~3;
+        b.coverage = (u8*)Allocator::AllocZero(&gc->allocator, (size_t)b.stride * dy);
+        if (!b.coverage) {
+            b.dx = b.dy = 0;
+            continue;
+        }
+        for (int y = 0; y < dy; y++) {
+            const u8* src = samples + (size_t)y * samplesStride;
+            u8* dst = b.coverage + (size_t)y * b.stride;
+            for (int x = 0; x < b.dx; x++) {
+                int s0 = std::max((b.x + x) * kGlyphSubpixels - left, 0);
+                int s1 = std::min((b.x + x + 1) * kGlyphSubpixels - left, nSamples);
+                int sum = 0;
+                for (int i = s0; i < s1; i++) {
+                    sum += src[i];
+                }
+                dst[x] = (u8)((sum + kGlyphSubpixels / 2) / kGlyphSubpixels);
+            }
+        }
+    }
+    free(samples);
+}
+
+static CachedGlyph* GetGlyph(GlyphCache* gc, GlyphCacheFont* f, WCHAR c) {
+    uintptr_t h = ((uintptr_t)f->font >> 4) * 31 + (uintptr_t)f->emSize * 131 + c;
+    CachedGlyph** bucket = &gc->buckets[h % kGlyphCacheBuckets];
+    for (CachedGlyph* g = *bucket; g; g = g->next) {
+        if (g->c == c && g->font == f->font && g->emSize == f->emSize) {
+            return g;
+        }
+    }
+    CachedGlyph* g = Allocator::Alloc<CachedGlyph>(&gc->allocator);
+    if (!g) {
+        return nullptr;
+    }
+    g->font = f->font;
+    g->emSize = f->emSize;
+    g->c = c;
+    RasterizeGlyph(gc, f, g);
+    g->next = *bucket;
+    *bucket = g;
+    gc->nGlyphs++;
+    return g;
+}
+
+// dst = dst + (color - dst) * coverage, with alphaMul (0 ... 256) applied to coverage
+static void BlendGlyphRow(u8* dst, const u8* coverage, int n, u32 color, int alphaMul) {
+    int x = 0;
+#if USE_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i col = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+    __m128i mul = _mm_set1_epi16((short)alphaMul);
+    for (; x + 4 <= n; x += 4) {
+        u32 cov4;
+        memcpy(&cov4, coverage + x, sizeof(cov4));
+        if (cov4 == 0) {
+            continue;
+        }
+        // coverage of each pixel repeated for its 4 channels
+        __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cov4), zero);
+        a = _mm_srli_epi16(_mm_mullo_epi16(a, mul), 8);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i aLo = _mm_unpacklo_epi32(a, a);
+        __m128i aHi = _mm_unpackhi_epi32(a, a);
+
+        __m128i d = _mm_loadu_si128((__m128i*)(dst + x * 4));
+        __m128i dLo = _mm_unpacklo_epi8(d, zero);
+        __m128i dHi = _mm_unpackhi_epi8(d, zero);
+        dLo = _mm_add_epi16(dLo, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(col, dLo), aLo), 6));
+        dHi = _mm_add_epi16(dHi, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(col, dHi), aHi), 6));
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(dLo, dHi));
+    }
+#endif
+    for (; x < n; x++) {
+        int a = (coverage[x] * alphaMul) >> 8;
+        if (a == 0) {
+            continue;
+        }
+        u8* d = dst + x * 4;
+        for (int c = 0; c < 4; c++) {
+            int v = (color >> (c * 8)) & 0xff;
+            d[c] = (u8)(d[c] + (((v - d[c]) * a) >> 6));
+        }
+    }
+}
+
+TextRenderGlyphCache* TextRenderGlyphCache::Create(Graphics* gfx) {
+    TextRenderGlyphCache* res = new TextRenderGlyphCache();
+    res->gfx = gfx;
+    res->gdiplus = TextRenderGdiplus::Create(gfx, MeasureTextQuick);
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+TextRenderGlyphCache::~TextRenderGlyphCache() {
+    delete gdiplus;
+}
+
+void TextRenderGlyphCache::SetFont(mui::CachedFont* font) {
+    CrashIf(!font->font);
+    currFont = font;
+    gdiplus->SetFont(font);
+}
+
+void TextRenderGlyphCache::SetTextColor(Gdiplus::Color col) {
+    textColor = col;
+    gdiplus->SetTextColor(col);
+}
+
+float TextRenderGlyphCache::GetCurrFontLineSpacing() {
+    return gdiplus->GetCurrFontLineSpacing();
+}
+
+RectF TextRenderGlyphCache::Measure(const WCHAR* s, size_t sLen) {
+    return gdiplus->Measure(s, sLen);
+}
+
+RectF TextRenderGlyphCache::Measure(const char* s, size_t sLen) {
+    return gdiplus->Measure(s, sLen);
+}
+
+void TextRenderGlyphCache::Lock() {
+    bmpData = nullptr;
+    if (!gGlyphCache || !gfx->IsClipInfinite()) {
+        return;
+    }
+    // only translation and uniform scaling can be done with pre-rasterized glyphs
+    Gdiplus::Matrix m;
+    float el[6];
+    if (gfx->GetTransform(&m) != Ok || m.GetElements(el) != Ok) {
+        return;
+    }
+    if (el[1] != 0.f || el[2] != 0.f || el[0] <= 0.f || fabsf(el[0] - el[3]) > el[0] * 0.001f) {
+        return;
+    }
+
+    gfx->Flush(Gdiplus::FlushIntentionSync);
+    HDC hdc = gfx->GetHDC();
+    HGDIOBJ hbmp = GetCurrentObject(hdc, OBJ_BITMAP);
+    DIBSECTION ds{};
+    bool isDib = hbmp && GetObject(hbmp, sizeof(ds), &ds) == sizeof(ds);
+    gfx->ReleaseHDC(hdc);
+    if (!isDib || ds.dsBm.bmBitsPixel != 32 || !ds.dsBm.bmBits) {
+        return;
+    }
+    GdiFlush();
+
+    bmpDx = ds.dsBm.bmWidth;
+    bmpDy = ds.dsBm.bmHeight;
+    bmpStride = ds.dsBm.bmWidthBytes;
+    bmpData = (u8*)ds.dsBm.bmBits;
+    if (ds.dsBmih.biHeight > 0) {
+        bmpData += (size_t)(bmpDy - 1) * bmpStride;
+        bmpStride = -bmpStride;
+    }
+    scale = el[0];
+    offX = el[4];
+    offY = el[5];
+    needsFlush = false;
+}
+
+void TextRenderGlyphCache::Unlock() {
+    bmpData = nullptr;
+}
+
+// returns false if s has to be drawn with GDI+
+bool TextRenderGlyphCache::DrawCached(const WCHAR* s, size_t sLen, RectF bb) {
+    if (!bmpData || !currFont || sLen > 256) {
+        return false;
+    }
+    for (size_t i = 0; i < sLen; i++) {
+        // other chars might need shaping or font fallback
+        if (s[i] < 0x20 || s[i] >= kGlyphAdvancesEndChar) {
+            return false;
+        }
+    }
+    float emSize = GetEmSize(gfx, currFont) * scale;
+    if (emSize < 1.f || emSize > kGlyphCacheMaxEmSize) {
+        return false;
+    }
+
+    GlyphCache* gc = gGlyphCache;
+    ScopedCritSec scope(&gc->cs);
+    if (gc->nGlyphs > kGlyphCacheMaxGlyphs) {
+        FreeGlyphs(gc);
+    }
+    if (gc->fonts.size() > kGlyphCacheMaxFonts) {
+        FreeGlyphCacheFonts(gc);
+    }
+    GlyphCacheFont* f = GetGlyphCacheFont(gc, gfx, currFont, emSize);
+    if (!f) {
+        return false;
+    }
+    CachedGlyph* glyphs[256];
+    for (size_t i = 0; i < sLen; i++) {
+        glyphs[i] = GetGlyph(gc, f, s[i]);
+        if (!glyphs[i] || !glyphs[i]->ok) {
+            return false;
+        }
+    }
+
+    if (needsFlush) {
+        gfx->Flush(Gdiplus::FlushIntentionSync);
+        GdiFlush();
+        needsFlush = false;
+    }
+    u32 color = textColor.GetValue();
+    int alpha = textColor.GetA();
+    int alphaMul = alpha + (alpha >> 7);
+    float penX = offX + bb.x * scale + emSize * kDrawStringPadding;
+    int baseline = (int)floorf(offY + bb.y * scale + f->ascent + 0.5f);
+    for (size_t i = 0; i < sLen; i++) {
+        int pos = (int)floorf(penX * kGlyphSubpixels);
+        int px = FloorDiv(pos, kGlyphSubpixels);
+        const GlyphBitmap& b = glyphs[i]->bmps[pos - px * kGlyphSubpixels];
+        penX += glyphs[i]->advance;
+
+        int x0 = px + b.x;
+        int y0 = baseline + b.y;
+        int xStart = std::max(x0, 0);
+        int xEnd = std::min(x0 + b.dx, bmpDx);
+        int yStart = std::max(y0, 0);
+        int yEnd = std::min(y0 + b.dy, bmpDy);
+        for (int y = yStart; y < yEnd; y++) {
+            const u8* coverage = b.coverage + (size_t)(y - y0) * b.stride + (xStart - x0);
+            u8* dst = bmpData + (ptrdiff_t)y * bmpStride + (ptrdiff_t)xStart * 4;
+            BlendGlyphRow(dst, coverage, xEnd - xStart, color, alphaMul);
+        }
+    }
+    return true;
+}
+
+void TextRenderGlyphCache::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl) {
+    if (!isRtl && DrawCached(s, sLen, bb)) {
+        return;
+    }
+    gdiplus->Draw(s, sLen, bb, isRtl);
+    needsFlush = true;
+}
+
+void TextRenderGlyphCache::Draw(const char* s, size_t sLen, const RectF bb, bool isRtl) {
+    WCHAR* buf = ToWstrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    Draw(buf, strLen, bb, isRtl);
+}
+
+// shared by all TextRenderDWrite, both are thread safe
+static IDWriteFactory* gDWriteFactory = nullptr;
+static ID2D1Factory* gD2DFactory = nullptr;
+static WCHAR gDWriteLocale[LOCALE_NAME_MAX_LENGTH] = L"en-us";
+
+static bool CreateDWriteFactories() {
+    HRESULT hr = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&gDWriteFactory);
+    if (FAILED(hr)) {
+        gDWriteFactory = nullptr;
+        return false;
+    }
+    D2D1_FACTORY_OPTIONS options = {D2D1_DEBUG_LEVEL_NONE};
+    hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, options, &gD2DFactory);
+    if (FAILED(hr)) {
+        gD2DFactory = nullptr;
+        return false;
+    }
+    GetUserDefaultLocaleName(gDWriteLocale, dimof(gDWriteLocale));
+    return true;
+}
+
+static bool InitDWriteFactories() {
+    static bool ok = CreateDWriteFactories();
+    return ok;
+}
+
+void FreeDWriteFactories() {
+    if (gD2DFactory) {
+        gD2DFactory->Release();
+        gD2DFactory = nullptr;
+    }
+    if (gDWriteFactory) {
+        gDWriteFactory->Release();
+        gDWriteFactory = nullptr;
+    }
+}
+
+static D2D1_COLOR_F ToD2DColor(Gdiplus::Color col) {
+    return D2D1::ColorF(col.GetR() / 255.f, col.GetG() / 255.f, col.GetB() / 255.f, col.GetA() / 255.f);
+}
+
+TextRenderDWrite* TextRenderDWrite::Create(Graphics* gfx) {
+    if (!InitDWriteFactories()) {
+        return nullptr;
+    }
+    // at 96 dpi, a DIP is a pixel of gfx
+    D2D1_RENDER_TARGET_PROPERTIES props =
+        D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
+                                     D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE), 96.f, 96.f);
+    ID2D1DCRenderTarget* target = nullptr;
+    HRESULT hr = gD2DFactory->CreateDCRenderTarget(&props, &target);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    TextRenderDWrite* res = new TextRenderDWrite();
+    res->gfx = gfx;
+    res->target = target;
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+TextRenderDWrite::~TextRenderDWrite() {
+    CrashIf(hdcGfxLocked); // hasn't been Unlock()ed
+    for (Format& f : formats) {
+        f.format->Release();
+    }
+    if (brush) {
+        brush->Release();
+    }
+    target->Release();
+}
+
+void TextRenderDWrite::SetFont(CachedFont* font) {
+    CrashIf(!font->font);
+    currFont = font;
+    for (int i = 0; i < formats.isize(); i++) {
+        if (formats[i].font == font) {
+            currFormat = i;
+            return;
+        }
+    }
+
+    currFormat = -1;
+    float emSize = GetEmSize(gfx, font);
+    if (emSize <= 0) {
+        emSize = font->GetSize() * 96.f / 72.f;
+    }
+    Gdiplus::FontStyle style = font->GetStyle();
+    DWRITE_FONT_WEIGHT weight = (style & Gdiplus::FontStyleBold) ? DWRITE_FONT_WEIGHT_BOLD : DWRITE_FONT_WEIGHT_NORMAL;
+    DWRITE_FONT_STYLE fontStyle = (style & Gdiplus::FontStyleItalic) ? DWRITE_FONT_STYLE_ITALIC : DWRITE_FONT_STYLE_NORMAL;
+    IDWriteTextFormat* format = nullptr;
+    HRESULT hr = gDWriteFactory->CreateTextFormat(font->GetName(), nullptr, weight, fontStyle,
+                                                  DWRITE_FONT_STRETCH_NORMAL, emSize, gDWriteLocale, &format);
+    if (FAILED(hr)) {
+        return;
+    }
+    format->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
+
+    Format f;
+    f.font = font;
+    f.format = format;
+    formats.Append(f);
+    currFormat = formats.isize() - 1;
+
+    ScopedComPtr<IDWriteTextLayout> layout(CreateLayout(L"x", 1, 0, false));
+    DWRITE_TEXT_METRICS m{};
+    if (layout && SUCCEEDED(layout->GetMetrics(&m))) {
+        formats[currFormat].lineSpacing = m.height;
+    }
+}
+
+IDWriteTextLayout* TextRenderDWrite::CreateLayout(const WCHAR* s, size_t sLen, float maxDx, bool isRtl) {
+    if (currFormat < 0) {
+        return nullptr;
+    }
+    IDWriteTextFormat* format = formats[currFormat].format;
+    format->SetReadingDirection(isRtl ? DWRITE_READING_DIRECTION_RIGHT_TO_LEFT : DWRITE_READING_DIRECTION_LEFT_TO_RIGHT);
+    IDWriteTextLayout* layout = nullptr;
+    HRESULT hr = gDWriteFactory->CreateTextLayout(s, (UINT32)sLen, format, std::max(maxDx, 1.f), 1.f, &layout);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    Gdiplus::FontStyle style = currFont->GetStyle();
+    DWRITE_TEXT_RANGE all = {0, (UINT32)sLen};
+    if (style & Gdiplus::FontStyleUnderline) {
+        layout->SetUnderline(TRUE, all);
+    }
+    if (style & Gdiplus::FontStyleStrikeout) {
+        layout->SetStrikethrough(TRUE, all);
+    }
+    return layout;
+}
+
+float TextRenderDWrite::GetCurrFontLineSpacing() {
+    if (currFormat < 0) {
+        return currFont->font->GetHeight(gfx);
+    }
+    return formats[currFormat].lineSpacing;
+}
+
+RectF TextRenderDWrite::Measure(const WCHAR* s, size_t sLen) {
+    CrashIf(!currFont);
+    ScopedComPtr<IDWriteTextLayout> layout(CreateLayout(s, sLen, 0, false));
+    DWRITE_TEXT_METRICS m{};
+    if (!layout || FAILED(layout->GetMetrics(&m))) {
+        return RectF(0, 0, 0, GetCurrFontLineSpacing());
+    }
+    return RectF(0, 0, m.widthIncludingTrailingWhitespace, m.height);
+}
+
+RectF TextRenderDWrite::Measure(const char* s, size_t sLen) {
+    WCHAR* buf = ToWstrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    return Measure(buf, strLen);
+}
+
+void TextRenderDWrite::SetTextColor(Gdiplus::Color col) {
+    textColor = col;
+    if (brush) {
+        brush->SetColor(ToD2DColor(col));
+    }
+}
+
+void TextRenderDWrite::Lock() {
+    CrashIf(hdcGfxLocked);
+    Gdiplus::Matrix m;
+    float el[6] = {1, 0, 0, 1, 0, 0};
+    gfx->GetTransform(&m);
+    m.GetElements(el);
+
+    hdcGfxLocked = gfx->GetHDC();
+    RECT rc{};
+    BITMAP bmp{};
+    HGDIOBJ hbmp = GetCurrentObject(hdcGfxLocked, OBJ_BITMAP);
+    if (hbmp && GetObject(hbmp, sizeof(bmp), &bmp) == sizeof(bmp)) {
+        rc = {0, 0, bmp.bmWidth, bmp.bmHeight};
+    } else {
+        GetClipBox(hdcGfxLocked, &rc);
+    }
+    target->BindDC(hdcGfxLocked, &rc);
+    target->BeginDraw();
+    target->SetTransform(D2D1::Matrix3x2F(el[0], el[1], el[2], el[3], el[4], el[5]));
+    if (!brush) {
+        target->CreateSolidColorBrush(ToD2DColor(textColor), &brush);
+    }
+}
+
+void TextRenderDWrite::Unlock() {
+    CrashIf(!hdcGfxLocked);
+    HRESULT hr = target->EndDraw();
+    if (hr == D2DERR_RECREATE_TARGET && brush) {
+        // the brush belongs to the lost device
+        brush->Release();
+        brush = nullptr;
+    }
+    gfx->ReleaseHDC(hdcGfxLocked);
+    hdcGfxLocked = nullptr;
+}
+
+void TextRenderDWrite::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl) {
+    CrashIf(!hdcGfxLocked); // hasn't been Lock()ed
+    if (!hdcGfxLocked || !brush) {
+        return;
+    }
+    ScopedComPtr<IDWriteTextLayout> layout(CreateLayout(s, sLen, bb.dx, isRtl));
+    if (!layout) {
+        return;
+    }
+    target->DrawTextLayout(D2D1::Point2F(bb.x, bb.y), layout, brush);
+}
+
+void TextRenderDWrite::Draw(const char* s, size_t sLen, const RectF bb, bool isRtl) {
+    WCHAR* buf = ToWstrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    Draw(buf, strLen, bb, isRtl);
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -491,6 +1245,17 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethod::Hdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethod::GlyphCache == method) {
+        res = TextRenderGlyphCache::Create(gfx);
+    }
+    if (TextRenderMethod::DWrite == method) {
+        res = TextRenderDWrite::Create(gfx);
+        if (!res) {
+            // layout and drawing fall back the same way, so text still fits
+            res = TextRenderGdiplus::Create(gfx, MeasureTextQuick);
+            method = TextRenderMethod::GdiplusQuick;
+        }
+    }
     CrashIf(!res);
     if (res) {
         res->method = method;
@@ -505,6 +1270,19 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
 // a smarter approach is possible, but this usually only does 3 MeasureText
 // calls, so it's not that bad
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx) {
+    GlyphAdvances* ga = textMeasure->GetAdvances(s, len);
+    if (ga) {
+        // widths of prefixes only grow so stop at the first that doesn't fit
+        float prefixDx = ga->overhead;
+        for (size_t i = 0; i < len; i++) {
+            prefixDx += ga->dx[s[i] - kGlyphAdvancesFirstChar];
+            if (prefixDx > dx) {
+                return i;
+            }
+        }
+        return len;
+    }
+
     RectF r = textMeasure->Measure(s, len);
     if (r.dx <= dx) {
         return len;
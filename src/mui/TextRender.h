@@ -1,13 +1,37 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+struct IDWriteTextFormat;
+struct IDWriteTextLayout;
+struct ID2D1DCRenderTarget;
+struct ID2D1SolidColorBrush;
+
 enum class TextRenderMethod {
     Gdiplus,      // uses MeasureTextAccurate, which is slower than MeasureTextQuick
     GdiplusQuick, // uses MeasureTextQuick
     Gdi,
     Hdc,
-    // TODO: implement TextRenderDirectDraw
-    // TextRenderDirectDraw
+    // measures like GdiplusQuick, draws cached glyphs directly into 32bpp DIBs
+    GlyphCache,
+    // DirectWrite for measuring, Direct2D for drawing
+    DWrite,
+};
+
+// chars whose widths are cached. Chars outside of this range (including
+// combining marks and complex scripts) are always measured
+constexpr WCHAR kGlyphAdvancesFirstChar = 0x21;
+constexpr WCHAR kGlyphAdvancesEndChar = 0x250;
+
+// widths of chars of a font, as measured by a given ITextRender, so that
+// the width of a string can be added up instead of being measured.
+// Neither GDI nor GDI+ apply kerning when measuring, so neither do we
+struct GlyphAdvances {
+    CachedFont* font = nullptr;
+    float dy = 0;
+    // added once per string (e.g. padding added by GDI+)
+    float overhead = 0;
+    // < 0 if not yet measured
+    float dx[kGlyphAdvancesEndChar - kGlyphAdvancesFirstChar];
 };
 
 class ITextRender {
@@ -36,10 +60,18 @@ class ITextRender {
     virtual void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) = 0;
     virtual void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) = 0;
 
-    virtual ~ITextRender() = default;
-    ;
+    virtual ~ITextRender();
+
+    // like Measure() but uses cached char widths of the current font
+    // if possible, which is much faster
+    RectF MeasureCached(const WCHAR* s, size_t sLen);
+    // returns nullptr if some chars of s are not cached
+    GlyphAdvances* GetAdvances(const WCHAR* s, size_t sLen);
 
     TextRenderMethod method = TextRenderMethod::Hdc;
+    // we don't own it
+    CachedFont* currFont = nullptr;
+    Vec<GlyphAdvances*> advancesCache;
 };
 
 class TextRenderGdi : public ITextRender {
@@ -47,7 +79,6 @@ class TextRenderGdi : public ITextRender {
     HDC hdcGfxLocked = nullptr;
     HDC hdcForTextMeasure = nullptr;
     HGDIOBJ hdcForTextMeasurePrevFont = nullptr;
-    CachedFont* currFont = nullptr;
     Gdiplus::Graphics* gfx = nullptr;
     Gdiplus::Color textColor;
     Gdiplus::Color textBgColor;
@@ -98,9 +129,8 @@ class TextRenderGdiplus : public ITextRender {
   private:
     TextMeasureAlgorithm measureAlgo = nullptr;
 
-    // We don't own gfx and currFont
+    // We don't own gfx
     Gdiplus::Graphics* gfx = nullptr;
-    CachedFont* currFont = nullptr;
     Gdiplus::Color textColor{};
     Gdiplus::Brush* textColorBrush = nullptr;
 
@@ -139,9 +169,8 @@ class TextRenderHdc : public ITextRender {
     HBITMAP bmp = nullptr;
     void* bmpData = nullptr;
 
-    // We don't own gfx and currFont
+    // We don't own gfx
     Gdiplus::Graphics* gfx = nullptr;
-    CachedFont* currFont = nullptr;
     Gdiplus::Color textColor{};
     Gdiplus::Color textBgColor{};
 
@@ -168,6 +197,108 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+// draws text by blending glyphs into the pixels of the 32bpp DIB that gfx draws to.
+// Glyphs are rasterized once per (font, size, subpixel offset) and cached for all
+// TextRenderGlyphCache instances. Text that can't be drawn that way (rotated gfx,
+// right-to-left or complex scripts) is drawn by GDI+
+class TextRenderGlyphCache : public ITextRender {
+  private:
+    // for measuring and as a fallback for drawing
+    TextRenderGdiplus* gdiplus = nullptr;
+    // We don't own gfx
+    Gdiplus::Graphics* gfx = nullptr;
+    Gdiplus::Color textColor{};
+
+    // set by Lock(), bmpData is nullptr if gfx doesn't draw to a 32bpp DIB.
+    // bmpData points to the top row and bmpStride is negative for bottom-up DIBs
+    u8* bmpData = nullptr;
+    int bmpDx = 0;
+    int bmpDy = 0;
+    int bmpStride = 0;
+    // maps text coordinates to pixels of the DIB
+    float scale = 1.f;
+    float offX = 0.f;
+    float offY = 0.f;
+    // GDI+ might not have drawn to the DIB yet
+    bool needsFlush = false;
+
+    TextRenderGlyphCache() = default;
+    bool DrawCached(const WCHAR* s, size_t sLen, RectF bb);
+
+  public:
+    static TextRenderGlyphCache* Create(Gdiplus::Graphics* gfx);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(__unused Gdiplus::Color col) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    // text is only drawn from the cache between Lock() and Unlock()
+    void Lock() override;
+    void Unlock() override;
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderGlyphCache() override;
+};
+
+// measures text with DirectWrite and draws it with Direct2D (which can use the GPU),
+// so text is drawn exactly as it has been measured. Between Lock() and Unlock()
+// a Direct2D render target draws to the HDC of gfx, so gfx can't be used then
+class TextRenderDWrite : public ITextRender {
+  private:
+    struct Format {
+        CachedFont* font = nullptr;
+        IDWriteTextFormat* format = nullptr;
+        float lineSpacing = 0;
+    };
+    Vec<Format> formats;
+    int currFormat = -1;
+
+    // We don't own gfx
+    Gdiplus::Graphics* gfx = nullptr;
+    Gdiplus::Color textColor{};
+
+    ID2D1DCRenderTarget* target = nullptr;
+    ID2D1SolidColorBrush* brush = nullptr;
+    HDC hdcGfxLocked = nullptr;
+
+    TextRenderDWrite() = default;
+    IDWriteTextLayout* CreateLayout(const WCHAR* s, size_t sLen, float maxDx, bool isRtl);
+
+  public:
+    // returns nullptr if DirectWrite or Direct2D aren't available
+    static TextRenderDWrite* Create(Gdiplus::Graphics* gfx);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(__unused Gdiplus::Color col) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override;
+    void Unlock() override;
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderDWrite() override;
+};
+
+void InitializeGlyphCache();
+void FreeGlyphCache();
+void FreeDWriteFactories();
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Archive.h"
+#include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/WinUtil.h"
 #include "mui/Mui.h"
@@ -13,6 +15,11 @@
 #include "DocController.h"
 #include "EngineBase.h"
 #include "EngineAll.h"
+#include "EbookBase.h"
+#include "EbookDoc.h"
+#include "FzImgReader.h"
+#include "ThumbnailStore.h"
+#include "Version.h"
 #include "Annotation.h"
 #include "RegistryPreview.h"
 
@@ -29,18 +36,69 @@ void _uploadDebugReportIfFunc(bool cond, __unused const char* condStr) {
     // no-op implementation to satisfy SubmitBugReport()
 }
 
+// renders page 1 with a fully loaded engine
+static RenderedBitmap* RenderThumbnailWithEngine(EngineBase* engine, Size size) {
+    RectF page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
+    float zoom = std::min(size.dx / (float)page.dx, size.dy / (float)page.dy) - 0.001f;
+    Rect thumb = RectF(0, 0, page.dx * zoom, page.dy * zoom).Round();
+    page = engine->Transform(ToRectF(thumb), 1, zoom, 0, true);
+    RenderPageArgs args(1, zoom, 0, &page);
+    return engine->RenderPage(args);
+}
+
+// the store is shared with SumatraPDF, which uses AppGenDataFilenameTemp(kThumbnailsDirName)
+static void InitPreviewThumbnailStore() {
+    char* dir = GetSpecialFolderTemp(CSIDL_LOCAL_APPDATA, true);
+    if (dir) {
+        dir = path::JoinTemp(dir, kAppName);
+        SetThumbnailStoreDir(path::JoinTemp(dir, kThumbnailsDirName));
+    }
+}
+
 IFACEMETHODIMP PreviewBase::GetThumbnail(uint cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) {
-    EngineBase* engine = GetEngine();
-    if (!engine) {
-        logf("PreviewBase::GetThumbnail: failed to get the engine\n");
+    Size size((int)cx, (int)cx);
+
+    // thumbnails of documents opened in SumatraPDF (or previously in Explorer)
+    // are in the thumbnail store, bigger requests are always rendered
+    ThumbnailKey key;
+    bool useStore = m_pStream && cx <= (uint)kThumbnailStoreDx;
+    if (useStore) {
+        InitPreviewThumbnailStore();
+        useStore = CalcThumbnailContentDigest(m_pStream, key.contentDigest);
+    }
+    RenderedBitmap* bmp = useStore ? LoadThumbnailFromStore(key, size, false) : nullptr;
+    if (bmp) {
+        logf("PreviewBase::GetThumbnail(cx=%d): from the thumbnail store\n", (int)cx);
+    } else {
+        Size renderSize = useStore ? Size(kThumbnailStoreDx, kThumbnailStoreDy) : size;
+        // Explorer asks for thumbnails of every file in a folder, so try
+        // to avoid loading the whole document first
+        bmp = m_pStream ? RenderThumbnail(m_pStream, renderSize) : nullptr;
+        if (bmp) {
+            logf("PreviewBase::GetThumbnail(cx=%d): used the fast path\n", (int)cx);
+        } else {
+            EngineBase* engine = GetEngine();
+            if (!engine) {
+                logf("PreviewBase::GetThumbnail: failed to get the engine\n");
+                return E_FAIL;
+            }
+            logf("PreviewBase::GetThumbnail(cx=%d, engine: %s\n", (int)cx, engine->kind);
+            bmp = RenderThumbnailWithEngine(engine, renderSize);
+        }
+        if (bmp && useStore) {
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            SaveThumbnailToStore(key, bmp, now);
+            RenderedBitmap* scaled = ScaleThumbnail(bmp, size, false);
+            delete bmp;
+            bmp = scaled;
+        }
+    }
+    if (!bmp) {
+        log("PreviewBase::GetThumbnail: failed to render the thumbnail\n");
         return E_FAIL;
     }
-
-    logf("PreviewBase::GetThumbnail(cx=%d, engine: %s\n", (int)cx, engine->kind);
-
-    RectF page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
-    float zoom = std::min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
-    Rect thumb = RectF(0, 0, page.dx * zoom, page.dy * zoom).Round();
+    Rect thumb = Rect(Point(), bmp->Size());
 
     BITMAPINFO bmi{};
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
@@ -54,15 +112,12 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(uint cx, HBITMAP* phbmp, WTS_ALPHATYPE*
     HBITMAP hthumb = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, (void**)&bmpData, nullptr, 0);
     if (!hthumb) {
         log("PreviewBase::GetThumbnail: CreateDIBSection() failed\n");
+        delete bmp;
         return E_OUTOFMEMORY;
     }
 
-    page = engine->Transform(ToRectF(thumb), 1, zoom, 0, true);
-    RenderPageArgs args(1, zoom, 0, &page);
-    RenderedBitmap* bmp = engine->RenderPage(args);
-
     HDC hdc = GetDC(nullptr);
-    if (bmp && GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
+    if (GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
         // cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
         for (int i = 0; i < thumb.dx * thumb.dy; i++) {
             bmpData[4 * i + 3] = 0xFF;
@@ -85,22 +140,51 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(uint cx, HBITMAP* phbmp, WTS_ALPHATYPE*
     return hthumb ? S_OK : E_NOTIMPL;
 }
 
+// the last few rendered pages are kept so that scrolling back and forth doesn't re-render them
+constexpr int kPreviewCacheSize = 5;
+
+struct PreviewCacheEntry {
+    int pageNo = 0;
+    Size size;
+    // nullptr if rendering failed (so that it isn't tried again)
+    RenderedBitmap* bmp = nullptr;
+    u64 lastUsed = 0;
+};
+
+// where a page of size page is shown, fitted into and centered in area
+static Rect GetPageOnScreen(Rect area, RectF page, float* zoomOut) {
+    float zoom = (float)std::min(area.dx / page.dx, area.dy / page.dy) - 0.001f;
+    Rect onScreen = RectF((float)area.x, (float)area.y, (float)page.dx * zoom, (float)page.dy * zoom).Round();
+    onScreen.Offset((area.dx - onScreen.dx) / 2, (area.dy - onScreen.dy) / 2);
+    *zoomOut = zoom;
+    return onScreen;
+}
+
+// renders pages on a background thread, so that the host process (Explorer, Outlook)
+// isn't blocked. After the visible page, the pages before and after it are rendered
 class PageRenderer {
     EngineBase* engine = nullptr;
     HWND hwnd = nullptr;
+    int pageCount = 0;
 
-    int currPage = 0;
-    RenderedBitmap* currBmp = nullptr;
-    // due to rounding differences, currBmp->Size() and currSize can differ slightly
-    Size currSize;
+    Vec<PreviewCacheEntry> cache;
+    u64 useCounter = 0;
+
+    // the page currently shown and the area it's shown in
     int reqPage = 0;
-    float reqZoom = 0.f;
-    Size reqSize = {};
-    bool reqAbort = false;
+    Rect reqArea;
+    // the page being rendered by the thread
+    int renderPage = 0;
+    Size renderSize;
     AbortCookie* abortCookie = nullptr;
+    bool renderAborted = false;
+    bool stop = false;
 
-    CRITICAL_SECTION currAccess;
+    // protects all of the above
+    CRITICAL_SECTION access;
     HANDLE thread = nullptr;
+    // signaled whenever the thread might have something to render
+    HANDLE wakeUp = nullptr;
 
     // seeking inside an IStream spins an inner event loop
     // which can cause reentrance in OnPaint and leave an
@@ -113,14 +197,30 @@ class PageRenderer {
     PageRenderer(EngineBase* engine, HWND hwnd) {
         this->engine = engine;
         this->hwnd = hwnd;
-        InitializeCriticalSection(&currAccess);
+        pageCount = engine->PageCount();
+        InitializeCriticalSection(&access);
+        wakeUp = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        thread = CreateThread(nullptr, 0, RenderThread, this, 0, nullptr);
     }
     ~PageRenderer() {
+        {
+            ScopedCritSec scope(&access);
+            stop = true;
+            if (abortCookie) {
+                abortCookie->Abort();
+                renderAborted = true;
+            }
+        }
         if (thread) {
+            SetEvent(wakeUp);
             WaitForSingleObject(thread, INFINITE);
+            CloseHandle(thread);
+        }
+        CloseHandle(wakeUp);
+        for (PreviewCacheEntry& e : cache) {
+            delete e.bmp;
         }
-        delete currBmp;
-        DeleteCriticalSection(&currAccess);
+        DeleteCriticalSection(&access);
     }
 
     RectF GetPageRect(int pageNo) {
@@ -136,56 +236,133 @@ class PageRenderer {
         return bbox;
     }
 
-    void Render(HDC hdc, Rect target, int pageNo, float zoom) {
-        log("PageRenderer::Render()\n");
-
-        ScopedCritSec scope(&currAccess);
-        if (currBmp && currPage == pageNo && currSize == target.Size()) {
-            currBmp->StretchDIBits(hdc, target);
-        } else if (!thread) {
+    // area is where the page is fitted into, target where it ends up
+    void Render(HDC hdc, Rect target, int pageNo, Rect area) {
+        ScopedCritSec scope(&access);
+        if (reqPage != pageNo || reqArea != area) {
             reqPage = pageNo;
-            reqZoom = zoom;
-            reqSize = target.Size();
-            reqAbort = false;
-            thread = CreateThread(nullptr, 0, RenderThread, this, 0, nullptr);
-        } else if (reqPage != pageNo || reqSize != target.Size()) {
-            if (abortCookie) {
+            reqArea = area;
+            // pages next to the new one are rendered afterwards anyway
+            bool isWanted = renderPage == pageNo && renderSize == target.Size();
+            if (renderPage != 0 && !isWanted && abortCookie) {
                 abortCookie->Abort();
+                renderAborted = true;
             }
-            reqAbort = true;
+            SetEvent(wakeUp);
+        }
+
+        PreviewCacheEntry* e = FindInCache(pageNo, target.Size());
+        if (!e) {
+            // e.g. after resizing the preview pane, show the page
+            // at its old size until it's been rendered again
+            e = FindInCache(pageNo, Size());
+        }
+        if (e && e->bmp) {
+            e->lastUsed = ++useCounter;
+            e->bmp->StretchDIBits(hdc, target);
         }
     }
 
   protected:
-    static DWORD WINAPI RenderThread(LPVOID data) {
-        log("PageRenderer::RenderThread started\n");
-        ScopedCom comScope; // because the engine reads data from a COM IStream
-
-        PageRenderer* pr = (PageRenderer*)data;
-        RenderPageArgs args(pr->reqPage, pr->reqZoom, 0, nullptr, RenderTarget::View, &pr->abortCookie);
-        RenderedBitmap* bmp = pr->engine->RenderPage(args);
-        if (!bmp) {
-            return 0;
+    // must be called with access held. An empty size matches any size
+    PreviewCacheEntry* FindInCache(int pageNo, Size size) {
+        for (PreviewCacheEntry& e : cache) {
+            if (e.pageNo == pageNo && (size.IsEmpty() || e.size == size)) {
+                return &e;
+            }
         }
+        return nullptr;
+    }
 
-        ScopedCritSec scope(&pr->currAccess);
+    // must be called with access held, takes ownership of bmp
+    void AddToCache(int pageNo, Size size, RenderedBitmap* bmp) {
+        PreviewCacheEntry* e = FindInCache(pageNo, Size());
+        if (!e && cache.isize() < kPreviewCacheSize) {
+            e = cache.AppendBlanks(1);
+        }
+        if (!e) {
+            e = &cache[0];
+            for (PreviewCacheEntry& e2 : cache) {
+                if (e2.lastUsed < e->lastUsed) {
+                    e = &e2;
+                }
+            }
+        }
+        delete e->bmp;
+        e->pageNo = pageNo;
+        e->size = size;
+        e->bmp = bmp;
+        e->lastUsed = ++useCounter;
+    }
 
-        if (!pr->reqAbort) {
-            delete pr->currBmp;
-            pr->currBmp = bmp;
-            pr->currPage = pr->reqPage;
-            pr->currSize = pr->reqSize;
-        } else {
-            delete bmp;
+    // finds the next page to render, the current one first
+    bool GetNextRequest(int* pageNoOut, float* zoomOut, Size* sizeOut) {
+        int pageNo;
+        Rect area;
+        {
+            ScopedCritSec scope(&access);
+            pageNo = reqPage;
+            area = reqArea;
+        }
+        if (pageNo == 0 || area.IsEmpty()) {
+            return false;
+        }
+        int candidates[3] = {pageNo, pageNo + 1, pageNo - 1};
+        for (int candidate : candidates) {
+            if (candidate < 1 || candidate > pageCount) {
+                continue;
+            }
+            RectF bbox = engine->Transform(engine->PageMediabox(candidate), candidate, 1.0, 0);
+            if (bbox.IsEmpty()) {
+                continue;
+            }
+            float zoom;
+            Size size = GetPageOnScreen(area, bbox, &zoom).Size();
+            ScopedCritSec scope(&access);
+            if (stop || !FindInCache(candidate, size)) {
+                *pageNoOut = candidate;
+                *zoomOut = zoom;
+                *sizeOut = size;
+                renderPage = candidate;
+                renderSize = size;
+                renderAborted = false;
+                return !stop;
+            }
         }
-        delete pr->abortCookie;
-        pr->abortCookie = nullptr;
+        return false;
+    }
 
-        HANDLE th = pr->thread;
-        pr->thread = nullptr;
-        PostMessageW(pr->hwnd, kUwmPaintAgain, 0, 0);
+    static DWORD WINAPI RenderThread(LPVOID data) {
+        log("PageRenderer::RenderThread started\n");
+        ScopedCom comScope; // because the engine reads data from a COM IStream
 
-        CloseHandle(th);
+        PageRenderer* pr = (PageRenderer*)data;
+        for (;;) {
+            WaitForSingleObject(pr->wakeUp, INFINITE);
+            int pageNo;
+            float zoom;
+            Size size;
+            while (pr->GetNextRequest(&pageNo, &zoom, &size)) {
+                RenderPageArgs args(pageNo, zoom, 0, nullptr, RenderTarget::View, &pr->abortCookie);
+                RenderedBitmap* bmp = pr->engine->RenderPage(args);
+
+                ScopedCritSec scope(&pr->access);
+                delete pr->abortCookie;
+                pr->abortCookie = nullptr;
+                pr->renderPage = 0;
+                // an aborted page is tried again if it's still needed
+                if (!pr->renderAborted || bmp) {
+                    pr->AddToCache(pageNo, size, bmp);
+                }
+                if (pageNo == pr->reqPage) {
+                    PostMessageW(pr->hwnd, kUwmPaintAgain, 0, 0);
+                }
+            }
+            ScopedCritSec scope(&pr->access);
+            if (pr->stop) {
+                break;
+            }
+        }
         DestroyTempAllocator();
         return 0;
     }
@@ -206,13 +383,12 @@ static LRESULT OnPaint(HWND hwnd) {
         RectF page = preview->renderer->GetPageRect(pageNo);
         if (!page.IsEmpty()) {
             rect.Inflate(-kPreviewMargin, -kPreviewMargin);
-            float zoom = (float)std::min(rect.dx / page.dx, rect.dy / page.dy) - 0.001f;
-            Rect onScreen = RectF((float)rect.x, (float)rect.y, (float)page.dx * zoom, (float)page.dy * zoom).Round();
-            onScreen.Offset((rect.dx - onScreen.dx) / 2, (rect.dy - onScreen.dy) / 2);
+            float zoom;
+            Rect onScreen = GetPageOnScreen(rect, page, &zoom);
 
             RECT rcPage = ToRECT(onScreen);
             FillRect(hdc, &rcPage, brushWhite);
-            preview->renderer->Render(hdc, onScreen, pageNo, zoom);
+            preview->renderer->Render(hdc, onScreen, pageNo, rect);
         }
     }
 
@@ -361,6 +537,10 @@ EngineBase* PdfPreview::LoadEngine(IStream* stream) {
     return CreateEngineMupdfFromStream(stream, "foo.pdf");
 }
 
+RenderedBitmap* PdfPreview::RenderThumbnail(IStream* stream, Size size) {
+    return EngineMupdfRenderThumbnail(stream, size);
+}
+
 #if 0
 EngineBase* XpsPreview::LoadEngine(IStream* stream) {
     return CreateEngineXpFromStream(stream);
@@ -387,6 +567,16 @@ EngineBase* EpubPreview::LoadEngine(IStream* stream) {
     return CreateEngineEpubFromStream(stream);
 }
 
+RenderedBitmap* EpubPreview::RenderThumbnail(IStream* stream, Size size) {
+    ByteSlice cover = EpubDoc::LoadCoverImage(stream);
+    if (!cover) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = ThumbnailFromData(cover, size);
+    cover.Free();
+    return bmp;
+}
+
 Fb2Preview::Fb2Preview(long* plRefCount) : PreviewBase(plRefCount, kFb2PreviewClsid) {
     m_gdiScope = new ScopedGdiPlus();
     mui::Initialize();
@@ -420,6 +610,16 @@ EngineBase* CbxPreview::LoadEngine(IStream* stream) {
     return CreateEngineCbxFromStream(stream);
 }
 
+RenderedBitmap* CbxPreview::RenderThumbnail(IStream* stream, Size size) {
+    ByteSlice data = EngineCbxLoadCoverImage(stream);
+    if (!data) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = ThumbnailFromData(data, size);
+    data.Free();
+    return bmp;
+}
+
 EngineBase* TgaPreview::LoadEngine(IStream* stream) {
     log("TgaPreview::LoadEngine()\n");
     return CreateEngineImageFromStream(stream);
@@ -174,6 +174,11 @@ class PreviewBase : public IThumbnailProvider,
     Rect m_rcParent;
 
     virtual EngineBase* LoadEngine(IStream* stream) = 0;
+    // fast path for GetThumbnail() that renders page 1 to fit into size without loading
+    // the whole document (returns nullptr to fall back to rendering with LoadEngine())
+    virtual RenderedBitmap* RenderThumbnail(__unused IStream* stream, __unused Size size) {
+        return nullptr;
+    }
 };
 
 class PdfPreview : public PreviewBase {
@@ -183,6 +188,7 @@ class PdfPreview : public PreviewBase {
 
   protected:
     EngineBase* LoadEngine(IStream* stream) override;
+    RenderedBitmap* RenderThumbnail(IStream* stream, Size size) override;
 };
 
 #if 0
@@ -213,6 +219,7 @@ class EpubPreview : public PreviewBase {
 
   protected:
     EngineBase* LoadEngine(IStream* stream) override;
+    RenderedBitmap* RenderThumbnail(IStream* stream, Size size) override;
 };
 
 class Fb2Preview : public PreviewBase {
@@ -241,6 +248,7 @@ class CbxPreview : public PreviewBase {
 
   protected:
     EngineBase* LoadEngine(IStream* stream) override;
+    RenderedBitmap* RenderThumbnail(IStream* stream, Size size) override;
 };
 
 class TgaPreview : public PreviewBase {
@@ -9,13 +9,18 @@ on presence of shared test files.
 Note: because it can be run as both release and debug, we can't use
 assert() or CrashIf() but CrashAlwaysIf().
 
+Each test runs in a separate process (SumatraPDF.exe -regress -regress-test ${name}),
+as many in parallel as there are cores. -regress-out saves the time and peak
+memory of each test, -regress-baseline compares them to a previous run.
+
 To write new regression test:
 - add a file src/regress/Regress${NN}.cpp with Regress${NN} function
-- #include "Regress${NN}.cpp" right before RunTest() function
-- call Regress${NN} function from RunTests()
+- #include "Regress${NN}.cpp" right before gRegressTests
+- add Regress${NN} function to gRegressTests
 */
 
 #include "utils/BaseUtil.h"
+#include <psapi.h>
 #include "utils/ScopedWin.h"
 #include "utils/WinDynCalls.h"
 #include "utils/Archive.h"
@@ -26,10 +31,12 @@ To write new regression test:
 #include "utils/HtmlParserLookup.h"
 #include "mui/Mui.h"
 #include "utils/WinUtil.h"
+#include "utils/Timer.h"
 
 #include "wingui/UIModels.h"
 
 #include "Settings.h"
+#include "Flags.h"
 #include "DocController.h"
 #include "EngineBase.h"
 #include "EbookBase.h"
@@ -43,15 +50,23 @@ To write new regression test:
 #include "TextSearch.h"
 
 static const char* gTestFilesDir;
+// true in the processes running a single test, which must not wait for input
+static bool gIsTestProcess = false;
 
 static const char* TestFilesDir() {
     return gTestFilesDir;
 }
 
+static void Pause() {
+    if (!gIsTestProcess) {
+        system("pause");
+    }
+}
+
 static int Usage() {
     printf("regress.exe\n");
     printf("Error: didn't find test files on this computer!\n");
-    system("pause");
+    Pause();
     return 1;
 }
 
@@ -78,7 +93,7 @@ static bool FindTestFilesDir() {
 static void VerifyFileExists(const char* filePath) {
     if (!file::Exists(filePath)) {
         printf("File '%s' doesn't exist!\n", filePath);
-        system("pause");
+        Pause();
         exit(1);
     }
 }
@@ -167,18 +182,38 @@ static void UninstallCrashHandler() {
 #include "Regress00.cpp"
 #include "Regress03.cpp"
 
-static void RunTests() {
-    Regress00();
-    Regress01();
-    Regress02();
-    Regress03();
-}
-
-int RegressMain() {
-    RedirectIOToConsole();
-
-    if (!FindTestFilesDir()) {
-        return Usage();
+struct RegressTest {
+    const char* name;
+    void (*fn)();
+};
+
+static RegressTest gRegressTests[] = {
+    {"Regress00", Regress00},
+    {"Regress01", Regress01},
+    {"Regress02", Regress02},
+    {"Regress03", Regress03},
+};
+
+struct RegressResult {
+    RegressTest* test = nullptr;
+    HANDLE process = nullptr;
+    LARGE_INTEGER start{};
+    DWORD exitCode = 0;
+    double timeMs = 0;
+    double peakMemMb = 0;
+};
+
+// runs a single test in this process (-regress-test)
+static int RunTest(const char* name) {
+    RegressTest* test = nullptr;
+    for (RegressTest& t : gRegressTests) {
+        if (str::EqI(t.name, name)) {
+            test = &t;
+        }
+    }
+    if (!test) {
+        printf("Error: unknown regression test '%s'\n", name);
+        return 2;
     }
 
     InstallCrashHandler();
@@ -186,12 +221,165 @@ int RegressMain() {
     ScopedGdiPlus gdi;
     mui::Initialize();
 
-    RunTests();
+    test->fn();
 
-    printflush("All tests completed successfully!\n");
     mui::Destroy();
     UninstallCrashHandler();
-
-    system("pause");
     return 0;
 }
+
+static void FinishTest(RegressResult& res) {
+    res.timeMs = TimeSinceInMs(res.start);
+    GetExitCodeProcess(res.process, &res.exitCode);
+    // the counters of a process can still be queried after it exited
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (GetProcessMemoryInfo(res.process, &pmc, sizeof(pmc))) {
+        res.peakMemMb = (double)pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+    SafeCloseHandle(&res.process);
+    printf("%s %s in %.0f ms, peak memory %.1f MB\n", res.test->name, res.exitCode == 0 ? "passed" : "FAILED",
+           res.timeMs, res.peakMemMb);
+    fflush(stdout);
+}
+
+// starts each test in its own process, at most as many at a time as there are cores
+static void RunTestsInParallel(RegressResult* results, int nTests) {
+    int maxRunning = std::clamp(GetPhysicalProcessorCount(), 1, MAXIMUM_WAIT_OBJECTS);
+    HANDLE running[MAXIMUM_WAIT_OBJECTS];
+    int runningIdx[MAXIMUM_WAIT_OBJECTS];
+    int nRunning = 0;
+    int next = 0;
+    while (next < nTests || nRunning > 0) {
+        while (next < nTests && nRunning < maxRunning) {
+            RegressResult& res = results[next];
+            AutoFreeStr cmdLine = str::Format("\"%s\" -regress -regress-test %s", GetExePathTemp(), res.test->name);
+            res.start = TimeGet();
+            res.process = LaunchProcess(cmdLine);
+            if (!res.process) {
+                printf("Error: failed to start %s\n", res.test->name);
+                res.exitCode = (DWORD)-1;
+            } else {
+                running[nRunning] = res.process;
+                runningIdx[nRunning] = next;
+                nRunning++;
+            }
+            next++;
+        }
+        if (nRunning == 0) {
+            continue;
+        }
+        DWORD n = WaitForMultipleObjects((DWORD)nRunning, running, FALSE, INFINITE);
+        int i = (int)(n - WAIT_OBJECT_0);
+        if (i < 0 || i >= nRunning) {
+            printf("Error: WaitForMultipleObjects() failed\n");
+            exit(1);
+        }
+        FinishTest(results[runningIdx[i]]);
+        nRunning--;
+        running[i] = running[nRunning];
+        runningIdx[i] = runningIdx[nRunning];
+    }
+}
+
+static bool SaveRegressResults(RegressResult* results, int nTests, const char* path) {
+    bool isJson = str::EndsWithI(path, ".json");
+    str::Str out;
+    out.Append(isJson ? "[\n" : "test,exit_code,time_ms,peak_mem_mb\n");
+    for (int i = 0; i < nTests; i++) {
+        RegressResult& res = results[i];
+        if (!isJson) {
+            out.AppendFmt("%s,%d,%.1f,%.1f\n", res.test->name, (int)res.exitCode, res.timeMs, res.peakMemMb);
+            continue;
+        }
+        out.AppendFmt("  {\"test\": \"%s\", \"exit_code\": %d, \"time_ms\": %.1f, \"peak_mem_mb\": %.1f}%s\n",
+                      res.test->name, (int)res.exitCode, res.timeMs, res.peakMemMb, i + 1 < nTests ? "," : "");
+    }
+    if (isJson) {
+        out.Append("]\n");
+    }
+    return file::WriteFile(path, out.AsByteSlice());
+}
+
+// compares the times to those in a .csv file saved with -regress-out
+// and returns the number of tests that got slower by more than tolerance percent
+static int CompareRegressResults(RegressResult* results, int nTests, const char* baselinePath, int tolerance) {
+    ByteSlice data = file::ReadFile(baselinePath);
+    if (data.empty()) {
+        printf("Error: failed to read %s\n", baselinePath);
+        return 0;
+    }
+    StrVec lines;
+    Split(lines, (const char*)data.data(), "\n", true);
+    data.Free();
+
+    printf("Comparison with %s (baseline -> current):\n", baselinePath);
+    int nRegressions = 0;
+    for (char* line : lines) {
+        str::TrimWSInPlace(line, str::TrimOpt::Right);
+        AutoFreeStr name;
+        int exitCode;
+        float timeMs, peakMemMb;
+        if (!str::Parse(line, "%S,%d,%f,%f", &name, &exitCode, &timeMs, &peakMemMb)) {
+            // e.g. the header
+            continue;
+        }
+        for (int i = 0; i < nTests; i++) {
+            RegressResult& res = results[i];
+            if (!str::EqI(res.test->name, name) || res.exitCode != 0) {
+                continue;
+            }
+            double diff = timeMs > 0 ? (res.timeMs - timeMs) * 100.0 / timeMs : 0;
+            // ignore noise in very short tests
+            bool isRegression = diff > tolerance && res.timeMs - timeMs > 50.0;
+            nRegressions += isRegression ? 1 : 0;
+            printf("%-12s %10.0f ms -> %10.0f ms (%+.1f%%)%s\n", res.test->name, timeMs, res.timeMs, diff,
+                   isRegression ? " REGRESSION" : "");
+        }
+    }
+    printf("%d regression(s)\n", nRegressions);
+    return nRegressions;
+}
+
+int RegressMain(Flags* flags) {
+    RedirectIOToConsole();
+    gIsTestProcess = flags->regressTest != nullptr;
+
+    if (!FindTestFilesDir()) {
+        return Usage();
+    }
+
+    if (gIsTestProcess) {
+        return RunTest(flags->regressTest);
+    }
+
+    int nTests = (int)dimof(gRegressTests);
+    RegressResult results[dimof(gRegressTests)];
+    for (int i = 0; i < nTests; i++) {
+        results[i].test = &gRegressTests[i];
+    }
+    RunTestsInParallel(results, nTests);
+
+    int nFailed = 0;
+    for (RegressResult& res : results) {
+        nFailed += res.exitCode != 0 ? 1 : 0;
+    }
+    if (flags->regressOutPath && !SaveRegressResults(results, nTests, flags->regressOutPath)) {
+        printf("Error: failed to save results to %s\n", flags->regressOutPath);
+    }
+    int nRegressions = 0;
+    if (flags->regressBaselinePath) {
+        nRegressions = CompareRegressResults(results, nTests, flags->regressBaselinePath, flags->regressTolerance);
+    }
+
+    if (nFailed > 0) {
+        printf("%d test(s) failed!\n", nFailed);
+    } else if (nRegressions > 0) {
+        printf("All tests passed but %d got slower!\n", nRegressions);
+    } else {
+        printflush("All tests completed successfully!\n");
+    }
+    fflush(stdout);
+
+    Pause();
+    return nFailed > 0 || nRegressions > 0 ? 1 : 0;
+}
@@ -12,6 +12,10 @@ static void RegressTestEpubLoading(const char *fileName)
     CrashAlwaysIf(!EpubDoc::IsSupportedFileType(kind));
     EpubDoc *doc = EpubDoc::CreateFromFile(filePath);
     CrashAlwaysIf(!doc);
+    // chapters are only loaded on demand
+    for (int i = 0; i < doc->GetChapterCount(); i++) {
+        doc->GetChapterHtml(i);
+    }
     delete doc;
 }
 
@@ -37,12 +41,19 @@ static void Regress00()
     EpubDoc *doc = EpubDoc::CreateFromFile(filePath);
     CrashAlwaysIf(!doc);
 
+    // the bug needs a layout across all chapters
+    str::Str html;
+    for (int i = 0; i < doc->GetChapterCount(); i++) {
+        ByteSlice chapter = doc->GetChapterHtml(i);
+        html.Append((const char*)chapter.data(), chapter.size());
+    }
+
     PoolAllocator textAllocator;
     HtmlFormatterArgs *args = CreateFormatterDefaultArgs(820, 920, &textAllocator);
     if (!args) {
         return;
     }
-    args->htmlStr = doc->GetHtmlData();
+    args->htmlStr = html.AsByteSlice();
     HtmlPage *pages[3];
     HtmlFormatter *formatter = new EpubFormatter(args, doc);
     int page = 0;
@@ -56,7 +67,7 @@ static void Regress00()
     CrashAlwaysIf(page != 3);
 
     args = CreateFormatterDefaultArgs(820, 920, &textAllocator);
-    args->htmlStr = doc->GetHtmlData();
+    args->htmlStr = html.AsByteSlice();
     args->reparseIdx = pages[2]->reparseIdx;
     formatter = new EpubFormatter(args, doc);
     // if bug is present, this will crash in formatter->Next()
@@ -24,6 +24,7 @@ extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
 extern void StrTest();
+extern void TextMatcherTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
 extern void WinUtilTest();
@@ -51,6 +52,7 @@ int main(__unused int argc, __unused char** argv) {
     SquareTreeTest();
     StrFormatTest();
     StrTest();
+    TextMatcherTest();
     TrivialHtmlParser_UnitTests();
     VecTest();
     WinUtilTest();
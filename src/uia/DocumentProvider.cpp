@@ -321,17 +321,16 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationDocumentProvider::GetVisibleRanges(
         return E_FAIL;
     }
 
-    // return all pages' ranges that are even partially visible
+    // return all pages' ranges that are even partially visible. Only
+    // the text of those pages is extracted (for their glyph counts)
     Vec<SumatraUIAutomationTextRange*> rangeArray;
-    SumatraUIAutomationPageProvider* it = child_first;
-    while (it && rangeArray.size() > ULONG_MAX) {
-        if (it->dm->GetPageInfo(it->pageNum) && it->dm->GetPageInfo(it->pageNum)->shown &&
-            it->dm->GetPageInfo(it->pageNum)->visibleRatio > 0.0f) {
-            rangeArray.Append(new SumatraUIAutomationTextRange(this, it->pageNum));
+    int lastPageNo = dm->LastVisiblePageNo();
+    for (int pageNo = dm->FirstVisiblePageNo(); pageNo > 0 && pageNo <= lastPageNo; pageNo++) {
+        PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+        if (pageInfo && pageInfo->shown && pageInfo->visibleRatio > 0.0f) {
+            rangeArray.Append(new SumatraUIAutomationTextRange(this, pageNo));
         }
-        it = it->sibling_next;
     }
-    CrashIf(ULONG_MAX == rangeArray.size());
 
     SAFEARRAY* psa = SafeArrayCreateVector(VT_UNKNOWN, 0, (ULONG)rangeArray.size());
     if (!psa) {
@@ -445,33 +445,51 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::GetText(int maxLength, B
         return E_FAIL;
     }
 
+    // -1 and [0, inf) are allowed
+    if (maxLength < -1) {
+        return E_INVALIDARG;
+    }
+
     if (IsNullRange() || IsEmptyRange()) {
         *text = SysAllocString(L""); // 0-sized not-null string
         return S_OK;
     }
 
-    TextSelection selection(document->GetDM()->GetEngine(), document->GetDM()->textCache);
-    selection.StartAt(startPage, startGlyph);
-    selection.SelectUpTo(endPage, endGlyph);
-
-    AutoFreeWstr selected_text(selection.ExtractText("\r\n"));
-    size_t selected_text_length = str::Len(selected_text);
-
-    // -1 and [0, inf) are allowed
-    if (maxLength > -2) {
-        if (maxLength != -1 && selected_text_length > (size_t)maxLength) {
-            selected_text[maxLength] = '\0'; // truncate
+    // screen readers often ask for a few chars of a range that covers the whole
+    // document, so only the text of the pages up to maxLength is extracted
+    auto cache = document->GetDM()->textCache;
+    if (endPage > startPage) {
+        // a reader walking through the document will likely want the following pages next
+        cache->StartPrefetch(startPage);
+    }
+    str::WStr s;
+    for (int page = startPage; page <= endPage; page++) {
+        if (maxLength != -1 && s.size() >= (size_t)maxLength) {
+            break;
         }
-
-        *text = SysAllocString(selected_text);
-        if (*text) {
-            return S_OK;
-        } else {
-            return E_OUTOFMEMORY;
+        int textLen;
+        const WCHAR* pageText = cache->GetTextForPage(page, &textLen);
+        int glyph = page == startPage ? startGlyph : 0;
+        int end = page == endPage ? std::min(endGlyph, textLen) : textLen;
+        if (page > startPage && s.size() > 0) {
+            s.Append(L"\r\n");
+        }
+        for (; glyph < end && (maxLength == -1 || s.size() < (size_t)maxLength); glyph++) {
+            if (pageText[glyph] == '\n') {
+                s.AppendChar('\r');
+            }
+            s.AppendChar(pageText[glyph]);
         }
-    } else {
-        return E_INVALIDARG;
     }
+    if (maxLength != -1 && s.size() > (size_t)maxLength) {
+        s.RemoveAt(maxLength, s.size() - maxLength); // truncate
+    }
+
+    *text = SysAllocString(s.Get());
+    if (!*text) {
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::Move(enum TextUnit unit, int count, int* moved) {
@@ -6,9 +6,12 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/CryptoUtil.h"
+#include "utils/Timer.h"
 
 #include "utils/Archive.h"
 
+#include "utils/Log.h"
+
 extern "C" {
 #include <unarr.h>
 }
@@ -21,6 +24,45 @@ extern "C" {
 // 3 is for absolute worst case of WCHAR* where last char was partially written
 #define ZERO_PADDING_COUNT 3
 
+// the list of files is saved if reading it took longer than that
+constexpr double kMinEntriesReadTimeMs = 50;
+// bump when the file layout changes
+constexpr u32 kEntriesCacheVersion = 1;
+constexpr u32 kEntriesCacheMagic = 0x43454153; // 'SAEC'
+constexpr u32 kEntriesCacheSolid = 0x1;
+constexpr u32 kEntriesCacheUnrarDll = 0x2;
+
+static char* gEntriesCacheDir = nullptr;
+
+/*
+Entries cache file layout (all values little-endian):
+
+EntriesCacheHeader
+for each file:
+  EntriesCacheFile
+  char name[nameLen] - not zero terminated
+*/
+
+struct EntriesCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 format;
+    u32 flags;
+    // the cache is only valid for the archive file it was created from
+    i64 archiveSize;
+    FILETIME archiveModTime;
+    u32 nFiles;
+    u32 reserved;
+};
+
+struct EntriesCacheFile {
+    i64 fileSizeUncompressed;
+    i64 filePos;
+    i64 fileTime;
+    u32 nameLen;
+    u32 reserved;
+};
+
 FILETIME MultiFormatArchive::FileInfo::GetWinFileTime() const {
     FILETIME ft = {(DWORD)-1, (DWORD)-1};
     LocalFileTimeToFileTime((FILETIME*)&fileTime, &ft);
@@ -32,6 +74,24 @@ MultiFormatArchive::MultiFormatArchive(archive_opener_t opener, MultiFormatArchi
     CrashIf(!opener);
     if (format == Format::Tar)
         loadOnOpen = true;
+    InitializeCriticalSection(&extractAccess_);
+    InitializeConditionVariable(&fileExtracted_);
+}
+
+void SetArchiveEntriesCacheDir(const char* dir) {
+    str::ReplaceWithCopy(&gEntriesCacheDir, dir);
+}
+
+// the caller must free()
+static char* GetEntriesCachePath(const char* archivePath) {
+    if (!gEntriesCacheDir) {
+        return nullptr;
+    }
+    AutoFreeStr pathLower = str::ToLower(archivePath);
+    u8 digest[16]{};
+    CalcMD5Digest(pathLower.Get(), str::Len(pathLower), digest);
+    AutoFreeStr name = str::MemToHex(digest, dimof(digest));
+    return path::Join(gEntriesCacheDir, str::JoinTemp(name, kArchiveEntriesCacheExt));
 }
 
 bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
@@ -39,19 +99,37 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     if (!data) {
         return false;
     }
+    if (archivePath) {
+        archivePath_ = str::Dup(&allocator_, archivePath);
+    }
+    if (LoadSavedEntries()) {
+        return true;
+    }
+    auto timeStart = TimeGet();
+    bool ok = ReadEntries();
+    if (ok && TimeSinceInMs(timeStart) >= kMinEntriesReadTimeMs) {
+        SaveEntries();
+    }
+    return ok;
+}
+
+bool MultiFormatArchive::ReadEntries() {
+    const char* archivePath = archivePath_;
     if ((format == Format::Rar) && archivePath) {
         bool ok = OpenUnrarFallback(archivePath);
         if (ok) {
             return true;
         }
     }
-    ar_ = opener_(data);
+    ar_ = opener_(data_);
     if (!ar_ || ar_at_eof(ar_)) {
         if (format == Format::Rar && archivePath) {
             return OpenUnrarFallback(archivePath);
         }
         return false;
     }
+    // unarr doesn't tell if a RAR archive is solid
+    isSolid = format == Format::Rar;
 
     size_t fileId = 0;
     while (ar_parse_entry(ar_)) {
@@ -66,6 +144,7 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
         i->fileTime = ar_entry_get_filetime(ar_);
         i->name = str::Dup(&allocator_, name);
         i->data = nullptr;
+        i->extractedPos = -1;
         fileInfos_.Append(i);
         // doesn't benchmark faster for .zip files but not much slower either
         // is probably faster for .tar.gz files
@@ -86,11 +165,123 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     return true;
 }
 
+// restores the list of files saved by SaveEntries() if the archive hasn't changed since
+bool MultiFormatArchive::LoadSavedEntries() {
+    if (!archivePath_ || loadOnOpen) {
+        return false;
+    }
+    AutoFreeStr cachePath = GetEntriesCachePath(archivePath_);
+    if (!cachePath) {
+        return false;
+    }
+    ByteSlice d = file::ReadFile(cachePath);
+    if (d.empty()) {
+        return false;
+    }
+    i64 archiveSize = file::GetSize(archivePath_);
+    FILETIME modTime = file::GetModificationTime(archivePath_);
+    const u8* curr = d.data();
+    const u8* end = curr + d.size();
+    EntriesCacheHeader hdr;
+    bool ok = d.size() >= sizeof(hdr);
+    if (ok) {
+        memcpy(&hdr, curr, sizeof(hdr));
+        curr += sizeof(hdr);
+        ok = hdr.magic == kEntriesCacheMagic && hdr.version == kEntriesCacheVersion && hdr.format == (u32)format &&
+             hdr.archiveSize == archiveSize && CompareFileTime(&hdr.archiveModTime, &modTime) == 0;
+    }
+    for (u32 fileId = 0; ok && fileId < hdr.nFiles; fileId++) {
+        EntriesCacheFile f;
+        ok = (size_t)(end - curr) >= sizeof(f);
+        if (!ok) {
+            break;
+        }
+        memcpy(&f, curr, sizeof(f));
+        curr += sizeof(f);
+        ok = (size_t)(end - curr) >= f.nameLen && f.fileSizeUncompressed >= 0;
+        if (!ok) {
+            break;
+        }
+        FileInfo* i = allocator_.AllocStruct<FileInfo>();
+        i->fileId = fileId;
+        i->fileSizeUncompressed = (size_t)f.fileSizeUncompressed;
+        i->filePos = f.filePos;
+        i->fileTime = f.fileTime;
+        i->name = str::Dup(&allocator_, (const char*)curr, f.nameLen);
+        i->data = nullptr;
+        i->extractedPos = -1;
+        fileInfos_.Append(i);
+        curr += f.nameLen;
+    }
+    d.Free();
+
+    if (ok && (hdr.flags & kEntriesCacheUnrarDll)) {
+        rarFilePath_ = archivePath_;
+    } else if (ok) {
+        // the files are uncompressed with unarr, which needs the archive opened
+        ar_ = opener_(data_);
+        ok = ar_ != nullptr;
+    }
+    if (!ok) {
+        fileInfos_.Reset();
+        file::Delete(cachePath);
+        return false;
+    }
+    isSolid = (hdr.flags & kEntriesCacheSolid) != 0;
+    return true;
+}
+
+void MultiFormatArchive::SaveEntries() {
+    if (!archivePath_ || loadOnOpen) {
+        return;
+    }
+    AutoFreeStr cachePath = GetEntriesCachePath(archivePath_);
+    if (!cachePath) {
+        return;
+    }
+    EntriesCacheHeader hdr{};
+    hdr.magic = kEntriesCacheMagic;
+    hdr.version = kEntriesCacheVersion;
+    hdr.format = (u32)format;
+    hdr.flags = (isSolid ? kEntriesCacheSolid : 0) | (LoadedUsingUnrarDll() ? kEntriesCacheUnrarDll : 0);
+    hdr.archiveSize = file::GetSize(archivePath_);
+    hdr.archiveModTime = file::GetModificationTime(archivePath_);
+    hdr.nFiles = (u32)fileInfos_.size();
+
+    str::Str d;
+    d.Append((const char*)&hdr, sizeof(hdr));
+    for (FileInfo* fi : fileInfos_) {
+        EntriesCacheFile f{};
+        f.fileSizeUncompressed = (i64)fi->fileSizeUncompressed;
+        f.filePos = fi->filePos;
+        f.fileTime = fi->fileTime;
+        f.nameLen = (u32)str::Len(fi->name);
+        d.Append((const char*)&f, sizeof(f));
+        d.Append(fi->name, f.nameLen);
+    }
+    if (dir::CreateForFile(cachePath)) {
+        file::WriteFile(cachePath, d.AsByteSlice());
+    }
+}
+
 MultiFormatArchive::~MultiFormatArchive() {
+    if (extractThread_) {
+        EnterCriticalSection(&extractAccess_);
+        abortExtracting_ = true;
+        LeaveCriticalSection(&extractAccess_);
+        WaitForSingleObject(extractThread_, INFINITE);
+        CloseHandle(extractThread_);
+    }
+    if (spillFile_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(spillFile_);
+    }
+    DeleteCriticalSection(&extractAccess_);
+
     ar_close_archive(ar_);
     ar_close(data_);
     for (auto& fi : fileInfos_) {
         free((void*)fi->data);
+        free(fi->extractedData);
     }
 }
 
@@ -132,9 +323,37 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
         fileInfo->data = nullptr;
         return res;
     }
+    return GetFileDataPartById(fileId, fileInfo->fileSizeUncompressed);
+}
+
+// the caller must free()
+ByteSlice MultiFormatArchive::GetFileDataPartById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
+        return {};
+    }
+    CrashIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    CrashIf(fileInfo->fileId != fileId);
+    size_t size = std::min(maxSize, fileInfo->fileSizeUncompressed);
+
+    if (fileInfo->data != nullptr) {
+        // already uncompressed on open; fileInfo keeps ownership
+        u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        if (!data) {
+            return {};
+        }
+        memcpy(data, fileInfo->data, size);
+        return {data, size};
+    }
+
+    ByteSlice extracted;
+    if (GetExtractedData(fileInfo, size, extracted)) {
+        return extracted;
+    }
 
     if (LoadedUsingUnrarDll()) {
-        return GetFileDataByIdUnarrDll(fileId);
+        return GetFileDataByIdUnarrDll(fileId, size);
     }
 
     if (!ar_) {
@@ -145,7 +364,6 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
     if (!ar_parse_entry_at(ar_, filePos)) {
         return {};
     }
-    size_t size = fileInfo->fileSizeUncompressed;
     if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
         return {};
     }
@@ -154,6 +372,7 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
         return {};
     }
     if (!ar_entry_uncompress(ar_, data, size)) {
+        free(data);
         return {};
     }
 
@@ -189,9 +408,19 @@ static ar_archive* ar_open_zip_archive_deflated(ar_stream* stream) {
     return ar_open_zip_archive(stream, true);
 }
 
+// reading from a file mapping avoids copying through a FILE buffer and
+// lets the OS read ahead in bigger chunks (which helps for network drives)
+static ar_stream* OpenFileStream(const WCHAR* path) {
+    ar_stream* stm = ar_open_file_mapped_w(path);
+    if (!stm) {
+        stm = ar_open_file_w(path);
+    }
+    return stm;
+}
+
 static MultiFormatArchive* open(MultiFormatArchive* archive, const char* path) {
     WCHAR* pathW = ToWstrTemp(path);
-    ar_stream* stm = ar_open_file_w(pathW);
+    ar_stream* stm = OpenFileStream(pathW);
     bool ok = archive->Open(stm, path);
     if (!ok) {
         delete archive;
@@ -261,6 +490,10 @@ struct Data {
     u8* d = nullptr;
     size_t sz = 0;
     u8* curr = nullptr;
+    // if true, only the first sz bytes of the file are wanted
+    bool partial = false;
+    // uncompressing is aborted when set
+    bool* abort = nullptr;
 };
 
 static size_t DataLeft(const Data& d) {
@@ -275,12 +508,22 @@ static int CALLBACK unrarCallback(UINT msg, LPARAM userData, LPARAM rarBuffer, L
         return -1;
     }
     Data* buf = (Data*)userData;
+    if (buf->abort && *buf->abort) {
+        return -1;
+    }
     size_t bytesGot = (size_t)bytesProcessed;
+    if (buf->partial) {
+        bytesGot = std::min(bytesGot, DataLeft(*buf));
+    }
     if (bytesGot > DataLeft(*buf)) {
         return -1;
     }
     memcpy(buf->curr, (char*)rarBuffer, bytesGot);
     buf->curr += bytesGot;
+    if (buf->partial && DataLeft(*buf) == 0) {
+        // got everything we wanted, abort uncompressing
+        return -1;
+    }
     return 1;
 }
 
@@ -300,14 +543,12 @@ static bool FindFile(HANDLE hArc, RARHeaderDataEx* rarHeader, const WCHAR* fileN
     }
 }
 
-ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId) {
+ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId, size_t maxSize) {
     CrashIf(!rarFilePath_);
 
     auto* fileInfo = fileInfos_[fileId];
     CrashIf(fileInfo->fileId != fileId);
-    if (fileInfo->data != nullptr) {
-        return {(u8*)fileInfo->data, fileInfo->fileSizeUncompressed};
-    }
+    CrashIf(fileInfo->data != nullptr);
 
     auto rarPath = ToWstrTemp(rarFilePath_);
 
@@ -333,8 +574,8 @@ ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId) {
     if (!ok) {
         goto Exit;
     }
-    size = fileInfo->fileSizeUncompressed;
-    CrashIf(size != rarHeader.UnpSize);
+    CrashIf(fileInfo->fileSizeUncompressed != rarHeader.UnpSize);
+    size = std::min(maxSize, fileInfo->fileSizeUncompressed);
     if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
         ok = false;
         goto Exit;
@@ -349,8 +590,10 @@ ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId) {
     uncompressedBuf.d = (u8*)data;
     uncompressedBuf.curr = (u8*)data;
     uncompressedBuf.sz = size;
+    uncompressedBuf.partial = size < fileInfo->fileSizeUncompressed;
     res = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
-    ok = (res == 0) && (DataLeft(uncompressedBuf) == 0);
+    // uncompressing a part of a file ends with an error after we abort it
+    ok = (res == 0 || uncompressedBuf.partial) && (DataLeft(uncompressedBuf) == 0);
 
 Exit:
     RARCloseArchive(hArc);
@@ -385,6 +628,7 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     if (!hArc || arcData.OpenResult != 0) {
         return false;
     }
+    isSolid = (arcData.Flags & ROADF_SOLID) != 0;
 
     size_t fileId = 0;
     while (true) {
@@ -404,6 +648,7 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
         i->fileTime = (i64)rarHeader.FileTime;
         i->name = str::Dup(&allocator_, name);
         i->data = nullptr;
+        i->extractedPos = -1;
         if (loadOnOpen) {
             // +2 so that it's zero-terminated even when interprted as WCHAR*
             i->data = AllocArray<char>(i->fileSizeUncompressed + 2);
@@ -425,3 +670,183 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     rarFilePath_ = str::Dup(&allocator_, rarPath);
     return true;
 }
+
+///// background extraction of solid archives /////
+
+bool MultiFormatArchive::StartExtractingAll(size_t maxMemSize) {
+    if (!archivePath_ || loadOnOpen || extractThread_) {
+        return false;
+    }
+    maxExtractedMemSize_ = maxMemSize;
+    isExtracting_ = true;
+    extractThread_ = CreateThread(nullptr, 0, ExtractAllThread, this, 0, nullptr);
+    if (!extractThread_) {
+        isExtracting_ = false;
+        return false;
+    }
+    return true;
+}
+
+DWORD WINAPI MultiFormatArchive::ExtractAllThread(LPVOID data) {
+    auto* archive = (MultiFormatArchive*)data;
+    auto timeStart = TimeGet();
+    if (archive->LoadedUsingUnrarDll()) {
+        archive->ExtractAllUnrarDll();
+    } else {
+        archive->ExtractAllUnarr();
+    }
+    logf("MultiFormatArchive: extracting all files took %.2f ms\n", TimeSinceInMs(timeStart));
+
+    // files that weren't extracted are uncompressed on demand again
+    EnterCriticalSection(&archive->extractAccess_);
+    archive->isExtracting_ = false;
+    LeaveCriticalSection(&archive->extractAccess_);
+    WakeAllConditionVariable(&archive->fileExtracted_);
+    DestroyTempAllocator();
+    return 0;
+}
+
+// uses its own ar_archive because ar_ might be used at the same time
+void MultiFormatArchive::ExtractAllUnarr() {
+    WCHAR* pathW = ToWstr(archivePath_);
+    ar_stream* stm = OpenFileStream(pathW);
+    free(pathW);
+    ar_archive* ar = stm ? opener_(stm) : nullptr;
+    size_t fileId = 0;
+    // files are parsed in the same order as in ReadEntries()
+    while (ar && !abortExtracting_ && fileId < fileInfos_.size() && ar_parse_entry(ar)) {
+        FileInfo* fi = fileInfos_[fileId++];
+        size_t size = fi->fileSizeUncompressed;
+        if (ar_entry_get_size(ar) != size || addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            break;
+        }
+        u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        if (!data || !ar_entry_uncompress(ar, data, size)) {
+            free(data);
+            continue;
+        }
+        SetExtracted(fi, data, size);
+    }
+    ar_close_archive(ar);
+    ar_close(stm);
+}
+
+void MultiFormatArchive::ExtractAllUnrarDll() {
+    WCHAR* pathW = ToWstr(rarFilePath_);
+    Data buf;
+    buf.abort = &abortExtracting_;
+    RAROpenArchiveDataEx arcData = {nullptr};
+    arcData.ArcNameW = pathW;
+    arcData.OpenMode = RAR_OM_EXTRACT;
+    arcData.Callback = unrarCallback;
+    arcData.UserData = (LPARAM)&buf;
+    HANDLE hArc = RAROpenArchiveEx(&arcData);
+    free(pathW);
+    if (!hArc || arcData.OpenResult != 0) {
+        return;
+    }
+
+    // files are listed in the same order as in OpenUnrarFallback()
+    for (size_t fileId = 0; !abortExtracting_ && fileId < fileInfos_.size(); fileId++) {
+        RARHeaderDataEx rarHeader{};
+        if (RARReadHeaderEx(hArc, &rarHeader) != 0) {
+            break;
+        }
+        FileInfo* fi = fileInfos_[fileId];
+        size_t size = fi->fileSizeUncompressed;
+        u8* data = nullptr;
+        if (rarHeader.UnpSizeHigh == 0 && rarHeader.UnpSize == size &&
+            !addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        }
+        if (!data) {
+            // in solid archives, skipping a file still uncompresses it
+            RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            continue;
+        }
+        buf.d = data;
+        buf.curr = data;
+        buf.sz = size;
+        int res = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
+        if (res != 0 || DataLeft(buf) != 0) {
+            free(data);
+            continue;
+        }
+        SetExtracted(fi, data, size);
+    }
+    RARCloseArchive(hArc);
+}
+
+static HANDLE CreateSpillFile() {
+    AutoFreeStr path = path::GetTempFilePath("sar");
+    if (!path) {
+        return INVALID_HANDLE_VALUE;
+    }
+    WCHAR* pathW = ToWstr(path);
+    DWORD flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr);
+    free(pathW);
+    return h;
+}
+
+// takes ownership of data
+void MultiFormatArchive::SetExtracted(FileInfo* fileInfo, u8* data, size_t size) {
+    ScopedCritSec scope(&extractAccess_);
+    if (extractedMemSize_ + size <= maxExtractedMemSize_) {
+        fileInfo->extractedData = data;
+        extractedMemSize_ += size;
+    } else {
+        if (spillFile_ == INVALID_HANDLE_VALUE) {
+            spillFile_ = CreateSpillFile();
+        }
+        LARGE_INTEGER pos;
+        pos.QuadPart = spillFileSize_;
+        DWORD nWritten = 0;
+        bool ok = spillFile_ != INVALID_HANDLE_VALUE && size <= UINT32_MAX &&
+                  SetFilePointerEx(spillFile_, pos, nullptr, FILE_BEGIN) &&
+                  WriteFile(spillFile_, data, (DWORD)size, &nWritten, nullptr) && nWritten == size;
+        free(data);
+        if (!ok) {
+            return;
+        }
+        fileInfo->extractedPos = spillFileSize_;
+        spillFileSize_ += (i64)size;
+    }
+    fileInfo->isExtracted = true;
+    WakeAllConditionVariable(&fileExtracted_);
+}
+
+// returns false if the file has to be uncompressed from the archive
+bool MultiFormatArchive::GetExtractedData(FileInfo* fileInfo, size_t size, ByteSlice& res) {
+    if (!extractThread_) {
+        return false;
+    }
+    ScopedCritSec scope(&extractAccess_);
+    // waiting is faster than uncompressing the solid block a second time
+    while (isExtracting_ && !fileInfo->isExtracted) {
+        SleepConditionVariableCS(&fileExtracted_, &extractAccess_, INFINITE);
+    }
+    if (!fileInfo->isExtracted) {
+        return false;
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return false;
+    }
+    if (fileInfo->extractedData) {
+        memcpy(data, fileInfo->extractedData, size);
+        res = {data, size};
+        return true;
+    }
+    LARGE_INTEGER pos;
+    pos.QuadPart = fileInfo->extractedPos;
+    DWORD nRead = 0;
+    bool ok = SetFilePointerEx(spillFile_, pos, nullptr, FILE_BEGIN) &&
+              ReadFile(spillFile_, data, (DWORD)size, &nRead, nullptr) && nRead == size;
+    if (!ok) {
+        free(data);
+        return false;
+    }
+    res = {data, size};
+    return true;
+}
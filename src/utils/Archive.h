@@ -21,6 +21,11 @@ class MultiFormatArchive {
         // internal use
         i64 filePos = 0;
         char* data = nullptr;
+        // set by the background extraction of solid archives. The data is
+        // either in extractedData or at extractedPos in the spill file
+        bool isExtracted = false;
+        u8* extractedData = nullptr;
+        i64 extractedPos = -1;
 
         FILETIME GetWinFileTime() const;
     };
@@ -38,12 +43,25 @@ class MultiFormatArchive {
 
     ByteSlice GetFileDataByName(const char* filename);
     ByteSlice GetFileDataById(size_t fileId);
+    // uncompresses at most the first maxSize bytes of a file e.g. to
+    // read its header without having to uncompress all of it
+    ByteSlice GetFileDataPartById(size_t fileId, size_t maxSize);
 
     const char* GetComment();
 
     // if true, will load and uncompress all files on open
     bool loadOnOpen = false;
 
+    // true if files are compressed together so that uncompressing a file
+    // requires uncompressing all the files stored before it
+    bool isSolid = false;
+
+    // uncompresses all files in the background, in the order in which they're
+    // stored, so that accessing them in random order doesn't uncompress the
+    // solid block again for each file. Keeps up to maxMemSize bytes in memory
+    // and the rest in a temporary file. Only for archives opened from a path
+    bool StartExtractingAll(size_t maxMemSize);
+
   protected:
     // used for allocating strings that are referenced by ArchFileInfo::name
     PoolAllocator allocator_;
@@ -53,16 +71,44 @@ class MultiFormatArchive {
     ar_stream* data_ = nullptr;
     ar_archive* ar_ = nullptr;
 
+    // only set when opened from a file
+    const char* archivePath_ = nullptr;
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
 
+    // protects the state of the background extraction
+    CRITICAL_SECTION extractAccess_;
+    CONDITION_VARIABLE fileExtracted_;
+    HANDLE extractThread_ = nullptr;
+    bool isExtracting_ = false;
+    bool abortExtracting_ = false;
+    size_t extractedMemSize_ = 0;
+    size_t maxExtractedMemSize_ = 0;
+    // files that don't fit in memory are appended to this temporary file
+    HANDLE spillFile_ = INVALID_HANDLE_VALUE;
+    i64 spillFileSize_ = 0;
+
+    bool ReadEntries();
+    bool LoadSavedEntries();
+    void SaveEntries();
     bool OpenUnrarFallback(const char* rarPathUtf);
-    ByteSlice GetFileDataByIdUnarrDll(size_t fileId);
+    ByteSlice GetFileDataByIdUnarrDll(size_t fileId, size_t maxSize);
     bool LoadedUsingUnrarDll() const {
         return rarFilePath_ != nullptr;
     }
+
+    static DWORD WINAPI ExtractAllThread(LPVOID data);
+    void ExtractAllUnarr();
+    void ExtractAllUnrarDll();
+    void SetExtracted(FileInfo* fileInfo, u8* data, size_t size);
+    bool GetExtractedData(FileInfo* fileInfo, size_t size, ByteSlice& res);
 };
 
+// if set, the list of files of archives that take long to open is saved
+// in this directory, so that it doesn't have to be read again next time
+void SetArchiveEntriesCacheDir(const char* dir);
+constexpr const char* kArchiveEntriesCacheExt = ".arcentries";
+
 MultiFormatArchive* OpenZipArchive(const char* path, bool deflatedOnly);
 MultiFormatArchive* Open7zArchive(const char* path);
 MultiFormatArchive* OpenTarArchive(const char* path);
@@ -7,6 +7,11 @@
 #ifndef NO_AVIF
 
 #include <libheif/heif.h>
+#include <libheif/heif_decoder_dav1d.h>
+
+void SetAvifDecodeThreads(int nThreads) {
+    heif_dav1d_set_max_threads(nThreads);
+}
 
 Size AvifSizeFromData(const ByteSlice& d) {
     Size res;
@@ -121,4 +126,6 @@ Size AvifSizeFromData(const ByteSlice&) {
 Gdiplus::Bitmap* AvifImageFromData(const ByteSlice&) {
     return nullptr;
 }
+void SetAvifDecodeThreads(int) {
+}
 #endif
@@ -3,3 +3,6 @@
 
 Size AvifSizeFromData(const ByteSlice&);
 Gdiplus::Bitmap* AvifImageFromData(const ByteSlice&);
+// limits the threads decoding a single image (0 for as many as there are logical
+// cores), for when several images are decoded at the same time
+void SetAvifDecodeThreads(int nThreads);
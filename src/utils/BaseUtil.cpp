@@ -85,12 +85,18 @@ void PoolAllocator::FreeAll() {
     currBlock = nullptr;
     firstBlock = nullptr;
     nAllocs = 0;
+    nResets++;
+    blocksSize = 0;
 }
 
 static size_t BlockHeaderSize() {
     return RoundUp(sizeof(PoolAllocator::Block), kPoolAllocatorAlign);
 }
 
+static size_t BlockSize(PoolAllocator::Block* block) {
+    return BlockHeaderSize() + block->dataSize;
+}
+
 // for easier debugging, poison the freed data with 0xdd
 // that way if the code tries to used the freed memory,
 // it's more likely to crash
@@ -155,6 +161,48 @@ void PoolAllocator::Reset(bool poisonFreedMemory) {
     ResetBlock(first);
     firstBlock = first;
     currBlock = first;
+    blocksSize = BlockSize(first);
+}
+
+PoolAllocator::Mark PoolAllocator::GetMark() {
+    ScopedCritSec scs(&cs);
+    Mark mark;
+    mark.block = currBlock;
+    if (currBlock) {
+        mark.freeSpace = currBlock->freeSpace;
+        mark.end = currBlock->end;
+        mark.blockNAllocs = currBlock->nAllocs;
+    }
+    mark.nAllocs = nAllocs;
+    mark.nResets = nResets;
+    return mark;
+}
+
+// frees everything allocated after GetMark() returned mark.
+// the block that was current at that point is kept for re-use
+void PoolAllocator::RewindTo(const Mark& mark) {
+    ScopedCritSec scs(&cs);
+    if (!mark.block) {
+        Reset(false);
+        return;
+    }
+    if (mark.nResets != nResets) {
+        // all allocations after the mark are already gone
+        return;
+    }
+    Block* curr = mark.block->next;
+    while (curr) {
+        Block* next = curr->next;
+        blocksSize -= BlockSize(curr);
+        free(curr);
+        curr = next;
+    }
+    mark.block->next = nullptr;
+    mark.block->freeSpace = mark.freeSpace;
+    mark.block->end = mark.end;
+    mark.block->nAllocs = mark.blockNAllocs;
+    currBlock = mark.block;
+    nAllocs = mark.nAllocs;
 }
 
 PoolAllocator::~PoolAllocator() {
@@ -208,6 +256,8 @@ void* PoolAllocator::Alloc(size_t size) {
         }
         block->dataSize = dataSize;
         ResetBlock(block);
+        blocksSize += BlockSize(block);
+        maxBlocksSize = std::max(blocksSize, maxBlocksSize);
         if (!firstBlock) {
             CrashIf(currBlock);
             firstBlock = block;
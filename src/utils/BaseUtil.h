@@ -399,9 +399,24 @@ struct PoolAllocator : Allocator {
         // data follows here
     };
 
+    // position to which RewindTo() frees allocations
+    struct Mark {
+        Block* block = nullptr;
+        char* freeSpace = nullptr;
+        char* end = nullptr;
+        size_t blockNAllocs = 0;
+        int nAllocs = 0;
+        // marks from before Reset() / FreeAll() are stale
+        int nResets = 0;
+    };
+
     Block* currBlock = nullptr;
     Block* firstBlock = nullptr;
     int nAllocs = 0;
+    int nResets = 0;
+    // size of all blocks and the most it has ever been
+    size_t blocksSize = 0;
+    size_t maxBlocksSize = 0;
     CRITICAL_SECTION cs;
 
     PoolAllocator();
@@ -414,6 +429,8 @@ struct PoolAllocator : Allocator {
 
     void FreeAll();
     void Reset(bool poisonFreedMemory = false);
+    Mark GetMark();
+    void RewindTo(const Mark& mark);
     void* At(int i);
 
     // only valid for structs, could alloc objects with
@@ -2,6 +2,9 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/CryptoUtil.h"
 
 #ifndef DWORD_MAX
@@ -9,15 +12,33 @@
 #endif
 
 // TODO: could use CryptoNG available starting in Vista
-static NO_INLINE void CalcDigestWin(const void* data, size_t dataSize, u8* digest, DWORD digestSize,
-                                    const WCHAR* provider, DWORD type, ALG_ID alg) {
-    HCRYPTPROV hProv = 0;
-    HCRYPTHASH hHash = 0;
+DigestCalc::DigestCalc(DigestKind kind) {
+    const WCHAR* provider = MS_DEF_PROV;
+    DWORD type = PROV_RSA_FULL;
+    ALG_ID alg = CALG_MD5;
+    digestSize = 16;
+    if (kind == DigestKind::SHA1) {
+        alg = CALG_SHA1;
+        digestSize = 20;
+    } else if (kind == DigestKind::SHA2) {
+        provider = MS_ENH_RSA_AES_PROV;
+        type = PROV_RSA_AES;
+        alg = CALG_SHA_256;
+        digestSize = 32;
+    }
     BOOL ok = CryptAcquireContextW(&hProv, nullptr, provider, type, CRYPT_VERIFYCONTEXT);
     CrashIf(!ok);
     ok = CryptCreateHash(hProv, alg, 0, 0, &hHash);
     CrashIf(!ok);
+}
 
+DigestCalc::~DigestCalc() {
+    CryptDestroyHash(hHash);
+    CryptReleaseContext(hProv, 0);
+}
+
+void DigestCalc::Update(const void* data, size_t dataSize) {
+    BOOL ok;
 #ifdef _WIN64
     for (; dataSize > DWORD_MAX; data = (const BYTE*)data + DWORD_MAX, dataSize -= DWORD_MAX) {
         ok = CryptHashData(hHash, (const BYTE*)data, DWORD_MAX, 0);
@@ -27,30 +48,214 @@ static NO_INLINE void CalcDigestWin(const void* data, size_t dataSize, u8* diges
     CrashIf(dataSize > DWORD_MAX);
     ok = CryptHashData(hHash, (const BYTE*)data, (DWORD)dataSize, 0);
     CrashIf(!ok);
+}
 
+void DigestCalc::Final(u8* digest) {
     DWORD hashLen = 0;
     DWORD argSize = sizeof(DWORD);
-    ok = CryptGetHashParam(hHash, HP_HASHSIZE, (BYTE*)&hashLen, &argSize, 0);
+    BOOL ok = CryptGetHashParam(hHash, HP_HASHSIZE, (BYTE*)&hashLen, &argSize, 0);
     CrashIf(sizeof(DWORD) != argSize);
     CrashIf(!ok);
     CrashIf(digestSize != hashLen);
     ok = CryptGetHashParam(hHash, HP_HASHVAL, digest, &hashLen, 0);
     CrashIf(!ok);
     CrashIf(digestSize != hashLen);
-    CryptDestroyHash(hHash);
-    CryptReleaseContext(hProv, 0);
 }
 
 void CalcMD5Digest(const void* data, size_t dataSize, u8 digest[16]) {
-    CalcDigestWin(data, dataSize, digest, 16, MS_DEF_PROV, PROV_RSA_FULL, CALG_MD5);
+    DigestCalc calc(DigestKind::MD5);
+    calc.Update(data, dataSize);
+    calc.Final(digest);
 }
 
 void CalcSHA1Digest(const void* data, size_t dataSize, u8 digest[20]) {
-    CalcDigestWin(data, dataSize, digest, 20, MS_DEF_PROV, PROV_RSA_FULL, CALG_SHA1);
+    DigestCalc calc(DigestKind::SHA1);
+    calc.Update(data, dataSize);
+    calc.Final(digest);
 }
 
 void CalcSHA2Digest(const void* data, size_t dataSize, u8 digest[32]) {
-    CalcDigestWin(data, dataSize, digest, 32, MS_ENH_RSA_AES_PROV, PROV_RSA_AES, CALG_SHA_256);
+    DigestCalc calc(DigestKind::SHA2);
+    calc.Update(data, dataSize);
+    calc.Final(digest);
+}
+
+constexpr DWORD kFileDigestBufSize = 1024 * 1024;
+
+bool CalcFileDigest(const char* path, DigestKind kind, u8* digest) {
+    AutoCloseHandle h = file::OpenReadOnly(path);
+    if (!h.IsValid()) {
+        return false;
+    }
+    AutoFree buf = AllocArray<char>(kFileDigestBufSize);
+    DigestCalc calc(kind);
+    while (true) {
+        DWORD nRead = 0;
+        if (!ReadFile(h, buf.Get(), kFileDigestBufSize, &nRead, nullptr)) {
+            return false;
+        }
+        if (nRead == 0) {
+            break;
+        }
+        calc.Update(buf.Get(), nRead);
+    }
+    calc.Final(digest);
+    return true;
+}
+
+// how much of the beginning, middle and the end of the file goes into its fingerprint
+constexpr int kFingerprintChunkSize = 64 * 1024;
+
+static bool HashFileChunk(HANDLE h, i64 off, DigestCalc& calc, char* buf) {
+    LARGE_INTEGER pos;
+    pos.QuadPart = off;
+    DWORD nRead = 0;
+    if (!SetFilePointerEx(h, pos, nullptr, FILE_BEGIN) || !ReadFile(h, buf, kFingerprintChunkSize, &nRead, nullptr)) {
+        return false;
+    }
+    calc.Update(buf, nRead);
+    return true;
+}
+
+// how many fingerprints CalcFileFingerprint() remembers
+constexpr int kMaxFileFingerprints = 64;
+
+struct FileFingerprint {
+    char* path = nullptr;
+    i64 size = 0;
+    FILETIME modTime{};
+    u8 digest[16]{};
+    // set while a thread is reading the file
+    bool isPending = false;
+
+    ~FileFingerprint() {
+        str::Free(path);
+    }
+};
+
+// the tile cache, the text cache, the ebook layout cache etc. all key on the
+// fingerprint of the same file, so it's only calculated once per version of the file
+struct FileFingerprints {
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE calculated;
+    // the most recently calculated are at the end
+    Vec<FileFingerprint*> fingerprints;
+
+    FileFingerprints() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&calculated);
+    }
+    ~FileFingerprints() {
+        DeleteVecMembers(fingerprints);
+        DeleteCriticalSection(&access);
+    }
+};
+
+static FileFingerprints gFileFingerprints;
+
+// must be called inside gFileFingerprints.access
+static FileFingerprint* FindFileFingerprint(const char* path, i64 size, FILETIME modTime) {
+    for (FileFingerprint* fp : gFileFingerprints.fingerprints) {
+        if (fp->size == size && CompareFileTime(&fp->modTime, &modTime) == 0 && str::EqI(fp->path, path)) {
+            return fp;
+        }
+    }
+    return nullptr;
+}
+
+// must be called inside gFileFingerprints.access
+static void FreeOldFileFingerprints() {
+    Vec<FileFingerprint*>& fingerprints = gFileFingerprints.fingerprints;
+    for (int i = 0; i < fingerprints.isize() && fingerprints.isize() > kMaxFileFingerprints;) {
+        FileFingerprint* fp = fingerprints[i];
+        if (fp->isPending) {
+            i++;
+            continue;
+        }
+        fingerprints.RemoveAt(i);
+        delete fp;
+    }
+}
+
+static bool HashFileFingerprint(HANDLE h, LARGE_INTEGER fileSize, FILETIME modTime, u8 digest[16]) {
+    DigestCalc calc(DigestKind::MD5);
+    calc.Update(&fileSize, sizeof(fileSize));
+    calc.Update(&modTime, sizeof(modTime));
+
+    char buf[kFingerprintChunkSize];
+    i64 size = fileSize.QuadPart;
+    if (!HashFileChunk(h, 0, calc, buf)) {
+        return false;
+    }
+    if (size > 3 * kFingerprintChunkSize && !HashFileChunk(h, (size - kFingerprintChunkSize) / 2, calc, buf)) {
+        return false;
+    }
+    if (size > kFingerprintChunkSize && !HashFileChunk(h, size - kFingerprintChunkSize, calc, buf)) {
+        return false;
+    }
+    calc.Final(digest);
+    return true;
+}
+
+// identifies the content of the file without reading all of it: hashes
+// the size, modification time and the first, middle and last 64 kB
+bool CalcFileFingerprint(const char* path, u8 digest[16]) {
+    AutoCloseHandle h = file::OpenReadOnly(path);
+    if (!h.IsValid()) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    FILETIME modTime;
+    if (!GetFileSizeEx(h, &fileSize) || !GetFileTime(h, nullptr, nullptr, &modTime)) {
+        return false;
+    }
+
+    FileFingerprints& ff = gFileFingerprints;
+    FileFingerprint* fp = nullptr;
+    {
+        ScopedCritSec scope(&ff.access);
+        fp = FindFileFingerprint(path, fileSize.QuadPart, modTime);
+        // another thread (e.g. PrefetchFileFingerprint()) is already reading the file
+        while (fp && fp->isPending) {
+            SleepConditionVariableCS(&ff.calculated, &ff.access, INFINITE);
+            fp = FindFileFingerprint(path, fileSize.QuadPart, modTime);
+        }
+        if (fp) {
+            memcpy(digest, fp->digest, sizeof(fp->digest));
+            return true;
+        }
+        fp = new FileFingerprint();
+        fp->path = str::Dup(path);
+        fp->size = fileSize.QuadPart;
+        fp->modTime = modTime;
+        fp->isPending = true;
+        ff.fingerprints.Append(fp);
+    }
+
+    bool ok = HashFileFingerprint(h, fileSize, modTime, digest);
+
+    ScopedCritSec scope(&ff.access);
+    if (ok) {
+        memcpy(fp->digest, digest, sizeof(fp->digest));
+        fp->isPending = false;
+    } else {
+        ff.fingerprints.Remove(fp);
+        delete fp;
+    }
+    FreeOldFileFingerprints();
+    WakeAllConditionVariable(&ff.calculated);
+    return ok;
+}
+
+// reads the file on a background thread so that the fingerprint is
+// ready by the time it's needed e.g. for loading cached tiles
+void PrefetchFileFingerprint(const char* path) {
+    char* pathCopy = str::Dup(path);
+    RunAsync([pathCopy] {
+        u8 digest[16];
+        CalcFileFingerprint(pathCopy, digest);
+        str::Free(pathCopy);
+    });
 }
 
 static bool ExtractSignature(const char* hexSignature, const void* data, size_t& dataLen, ScopedMem<BYTE>& signature,
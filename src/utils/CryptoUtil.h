@@ -1,9 +1,38 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+enum class DigestKind {
+    MD5,  // 16 bytes
+    SHA1, // 20 bytes
+    SHA2, // 32 bytes (SHA-256)
+};
+
+// calculates a digest of data that is passed in pieces,
+// e.g. while reading a file that might not fit in memory
+struct DigestCalc {
+    ULONG_PTR hProv = 0;
+    ULONG_PTR hHash = 0;
+    DWORD digestSize = 0;
+
+    explicit DigestCalc(DigestKind kind);
+    DigestCalc(const DigestCalc&) = delete;
+    DigestCalc& operator=(const DigestCalc&) = delete;
+    ~DigestCalc();
+
+    void Update(const void* data, size_t dataSize);
+    // can only be called once
+    void Final(u8* digest);
+};
+
 void CalcMD5Digest(const void* data, size_t dataSize, u8 digest[16]);
 void CalcSHA1Digest(const void* data, size_t dataSize, u8 digest[20]);
 void CalcSHA2Digest(const void* data, size_t dataSize, u8 digest[32]);
+// reads the file in chunks
+bool CalcFileDigest(const char* path, DigestKind kind, u8* digest);
+// a cheap substitute for a hash of the whole file
+// (remembered for the most recently used files)
+bool CalcFileFingerprint(const char* path, u8 digest[16]);
+void PrefetchFileFingerprint(const char* path);
 
 bool VerifySHA1Signature(const void* data, size_t dataLen, const char* hexSignature, const void* pubkey,
                          size_t pubkeyLen);
@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
 
@@ -169,6 +170,25 @@ const CssSelector* CssPullParser::NextSelector() {
     return &sel;
 }
 
+bool CompileCssSelector(const CssSelector* sel, StringInterner* classes, CssSelectorKey* key) {
+    if (Tag_NotFound == sel->tag) {
+        return false;
+    }
+    key->tag = sel->tag;
+    key->classId = -1;
+    if (sel->clazz) {
+        key->classId = classes->Intern(str::DupTemp(sel->clazz, sel->clazzLen));
+    }
+    return true;
+}
+
+int FindCssClassId(const StringInterner* classes, const char* clazz, size_t clazzLen) {
+    if (classes->StringsCount() == 0) {
+        return -1;
+    }
+    return classes->Find(str::DupTemp(clazz, clazzLen));
+}
+
 const CssProperty* CssPullParser::NextProperty() {
     if (currPos == s) {
         inlineStyle = inProps = true;
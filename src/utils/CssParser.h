@@ -12,6 +12,22 @@ struct CssSelector {
     size_t clazzLen = 0;
 };
 
+class StringInterner;
+
+// a selector reduced to what can be matched against a tag: the tag
+// and the class name interned in a StringInterner, so that matching
+// only compares integers
+struct CssSelectorKey {
+    HtmlTag tag = Tag_NotFound;
+    // -1 for selectors without a class
+    int classId = -1;
+};
+
+// returns false for selectors that can't be reduced to a tag and a class
+bool CompileCssSelector(const CssSelector* sel, StringInterner* classes, CssSelectorKey* key);
+// returns -1 for classes that no compiled selector uses
+int FindCssClassId(const StringInterner* classes, const char* clazz, size_t clazzLen);
+
 struct CssProperty {
     CssProp type = Css_Unknown;
     const char* s = nullptr;
@@ -10,202 +10,295 @@ just as well be a tree of some kind.
 Usually those things are done as a templated hash table class,
 but I want to avoid code bloat and awful syntax.
 
-The classes are based on a generic, untyped uintptr => uintptr
+The classes are based on a generic, untyped uintptr => int
 hash table. The actual dict class is a wrapper that provides
 a type-safe API and handles policy decisions like allocations
 (if they are necessary).
 
-Our hash table uses the same parameters as the one in redis
-(but without complexity of incremental hashing):
-- we use chaining on collisions
-- size of the hash table is power of two
+The hash table uses open addressing with a separate array of
+control bytes (like Abseil's "Swiss tables"):
+- size of the hash table is power of two and at least kGroupSize
+- each slot has a control byte that is kCtrlEmpty, kCtrlDeleted or
+  the low 7 bits of the hash of the key in that slot
+- we probe kGroupSize slots at a time, comparing their control bytes
+  with SSE2 (or a plain loop where SSE2 isn't available). Keys are only
+  compared when the control byte and the full hash (stored in the slot)
+  match, so there are very few string comparisons
+- hashing and comparing keys is a template parameter of the functions
+  in this file, so there are no virtual calls per probe
 
 TODO:
 - add iterator for keys/values
-- would hash function be faster if we got bytes one at a time
-  but only with a single pass vs. getting 4 at a time but
-  doing 2 passes (the first to calculate the length)?
 */
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
 
-namespace dict {
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
 
-class HasherComparator {
-  public:
-    virtual size_t Hash(uintptr_t key) = 0;
-    virtual bool Equal(uintptr_t k1, uintptr_t k2) = 0;
-    virtual ~HasherComparator() = default;
-};
+namespace dict {
 
-class StrKeyHasherComparator : public HasherComparator {
-    size_t Hash(uintptr_t key) override {
+struct StrKeyHasher {
+    static u32 Hash(uintptr_t key) {
         return MurmurHash2((const void*)key, str::Len((const char*)key));
     }
-    bool Equal(uintptr_t k1, uintptr_t k2) override {
-        const char* s1 = (const char*)k1;
-        const char* s2 = (const char*)k2;
-        return str::Eq(s1, s2);
+    static bool Equal(uintptr_t k1, uintptr_t k2) {
+        return str::Eq((const char*)k1, (const char*)k2);
     }
 };
 
-class WStrKeyHasherComparator : public HasherComparator {
-    size_t Hash(uintptr_t key) override {
+struct WStrKeyHasher {
+    static u32 Hash(uintptr_t key) {
         size_t cbLen = str::Len((const WCHAR*)key) * sizeof(WCHAR);
         return MurmurHash2((const void*)key, cbLen);
     }
-    bool Equal(uintptr_t k1, uintptr_t k2) override {
-        const WCHAR* s1 = (const WCHAR*)k1;
-        const WCHAR* s2 = (const WCHAR*)k2;
-        return str::Eq(s1, s2);
+    static bool Equal(uintptr_t k1, uintptr_t k2) {
+        return str::Eq((const WCHAR*)k1, (const WCHAR*)k2);
     }
 };
 
-static StrKeyHasherComparator gStrKeyHasherComparator;
-static WStrKeyHasherComparator gWStrKeyHasherComparator;
+constexpr int kGroupSize = 16;
+constexpr u8 kCtrlEmpty = 0x80;
+constexpr u8 kCtrlDeleted = 0xFE;
 
 struct HashTableEntry {
     uintptr_t key;
-    uintptr_t val;
-    struct HashTableEntry* next;
+    int val;
+    u32 hash;
 };
 
 // not a class so that it can be allocated with an allocator
 struct HashTable {
-    HashTableEntry** entries;
-    HashTableEntry* freeList;
+    // nSlots + kGroupSize control bytes. The last kGroupSize are a copy
+    // of the first ones so that a group can be loaded at any slot
+    u8* ctrl;
+    HashTableEntry* slots;
 
-    size_t nEntries;
-    size_t nUsed; // total number of inserted entries
+    size_t nSlots;
+    size_t nUsed;    // total number of inserted entries
+    size_t nDeleted; // slots marked kCtrlDeleted
 
     // for debugging
     size_t nResizes;
-    size_t nCollisions;
 };
 
+static inline u8 CtrlFromHash(u32 hash) {
+    return (u8)(hash & 0x7F);
+}
+
+// bit i is set if control byte i of the group at ctrl is v
+static inline u32 MatchGroup(const u8* ctrl, u8 v) {
+#if USE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)v)));
+#else
+    u32 res = 0;
+    for (int i = 0; i < kGroupSize; i++) {
+        if (ctrl[i] == v) {
+            res |= (1u << i);
+        }
+    }
+    return res;
+#endif
+}
+
+// bit i is set if slot i of the group at ctrl is empty or deleted
+static inline u32 MatchGroupFree(const u8* ctrl) {
+#if USE_SSE2
+    // kCtrlEmpty and kCtrlDeleted are the only ones with the high bit set
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (u32)_mm_movemask_epi8(group);
+#else
+    u32 res = 0;
+    for (int i = 0; i < kGroupSize; i++) {
+        if (ctrl[i] & 0x80) {
+            res |= (1u << i);
+        }
+    }
+    return res;
+#endif
+}
+
+static inline int LowestBit(u32 mask) {
+    DWORD idx;
+    BitScanForward(&idx, mask);
+    return (int)idx;
+}
+
+static void SetCtrl(HashTable* h, size_t pos, u8 v) {
+    h->ctrl[pos] = v;
+    if (pos < kGroupSize) {
+        h->ctrl[h->nSlots + pos] = v;
+    }
+}
+
+static bool AllocSlots(HashTable* h, size_t size) {
+    size = std::max(RoundToPowerOf2(size), (size_t)kGroupSize);
+    // entries are not allocated with allocator since those are large blocks
+    // and we don't want to waste their memory after
+    u8* ctrl = AllocArray<u8>(size + kGroupSize);
+    HashTableEntry* slots = AllocArray<HashTableEntry>(size);
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return false;
+    }
+    memset(ctrl, kCtrlEmpty, size + kGroupSize);
+    h->ctrl = ctrl;
+    h->slots = slots;
+    h->nSlots = size;
+    h->nDeleted = 0;
+    return true;
+}
+
 static HashTable* NewHashTable(size_t size, Allocator* allocator) {
     CrashIf(!allocator); // we'll leak otherwise
     HashTable* h = (HashTable*)Allocator::AllocZero(allocator, sizeof(HashTable));
-    // number of hash table entries should be power of 2
-    size = RoundToPowerOf2(size);
-    // entries are not allocated with allocator since those are large blocks
-    // and we don't want to waste their memory after
-    h->entries = AllocArray<HashTableEntry*>(size);
-    h->nEntries = size;
+    bool ok = AllocSlots(h, size);
+    CrashAlwaysIf(!ok);
     return h;
 }
 
 static void DeleteHashTable(HashTable* h) {
-    free(h->entries);
+    free(h->ctrl);
+    free(h->slots);
     // the rest is freed by allocator
 }
 
-static void HashTableResize(HashTable* h, HasherComparator* hc) {
-    size_t newSize = RoundToPowerOf2(h->nEntries + 1);
-    CrashIf(newSize <= h->nEntries);
-    HashTableEntry** newEntries = AllocArray<HashTableEntry*>(newSize);
-    HashTableEntry *e, *next;
-    size_t hash, pos;
-    for (size_t i = 0; i < h->nEntries; i++) {
-        e = h->entries[i];
-        while (e) {
-            next = e->next;
-            hash = hc->Hash(e->key);
-            pos = hash % newSize;
-            e->next = newEntries[pos];
-            newEntries[pos] = e;
-            e = next;
+// returns the slot with key or -1
+template <typename Hasher>
+static inline int FindSlot(HashTable* h, uintptr_t key, u32 hash) {
+    size_t mask = h->nSlots - 1;
+    size_t pos = (hash >> 7) & mask;
+    u8 c = CtrlFromHash(hash);
+    // triangular probing visits every group once
+    for (size_t step = kGroupSize;; step += kGroupSize) {
+        const u8* group = h->ctrl + pos;
+        u32 match = MatchGroup(group, c);
+        while (match != 0) {
+            size_t idx = (pos + LowestBit(match)) & mask;
+            HashTableEntry* e = &h->slots[idx];
+            if (e->hash == hash && Hasher::Equal(key, e->key)) {
+                return (int)idx;
+            }
+            match &= match - 1;
         }
+        if (MatchGroup(group, kCtrlEmpty) != 0) {
+            return -1;
+        }
+        if (step > h->nSlots) {
+            return -1;
+        }
+        pos = (pos + step) & mask;
     }
-    free(h->entries);
-    h->entries = newEntries;
-    h->nEntries = newSize;
-    h->nResizes += 1;
+}
+
+// returns the first empty or deleted slot for hash
+static size_t FindFreeSlot(HashTable* h, u32 hash) {
+    size_t mask = h->nSlots - 1;
+    size_t pos = (hash >> 7) & mask;
+    for (size_t step = kGroupSize;; step += kGroupSize) {
+        u32 match = MatchGroupFree(h->ctrl + pos);
+        if (match != 0) {
+            return (pos + LowestBit(match)) & mask;
+        }
+        pos = (pos + step) & mask;
+    }
+}
 
-    CrashIf(h->nUsed >= (h->nEntries * 3) / 2);
+static void HashTableResize(HashTable* h, size_t newSize) {
+    u8* oldCtrl = h->ctrl;
+    HashTableEntry* oldSlots = h->slots;
+    size_t oldSize = h->nSlots;
+    bool ok = AllocSlots(h, newSize);
+    CrashAlwaysIf(!ok);
+    // hashes are stored in slots so we don't have to re-hash the keys
+    for (size_t i = 0; i < oldSize; i++) {
+        if (oldCtrl[i] & 0x80) {
+            continue;
+        }
+        HashTableEntry* e = &oldSlots[i];
+        size_t idx = FindFreeSlot(h, e->hash);
+        SetCtrl(h, idx, CtrlFromHash(e->hash));
+        h->slots[idx] = *e;
+    }
+    free(oldCtrl);
+    free(oldSlots);
+    h->nResizes += 1;
 }
 
 // micro optimization: this is called often, so we want this check inlined. Resizing logic
 // is called rarely, so doesn't need to be inlined
-static inline void HashTableResizeIfNeeded(HashTable* h, HasherComparator* hc) {
-    // per http://stackoverflow.com/questions/1603712/when-should-i-do-rehashing-of-entire-hash-table/1604428#1604428
-    // when using collision chaining, load factor can be 150%
-    if (h->nUsed < (h->nEntries * 3) / 2) {
+static inline void HashTableResizeIfNeeded(HashTable* h) {
+    // with open addressing the load factor must stay well below 100%.
+    // deleted slots make probes longer just like used ones
+    size_t maxUsed = h->nSlots - h->nSlots / 8;
+    if (h->nUsed + h->nDeleted < maxUsed) {
         return;
     }
-    HashTableResize(h, hc);
+    // if it's mostly deleted slots, re-building at the same size is enough
+    size_t newSize = h->nSlots;
+    if (h->nUsed >= h->nSlots / 2) {
+        newSize = h->nSlots * 2;
+    }
+    HashTableResize(h, newSize);
 }
 
-// note: allocator must be nullptr for get, non-nullptr for create
-static HashTableEntry* GetOrCreateEntry(HashTable* h, HasherComparator* hc, uintptr_t key, Allocator* allocator,
-                                        bool& newEntry) {
-    bool shouldCreate = (allocator != nullptr);
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    newEntry = false;
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            return e;
-        }
-        e = e->next;
+// returns the entry for key and sets newEntry if it was just created.
+// the caller must set key and val of a new entry
+template <typename Hasher>
+static HashTableEntry* GetOrCreateEntry(HashTable* h, uintptr_t key, bool& newEntry) {
+    u32 hash = Hasher::Hash(key);
+    int idx = FindSlot<Hasher>(h, key, hash);
+    if (idx >= 0) {
+        newEntry = false;
+        return &h->slots[idx];
     }
-    if (!shouldCreate) {
-        return nullptr;
-    }
-
-    if (h->freeList) {
-        e = h->freeList;
-        h->freeList = h->freeList->next;
-    } else {
-        e = (HashTableEntry*)Allocator::AllocZero(allocator, sizeof(HashTableEntry));
+    HashTableResizeIfNeeded(h);
+    size_t pos = FindFreeSlot(h, hash);
+    if (h->ctrl[pos] == kCtrlDeleted) {
+        h->nDeleted--;
     }
-    e->next = h->entries[pos];
-    h->entries[pos] = e;
+    SetCtrl(h, pos, CtrlFromHash(hash));
+    HashTableEntry* e = &h->slots[pos];
+    e->hash = hash;
+    e->key = 0;
+    e->val = 0;
     h->nUsed++;
-    if (e->next != nullptr) {
-        h->nCollisions++;
-    }
     newEntry = true;
     return e;
 }
 
-static bool RemoveEntry(HashTable* h, HasherComparator* hc, uintptr_t key, uintptr_t* removedValOut) {
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            break;
-        }
-        e = e->next;
-    }
-    if (!e) {
-        return false;
-    }
+template <typename Hasher>
+static HashTableEntry* GetEntry(HashTable* h, uintptr_t key) {
+    u32 hash = Hasher::Hash(key);
+    int idx = FindSlot<Hasher>(h, key, hash);
+    return idx >= 0 ? &h->slots[idx] : nullptr;
+}
 
-    // remove the the entry from the list
-    HashTableEntry* e2 = h->entries[pos];
-    if (e2 == e) {
-        h->entries[pos] = e->next;
-    } else {
-        while (e2->next != e) {
-            e2 = e2->next;
-        }
-        e2->next = e->next;
+template <typename Hasher>
+static bool RemoveEntry(HashTable* h, uintptr_t key, int* removedValOut) {
+    u32 hash = Hasher::Hash(key);
+    int idx = FindSlot<Hasher>(h, key, hash);
+    if (idx < 0) {
+        return false;
     }
-    e->next = h->freeList;
-    h->freeList = e;
-    *removedValOut = e->val;
+    // the key was allocated from the allocator and is freed with it
+    *removedValOut = h->slots[idx].val;
+    SetCtrl(h, (size_t)idx, kCtrlDeleted);
+    h->nDeleted++;
     CrashIf(0 == h->nUsed);
     h->nUsed -= 1;
     return true;
 }
 
 MapStrToInt::MapStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -228,49 +321,44 @@ size_t MapStrToInt::Count() const {
 //   * sets existingKeyOut to (interned) key
 bool MapStrToInt::Insert(const char* key, int val, int* existingValOut, const char** existingKeyOut) {
     bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
+    HashTableEntry* e = GetOrCreateEntry<StrKeyHasher>(h, (uintptr_t)key, newEntry);
     if (!newEntry) {
         if (existingValOut) {
-            *existingValOut = (int)e->val;
+            *existingValOut = e->val;
         }
         if (existingKeyOut) {
             *existingKeyOut = (const char*)e->key;
         }
         return false;
     }
-    e->key = (intptr_t)str::Dup(&allocator, key);
-    e->val = (intptr_t)val;
+    e->key = (uintptr_t)str::Dup(&allocator, key);
+    e->val = val;
     if (existingKeyOut) {
         *existingKeyOut = (const char*)e->key;
     }
-
-    HashTableResizeIfNeeded(h, &gStrKeyHasherComparator);
     return true;
 }
 
 bool MapStrToInt::Remove(const char* key, int* removedValOut) const {
-    uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
+    int removedVal;
+    bool removed = RemoveEntry<StrKeyHasher>(h, (uintptr_t)key, &removedVal);
     if (removed && removedValOut) {
-        *removedValOut = (int)removedVal;
+        *removedValOut = removedVal;
     }
     return removed;
 }
 
 bool MapStrToInt::Get(const char* key, int* valOut) const {
-    StrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
+    HashTableEntry* e = GetEntry<StrKeyHasher>(h, (uintptr_t)key);
     if (!e) {
         return false;
     }
-    *valOut = (int)e->val;
+    *valOut = e->val;
     return true;
 }
 
 MapWStrToInt::MapWStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -284,42 +372,46 @@ size_t MapWStrToInt::Count() const {
 
 bool MapWStrToInt::Insert(const WCHAR* key, int val, int* prevVal) {
     bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
+    HashTableEntry* e = GetOrCreateEntry<WStrKeyHasher>(h, (uintptr_t)key, newEntry);
     if (!newEntry) {
         if (prevVal) {
-            *prevVal = (int)e->val;
+            *prevVal = e->val;
         }
         return false;
     }
-    e->key = (intptr_t)str::Dup(&allocator, key);
-    e->val = (intptr_t)val;
-
-    HashTableResizeIfNeeded(h, &gWStrKeyHasherComparator);
+    e->key = (uintptr_t)str::Dup(&allocator, key);
+    e->val = val;
     return true;
 }
 
 bool MapWStrToInt::Remove(const WCHAR* key, int* removedValOut) const {
-    uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
+    int removedVal;
+    bool removed = RemoveEntry<WStrKeyHasher>(h, (uintptr_t)key, &removedVal);
     if (removed && removedValOut) {
-        *removedValOut = (int)removedVal;
+        *removedValOut = removedVal;
     }
     return removed;
 }
 
 bool MapWStrToInt::Get(const WCHAR* key, int* valOut) const {
-    WStrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
+    HashTableEntry* e = GetEntry<WStrKeyHasher>(h, (uintptr_t)key);
     if (!e) {
         return false;
     }
-    *valOut = (int)e->val;
+    *valOut = e->val;
     return true;
 }
 
 } // namespace dict
 
+int StringInterner::Find(const char* s) const {
+    int idx;
+    if (!strToInt.Get(s, &idx)) {
+        return -1;
+    }
+    return idx;
+}
+
 int StringInterner::Intern(const char* s, bool* alreadyPresent) {
     nInternCalls++;
     int idx = (int)intToStr.size();
@@ -59,6 +59,8 @@ class StringInterner {
     StringInterner() = default;
 
     int Intern(const char* s, bool* alreadyPresent = nullptr);
+    // returns -1 if s hasn't been interned
+    int Find(const char* s) const;
     size_t StringsCount() const {
         return intToStr.size();
     }
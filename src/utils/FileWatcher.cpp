@@ -31,17 +31,18 @@ worker thread so must be protected via g_threadCritSec.
 ReadDirectChangesW() doesn't always work for files on network drives,
 so for those files, we do manual checks, by using a timeout to
 periodically wake up thread.
+
+A single write (e.g. copy f2.pdf f.pdf or a TeX run) generates several
+notifications, the first ones while the file is still being written.
+So a change only marks the file as pending and the callback is called
+once the file's size and time stamp haven't changed for a while and
+the file isn't open for writing anymore.
 */
 
 /*
 TODO:
   - should I end the thread when there are no files to watch?
 
-  - a single file copy can generate multiple notifications for the same
-    file. add some delay mechanism so that subsequent change notifications
-    cancel a previous, delayed one ? E.g. a copy f2.pdf f.pdf generates 3
-    notifications if f2.pdf is 2 MB.
-
   - try to handle short file names as well: http://blogs.msdn.com/b/ericgu/archive/2005/10/07/478396.aspx
     but how to test it?
 
@@ -52,6 +53,12 @@ TODO:
 
 // there's a balance between responsiveness to changes and efficiency
 #define FILEWATCH_DELAY_IN_MS 1000
+// a change is reported once the file hasn't changed for that long
+#define FILEWATCH_QUIET_IN_MS 300
+// how often files with pending changes are checked
+#define FILEWATCH_PENDING_CHECK_IN_MS 100
+// a change is reported even if the file is still being written to after that long
+#define FILEWATCH_MAX_PENDING_IN_MS 30000
 
 // Some people use overlapped.hEvent to store data but I'm playing it safe.
 struct OverlappedEx {
@@ -86,6 +93,13 @@ struct WatchedFile {
     bool isManualCheck = false;
     FileWatcherState fileState;
 
+    // set when a change was detected but not yet reported
+    bool isPending = false;
+    // state of the file when it last changed while pending
+    FileWatcherState pendingState;
+    u64 pendingSince = 0;
+    u64 lastChange = 0;
+
     bool ignore = false;
 };
 
@@ -135,6 +149,30 @@ static bool FileStateEq(FileWatcherState* fs1, FileWatcherState* fs2) {
     return true;
 }
 
+// true if another process has the file open for writing
+static bool IsFileBeingWritten(const char* path) {
+    WCHAR* pathW = ToWstrTemp(path);
+    // denying write sharing fails if a writer has it open
+    DWORD shareMode = FILE_SHARE_READ;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, shareMode, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return GetLastError() == ERROR_SHARING_VIOLATION;
+    }
+    CloseHandle(h);
+    return false;
+}
+
+// starts (or restarts) the wait for the file to settle
+static void MarkFileChanged(WatchedFile* wf) {
+    u64 now = GetTickCount64();
+    if (!wf->isPending) {
+        wf->isPending = true;
+        wf->pendingSince = now;
+    }
+    wf->lastChange = now;
+    GetFileState(wf->filePath, &wf->pendingState);
+}
+
 static bool FileStateChanged(const char* filePath, FileWatcherState* fs) {
     FileWatcherState fsTmp;
 
@@ -150,11 +188,6 @@ static bool FileStateChanged(const char* filePath, FileWatcherState* fs) {
 // TODO: per internet, fileName could be short, 8.3 dos-style name
 // and we don't handle that. On the other hand, I've only seen references
 // to it wrt. to rename/delete operation, which we don't get notified about
-//
-// TODO: to collapse multiple notifications for the same file, could put it on a
-// queue, restart the thread with a timeout, restart the process if we
-// get notified again before timeout expires, call OnFileChanges() when
-// timeout expires
 static void NotifyAboutFile(WatchedDir* d, const char* fileName) {
     int i = 0;
 
@@ -178,6 +211,39 @@ static void NotifyAboutFile(WatchedDir* d, const char* fileName) {
         // because the time granularity is so big that this can cause genuine
         // file notifications to be ignored. (This happens for instance for
         // PDF files produced by pdftex from small.tex document)
+        // so every notification counts as a change, reported by CheckPendingFiles()
+        MarkFileChanged(wf);
+    }
+}
+
+// calls the callback for files that have settled after a change
+static void CheckPendingFiles() {
+    ScopedCritSec cs(&g_threadCritSec);
+
+    u64 now = GetTickCount64();
+    for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+        if (!wf->isPending || now - wf->lastChange < FILEWATCH_QUIET_IN_MS) {
+            continue;
+        }
+        bool isTooLong = now - wf->pendingSince > FILEWATCH_MAX_PENDING_IN_MS;
+        if (!isTooLong) {
+            FileWatcherState fs;
+            GetFileState(wf->filePath, &fs);
+            if (!FileStateEq(&fs, &wf->pendingState)) {
+                wf->pendingState = fs;
+                wf->lastChange = now;
+                continue;
+            }
+            if (IsFileBeingWritten(wf->filePath)) {
+                wf->lastChange = now;
+                continue;
+            }
+        }
+        logf("CheckPendingFiles: '%s' changed\n", wf->filePath);
+        wf->isPending = false;
+        if (wf->isManualCheck) {
+            wf->fileState = wf->pendingState;
+        }
         wf->onFileChangedCb();
     }
 }
@@ -290,24 +356,37 @@ static void StartMonitoringDirForChanges(WatchedDir* wd) {
 
 static DWORD GetTimeoutInMs() {
     ScopedCritSec cs(&g_threadCritSec);
+    DWORD timeout = INFINITE;
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+        if (wf->isPending) {
+            return FILEWATCH_PENDING_CHECK_IN_MS;
+        }
         if (wf->isManualCheck) {
-            return FILEWATCH_DELAY_IN_MS;
+            timeout = FILEWATCH_DELAY_IN_MS;
         }
     }
-    return INFINITE;
+    return timeout;
 }
 
+static u64 gLastManualCheck = 0;
+
 static void RunManualChecks() {
     ScopedCritSec cs(&g_threadCritSec);
 
+    // the thread wakes up more often while there are pending files
+    u64 now = GetTickCount64();
+    if (now - gLastManualCheck < FILEWATCH_DELAY_IN_MS) {
+        return;
+    }
+    gLastManualCheck = now;
+
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
-        if (!wf->isManualCheck) {
+        if (!wf->isManualCheck || wf->isPending) {
             continue;
         }
         if (FileStateChanged(wf->filePath, &wf->fileState)) {
             // logf("RunManualCheck() %s changed\n", wf->filePath);
-            wf->onFileChangedCb();
+            MarkFileChanged(wf);
         }
     }
 }
@@ -322,6 +401,7 @@ static DWORD WINAPI FileWatcherThread(__unused void* param) {
         handles[0] = g_threadControlHandle;
         DWORD timeout = GetTimeoutInMs();
         DWORD obj = WaitForMultipleObjectsEx(1, handles, FALSE, timeout, alertable);
+        CheckPendingFiles();
         if (WAIT_TIMEOUT == obj) {
             RunManualChecks();
             continue;
@@ -265,7 +265,7 @@ static Gdiplus::RotateFlipType rfts[] = {
     Gdiplus::Rotate90FlipNone, Gdiplus::Rotate270FlipX,    Gdiplus::Rotate270FlipNone,
 };
 
-static Bitmap* WICDecodeImageFromStream(IStream* stream) {
+static Bitmap* WICDecodeImageFromStream(IStream* stream, Size scaledSize) {
     ScopedCom com;
     HRESULT hr;
     int iRot = -1;
@@ -296,8 +296,23 @@ static Bitmap* WICDecodeImageFromStream(IStream* stream) {
         }
     }
 
+    // scaling while decoding is much faster than decoding at full size and
+    // scaling later (and the jpeg decoder can skip some of the decoding)
+    IWICBitmapSource* src = srcFrame;
+    ScopedComPtr<IWICBitmapScaler> pScaler;
+    if (!scaledSize.IsEmpty()) {
+        // like BitmapSizeFromHeader(), scaledSize ignores the orientation
+        uint srcDx, srcDy;
+        HR(srcFrame->GetSize(&srcDx, &srcDy));
+        if ((uint)scaledSize.dx < srcDx || (uint)scaledSize.dy < srcDy) {
+            HR(pFactory->CreateBitmapScaler(&pScaler));
+            HR(pScaler->Initialize(srcFrame, (uint)scaledSize.dx, (uint)scaledSize.dy, WICBitmapInterpolationModeFant));
+            src = pScaler;
+        }
+    }
+
     HR(pFactory->CreateFormatConverter(&pConverter));
-    HR(pConverter->Initialize(srcFrame, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, nullptr, 0.f,
+    HR(pConverter->Initialize(src, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, nullptr, 0.f,
                               WICBitmapPaletteTypeCustom));
 
     uint w, h;
@@ -350,13 +365,13 @@ static void MaybeFlipBitmap(Bitmap* bmp) {
     }
 }
 
-static Bitmap* DecodeWithWIC(const ByteSlice& bmpData) {
+static Bitmap* DecodeWithWIC(const ByteSlice& bmpData, Size scaledSize) {
     auto strm = CreateStreamFromData(bmpData);
     ScopedComPtr<IStream> stream(strm);
     if (!stream) {
         return nullptr;
     }
-    auto bmp = WICDecodeImageFromStream(stream);
+    auto bmp = WICDecodeImageFromStream(stream, scaledSize);
     return bmp;
 }
 
@@ -378,7 +393,9 @@ static Bitmap* DecodeWithGdiplus(const ByteSlice& bmpData) {
     return bmp;
 }
 
-Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
+// if scaledSize isn't empty, decoders that can scale while decoding (WIC and webp)
+// return a bitmap of scaledSize. Others return the full size bitmap
+Bitmap* BitmapFromDataWin(const ByteSlice& bmpData, Size scaledSize) {
     Bitmap* bmp = nullptr;
 
     Kind kind = GuessFileTypeFromContent(bmpData);
@@ -389,7 +406,7 @@ Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
         }
     }
     if (kindFileWebp == kind) {
-        bmp = webp::ImageFromData(bmpData);
+        bmp = webp::ImageFromData(bmpData, scaledSize);
         if (bmp) {
             return bmp;
         }
@@ -408,7 +425,7 @@ Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
         bmp = DecodeWithGdiplus(bmpData);
     }
     if (!bmp) {
-        bmp = DecodeWithWIC(bmpData);
+        bmp = DecodeWithWIC(bmpData, scaledSize);
     }
     if (!bmp && !tryGdiplusFirst) {
         bmp = DecodeWithGdiplus(bmpData);
@@ -583,8 +600,10 @@ static bool AvifSizeFromData(ByteReader r, Size& result) {
     return !result.IsEmpty();
 }
 
+// only parses the image header, so d can be just the beginning of the data
+// returns an empty size if the size isn't known from the header
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const ByteSlice& d) {
+Size BitmapSizeFromHeader(const ByteSlice& d) {
     Size result;
     bool ok = false;
     Kind kind = GuessFileTypeFromContent(d);
@@ -609,7 +628,15 @@ Size BitmapSizeFromData(const ByteSlice& d) {
     } else if (kind == kindFileAvif || kind == kindFileHeic) {
         ok = AvifSizeFromData(r, result);
     }
-    if (ok && !result.IsEmpty()) {
+    if (!ok) {
+        return Size();
+    }
+    return result;
+}
+
+Size BitmapSizeFromData(const ByteSlice& d) {
+    Size result = BitmapSizeFromHeader(d);
+    if (!result.IsEmpty()) {
         return result;
     }
 
@@ -19,7 +19,8 @@ RectF MeasureText(Gdiplus::Graphics* g, Gdiplus::Font* f, const WCHAR* s, size_t
 
 void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, int rotation);
 
-Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData);
+Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData, Size scaledSize = Size());
 Size BitmapSizeFromData(const ByteSlice&);
+Size BitmapSizeFromHeader(const ByteSlice&);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);
@@ -3,6 +3,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/ByteReader.h"
 #include "utils/Archive.h"
@@ -318,6 +319,169 @@ Kind GuessFileTypeFromContent(const ByteSlice& d) {
     return nullptr;
 }
 
+// trailing whitespace is allowed for the mimetype file
+static bool IsEpubMimeType(const char* s, size_t n) {
+    while (n > 0 && str::IsWs(s[n - 1])) {
+        n--;
+    }
+    // also open renamed .ibooks files
+    // http://en.wikipedia.org/wiki/IBooks#Formats
+    return (n == 20 && str::EqN(s, "application/epub+zip", n)) ||
+           (n == 24 && str::EqN(s, "application/x-ibooks+zip", n));
+}
+
+static bool ReadAt(HANDLE h, i64 off, u8* buf, size_t n) {
+    LARGE_INTEGER pos;
+    pos.QuadPart = off;
+    if (!SetFilePointerEx(h, pos, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    DWORD nRead = 0;
+    BOOL ok = ::ReadFile(h, buf, (DWORD)n, &nRead, nullptr);
+    return ok && nRead == (DWORD)n;
+}
+
+// if this is the stored "mimetype" entry (which a proper EPUB has as its
+// first entry), returns true and sets isEpub. d starts at its local file header
+static bool CheckEpubMimeTypeEntry(const ByteSlice& d, u32 compSize, bool& isEpub) {
+    ByteReader r(d);
+    if (d.size() < 30 || r.DWordLE(0) != 0x04034b50) {
+        return false;
+    }
+    u16 method = r.WordLE(8);
+    size_t nameLen = r.WordLE(26);
+    size_t dataOff = 30 + nameLen + r.WordLE(28);
+    if (nameLen != 8 || d.size() < 30 + nameLen || !str::EqN((const char*)d.data() + 30, "mimetype", 8)) {
+        return false;
+    }
+    if (compSize == (u32)-1) {
+        compSize = r.DWordLE(18);
+    }
+    if (method != 0 || d.size() < dataOff + compSize) {
+        return false;
+    }
+    isEpub = IsEpubMimeType((const char*)d.data() + dataOff, compSize);
+    return true;
+}
+
+// instead of opening the whole archive (which parses the central directory into
+// MultiFormatArchive::FileInfo and would be done again by the engine), only reads
+// the end of central directory record and the file names in the central directory.
+// Returns nullptr if the .zip file is unusual (e.g. zip64) and has to be opened
+static Kind SniffZipArchive(const char* path, const ByteSlice& hdr) {
+    // fast path for a proper EPUB
+    bool isEpub = false;
+    if (CheckEpubMimeTypeEntry(hdr, (u32)-1, isEpub) && isEpub) {
+        return kindFileEpub;
+    }
+
+    AutoCloseHandle h = file::OpenReadOnly(path);
+    LARGE_INTEGER fileSize;
+    if (!h.IsValid() || !GetFileSizeEx(h, &fileSize)) {
+        return nullptr;
+    }
+    // the end of central directory record is followed by a comment of up to 64 kB
+    i64 size = fileSize.QuadPart;
+    size_t tailLen = (size_t)std::min(size, (i64)22 + 65535);
+    if (tailLen < 22) {
+        return nullptr;
+    }
+    u8* tail = AllocArray<u8>(tailLen);
+    AutoFree tailFree(tail);
+    if (!ReadAt(h, size - (i64)tailLen, tail, tailLen)) {
+        return nullptr;
+    }
+    ByteReader r(tail, tailLen);
+    size_t eocd = tailLen - 22;
+    while (eocd > 0 && r.DWordLE(eocd) != 0x06054b50) {
+        eocd--;
+    }
+    if (r.DWordLE(eocd) != 0x06054b50) {
+        return nullptr;
+    }
+    u32 nEntries = r.WordLE(eocd + 10);
+    u32 cdSize = r.DWordLE(eocd + 12);
+    u32 cdOff = r.DWordLE(eocd + 16);
+    if (nEntries == 0xffff || cdOff == 0xffffffff || (i64)cdOff + cdSize > size) {
+        return nullptr;
+    }
+    // archives this big are comic books or plain .zip files
+    if (cdSize > 8 * 1024 * 1024) {
+        return kindFileZip;
+    }
+
+    u8* cd = AllocArray<u8>(cdSize + 1);
+    AutoFree cdFree(cd);
+    if (!ReadAt(h, cdOff, cd, cdSize)) {
+        return nullptr;
+    }
+    r = ByteReader(cd, cdSize);
+    bool isXps = false;
+    bool hasContainer = false;
+    i64 mimetypeOff = -1;
+    u32 mimetypeSize = 0;
+    const char* fileName = nullptr;
+    size_t fileNameLen = 0;
+    int nFiles = 0;
+    size_t off = 0;
+    for (u32 i = 0; i < nEntries; i++) {
+        if (off + 46 > cdSize || r.DWordLE(off) != 0x02014b50) {
+            return nullptr;
+        }
+        size_t nameLen = r.WordLE(off + 28);
+        size_t entryLen = 46 + nameLen + r.WordLE(off + 30) + r.WordLE(off + 32);
+        if (off + entryLen > cdSize) {
+            return nullptr;
+        }
+        const char* name = (const char*)cd + off + 46;
+        AutoFreeStr s = str::Dup(name, nameLen);
+        if (str::EqI(s, "_rels/.rels") || str::EqI(s, "_rels/.rels/[0].piece") ||
+            str::EqI(s, "_rels/.rels/[0].last.piece")) {
+            isXps = true;
+        } else if (str::EqI(s, "META-INF/container.xml")) {
+            hasContainer = true;
+        } else if (str::EqI(s, "mimetype")) {
+            mimetypeOff = r.DWordLE(off + 42);
+            mimetypeSize = r.DWordLE(off + 20);
+        }
+        if (nameLen > 0 && name[nameLen - 1] != '/') {
+            fileName = name;
+            fileNameLen = nameLen;
+            nFiles++;
+        }
+        off += entryLen;
+    }
+
+    // we expect 1 file ending with .fb2
+    if (nFiles == 1 && fileNameLen > 4 && str::EqNI(fileName + fileNameLen - 4, ".fb2", 4)) {
+        return kindFileFb2z;
+    }
+    // assume that if this file exists, this is a epub file
+    // https://github.com/sumatrapdfreader/sumatrapdf/issues/1801
+    if (hasContainer) {
+        return kindFileEpub;
+    }
+    if (mimetypeOff >= 0) {
+        // a compressed (or unusually big) "mimetype" entry can't be checked here,
+        // so let the caller open the archive and decompress it
+        if (mimetypeSize >= 256) {
+            return nullptr;
+        }
+        u8 buf[30 + 8 + 1024 + 256];
+        size_t n = (size_t)std::min((i64)sizeof(buf), size - mimetypeOff);
+        if (!ReadAt(h, mimetypeOff, buf, n) || !CheckEpubMimeTypeEntry({buf, n}, mimetypeSize, isEpub)) {
+            return nullptr;
+        }
+        if (isEpub) {
+            return kindFileEpub;
+        }
+    }
+    if (isXps) {
+        return kindFileXps;
+    }
+    return kindFileZip;
+}
+
 static bool IsEpubArchive(MultiFormatArchive* archive) {
     // assume that if this file exists, this is a epub file
     // https://github.com/sumatrapdfreader/sumatrapdf/issues/1801
@@ -401,6 +565,10 @@ Kind GuessFileTypeFromContent(const char* path) {
     ByteSlice d = {(u8*)buf, (size_t)n};
     auto res = GuessFileTypeFromContent(d);
     if (res == kindFileZip) {
+        Kind kind = SniffZipArchive(path, d);
+        if (kind) {
+            return kind;
+        }
         MultiFormatArchive* archive = OpenZipArchive(path, true);
         if (archive) {
             if (IsXpsArchive(archive)) {
@@ -5,6 +5,13 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 // returns -1 if didn't find
 int HtmlEntityNameToRune(const char* name, size_t nameLen) {
     return FindHtmlEntityRune(name, nameLen);
@@ -31,19 +38,23 @@ int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen) {
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
+// memchr() is vectorized by the CRT
 bool SkipUntil(const char*& s, const char* end, char c) {
-    while ((s < end) && (*s != c)) {
-        ++s;
+    if (s >= end) {
+        return false;
     }
-    return *s == c;
+    const char* found = (const char*)memchr(s, c, end - s);
+    s = found ? found : end;
+    return found != nullptr;
 }
 
 bool SkipUntil(const char*& s, const char* end, const char* term) {
     size_t len = str::Len(term);
-    for (; s < end; s++) {
-        if (s + len <= end && str::StartsWith(s, term)) {
+    while (SkipUntil(s, end, term[0])) {
+        if ((size_t)(end - s) >= len && memcmp(s, term, len) == 0) {
             return true;
         }
+        s++;
     }
     return false;
 }
@@ -188,7 +199,7 @@ char* ResolveHtmlEntities(const char* s, size_t len) {
 }
 
 bool AttrInfo::NameIs(const char* s) const {
-    return str::EqNIx(name, nameLen, s);
+    return str::EqI(StrSpan(name, nameLen), s);
 }
 
 // return true if nameToCheck is the same as s after skipping namespace preifix
@@ -215,7 +226,7 @@ bool AttrInfo::NameIsNS(const char* nameToCheck, const char* ns) const {
 }
 
 bool AttrInfo::ValIs(const char* s) const {
-    return str::EqNIx(val, valLen, s);
+    return str::EqI(Val(), s);
 }
 
 void HtmlToken::SetTag(TokenType new_type, const char* new_s, const char* end) {
@@ -352,8 +363,44 @@ AttrInfo* HtmlToken::NextAttr() {
 // tries to find the closing '>' and not be confused by '>' that
 // are part of attribute value. We're not very strict here
 // Returns false if didn't find
+#if USE_SSE2
+// returns the first '>', '\'' or '"' or end if there is none
+static const char* FindTagEndOrQuote(const char* s, const char* end) {
+    __m128i gt = _mm_set1_epi8('>');
+    __m128i quote = _mm_set1_epi8('\'');
+    __m128i dquote = _mm_set1_epi8('"');
+    while (end - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, dquote));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            unsigned long idx;
+            _BitScanForward(&idx, (unsigned long)mask);
+            return s + idx;
+        }
+        s += 16;
+    }
+    while (s < end && *s != '>' && *s != '\'' && *s != '"') {
+        s++;
+    }
+    return s;
+}
+#else
+static const char* FindTagEndOrQuote(const char* s, const char* end) {
+    while (s < end && *s != '>' && *s != '\'' && *s != '"') {
+        s++;
+    }
+    return s;
+}
+#endif
+
 static bool SkipUntilTagEnd(const char*& s, const char* end) {
     while (s < end) {
+        s = FindTagEndOrQuote(s, end);
+        if (s == end) {
+            return false;
+        }
         char c = *s++;
         if ('>' == c) {
             --s;
@@ -10,6 +10,9 @@ struct AttrInfo {
     bool NameIs(const char* s) const;
     bool NameIsNS(const char* nameToCheck, const char* ns) const;
     bool ValIs(const char* s) const;
+    StrSpan Val() const {
+        return {val, valLen};
+    }
 };
 
 // TrivialHtmlParser needs to enumerate all attributes of an HtmlToken
@@ -96,6 +99,13 @@ class HtmlPullParser {
     void SetCurrPosOff(ptrdiff_t off) {
         currPos = start + off;
     }
+    // for data that is still being appended to while it's being parsed
+    // (it must not move in memory)
+    void SetLen(size_t newLen) {
+        CrashIf(newLen < len);
+        len = newLen;
+        end = start + newLen;
+    }
     size_t Len() const {
         return len;
     }
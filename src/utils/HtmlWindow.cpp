@@ -6,6 +6,8 @@
 #include "ScopedWin.h"
 #include "WinUtil.h"
 #include "GuessFileType.h"
+#include "ThreadUtil.h"
+#include "UITask.h"
 
 #include <mshtml.h>
 #include <mshtmhst.h>
@@ -300,7 +302,11 @@ class HW_IInternetProtocol : public IInternetProtocol {
     HW_IInternetProtocol() = default;
 
   protected:
-    virtual ~HW_IInternetProtocol() = default;
+    virtual ~HW_IInternetProtocol() {
+        if (sink) {
+            sink->Release();
+        }
+    }
 
   public:
     // IUnknown
@@ -317,9 +323,11 @@ class HW_IInternetProtocol : public IInternetProtocol {
         return S_OK;
     }
     STDMETHODIMP Abort(__unused HRESULT hrReason, __unused DWORD dwOptions) override {
+        ReleaseSink();
         return S_OK;
     }
     STDMETHODIMP Terminate(__unused DWORD dwOptions) override {
+        ReleaseSink();
         return S_OK;
     }
     STDMETHODIMP Suspend() override {
@@ -337,15 +345,103 @@ class HW_IInternetProtocol : public IInternetProtocol {
         return S_OK;
     }
 
+    // called on HtmlDataThread
+    void FetchData(HtmlWindowCallback* cb);
+
   protected:
     LONG refCount = 1;
 
-    // those are filled in Start() and represent data to be sent
+    // set in Start() and only used on the ui thread
+    IInternetProtocolSink* sink = nullptr;
+    int htmlWindowId = 0;
+    AutoFreeStr url;
+
+    // those are filled by FetchData() and represent data to be sent
     // for a given url
     ByteSlice data{};
     size_t dataCurrPos = 0;
+
+    void ReportData();
+    void ReleaseSink() {
+        if (sink) {
+            sink->Release();
+            sink = nullptr;
+        }
+    }
+};
+
+// serves the data for its:// urls on a thread so that decompressing
+// e.g. big images doesn't block the ui while a page is being loaded
+struct HtmlDataThread {
+    HtmlWindowCallback* cb = nullptr;
+    HANDLE hThread = nullptr;
+    HANDLE hEvent = nullptr;
+    CRITICAL_SECTION access;
+    // requests are served in the order in which the browser made them
+    Vec<HW_IInternetProtocol*> queue;
+    bool stop = false;
+
+    explicit HtmlDataThread(HtmlWindowCallback* cb);
+    ~HtmlDataThread();
+    void Queue(HW_IInternetProtocol* protocol);
 };
 
+static DWORD WINAPI HtmlDataThreadProc(void* data) {
+    SetThreadName("HtmlDataThread");
+    HtmlDataThread* t = (HtmlDataThread*)data;
+    for (;;) {
+        WaitForSingleObject(t->hEvent, INFINITE);
+        for (;;) {
+            HW_IInternetProtocol* protocol = nullptr;
+            {
+                ScopedCritSec scope(&t->access);
+                if (t->stop) {
+                    return 0;
+                }
+                if (t->queue.empty()) {
+                    break;
+                }
+                protocol = t->queue[0];
+                t->queue.RemoveAt(0);
+            }
+            protocol->FetchData(t->cb);
+        }
+    }
+}
+
+HtmlDataThread::HtmlDataThread(HtmlWindowCallback* cb) : cb(cb) {
+    InitializeCriticalSection(&access);
+    hEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (hEvent) {
+        hThread = CreateThread(nullptr, 0, HtmlDataThreadProc, this, 0, nullptr);
+    }
+}
+
+HtmlDataThread::~HtmlDataThread() {
+    if (hThread) {
+        EnterCriticalSection(&access);
+        stop = true;
+        LeaveCriticalSection(&access);
+        SetEvent(hEvent);
+        WaitForSingleObject(hThread, INFINITE);
+        CloseHandle(hThread);
+    }
+    for (HW_IInternetProtocol* protocol : queue) {
+        protocol->Release();
+    }
+    if (hEvent) {
+        CloseHandle(hEvent);
+    }
+    DeleteCriticalSection(&access);
+}
+
+// takes over the reference to protocol
+void HtmlDataThread::Queue(HW_IInternetProtocol* protocol) {
+    ScopedCritSec scope(&access);
+    queue.Append(protocol);
+    SetEvent(hEvent);
+}
+
 ULONG STDMETHODCALLTYPE HW_IInternetProtocol::Release() {
     LONG res = InterlockedDecrement(&refCount);
     CrashIf(res < 0);
@@ -456,25 +552,58 @@ STDMETHODIMP HW_IInternetProtocol::Start(LPCWSTR szUrl, IInternetProtocolSink* p
     if (!win->htmlWinCb) {
         return INET_E_OBJECT_NOT_FOUND;
     }
-    char* urlRestA = ToUtf8Temp(urlRest);
-    data = win->htmlWinCb->GetDataForUrl(urlRestA);
+    this->htmlWindowId = htmlWindowId;
+    url.Set(ToUtf8(urlRest));
+    sink = pIProtSink;
+    sink->AddRef();
+    if (!win->dataThread || !win->dataThread->hThread) {
+        data = win->htmlWinCb->GetDataForUrl(url);
+        if (data.empty()) {
+            ReleaseSink();
+            return INET_E_DATA_NOT_AVAILABLE;
+        }
+        ReportData();
+        return S_OK;
+    }
+    AddRef();
+    win->dataThread->Queue(this);
+    return E_PENDING;
+}
+
+void HW_IInternetProtocol::FetchData(HtmlWindowCallback* cb) {
+    data = cb->GetDataForUrl(url);
+    // the browser must only be notified on the ui thread
+    uitask::Post([this] {
+        // the data belongs to the window which might've been closed in the meantime
+        if (FindHtmlWindowById(htmlWindowId)) {
+            ReportData();
+        }
+        Release();
+    });
+}
+
+void HW_IInternetProtocol::ReportData() {
+    if (!sink) {
+        // the request has been aborted
+        return;
+    }
     if (data.empty()) {
-        return INET_E_DATA_NOT_AVAILABLE;
+        sink->ReportResult(INET_E_DATA_NOT_AVAILABLE, 0, nullptr);
+        return;
     }
 
     const char* imgExt = GfxFileExtFromData({(u8*)data.data(), data.size()});
-    char* mime = MimeFromUrl(urlRestA, imgExt);
+    char* mime = MimeFromUrl(url, imgExt);
     WCHAR* mimeW = ToWstrTemp(mime);
     str::Free(mime);
-    pIProtSink->ReportProgress(BINDSTATUS_VERIFIEDMIMETYPEAVAILABLE, mimeW);
+    sink->ReportProgress(BINDSTATUS_VERIFIEDMIMETYPEAVAILABLE, mimeW);
 #ifdef _WIN64
     // not going to report data in parts for unexpectedly huge webpages
     CrashIf(data.size() > ULONG_MAX);
 #endif
-    pIProtSink->ReportData(BSCF_FIRSTDATANOTIFICATION | BSCF_LASTDATANOTIFICATION | BSCF_DATAFULLYAVAILABLE,
-                           (ULONG)data.size(), (ULONG)data.size());
-    pIProtSink->ReportResult(S_OK, 200, nullptr);
-    return S_OK;
+    sink->ReportData(BSCF_FIRSTDATANOTIFICATION | BSCF_LASTDATANOTIFICATION | BSCF_DATAFULLYAVAILABLE,
+                     (ULONG)data.size(), (ULONG)data.size());
+    sink->ReportResult(S_OK, 200, nullptr);
 }
 
 STDMETHODIMP HW_IInternetProtocol::Read(void* pv, ULONG cb, ULONG* pcbRead) {
@@ -1445,6 +1574,9 @@ HtmlWindow::HtmlWindow(HWND parent, HtmlWindowCallback* cb) {
     htmlWinCb = cb;
     RegisterInternetProtocolFactory();
     windowId = GenNewWindowId(this);
+    if (cb) {
+        dataThread = new HtmlDataThread(cb);
+    }
     zoomDPI = DpiGet(parent);
     if (zoomDPI < 96) {
         zoomDPI = 96;
@@ -1586,6 +1718,7 @@ HtmlWindow::~HtmlWindow() {
         ReportIf(refCount != 0);
     }
 
+    delete dataThread;
     FreeWindowId(windowId);
     UnregisterInternetProtocolFactory();
     FreeHtmlSetInProgressData();
@@ -3,6 +3,7 @@
 
 class FrameSite;
 class HtmlMoniker;
+struct HtmlDataThread;
 
 bool IsBlankUrl(const WCHAR*);
 bool IsBlankUrl(const char*);
@@ -20,6 +21,7 @@ class HtmlWindowCallback {
 
     // allows for providing data for a given url.
     // returning nullptr means data wasn't provided.
+    // usually called on a background thread, so must be thread-safe
     virtual ByteSlice GetDataForUrl(const char* url) = 0;
 
     // called when left mouse button is clicked in the web control window.
@@ -95,6 +97,7 @@ class HtmlWindow {
     WNDPROC wndProcBrowserPrev = nullptr;
     LONG_PTR userDataBrowserPrev = 0;
     HtmlWindowCallback* htmlWinCb = nullptr;
+    HtmlDataThread* dataThread = nullptr;
 
     bool OnBeforeNavigate(const WCHAR* url, bool newWindow);
     void OnDocumentComplete(const WCHAR* url);
@@ -86,24 +86,83 @@ Error:
     goto Exit;
 }
 
-// Download content of a url to a file
-bool HttpGetToFile(const char* urlA, const char* destFilePath) {
+static char* QueryHeaderTemp(HINTERNET hReq, DWORD infoLevel) {
+    WCHAR buf[512];
+    DWORD size = sizeof(buf);
+    if (!HttpQueryInfoW(hReq, infoLevel, buf, &size, nullptr)) {
+        return nullptr;
+    }
+    return ToUtf8Temp(buf);
+}
+
+// the value for If-Range. Weak ETags can't be used for range requests
+static char* GetRangeValidatorTemp(HINTERNET hReq) {
+    char* etag = QueryHeaderTemp(hReq, HTTP_QUERY_ETAG);
+    if (etag && !str::StartsWith(etag, "W/")) {
+        return etag;
+    }
+    return QueryHeaderTemp(hReq, HTTP_QUERY_LAST_MODIFIED);
+}
+
+// for a 206 response, checks that the server sends the rest of the file from offset
+static bool IsContentRangeFrom(HINTERNET hReq, i64 offset) {
+    char* range = QueryHeaderTemp(hReq, HTTP_QUERY_CONTENT_RANGE);
+    if (!range || !str::StartsWith(range, "bytes ")) {
+        return false;
+    }
+    return _atoi64(range + 6) == offset;
+}
+
+// sleeps as long as needed for the average download rate to be at most maxBytesPerSec
+static void ThrottleDownload(DWORD startMs, i64 nBytes, int maxBytesPerSec) {
+    if (maxBytesPerSec <= 0) {
+        return;
+    }
+    i64 expectedMs = nBytes * 1000 / maxBytesPerSec;
+    i64 elapsedMs = (i64)(GetTickCount() - startMs);
+    if (expectedMs > elapsedMs) {
+        Sleep((DWORD)std::min(expectedMs - elapsedMs, (i64)1000));
+    }
+}
+
+// Download content of a url to a file.
+// The data is streamed to destFilePath.part, which is renamed once complete.
+// If a download is interrupted, the next call for the same destFilePath picks
+// it up with a range request, as long as the file on the server hasn't changed
+// (the ETag or Last-Modified it had is kept in destFilePath.part.etag).
+// maxBytesPerSec > 0 throttles the download to about that rate
+bool HttpGetToFile(const char* urlA, const char* destFilePath, int maxBytesPerSec) {
     logf("HttpGetToFile: url: '%s', file: '%s'\n", urlA, destFilePath);
     bool ok = false;
+    // a partial download is only kept if it can be resumed
+    bool keepPart = false;
     HINTERNET hReq = nullptr, hInet = nullptr;
+    HANDLE hf = INVALID_HANDLE_VALUE;
     DWORD dwRead = 0;
     DWORD headerBuffSize = sizeof(DWORD);
     DWORD statusCode = 0;
     WCHAR* url = ToWstrTemp(urlA);
-    char buf[1024];
-
-    WCHAR* pathW = ToWstrTemp(destFilePath);
-    HANDLE hf =
-        CreateFileW(pathW, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (INVALID_HANDLE_VALUE == hf) {
-        logf("HttpGetToFile: CreateFileW('%s') failed\n", destFilePath);
-        LogLastError();
-        goto Exit;
+    DWORD flags = INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_RELOAD;
+    constexpr DWORD kBufSize = 64 * 1024;
+    char* buf = nullptr;
+    i64 nDownloaded = 0;
+    DWORD startMs = 0;
+    char* validator = nullptr;
+    WCHAR* headersW = nullptr;
+    str::Str headers;
+
+    char* partPath = str::JoinTemp(destFilePath, ".part");
+    char* validatorPath = str::JoinTemp(destFilePath, ".part.etag");
+    WCHAR* partPathW = ToWstrTemp(partPath);
+    i64 partSize = file::GetSize(partPath);
+    AutoFreeStr prevValidator = file::ReadFile(validatorPath).data();
+    if (partSize <= 0 || str::IsEmpty(prevValidator.Get())) {
+        partSize = 0;
+    }
+    if (partSize > 0) {
+        headers.AppendFmt("Range: bytes=%lld-\r\nIf-Range: %s\r\n", (long long)partSize, prevValidator.Get());
+        headersW = ToWstrTemp(headers.Get());
+        logf("HttpGetToFile: resuming after %lld bytes\n", (long long)partSize);
     }
 
     hInet = InternetOpenW(kUserAgent, INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
@@ -111,21 +170,47 @@ bool HttpGetToFile(const char* urlA, const char* destFilePath) {
         goto Exit;
     }
 
-    hReq = InternetOpenUrlW(hInet, url, nullptr, 0, 0, 0);
+    hReq = InternetOpenUrlW(hInet, url, headersW, headersW ? (DWORD)-1 : 0, flags, 0);
     if (!hReq) {
+        keepPart = partSize > 0;
         goto Exit;
     }
 
     if (!HttpQueryInfoW(hReq, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &statusCode, &headerBuffSize, nullptr)) {
+        keepPart = partSize > 0;
         goto Exit;
     }
 
-    if (statusCode != 200) {
+    if (statusCode == 206 && partSize > 0 && IsContentRangeFrom(hReq, partSize)) {
+        hf = CreateFileW(partPathW, FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+    } else if (statusCode == 200) {
+        // the server doesn't support ranges or the file has changed
+        partSize = 0;
+        hf = CreateFileW(partPathW, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+        validator = GetRangeValidatorTemp(hReq);
+        if (validator) {
+            file::WriteFile(validatorPath, validator);
+        } else {
+            file::Delete(validatorPath);
+        }
+    } else {
+        logf("HttpGetToFile: unexpected status code %d\n", (int)statusCode);
         goto Exit;
     }
+    if (INVALID_HANDLE_VALUE == hf) {
+        logf("HttpGetToFile: CreateFileW('%s') failed\n", partPath);
+        LogLastError();
+        goto Exit;
+    }
+    // from here on, a failed download can be resumed if there's a validator
+    keepPart = file::Exists(validatorPath);
 
+    buf = AllocArray<char>(kBufSize);
+    startMs = GetTickCount();
     for (;;) {
-        if (!InternetReadFile(hReq, buf, sizeof(buf), &dwRead)) {
+        if (!InternetReadFile(hReq, buf, kBufSize, &dwRead)) {
             goto Exit;
         }
         if (dwRead == 0) {
@@ -133,27 +218,40 @@ bool HttpGetToFile(const char* urlA, const char* destFilePath) {
         }
         DWORD size;
         BOOL wroteOk = WriteFile(hf, buf, (DWORD)dwRead, &size, nullptr);
-        if (!wroteOk) {
-            goto Exit;
-        }
-
-        if (size != dwRead) {
+        if (!wroteOk || size != dwRead) {
+            keepPart = false;
             goto Exit;
         }
+        nDownloaded += dwRead;
+        ThrottleDownload(startMs, nDownloaded, maxBytesPerSec);
     }
+    CloseHandle(hf);
+    hf = INVALID_HANDLE_VALUE;
 
-    ok = true;
+    file::Delete(destFilePath);
+    ok = MoveFileExW(partPathW, ToWstrTemp(destFilePath), MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED) != 0;
+    if (!ok) {
+        logf("HttpGetToFile: failed to rename '%s'\n", partPath);
+        LogLastError();
+    }
 Exit:
-    CloseHandle(hf);
+    free(buf);
+    if (hf != INVALID_HANDLE_VALUE) {
+        CloseHandle(hf);
+    }
     if (hReq) {
         InternetCloseHandle(hReq);
     }
     if (hInet) {
         InternetCloseHandle(hInet);
     }
-    if (!ok) {
-        file::Delete(destFilePath);
+    if (!ok && !keepPart) {
+        file::Delete(partPath);
+    }
+    if (ok || !keepPart) {
+        file::Delete(validatorPath);
     }
+    logf("HttpGetToFile: ok: %d, downloaded %lld bytes\n", (int)ok, (long long)nDownloaded);
     return ok;
 }
 
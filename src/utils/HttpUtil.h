@@ -15,6 +15,6 @@ bool HttpRspOk(const HttpRsp*);
 
 bool HttpPost(const char* server, int port, const char* url, str::Str* headers, str::Str* data);
 bool HttpGet(const char* url, HttpRsp* rspOut);
-bool HttpGetToFile(const char* url, const char* destFilePath);
+bool HttpGetToFile(const char* url, const char* destFilePath, int maxBytesPerSec = 0);
 // void  HttpGetAsync(const char *url, const std::function<void(HttpRsp *)> &);
 void HttpGetAsync(const char* url, const std::function<void(HttpRsp*)>&);
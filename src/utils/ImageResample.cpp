@@ -0,0 +1,313 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/ImageResample.h"
+
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
+// bitmaps with more pixels are resampled in bands of rows in parallel
+constexpr int kMinPixelsPerResampleBand = 256 * 1024;
+constexpr int kMaxResampleThreads = 8;
+
+constexpr float kPi = 3.14159265f;
+
+// Catmull-Rom spline (a = -0.5)
+static float BicubicKernel(float x) {
+    x = fabsf(x);
+    if (x < 1.f) {
+        return (1.5f * x - 2.5f) * x * x + 1.f;
+    }
+    if (x < 2.f) {
+        return ((-0.5f * x + 2.5f) * x - 4.f) * x + 2.f;
+    }
+    return 0.f;
+}
+
+static float Sinc(float x) {
+    if (x == 0.f) {
+        return 1.f;
+    }
+    x *= kPi;
+    return sinf(x) / x;
+}
+
+static float Lanczos3Kernel(float x) {
+    if (fabsf(x) >= 3.f) {
+        return 0.f;
+    }
+    return Sinc(x) * Sinc(x / 3.f);
+}
+
+// how much each source pixel contributes to a destination pixel
+// in one dimension. The source pixels of a destination pixel are
+// first[i] ... first[i] + count[i] - 1 (always within the source)
+struct ResampleWeights {
+    int maxTaps = 0;
+    int* first = nullptr;
+    int* count = nullptr;
+    // maxTaps weights for each destination pixel
+    float* weights = nullptr;
+
+    ResampleWeights() = default;
+    ~ResampleWeights() {
+        free(first);
+        free(count);
+        free(weights);
+    }
+};
+
+// destination pixel i covers source pixels srcStart + i * scale ... srcStart + (i + 1) * scale
+static bool CalcResampleWeights(ResampleWeights& w, ResampleFilter filter, float srcStart, float scale, int dstLen,
+                                int srcLen) {
+    bool isLanczos = filter == ResampleFilter::Lanczos3;
+    float support = isLanczos ? 3.f : 2.f;
+    // when downscaling, the filter is stretched to cover all source pixels
+    float filterScale = std::max(scale, 1.f);
+    float radius = support * filterScale;
+    int nTaps = (int)ceilf(radius * 2.f) + 1;
+    w.maxTaps = std::min(nTaps, srcLen);
+    w.first = AllocArray<int>(dstLen);
+    w.count = AllocArray<int>(dstLen);
+    w.weights = AllocArray<float>((size_t)dstLen * w.maxTaps);
+    float* raw = AllocArray<float>(nTaps);
+    if (!w.first || !w.count || !w.weights || !raw) {
+        free(raw);
+        return false;
+    }
+
+    for (int i = 0; i < dstLen; i++) {
+        float center = srcStart + ((float)i + 0.5f) * scale;
+        int rawFirst = (int)floorf(center - radius);
+        float sum = 0.f;
+        for (int j = 0; j < nTaps; j++) {
+            float x = ((float)(rawFirst + j) + 0.5f - center) / filterScale;
+            raw[j] = isLanczos ? Lanczos3Kernel(x) : BicubicKernel(x);
+            sum += raw[j];
+        }
+        // ignore taps that don't contribute
+        int lo = 0;
+        int hi = nTaps - 1;
+        while (lo < hi && fabsf(raw[lo]) < 1e-6f) {
+            lo++;
+        }
+        while (hi > lo && fabsf(raw[hi]) < 1e-6f) {
+            hi--;
+        }
+        // pixels outside of the source repeat the closest edge pixel
+        int first = std::clamp(rawFirst + lo, 0, srcLen - 1);
+        int last = std::clamp(rawFirst + hi, 0, srcLen - 1);
+        float* ws = w.weights + (size_t)i * w.maxTaps;
+        for (int j = 0; j < w.maxTaps; j++) {
+            ws[j] = 0.f;
+        }
+        for (int j = lo; j <= hi; j++) {
+            int idx = std::clamp(rawFirst + j, 0, srcLen - 1);
+            ws[idx - first] += sum != 0.f ? raw[j] / sum : 0.f;
+        }
+        w.first[i] = first;
+        w.count[i] = last - first + 1;
+    }
+    free(raw);
+    return true;
+}
+
+#if USE_SSE2
+
+// loads B, G, R, A and blends it with white
+static inline __m128 LoadPixel(const u8* p) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128(*(const int*)p);
+    v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+    __m128 px = _mm_cvtepi32_ps(v);
+    __m128 a = _mm_shuffle_ps(px, px, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 white = _mm_set1_ps(255.f);
+    return _mm_add_ps(_mm_mul_ps(px, _mm_mul_ps(a, _mm_set1_ps(1.f / 255.f))), _mm_sub_ps(white, a));
+}
+
+static void ResampleRow(const u8* srcRow, const ResampleWeights& wx, int dstDx, float* out) {
+    for (int i = 0; i < dstDx; i++) {
+        const u8* p = srcRow + (size_t)wx.first[i] * 4;
+        const float* ws = wx.weights + (size_t)i * wx.maxTaps;
+        __m128 acc = _mm_setzero_ps();
+        for (int j = 0, n = wx.count[i]; j < n; j++) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(LoadPixel(p + j * 4), _mm_set1_ps(ws[j])));
+        }
+        _mm_storeu_ps(out + i * 4, acc);
+    }
+}
+
+static void AccumulateRow(float* acc, const float* row, float weight, int dstDx) {
+    __m128 w = _mm_set1_ps(weight);
+    for (int i = 0; i < dstDx * 4; i += 4) {
+        __m128 v = _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w));
+        _mm_storeu_ps(acc + i, v);
+    }
+}
+
+static void StoreRow(const float* acc, u8* dstRow, int dstDx) {
+    for (int i = 0; i < dstDx; i++) {
+        __m128i v = _mm_cvtps_epi32(_mm_loadu_ps(acc + i * 4));
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        // the alpha channel of 32 bit DIBs is ignored but keep it opaque
+        *(int*)(dstRow + i * 4) = _mm_cvtsi128_si32(v) | (int)0xFF000000;
+    }
+}
+
+#else
+
+static void ResampleRow(const u8* srcRow, const ResampleWeights& wx, int dstDx, float* out) {
+    for (int i = 0; i < dstDx; i++) {
+        const u8* p = srcRow + (size_t)wx.first[i] * 4;
+        const float* ws = wx.weights + (size_t)i * wx.maxTaps;
+        float acc[4] = {};
+        for (int j = 0, n = wx.count[i]; j < n; j++, p += 4) {
+            float a = (float)p[3];
+            for (int c = 0; c < 4; c++) {
+                // blend with white
+                float v = (float)p[c] * a / 255.f + 255.f - a;
+                acc[c] += v * ws[j];
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            out[i * 4 + c] = acc[c];
+        }
+    }
+}
+
+static void AccumulateRow(float* acc, const float* row, float weight, int dstDx) {
+    for (int i = 0; i < dstDx * 4; i++) {
+        acc[i] += row[i] * weight;
+    }
+}
+
+static void StoreRow(const float* acc, u8* dstRow, int dstDx) {
+    for (int i = 0; i < dstDx * 4; i++) {
+        dstRow[i] = (u8)std::clamp((int)lrintf(acc[i]), 0, 255);
+    }
+    for (int i = 0; i < dstDx; i++) {
+        dstRow[i * 4 + 3] = 0xFF;
+    }
+}
+
+#endif
+
+struct ResampleBand {
+    const ImagePixels* src = nullptr;
+    const ImagePixels* dst = nullptr;
+    const ResampleWeights* wx = nullptr;
+    const ResampleWeights* wy = nullptr;
+    int dstY = 0;
+    int dstDy = 0;
+    bool ok = false;
+};
+
+static void ResampleRows(ResampleBand* band) {
+    const ImagePixels& src = *band->src;
+    const ImagePixels& dst = *band->dst;
+    const ResampleWeights& wy = *band->wy;
+    int dstDx = dst.dx;
+
+    // horizontally resampled source rows, row n is at n % nRows. Source rows
+    // of consecutive destination rows overlap, so each is only resampled once
+    int nRows = wy.maxTaps;
+    size_t rowSize = (size_t)dstDx * 4;
+    float* rows = AllocArray<float>(rowSize * (nRows + 1));
+    int* rowInSlot = AllocArray<int>(nRows);
+    if (!rows || !rowInSlot) {
+        free(rows);
+        free(rowInSlot);
+        return;
+    }
+    float* acc = rows + rowSize * nRows;
+    for (int i = 0; i < nRows; i++) {
+        rowInSlot[i] = -1;
+    }
+
+    for (int y = band->dstY; y < band->dstY + band->dstDy; y++) {
+        int first = wy.first[y];
+        int count = wy.count[y];
+        const float* ws = wy.weights + (size_t)y * wy.maxTaps;
+        memset(acc, 0, rowSize * sizeof(float));
+        for (int j = 0; j < count; j++) {
+            int srcY = first + j;
+            int slot = srcY % nRows;
+            float* row = rows + rowSize * slot;
+            if (rowInSlot[slot] != srcY) {
+                ResampleRow(src.data + (size_t)srcY * src.stride, *band->wx, dstDx, row);
+                rowInSlot[slot] = srcY;
+            }
+            AccumulateRow(acc, row, ws[j], dstDx);
+        }
+        StoreRow(acc, dst.data + (size_t)y * dst.stride, dstDx);
+    }
+
+    free(rows);
+    free(rowInSlot);
+    band->ok = true;
+}
+
+static DWORD WINAPI ResampleBandThread(LPVOID data) {
+    ResampleRows((ResampleBand*)data);
+    return 0;
+}
+
+bool ResampleBitmap(const ImagePixels& src, const RectF& srcRect, const ImagePixels& dst, ResampleFilter filter) {
+    if (src.dx <= 0 || src.dy <= 0 || dst.dx <= 0 || dst.dy <= 0 || srcRect.dx <= 0 || srcRect.dy <= 0) {
+        return false;
+    }
+    ResampleWeights wx, wy;
+    float scaleX = srcRect.dx / (float)dst.dx;
+    float scaleY = srcRect.dy / (float)dst.dy;
+    if (!CalcResampleWeights(wx, filter, srcRect.x, scaleX, dst.dx, src.dx) ||
+        !CalcResampleWeights(wy, filter, srcRect.y, scaleY, dst.dy, src.dy)) {
+        return false;
+    }
+
+    i64 nPixels = (i64)dst.dx * (i64)dst.dy;
+    int maxBands = std::min(GetPhysicalProcessorCount(), kMaxResampleThreads);
+    int nBands = (int)std::clamp(nPixels / kMinPixelsPerResampleBand, (i64)1, (i64)std::max(maxBands, 1));
+    nBands = std::min(nBands, dst.dy);
+
+    ResampleBand bands[kMaxResampleThreads];
+    HANDLE threads[kMaxResampleThreads] = {};
+    int nThreads = 0;
+    for (int i = 0; i < nBands; i++) {
+        ResampleBand& b = bands[i];
+        b.src = &src;
+        b.dst = &dst;
+        b.wx = &wx;
+        b.wy = &wy;
+        b.dstY = (int)((i64)dst.dy * i / nBands);
+        b.dstDy = (int)((i64)dst.dy * (i + 1) / nBands) - b.dstY;
+    }
+    // the first band is done on this thread
+    for (int i = 1; i < nBands; i++) {
+        HANDLE h = CreateThread(nullptr, 0, ResampleBandThread, &bands[i], 0, nullptr);
+        if (!h) {
+            ResampleRows(&bands[i]);
+            continue;
+        }
+        threads[nThreads++] = h;
+    }
+    ResampleRows(&bands[0]);
+    if (nThreads > 0) {
+        WaitForMultipleObjects(nThreads, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        CloseHandle(threads[i]);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < nBands; i++) {
+        ok = ok && bands[i].ok;
+    }
+    return ok;
+}
@@ -0,0 +1,23 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// high quality scaling of 32 bits per pixel bitmaps with a separable filter.
+// Much faster than GDI+ DrawImage() and uses several threads for big bitmaps
+
+enum class ResampleFilter {
+    Bicubic,
+    Lanczos3,
+};
+
+// top-down, 4 bytes per pixel in B, G, R, A order (like GDI+ PixelFormat32bppARGB
+// and 32 bit DIBs)
+struct ImagePixels {
+    u8* data = nullptr;
+    int dx = 0;
+    int dy = 0;
+    int stride = 0;
+};
+
+// scales srcRect (in pixels of src, can be fractional and extend outside of src)
+// to all of dst. Transparent pixels are blended with white
+bool ResampleBitmap(const ImagePixels& src, const RectF& srcRect, const ImagePixels& dst, ResampleFilter filter);
@@ -23,6 +23,8 @@ static inline const char* SkipDigits(const char* s) {
 class ParseArgs {
   public:
     str::Str path;
+    // re-used for string and number values to avoid an allocation per value
+    str::Str value;
     bool canceled = false;
     ValueVisitor* visitor = nullptr;
 
@@ -82,11 +84,11 @@ static const char* ExtractString(str::Str& string, const char* data) {
 }
 
 static const char* ParseString(ParseArgs& args, const char* data) {
-    str::Str string;
-    data = ExtractString(string, data);
+    args.value.Clear();
+    data = ExtractString(args.value, data);
     if (data) {
         const char* path = args.path.Get();
-        const char* value = string.Get();
+        const char* value = args.value.Get();
         args.canceled = !args.visitor->Visit(path, value, Type::String);
     }
     return data;
@@ -122,10 +124,10 @@ static const char* ParseNumber(ParseArgs& args, const char* data) {
         return nullptr;
     }
 
-    char* number = str::Dup(start, data - start);
+    args.value.Clear();
+    args.value.Append(start, data - start);
     const char* path = args.path.Get();
-    args.canceled = !args.visitor->Visit(path, number, Type::Number);
-    free(number);
+    args.canceled = !args.visitor->Visit(path, args.value.Get(), Type::Number);
     return data;
 }
 
@@ -248,4 +250,299 @@ bool Parse(const char* data, ValueVisitor* visitor) {
     return args.canceled || !*SkipWS(end);
 }
 
+// a bit for every path of PathSet that can still match at the current depth
+using PathMask = u32;
+static_assert(sizeof(PathMask) * 8 >= PathSet::kMaxPaths);
+
+PathSet::PathSet(const char** paths, int nPaths) {
+    CrashIf(nPaths > kMaxPaths);
+    this->nPaths = std::min(nPaths, kMaxPaths);
+    for (int i = 0; i < this->nPaths; i++) {
+        this->paths[i] = paths[i];
+    }
+}
+
+class PathParseArgs {
+  public:
+    const PathSet& set;
+    PathVisitor* visitor = nullptr;
+    // only used for strings with escape sequences
+    str::Str key;
+    str::Str value;
+    bool canceled = false;
+
+    PathParseArgs(const PathSet& set, PathVisitor* visitor) : set(set), visitor(visitor) {
+    }
+};
+
+// offs[i] is how much of path i has been matched so far and arrayIdxs[i]
+// the index matched by its last "[*]"
+static const char* ParsePathValue(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                  const int* arrayIdxs);
+
+// returns the end of the string starting at data without copying it
+static const char* SkipString(const char* data, bool& hasEscapes) {
+    hasEscapes = false;
+    while (*++data) {
+        if ('"' == *data) {
+            return data + 1;
+        }
+        if ('\\' != *data) {
+            continue;
+        }
+        hasEscapes = true;
+        int i;
+        char c = *++data;
+        if ('u' == c) {
+            if (!str::Parse(data + 1, "%4x", &i) || i == 0) {
+                return nullptr;
+            }
+            data += 4;
+        } else if (!c || !str::FindChar("\"\\/bfnrt", c)) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// only unescapes into buf if necessary
+static const char* ParseStringSpan(str::Str& buf, const char* data, StrSpan& s, bool needValue) {
+    bool hasEscapes;
+    const char* end = SkipString(data, hasEscapes);
+    if (!end || !needValue) {
+        return end;
+    }
+    if (!hasEscapes) {
+        s = {data + 1, (size_t)(end - data - 2)};
+        return end;
+    }
+    buf.Clear();
+    if (!ExtractString(buf, data)) {
+        return nullptr;
+    }
+    s = {buf.Get(), buf.size()};
+    return end;
+}
+
+static void VisitPaths(PathParseArgs& args, PathMask mask, const u16* offs, const int* arrayIdxs, StrSpan value,
+                       Type type) {
+    for (int i = 0; i < args.set.nPaths && mask != 0; i++) {
+        PathMask bit = (PathMask)1 << i;
+        if (!(mask & bit)) {
+            continue;
+        }
+        mask &= ~bit;
+        if (args.set.paths[i][offs[i]] != '\0') {
+            continue;
+        }
+        if (!args.visitor->Visit(i, arrayIdxs[i], value, type)) {
+            args.canceled = true;
+            return;
+        }
+    }
+}
+
+static const char* ParsePathObject(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                   const int* arrayIdxs) {
+    data = SkipWS(data + 1);
+    if ('}' == *data) {
+        return data + 1;
+    }
+
+    u16 childOffs[PathSet::kMaxPaths];
+    int childIdxs[PathSet::kMaxPaths];
+    for (;;) {
+        data = SkipWS(data);
+        if ('"' != *data) {
+            return nullptr;
+        }
+        StrSpan key;
+        data = ParseStringSpan(args.key, data, key, mask != 0);
+        if (!data) {
+            return nullptr;
+        }
+        // a key matches "/$key" followed by the end of the path, '/' or '['
+        PathMask childMask = 0;
+        for (int i = 0; i < args.set.nPaths && mask != 0; i++) {
+            if (!(mask & ((PathMask)1 << i))) {
+                continue;
+            }
+            const char* s = args.set.paths[i] + offs[i];
+            if (*s != '/' || !str::EqN(s + 1, key.data(), key.size())) {
+                continue;
+            }
+            char next = s[1 + key.size()];
+            if (next == '\0' || next == '/' || next == '[') {
+                childMask |= (PathMask)1 << i;
+                childOffs[i] = (u16)(offs[i] + 1 + key.size());
+                childIdxs[i] = arrayIdxs[i];
+            }
+        }
+        data = SkipWS(data);
+        if (':' != *data) {
+            return nullptr;
+        }
+
+        data = ParsePathValue(args, data + 1, childMask, childOffs, childIdxs);
+        if (args.canceled || !data) {
+            return data;
+        }
+
+        data = SkipWS(data);
+        if ('}' == *data) {
+            return data + 1;
+        }
+        if (',' != *data) {
+            return nullptr;
+        }
+        data++;
+    }
+}
+
+static const char* ParsePathArray(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                  const int* arrayIdxs) {
+    data = SkipWS(data + 1);
+    if (']' == *data) {
+        return data + 1;
+    }
+
+    u16 childOffs[PathSet::kMaxPaths];
+    int childIdxs[PathSet::kMaxPaths];
+    for (int idx = 0;; idx++) {
+        PathMask childMask = 0;
+        for (int i = 0; i < args.set.nPaths && mask != 0; i++) {
+            if (!(mask & ((PathMask)1 << i))) {
+                continue;
+            }
+            const char* s = args.set.paths[i] + offs[i];
+            if (*s != '[') {
+                continue;
+            }
+            int n = -1;
+            const char* end = str::StartsWith(s, "[*]") ? s + 3 : str::Parse(s, "[%d]", &n);
+            if (!end || (n != -1 && n != idx)) {
+                continue;
+            }
+            childMask |= (PathMask)1 << i;
+            childOffs[i] = (u16)(end - args.set.paths[i]);
+            childIdxs[i] = n == -1 ? idx : arrayIdxs[i];
+        }
+        data = ParsePathValue(args, data, childMask, childOffs, childIdxs);
+        if (args.canceled || !data) {
+            return data;
+        }
+
+        data = SkipWS(data);
+        if (']' == *data) {
+            return data + 1;
+        }
+        if (',' != *data) {
+            return nullptr;
+        }
+        data++;
+    }
+}
+
+static const char* ParsePathNumber(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                   const int* arrayIdxs) {
+    const char* start = data;
+    // same validation as ParseNumber()
+    if ('-' == *data) {
+        data++;
+    }
+    if ('0' == *data) {
+        data++;
+    } else if (str::IsDigit(*data)) {
+        data = SkipDigits(data + 1);
+    } else {
+        return nullptr;
+    }
+    if ('.' == *data) {
+        data = SkipDigits(data + 1);
+    }
+    if ('e' == *data || 'E' == *data) {
+        data++;
+        if ('+' == *data || '-' == *data) {
+            data++;
+        }
+        data = SkipDigits(data + 1);
+    }
+    if (!str::IsDigit(*(data - 1)) || str::IsDigit(*data)) {
+        return nullptr;
+    }
+    if (mask != 0) {
+        VisitPaths(args, mask, offs, arrayIdxs, {start, (size_t)(data - start)}, Type::Number);
+    }
+    return data;
+}
+
+static const char* ParsePathKeyword(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                    const int* arrayIdxs, const char* keyword, Type type) {
+    if (!str::StartsWith(data, keyword)) {
+        return nullptr;
+    }
+    if (mask != 0) {
+        VisitPaths(args, mask, offs, arrayIdxs, keyword, type);
+    }
+    return data + str::Len(keyword);
+}
+
+static const char* ParsePathValue(PathParseArgs& args, const char* data, PathMask mask, const u16* offs,
+                                  const int* arrayIdxs) {
+    data = SkipWS(data);
+    switch (*data) {
+        case '"': {
+            StrSpan value;
+            data = ParseStringSpan(args.value, data, value, mask != 0);
+            if (data && mask != 0) {
+                VisitPaths(args, mask, offs, arrayIdxs, value, Type::String);
+            }
+            return data;
+        }
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+        case '-':
+            return ParsePathNumber(args, data, mask, offs, arrayIdxs);
+        case '{':
+            return ParsePathObject(args, data, mask, offs, arrayIdxs);
+        case '[':
+            return ParsePathArray(args, data, mask, offs, arrayIdxs);
+        case 't':
+            return ParsePathKeyword(args, data, mask, offs, arrayIdxs, "true", Type::Bool);
+        case 'f':
+            return ParsePathKeyword(args, data, mask, offs, arrayIdxs, "false", Type::Bool);
+        case 'n':
+            return ParsePathKeyword(args, data, mask, offs, arrayIdxs, "null", Type::Null);
+        default:
+            return nullptr;
+    }
+}
+
+bool Parse(const char* data, const PathSet& paths, PathVisitor* visitor) {
+    PathParseArgs args(paths, visitor);
+    if (str::StartsWith(data, UTF8_BOM)) {
+        data += 3;
+    }
+    PathMask mask = 0;
+    u16 offs[PathSet::kMaxPaths]{};
+    int arrayIdxs[PathSet::kMaxPaths];
+    for (int i = 0; i < paths.nPaths; i++) {
+        mask |= (PathMask)1 << i;
+        arrayIdxs[i] = -1;
+    }
+    const char* end = ParsePathValue(args, data, mask, offs, arrayIdxs);
+    if (!end) {
+        return false;
+    }
+    return args.canceled || !*SkipWS(end);
+}
+
 } // namespace json
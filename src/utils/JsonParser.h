@@ -27,4 +27,30 @@ class ValueVisitor {
 // returns false on error
 bool Parse(const char* data, ValueVisitor* visitor);
 
+// for callers that only need the values at a few known paths: the paths are
+// matched while parsing (without building path strings), everything else is
+// only skipped over and values without escape sequences aren't copied.
+// "[*]" in a path matches any array index, e.g. "/credits[*]/person"
+class PathVisitor {
+  public:
+    // pathIdx is the index of the path in PathSet, arrayIdx the index matched
+    // by the last "[*]" (or -1). value is only valid during the call
+    // and isn't 0-terminated
+    // return false to stop parsing
+    virtual bool Visit(int pathIdx, int arrayIdx, StrSpan value, Type type) = 0;
+    virtual ~PathVisitor() = default;
+};
+
+struct PathSet {
+    static constexpr int kMaxPaths = 32;
+
+    // paths must outlive the PathSet
+    const char* paths[kMaxPaths]{};
+    int nPaths = 0;
+
+    PathSet(const char** paths, int nPaths);
+};
+
+bool Parse(const char* data, const PathSet& paths, PathVisitor* visitor);
+
 } // namespace json
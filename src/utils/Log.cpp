@@ -33,12 +33,39 @@ bool gSkipDuplicateLines = true;
 
 bool gLogToPipe = true;
 HANDLE hLogPipe = INVALID_HANDLE_VALUE;
+// when logview isn't running, don't try to connect on every line
+static u64 gLogPipeLastConnectTry = 0;
+constexpr u64 kLogPipeConnectRetryMs = 2000;
 
 char* gLogFilePath = nullptr;
 
 // 1 MB - 128 to stay under 1 MB even after appending (an estimate)
 constexpr int kMaxLogBuf = 1024 * 1024 - 128;
 
+// hashes of the most recently logged distinct lines, to skip duplicates
+// without searching all of gLogBuf
+constexpr int kRecentLogLines = 512;
+static u32 gRecentLogLineHashes[kRecentLogLines];
+static int gRecentLogLinesCount = 0;
+static int gRecentLogLinesNext = 0;
+
+// if true, writing to the log file and logview is done on LogWriterThread
+// so that threads that log a lot (e.g. mupdf warnings for a broken document)
+// don't wait for the disk or the pipe. Off by default because dlls
+// (e.g. the previewer) can be unloaded while the thread runs
+bool gLogAsync = false;
+static str::Str* gLogPending = nullptr;
+static HANDLE gLogWriterThread = nullptr;
+static HANDLE gLogWriterEvent = nullptr;
+// serializes writing to the file and logview
+static Mutex gLogWriteMutex;
+
+// limits how many messages logThrottled() logs
+constexpr int kMaxThrottledPerSec = 50;
+static u64 gThrottleStart = 0;
+static int gThrottledCount = 0;
+static int gThrottledSkipped = 0;
+
 #if 0
 // TODO: add more codes
 static const char* getWinError(DWORD errCode) {
@@ -74,12 +101,15 @@ static void logToPipe(const char* s, size_t n = 0) {
     BOOL ok = false;
     bool didConnect = false;
     if (!IsValidHandle(hLogPipe)) {
+        u64 now = GetTickCount64();
+        if (gLogPipeLastConnectTry != 0 && now - gLogPipeLastConnectTry < kLogPipeConnectRetryMs) {
+            return;
+        }
+        gLogPipeLastConnectTry = now;
         // try open pipe for logging
         hLogPipe = CreateFileW(kPipeName, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
         if (!IsValidHandle(hLogPipe)) {
             // TODO: retry if ERROR_PIPE_BUSY ?
-            // TODO: maybe remember when last we tried to open it and don't try to open for the
-            // next 10 secs, to minimize CreateFileW() calls
             return;
         }
         didConnect = true;
@@ -116,27 +146,106 @@ static void logToPipe(const char* s, size_t n = 0) {
     }
 }
 
-void log(const char* s, bool always) {
-    bool skipLog = !always && gSkipDuplicateLines && gLogBuf && gLogBuf->Contains(s);
+// FNV-1a
+static u32 HashLogLine(const char* s, size_t n) {
+    u32 h = 2166136261;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (u8)s[i]) * 16777619;
+    }
+    return h;
+}
 
-    if (!skipLog) {
+// must be called with gLogMutex held
+static bool IsRecentLogLine(const char* s, size_t n) {
+    u32 h = HashLogLine(s, n);
+    for (int i = 0; i < gRecentLogLinesCount; i++) {
+        if (gRecentLogLineHashes[i] == h) {
+            return true;
+        }
+    }
+    gRecentLogLineHashes[gRecentLogLinesNext] = h;
+    gRecentLogLinesNext = (gRecentLogLinesNext + 1) % kRecentLogLines;
+    gRecentLogLinesCount = std::min(gRecentLogLinesCount + 1, kRecentLogLines);
+    return false;
+}
+
+// must be called with gLogWriteMutex held
+static void WriteLogToFileAndPipe(const char* s, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    if (gLogFilePath) {
+        auto f = fopen(gLogFilePath, "a");
+        if (f != nullptr) {
+            fwrite(s, 1, n, f);
+            fflush(f);
+            fclose(f);
+        }
+    }
+    logToPipe(s, n);
+}
+
+// moves what was logged since the last call to the file and logview
+static void WritePendingLog() {
+    str::Str toWrite;
+    // taken first so that chunks are written in order
+    gLogWriteMutex.Lock();
+    gLogMutex.Lock();
+    if (gLogPending && gLogPending->size() > 0) {
+        toWrite.Append(gLogPending->LendData(), gLogPending->size());
+        gLogPending->Reset();
+    }
+    gLogMutex.Unlock();
+    WriteLogToFileAndPipe(toWrite.LendData(), toWrite.size());
+    gLogWriteMutex.Unlock();
+}
+
+static DWORD WINAPI LogWriterThread(LPVOID) {
+    SetThreadName("LogWriterThread");
+    while (!gStopLogging) {
+        WaitForSingleObject(gLogWriterEvent, INFINITE);
+        WritePendingLog();
+    }
+    return 0;
+}
+
+// must be called with gLogMutex held. Returns false if the log
+// has to be written directly because we can't start the thread
+static bool StartLogWriterThread() {
+    if (gLogWriterThread) {
+        return true;
+    }
+    if (!gLogWriterEvent) {
+        gLogWriterEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        if (!gLogWriterEvent) {
+            return false;
+        }
+    }
+    gLogWriterThread = CreateThread(nullptr, 0, LogWriterThread, nullptr, 0, nullptr);
+    return gLogWriterThread != nullptr;
+}
+
+void log(const char* s, bool always) {
+    if (gStopLogging) {
         // in reduced logging mode, we do want to log to at least the debugger
         if (gLogToDebugger || IsDebuggerPresent() || gReducedLogging) {
             OutputDebugStringA(s);
         }
-    }
-    if (gStopLogging) {
         return;
     }
     if (gReducedLogging) {
+        // we might be crashing with gLogMutex held so don't take it
+        OutputDebugStringA(s);
         // if the pipe already connected, do log to it even if disabled
         // we do want easy logging, just want to reduce doing stuff
         // that can break crash handling
         if (gLogToPipe && IsValidHandle(hLogPipe)) {
-            logToPipe(s);
+            logToPipe(s, str::Len(s));
         }
         return;
     }
+
+    size_t n = str::Len(s);
     gLogMutex.Lock();
 
     InterlockedIncrement(&gAllowAllocFailure);
@@ -147,17 +256,18 @@ void log(const char* s, bool always) {
     if (!gLogBuf) {
         gLogAllocator = new HeapAllocator();
         gLogBuf = new str::Str(32 * 1024, gLogAllocator);
+        gLogPending = new str::Str(4 * 1024, gLogAllocator);
     } else {
         if (gLogBuf->isize() > kMaxLogBuf) {
             // TODO: use gLogBuf->Clear(), which doesn't free the allocated space
             gLogBuf->Reset();
+            gRecentLogLinesCount = 0;
         }
     }
 
-    size_t n = str::Len(s);
-
-    // when skipping, we skip buf (crash reports) and console
+    // when skipping, we skip buf (crash reports), console and debugger
     // but write to file and logview
+    bool skipLog = !always && gSkipDuplicateLines && IsRecentLogLine(s, n);
     if (!skipLog) {
         gLogBuf->Append(s, n);
     }
@@ -167,16 +277,42 @@ void log(const char* s, bool always) {
         fflush(stdout);
     }
 
-    if (gLogFilePath) {
-        auto f = fopen(gLogFilePath, "a");
-        if (f != nullptr) {
-            fwrite(s, 1, n, f);
-            fflush(f);
-            fclose(f);
+    bool needsWrite = gLogFilePath || gLogToPipe;
+    bool viaThread = needsWrite && gLogAsync && StartLogWriterThread();
+    if (viaThread) {
+        if (gLogPending->isize() > kMaxLogBuf) {
+            // the writer can't keep up, drop what it didn't write yet
+            gLogPending->Reset();
         }
+        gLogPending->Append(s, n);
     }
-    logToPipe(s, n);
     gLogMutex.Unlock();
+
+    if (!skipLog && (gLogToDebugger || IsDebuggerPresent())) {
+        OutputDebugStringA(s);
+    }
+    if (viaThread) {
+        SetEvent(gLogWriterEvent);
+    } else if (needsWrite) {
+        gLogWriteMutex.Lock();
+        WriteLogToFileAndPipe(s, n);
+        gLogWriteMutex.Unlock();
+    }
+}
+
+// formats into a stack buffer to avoid allocating for typical short lines
+static void logfv(bool always, const char* fmt, va_list args) {
+    char buf[512];
+    va_list args2;
+    va_copy(args2, args);
+    int n = vsnprintf(buf, dimof(buf), fmt, args2);
+    va_end(args2);
+    if (n >= 0 && n < (int)dimof(buf)) {
+        log(buf, always);
+        return;
+    }
+    AutoFreeStr s = str::FmtV(fmt, args);
+    log(s.Get(), always);
 }
 
 void logf(const char* fmt, ...) {
@@ -186,8 +322,7 @@ void logf(const char* fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-    AutoFreeStr s = str::FmtV(fmt, args);
-    log(s.Get(), false);
+    logfv(false, fmt, args);
     va_end(args);
 }
 
@@ -198,11 +333,48 @@ void logfa(const char* fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-    AutoFreeStr s = str::FmtV(fmt, args);
-    log(s.Get(), true);
+    logfv(true, fmt, args);
     va_end(args);
 }
 
+// used for messages that can come in floods, like mupdf warnings
+// for broken documents. Logs at most kMaxThrottledPerSec per second
+void logThrottled(const char* s) {
+    if (gReducedLogging || gStopLogging) {
+        return;
+    }
+    int nSkipped = 0;
+    gLogMutex.Lock();
+    u64 now = GetTickCount64();
+    if (now - gThrottleStart >= 1000) {
+        nSkipped = gThrottledSkipped;
+        gThrottleStart = now;
+        gThrottledCount = 0;
+        gThrottledSkipped = 0;
+    }
+    bool skip = gThrottledCount >= kMaxThrottledPerSec;
+    if (skip) {
+        gThrottledSkipped++;
+    } else {
+        gThrottledCount++;
+    }
+    gLogMutex.Unlock();
+
+    if (nSkipped > 0) {
+        logf("... skipped %d messages\n", nSkipped);
+    }
+    if (!skip) {
+        log(s);
+    }
+}
+
+// makes sure everything logged so far is in the log file
+void FlushLogging() {
+    if (gLogWriterThread) {
+        WritePendingLog();
+    }
+}
+
 void StartLogToFile(const char* path, bool removeIfExists) {
     CrashIf(gLogFilePath);
     gLogFilePath = str::Dup(path);
@@ -221,10 +393,19 @@ bool WriteCurrentLogToFile(const char* path) {
 }
 
 void DestroyLogging() {
+    FlushLogging();
     gStopLogging = true;
+    if (gLogWriterThread) {
+        SetEvent(gLogWriterEvent);
+        WaitForSingleObject(gLogWriterThread, 1000);
+        SafeCloseHandle(&gLogWriterThread);
+    }
+    SafeCloseHandle(&gLogWriterEvent);
     gLogMutex.Lock();
     delete gLogBuf;
     gLogBuf = nullptr;
+    delete gLogPending;
+    gLogPending = nullptr;
     delete gLogAllocator;
     gLogAllocator = nullptr;
     gLogMutex.Unlock();
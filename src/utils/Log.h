@@ -7,6 +7,7 @@ extern bool gLogToConsole;
 extern bool gLogToDebugger;
 extern bool gReducedLogging;
 extern bool gLogToPipe;
+extern bool gLogAsync;
 extern bool gStopLogging;
 extern const char* gLogAppName;
 extern char* gLogFilePath;
@@ -43,5 +44,8 @@ void logf(const char* fmt, ...);
 
 // always log, even if NO_LOG is defined
 void logfa(const char* fmt, ...);
+// for messages that can come in floods, logs at most 50 per second
+void logThrottled(const char* s);
 
+void FlushLogging();
 void DestroyLogging();
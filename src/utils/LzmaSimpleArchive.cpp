@@ -117,6 +117,107 @@ static bool Decompress(const u8* compressed, size_t compressedSize, u8* uncompre
     return true;
 }
 
+// size of the buffer for extracting a file in chunks
+constexpr size_t kExtractBufSize = 256 * 1024;
+
+static bool WriteAll(HANDLE hFile, const u8* data, size_t size) {
+    while (size > 0) {
+        DWORD toWrite = (DWORD)std::min(size, (size_t)1 << 30);
+        DWORD written = 0;
+        if (!::WriteFile(hFile, data, toWrite, &written, nullptr) || written != toWrite) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// like Decompress() but writes the uncompressed data to hFile, kExtractBufSize bytes
+// at a time, and also checks the crc32 checksum. Sets writeFailed if hFile couldn't be written
+static bool DecompressToFile(const FileInfo* fi, HANDLE hFile, Allocator* allocator, bool& writeFailed) {
+    const u8* compressed = fi->compressedData;
+    size_t compressedSize = fi->compressedSize;
+    size_t uncompressedSize = fi->uncompressedSize;
+    if (compressedSize < 1) {
+        return false;
+    }
+
+    u8 usesX86Filter = compressed[0];
+    // handle stored data
+    if (usesX86Filter == (u8)-1) {
+        if (uncompressedSize != compressedSize - 1) {
+            return false;
+        }
+        if (lzma_crc32(0, compressed + 1, uncompressedSize) != fi->uncompressedCrc32) {
+            return false;
+        }
+        writeFailed = !WriteAll(hFile, compressed + 1, uncompressedSize);
+        return !writeFailed;
+    }
+
+    if (compressedSize < LZMA_HEADER_SIZE || usesX86Filter > 1) {
+        return false;
+    }
+
+    ISzAllocatorAlloc lzmaAlloc(allocator);
+    CLzmaDec dec;
+    LzmaDec_Construct(&dec);
+    if (SZ_OK != LzmaDec_Allocate(&dec, compressed + 1, LZMA_PROPS_SIZE, &lzmaAlloc)) {
+        return false;
+    }
+    LzmaDec_Init(&dec);
+    u8* buf = (u8*)Allocator::Alloc(allocator, kExtractBufSize);
+
+    const u8* src = compressed + LZMA_HEADER_SIZE;
+    size_t srcLeft = compressedSize - LZMA_HEADER_SIZE;
+    // bytes in buf, starting at offset bufPos of the uncompressed data
+    size_t bufLen = 0;
+    size_t bufPos = 0;
+    UInt32 x86State;
+    x86_Convert_Init(x86State);
+    u32 crc = 0;
+    bool finished = false;
+    bool ok = buf != nullptr;
+    while (ok && !finished) {
+        SizeT destLen = kExtractBufSize - bufLen;
+        SizeT srcLen = srcLeft;
+        ELzmaStatus status;
+        SRes res = LzmaDec_DecodeToBuf(&dec, buf + bufLen, &destLen, src, &srcLen, LZMA_FINISH_ANY, &status);
+        src += srcLen;
+        srcLeft -= srcLen;
+        bufLen += destLen;
+        finished = status == LZMA_STATUS_FINISHED_WITH_MARK;
+        if (SZ_OK != res || bufPos + bufLen > uncompressedSize || (destLen == 0 && srcLen == 0 && !finished)) {
+            ok = false;
+            break;
+        }
+
+        // the x86 filter leaves the last few bytes, which might be the start
+        // of an instruction, until more data follows
+        size_t n = bufLen;
+        if (usesX86Filter) {
+            SizeT converted = x86_Convert(buf, bufLen, (UInt32)bufPos, &x86State, 0);
+            if (!finished) {
+                n = converted;
+            }
+        }
+        crc = lzma_crc32(crc, buf, n);
+        if (!WriteAll(hFile, buf, n)) {
+            writeFailed = true;
+            ok = false;
+            break;
+        }
+        memmove(buf, buf + n, bufLen - n);
+        bufLen -= n;
+        bufPos += n;
+    }
+
+    Allocator::Free(allocator, buf);
+    LzmaDec_Free(&dec, &lzmaAlloc);
+    return ok && bufPos == uncompressedSize && crc == fi->uncompressedCrc32;
+}
+
 /* archiveHeader points to the beginning of archive, which has a following format:
 
 u32   magic_id 0x41537a4c ("LzSA' for "Lzma Simple Archive")
@@ -257,24 +358,47 @@ u8* GetFileDataByName(SimpleArchive* archive, const char* fileName, Allocator* a
     return nullptr;
 }
 
-static bool ExtractFileByIdx(SimpleArchive* archive, int idx, const char* dstDir, Allocator* allocator) {
+// the crc32 table is built by ParseSimpleArchive(), so that
+// extracting on several threads only reads it
+bool ExtractFileByIdxToPath(SimpleArchive* archive, int idx, const char* filePath, Allocator* allocator,
+                            bool* corruptedOut) {
+    if (corruptedOut) {
+        *corruptedOut = false;
+    }
+    if (idx >= archive->filesCount) {
+        return false;
+    }
     FileInfo* fi = &archive->files[idx];
 
-    u8* uncompressed = GetFileDataByIdx(archive, idx, allocator);
-    if (!uncompressed) {
+    WCHAR* pathW = ToWstr(filePath);
+    HANDLE hFile = CreateFileW(pathW, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        str::Free(pathW);
         return false;
     }
 
-    bool ok = false;
-    char* filePath = path::Join(allocator, dstDir, fi->name);
-    if (filePath) {
-        ByteSlice d = {(u8*)uncompressed, fi->uncompressedSize};
-        ok = file::WriteFile(filePath, d);
+    bool writeFailed = false;
+    bool ok = DecompressToFile(fi, hFile, allocator, writeFailed);
+    CloseHandle(hFile);
+    if (!ok) {
+        // don't leave a partial file behind
+        DeleteFileW(pathW);
+        if (corruptedOut) {
+            *corruptedOut = !writeFailed;
+        }
     }
+    str::Free(pathW);
+    return ok;
+}
 
+static bool ExtractFileByIdx(SimpleArchive* archive, int idx, const char* dstDir, Allocator* allocator) {
+    FileInfo* fi = &archive->files[idx];
+    char* filePath = path::Join(allocator, dstDir, fi->name);
+    if (!filePath) {
+        return false;
+    }
+    bool ok = ExtractFileByIdxToPath(archive, idx, filePath, allocator);
     Allocator::Free(allocator, filePath);
-    Allocator::Free(allocator, uncompressed);
-
     return ok;
 }
 
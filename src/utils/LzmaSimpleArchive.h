@@ -25,6 +25,11 @@ bool ParseSimpleArchive(const u8* archiveHeader, size_t dataLen, SimpleArchive*
 int GetIdxFromName(SimpleArchive* archive, const char* name);
 u8* GetFileDataByIdx(SimpleArchive* archive, int idx, Allocator* allocator);
 u8* GetFileDataByName(SimpleArchive* archive, const char* fileName, Allocator* allocator);
+// decompresses the file to filePath in chunks, without holding all of it in memory.
+// Can be called from several threads for different files (after ParseSimpleArchive()).
+// If given, corruptedOut is set when the failure was due to bad data (and not to writing)
+bool ExtractFileByIdxToPath(SimpleArchive* archive, int idx, const char* filePath, Allocator* allocator,
+                            bool* corruptedOut = nullptr);
 // files is an array of char * entries, last element must be nullptr
 bool ExtractFiles(const char* archivePath, const char* dstDir, const char** files, Allocator* allocator);
 
@@ -476,17 +476,119 @@ static void SerializeStructRec(str::Str& out, const StructInfo* info, const void
     SerializeUnknownFields(out, prevNode, indent);
 }
 
+// nodes with fewer items are searched linearly
+constexpr size_t kMinItemsForNodeIndex = 8;
+
+static size_t HashKeyI(const char* key) {
+    // FNV-1a over the lower-cased key (keys are compared case-insensitively)
+    size_t h = 2166136261u;
+    for (const char* s = key; *s; s++) {
+        char c = *s;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ (u8)c) * 16777619u;
+    }
+    return h;
+}
+
+// index of the first item with a given key in a SquareTreeNode, so that
+// deserializing a struct doesn't have to scan all items for every field
+// (which is quadratic for big structs like GlobalPrefs)
+struct SquareTreeNodeIndex {
+    SquareTreeNode* node = nullptr;
+    // open addressing hash table of item index + 1 (0 for empty slots)
+    int* slots = nullptr;
+    size_t mask = 0;
+
+    explicit SquareTreeNodeIndex(SquareTreeNode* node);
+    SquareTreeNodeIndex(const SquareTreeNodeIndex&) = delete;
+    SquareTreeNodeIndex& operator=(const SquareTreeNodeIndex&) = delete;
+    ~SquareTreeNodeIndex() {
+        free(slots);
+    }
+
+    size_t FindFirst(const char* key) const;
+    const char* GetValue(const char* key) const;
+    SquareTreeNode* GetChild(const char* key) const;
+};
+
+SquareTreeNodeIndex::SquareTreeNodeIndex(SquareTreeNode* node) : node(node) {
+    size_t n = node ? node->data.size() : 0;
+    if (n < kMinItemsForNodeIndex) {
+        return;
+    }
+    size_t size = 16;
+    while (size < n * 2) {
+        size *= 2;
+    }
+    slots = AllocArray<int>(size);
+    if (!slots) {
+        return;
+    }
+    mask = size - 1;
+    for (size_t i = 0; i < n; i++) {
+        const char* key = node->data.at(i).key;
+        size_t slot = HashKeyI(key) & mask;
+        while (slots[slot] != 0 && !str::EqI(node->data.at(slots[slot] - 1).key, key)) {
+            slot = (slot + 1) & mask;
+        }
+        // only remember the first item for each key
+        if (slots[slot] == 0) {
+            slots[slot] = (int)i + 1;
+        }
+    }
+}
+
+// returns node->data.size() if there's no item with that key
+size_t SquareTreeNodeIndex::FindFirst(const char* key) const {
+    size_t n = node ? node->data.size() : 0;
+    if (!slots) {
+        for (size_t i = 0; i < n; i++) {
+            if (str::EqI(node->data.at(i).key, key)) {
+                return i;
+            }
+        }
+        return n;
+    }
+    for (size_t slot = HashKeyI(key) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        size_t i = (size_t)slots[slot] - 1;
+        if (str::EqI(node->data.at(i).key, key)) {
+            return i;
+        }
+    }
+    return n;
+}
+
+const char* SquareTreeNodeIndex::GetValue(const char* key) const {
+    size_t idx = FindFirst(key);
+    if (!node || idx >= node->data.size()) {
+        return nullptr;
+    }
+    // the first item with this key might be a child node
+    return node->GetValue(key, &idx);
+}
+
+SquareTreeNode* SquareTreeNodeIndex::GetChild(const char* key) const {
+    size_t idx = FindFirst(key);
+    if (!node || idx >= node->data.size()) {
+        return nullptr;
+    }
+    return node->GetChild(key, &idx);
+}
+
 static void* DeserializeStructRec(const StructInfo* info, SquareTreeNode* node, u8* base, bool useDefaults) {
     if (!base) {
         base = AllocArray<u8>(info->structSize);
     }
 
+    SquareTreeNodeIndex nodeIndex(node);
     const char* fieldName = info->fieldNames;
     for (size_t i = 0; i < info->fieldCount; i++, fieldName += str::Len(fieldName) + 1) {
         const FieldInfo& field = info->fields[i];
         u8* fieldPtr = base + field.offset;
         if (SettingType::Struct == field.type || SettingType::Prerelease == field.type) {
-            SquareTreeNode* child = node ? node->GetChild(fieldName) : nullptr;
+            SquareTreeNode* child = nodeIndex.GetChild(fieldName);
 #if !(defined(PRE_RELEASE_VER) || defined(DEBUG))
             if (SettingType::Prerelease == field.type) {
                 child = nullptr;
@@ -495,14 +597,14 @@ static void* DeserializeStructRec(const StructInfo* info, SquareTreeNode* node,
             DeserializeStructRec(GetSubstruct(field), child, fieldPtr, useDefaults);
         } else if (SettingType::Array == field.type) {
             SquareTreeNode *parent = node, *child = nullptr;
-            if (parent && (child = parent->GetChild(fieldName)) != nullptr &&
+            if (parent && (child = nodeIndex.GetChild(fieldName)) != nullptr &&
                 (0 == child->data.size() || child->GetChild(""))) {
                 parent = child;
                 fieldName += str::Len(fieldName);
             }
             if (child || useDefaults || !*(Vec<void*>**)fieldPtr) {
                 Vec<void*>* array = new Vec<void*>();
-                size_t idx = 0;
+                size_t idx = parent == node ? nodeIndex.FindFirst(fieldName) : 0;
                 while (parent && (child = parent->GetChild(fieldName, &idx)) != nullptr) {
                     void* v = DeserializeStructRec(GetSubstruct(field), child, nullptr, true);
                     array->Append(v);
@@ -511,7 +613,7 @@ static void* DeserializeStructRec(const StructInfo* info, SquareTreeNode* node,
                 *(Vec<void*>**)fieldPtr = array;
             }
         } else if (field.type != SettingType::Comment) {
-            const char* value = node ? node->GetValue(fieldName) : nullptr;
+            const char* value = nodeIndex.GetValue(fieldName);
             if (useDefaults || value) {
                 DeserializeField(field, base, value);
             }
@@ -1095,6 +1095,133 @@ bool EmptyOrWhiteSpaceOnly(const char* s) {
     return true;
 }
 
+bool Eq(const StrSpan& s, const char* s2) {
+    if (!s.data() || !s2) {
+        return !s.data() && !s2;
+    }
+    return s.size() == str::Len(s2) && 0 == memcmp(s.data(), s2, s.size());
+}
+
+bool EqI(const StrSpan& s, const char* s2) {
+    if (!s.data() || !s2) {
+        return !s.data() && !s2;
+    }
+    return s.size() == str::Len(s2) && 0 == _strnicmp(s.data(), s2, s.size());
+}
+
+bool StartsWith(const StrSpan& s, const char* prefix) {
+    size_t n = str::Len(prefix);
+    return s.data() && n <= s.size() && 0 == memcmp(s.data(), prefix, n);
+}
+
+bool StartsWithI(const StrSpan& s, const char* prefix) {
+    size_t n = str::Len(prefix);
+    return s.data() && n <= s.size() && 0 == _strnicmp(s.data(), prefix, n);
+}
+
+const char* FindChar(const StrSpan& s, char c) {
+    if (!s.data()) {
+        return nullptr;
+    }
+    return (const char*)memchr(s.data(), c, s.size());
+}
+
+const char* Find(const StrSpan& s, const char* find) {
+    size_t n = str::Len(find);
+    if (!s.data() || n > s.size()) {
+        return nullptr;
+    }
+    if (n == 0) {
+        return s.data();
+    }
+    const char* end = s.end() - n + 1;
+    for (const char* p = s.data(); p < end; p++) {
+        p = (const char*)memchr(p, *find, end - p);
+        if (!p) {
+            break;
+        }
+        if (0 == memcmp(p, find, n)) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// splits off the part of rest before the first sep (or all of rest
+// if there's no sep). Returns false when there are no more parts,
+// so "a,,b" yields "a", "", "b"
+bool NextPart(StrSpan& rest, char sep, StrSpan& part) {
+    if (!rest.data()) {
+        return false;
+    }
+    const char* p = FindChar(rest, sep);
+    if (!p) {
+        part = rest;
+        rest = {};
+        return true;
+    }
+    part = {rest.data(), (size_t)(p - rest.data())};
+    rest = {p + 1, (size_t)(rest.end() - p - 1)};
+    return true;
+}
+
+StrSpan TrimWs(const StrSpan& s) {
+    const char* b = s.data();
+    const char* e = s.end();
+    if (!b) {
+        return {};
+    }
+    while (b < e && str::IsWs(*b)) {
+        b++;
+    }
+    while (e > b && str::IsWs(e[-1])) {
+        e--;
+    }
+    return {b, (size_t)(e - b)};
+}
+
+// numbers are parsed from a zero-terminated copy on the stack
+// because strtol() and strtod() might read past the end of the span
+static size_t NumberToBuf(const StrSpan& s, char* buf, size_t bufSize) {
+    size_t n = s.data() ? std::min(s.size(), bufSize - 1) : 0;
+    if (n > 0) {
+        memcpy(buf, s.data(), n);
+    }
+    buf[n] = 0;
+    return n;
+}
+
+// like Parse(s, "%d") but also returns the unparsed rest of s
+bool ParseInt(const StrSpan& s, int* n, StrSpan* rest) {
+    char buf[32];
+    NumberToBuf(s, buf, dimof(buf));
+    char* end = nullptr;
+    long v = strtol(buf, &end, 10);
+    if (end == buf) {
+        return false;
+    }
+    *n = (int)v;
+    if (rest) {
+        *rest = s.Sub(end - buf);
+    }
+    return true;
+}
+
+bool ParseFloat(const StrSpan& s, float* f, StrSpan* rest) {
+    char buf[64];
+    NumberToBuf(s, buf, dimof(buf));
+    char* end = nullptr;
+    double v = strtod(buf, &end);
+    if (end == buf) {
+        return false;
+    }
+    *f = (float)v;
+    if (rest) {
+        *rest = s.Sub(end - buf);
+    }
+    return true;
+}
+
 } // namespace str
 
 namespace url {
@@ -1359,6 +1486,13 @@ Str::~Str() {
     Free(this);
 }
 
+// like Reset() but keeps the allocated memory for re-use
+void Str::Clear() {
+    if (len > 0) {
+        RemoveAt(0, len);
+    }
+}
+
 char& Str::at(size_t idx) const {
     CrashIf(idx >= (u32)len);
     return els[idx];
@@ -79,6 +79,44 @@ struct ByteSlice {
 
 bool IsEqual(const ByteSlice&, const ByteSlice&);
 
+// non-owning view of a string that is not necessarily zero-terminated,
+// typically a part of a bigger buffer that is being parsed
+struct StrSpan {
+    const char* d = nullptr;
+    size_t sz = 0;
+
+    StrSpan() = default;
+    StrSpan(const char* s) {
+        d = s;
+        sz = s ? strlen(s) : 0;
+    }
+    StrSpan(const char* s, size_t len) {
+        d = s;
+        sz = len;
+    }
+    const char* data() const {
+        return d;
+    }
+    size_t size() const {
+        return sz;
+    }
+    const char* end() const {
+        return d + sz;
+    }
+    bool empty() const {
+        return sz == 0;
+    }
+    char operator[](size_t i) const {
+        return d[i];
+    }
+    // clamps off and len to the span
+    StrSpan Sub(size_t off, size_t len = (size_t)-1) const {
+        off = std::min(off, sz);
+        len = std::min(len, sz - off);
+        return {d + off, len};
+    }
+};
+
 namespace str {
 
 enum class TrimOpt { Left, Right, Both };
@@ -226,6 +264,17 @@ char* FormatNumWithThousandSepTemp(i64 num, LCID locale = LOCALE_USER_DEFAULT);
 char* FormatRomanNumeral(int number);
 
 bool EmptyOrWhiteSpaceOnly(const char* sv);
+
+bool Eq(const StrSpan&, const char*);
+bool EqI(const StrSpan&, const char*);
+bool StartsWith(const StrSpan&, const char* prefix);
+bool StartsWithI(const StrSpan&, const char* prefix);
+const char* FindChar(const StrSpan&, char c);
+const char* Find(const StrSpan&, const char* find);
+bool NextPart(StrSpan& rest, char sep, StrSpan& part);
+StrSpan TrimWs(const StrSpan&);
+bool ParseInt(const StrSpan&, int* n, StrSpan* rest = nullptr);
+bool ParseFloat(const StrSpan&, float* f, StrSpan* rest = nullptr);
 } // namespace str
 
 namespace url {
@@ -274,6 +323,7 @@ struct Str {
     ~Str();
 
     void Reset();
+    void Clear();
     char& at(size_t idx) const;
     char& at(int idx) const;
     char& operator[](size_t idx) const;
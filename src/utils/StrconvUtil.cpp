@@ -3,8 +3,96 @@
 
 #include "BaseUtil.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 namespace strconv {
 
+// converts the leading ascii characters of s, returns how many were converted
+static size_t AsciiToWchar(const char* s, size_t n, WCHAR* dst) {
+    size_t i = 0;
+#if USE_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+#endif
+    for (; i < n && (u8)s[i] < 0x80; i++) {
+        dst[i] = (WCHAR)s[i];
+    }
+    return i;
+}
+
+static size_t WcharToAscii(const WCHAR* s, size_t n, char* dst) {
+    size_t i = 0;
+#if USE_SSE2
+    __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(s + i + 8));
+        __m128i hi = _mm_and_si128(_mm_or_si128(v1, v2), nonAscii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, zero)) != 0xFFFF) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(v1, v2));
+    }
+#endif
+    for (; i < n && s[i] < 0x80; i++) {
+        dst[i] = (char)s[i];
+    }
+    return i;
+}
+
+// a byte of utf8 never becomes more than one WCHAR, so dst must have
+// space for cb WCHARs. Returns the number of WCHARs written
+static size_t Utf8ToWcharNoCheck(const char* s, size_t cb, WCHAR* dst) {
+    size_t n = AsciiToWchar(s, cb, dst);
+    if (n == cb) {
+        return n;
+    }
+    // ascii chars are never part of a multi-byte sequence so it's safe
+    // to convert the rest separately
+    int cch = (int)(cb - n);
+    int cchConverted = MultiByteToWideChar(CP_UTF8, 0, s + n, cch, dst + n, cch);
+    ReportIf(cchConverted <= 0);
+    return n + (size_t)std::max(cchConverted, 0);
+}
+
+// a WCHAR never becomes more than 3 bytes of utf8 (a surrogate pair
+// becomes 4), so dst must have space for cch * 3 bytes
+static size_t WcharToUtf8NoCheck(const WCHAR* s, size_t cch, char* dst) {
+    size_t n = WcharToAscii(s, cch, dst);
+    if (n == cch) {
+        return n;
+    }
+    int cb = (int)((cch - n) * 3);
+    int cbConverted = WideCharToMultiByte(CP_UTF8, 0, s + n, (int)(cch - n), dst + n, cb, nullptr, nullptr);
+    ReportIf(cbConverted <= 0);
+    return n + (size_t)std::max(cbConverted, 0);
+}
+
+// the result was allocated for the worst case, give back the memory
+// if that was a lot more than needed
+static void* ShrinkConverted(Allocator* a, void* res, size_t cbUsed, size_t cbAlloc) {
+    if (a || cbAlloc < 4096 || cbUsed > cbAlloc / 2) {
+        return res;
+    }
+    void* shrunk = Allocator::Realloc(a, res, cbUsed);
+    return shrunk ? shrunk : res;
+}
+
+// converts in a single pass into a buffer of the maximum possible size,
+// which for mostly ascii text is close to the final size
 WCHAR* Utf8ToWstr(const char* s, size_t cb, Allocator* a) {
     // subtle: if s is nullptr, we return nullptr. if empty string => we return empty string
     if (!s) {
@@ -16,19 +104,64 @@ WCHAR* Utf8ToWstr(const char* s, size_t cb, Allocator* a) {
     if (cb == 0) {
         return (WCHAR*)Allocator::AllocZero(a, sizeof(WCHAR));
     }
-    // ask for the size of buffer needed for converted string
-    int cchNeeded = MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, nullptr, 0);
-    size_t cbAlloc = ((size_t)cchNeeded * sizeof(WCHAR)) + sizeof(WCHAR); // +1 for terminating 0
-    WCHAR* res = (WCHAR*)Allocator::AllocZero(a, cbAlloc);
+    size_t cbAlloc = (cb + 1) * sizeof(WCHAR); // +1 for terminating 0
+    WCHAR* res = (WCHAR*)Allocator::Alloc(a, cbAlloc);
     if (!res) {
         return nullptr;
     }
-    int cchConverted = MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, res, (int)cchNeeded);
-    ReportIf(cchConverted != cchNeeded);
-    // TODO: not sure if invalid test or it's more subtle
-    // triggers in Dune.epub
-    // ReportIf((size_t)cchConverted != str::Len(res));
-    return res;
+    size_t cch = Utf8ToWcharNoCheck(s, cb, res);
+    res[cch] = 0;
+    return (WCHAR*)ShrinkConverted(a, res, (cch + 1) * sizeof(WCHAR), cbAlloc);
+}
+
+size_t Utf8ToWcharBuf(const StrSpan& s, WCHAR* buf, size_t cchBuf) {
+    if (cchBuf == 0) {
+        return 0;
+    }
+    buf[0] = 0;
+    if (s.empty() || cchBuf < 2) {
+        return 0;
+    }
+    if (s.size() < cchBuf) {
+        size_t cch = Utf8ToWcharNoCheck(s.data(), s.size(), buf);
+        buf[cch] = 0;
+        return cch;
+    }
+    int n = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), buf, (int)(cchBuf - 1));
+    if (n <= 0) {
+        buf[0] = 0;
+        return 0;
+    }
+    buf[n] = 0;
+    return (size_t)n;
+}
+
+size_t WcharToUtf8Buf(const WCHAR* s, size_t cch, char* buf, size_t cbBuf) {
+    if (cbBuf == 0) {
+        return 0;
+    }
+    buf[0] = 0;
+    if (!s || cbBuf < 2) {
+        return 0;
+    }
+    if (cch == (size_t)-1) {
+        cch = str::Len(s);
+    }
+    if (cch == 0) {
+        return 0;
+    }
+    if (cch * 3 < cbBuf) {
+        size_t cb = WcharToUtf8NoCheck(s, cch, buf);
+        buf[cb] = 0;
+        return cb;
+    }
+    int n = WideCharToMultiByte(CP_UTF8, 0, s, (int)cch, buf, (int)(cbBuf - 1), nullptr, nullptr);
+    if (n <= 0) {
+        buf[0] = 0;
+        return 0;
+    }
+    buf[n] = 0;
+    return (size_t)n;
 }
 
 char* WstrToCodePage(uint codePage, const WCHAR* s, size_t cch, Allocator* a) {
@@ -42,6 +175,16 @@ char* WstrToCodePage(uint codePage, const WCHAR* s, size_t cch, Allocator* a) {
     if (cch == 0) {
         return (char*)Allocator::AllocZero(a, sizeof(char));
     }
+    if (codePage == CP_UTF8) {
+        size_t cbAlloc = cch * 3 + 1; // +1 for terminating 0
+        char* res = (char*)Allocator::Alloc(a, cbAlloc);
+        if (!res) {
+            return nullptr;
+        }
+        size_t cb = WcharToUtf8NoCheck(s, cch, res);
+        res[cb] = 0;
+        return (char*)ShrinkConverted(a, res, cb + 1, cbAlloc);
+    }
     // ask for the size of buffer needed for converted string
     int cbNeeded = WideCharToMultiByte(codePage, 0, s, (int)cch, nullptr, 0, nullptr, nullptr);
     if (cbNeeded == 0) {
@@ -68,6 +211,9 @@ WCHAR* StrToWstr(const char* src, uint codePage, int cbSrc) {
     if (!src) {
         return nullptr;
     }
+    if (codePage == CP_UTF8) {
+        return Utf8ToWstr(src, cbSrc < 0 ? (size_t)-1 : (size_t)cbSrc);
+    }
 
     int requiredBufSize = MultiByteToWideChar(codePage, 0, src, cbSrc, nullptr, 0);
     if (0 == requiredBufSize) {
@@ -6,6 +6,12 @@ namespace strconv {
 WCHAR* Utf8ToWstr(const char* s, size_t cb = (size_t)-1, Allocator* a = nullptr);
 char* WstrToUtf8(const WCHAR* s, size_t cch = (size_t)-1, Allocator* a = nullptr);
 
+// convert into a caller-provided buffer, without allocating. The result is
+// always zero-terminated. Return the number of chars written (without
+// the terminating 0) or 0 (and an empty string) if it didn't fit
+size_t Utf8ToWcharBuf(const StrSpan& s, WCHAR* buf, size_t cchBuf);
+size_t WcharToUtf8Buf(const WCHAR* s, size_t cch, char* buf, size_t cbBuf);
+
 char* WstrToCodePage(uint codePage, const WCHAR* s, size_t cch = (size_t)-1, Allocator* a = nullptr);
 char* ToMultiByte(const char* src, uint codePageSrc, uint codePageDest);
 WCHAR* StrToWstr(const char* src, uint codePage, int cbSrc = -1);
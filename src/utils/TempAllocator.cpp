@@ -13,6 +13,7 @@ It's a very fast bump allocator.
 You must periodically call ResetTempAllocator()
 to free memory used by allocator.
 A safe place to call it is inside message windows loop.
+Threads that loop can instead use TempAllocatorScope for each iteration.
 */
 
 thread_local static PoolAllocator* gTempAllocator = nullptr;
@@ -40,6 +41,23 @@ void ResetTempAllocator() {
     }
 }
 
+size_t TempAllocatorHighWater() {
+    return gTempAllocator ? gTempAllocator->maxBlocksSize : 0;
+}
+
+TempAllocatorScope::TempAllocatorScope() {
+    GetTempAllocator();
+    allocator = gTempAllocator;
+    mark = allocator->GetMark();
+}
+
+TempAllocatorScope::~TempAllocatorScope() {
+    // DestroyTempAllocator() might have been called inside the scope
+    if (gTempAllocator == allocator) {
+        allocator->RewindTo(mark);
+    }
+}
+
 namespace str {
 TempStr DupTemp(const char* s, size_t cb) {
     return str::Dup(GetTempAllocator(), s, cb);
@@ -49,6 +67,13 @@ TempWstr DupTemp(const WCHAR* s, size_t cch) {
     return str::Dup(GetTempAllocator(), s, cch);
 }
 
+TempStr DupTemp(const StrSpan& s) {
+    if (!s.data()) {
+        return nullptr;
+    }
+    return str::Dup(GetTempAllocator(), s.data(), s.size());
+}
+
 TempStr JoinTemp(const char* s1, const char* s2, const char* s3) {
     return Join(GetTempAllocator(), s1, s2, s3);
 }
@@ -74,3 +99,7 @@ TempWstr ToWstrTemp(const char* s, size_t cb) {
     }
     return strconv::Utf8ToWstr(s, cb, GetTempAllocator());
 }
+
+TempWstr ToWstrTemp(const StrSpan& s) {
+    return ToWstrTemp(s.data(), s.size());
+}
@@ -6,6 +6,18 @@
 Allocator* GetTempAllocator();
 void DestroyTempAllocator();
 void ResetTempAllocator();
+// the most memory the temp allocator of this thread has used
+size_t TempAllocatorHighWater();
+
+// frees temp allocations made during its lifetime, for long running threads
+// that don't get to call ResetTempAllocator() regularly. Temp values
+// allocated inside the scope must not be used after it ends
+struct TempAllocatorScope {
+    PoolAllocator* allocator = nullptr;
+    PoolAllocator::Mark mark;
+    TempAllocatorScope();
+    ~TempAllocatorScope();
+};
 
 // exists just to mark the intent
 using TempStr = char*;
@@ -14,6 +26,7 @@ using TempWstr = WCHAR*;
 namespace str {
 TempStr DupTemp(const char* s, size_t cb = (size_t)-1);
 TempWstr DupTemp(const WCHAR* s, size_t cch = (size_t)-1);
+TempStr DupTemp(const StrSpan&);
 
 TempStr JoinTemp(const char* s1, const char* s2, const char* s3 = nullptr);
 TempWstr JoinTemp(const WCHAR* s1, const WCHAR* s2, const WCHAR* s3 = nullptr);
@@ -21,3 +34,4 @@ TempWstr JoinTemp(const WCHAR* s1, const WCHAR* s2, const WCHAR* s3 = nullptr);
 
 TempStr ToUtf8Temp(const WCHAR* s, size_t cch = (size_t)-1);
 TempWstr ToWstrTemp(const char* s, size_t cb = (size_t)-1);
+TempWstr ToWstrTemp(const StrSpan&);
@@ -0,0 +1,955 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/TextMatcher.h"
+
+/*
+Patterns are parsed into a tree of Node. Patterns made only of literal
+alternatives are matched with AhoCorasickMatcher, all others with
+GlushkovMatcher.
+
+GlushkovMatcher builds a position automaton (each char or char class of the
+expanded pattern is a position, see "Glushkov automaton") with at most 64
+positions, so that the set of active positions fits into a u64 and is
+advanced by a few table lookups per char of text. To get the leftmost
+match, it also tracks for every active position the leftmost start from
+which it was reached.
+*/
+
+// max number of chars and char classes in a pattern for GlushkovMatcher
+constexpr int kMaxPositions = 64;
+// max n and m in {n,m}
+constexpr int kMaxRepeat = 1000;
+// limits the work for patterns like "(){1000}{1000}"
+constexpr int kMaxBuildSteps = 100000;
+
+enum {
+    kClassDigit = 1,
+    kClassNotDigit = 2,
+    kClassWord = 4,
+    kClassNotWord = 8,
+    kClassSpace = 16,
+    kClassNotSpace = 32,
+};
+
+static bool IsWordCharacter(WCHAR c) {
+    return IsCharAlphaNumericW(c) || c == '_';
+}
+
+static int LowestBitIndex(u64 v) {
+    unsigned long idx;
+    u32 lo = (u32)v;
+    if (lo != 0) {
+        _BitScanForward(&idx, lo);
+        return (int)idx;
+    }
+    _BitScanForward(&idx, (u32)(v >> 32));
+    return (int)idx + 32;
+}
+
+static inline WCHAR FoldChar(const WCHAR* lowerCase, WCHAR c) {
+    return lowerCase ? lowerCase[c] : c;
+}
+
+// a set of (case-folded) chars
+struct CharSet {
+    // chars < 256
+    u64 bits[4] = {};
+    // pairs of first and last char of ranges of chars >= 256
+    Vec<WCHAR> ranges;
+    int classes = 0;
+    bool negated = false;
+
+    void AddChar(WCHAR c);
+    void AddRange(WCHAR lo, WCHAR hi, const WCHAR* lowerCase);
+    bool InRanges(WCHAR c) const;
+    bool Contains(WCHAR c) const;
+    bool MayContainNonAscii() const;
+};
+
+void CharSet::AddChar(WCHAR c) {
+    if (c < 256) {
+        bits[c >> 6] |= (u64)1 << (c & 63);
+        return;
+    }
+    size_t n = ranges.size();
+    if (n > 0 && ranges[n - 1] + 1 == c) {
+        ranges[n - 1] = c;
+        return;
+    }
+    if (InRanges(c)) {
+        return;
+    }
+    ranges.Append(c);
+    ranges.Append(c);
+}
+
+void CharSet::AddRange(WCHAR lo, WCHAR hi, const WCHAR* lowerCase) {
+    for (int c = lo; c <= hi && c < 256; c++) {
+        AddChar(FoldChar(lowerCase, (WCHAR)c));
+    }
+    if (hi >= 256) {
+        WCHAR first = std::max(lo, (WCHAR)256);
+        ranges.Append(first);
+        ranges.Append(hi);
+    }
+    if (!lowerCase) {
+        return;
+    }
+    // chars >= 256 in the range whose lower case is outside of it
+    for (int c = std::max((int)lo, 256); c <= hi; c++) {
+        WCHAR lc = lowerCase[c];
+        if (lc < lo || lc > hi) {
+            AddChar(lc);
+        }
+    }
+}
+
+bool CharSet::InRanges(WCHAR c) const {
+    size_t n = ranges.size();
+    for (size_t i = 0; i < n; i += 2) {
+        if (ranges[i] <= c && c <= ranges[i + 1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CharSet::Contains(WCHAR c) const {
+    bool res;
+    if (c < 256) {
+        res = (bits[c >> 6] & ((u64)1 << (c & 63))) != 0;
+    } else {
+        res = InRanges(c);
+    }
+    if (!res && classes != 0) {
+        bool isDigit = c >= '0' && c <= '9';
+        bool isSpace = str::IsWs(c);
+        bool isWord = IsWordCharacter(c);
+        res = ((classes & kClassDigit) && isDigit) || ((classes & kClassNotDigit) && !isDigit) ||
+              ((classes & kClassWord) && isWord) || ((classes & kClassNotWord) && !isWord) ||
+              ((classes & kClassSpace) && isSpace) || ((classes & kClassNotSpace) && !isSpace);
+    }
+    return res != negated;
+}
+
+bool CharSet::MayContainNonAscii() const {
+    // \d and \s don't match chars >= 256 when negated
+    return negated || ranges.size() > 0 || (classes & ~(kClassDigit)) != 0;
+}
+
+enum class NodeType {
+    Empty,
+    Chars,
+    Cat,
+    Alt,
+    Repeat,
+};
+
+struct Node {
+    NodeType type = NodeType::Empty;
+    // for Chars
+    int set = -1;
+    // for Chars matching a single char, e.g. 'a' or ' ' (for any whitespace)
+    bool isLiteral = false;
+    WCHAR literal = 0;
+    // for Cat, Alt and Repeat
+    Node* a = nullptr;
+    Node* b = nullptr;
+    // for Repeat, max is -1 for unbounded
+    int min = 0;
+    int max = 0;
+};
+
+struct PatternParser {
+    const WCHAR* s = nullptr;
+    const WCHAR* lowerCase = nullptr;
+    Vec<Node*> nodes;
+    Vec<CharSet*> sets;
+    bool failed = false;
+
+    PatternParser(const WCHAR* pattern, const WCHAR* lowerCase) : s(pattern), lowerCase(lowerCase) {
+    }
+    ~PatternParser() {
+        DeleteVecMembers(nodes);
+        DeleteVecMembers(sets);
+    }
+
+    Node* NewNode(NodeType type, Node* a = nullptr, Node* b = nullptr);
+    Node* NewChars(CharSet* set);
+    Node* NewLiteral(WCHAR c);
+    Node* Fail();
+
+    Node* Parse();
+    Node* ParseAlt();
+    Node* ParseCat();
+    Node* ParseRepeat();
+    Node* ParseAtom();
+    Node* ParseClass();
+    bool ParseEscape(WCHAR* charOut, int* classOut);
+    bool ParseInt(int* nOut);
+};
+
+Node* PatternParser::NewNode(NodeType type, Node* a, Node* b) {
+    Node* n = new Node();
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    nodes.Append(n);
+    return n;
+}
+
+Node* PatternParser::NewChars(CharSet* set) {
+    Node* n = NewNode(NodeType::Chars);
+    n->set = sets.isize();
+    sets.Append(set);
+    return n;
+}
+
+Node* PatternParser::NewLiteral(WCHAR c) {
+    auto set = new CharSet();
+    WCHAR lit = FoldChar(lowerCase, c);
+    if (str::IsWs(c)) {
+        set->classes = kClassSpace;
+        lit = ' ';
+    } else {
+        set->AddRange(c, c, lowerCase);
+    }
+    Node* n = NewChars(set);
+    n->isLiteral = true;
+    n->literal = lit;
+    return n;
+}
+
+Node* PatternParser::Fail() {
+    failed = true;
+    return nullptr;
+}
+
+Node* PatternParser::Parse() {
+    Node* n = ParseAlt();
+    if (failed || *s) {
+        // e.g. unbalanced ')'
+        return nullptr;
+    }
+    return n;
+}
+
+Node* PatternParser::ParseAlt() {
+    Node* n = ParseCat();
+    while (!failed && *s == '|') {
+        s++;
+        Node* n2 = ParseCat();
+        n = NewNode(NodeType::Alt, n, n2);
+    }
+    return n;
+}
+
+Node* PatternParser::ParseCat() {
+    Node* n = NewNode(NodeType::Empty);
+    while (!failed && *s && *s != '|' && *s != ')') {
+        Node* n2 = ParseRepeat();
+        if (!n2) {
+            return Fail();
+        }
+        n = n->type == NodeType::Empty ? n2 : NewNode(NodeType::Cat, n, n2);
+    }
+    return n;
+}
+
+bool PatternParser::ParseInt(int* nOut) {
+    if (!str::IsDigit(*s)) {
+        return false;
+    }
+    int n = 0;
+    for (; str::IsDigit(*s); s++) {
+        n = n * 10 + (*s - '0');
+        if (n > kMaxRepeat) {
+            return false;
+        }
+    }
+    *nOut = n;
+    return true;
+}
+
+Node* PatternParser::ParseRepeat() {
+    Node* n = ParseAtom();
+    while (n && !failed) {
+        int min, max;
+        if (*s == '*') {
+            min = 0;
+            max = -1;
+        } else if (*s == '+') {
+            min = 1;
+            max = -1;
+        } else if (*s == '?') {
+            min = 0;
+            max = 1;
+        } else if (*s == '{') {
+            s++;
+            if (!ParseInt(&min)) {
+                return Fail();
+            }
+            max = min;
+            if (*s == ',') {
+                s++;
+                max = -1;
+                if (*s != '}' && (!ParseInt(&max) || max < min)) {
+                    return Fail();
+                }
+            }
+            if (*s != '}') {
+                return Fail();
+            }
+        } else {
+            break;
+        }
+        s++;
+        Node* r = NewNode(NodeType::Repeat, n);
+        r->min = min;
+        r->max = max;
+        n = r;
+    }
+    return n;
+}
+
+// parses the part after '\'
+bool PatternParser::ParseEscape(WCHAR* charOut, int* classOut) {
+    *classOut = 0;
+    WCHAR c = *s;
+    if (!c) {
+        return false;
+    }
+    s++;
+    switch (c) {
+        case 'd':
+            *classOut = kClassDigit;
+            return true;
+        case 'D':
+            *classOut = kClassNotDigit;
+            return true;
+        case 'w':
+            *classOut = kClassWord;
+            return true;
+        case 'W':
+            *classOut = kClassNotWord;
+            return true;
+        case 's':
+            *classOut = kClassSpace;
+            return true;
+        case 'S':
+            *classOut = kClassNotSpace;
+            return true;
+        case 't':
+            *charOut = '\t';
+            return true;
+        case 'n':
+            *charOut = '\n';
+            return true;
+        case 'u': {
+            int v = 0;
+            for (int i = 0; i < 4; i++, s++) {
+                int h = *s;
+                if (h >= '0' && h <= '9') {
+                    h -= '0';
+                } else if (h >= 'a' && h <= 'f') {
+                    h -= 'a' - 10;
+                } else if (h >= 'A' && h <= 'F') {
+                    h -= 'A' - 10;
+                } else {
+                    return false;
+                }
+                v = v * 16 + h;
+            }
+            *charOut = (WCHAR)v;
+            return v != 0;
+        }
+    }
+    if (IsWordCharacter(c)) {
+        // reserve other escapes like \b for the future
+        return false;
+    }
+    *charOut = c;
+    return true;
+}
+
+Node* PatternParser::ParseClass() {
+    auto set = new CharSet();
+    Node* n = NewChars(set);
+    if (*s == '^') {
+        set->negated = true;
+        s++;
+    }
+    bool first = true;
+    while (*s != ']' || first) {
+        first = false;
+        if (!*s) {
+            return Fail();
+        }
+        WCHAR lo;
+        int cls = 0;
+        if (*s == '\\') {
+            s++;
+            if (!ParseEscape(&lo, &cls)) {
+                return Fail();
+            }
+        } else {
+            lo = *s++;
+        }
+        if (cls != 0) {
+            set->classes |= cls;
+            continue;
+        }
+        WCHAR hi = lo;
+        if (s[0] == '-' && s[1] && s[1] != ']') {
+            s++;
+            if (*s == '\\') {
+                s++;
+                if (!ParseEscape(&hi, &cls) || cls != 0) {
+                    return Fail();
+                }
+            } else {
+                hi = *s++;
+            }
+            if (hi < lo) {
+                return Fail();
+            }
+        }
+        set->AddRange(lo, hi, lowerCase);
+    }
+    s++;
+    return n;
+}
+
+Node* PatternParser::ParseAtom() {
+    WCHAR c = *s;
+    switch (c) {
+        case '(': {
+            s++;
+            if (s[0] == '?' && s[1] == ':') {
+                s += 2;
+            }
+            Node* n = ParseAlt();
+            if (failed || *s != ')') {
+                return Fail();
+            }
+            s++;
+            return n;
+        }
+        case '[':
+            s++;
+            return ParseClass();
+        case '.': {
+            s++;
+            auto set = new CharSet();
+            set->AddChar('\n');
+            set->negated = true;
+            return NewChars(set);
+        }
+        case '\\': {
+            s++;
+            WCHAR lit;
+            int cls;
+            if (!ParseEscape(&lit, &cls)) {
+                return Fail();
+            }
+            if (cls == 0) {
+                return NewLiteral(lit);
+            }
+            auto set = new CharSet();
+            set->classes = cls;
+            return NewChars(set);
+        }
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case '}':
+        case ']':
+        case ')':
+        // anchors aren't supported
+        case '^':
+        case '$':
+            return Fail();
+    }
+    s++;
+    if (str::IsWs(c)) {
+        // like in regular search, whitespace matches any run of whitespace
+        while (str::IsWs(*s)) {
+            s++;
+        }
+        Node* n = NewNode(NodeType::Repeat, NewLiteral(c));
+        n->min = 1;
+        n->max = -1;
+        return n;
+    }
+    return NewLiteral(c);
+}
+
+bool TextMatcher::FindLast(const WCHAR* s, int len, int before, int* startOut, int* endOut) const {
+    bool found = false;
+    int from = 0;
+    int start, end;
+    while (from < before && Find(s, len, from, &start, &end) && start < before) {
+        *startOut = start;
+        *endOut = end;
+        found = true;
+        from = start + 1;
+    }
+    return found;
+}
+
+struct GlushkovSets {
+    bool nullable = true;
+    u64 first = 0;
+    u64 last = 0;
+};
+
+struct GlushkovMatcher : TextMatcher {
+    const WCHAR* lowerCase = nullptr;
+    int nPositions = 0;
+    int nBuildSteps = 0;
+    // CharSet of each position
+    int posSet[kMaxPositions] = {};
+    Vec<CharSet*> sets;
+
+    u64 first = 0;
+    u64 last = 0;
+    u64 follow[kMaxPositions] = {};
+    // positions that have a position in their follow set
+    u64 preceding[kMaxPositions] = {};
+    // followTable[k][b] is the union of follow sets of positions 8*k + bit in b
+    u64 followTable[8][256] = {};
+    // positions matching chars < 256
+    u64 asciiMasks[256] = {};
+    // positions that might match chars >= 256
+    u64 nonAsciiPositions = 0;
+
+    ~GlushkovMatcher() override {
+        DeleteVecMembers(sets);
+    }
+
+    bool Build(Node* n, GlushkovSets& res);
+    void AddFollow(u64 from, u64 to);
+    GlushkovSets Cat(const GlushkovSets& a, const GlushkovSets& b);
+    void BuildTables();
+
+    u64 Mask(WCHAR c) const;
+    u64 FollowOf(u64 d) const;
+    bool Find(const WCHAR* s, int len, int from, int* startOut, int* endOut) const override;
+};
+
+void GlushkovMatcher::AddFollow(u64 from, u64 to) {
+    for (u64 p = from; p != 0; p &= p - 1) {
+        follow[LowestBitIndex(p)] |= to;
+    }
+}
+
+GlushkovSets GlushkovMatcher::Cat(const GlushkovSets& a, const GlushkovSets& b) {
+    AddFollow(a.last, b.first);
+    GlushkovSets res;
+    res.nullable = a.nullable && b.nullable;
+    res.first = a.first | (a.nullable ? b.first : 0);
+    res.last = b.last | (b.nullable ? a.last : 0);
+    return res;
+}
+
+// a node is visited once for every copy of it in the expanded pattern,
+// each visit gets new positions
+bool GlushkovMatcher::Build(Node* n, GlushkovSets& res) {
+    res = GlushkovSets();
+    if (++nBuildSteps > kMaxBuildSteps) {
+        return false;
+    }
+    GlushkovSets a, b;
+    switch (n->type) {
+        case NodeType::Empty:
+            return true;
+        case NodeType::Chars: {
+            if (nPositions == kMaxPositions) {
+                return false;
+            }
+            int p = nPositions++;
+            posSet[p] = n->set;
+            res.nullable = false;
+            res.first = res.last = (u64)1 << p;
+            return true;
+        }
+        case NodeType::Cat:
+            if (!Build(n->a, a) || !Build(n->b, b)) {
+                return false;
+            }
+            res = Cat(a, b);
+            return true;
+        case NodeType::Alt:
+            if (!Build(n->a, a) || !Build(n->b, b)) {
+                return false;
+            }
+            res.nullable = a.nullable || b.nullable;
+            res.first = a.first | b.first;
+            res.last = a.last | b.last;
+            return true;
+        case NodeType::Repeat:
+            for (int i = 0; i < n->min; i++) {
+                if (!Build(n->a, a)) {
+                    return false;
+                }
+                res = Cat(res, a);
+            }
+            if (n->max < 0) {
+                if (!Build(n->a, a)) {
+                    return false;
+                }
+                AddFollow(a.last, a.first);
+                a.nullable = true;
+                res = Cat(res, a);
+                return true;
+            }
+            // a{2,4} is expanded to aaa?a?
+            for (int i = n->min; i < n->max; i++) {
+                if (!Build(n->a, a)) {
+                    return false;
+                }
+                a.nullable = true;
+                res = Cat(res, a);
+            }
+            return true;
+    }
+    return false;
+}
+
+void GlushkovMatcher::BuildTables() {
+    for (int p = 0; p < nPositions; p++) {
+        u64 bit = (u64)1 << p;
+        for (u64 q = follow[p]; q != 0; q &= q - 1) {
+            preceding[LowestBitIndex(q)] |= bit;
+        }
+        for (int b = 0; b < 256; b++) {
+            if ((b >> (p & 7)) & 1) {
+                followTable[p >> 3][b] |= follow[p];
+            }
+        }
+        CharSet* set = sets[posSet[p]];
+        for (int c = 0; c < 256; c++) {
+            if (set->Contains((WCHAR)c)) {
+                asciiMasks[c] |= bit;
+            }
+        }
+        if (set->MayContainNonAscii()) {
+            nonAsciiPositions |= bit;
+        }
+    }
+}
+
+u64 GlushkovMatcher::Mask(WCHAR c) const {
+    if (c < 256) {
+        return asciiMasks[c];
+    }
+    u64 m = 0;
+    for (u64 p = nonAsciiPositions; p != 0; p &= p - 1) {
+        int i = LowestBitIndex(p);
+        if (sets[posSet[i]]->Contains(c)) {
+            m |= (u64)1 << i;
+        }
+    }
+    return m;
+}
+
+u64 GlushkovMatcher::FollowOf(u64 d) const {
+    u64 res = 0;
+    for (int k = 0; d != 0; k++, d >>= 8) {
+        res |= followTable[k][d & 0xff];
+    }
+    return res;
+}
+
+bool GlushkovMatcher::Find(const WCHAR* s, int len, int from, int* startOut, int* endOut) const {
+    // active positions and the leftmost start each of them was reached from
+    u64 d = 0;
+    int somBuf1[kMaxPositions];
+    int somBuf2[kMaxPositions];
+    int* som = somBuf1;
+    int* somNew = somBuf2;
+    int bestStart = -1;
+    int bestEnd = -1;
+    for (int i = from; i < len; i++) {
+        if (d == 0) {
+            // skip to a char that can start a match
+            while (i < len && (Mask(FoldChar(lowerCase, s[i])) & first) == 0) {
+                i++;
+            }
+            if (i == len) {
+                break;
+            }
+        }
+        u64 m = Mask(FoldChar(lowerCase, s[i]));
+        // once there's a match, matches starting later can't be the leftmost
+        u64 starts = bestStart < 0 ? first & m : 0;
+        u64 dNew = (FollowOf(d) & m) | starts;
+        for (u64 q = dNew; q != 0; q &= q - 1) {
+            int qi = LowestBitIndex(q);
+            int start = (starts >> qi) & 1 ? i : INT_MAX;
+            for (u64 p = d & preceding[qi]; p != 0; p &= p - 1) {
+                start = std::min(start, som[LowestBitIndex(p)]);
+            }
+            somNew[qi] = start;
+            if (bestStart >= 0 && start > bestStart) {
+                dNew &= ~((u64)1 << qi);
+            }
+        }
+        for (u64 q = dNew & last; q != 0; q &= q - 1) {
+            int start = somNew[LowestBitIndex(q)];
+            if (bestStart < 0 || start <= bestStart) {
+                bestStart = start;
+                bestEnd = i + 1;
+            }
+        }
+        d = dNew;
+        std::swap(som, somNew);
+        if (d == 0 && bestStart >= 0) {
+            break;
+        }
+    }
+    if (bestStart < 0) {
+        return false;
+    }
+    *startOut = bestStart;
+    *endOut = bestEnd;
+    return true;
+}
+
+struct AhoCorasickMatcher : TextMatcher {
+    struct AcNode {
+        int fail = 0;
+        int firstEdge = -1;
+        // length of the longest term that ends at this node
+        int longestTerm = 0;
+    };
+    struct AcEdge {
+        WCHAR c;
+        int to;
+        int next;
+    };
+
+    const WCHAR* lowerCase = nullptr;
+    Vec<AcNode> nodes;
+    Vec<AcEdge> edges;
+    // edges from the root node for chars < 256
+    int rootNext[256] = {};
+    int maxTermLen = 0;
+
+    int Goto(int node, WCHAR c) const;
+    void AddTerm(const WCHAR* term);
+    void Finish();
+    WCHAR Fold(WCHAR c) const;
+    bool Find(const WCHAR* s, int len, int from, int* startOut, int* endOut) const override;
+};
+
+// -1 if there's no edge, except for the root node, which has
+// an implicit edge to itself for every char
+int AhoCorasickMatcher::Goto(int node, WCHAR c) const {
+    if (node == 0 && c < 256) {
+        return rootNext[c];
+    }
+    for (int e = nodes[node].firstEdge; e >= 0; e = edges[e].next) {
+        if (edges[e].c == c) {
+            return edges[e].to;
+        }
+    }
+    return node == 0 ? 0 : -1;
+}
+
+void AhoCorasickMatcher::AddTerm(const WCHAR* term) {
+    if (nodes.size() == 0) {
+        nodes.Append(AcNode());
+    }
+    int node = 0;
+    int len = 0;
+    for (const WCHAR* c = term; *c; c++, len++) {
+        int next = Goto(node, *c);
+        if (next <= 0) {
+            next = nodes.isize();
+            nodes.Append(AcNode());
+            AcEdge e = {*c, next, nodes[node].firstEdge};
+            nodes[node].firstEdge = edges.isize();
+            edges.Append(e);
+            if (node == 0 && *c < 256) {
+                rootNext[*c] = next;
+            }
+        }
+        node = next;
+    }
+    nodes[node].longestTerm = len;
+    maxTermLen = std::max(maxTermLen, len);
+}
+
+// computes fail links in breadth first order
+void AhoCorasickMatcher::Finish() {
+    Vec<int> queue;
+    queue.Append(0);
+    for (size_t i = 0; i < queue.size(); i++) {
+        int node = queue[i];
+        for (int e = nodes[node].firstEdge; e >= 0; e = edges[e].next) {
+            WCHAR c = edges[e].c;
+            int child = edges[e].to;
+            int fail = 0;
+            if (node != 0) {
+                int f = nodes[node].fail;
+                while (Goto(f, c) < 0) {
+                    f = nodes[f].fail;
+                }
+                fail = Goto(f, c);
+            }
+            nodes[child].fail = fail;
+            nodes[child].longestTerm = std::max(nodes[child].longestTerm, nodes[fail].longestTerm);
+            queue.Append(child);
+        }
+    }
+}
+
+WCHAR AhoCorasickMatcher::Fold(WCHAR c) const {
+    if (str::IsWs(c)) {
+        return ' ';
+    }
+    return FoldChar(lowerCase, c);
+}
+
+// runs of whitespace in the text are matched as a single ' ', so the position
+// of the chars that were fed to the automaton is remembered in a ring buffer
+bool AhoCorasickMatcher::Find(const WCHAR* s, int len, int from, int* startOut, int* endOut) const {
+    int node = 0;
+    int bestStart = -1;
+    int bestEnd = -1;
+    Vec<int> pos;
+    for (int i = 0; i < maxTermLen; i++) {
+        pos.Append(0);
+    }
+    int nFed = 0;
+    for (int i = from; i < len; i++) {
+        WCHAR c = Fold(s[i]);
+        if (c == ' ' && i > from && str::IsWs(s[i - 1])) {
+            continue;
+        }
+        pos[nFed % maxTermLen] = i;
+        nFed++;
+        int next;
+        while ((next = Goto(node, c)) < 0) {
+            node = nodes[node].fail;
+        }
+        node = next;
+        int n = nodes[node].longestTerm;
+        if (n > 0) {
+            // the longest term ending here is the one starting leftmost
+            int start = pos[(nFed - n) % maxTermLen];
+            if (bestStart < 0 || start <= bestStart) {
+                bestStart = start;
+                bestEnd = i + 1;
+            }
+        }
+        // terms ending later start after bestStart
+        int nextStart = nFed + 1 - maxTermLen;
+        if (bestStart >= 0 && nextStart >= 0 && pos[nextStart % maxTermLen] > bestStart) {
+            break;
+        }
+    }
+    if (bestStart < 0) {
+        return false;
+    }
+    // a match that ends in whitespace extends over the whole run
+    while (str::IsWs(s[bestEnd - 1]) && bestEnd < len && str::IsWs(s[bestEnd])) {
+        bestEnd++;
+    }
+    *startOut = bestStart;
+    *endOut = bestEnd;
+    return true;
+}
+
+// appends the literal chars of a concatenation to term
+static bool CollectLiteralChars(Node* n, str::WStr& term) {
+    switch (n->type) {
+        case NodeType::Empty:
+            return true;
+        case NodeType::Chars:
+            if (!n->isLiteral) {
+                return false;
+            }
+            term.AppendChar(n->literal);
+            return true;
+        case NodeType::Cat:
+            return CollectLiteralChars(n->a, term) && CollectLiteralChars(n->b, term);
+        case NodeType::Repeat:
+            // a run of whitespace, which AhoCorasickMatcher collapses to a single ' '
+            if (n->min == 1 && n->max == -1 && n->a->isLiteral && n->a->literal == ' ') {
+                term.AppendChar(' ');
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// collects the terms of patterns like "foo|bar|baz"
+static bool CollectLiteralTerms(Node* n, Vec<WCHAR*>& terms) {
+    if (n->type == NodeType::Alt) {
+        return CollectLiteralTerms(n->a, terms) && CollectLiteralTerms(n->b, terms);
+    }
+    str::WStr term;
+    if (!CollectLiteralChars(n, term)) {
+        return false;
+    }
+    terms.Append(term.StealData());
+    return true;
+}
+
+static void FreeTerms(Vec<WCHAR*>& terms) {
+    for (WCHAR* term : terms) {
+        str::Free(term);
+    }
+    terms.Reset();
+}
+
+TextMatcher* CompileTextMatcher(const WCHAR* pattern, const WCHAR* lowerCase) {
+    PatternParser parser(pattern, lowerCase);
+    Node* root = parser.Parse();
+    if (!root) {
+        return nullptr;
+    }
+
+    Vec<WCHAR*> terms;
+    if (CollectLiteralTerms(root, terms)) {
+        AhoCorasickMatcher* m = new AhoCorasickMatcher();
+        m->lowerCase = lowerCase;
+        bool hasEmptyTerm = false;
+        for (WCHAR* term : terms) {
+            hasEmptyTerm |= str::IsEmpty(term);
+            m->AddTerm(term);
+        }
+        FreeTerms(terms);
+        if (hasEmptyTerm) {
+            delete m;
+            return nullptr;
+        }
+        m->Finish();
+        return m;
+    }
+    FreeTerms(terms);
+
+    GlushkovMatcher* m = new GlushkovMatcher();
+    m->lowerCase = lowerCase;
+    GlushkovSets res;
+    bool ok = m->Build(root, res);
+    // the matcher takes over the sets
+    m->sets = parser.sets;
+    parser.sets.Reset();
+    if (!ok || res.nullable) {
+        // too many positions or matches the empty string
+        delete m;
+        return nullptr;
+    }
+    m->first = res.first;
+    m->last = res.last;
+    m->BuildTables();
+    return m;
+}
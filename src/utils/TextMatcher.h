@@ -0,0 +1,27 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Finds matches of a regular expression in UTF-16 text in time linear
+// in the length of the text (there's no backtracking).
+//
+// Supported syntax: chars, '.', [...] and [^...] with ranges, \d \w \s \D \W \S,
+// \t \n \uXXXX, escaped meta chars, (...) and (?:...), '|', '*', '+', '?',
+// {n}, {n,} and {n,m}. Whitespace in the pattern matches any run of whitespace.
+// Matches are leftmost-longest.
+//
+// A pattern that only consists of literal alternatives ("foo|bar|baz") is
+// matched with Aho-Corasick and can have any number of terms. Other patterns
+// can have at most 64 chars and char classes (after expanding {n,m}).
+
+struct TextMatcher {
+    virtual ~TextMatcher() = default;
+
+    // finds the leftmost-longest match that starts at or after from
+    virtual bool Find(const WCHAR* s, int len, int from, int* startOut, int* endOut) const = 0;
+    // finds the last match that starts before before
+    bool FindLast(const WCHAR* s, int len, int before, int* startOut, int* endOut) const;
+};
+
+// lowerCase maps every UTF-16 code unit to its lower case (nullptr for case-sensitive
+// matching). Returns nullptr if pattern is invalid, too complex or matches the empty string
+TextMatcher* CompileTextMatcher(const WCHAR* pattern, const WCHAR* lowerCase);
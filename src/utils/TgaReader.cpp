@@ -4,6 +4,13 @@
 #include "BaseUtil.h"
 #include "TgaReader.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 namespace tga {
 
 #define TGA_FOOTER_SIGNATURE "TRUEVISION-XFILE."
@@ -120,6 +127,7 @@ static const TgaExtArea* GetExtAreaPtr(const u8* data, size_t len) {
 
 // note: we only support the more common bit depths:
 // http://www.ryanjuckett.com/programming/graphics/26-parsing-colors-in-a-tga-file
+// 24-bit and grayscale images are expanded to 32 bpp, which GDI+ draws the fastest
 static Gdiplus::PixelFormat GetPixelFormat(const TgaHeader* headerLE, ImageAlpha aType = Alpha_Normal) {
     int bits;
     if (Type_Palette == headerLE->imageType || Type_Palette_RLE == headerLE->imageType) {
@@ -134,7 +142,7 @@ static Gdiplus::PixelFormat GetPixelFormat(const TgaHeader* headerLE, ImageAlpha
             return 0;
         }
         // using a non-indexed format so that we don't have to bother with a palette
-        return PixelFormat24bppRGB;
+        return PixelFormat32bppRGB;
     } else {
         return 0;
     }
@@ -150,7 +158,7 @@ static Gdiplus::PixelFormat GetPixelFormat(const TgaHeader* headerLE, ImageAlpha
         return PixelFormat16bppARGB1555;
     }
     if (24 == bits && 0 == alphaBits) {
-        return PixelFormat24bppRGB;
+        return PixelFormat32bppRGB;
     }
     if (32 == bits && (0 == alphaBits || Alpha_Ignore == aType)) {
         return PixelFormat32bppRGB;
@@ -266,68 +274,174 @@ struct ReadState {
     const u8* end;
     ImageType type;
     int n;
+    // bytes per pixel in the bitmap (2 or 4)
+    int outN;
     bool isRLE;
     int repeat;
     bool repeatSame;
     struct {
         int firstEntry;
         int length;
-        const u8* data;
-        int n;
+        // palette entries converted to the bitmap's pixel format
+        const u32* colors;
     } cmap;
     bool failed;
 };
 
-static inline void CopyPixel(u8* dst, const u8* src, int n) {
+// converts count pixels of 3 bytes (BGR) to 4 bytes (BGRA)
+static void Expand24To32(const u8* src, u32* dst, int count) {
+    int i = 0;
+#if USE_SSE2
+    // shift each of 4 pixels into its own 32-bit lane. Loads 16 bytes
+    // for 12 bytes of pixels, so stop early enough not to read past src
+    const __m128i m0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+    const __m128i m1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+    const __m128i m2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+    const __m128i m3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 6 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        __m128i r = _mm_or_si128(_mm_and_si128(v, m0), _mm_and_si128(_mm_slli_si128(v, 1), m1));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_slli_si128(v, 2), m2));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_slli_si128(v, 3), m3));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(r, alpha));
+    }
+#endif
+    for (; i < count; i++) {
+        const u8* px = src + i * 3;
+        dst[i] = px[0] | (px[1] << 8) | (px[2] << 16) | 0xFF000000;
+    }
+}
+
+static void ExpandGrayTo32(const u8* src, u32* dst, int count) {
+    int i = 0;
+#if USE_SSE2
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, v);
+        __m128i hi = _mm_unpackhi_epi8(v, v);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = src[i] * 0x010101 | 0xFF000000;
+    }
+}
+
+static u32 ReadPaletteColor(const u8* src, int n) {
     switch (n) {
-        case 3:
-            dst[2] = src[2]; // fall through
         case 2:
-            *(u16*)dst = *(u16*)src;
-            break;
+            return src[0] | (src[1] << 8);
+        case 3:
+            return src[0] | (src[1] << 8) | (src[2] << 16) | 0xFF000000;
         case 4:
-            *(u32*)dst = *(u32*)src;
-            break;
+            return src[0] | (src[1] << 8) | (src[2] << 16) | ((u32)src[3] << 24);
         default:
             CrashIf(true);
+            return 0;
     }
 }
 
-static void ReadPixel(ReadState& s, u8* dst) {
-    if (s.isRLE && 0 == s.repeat && s.data < s.end) {
-        s.repeat = (*s.data & 0x7F) + 1;
-        s.repeatSame = (*s.data & 0x80);
-        s.data++;
-    }
-    if (s.data + s.n > s.end) {
-        s.failed = true;
-        return;
-    }
-
-    int idx;
+// converts count pixels of s.n bytes (in the file) to s.outN bytes (in the bitmap)
+static void ConvertPixels(ReadState& s, const u8* src, int count, u8* dst) {
     switch (s.type) {
         case Type_Palette:
         case Type_Palette_RLE:
-            idx = ((u8)s.data[0] | (2 == s.n ? ((u8)s.data[1] << 8) : 0)) - s.cmap.firstEntry;
-            if (0 <= idx && idx < s.cmap.length) {
-                CopyPixel(dst, s.cmap.data + idx * s.cmap.n, s.cmap.n);
+            for (int i = 0; i < count; i++) {
+                const u8* px = src + i * s.n;
+                int idx = (px[0] | (2 == s.n ? (px[1] << 8) : 0)) - s.cmap.firstEntry;
+                u32 c = 0 <= idx && idx < s.cmap.length ? s.cmap.colors[idx] : 0;
+                if (4 == s.outN) {
+                    ((u32*)dst)[i] = c;
+                } else {
+                    ((u16*)dst)[i] = (u16)c;
+                }
             }
             break;
         case Type_Truecolor:
         case Type_Truecolor_RLE:
-            CopyPixel(dst, s.data, s.n);
+            if (s.n == s.outN) {
+                memcpy(dst, src, (size_t)count * s.n);
+            } else {
+                Expand24To32(src, (u32*)dst, count);
+            }
             break;
         case Type_Grayscale:
         case Type_Grayscale_RLE:
-            dst[0] = dst[1] = dst[2] = s.data[0];
+            ExpandGrayTo32(src, (u32*)dst, count);
             break;
     }
+}
 
-    if (!s.isRLE || 0 == --s.repeat || !s.repeatSame) {
-        s.data += s.n;
+static void FillPixels(u8* dst, const u8* px, int count, int n) {
+    if (4 == n) {
+        std::fill_n((u32*)dst, count, *(const u32*)px);
+    } else {
+        std::fill_n((u16*)dst, count, *(const u16*)px);
     }
 }
 
+// reads a row of w pixels in file order, converting whole runs at a time
+// (RLE packets may span rows, so s.repeat carries over to the next row)
+static void ReadRow(ReadState& s, u8* rowOut, int w) {
+    if (!s.isRLE) {
+        if ((size_t)(s.end - s.data) < (size_t)w * s.n) {
+            s.failed = true;
+            return;
+        }
+        ConvertPixels(s, s.data, w, rowOut);
+        s.data += (size_t)w * s.n;
+        return;
+    }
+    for (int x = 0; x < w;) {
+        if (0 == s.repeat) {
+            if (s.data >= s.end) {
+                s.failed = true;
+                return;
+            }
+            s.repeat = (*s.data & 0x7F) + 1;
+            s.repeatSame = (*s.data & 0x80);
+            s.data++;
+        }
+        int count = std::min(s.repeat, w - x);
+        if (s.repeatSame) {
+            if (s.data + s.n > s.end) {
+                s.failed = true;
+                return;
+            }
+            u32 px = 0;
+            ConvertPixels(s, s.data, 1, (u8*)&px);
+            FillPixels(rowOut + x * s.outN, (u8*)&px, count, s.outN);
+            s.repeat -= count;
+            if (0 == s.repeat) {
+                s.data += s.n;
+            }
+        } else {
+            if ((size_t)(s.end - s.data) < (size_t)count * s.n) {
+                s.failed = true;
+                return;
+            }
+            ConvertPixels(s, s.data, count, rowOut + x * s.outN);
+            s.data += (size_t)count * s.n;
+            s.repeat -= count;
+        }
+        x += count;
+    }
+}
+
+static void ReverseRow(u8* row, int w, int n) {
+    if (4 == n) {
+        std::reverse((u32*)row, (u32*)row + w);
+    } else {
+        std::reverse((u16*)row, (u16*)row + w);
+    }
+}
+
+// decodes the pixels straight into the bitmap's memory
 Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
     size_t len = d.size();
     const u8* data = (const u8*)d.data();
@@ -336,16 +450,32 @@ Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
         return nullptr;
     }
 
-    ReadState s = {nullptr};
+    ReadState s{};
     const TgaHeader* headerLE = (const TgaHeader*)d.data();
     s.data = data + sizeof(TgaHeader) + headerLE->idLength;
     s.end = data + len;
+    if (s.data > s.end) {
+        return nullptr;
+    }
+    Vec<u32> colors;
     if (1 == headerLE->cmapType) {
-        s.cmap.data = s.data;
-        s.cmap.n = (headerLE->cmapBitDepth + 7) / 8;
+        int cmapN = (headerLE->cmapBitDepth + 7) / 8;
         s.cmap.length = convLE(headerLE->cmapLength);
         s.cmap.firstEntry = convLE(headerLE->cmapFirstEntry);
-        s.data += s.cmap.length * s.cmap.n;
+        if ((size_t)(s.end - s.data) < (size_t)s.cmap.length * cmapN) {
+            return nullptr;
+        }
+        bool isPalette = Type_Palette == headerLE->imageType || Type_Palette_RLE == headerLE->imageType;
+        if (isPalette && (cmapN < 2 || cmapN > 4)) {
+            return nullptr;
+        }
+        if (isPalette) {
+            for (int i = 0; i < s.cmap.length; i++) {
+                colors.Append(ReadPaletteColor(s.data + i * cmapN, cmapN));
+            }
+        }
+        s.cmap.colors = colors.LendData();
+        s.data += s.cmap.length * cmapN;
     }
     s.type = (ImageType)headerLE->imageType;
     s.n = (headerLE->bitDepth + 7) / 8;
@@ -358,29 +488,36 @@ Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
 
     int w = convLE(headerLE->width);
     int h = convLE(headerLE->height);
-    int n = ((format >> 8) & 0x3F) / 8;
+    s.outN = ((format >> 8) & 0x3F) / 8;
     bool invertX = (headerLE->flags & Flag_InvertX);
     bool invertY = (headerLE->flags & Flag_InvertY);
 
-    Gdiplus::Bitmap bmp(w, h, format);
+    auto bmp = new Gdiplus::Bitmap(w, h, format);
+    if (bmp->GetLastStatus() != Gdiplus::Ok) {
+        delete bmp;
+        return nullptr;
+    }
     Gdiplus::Rect bmpRect(0, 0, w, h);
     Gdiplus::BitmapData bmpData;
-    Gdiplus::Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, format, &bmpData);
+    Gdiplus::Status ok = bmp->LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, format, &bmpData);
     if (ok != Gdiplus::Ok) {
+        delete bmp;
         return nullptr;
     }
-    for (int y = 0; y < h; y++) {
+    for (int y = 0; y < h && !s.failed; y++) {
         u8* rowOut = (u8*)bmpData.Scan0 + bmpData.Stride * (invertY ? y : h - 1 - y);
-        for (int x = 0; x < w; x++) {
-            ReadPixel(s, rowOut + n * (invertX ? w - 1 - x : x));
+        ReadRow(s, rowOut, w);
+        if (invertX) {
+            ReverseRow(rowOut, w, s.outN);
         }
     }
-    bmp.UnlockBits(&bmpData);
+    bmp->UnlockBits(&bmpData);
     if (s.failed) {
+        delete bmp;
         return nullptr;
     }
-    CopyMetadata(data, len, &bmp);
-    return bmp.Clone(0, 0, w, h, format);
+    CopyMetadata(data, len, bmp);
+    return bmp;
 }
 
 inline bool memeq3(const char* pix1, const char* pix2) {
@@ -0,0 +1,152 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/TimeTrace.h"
+
+bool gTimeTraceEnabled = false;
+
+// when tracing for a long time (e.g. while reproducing slow rendering)
+// we only keep the most recent events
+constexpr int kMaxTimeTraceEvents = 64 * 1024;
+
+struct TimeTraceEvent {
+    const char* name = nullptr;
+    char* arg = nullptr;
+    int pageNo = -1;
+    DWORD threadId = 0;
+    // in microseconds since timeBase
+    i64 start = 0;
+    i64 dur = 0;
+};
+
+static CRITICAL_SECTION gTimeTraceMutex;
+// ring buffer of kMaxTimeTraceEvents, allocated on first use
+static TimeTraceEvent* gTimeTraceEvents = nullptr;
+static int gTimeTraceNext = 0;
+static int gTimeTraceCount = 0;
+static LARGE_INTEGER gTimeTraceBase{};
+static LARGE_INTEGER gTimeTraceFreq{};
+static DWORD gTimeTraceMainThreadId = 0;
+
+// the first call must happen before other threads record spans
+void TimeTraceEnable(LARGE_INTEGER timeBase) {
+    if (!gTimeTraceEvents) {
+        InitializeCriticalSection(&gTimeTraceMutex);
+        gTimeTraceEvents = AllocArray<TimeTraceEvent>(kMaxTimeTraceEvents);
+        if (!gTimeTraceEvents) {
+            DeleteCriticalSection(&gTimeTraceMutex);
+            return;
+        }
+        gTimeTraceBase = timeBase;
+        QueryPerformanceFrequency(&gTimeTraceFreq);
+        gTimeTraceMainThreadId = GetCurrentThreadId();
+    }
+    gTimeTraceEnabled = true;
+}
+
+void TimeTraceEnable() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    TimeTraceEnable(now);
+}
+
+// spans that are in progress are dropped
+void TimeTraceDisable() {
+    gTimeTraceEnabled = false;
+}
+
+static i64 TimeTraceUs(LARGE_INTEGER t) {
+    i64 d = t.QuadPart - gTimeTraceBase.QuadPart;
+    return (d * 1000000) / gTimeTraceFreq.QuadPart;
+}
+
+void TimeTraceAdd(const char* name, LARGE_INTEGER start, const char* arg, int pageNo) {
+    if (!gTimeTraceEnabled) {
+        return;
+    }
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    char* argCopy = str::Dup(arg);
+    i64 startUs = TimeTraceUs(start);
+
+    ScopedCritSec scope(&gTimeTraceMutex);
+    TimeTraceEvent& ev = gTimeTraceEvents[gTimeTraceNext];
+    str::Free(ev.arg);
+    ev.name = name;
+    ev.arg = argCopy;
+    ev.pageNo = pageNo;
+    ev.threadId = GetCurrentThreadId();
+    ev.start = startUs;
+    ev.dur = TimeTraceUs(end) - startUs;
+    gTimeTraceNext = (gTimeTraceNext + 1) % kMaxTimeTraceEvents;
+    gTimeTraceCount = std::min(gTimeTraceCount + 1, kMaxTimeTraceEvents);
+}
+
+void TimeTraceSpan::Begin(const char* nameIn, const char* argIn, int pageNoIn) {
+    name = nameIn;
+    arg = str::Dup(argIn);
+    pageNo = pageNoIn;
+    QueryPerformanceCounter(&start);
+}
+
+void TimeTraceSpan::End() {
+    TimeTraceAdd(name, start, arg, pageNo);
+    str::Free(arg);
+}
+
+static void AppendJsonStr(str::Str& s, const char* v) {
+    s.AppendChar('"');
+    for (const char* c = v; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            s.AppendChar('\\');
+            s.AppendChar(*c);
+        } else if ((u8)*c < 0x20) {
+            s.AppendFmt("\\u%04x", (u8)*c);
+        } else {
+            s.AppendChar(*c);
+        }
+    }
+    s.AppendChar('"');
+}
+
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+// events are "complete" (X) events, the viewers nest them based on their times
+bool TimeTraceSave(const char* path) {
+    if (!gTimeTraceEvents || !path) {
+        return false;
+    }
+    DWORD pid = GetCurrentProcessId();
+    str::Str s;
+    s.Append("{\"traceEvents\":[\n");
+    s.AppendFmt(
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"main\"}}",
+        pid, gTimeTraceMainThreadId);
+    {
+        ScopedCritSec scope(&gTimeTraceMutex);
+        int first = gTimeTraceNext - gTimeTraceCount + kMaxTimeTraceEvents;
+        for (int i = 0; i < gTimeTraceCount; i++) {
+            TimeTraceEvent& ev = gTimeTraceEvents[(first + i) % kMaxTimeTraceEvents];
+            s.Append(",\n{\"name\":");
+            AppendJsonStr(s, ev.name);
+            s.AppendFmt(",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%lld,\"dur\":%lld", pid, ev.threadId,
+                        ev.start, ev.dur);
+            if (ev.arg || ev.pageNo >= 0) {
+                s.Append(",\"args\":{");
+                if (ev.arg) {
+                    s.Append("\"detail\":");
+                    AppendJsonStr(s, ev.arg);
+                }
+                if (ev.pageNo >= 0) {
+                    s.AppendFmt("%s\"page\":%d", ev.arg ? "," : "", ev.pageNo);
+                }
+                s.AppendChar('}');
+            }
+            s.AppendChar('}');
+        }
+    }
+    s.Append("\n],\"displayTimeUnit\":\"ms\"}\n");
+    return file::WriteFile(path, s.AsByteSlice());
+}
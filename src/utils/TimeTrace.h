@@ -0,0 +1,46 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Records how long named phases of the code (e.g. parts of startup or rendering)
+// take, on any thread. The result can be saved in Chrome's trace event format
+// and viewed in chrome://tracing or https://ui.perfetto.dev
+// When not recording, a span only costs checking a flag.
+
+extern bool gTimeTraceEnabled;
+
+// starts recording. timeBase is the time shown as 0 in the trace and is
+// only used the first time. Only the most recent kMaxTimeTraceEvents are kept
+void TimeTraceEnable(LARGE_INTEGER timeBase);
+void TimeTraceEnable();
+void TimeTraceDisable();
+// records a span that started at start and ends now
+void TimeTraceAdd(const char* name, LARGE_INTEGER start, const char* arg = nullptr, int pageNo = -1);
+// the recorded events are never freed because other threads might
+// still be recording spans while we shut down
+bool TimeTraceSave(const char* path);
+
+// records the time between construction and destruction
+// name must be a static string, arg (if given) is copied
+struct TimeTraceSpan {
+    const char* name = nullptr;
+    char* arg = nullptr;
+    int pageNo = -1;
+    LARGE_INTEGER start{};
+
+    explicit TimeTraceSpan(const char* name, const char* arg = nullptr, int pageNo = -1) {
+        if (gTimeTraceEnabled) {
+            Begin(name, arg, pageNo);
+        }
+    }
+    ~TimeTraceSpan() {
+        if (name) {
+            End();
+        }
+    }
+    void Begin(const char* name, const char* arg, int pageNo);
+    void End();
+};
+
+#define TIME_TRACE(name) TimeTraceSpan CONCAT(timeTrace__, __LINE__)(name)
+#define TIME_TRACE_ARG(name, arg) TimeTraceSpan CONCAT(timeTrace__, __LINE__)(name, arg)
+#define TIME_TRACE_PAGE(name, pageNo) TimeTraceSpan CONCAT(timeTrace__, __LINE__)(name, nullptr, pageNo)
@@ -7,16 +7,20 @@
 store pointer types or POD types
 (http://stackoverflow.com/questions/146452/what-are-pod-types-in-c).
 
+The first N - 1 elements are stored inside Vec, without allocating.
+Use a smaller N for vectors of big structs.
 */
-template <typename T>
+template <typename T, size_t N = 16>
 class Vec {
+    static_assert(N >= 2, "N must leave space for padding");
+
   public:
     Allocator* allocator = nullptr;
     size_t len = 0;
     size_t cap = 0;
     size_t capacityHint = 0;
     T* els = nullptr;
-    T buf[16];
+    T buf[N];
 
     // We always pad the elements with a single 0 value. This makes
     // Vec<char> and Vec<WCHAR> a C-compatible string. Although it's
@@ -26,7 +30,9 @@ class Vec {
     static constexpr size_t kElSize = sizeof(T);
 
   protected:
-    NO_INLINE bool EnsureCapSlow(size_t needed) {
+    // if exact, allocates space for needed elements instead of growing
+    // geometrically. Meant for when the final size is known
+    NO_INLINE bool EnsureCapSlow(size_t needed, bool exact = false) {
         size_t newCap = cap * 2;
         if (needed > newCap) {
             newCap = needed;
@@ -34,6 +40,9 @@ class Vec {
         if (newCap < capacityHint) {
             newCap = capacityHint;
         }
+        if (exact) {
+            newCap = needed;
+        }
 
         size_t newElCount = newCap + kPadding;
         if (newElCount >= SIZE_MAX / kElSize) {
@@ -94,6 +103,23 @@ class Vec {
         }
     }
 
+    // must be called on an empty Vec
+    void MoveFrom(Vec& other) {
+        capacityHint = other.capacityHint;
+        if (other.els == other.buf) {
+            memcpy(buf, other.buf, sizeof(buf));
+            len = other.len;
+        } else {
+            // els was allocated with other.allocator
+            allocator = other.allocator;
+            els = other.els;
+            len = other.len;
+            cap = other.cap;
+            other.els = other.buf;
+        }
+        other.Reset();
+    }
+
   public:
     void Reset() {
         FreeEls();
@@ -108,6 +134,27 @@ class Vec {
         return MakeSpaceAt(0, newSize);
     }
 
+    // makes space for exactly n elements (if it's more than the
+    // current capacity) so that appending up to n doesn't re-allocate
+    bool Reserve(size_t n) {
+        if (cap >= n) {
+            return true;
+        }
+        return EnsureCapSlow(n, true);
+    }
+
+    // frees unused capacity of a Vec that isn't expected to grow anymore
+    void Compact() {
+        if (els == buf || cap == len) {
+            return;
+        }
+        T* newEls = (T*)Allocator::Realloc(allocator, els, (len + kPadding) * kElSize);
+        if (newEls) {
+            els = newEls;
+            cap = len;
+        }
+    }
+
     // allocator is not owned by Vec and must outlive it
     explicit Vec(size_t capHint = 0, Allocator* a = nullptr) {
         allocator = a;
@@ -128,7 +175,12 @@ class Vec {
         memcpy(els, other.els, kElSize * (other.len));
     }
 
-    // TODO: write Vec(const Vec&& other)
+    // takes over the allocated elements of other, which is left empty
+    Vec(Vec&& other) noexcept {
+        els = buf;
+        Reset();
+        MoveFrom(other);
+    }
 
     Vec& operator=(const Vec& other) {
         if (this == &other) {
@@ -146,6 +198,14 @@ class Vec {
         return *this;
     }
 
+    Vec& operator=(Vec&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
     ~Vec() {
         FreeEls();
     }
@@ -230,6 +290,18 @@ class Vec {
         return true;
     }
 
+    // appends count copies of el
+    bool AppendN(const T& el, size_t count) {
+        T* dst = MakeSpaceAt(len, count);
+        if (!dst) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = el;
+        }
+        return true;
+    }
+
     // appends count blank (i.e. zeroed-out) elements at the end
     T* AppendBlanks(size_t count) {
         return MakeSpaceAt(len, count);
@@ -384,8 +456,8 @@ class Vec {
 };
 
 // only suitable for T that are pointers to C++ objects
-template <typename T>
-inline void DeleteVecMembers(Vec<T>& v) {
+template <typename T, size_t N>
+inline void DeleteVecMembers(Vec<T, N>& v) {
     for (T& el : v) {
         delete el;
     }
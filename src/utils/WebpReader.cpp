@@ -25,24 +25,51 @@ Size SizeFromData(const ByteSlice& d) {
     return size;
 }
 
-Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
-    int w, h;
-    if (!WebPGetInfo((const u8*)d.data(), d.size(), &w, &h)) {
+// if scaledSize isn't empty, the image is scaled to it while decoding
+Gdiplus::Bitmap* ImageFromData(const ByteSlice& d, Size scaledSize) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
         return nullptr;
     }
+    if (WebPGetFeatures((const u8*)d.data(), d.size(), &config.input) != VP8_STATUS_OK) {
+        return nullptr;
+    }
+    int w = config.input.width;
+    int h = config.input.height;
+    if (!scaledSize.IsEmpty() && (scaledSize.dx < w || scaledSize.dy < h)) {
+        w = scaledSize.dx;
+        h = scaledSize.dy;
+        config.options.use_scaling = 1;
+        config.options.scaled_width = w;
+        config.options.scaled_height = h;
+    }
 
-    Gdiplus::Bitmap bmp(w, h, PixelFormat32bppARGB);
+    // decode straight into the bitmap's memory instead of cloning it afterwards
+    auto bmp = new Gdiplus::Bitmap(w, h, PixelFormat32bppARGB);
+    if (bmp->GetLastStatus() != Gdiplus::Ok) {
+        delete bmp;
+        return nullptr;
+    }
     Gdiplus::Rect bmpRect(0, 0, w, h);
     Gdiplus::BitmapData bmpData;
-    Gdiplus::Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
+    Gdiplus::Status ok = bmp->LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
     if (ok != Gdiplus::Ok) {
+        delete bmp;
         return nullptr;
     }
-    if (!WebPDecodeBGRAInto((const u8*)d.data(), d.size(), (u8*)bmpData.Scan0, bmpData.Stride * h, bmpData.Stride)) {
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = (u8*)bmpData.Scan0;
+    config.output.u.RGBA.stride = bmpData.Stride;
+    config.output.u.RGBA.size = (size_t)bmpData.Stride * h;
+    VP8StatusCode status = WebPDecode((const u8*)d.data(), d.size(), &config);
+    WebPFreeDecBuffer(&config.output);
+    bmp->UnlockBits(&bmpData);
+    if (status != VP8_STATUS_OK) {
+        delete bmp;
         return nullptr;
     }
-    bmp.UnlockBits(&bmpData);
-    return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
+    return bmp;
 }
 
 } // namespace webp
@@ -55,7 +82,7 @@ bool HasSignature(const ByteSlice&) {
 Size SizeFromData(const ByteSlice&) {
     return Size();
 }
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&) {
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, Size) {
     return nullptr;
 }
 } // namespace webp
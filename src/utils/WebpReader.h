@@ -5,6 +5,6 @@ namespace webp {
 
 bool HasSignature(const ByteSlice&);
 Size SizeFromData(const ByteSlice&);
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&);
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, Size scaledSize = Size());
 
 } // namespace webp
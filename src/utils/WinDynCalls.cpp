@@ -186,6 +186,13 @@ HRESULT GetWindowAttribute(HWND hwnd, DWORD dwAttribute, void* pvAttribute, DWOR
     }
     return DynDwmGetWindowAttribute(hwnd, dwAttribute, pvAttribute, cbAttribute);
 }
+
+HRESULT GetCompositionTimingInfo(HWND hwnd, DWM_TIMING_INFO* timingInfo) {
+    if (!DynDwmGetCompositionTimingInfo) {
+        return E_NOTIMPL;
+    }
+    return DynDwmGetCompositionTimingInfo(hwnd, timingInfo);
+}
 }; // namespace dwm
 
 static const char* dllsToPreload =
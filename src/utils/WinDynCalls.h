@@ -69,6 +69,7 @@ NORMALIZ_API_LIST(API_DECLARATION)
     V(RtlCaptureContext)        \
     V(RtlCaptureStackBackTrace) \
     V(SetThreadDescription)     \
+    V(SetThreadInformation)     \
     V(SetProcessMitigationPolicy)
 
 // TODO: only available in 20348, not yet present in SDK?
@@ -106,7 +107,8 @@ UXTHEME_API_LIST(API_DECLARATION2)
     V(DwmIsCompositionEnabled)      \
     V(DwmExtendFrameIntoClientArea) \
     V(DwmDefWindowProc)             \
-    V(DwmGetWindowAttribute)
+    V(DwmGetWindowAttribute)        \
+    V(DwmGetCompositionTimingInfo)
 
 DWMAPI_API_LIST(API_DECLARATION2)
 
@@ -152,6 +154,7 @@ BOOL IsCompositionEnabled();
 HRESULT ExtendFrameIntoClientArea(HWND hwnd, const MARGINS* pMarInset);
 BOOL DefaultWindowProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp, LRESULT* plResult);
 HRESULT GetWindowAttribute(HWND hwnd, DWORD dwAttribute, void* pvAttribute, DWORD cbAttribute);
+HRESULT GetCompositionTimingInfo(HWND hwnd, DWM_TIMING_INFO* timingInfo);
 }; // namespace dwm
 
 // Touch Gesture API, only available in Windows 7
@@ -13,6 +13,13 @@
 
 #include "utils/Log.h"
 
+#if IS_INTEL_64 || IS_INTEL_32
+#include <emmintrin.h>
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
 static HFONT gDefaultGuiFont = nullptr;
 static HFONT gDefaultGuiFontBold = nullptr;
 static HFONT gDefaultGuiFontItalic = nullptr;
@@ -23,6 +30,9 @@ bool ToBool(BOOL b) {
 }
 
 RenderedBitmap::~RenderedBitmap() {
+    if (pooled && IsValidHandle(hbmp) && IsValidHandle(hMap) && ReleasePooledMemoryBitmap(hbmp, hMap, size)) {
+        return;
+    }
     if (IsValidHandle(hbmp)) {
         DeleteObject(hbmp);
     }
@@ -246,6 +256,38 @@ bool IsProcessAndOsArchSame() {
     return IsProcess64() == IsOs64();
 }
 
+// number of physical cores (as opposed to logical processors
+// which include hyper-threaded siblings)
+int GetPhysicalProcessorCount() {
+    // concurrent first callers compute the same value and it's published with a single store
+    static LONG gCount = 0;
+    if (gCount > 0) {
+        return (int)gCount;
+    }
+    int count = 0;
+    DWORD size = 0;
+    GetLogicalProcessorInformation(nullptr, &size);
+    if (GetLastError() == ERROR_INSUFFICIENT_BUFFER && size > 0) {
+        auto info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*)malloc(size);
+        if (info && GetLogicalProcessorInformation(info, &size)) {
+            int n = (int)(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+            for (int i = 0; i < n; i++) {
+                if (info[i].Relationship == RelationProcessorCore) {
+                    count++;
+                }
+            }
+        }
+        free(info);
+    }
+    if (count == 0) {
+        SYSTEM_INFO si{};
+        GetSystemInfo(&si);
+        count = std::max((int)si.dwNumberOfProcessors, 1);
+    }
+    InterlockedExchange(&gCount, count);
+    return count;
+}
+
 void LogLastError(DWORD err) {
     // allow to set a breakpoint in release builds
     if (0 == err) {
@@ -1888,6 +1930,68 @@ BitmapPixels* GetBitmapPixels(HBITMAP hbmp) {
     return res;
 }
 
+// recoloring is a per-channel mapping of 256 values so we pre-compute
+// it once per bitmap instead of doing the multiplication for every byte
+struct ColorMapTable {
+    u8 ch[4][256];
+};
+
+static void BuildColorMapTable(ColorMapTable& t, const int base[4], const int diff[4]) {
+    for (int k = 0; k < 4; k++) {
+        for (int v = 0; v < 256; v++) {
+            t.ch[k][v] = (u8)(base[k] + mul255(v, diff[k]));
+        }
+    }
+}
+
+// maps a whole BGRA pixel at a time
+static void MapColors32(u8* d, size_t nPixels, const ColorMapTable& t) {
+    const u8* t0 = t.ch[0];
+    const u8* t1 = t.ch[1];
+    const u8* t2 = t.ch[2];
+    const u8* t3 = t.ch[3];
+    u32* px = (u32*)d;
+    for (size_t i = 0; i < nPixels; i++) {
+        u32 c = px[i];
+        px[i] = (u32)t0[c & 0xff] | ((u32)t1[(c >> 8) & 0xff] << 8) | ((u32)t2[(c >> 16) & 0xff] << 16) |
+                ((u32)t3[c >> 24] << 24);
+    }
+}
+
+#if USE_SSE2
+// base + mul255(v, diff) for 8 channel values (2 pixels) in 16-bit lanes.
+// v and diff fit into 16 bits but their product needs 32
+static inline __m128i MapColorsSSE2(__m128i v, __m128i diff, __m128i base) {
+    __m128i lo = _mm_mullo_epi16(v, diff);
+    __m128i hi = _mm_mulhi_epi16(v, diff);
+    __m128i round = _mm_set1_epi32(128);
+    __m128i x0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round);
+    __m128i x1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round);
+    x0 = _mm_srai_epi32(_mm_add_epi32(x0, _mm_srai_epi32(x0, 8)), 8);
+    x1 = _mm_srai_epi32(_mm_add_epi32(x1, _mm_srai_epi32(x1, 8)), 8);
+    return _mm_packs_epi32(_mm_add_epi32(x0, base), _mm_add_epi32(x1, base));
+}
+
+// same result as MapColors32() for 4 pixels at a time, returns the number
+// of pixels done. The rest (less than 4) is left for MapColors32()
+static size_t MapColors32SSE2(u8* d, size_t nPixels, const int base[4], const int diff[4]) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i vdiff = _mm_setr_epi16((short)diff[0], (short)diff[1], (short)diff[2], (short)diff[3], (short)diff[0],
+                                   (short)diff[1], (short)diff[2], (short)diff[3]);
+    __m128i vbase = _mm_setr_epi32(base[0], base[1], base[2], base[3]);
+    size_t n = nPixels & ~(size_t)3;
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i* px = (__m128i*)(d + i * 4);
+        __m128i c = _mm_loadu_si128(px);
+        __m128i lo = MapColorsSSE2(_mm_unpacklo_epi8(c, zero), vdiff, vbase);
+        __m128i hi = MapColorsSSE2(_mm_unpackhi_epi8(c, zero), vdiff, vbase);
+        // the results are between base and base + diff, so in 0..255
+        _mm_storeu_si128(px, _mm_packus_epi16(lo, hi));
+    }
+    return n;
+}
+#endif
+
 void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     if ((textColor & 0xFFFFFF) == WIN_COL_BLACK && (bgColor & 0xFFFFFF) == WIN_COL_WHITE) {
         return;
@@ -1909,12 +2013,19 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     // for mapped 32-bit DI bitmaps: directly access the pixel data
     if (ret >= sizeof(info.dsBm) && info.dsBm.bmBits && 32 == info.dsBm.bmBitsPixel &&
         size.dx * 4 == info.dsBm.bmWidthBytes) {
-        int bmpBytes = size.dx * size.dy * 4;
+        size_t nPixels = (size_t)size.dx * (size_t)size.dy;
         u8* bmpData = (u8*)info.dsBm.bmBits;
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (u8)(base[k] + mul255(bmpData[i], diff[k]));
+#if USE_SSE2
+        size_t nDone = MapColors32SSE2(bmpData, nPixels, base, diff);
+        bmpData += nDone * 4;
+        nPixels -= nDone;
+        if (nPixels == 0) {
+            return;
         }
+#endif
+        ColorMapTable t;
+        BuildColorMapTable(t, base, diff);
+        MapColors32(bmpData, nPixels, t);
         return;
     }
 
@@ -1922,10 +2033,15 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     if (ret >= sizeof(info.dsBm) && info.dsBm.bmBits && 24 == info.dsBm.bmBitsPixel &&
         info.dsBm.bmWidthBytes >= size.dx * 3) {
         u8* bmpData = (u8*)info.dsBm.bmBits;
+        ColorMapTable t;
+        BuildColorMapTable(t, base, diff);
         for (int y = 0; y < size.dy; y++) {
-            for (int x = 0; x < size.dx * 3; x++) {
-                int k = x % 3;
-                bmpData[x] = (u8)(base[k] + mul255(bmpData[x], diff[k]));
+            u8* d = bmpData;
+            for (int x = 0; x < size.dx; x++) {
+                d[0] = t.ch[0][d[0]];
+                d[1] = t.ch[1][d[1]];
+                d[2] = t.ch[2][d[2]];
+                d += 3;
             }
             bmpData += info.dsBm.bmWidthBytes;
         }
@@ -1934,7 +2050,7 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
 
     // for paletted DI bitmaps: only update the color palette
     if (sizeof(info) == ret && info.dsBmih.biBitCount && info.dsBmih.biBitCount <= 8) {
-        CrashIf(info.dsBmih.biBitCount != 8);
+        CrashIf(info.dsBmih.biBitCount != 8 && info.dsBmih.biBitCount != 1);
         RGBQUAD palette[256];
         HDC hDC = CreateCompatibleDC(nullptr);
         DeleteObject(SelectObject(hDC, hbmp));
@@ -1965,10 +2081,9 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
     CrashIf(!bmpData);
 
     if (GetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (u8)(base[k] + mul255(bmpData[i], diff[k]));
-        }
+        ColorMapTable t;
+        BuildColorMapTable(t, base, diff);
+        MapColors32(bmpData, (size_t)size.dx * (size_t)size.dy, t);
         SetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS);
     }
 
@@ -2029,6 +2144,147 @@ HBITMAP CreateMemoryBitmap(Size size, HANDLE* hDataMapping) {
     return CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hDataMapping ? *hDataMapping : nullptr, 0);
 }
 
+// bitmaps in the pool together take up at most that much memory
+constexpr size_t kMaxPooledBitmapsSize = 64 * 1024 * 1024;
+// the memory of bitmaps is allocated in multiples of this, so that
+// a bitmap of a slightly different size can reuse it
+constexpr size_t kPooledBitmapGranularity = 64 * 1024;
+
+struct PooledMemoryBitmap {
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+    Size size;
+    size_t mapSize = 0;
+};
+
+struct MemoryBitmapPool {
+    CRITICAL_SECTION access;
+    // the most recently released are at the end
+    Vec<PooledMemoryBitmap> bitmaps;
+    size_t totalSize = 0;
+
+    MemoryBitmapPool() {
+        InitializeCriticalSection(&access);
+    }
+    ~MemoryBitmapPool() {
+        DeleteCriticalSection(&access);
+    }
+};
+
+static MemoryBitmapPool gMemoryBitmapPool;
+
+static size_t PooledBitmapMapSize(Size size) {
+    size_t imgSize = (size_t)size.dx * 4 * (size_t)size.dy;
+    return (imgSize + kPooledBitmapGranularity - 1) / kPooledBitmapGranularity * kPooledBitmapGranularity;
+}
+
+HBITMAP NewPooledMemoryBitmap(Size size, HANDLE* hMapOut, void** dataOut) {
+    if (size.dx <= 0 || size.dy <= 0 || (size_t)size.dx * 4 * (size_t)size.dy > (size_t)INT_MAX) {
+        return nullptr;
+    }
+    size_t mapSize = PooledBitmapMapSize(size);
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+    {
+        MemoryBitmapPool& pool = gMemoryBitmapPool;
+        ScopedCritSec scope(&pool.access);
+        // a bitmap of the same size is best, otherwise memory that isn't much bigger
+        int found = -1;
+        for (int i = pool.bitmaps.isize() - 1; i >= 0; i--) {
+            PooledMemoryBitmap& pb = pool.bitmaps[i];
+            if (pb.size == size) {
+                found = i;
+                break;
+            }
+            if (found == -1 && pb.mapSize >= mapSize && pb.mapSize <= mapSize + mapSize / 4) {
+                found = i;
+            }
+        }
+        if (found != -1) {
+            PooledMemoryBitmap pb = pool.bitmaps[found];
+            pool.bitmaps.RemoveAt(found);
+            pool.totalSize -= pb.mapSize;
+            hMap = pb.hMap;
+            if (pb.size == size) {
+                hbmp = pb.hbmp;
+            } else {
+                DeleteObject(pb.hbmp);
+            }
+        }
+    }
+    if (hbmp) {
+        DIBSECTION ds{};
+        GetObject(hbmp, sizeof(ds), &ds);
+        *hMapOut = hMap;
+        *dataOut = ds.dsBm.bmBits;
+        return hbmp;
+    }
+
+    if (!hMap) {
+        hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)mapSize, nullptr);
+        if (!hMap) {
+            return nullptr;
+        }
+    }
+    BITMAPINFO bmi{};
+    BITMAPINFOHEADER* bmih = &bmi.bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = size.dx;
+    bmih->biHeight = -size.dy;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = 32;
+    bmih->biSizeImage = size.dx * 4 * size.dy;
+    void* data = nullptr;
+    hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp || !data) {
+        if (hbmp) {
+            DeleteObject(hbmp);
+        }
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    *hMapOut = hMap;
+    *dataOut = data;
+    return hbmp;
+}
+
+bool ReleasePooledMemoryBitmap(HBITMAP hbmp, HANDLE hMap, Size size) {
+    // the memory of a reused mapping can be bigger, but never smaller
+    size_t mapSize = PooledBitmapMapSize(size);
+    if (mapSize > kMaxPooledBitmapsSize / 4) {
+        return false;
+    }
+    MemoryBitmapPool& pool = gMemoryBitmapPool;
+    ScopedCritSec scope(&pool.access);
+    PooledMemoryBitmap pb;
+    pb.hbmp = hbmp;
+    pb.hMap = hMap;
+    pb.size = size;
+    pb.mapSize = mapSize;
+    pool.bitmaps.Append(pb);
+    pool.totalSize += mapSize;
+    while (pool.totalSize > kMaxPooledBitmapsSize) {
+        PooledMemoryBitmap oldest = pool.bitmaps[0];
+        pool.bitmaps.RemoveAt(0);
+        pool.totalSize -= oldest.mapSize;
+        DeleteObject(oldest.hbmp);
+        CloseHandle(oldest.hMap);
+    }
+    return true;
+}
+
+void FreePooledMemoryBitmaps() {
+    MemoryBitmapPool& pool = gMemoryBitmapPool;
+    ScopedCritSec scope(&pool.access);
+    for (PooledMemoryBitmap& pb : pool.bitmaps) {
+        DeleteObject(pb.hbmp);
+        CloseHandle(pb.hMap);
+    }
+    pool.bitmaps.Reset();
+    pool.totalSize = 0;
+}
+
 // render the bitmap into the target rectangle (streching and skewing as requird)
 bool BlitHBITMAP(HBITMAP hbmp, HDC hdc, Rect target) {
     HDC bmpDC = CreateCompatibleDC(hdc);
@@ -2210,6 +2466,23 @@ ByteSlice LoadDataResource(int resId) {
     return {(u8*)s, size};
 }
 
+ByteSlice LockDataResource(int resId) {
+    HRSRC resSrc = FindResourceW(nullptr, MAKEINTRESOURCE(resId), RT_RCDATA);
+    CrashIf(!resSrc);
+    if (!resSrc) {
+        return {};
+    }
+    HGLOBAL res = LoadResource(nullptr, resSrc);
+    CrashIf(!res);
+    if (!res) {
+        return {};
+    }
+    DWORD size = SizeofResource(nullptr, resSrc);
+    u8* resData = (u8*)LockResource(res);
+    CrashIf(!resData);
+    return {resData, size};
+}
+
 static HDDEDATA CALLBACK DdeCallback(__unused UINT uType, __unused UINT uFmt, __unused HCONV hconv, __unused HSZ hsz1,
                                      __unused HSZ hsz2, __unused HDDEDATA hdata, __unused ULONG_PTR dwData1,
                                      __unused ULONG_PTR dwData2) {
@@ -30,6 +30,7 @@ bool IsOs64();
 bool IsProcess64();
 bool IsRunningInWow64();
 bool IsProcessAndOsArchSame();
+int GetPhysicalProcessorCount();
 
 bool GetOsVersion(OSVERSIONINFOEX& ver);
 TempStr OsNameFromVerTemp(const OSVERSIONINFOEX& ver);
@@ -229,6 +230,8 @@ struct RenderedBitmap {
     HBITMAP hbmp = nullptr;
     Size size{};
     HANDLE hMap{};
+    // if true, hbmp and hMap come from NewPooledMemoryBitmap() and go back into the pool
+    bool pooled = false;
 
     RenderedBitmap(HBITMAP hbmp, Size size, HANDLE hMap = nullptr) : hbmp(hbmp), size(size), hMap(hMap) {
     }
@@ -247,12 +250,20 @@ COLORREF GetPixel(BitmapPixels* bitmap, int x, int y);
 void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor);
 ByteSlice SerializeBitmap(HBITMAP hbmp);
 HBITMAP CreateMemoryBitmap(Size size, HANDLE* hDataMapping = nullptr);
+// same format as CreateMemoryBitmap() but reuses the bitmaps (or their memory)
+// given back with ReleasePooledMemoryBitmap(), e.g. of tiles evicted while scrolling
+HBITMAP NewPooledMemoryBitmap(Size size, HANDLE* hMapOut, void** dataOut);
+// returns false if the bitmap isn't kept, the caller must then delete it
+bool ReleasePooledMemoryBitmap(HBITMAP hbmp, HANDLE hMap, Size size);
+void FreePooledMemoryBitmaps();
 bool BlitHBITMAP(HBITMAP hbmp, HDC hdc, Rect target);
 double GetProcessRunningTime();
 
 void RunNonElevated(const char* exePath);
 void VariantInitBstr(VARIANT& urlVar, const WCHAR* s);
 ByteSlice LoadDataResource(int resId);
+// the data stays valid (and must not be freed) until the module is unloaded
+ByteSlice LockDataResource(int resId);
 bool DDEExecute(const WCHAR* server, const WCHAR* topic, const WCHAR* command);
 
 void RectInflateTB(RECT& r, int top, int bottom);
@@ -9,6 +9,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
 
 extern "C" {
 #include <unarr.h>
@@ -17,58 +18,48 @@ extern "C" {
 
 /***** ZipCreator *****/
 
-class FileWriteStream : public ISequentialStream {
-    HANDLE hFile;
-    LONG refCount;
-
-  public:
-    explicit FileWriteStream(const char* filePath) : refCount(1) {
-        WCHAR* path = ToWstrTemp(filePath);
-        hFile =
-            CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    }
-    virtual ~FileWriteStream() {
-        CloseHandle(hFile);
-    }
-    // IUnknown
-    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv) {
-        static const QITAB qit[] = {QITABENT(FileWriteStream, ISequentialStream), {nullptr}};
-        return QISearch(this, qit, riid, ppv);
-    }
-    IFACEMETHODIMP_(ULONG) AddRef() {
-        return InterlockedIncrement(&refCount);
-    }
-    IFACEMETHODIMP_(ULONG) Release() {
-        LONG newCount = InterlockedDecrement(&refCount);
-        if (newCount == 0) {
-            delete this;
-        }
-        return newCount;
-    }
-    // ISequentialStream
-    IFACEMETHODIMP Read(__unused void* buffer, __unused ULONG size, __unused ULONG* read) {
-        return E_NOTIMPL;
-    }
-    IFACEMETHODIMP Write(const void* data, ULONG size, ULONG* written) {
-        bool ok = WriteFile(hFile, data, size, written, nullptr);
-        return ok && *written == size ? S_OK : E_FAIL;
-    }
-};
+// files of at least that size are compressed in chunks straight to the stream
+// (if the local header can be fixed up afterwards) instead of in memory
+constexpr i64 kMinStreamedFileSize = 4 * 1024 * 1024;
+constexpr DWORD kZipChunkSize = 256 * 1024;
 
 ZipCreator::ZipCreator(const char* zipFilePath) : bytesWritten(0), fileCount(0) {
-    stream = new FileWriteStream(zipFilePath);
+    WCHAR* path = ToWstrTemp(zipFilePath);
+    IStream* fileStream = nullptr;
+    DWORD mode = STGM_CREATE | STGM_WRITE | STGM_SHARE_DENY_WRITE;
+    HRESULT hr = SHCreateStreamOnFileEx(path, mode, FILE_ATTRIBUTE_NORMAL, TRUE, nullptr, &fileStream);
+    stream = SUCCEEDED(hr) ? fileStream : nullptr;
+    seekableStream = stream ? fileStream : nullptr;
+    if (seekableStream) {
+        seekableStream->AddRef();
+    }
 }
 
 ZipCreator::ZipCreator(ISequentialStream* stream) : bytesWritten(0), fileCount(0) {
     stream->AddRef();
     this->stream = stream;
+    if (FAILED(stream->QueryInterface(IID_PPV_ARGS(&seekableStream)))) {
+        seekableStream = nullptr;
+    }
 }
 
 ZipCreator::~ZipCreator() {
-    stream->Release();
+    if (seekableStream) {
+        seekableStream->Release();
+    }
+    if (stream) {
+        stream->Release();
+    }
+}
+
+void ZipCreator::SetStoreOnly(bool storeOnly) {
+    this->storeOnly = storeOnly;
 }
 
 bool ZipCreator::WriteData(const void* data, size_t size) {
+    if (!stream) {
+        return false;
+    }
     ULONG written = 0;
     HRESULT res = stream->Write(data, (ULONG)size, &written);
     if (FAILED(res) || written != size) {
@@ -101,64 +92,107 @@ static u32 zip_compress(void* dst, u32 dstlen, const void* src, u32 srclen) {
     return newdstlen;
 }
 
-bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate) {
-    CrashIf(size >= UINT32_MAX);
-    CrashIf(str::Len(nameUtf8) >= UINT16_MAX);
-    if (size >= UINT32_MAX) {
-        return false;
+// deflate hardly makes those smaller, so they're stored
+static bool IsCompressedFileFormat(const char* name) {
+    static const char* exts[] = {".jpg", ".jpeg", ".png", ".gif", ".webp", ".jp2", ".jxl", ".avif", ".heic",
+                                 ".zip", ".cbz",  ".rar", ".cbr", ".7z",   ".cb7", ".gz",  ".mp3", ".mp4"};
+    for (const char* ext : exts) {
+        if (str::EndsWithI(name, ext)) {
+            return true;
+        }
     }
+    return false;
+}
 
-    size_t fileOffset = bytesWritten;
-    u16 flags = (1 << 11); // filename is UTF-8
-    uInt crc = crc32(0, (const Bytef*)data, (uInt)size);
-    size_t namelen = str::Len(nameUtf8);
-    if (namelen >= UINT16_MAX) {
-        return false;
+// a file compressed (in memory) for writing into the zip
+struct ZipEntry {
+    // with forward slashes
+    char* name = nullptr;
+    char* filePath = nullptr;
+    u32 dosdate = 0;
+    bool storeOnly = false;
+
+    // prepared by CompressZipEntry()
+    ByteSlice fileData;
+    const u8* data = nullptr;
+    size_t size = 0;
+    u8* compressed = nullptr;
+    u32 compressedSize = 0;
+    u16 method = 0;
+    u32 crc = 0;
+    bool ok = false;
+
+    ~ZipEntry() {
+        str::Free(name);
+        str::Free(filePath);
+        fileData.Free();
+        free(compressed);
     }
+};
 
-    u16 method = Z_DEFLATED;
-    uLongf compressedSize = (u32)size;
-    AutoFree compressed((char*)malloc(size));
-    if (!compressed) {
+// thread-safe, entries of a directory are compressed in parallel
+static bool CompressZipEntry(ZipEntry* e) {
+    if (e->filePath) {
+        e->fileData = file::ReadFile(e->filePath);
+        if (!e->fileData) {
+            return false;
+        }
+        e->data = e->fileData.data();
+        e->size = e->fileData.size();
+    }
+    if (e->size >= UINT32_MAX) {
+        return false;
+    }
+    e->crc = crc32(0, (const Bytef*)e->data, (uInt)e->size);
+    e->method = 0; // Store
+    e->compressedSize = (u32)e->size;
+    if (e->storeOnly || IsCompressedFileFormat(e->name) || e->size == 0) {
+        return true;
+    }
+    e->compressed = (u8*)malloc(e->size);
+    if (!e->compressed) {
         return false;
     }
-    compressedSize = zip_compress(compressed, (u32)size, data, (u32)size);
-    if (!compressedSize) {
-        method = 0; // Store
-        memcpy(compressed.Get(), data, size);
-        compressedSize = (u32)size;
+    u32 compressedSize = zip_compress(e->compressed, (u32)e->size, e->data, (u32)e->size);
+    if (compressedSize) {
+        e->method = Z_DEFLATED;
+        e->compressedSize = compressedSize;
+    } else {
+        // didn't get smaller
+        free(e->compressed);
+        e->compressed = nullptr;
     }
+    return true;
+}
 
-    constexpr size_t kHdrSize = 30;
-    ByteWriterLE local(kHdrSize);
+static void WriteLocalHeader(ByteWriterLE& local, u16 method, u32 dosdate, u32 crc, u32 compressedSize, u32 size,
+                             size_t namelen) {
     local.Write32(0x04034B50); // signature
     local.Write16(20);         // version needed to extract
-    local.Write16(flags);
+    local.Write16(1 << 11);    // filename is UTF-8
     local.Write16(method);
     local.Write32(dosdate);
     local.Write32(crc);
     local.Write32(compressedSize);
-    local.Write32((u32)size);
+    local.Write32(size);
     local.Write16((u16)namelen);
     local.Write16(0); // extra field length
-    CrashIf(local.d.size() != kHdrSize);
-
-    char* localHeader = local.d.Get();
-    bool ok = WriteData(localHeader, kHdrSize);
-    ok = ok && WriteData(nameUtf8, namelen);
-    ok = ok && WriteData(compressed, compressedSize);
+}
 
+static void AppendCentralDirEntry(str::Str& centraldir, const char* name, u16 method, u32 dosdate, u32 crc,
+                                  u32 compressedSize, u32 size, size_t fileOffset) {
+    size_t namelen = str::Len(name);
     constexpr size_t kCentralSize = 46;
     ByteWriterLE central(kCentralSize);
     central.Write32(0x02014B50); // signature
     central.Write16(20);         // version made by
     central.Write16(20);         // version needed to extract
-    central.Write16(flags);
+    central.Write16(1 << 11);    // filename is UTF-8
     central.Write16(method);
     central.Write32(dosdate);
     central.Write32(crc);
     central.Write32(compressedSize);
-    central.Write32((u32)size);
+    central.Write32(size);
     central.Write16((u16)namelen);
     central.Write16(0); // extra field length
     central.Write16(0); // file comment length
@@ -169,37 +203,175 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     CrashIf(central.d.size() != kCentralSize);
 
     centraldir.Append(central.d.Get(), kCentralSize);
-    centraldir.Append(nameUtf8, namelen);
+    centraldir.Append(name, namelen);
+}
+
+bool ZipCreator::WriteEntry(ZipEntry* e) {
+    size_t namelen = str::Len(e->name);
+    CrashIf(namelen >= UINT16_MAX);
+    if (namelen >= UINT16_MAX) {
+        return false;
+    }
 
+    size_t fileOffset = bytesWritten;
+    constexpr size_t kHdrSize = 30;
+    ByteWriterLE local(kHdrSize);
+    WriteLocalHeader(local, e->method, e->dosdate, e->crc, e->compressedSize, (u32)e->size, namelen);
+    CrashIf(local.d.size() != kHdrSize);
+
+    const void* data = e->compressed ? e->compressed : e->data;
+    bool ok = WriteData(local.d.Get(), kHdrSize);
+    ok = ok && WriteData(e->name, namelen);
+    ok = ok && WriteData(data, e->compressedSize);
+
+    AppendCentralDirEntry(centraldir, e->name, e->method, e->dosdate, e->crc, e->compressedSize, (u32)e->size,
+                          fileOffset);
     fileCount++;
     return ok;
 }
 
-// add a given file under (optional) nameInZip
-bool ZipCreator::AddFile(const char* path, const char* nameInZip) {
-    ByteSlice fileData = file::ReadFile(path);
-    if (!fileData) {
+bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate) {
+    CrashIf(size >= UINT32_MAX);
+    if (size >= UINT32_MAX) {
+        return false;
+    }
+    ZipEntry e;
+    e.name = str::Dup(nameUtf8);
+    e.data = (const u8*)data;
+    e.size = size;
+    e.dosdate = dosdate;
+    e.storeOnly = storeOnly;
+    if (!CompressZipEntry(&e)) {
         return false;
     }
+    return WriteEntry(&e);
+}
 
-    u32 dosdatetime = 0;
+static u32 GetDosDateTime(const char* path) {
     FILETIME ft = file::GetModificationTime(path);
     if (ft.dwLowDateTime || ft.dwHighDateTime) {
         FILETIME ftLocal;
         WORD dosDate, dosTime;
         if (FileTimeToLocalFileTime(&ft, &ftLocal) && FileTimeToDosDateTime(&ftLocal, &dosDate, &dosTime)) {
-            dosdatetime = MAKELONG(dosTime, dosDate);
+            return MAKELONG(dosTime, dosDate);
         }
     }
+    return 0;
+}
 
+static char* ZipNameDup(const char* path, const char* nameInZip) {
     if (!nameInZip) {
         nameInZip = path::IsAbsolute(path) ? path::GetBaseNameTemp(path) : path;
     }
-
     char* name = str::Dup(nameInZip);
     str::TransCharsInPlace(name, "\\", "/");
+    return name;
+}
 
-    bool res = AddFileData(name, fileData.Get(), fileData.size(), dosdatetime);
+// compresses filePath in chunks, writing the local header first and
+// fixing up its crc and sizes at the end. Only for seekable streams
+bool ZipCreator::AddFileStreamed(const char* filePath, const char* nameInZip, u32 dosdate) {
+    AutoCloseHandle hFile(file::OpenReadOnly(filePath));
+    LARGE_INTEGER fileSize;
+    if (!hFile.IsValid() || !GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart >= UINT32_MAX) {
+        return false;
+    }
+    u32 size = (u32)fileSize.QuadPart;
+    size_t namelen = str::Len(nameInZip);
+    if (namelen >= UINT16_MAX) {
+        return false;
+    }
+
+    bool store = storeOnly || IsCompressedFileFormat(nameInZip);
+    u16 method = store ? 0 : Z_DEFLATED;
+    z_stream zs = {nullptr};
+    if (!store && deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    size_t fileOffset = bytesWritten;
+    constexpr size_t kHdrSize = 30;
+    ByteWriterLE local(kHdrSize);
+    WriteLocalHeader(local, method, dosdate, 0, 0, size, namelen);
+    bool ok = WriteData(local.d.Get(), kHdrSize);
+    ok = ok && WriteData(nameInZip, namelen);
+    size_t dataOffset = bytesWritten;
+
+    u8* buf = AllocArray<u8>(kZipChunkSize * 2);
+    AutoFree bufFree(buf);
+    u8* out = buf + kZipChunkSize;
+    ok = ok && buf;
+
+    u32 crc = 0;
+    u32 nRead = 0;
+    bool isLast = false;
+    while (ok && !isLast) {
+        DWORD n = 0;
+        ok = ReadFile(hFile, buf, kZipChunkSize, &n, nullptr);
+        nRead += n;
+        isLast = n < kZipChunkSize || nRead >= size;
+        crc = crc32(crc, buf, n);
+        if (!ok) {
+            break;
+        }
+        if (store) {
+            ok = WriteData(buf, n);
+            continue;
+        }
+        zs.next_in = buf;
+        zs.avail_in = n;
+        int err = Z_OK;
+        do {
+            zs.next_out = out;
+            zs.avail_out = kZipChunkSize;
+            err = deflate(&zs, isLast ? Z_FINISH : Z_NO_FLUSH);
+            ok = err != Z_STREAM_ERROR && WriteData(out, kZipChunkSize - zs.avail_out);
+        } while (ok && zs.avail_out == 0);
+        ok = ok && (!isLast || err == Z_STREAM_END);
+    }
+    if (!store) {
+        deflateEnd(&zs);
+    }
+    // the file might have changed since we got its size
+    ok = ok && nRead == size;
+    size_t compressedSize = bytesWritten - dataOffset;
+    if (!ok || compressedSize >= UINT32_MAX) {
+        return false;
+    }
+
+    // fix up crc and compressed size in the local header
+    ByteWriterLE fixup(8);
+    fixup.Write32(crc);
+    fixup.Write32((u32)compressedSize);
+    LARGE_INTEGER off;
+    off.QuadPart = -(i64)(bytesWritten - (fileOffset + 14));
+    ok = SUCCEEDED(seekableStream->Seek(off, STREAM_SEEK_CUR, nullptr));
+    ULONG written = 0;
+    ok = ok && SUCCEEDED(stream->Write(fixup.d.Get(), 8, &written)) && written == 8;
+    off.QuadPart = (i64)(bytesWritten - (fileOffset + 14 + 8));
+    ok = ok && SUCCEEDED(seekableStream->Seek(off, STREAM_SEEK_CUR, nullptr));
+    if (!ok) {
+        return false;
+    }
+
+    AppendCentralDirEntry(centraldir, nameInZip, method, dosdate, crc, (u32)compressedSize, size, fileOffset);
+    fileCount++;
+    return true;
+}
+
+// add a given file under (optional) nameInZip
+bool ZipCreator::AddFile(const char* path, const char* nameInZip) {
+    u32 dosdatetime = GetDosDateTime(path);
+    AutoFree name(ZipNameDup(path, nameInZip));
+    if (seekableStream && file::GetSize(path) >= kMinStreamedFileSize) {
+        return AddFileStreamed(path, name.Get(), dosdatetime);
+    }
+
+    ByteSlice fileData = file::ReadFile(path);
+    if (!fileData) {
+        return false;
+    }
+    bool res = AddFileData(name.Get(), fileData.Get(), fileData.size(), dosdatetime);
     fileData.Free();
     return res;
 }
@@ -216,13 +388,106 @@ bool ZipCreator::AddFileFromDir(const char* filePath, const char* dir) {
     return AddFile(filePath, nameInZip);
 }
 
-bool ZipCreator::AddDir(const char* dir, bool recursive) {
-    DirTraverse(dir, recursive, [this, dir](const char* path) -> bool {
-        if (!this->AddFileFromDir(path, dir)) {
-            return false;
+struct CompressZipEntriesData {
+    ZipEntry** entries = nullptr;
+    int nEntries = 0;
+    LONG nextIdx = -1;
+};
+
+static void CompressZipEntries(CompressZipEntriesData* d) {
+    while (true) {
+        int i = (int)InterlockedIncrement(&d->nextIdx);
+        if (i >= d->nEntries) {
+            break;
         }
+        ZipEntry* e = d->entries[i];
+        e->ok = CompressZipEntry(e);
+    }
+}
+
+static DWORD WINAPI CompressZipEntriesThread(void* data) {
+    CompressZipEntries((CompressZipEntriesData*)data);
+    DestroyTempAllocator();
+    return 0;
+}
+
+// compresses the entries on several threads, each taking the next entry
+static void CompressZipEntriesParallel(ZipEntry** entries, int nEntries, int nThreads) {
+    CompressZipEntriesData data;
+    data.entries = entries;
+    data.nEntries = nEntries;
+    Vec<HANDLE> threads;
+    // the current thread also compresses entries
+    for (int i = 1; i < std::min(nThreads, nEntries); i++) {
+        HANDLE h = CreateThread(nullptr, 0, CompressZipEntriesThread, &data, 0, nullptr);
+        if (h) {
+            threads.Append(h);
+        }
+    }
+    CompressZipEntries(&data);
+    if (threads.size() > 0) {
+        WaitForMultipleObjects((DWORD)threads.size(), threads.LendData(), TRUE, INFINITE);
+    }
+    for (HANDLE h : threads) {
+        CloseHandle(h);
+    }
+}
+
+// files are compressed in parallel, a batch at a time (to bound memory use),
+// and written in the order in which they were found
+bool ZipCreator::AddDir(const char* dir, bool recursive) {
+    StrVec files;
+    DirTraverse(dir, recursive, [&files](const char* path) -> bool {
+        files.Append(path);
         return true;
     });
+
+    int nThreads = std::min(GetPhysicalProcessorCount(), MAXIMUM_WAIT_OBJECTS);
+    int batchSize = nThreads * 4;
+    Vec<ZipEntry*> batch;
+    int nFiles = files.Size();
+    for (int i = 0; i < nFiles;) {
+        // big files are added on their own, streamed if possible
+        char* path = files.at(i);
+        if (file::GetSize(path) >= kMinStreamedFileSize) {
+            if (!AddFileFromDir(path, dir)) {
+                return true;
+            }
+            i++;
+            continue;
+        }
+
+        for (; i < nFiles && batch.isize() < batchSize; i++) {
+            path = files.at(i);
+            const char* nameInZip = path + str::Len(dir) + 1;
+            if (!str::StartsWith(path, dir) || !path::IsSep(nameInZip[-1])) {
+                break;
+            }
+            if (file::GetSize(path) >= kMinStreamedFileSize) {
+                break;
+            }
+            auto e = new ZipEntry();
+            e->filePath = str::Dup(path);
+            e->name = ZipNameDup(path, nameInZip);
+            e->dosdate = GetDosDateTime(path);
+            e->storeOnly = storeOnly;
+            batch.Append(e);
+        }
+        if (batch.IsEmpty()) {
+            // like AddFileFromDir(), stop at a file that's not in dir
+            return true;
+        }
+
+        CompressZipEntriesParallel(batch.LendData(), batch.isize(), nThreads);
+        bool ok = true;
+        for (ZipEntry* e : batch) {
+            ok = ok && e->ok && WriteEntry(e);
+        }
+        DeleteVecMembers(batch);
+        if (!ok) {
+            return true;
+        }
+    }
     return true;
 }
 
@@ -260,7 +525,9 @@ IStream* OpenDirAsZipStream(const char* dirPath, bool recursive) {
         return nullptr;
     }
 
+    // the zip is only read (once) from memory, compressing it wouldn't save anything
     ZipCreator zc(stream);
+    zc.SetStoreOnly(true);
     if (!zc.AddDir(dirPath, recursive)) {
         return nullptr;
     }
@@ -6,14 +6,21 @@ typedef struct ar_stream_s ar_stream;
 typedef struct ar_archive_s ar_archive;
 }
 
+struct ZipEntry;
+
 class ZipCreator {
     ISequentialStream* stream;
+    // set if stream can seek, for compressing big files directly to it
+    IStream* seekableStream = nullptr;
     str::Str centraldir;
     size_t bytesWritten;
     size_t fileCount;
+    bool storeOnly = false;
 
     bool WriteData(const void* data, size_t size);
     bool AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate = 0);
+    bool WriteEntry(ZipEntry* e);
+    bool AddFileStreamed(const char* filePath, const char* nameInZip, u32 dosdate);
 
   public:
     explicit ZipCreator(const char* zipFilePath);
@@ -27,6 +34,10 @@ class ZipCreator {
     bool AddFileFromDir(const char* filePath, const char* dir);
     bool AddDir(const char* dirPath, bool recursive = false);
     bool Finish();
+
+    // don't compress any files, e.g. for a zip that's only read once.
+    // Files in already compressed formats (e.g. JPEG, PNG) are always stored
+    void SetStoreOnly(bool storeOnly);
 };
 
 IStream* OpenDirAsZipStream(const char* dirPath, bool recursive = false);
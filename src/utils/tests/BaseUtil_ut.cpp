@@ -98,9 +98,46 @@ static void PoolAllocatorStringsTest(PoolAllocator& a, int nRounds) {
     }
 }
 
+static void PoolAllocatorMarkTest() {
+    PoolAllocator a;
+    a.minBlockSize = 256;
+    char* s1 = str::Dup(&a, "before mark");
+    auto mark = a.GetMark();
+    for (int i = 0; i < 100; i++) {
+        str::Dup(&a, "after mark, spills into new blocks");
+    }
+    size_t maxSize = a.blocksSize;
+    utassert(a.maxBlocksSize == maxSize);
+    a.RewindTo(mark);
+    utassert(a.nAllocs == 1);
+    utassert(a.blocksSize < maxSize);
+    utassert(a.maxBlocksSize == maxSize);
+    utassert(str::Eq(s1, "before mark"));
+    utassert(str::Eq((char*)a.At(0), "before mark"));
+    char* s2 = str::Dup(&a, "re-used");
+    utassert(str::Eq((char*)a.At(1), s2));
+
+    // marks don't survive Reset()
+    mark = a.GetMark();
+    a.Reset();
+    str::Dup(&a, "after reset");
+    a.RewindTo(mark);
+    utassert(a.nAllocs == 1);
+
+    TempStr t1 = str::DupTemp("outside");
+    {
+        TempAllocatorScope scope;
+        for (int i = 0; i < 100; i++) {
+            str::JoinTemp("inside", "scope");
+        }
+    }
+    utassert(str::Eq(t1, "outside"));
+}
+
 static void PoolAllocatorTest() {
     PoolAllocator a;
     PoolAllocatorStringsTest(a, 2048);
+    PoolAllocatorMarkTest();
 }
 
 static int roundUpTestCases[] = {
@@ -28,6 +28,19 @@ static bool TestDigestSHA2(const char* data, size_t size, const char* verify) {
     return str::Eq(hash, verify);
 }
 
+// feeding the data in pieces must give the same digest
+static bool TestDigestCalc(DigestKind kind, const char* data, const char* verify) {
+    u8 digest[32];
+    DigestCalc calc(kind);
+    size_t len = str::Len(data);
+    for (size_t i = 0; i < len; i += 5) {
+        calc.Update(data + i, std::min((size_t)5, len - i));
+    }
+    calc.Final(digest);
+    AutoFreeStr hash = str::MemToHex(digest, calc.digestSize);
+    return str::Eq(hash, verify);
+}
+
 void CryptoUtilTest() {
     utassert(TestDigestMD5("", 0, "d41d8cd98f00b204e9800998ecf8427e"));
     utassert(TestDigestMD5("The quick brown fox jumps over the lazy dog", 43, "9e107d9d372bb6826bd81d3542a419d6"));
@@ -44,4 +57,10 @@ void CryptoUtilTest() {
                             "d7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592"));
     utassert(TestDigestSHA2("The quick brown fox jumps over the lazy dog.", 44,
                             "ef537f25c895bfa782526529a9b63d97aa631564d5d789c2b765448c8635fb6c"));
+
+    const char* fox = "The quick brown fox jumps over the lazy dog";
+    utassert(TestDigestCalc(DigestKind::MD5, fox, "9e107d9d372bb6826bd81d3542a419d6"));
+    utassert(TestDigestCalc(DigestKind::SHA1, fox, "2fd4e1c67a2d28fced849ee1bb76e7391b93eb12"));
+    utassert(
+        TestDigestCalc(DigestKind::SHA2, fox, "d7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592"));
 }
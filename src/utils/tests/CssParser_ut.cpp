@@ -2,8 +2,10 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -184,6 +186,89 @@ static void Test08() {
     utassert(!ok);
 }
 
+static void Test09() {
+    const char* simpleCss = "p.note, .note, *, span, p#id, .other { color: red }";
+    CssPullParser parser(simpleCss, str::Len(simpleCss));
+    StringInterner classes;
+    CssSelectorKey key;
+    bool ok = parser.NextRule();
+    utassert(ok);
+
+    const CssSelector* sel = parser.NextSelector();
+    utassert(sel && CompileCssSelector(sel, &classes, &key));
+    utassert(Tag_P == key.tag && key.classId == 0);
+    sel = parser.NextSelector();
+    utassert(sel && CompileCssSelector(sel, &classes, &key));
+    utassert(Tag_Any == key.tag && key.classId == 0);
+    sel = parser.NextSelector();
+    utassert(sel && CompileCssSelector(sel, &classes, &key));
+    utassert(Tag_Any == key.tag && key.classId == -1);
+    sel = parser.NextSelector();
+    utassert(sel && CompileCssSelector(sel, &classes, &key));
+    utassert(Tag_Span == key.tag && key.classId == -1);
+    sel = parser.NextSelector();
+    utassert(sel && !CompileCssSelector(sel, &classes, &key));
+    sel = parser.NextSelector();
+    utassert(sel && CompileCssSelector(sel, &classes, &key));
+    utassert(Tag_Any == key.tag && key.classId == 1);
+    sel = parser.NextSelector();
+    utassert(!sel);
+
+    utassert(0 == FindCssClassId(&classes, "note", 4));
+    utassert(1 == FindCssClassId(&classes, "other-class", 5));
+    utassert(-1 == FindCssClassId(&classes, "Note", 4));
+}
+
+// prints how long it takes to parse and compile a big style sheet
+// (publisher EPUBs can have thousands of rules) and to look up classes
+static void CssBenchmark() {
+    constexpr int kRules = 20000;
+    constexpr int kLookups = 10;
+    str::Str css;
+    for (int i = 0; i < kRules; i++) {
+        css.AppendFmt("p.c%d, .c%d > span, div.c%d { text-indent: %dem; color: red; text-align: center }\n", i, i,
+                      i, i % 5);
+    }
+
+    auto timeStart = TimeGet();
+    StringInterner classes;
+    CssPullParser parser(css.Get(), css.size());
+    int nSelectors = 0;
+    int nProps = 0;
+    CssSelectorKey key;
+    while (parser.NextRule()) {
+        while (parser.NextProperty()) {
+            nProps++;
+        }
+        const CssSelector* sel;
+        while ((sel = parser.NextSelector()) != nullptr) {
+            if (CompileCssSelector(sel, &classes, &key)) {
+                nSelectors++;
+            }
+        }
+    }
+    double parseMs = TimeSinceInMs(timeStart);
+    utassert(nProps == kRules * 3);
+    utassert(nSelectors == kRules * 2);
+    utassert(classes.StringsCount() == kRules);
+
+    char buf[32];
+    timeStart = TimeGet();
+    int nFound = 0;
+    for (int n = 0; n < kLookups; n++) {
+        for (int i = 0; i < kRules; i++) {
+            str::BufFmt(buf, dimof(buf), "c%d", i);
+            if (FindCssClassId(&classes, buf, str::Len(buf)) == i) {
+                nFound++;
+            }
+        }
+    }
+    double lookupMs = TimeSinceInMs(timeStart);
+    utassert(nFound == kRules * kLookups);
+    printf("CssPullParser: %d rules parsed and compiled in %.2f ms, %d class lookups in %.2f ms\n", kRules, parseMs,
+           kRules * kLookups, lookupMs);
+}
+
 void CssParser_UnitTests() {
     Test01();
     Test02();
@@ -193,4 +278,6 @@ void CssParser_UnitTests() {
     Test06();
     Test07();
     Test08();
+    Test09();
+    CssBenchmark();
 }
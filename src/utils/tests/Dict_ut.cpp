@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -77,6 +78,71 @@ void DictTestMapStrToInt() {
     toRemove.FreeMembers();
 }
 
+static void DictTestMapWStrToInt() {
+    dict::MapWStrToInt d(4);
+    int val = 0;
+    bool ok;
+    char buf[32];
+    for (int i = 0; i < 200; i++) {
+        str::BufFmt(buf, dimof(buf), "key %d", i);
+        TempWstr k = ToWstrTemp(buf);
+        ok = d.Insert(k, i, nullptr);
+        utassert(ok);
+    }
+    utassert(200 == d.Count());
+    // removing leaves deleted slots that must not break lookups
+    for (int i = 0; i < 200; i += 2) {
+        str::BufFmt(buf, dimof(buf), "key %d", i);
+        TempWstr k = ToWstrTemp(buf);
+        ok = d.Remove(k, &val);
+        utassert(ok && val == i);
+    }
+    utassert(100 == d.Count());
+    for (int i = 0; i < 200; i++) {
+        str::BufFmt(buf, dimof(buf), "key %d", i);
+        TempWstr k = ToWstrTemp(buf);
+        ok = d.Get(k, &val);
+        utassert(ok == (i % 2 == 1));
+        utassert(!ok || val == i);
+    }
+}
+
+// prints how long it takes to insert and look up many short strings
+// (like tag / attribute names and settings keys passed to StringInterner)
+static void DictBenchmark() {
+    constexpr int kKeys = 50000;
+    constexpr int kLookups = 10;
+    StrVec keys;
+    char buf[64];
+    for (int i = 0; i < kKeys; i++) {
+        str::BufFmt(buf, dimof(buf), "key-%d-%x", i, i * 7919);
+        keys.Append(buf);
+    }
+    auto timeStart = TimeGet();
+    dict::MapStrToInt d;
+    for (int i = 0; i < kKeys; i++) {
+        d.Insert(keys.at(i), i, nullptr);
+    }
+    double insertMs = TimeSinceInMs(timeStart);
+
+    timeStart = TimeGet();
+    int nFound = 0;
+    int val;
+    for (int n = 0; n < kLookups; n++) {
+        for (int i = 0; i < kKeys; i++) {
+            if (d.Get(keys.at(i), &val)) {
+                nFound++;
+            }
+        }
+    }
+    double getMs = TimeSinceInMs(timeStart);
+    utassert(nFound == kKeys * kLookups);
+    printf("dict::MapStrToInt: %d inserts in %.2f ms, %d lookups in %.2f ms\n", kKeys, insertMs, kKeys * kLookups,
+           getMs);
+}
+
 void DictTest() {
     DictTestMapStrToInt();
+    DictTestMapWStrToInt();
+    DictBenchmark();
 }
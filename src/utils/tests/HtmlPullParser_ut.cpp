@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -108,6 +109,81 @@ static void Test03() {
     utassert(!t);
 }
 
+// delimiters at all positions relative to the 16 byte blocks that are scanned at once
+static void Test04() {
+    for (int n = 0; n < 40; n++) {
+        str::Str s;
+        s.Append("<p a='");
+        for (int i = 0; i < n; i++) {
+            s.AppendChar('>');
+        }
+        s.Append("' b=");
+        for (int i = 0; i < n; i++) {
+            s.AppendChar('x');
+        }
+        s.Append(">text");
+        for (int i = 0; i < n; i++) {
+            s.AppendChar('-');
+        }
+        s.Append("<!-- -- -->");
+        HtmlPullParser parser(s.Get(), s.size());
+        HtmlToken* t = parser.Next();
+        utassert(t && t->IsStartTag() && Tag_P == t->tag);
+        AttrInfo* a = t->GetAttrByName("a");
+        utassert(a && a->valLen == (size_t)n);
+        a = t->GetAttrByName("b");
+        utassert(a && a->valLen == (size_t)n);
+        t = parser.Next();
+        utassert(t && t->IsText() && t->sLen == 4 + (size_t)n);
+        t = parser.Next();
+        utassert(!t);
+    }
+    // the data after end must not be looked at
+    const char* s = "<p a='x'><p a='xxxxxxxxxxxxxxxxxxxxxxxxxxxx'>";
+    HtmlPullParser parser(s, 20);
+    HtmlToken* t = parser.Next();
+    utassert(t && t->IsStartTag());
+    t = parser.Next();
+    utassert(t && t->IsError() && HtmlToken::UnclosedTag == t->error);
+    const char* curr = s;
+    utassert(!SkipUntil(curr, s + 2, 'a') && curr == s + 2);
+    curr = s;
+    utassert(!SkipUntil(curr, s + 9, "><p") && curr == s + 9);
+    curr = s;
+    utassert(SkipUntil(curr, s + 11, "><p") && curr == s + 8);
+}
+
+// measures how fast a big document with many attributes is tokenized
+static void HtmlPullParserBenchmark() {
+    constexpr int kParagraphs = 20000;
+    constexpr int kIterations = 10;
+
+    str::Str html;
+    html.Append("<html><head><title>Benchmark</title></head><body>");
+    for (int i = 0; i < kParagraphs; i++) {
+        html.AppendFmt("<p class=\"para%d\" style=\"text-indent: 1em\">", i % 50);
+        html.Append("Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor ");
+        html.Append("<a href=\"chapter2.html#note\">incididunt</a> ut labore et dolore magna aliqua.</p>\n");
+    }
+    html.Append("</body></html>");
+
+    auto timeStart = TimeGet();
+    int nTags = 0;
+    for (int i = 0; i < kIterations; i++) {
+        HtmlPullParser parser(html.Get(), html.size());
+        for (HtmlToken* t = parser.Next(); t && !t->IsError(); t = parser.Next()) {
+            if (t->IsStartTag() && t->GetAttrByName("class")) {
+                nTags++;
+            }
+        }
+    }
+    utassert(nTags == kParagraphs * kIterations);
+    double durMs = TimeSinceInMs(timeStart);
+    double sizeMb = (double)html.size() * kIterations / (1024.0 * 1024.0);
+    printf("HtmlPullParser: parsed %.1f MB in %.2f ms (%.1f MB/s)\n", sizeMb, durMs,
+           durMs > 0 ? sizeMb * 1000.0 / durMs : 0.0);
+}
+
 void HtmlPullParser_UnitTests() {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
     Test00("<p a1 ='>'     foo=\"bar\"/>", HtmlToken::EmptyElementTag);
@@ -118,4 +194,6 @@ void HtmlPullParser_UnitTests() {
     Test01();
     Test02();
     Test03();
+    Test04();
+    HtmlPullParserBenchmark();
 }
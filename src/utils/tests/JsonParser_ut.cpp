@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/JsonParser.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -42,6 +43,97 @@ class JsonVerifier : public json::ValueVisitor {
     }
 };
 
+class JsonPathCollector : public json::PathVisitor {
+  public:
+    str::Str visited;
+    int nVisited = 0;
+    int stopAfter = -1;
+
+    bool Visit(int pathIdx, int arrayIdx, StrSpan value, json::Type) override {
+        visited.AppendFmt("%d:%d:", pathIdx, arrayIdx);
+        visited.Append(value.data(), value.size());
+        visited.AppendChar(';');
+        nVisited++;
+        return nVisited != stopAfter;
+    }
+};
+
+class JsonCounter : public json::ValueVisitor {
+  public:
+    int nVisited = 0;
+
+    bool Visit(const char*, const char*, json::Type) override {
+        nVisited++;
+        return true;
+    }
+};
+
+static void JsonPathTest(const char* jsonSample) {
+    static const char* paths[] = {
+        "/ComicBookInfo/1.0/title",
+        "/ComicBookInfo/1.0/credits[*]/role",
+        "/ComicBookInfo/1.0/credits[2]",
+        "/appID",
+        "/ComicBookInfo/1.0/credits",
+    };
+    json::PathSet set(paths, dimof(paths));
+    JsonPathCollector collector;
+    utassert(json::Parse(jsonSample, set, &collector));
+    const char* expected = "0:-1:Meta data demo;1:0:Writer;1:1:Publisher;2:-1:null;3:-1:Test/123;";
+    utassert(str::Eq(collector.visited.Get(), expected));
+
+    JsonPathCollector canceled;
+    canceled.stopAfter = 2;
+    utassert(json::Parse(jsonSample, set, &canceled));
+    utassert(canceled.nVisited == 2);
+
+    // escaped keys and values are unescaped, everything else is still validated
+    JsonPathCollector escaped;
+    utassert(json::Parse("{\"a\":1,\"app\\u0049D\":\"x\\ty\"}", set, &escaped));
+    utassert(str::Eq(escaped.visited.Get(), "3:-1:x\ty;"));
+    static const char* invalidJson[] = {"{\"a\":1,}", "[1,]", "{\"a\":\"\\x\"}", "{\"a\" 1}", "{\"a\":[01]}"};
+    for (const char* s : invalidJson) {
+        JsonPathCollector c;
+        utassert(!json::Parse(s, set, &c));
+    }
+}
+
+// prints how long it takes to extract a few values from a big document
+// with either API (ComicBookInfo comments often list many credits)
+static void JsonBenchmark() {
+    constexpr int kCredits = 20000;
+    constexpr int kRuns = 5;
+    str::Str s;
+    s.Append("{\"ComicBookInfo/1.0\": {\"credits\": [");
+    for (int i = 0; i < kCredits; i++) {
+        s.AppendFmt("%s{\"person\": \"Person %d\", \"role\": \"Artist\", \"primary\": false}", i > 0 ? "," : "",
+                    i);
+    }
+    s.Append("], \"title\": \"Benchmark\"}, \"appID\": \"Test/123\"}");
+
+    auto timeStart = TimeGet();
+    int nValues = 0;
+    for (int n = 0; n < kRuns; n++) {
+        JsonCounter counter;
+        utassert(json::Parse(s.Get(), &counter));
+        nValues = counter.nVisited;
+    }
+    double valueMs = TimeSinceInMs(timeStart);
+    utassert(nValues == kCredits * 3 + 2);
+
+    static const char* paths[] = {"/ComicBookInfo/1.0/title", "/appID"};
+    json::PathSet set(paths, dimof(paths));
+    timeStart = TimeGet();
+    for (int n = 0; n < kRuns; n++) {
+        JsonPathCollector collector;
+        utassert(json::Parse(s.Get(), set, &collector));
+        utassert(collector.nVisited == 2);
+    }
+    double pathMs = TimeSinceInMs(timeStart);
+    double mb = (double)(s.size() * kRuns) / (1024.0 * 1024.0);
+    printf("json::Parse: %.2f MB with ValueVisitor in %.2f ms, with PathSet in %.2f ms\n", mb, valueMs, pathMs);
+}
+
 void JsonTest() {
     static const struct {
         const char* json;
@@ -135,4 +227,7 @@ void JsonTest() {
 }";
     JsonVerifier sampleVerifier(testData, dimof(testData));
     utassert(json::Parse(jsonSample, &sampleVerifier));
+
+    JsonPathTest(jsonSample);
+    JsonBenchmark();
 }
@@ -3,10 +3,67 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/SquareTreeParser.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
+// per-document part of a settings file with a big file history
+static const char* benchFileState =
+    "\t\tIsPinned = false\r\n"
+    "\t\tIsMissing = false\r\n"
+    "\t\tOpenCount = 3\r\n"
+    "\t\tUseDefaultState = false\r\n"
+    "\t\tDisplayMode = automatic\r\n"
+    "\t\tScrollPos = 0 1234\r\n"
+    "\t\tPageNo = 17\r\n"
+    "\t\tZoom = fit page\r\n"
+    "\t\tRotation = 0\r\n"
+    "\t\tWindowState = 1\r\n"
+    "\t\tWindowPos = 120 80 1280 900\r\n"
+    "\t\tShowToc = true\r\n"
+    "\t\tSidebarDx = 240\r\n"
+    "\t\tDisplayR2L = false\r\n"
+    "\t\tReparseIdx = 0\r\n"
+    "\t\tTocState = 1 4 9\r\n"
+    "\t\tFavorites [\r\n"
+    "\t\t\t[\r\n"
+    "\t\t\t\tName = Introduction\r\n"
+    "\t\t\t\tPageNo = 3\r\n"
+    "\t\t\t]\r\n"
+    "\t\t]\r\n";
+
+// measures how fast a settings file with a big file history is parsed
+static void SquareTreeBenchmark() {
+    constexpr int kFileStates = 2000;
+    constexpr int kIterations = 10;
+
+    str::Str data;
+    data.Append(UTF8_BOM);
+    data.Append("FileStates [\r\n");
+    for (int i = 0; i < kFileStates; i++) {
+        data.Append("\t[\r\n");
+        data.AppendFmt("\t\tFilePath = C:\\Users\\Test\\Documents\\document %d.pdf\r\n", i);
+        data.Append(benchFileState);
+        data.Append("\t]\r\n");
+    }
+    data.Append("]\r\n");
+
+    auto timeStart = TimeGet();
+    for (int i = 0; i < kIterations; i++) {
+        SquareTree sqt(data.Get());
+        SquareTreeNode* states = sqt.root ? sqt.root->GetChild("FileStates") : nullptr;
+        utassert(states && kFileStates == states->data.size());
+        SquareTreeNode* last = states->data.Last().value.child;
+        utassert(str::Eq(last->GetValue("PageNo"), "17"));
+        utassert(str::EndsWith(last->GetValue("FilePath"), "document 1999.pdf"));
+    }
+    double durMs = TimeSinceInMs(timeStart);
+    double sizeMb = (double)data.size() * kIterations / (1024.0 * 1024.0);
+    printf("SquareTree: parsed %.1f MB in %.2f ms (%.1f MB/s)\n", sizeMb, durMs,
+           durMs > 0 ? sizeMb * 1000.0 / durMs : 0.0);
+}
+
 void SquareTreeTest() {
     static const char* keyValueData[] = {
         UTF8_BOM "key = value",  UTF8_BOM "key = value",    UTF8_BOM "key=value",
@@ -159,4 +216,6 @@ void SquareTreeTest() {
     utassert(mixed.root && mixed.root->GetChild("node1") && mixed.root->GetChild("node2"));
     utassert(0 == mixed.root->GetChild("node1")->data.size());
     utassert(str::Eq(mixed.root->GetChild("node2")->GetValue("Key"), "value"));
+
+    SquareTreeBenchmark();
 }
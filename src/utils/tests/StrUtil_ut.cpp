@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Timer.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -110,6 +111,90 @@ static void StrConvTest() {
 #endif
 }
 
+// compare with converting by asking for the size first
+static void CheckUtf8Conv(const char* s, size_t cb) {
+    int cch = MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, nullptr, 0);
+    WCHAR* exp = AllocArray<WCHAR>((size_t)cch + 1);
+    MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, exp, cch);
+    WCHAR* ws = strconv::Utf8ToWstr(s, cb);
+    utassert(str::Eq(ws, exp));
+
+    char* back = strconv::WstrToUtf8(ws);
+    int cbExp = WideCharToMultiByte(CP_UTF8, 0, ws, -1, nullptr, 0, nullptr, nullptr);
+    utassert(str::Len(back) + 1 == (size_t)cbExp);
+
+    WCHAR wbuf[64];
+    size_t n = strconv::Utf8ToWcharBuf(StrSpan(s, cb), wbuf, dimof(wbuf));
+    utassert(n == (size_t)cch && str::Eq(wbuf, exp));
+    free(exp);
+    free(ws);
+    free(back);
+}
+
+static void StrConvFastPathTest() {
+    // non-ascii chars before, inside and after the 16 byte blocks
+    const char* nonAscii[] = {"\xc3\xa4", "\xe2\x82\xac", "\xf0\x90\x82\x80", "\xff"};
+    char buf[64];
+    for (const char* na : nonAscii) {
+        size_t naLen = str::Len(na);
+        for (size_t len = 0; len < 40; len++) {
+            memset(buf, 'a', len);
+            CheckUtf8Conv(buf, len);
+            for (size_t pos = 0; pos + naLen <= len; pos++) {
+                memset(buf, 'a', len);
+                memcpy(buf + pos, na, naLen);
+                CheckUtf8Conv(buf, len);
+            }
+        }
+    }
+}
+
+static void StrConvBenchmark() {
+    const size_t cb = 1024 * 1024;
+    const int nRounds = 20;
+    char* ascii = AllocArray<char>(cb + 1);
+    char* mixed = AllocArray<char>(cb + 1);
+    for (size_t i = 0; i < cb; i++) {
+        ascii[i] = (char)('a' + i % 26);
+        // 2 byte sequence every 32 chars
+        mixed[i] = (i % 32 == 30) ? '\xc3' : (i % 32 == 31) ? '\xa4' : 'a';
+    }
+
+    const char* texts[] = {ascii, mixed};
+    const char* names[] = {"ascii", "mixed"};
+    for (int t = 0; t < 2; t++) {
+        const char* s = texts[t];
+        auto tm = TimeGet();
+        for (int r = 0; r < nRounds; r++) {
+            int cch = MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, nullptr, 0);
+            WCHAR* ws = AllocArray<WCHAR>((size_t)cch + 1);
+            MultiByteToWideChar(CP_UTF8, 0, s, (int)cb, ws, cch);
+            free(ws);
+        }
+        double twoPassMs = TimeSinceInMs(tm);
+
+        tm = TimeGet();
+        WCHAR* ws = nullptr;
+        for (int r = 0; r < nRounds; r++) {
+            free(ws);
+            ws = strconv::Utf8ToWstr(s, cb);
+        }
+        double utf8ToWstrMs = TimeSinceInMs(tm);
+
+        tm = TimeGet();
+        for (int r = 0; r < nRounds; r++) {
+            char* back = strconv::WstrToUtf8(ws);
+            free(back);
+        }
+        double wstrToUtf8Ms = TimeSinceInMs(tm);
+        free(ws);
+        printf("utf8 conversion (%s): two pass %.2f ms, Utf8ToWstr %.2f ms, WstrToUtf8 %.2f ms\n", names[t],
+               twoPassMs, utf8ToWstrMs, wstrToUtf8Ms);
+    }
+    free(ascii);
+    free(mixed);
+}
+
 static void StrUrlExtractTest() {
     utassert(!url::GetFileName(""));
     utassert(!url::GetFileName("#hash_only"));
@@ -427,6 +512,60 @@ static void StrVecTest3() {
     CheckRemoveAt(v);
 }
 
+static void StrSpanTest() {
+    // not zero-terminated in the middle of the buffer
+    const char* buf = "  12.5em, Arial,,x  ";
+    StrSpan all(buf);
+    StrSpan sp(buf + 2, 4);
+    utassert(str::Eq(sp, "12.5"));
+    utassert(!str::Eq(sp, "12.5e"));
+    utassert(!str::Eq(sp, "12."));
+    utassert(str::EqI(StrSpan("ArIaL"), "arial"));
+    utassert(str::Eq(StrSpan(), nullptr) && !str::Eq(StrSpan(), ""));
+    utassert(str::StartsWith(sp, "12") && !str::StartsWith(sp, "12.5e"));
+    utassert(str::StartsWithI(StrSpan("EMx", 2), "em"));
+    utassert(str::FindChar(sp, 'e') == nullptr);
+    utassert(str::FindChar(all, 'e') == buf + 6);
+    utassert(str::Find(all, "Arial") == buf + 10);
+    utassert(str::Find(sp, "5em") == nullptr);
+    utassert(str::Find(all, "") == buf);
+    utassert(str::Eq(sp.Sub(1, 2), "2.") && sp.Sub(10).empty() && str::Eq(sp.Sub(2), ".5"));
+
+    StrSpan trimmed = str::TrimWs(all);
+    utassert(trimmed.data() == buf + 2 && trimmed.size() == 16);
+    utassert(str::TrimWs(StrSpan("   ")).empty());
+
+    float f = 0;
+    StrSpan rest;
+    utassert(str::ParseFloat(trimmed, &f, &rest) && f == 12.5f);
+    utassert(str::StartsWith(rest, "em,"));
+    int n = 0;
+    utassert(str::ParseInt(StrSpan("-42px", 3), &n, &rest) && n == -42 && rest.empty());
+    utassert(!str::ParseInt(StrSpan("x1"), &n));
+    utassert(!str::ParseInt(StrSpan(), &n));
+    // the number is cut at the end of the span
+    utassert(str::ParseInt(StrSpan("123", 2), &n) && n == 12);
+
+    const char* parts[] = {"12.5em", " Arial", "", "x"};
+    StrSpan s = trimmed;
+    StrSpan part;
+    int i = 0;
+    while (str::NextPart(s, ',', part)) {
+        utassert(i < (int)dimof(parts) && str::Eq(part, parts[i]));
+        i++;
+    }
+    utassert(i == 4);
+
+    WCHAR wbuf[8];
+    utassert(strconv::Utf8ToWcharBuf(StrSpan("t\xc3\xa4st!", 5), wbuf, dimof(wbuf)) == 4);
+    utassert(str::Eq(wbuf, L"t\xe4st"));
+    utassert(strconv::Utf8ToWcharBuf(StrSpan("too long for it"), wbuf, dimof(wbuf)) == 0 && !wbuf[0]);
+    char cbuf[8];
+    utassert(strconv::WcharToUtf8Buf(L"t\xe4st", (size_t)-1, cbuf, dimof(cbuf)) == 5);
+    utassert(str::Eq(cbuf, "t\xc3\xa4st"));
+    utassert(str::Eq(str::DupTemp(sp), "12.5"));
+}
+
 void StrTest() {
     WCHAR buf[32];
     const WCHAR* str = L"a string";
@@ -851,9 +990,12 @@ void StrTest() {
     StrReplaceTest();
     StrSeqTest();
     StrConvTest();
+    StrConvFastPathTest();
+    StrConvBenchmark();
     StrUrlExtractTest();
     // ParseUntilTest();
     StrVecTest();
     StrVecTest2();
     StrVecTest3();
+    StrSpanTest();
 }
@@ -0,0 +1,85 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/TextMatcher.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static WCHAR* BuildAsciiLowerCase() {
+    WCHAR* table = AllocArray<WCHAR>(0x10000);
+    for (int i = 0; i < 0x10000; i++) {
+        table[i] = (i >= 'A' && i <= 'Z') ? (WCHAR)(i + 'a' - 'A') : (WCHAR)i;
+    }
+    return table;
+}
+
+// checks that the first match of pattern in s is [start, end)
+static bool MatchesAt(const WCHAR* pattern, const WCHAR* s, int start, int end, const WCHAR* lowerCase = nullptr) {
+    TextMatcher* m = CompileTextMatcher(pattern, lowerCase);
+    if (!m) {
+        return false;
+    }
+    int startFound = -1, endFound = -1;
+    bool found = m->Find(s, (int)str::Len(s), 0, &startFound, &endFound);
+    delete m;
+    if (start < 0) {
+        return !found;
+    }
+    return found && start == startFound && end == endFound;
+}
+
+static bool IsInvalid(const WCHAR* pattern) {
+    TextMatcher* m = CompileTextMatcher(pattern, nullptr);
+    delete m;
+    return !m;
+}
+
+void TextMatcherTest() {
+    // literal alternatives (Aho-Corasick)
+    utassert(MatchesAt(L"foo", L"a foo b", 2, 5));
+    utassert(MatchesAt(L"foo|bar", L"a bar foo", 2, 5));
+    utassert(MatchesAt(L"x|yz|xyz", L"axyz", 1, 4));
+    utassert(MatchesAt(L"abc|d", L"xxabd", 4, 5));
+    utassert(MatchesAt(L"foo", L"fo", -1, -1));
+    utassert(MatchesAt(L"foo bar", L"foo \n\tbar", 0, 9));
+
+    // general expressions (bit-parallel)
+    utassert(MatchesAt(L"\\d+", L"ab 123 c", 3, 6));
+    utassert(MatchesAt(L"[^\\d]+", L"12ab3", 2, 4));
+    utassert(MatchesAt(L"a{2,}", L"caaaa", 1, 5));
+    utassert(MatchesAt(L"(?:ab)+", L"ababx", 0, 4));
+    utassert(MatchesAt(L"B+(a|bc)*", L"Bbc", 0, 3));
+    utassert(MatchesAt(L"a\\.b", L"axb a.b", 4, 7));
+    utassert(MatchesAt(L"\\u0041", L"zA", 1, 2));
+    utassert(MatchesAt(L"colou?r", L"a color", 2, 7));
+    utassert(MatchesAt(L"\\w+ \\w+", L"hello   world", 0, 13));
+
+    // case folding
+    WCHAR* lower = BuildAsciiLowerCase();
+    utassert(MatchesAt(L"FOO|bar", L"xBaR", 1, 4, lower));
+    utassert(MatchesAt(L"[a-c]+x", L"CbAX", 0, 4, lower));
+    utassert(MatchesAt(L"[a-c]+x", L"CbAX", -1, -1));
+    free(lower);
+
+    // searching backward
+    {
+        TextMatcher* m = CompileTextMatcher(L"ab", nullptr);
+        int start, end;
+        utassert(m->FindLast(L"abab abab", 9, 5, &start, &end));
+        utassert(start == 2 && end == 4);
+        utassert(!m->FindLast(L"abab abab", 9, 0, &start, &end));
+        delete m;
+    }
+
+    utassert(IsInvalid(L"^a"));
+    utassert(IsInvalid(L"a$"));
+    utassert(IsInvalid(L"a*"));
+    utassert(IsInvalid(L"(a"));
+    utassert(IsInvalid(L"a)"));
+    utassert(IsInvalid(L"[z-a]"));
+    utassert(IsInvalid(L"a{3,2}"));
+    utassert(IsInvalid(L"\\q"));
+    utassert(IsInvalid(L"[a-z]{70}"));
+}
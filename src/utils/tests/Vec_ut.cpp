@@ -5,6 +5,9 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <utils/VecSegmented.h>
+#include "utils/Timer.h"
+
+#include <vector>
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -41,8 +44,121 @@ static void VecSegmentedTest() {
     }
 }
 
+static void VecMoveTest() {
+    {
+        // elements still in buf are copied
+        Vec<int> v;
+        v.Append(3);
+        v.Append(5);
+        Vec<int> v2(std::move(v));
+        utassert(v2.size() == 2 && v2.at(0) == 3 && v2.at(1) == 5);
+        utassert(v.size() == 0);
+    }
+    {
+        // allocated elements are taken over
+        Vec<int> v;
+        for (int i = 0; i < 100; i++) {
+            v.Append(i);
+        }
+        int* els = v.LendData();
+        Vec<int> v2;
+        v2.Append(7);
+        v2 = std::move(v);
+        utassert(v2.size() == 100 && v2.LendData() == els && v2.at(99) == 99);
+        utassert(v.size() == 0 && v.LendData() != els);
+        v.Append(1);
+        utassert(v.size() == 1 && v.at(0) == 1);
+    }
+    {
+        Vec<int, 4> v;
+        v.AppendN(8, 3);
+        utassert(v.size() == 3 && v.at(2) == 8);
+        v.AppendN(9, 2);
+        utassert(v.size() == 5 && v.at(2) == 8 && v.at(3) == 9 && v.at(4) == 9);
+        v.AppendN(0, 0);
+        utassert(v.size() == 5);
+    }
+    {
+        Vec<int> v;
+        v.Reserve(1000);
+        int* els = v.LendData();
+        for (int i = 0; i < 1000; i++) {
+            v.Append(i);
+        }
+        utassert(v.size() == 1000 && v.LendData() == els);
+        // reserving less than the capacity is a no-op
+        v.Reserve(10);
+        utassert(v.LendData() == els && v.at(999) == 999);
+    }
+    {
+        Vec<int> v;
+        for (int i = 0; i < 100; i++) {
+            v.Append(i);
+        }
+        v.Compact();
+        utassert(v.size() == 100 && v.cap == 100 && v.at(99) == 99);
+        // still zero-terminated
+        utassert(v.LendData()[100] == 0);
+        v.Append(100);
+        utassert(v.size() == 101 && v.at(100) == 100);
+    }
+}
+
+static void VecBenchmark() {
+    const int n = 1000000;
+    const int nRounds = 10;
+    int sum = 0;
+
+    auto t = TimeGet();
+    for (int r = 0; r < nRounds; r++) {
+        Vec<int> v;
+        for (int i = 0; i < n; i++) {
+            v.Append(i);
+        }
+        sum += v.at(n / 2);
+    }
+    double vecMs = TimeSinceInMs(t);
+
+    t = TimeGet();
+    for (int r = 0; r < nRounds; r++) {
+        Vec<int> v;
+        v.Reserve(n);
+        for (int i = 0; i < n; i++) {
+            v.Append(i);
+        }
+        sum += v.at(n / 2);
+    }
+    double reservedMs = TimeSinceInMs(t);
+
+    t = TimeGet();
+    for (int r = 0; r < nRounds; r++) {
+        std::vector<int> v;
+        for (int i = 0; i < n; i++) {
+            v.push_back(i);
+        }
+        sum += v[n / 2];
+    }
+    double stdMs = TimeSinceInMs(t);
+
+    // small vectors shouldn't allocate at all
+    t = TimeGet();
+    for (int r = 0; r < n; r++) {
+        Vec<int> v;
+        for (int i = 0; i < 8; i++) {
+            v.Append(i);
+        }
+        sum += v.at(r % 8);
+    }
+    double smallMs = TimeSinceInMs(t);
+
+    printf("Vec append: %.2f ms, with Reserve: %.2f ms, std::vector: %.2f ms, small: %.2f ms (%d)\n", vecMs,
+           reservedMs, stdMs, smallMs, sum);
+}
+
 void VecTest() {
     VecSegmentedTest();
+    VecMoveTest();
+    VecBenchmark();
 
     Vec<int> ints;
     utassert(ints.size() == 0);
@@ -30,6 +30,13 @@ that it's actually a part of that window.
 #define COL_WHITE RGB(0xff, 0xff, 0xff)
 #define COL_BLACK RGB(0, 0, 0)
 
+static WCHAR* FormatFrameRate(FrameRateWnd* w) {
+    if (w->paintsPerSec < 0) {
+        return str::Format(L"%d", w->frameRate);
+    }
+    return str::Format(L"%d (%d/s)", w->frameRate, w->paintsPerSec);
+}
+
 static void FrameRatePaint(FrameRateWnd* w, HDC hdc, __unused PAINTSTRUCT& ps) {
     RECT rc = ClientRECT(w->hwnd);
     ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(COL_BLACK));
@@ -38,7 +45,7 @@ static void FrameRatePaint(FrameRateWnd* w, HDC hdc, __unused PAINTSTRUCT& ps) {
     SetTextColor(hdc, COL_WHITE);
 
     ScopedSelectObject selFont(hdc, w->font);
-    AutoFreeWstr txt(str::Format(L"%d", w->frameRate));
+    AutoFreeWstr txt(FormatFrameRate(w));
     DrawCenteredText(hdc, rc, txt);
 }
 
@@ -50,7 +57,7 @@ static void PositionWindow(FrameRateWnd* w, SIZE s) {
 }
 
 static SIZE GetIdealSize(FrameRateWnd* w) {
-    WCHAR* txt = str::Format(L"%d", w->frameRate);
+    WCHAR* txt = FormatFrameRate(w);
     Size s = TextSizeInHwnd(w->hwnd, txt);
 
     // add padding
@@ -182,6 +189,15 @@ void FrameRateWnd::ShowFrameRateDur(double durMs) {
     this->ShowFrameRate(FrameRateFromDuration(durMs));
 }
 
+void FrameRateWnd::ShowFrameStats(double durMs, int paintsPerSec) {
+    if (this->paintsPerSec != paintsPerSec) {
+        // make sure that ShowFrameRate() updates the window
+        this->frameRate = -1;
+        this->paintsPerSec = paintsPerSec;
+    }
+    this->ShowFrameRate(FrameRateFromDuration(durMs));
+}
+
 FrameRateWnd::~FrameRateWnd() {
     RemoveWindowSubclass(this->hwndAssociatedWithTopLevel, WndProcFrameRateAssociated, 0);
 }
@@ -9,6 +9,8 @@ struct FrameRateWnd {
 
     void ShowFrameRate(int frameRate);
     void ShowFrameRateDur(double durMs);
+    // durMs is how long the last paint took, paintsPerSec how many paints actually happen
+    void ShowFrameStats(double durMs, int paintsPerSec);
 
     HWND hwndAssociatedWith = nullptr;
     HWND hwndAssociatedWithTopLevel = nullptr;
@@ -18,6 +20,7 @@ struct FrameRateWnd {
 
     SIZE maxSizeSoFar = {0, 0};
     int frameRate = -1;
+    int paintsPerSec = -1;
 };
 
 int FrameRateFromDuration(double durMs);
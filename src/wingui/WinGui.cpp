@@ -2782,14 +2782,9 @@ TVITEMW* GetTVITEM(TreeView* tree, TreeItem ti) {
 // expand if collapse, collapse if expanded
 void TreeViewToggle(TreeView* tree, HTREEITEM hItem, bool recursive) {
     HWND hTree = tree->hwnd;
-    HTREEITEM child = TreeView_GetChild(hTree, hItem);
-    if (!child) {
-        // only applies to nodes with children
-        return;
-    }
-
     TVITEMW* item = GetTVITEM(tree, hItem);
-    if (!item) {
+    // only applies to nodes with children (which might not be inserted yet)
+    if (!item || item->cChildren == 0) {
         return;
     }
     uint flag = TVE_EXPAND;
@@ -2888,7 +2883,7 @@ TreeItem TreeView::GetSelection() {
 bool TreeView::SelectItem(TreeItem ti) {
     HTREEITEM hi = nullptr;
     if (ti != TreeModel::kNullItem) {
-        hi = GetHandleByTreeItem(ti);
+        hi = InsertItemIfNeeded(ti);
     }
     BOOL ok = TreeView_SelectItem(hwnd, hi);
     return ok == TRUE;
@@ -2966,8 +2961,10 @@ TreeItem TreeView::GetTreeItemByHandle(HTREEITEM item) {
 }
 
 static void FillTVITEM(TVITEMEXW* tvitem, TreeModel* tm, TreeItem ti) {
-    uint mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE;
+    uint mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE | TVIF_CHILDREN;
     tvitem->mask = mask;
+    // children might not be inserted yet, but the expand button must be shown
+    tvitem->cChildren = tm->ChildCount(ti) > 0 ? 1 : 0;
 
     uint stateMask = TVIS_EXPANDED;
     uint state = 0;
@@ -2997,7 +2994,7 @@ HTREEITEM insertItemFront(TreeView* treeView, TreeItem ti, HTREEITEM parent) {
 }
 
 bool TreeView::UpdateItem(TreeItem ti) {
-    HTREEITEM ht = GetHandleByTreeItem(ti);
+    HTREEITEM ht = InsertItemIfNeeded(ti);
     CrashIf(!ht);
     if (!ht) {
         return false;
@@ -3012,6 +3009,8 @@ bool TreeView::UpdateItem(TreeItem ti) {
 
 // complicated because it inserts items backwards, as described in
 // https://devblogs.microsoft.com/oldnewthing/20111125-00/?p=9033
+// To keep big trees (e.g. 100k bookmarks) fast, only children of expanded
+// items are inserted. The rest is inserted in TVN_ITEMEXPANDING
 void PopulateTreeItem(TreeView* treeView, TreeItem item, HTREEITEM parent) {
     auto tm = treeView->treeModel;
     int n = tm->ChildCount(item);
@@ -3034,7 +3033,7 @@ void PopulateTreeItem(TreeView* treeView, TreeItem item, HTREEITEM parent) {
         HTREEITEM h = insertItemFront(treeView, ti, parent);
         tm->SetHandle(ti, h);
         // avoid recursing if not needed because we use a lot of stack space
-        if (tm->ChildCount(ti) > 0) {
+        if (tm->IsExpanded(ti) && tm->ChildCount(ti) > 0) {
             PopulateTreeItem(treeView, ti, h);
         }
     }
@@ -3045,10 +3044,48 @@ void PopulateTreeItem(TreeView* treeView, TreeItem item, HTREEITEM parent) {
 }
 
 static void PopulateTree(TreeView* treeView, TreeModel* tm) {
+    // handles left over from a previous SetTreeModel() would be stale
+    VisitTreeModelItems(tm, [](TreeModel* tm, TreeItem ti) {
+        tm->SetHandle(ti, nullptr);
+        return true;
+    });
     TreeItem root = tm->Root();
     PopulateTreeItem(treeView, root, nullptr);
 }
 
+// inserts children of item unless they already are
+static void PopulateTreeItemIfNeeded(TreeView* treeView, TreeItem item, HTREEITEM hItem) {
+    HWND hwnd = treeView->hwnd;
+    HTREEITEM child = hItem ? TreeView_GetChild(hwnd, hItem) : TreeView_GetRoot(hwnd);
+    if (child) {
+        return;
+    }
+    PopulateTreeItem(treeView, item, hItem);
+}
+
+// items are only inserted when their parent is expanded, so an item
+// we need a handle for (e.g. to select it) might have to be inserted first
+HTREEITEM TreeView::InsertItemIfNeeded(TreeItem ti) {
+    TreeModel* tm = treeModel;
+    HTREEITEM res = tm->GetHandle(ti);
+    TreeItem root = tm->Root();
+    if (res || ti == TreeModel::kNullItem || ti == root) {
+        return res;
+    }
+    TreeItem parent = tm->Parent(ti);
+    HTREEITEM hParent = nullptr;
+    if (parent == TreeModel::kNullItem) {
+        parent = root;
+    } else if (parent != root) {
+        hParent = InsertItemIfNeeded(parent);
+        if (!hParent) {
+            return nullptr;
+        }
+    }
+    PopulateTreeItemIfNeeded(this, parent, hParent);
+    return tm->GetHandle(ti);
+}
+
 void TreeView::SetTreeModel(TreeModel* tm) {
     CrashIf(!tm);
 
@@ -3065,13 +3102,13 @@ void TreeView::SetTreeModel(TreeModel* tm) {
 }
 
 void TreeView::SetCheckState(TreeItem item, bool enable) {
-    HTREEITEM hi = GetHandleByTreeItem(item);
+    HTREEITEM hi = InsertItemIfNeeded(item);
     CrashIf(!hi);
     TreeView_SetCheckState(hwnd, hi, enable);
 }
 
 bool TreeView::GetCheckState(TreeItem item) {
-    HTREEITEM hi = GetHandleByTreeItem(item);
+    HTREEITEM hi = InsertItemIfNeeded(item);
     CrashIf(!hi);
     auto res = TreeView_GetCheckState(hwnd, hi);
     return res != 0;
@@ -3080,6 +3117,14 @@ bool TreeView::GetCheckState(TreeItem item) {
 TreeItemState TreeView::GetItemState(TreeItem ti) {
     TreeItemState res;
 
+    // not inserted yet, so it has the state it'll be inserted with
+    if (!GetHandleByTreeItem(ti)) {
+        res.isExpanded = treeModel->IsExpanded(ti);
+        res.isChecked = treeModel->IsChecked(ti);
+        res.nChildren = treeModel->ChildCount(ti);
+        return res;
+    }
+
     TVITEMW* it = GetTVITEM(this, ti);
     CrashIf(!it);
     if (!it) {
@@ -3174,6 +3219,15 @@ LRESULT TreeView::OnNotifyReflect(WPARAM wp, LPARAM lp) {
         return res;
     }
 
+    // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-itemexpanding
+    if (code == TVN_ITEMEXPANDING) {
+        if (nmtv->action & TVE_EXPAND) {
+            HTREEITEM hItem = nmtv->itemNew.hItem;
+            PopulateTreeItemIfNeeded(w, GetTreeItemByHandle(hItem), hItem);
+        }
+        return FALSE;
+    }
+
     // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-selchanged
     if (code == TVN_SELCHANGED) {
         log("tv: TVN_SELCHANGED\n");
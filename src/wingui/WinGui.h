@@ -604,6 +604,7 @@ struct TreeView : Wnd {
     char* GetDefaultTooltipTemp(TreeItem ti);
     TreeItem GetItemAt(int x, int y);
     TreeItem GetTreeItemByHandle(HTREEITEM item);
+    HTREEITEM InsertItemIfNeeded(TreeItem item);
     bool UpdateItem(TreeItem ti);
     void SetTreeModel(TreeModel* tm);
     void SetCheckState(TreeItem item, bool enable);